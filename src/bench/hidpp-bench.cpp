@@ -0,0 +1,615 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <hid/ReportDescriptor.h>
+#include <hid/UsageStrings.h>
+#include <hid/VirtualDevice.h>
+#include <hidpp/Dispatcher.h>
+#include <hidpp/DispatcherThread.h>
+#include <hidpp/Report.h>
+#include <hidpp/SimulatedReceiver.h>
+#include <hidpp10/MacroFormat.h>
+#include <hidpp10/ProfileFormatG500.h>
+#include <hidpp10/Sensor.h>
+#include <hidpp20/MacroFormat.h>
+#include <hidpp20/ProfileFormat.h>
+#include <misc/CRC.h>
+
+#include "MacroText.h"
+
+/*
+ * Each benchmark is run for a fixed time after calibrating its iteration
+ * count. Results are printed as one JSON object per line.
+ */
+
+static const char *filter = nullptr;
+static auto min_time = std::chrono::milliseconds (200);
+static constexpr unsigned int Repetitions = 5;
+
+// Prevent the compiler from removing the computation of value
+template <typename T>
+static inline void keep (const T &value)
+{
+#ifdef __GNUC__
+	asm volatile ("" : : "r,m" (value) : "memory");
+#else
+	static volatile const T *sink;
+	sink = &value;
+#endif
+}
+
+/**
+ * Run \p f (which does \p ops_per_call operations per call) and print its
+ * timings as "ns_min" and "ns_median" per operation.
+ */
+static void bench (const std::string &name, std::function<void ()> f, unsigned int ops_per_call = 1)
+{
+	using clock = std::chrono::steady_clock;
+	if (filter && name.find (filter) == std::string::npos)
+		return;
+	try {
+		uint64_t iterations = 1;
+		while (true) {
+			auto start = clock::now ();
+			for (uint64_t i = 0; i < iterations; ++i)
+				f ();
+			auto elapsed = clock::now () - start;
+			if (elapsed >= min_time / Repetitions || iterations >= (uint64_t (1) << 40))
+				break;
+			iterations *= 2;
+		}
+		std::vector<double> samples;
+		for (unsigned int r = 0; r < Repetitions; ++r) {
+			auto start = clock::now ();
+			for (uint64_t i = 0; i < iterations; ++i)
+				f ();
+			std::chrono::duration<double, std::nano> elapsed = clock::now () - start;
+			samples.push_back (elapsed.count () / (iterations * ops_per_call));
+		}
+		std::sort (samples.begin (), samples.end ());
+		printf ("{\"name\":\"%s\",\"iterations\":%llu,\"ns_min\":%.2f,\"ns_median\":%.2f}\n",
+			name.c_str (), static_cast<unsigned long long> (iterations * ops_per_call),
+			samples.front (), samples[samples.size ()/2]);
+	}
+	catch (std::exception &e) {
+		printf ("{\"name\":\"%s\",\"error\":\"%s\"}\n", name.c_str (), e.what ());
+	}
+	fflush (stdout);
+}
+
+static void benchReport ()
+{
+	using HIDPP::Report;
+	bench ("report/construct_long", [] () {
+		Report report (Report::Long, HIDPP::DefaultDevice, 0x05, 1, 1);
+		keep (report);
+	});
+	uint8_t raw[Report::reportLength (Report::Long)] = { Report::Long, 0xff, 0x05, 0x11 };
+	bench ("report/parse_raw_long", [&raw] () {
+		Report report (raw, HIDPP::Report::reportLength (Report::Long));
+		keep (report);
+	});
+	Report answer (Report::Long, HIDPP::DefaultDevice, 0x05, 1, 1);
+	Report error20 (Report::Long, HIDPP::DefaultDevice, 0xff, 0, 0);
+	error20.parameterBegin ()[0] = 0x05;
+	error20.parameterBegin ()[1] = 0x11;
+	error20.parameterBegin ()[2] = 0x02;
+	Report error10 (Report::Short, HIDPP::DefaultDevice, 0x8f, 0x81);
+	error10.parameterBegin ()[0] = 0x00;
+	error10.parameterBegin ()[1] = 0x02;
+	bench ("report/check_error10_answer", [&answer] () {
+		uint8_t sub_id, address, error;
+		keep (answer.checkErrorMessage10 (&sub_id, &address, &error));
+	});
+	bench ("report/check_error10_error", [&error10] () {
+		uint8_t sub_id, address, error;
+		keep (error10.checkErrorMessage10 (&sub_id, &address, &error));
+	});
+	bench ("report/check_error20_answer", [&answer] () {
+		uint8_t feature, error;
+		unsigned int function, sw_id;
+		keep (answer.checkErrorMessage20 (&feature, &function, &sw_id, &error));
+	});
+	bench ("report/check_error20_error", [&error20] () {
+		uint8_t feature, error;
+		unsigned int function, sw_id;
+		keep (error20.checkErrorMessage20 (&feature, &function, &sw_id, &error));
+	});
+}
+
+// Dispatcher without device, only for calling processEvent
+class EventDispatcher: public HIDPP::Dispatcher
+{
+public:
+	virtual uint16_t vendorID () const { return 0; }
+	virtual uint16_t productID () const { return 0; }
+	virtual std::string name () const { return "bench"; }
+	virtual void sendCommandWithoutResponse (const HIDPP::Report &) { }
+	virtual std::unique_ptr<AsyncReport> sendCommand (HIDPP::Report &&) { return nullptr; }
+	virtual std::unique_ptr<AsyncReport> getNotification (HIDPP::DeviceIndex, uint8_t) { return nullptr; }
+
+	using Dispatcher::processEvent;
+};
+
+static void benchProcessEvent ()
+{
+	for (unsigned int count: { 1, 16, 128 }) {
+		EventDispatcher dispatcher;
+		unsigned long events = 0;
+		std::vector<HIDPP::Dispatcher::listener_iterator> listeners;
+		for (unsigned int i = 0; i < count; ++i)
+			listeners.push_back (dispatcher.registerEventHandler (
+				static_cast<HIDPP::DeviceIndex> (1 + i % 6), 0x40 + i / 6,
+				[&events] (const HIDPP::Report &) { ++events; return true; }));
+		HIDPP::Report event (HIDPP::Report::Short, HIDPP::WirelessDevice1, 0x40, 0);
+		bench ("dispatcher/process_event/listeners=" + std::to_string (count), [&] () {
+			dispatcher.processEvent (event);
+		});
+		keep (events);
+		for (const auto &it: listeners)
+			dispatcher.unregisterEventHandler (it);
+	}
+}
+
+/**
+ * Event listeners as stored by Dispatcher before they were indexed by
+ * device index and sub ID: a copy-on-write multimap searched for each
+ * event. Only kept as a baseline for dispatcher/process_event.
+ */
+class MultimapListeners
+{
+public:
+	MultimapListeners (): _listeners (std::make_shared<container> ()) { }
+
+	void registerEventHandler (HIDPP::DeviceIndex index, uint8_t sub_id,
+				   const HIDPP::Dispatcher::event_handler &handler)
+	{
+		auto listener = std::make_shared<Listener> (handler);
+		std::unique_lock<std::mutex> lock (_mutex);
+		auto listeners = std::make_shared<container> (*_listeners);
+		listeners->emplace (std::make_tuple (index, sub_id), listener);
+		std::atomic_store (&_listeners, std::shared_ptr<const container> (std::move (listeners)));
+	}
+
+	void processEvent (const HIDPP::Report &report)
+	{
+		auto listeners = std::atomic_load (&_listeners);
+		auto range = listeners->equal_range (std::make_tuple (report.deviceIndex (), report.subID ()));
+		for (auto it = range.first; it != range.second; ++it) {
+			auto &listener = it->second;
+			std::unique_lock<std::mutex> lock (listener->call_mutex);
+			if (!listener->active)
+				continue;
+			listener->handler (report);
+		}
+	}
+
+private:
+	struct Listener
+	{
+		HIDPP::Dispatcher::event_handler handler;
+		std::atomic<bool> active;
+		std::mutex call_mutex;
+
+		Listener (const HIDPP::Dispatcher::event_handler &handler):
+			handler (handler), active (true)
+		{
+		}
+	};
+	typedef std::multimap<std::tuple<HIDPP::DeviceIndex, uint8_t>, std::shared_ptr<Listener>> container;
+	std::mutex _mutex;
+	std::shared_ptr<const container> _listeners;
+};
+
+static void benchProcessEventMultimap ()
+{
+	for (unsigned int count: { 1, 16, 128 }) {
+		MultimapListeners listeners;
+		unsigned long events = 0;
+		for (unsigned int i = 0; i < count; ++i)
+			listeners.registerEventHandler (
+				static_cast<HIDPP::DeviceIndex> (1 + i % 6), 0x40 + i / 6,
+				[&events] (const HIDPP::Report &) { ++events; return true; });
+		HIDPP::Report event (HIDPP::Report::Short, HIDPP::WirelessDevice1, 0x40, 0);
+		bench ("dispatcher/process_event_multimap/listeners=" + std::to_string (count), [&] () {
+			listeners.processEvent (event);
+		});
+		keep (events);
+	}
+}
+
+/**
+ * Virtual device answering every command with a copy of its request. The
+ * answers are held until release () is called.
+ */
+class EchoDevice: public HID::VirtualDevice
+{
+public:
+	EchoDevice (): _interrupted (false) { }
+
+	virtual uint16_t vendorID () const { return 0x046d; }
+	virtual uint16_t productID () const { return 0; }
+	virtual std::string name () const { return "echo"; }
+	virtual HID::ReportDescriptor reportDescriptor () const
+	{
+		return HIDPP::SimulatedReceiver::hidppReportDescriptor ();
+	}
+
+	virtual int writeReport (const uint8_t *report, std::size_t length)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_held.emplace_back (report, report+length);
+		return length;
+	}
+
+	virtual int readReport (uint8_t *report, std::size_t length, int timeout)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		auto ready = [this] () { return _interrupted || !_answers.empty (); };
+		if (timeout < 0)
+			_cond.wait (lock, ready);
+		else if (!_cond.wait_for (lock, std::chrono::milliseconds (timeout), ready))
+			return 0;
+		if (_interrupted) {
+			_interrupted = false;
+			return 0;
+		}
+		auto answer = std::move (_answers.front ());
+		_answers.pop_front ();
+		std::size_t n = std::min (length, answer.size ());
+		std::copy_n (answer.begin (), n, report);
+		return n;
+	}
+
+	virtual void interruptRead ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_interrupted = true;
+		_cond.notify_all ();
+	}
+
+	void release ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (auto &report: _held)
+			_answers.push_back (std::move (report));
+		_held.clear ();
+		_cond.notify_all ();
+	}
+
+private:
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::vector<std::vector<uint8_t>> _held;
+	std::deque<std::vector<uint8_t>> _answers;
+	bool _interrupted;
+};
+
+static void benchProcessReport ()
+{
+	auto device = std::make_shared<EchoDevice> ();
+	HID::VirtualDevice::registerScheme ("bench-echo", [device] (const std::string &) {
+		return device;
+	});
+	HIDPP::DispatcherThread dispatcher ("bench-echo:");
+	std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+	for (unsigned int outstanding: { 1, 16, 64, 256 }) {
+		std::mutex mutex;
+		std::condition_variable cond;
+		unsigned int done = 0;
+		auto handler = [&] (const HIDPP::Report *, std::exception_ptr) {
+			std::unique_lock<std::mutex> lock (mutex);
+			if (++done == outstanding)
+				cond.notify_one ();
+		};
+		// Includes the dispatcher thread wake up and the virtual reads,
+		// divided between the outstanding commands.
+		bench ("dispatcher_thread/process_report/outstanding=" + std::to_string (outstanding), [&] () {
+			done = 0;
+			for (unsigned int i = 0; i < outstanding; ++i)
+				dispatcher.sendCommand (HIDPP::Report (HIDPP::Report::Short, HIDPP::DefaultDevice,
+								       1 + i/16, i%16, 1),
+							handler);
+			device->release ();
+			std::unique_lock<std::mutex> lock (mutex);
+			cond.wait (lock, [&] () { return done == outstanding; });
+		}, outstanding);
+	}
+	dispatcher.stop ();
+	thread.join ();
+}
+
+/**
+ * Virtual device discarding commands, for dispatchers that are never run.
+ */
+class SinkDevice: public HID::VirtualDevice
+{
+public:
+	virtual uint16_t vendorID () const { return 0x046d; }
+	virtual uint16_t productID () const { return 0; }
+	virtual std::string name () const { return "sink"; }
+	virtual HID::ReportDescriptor reportDescriptor () const
+	{
+		return HIDPP::SimulatedReceiver::hidppReportDescriptor ();
+	}
+	virtual int writeReport (const uint8_t *, std::size_t length) { return length; }
+	virtual int readReport (uint8_t *, std::size_t, int) { return 0; }
+	virtual void interruptRead () { }
+};
+
+/**
+ * Dispatcher fed directly from the benchmark thread, without running its
+ * reading loop.
+ */
+class MatchingDispatcher: public HIDPP::DispatcherThread
+{
+public:
+	using DispatcherThread::DispatcherThread;
+
+	void feed (const uint8_t *report, std::size_t length)
+	{
+		processRawReport (report, length, std::chrono::steady_clock::now ());
+	}
+};
+
+static void benchMatchReport ()
+{
+	auto device = std::make_shared<SinkDevice> ();
+	HID::VirtualDevice::registerScheme ("bench-sink", [device] (const std::string &) {
+		return device;
+	});
+	MatchingDispatcher dispatcher ("bench-sink:");
+	for (unsigned int outstanding: { 1, 16, 256 }) {
+		std::vector<HIDPP::Report> answers;
+		for (unsigned int i = 0; i < outstanding; ++i)
+			answers.emplace_back (HIDPP::Report::Short, HIDPP::DefaultDevice, 1 + i/16, i%16, 1);
+		unsigned int done = 0;
+		auto handler = [&done] (const HIDPP::Report *, std::exception_ptr) { ++done; };
+		// Commands are added then answered from this thread: only the
+		// pending command index is measured, not the reading thread.
+		bench ("dispatcher_thread/match_report/outstanding=" + std::to_string (outstanding), [&] () {
+			for (const auto &answer: answers)
+				dispatcher.sendCommand (HIDPP::Report (answer), handler);
+			for (const auto &answer: answers)
+				dispatcher.feed (answer.rawData (), answer.rawLength ());
+		}, outstanding);
+		keep (done);
+	}
+}
+
+/**
+ * Byte-at-a-time CRC-CCITT that CRC::CCITT replaced, kept as a baseline.
+ */
+static uint16_t bytewiseCCITT (const uint8_t *data, std::size_t length)
+{
+	uint16_t crc = 0xFFFF;
+	for (std::size_t i = 0; i < length; ++i) {
+		uint16_t temp = (crc >> 8) ^ data[i];
+		crc <<= 8;
+		uint16_t quick = temp ^ (temp >> 4);
+		crc ^= quick;
+		quick <<= 5;
+		crc ^= quick;
+		quick <<= 7;
+		crc ^= quick;
+	}
+	return crc;
+}
+
+static void benchCRC ()
+{
+	for (std::size_t size: { 16, 256, 4096 }) {
+		std::vector<uint8_t> data (size);
+		for (std::size_t i = 0; i < size; ++i)
+			data[i] = i * 31 + 7;
+		if (bytewiseCCITT (data.data (), data.size ()) != CRC::CCITT (data.data (), data.size ()))
+			fprintf (stderr, "crc/ccitt: baseline mismatch for %zu bytes\n", size);
+		bench ("crc/ccitt/bytes=" + std::to_string (size), [&data] () {
+			keep (CRC::CCITT (data.data (), data.size ()));
+		});
+		bench ("crc/ccitt_bytewise/bytes=" + std::to_string (size), [&data] () {
+			keep (bytewiseCCITT (data.data (), data.size ()));
+		});
+	}
+}
+
+static void benchReportDescriptor ()
+{
+	// HID++ collections of a receiver: short, long and very long reports
+	static const uint8_t descriptor[] = {
+		0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x10, 0x75, 0x08,
+		0x95, 0x06, 0x15, 0x00, 0x26, 0xff, 0x00, 0x09, 0x01, 0x81, 0x00,
+		0x09, 0x01, 0x91, 0x00, 0xc0,
+		0x06, 0x00, 0xff, 0x09, 0x02, 0xa1, 0x01, 0x85, 0x11, 0x75, 0x08,
+		0x95, 0x13, 0x15, 0x00, 0x26, 0xff, 0x00, 0x09, 0x02, 0x81, 0x00,
+		0x09, 0x02, 0x91, 0x00, 0xc0,
+		0x06, 0x00, 0xff, 0x09, 0x04, 0xa1, 0x01, 0x85, 0x20, 0x75, 0x08,
+		0x95, 0x0e, 0x15, 0x00, 0x26, 0xff, 0x00, 0x09, 0x41, 0x81, 0x00,
+		0x09, 0x41, 0x91, 0x00, 0x85, 0x21, 0x96, 0x1f, 0x00, 0x09, 0x42,
+		0x81, 0x00, 0x09, 0x42, 0x91, 0x00, 0xc0,
+	};
+	bench ("report_descriptor/from_raw_data", [] () {
+		auto desc = HID::ReportDescriptor::fromRawData (descriptor, sizeof (descriptor));
+		keep (desc);
+	});
+}
+
+static void benchMacroFormat (const std::string &name, const HIDPP::AbstractMacroFormat &format)
+{
+	using HIDPP::Macro;
+	std::vector<Macro::Item> items;
+	for (unsigned int key = 4; key < 12; ++key) {
+		items.emplace_back (Macro::Item::KeyPress);
+		items.back ().setKeyCode (key);
+		items.emplace_back (Macro::Item::Delay);
+		items.back ().setDelay (20);
+		items.emplace_back (Macro::Item::KeyRelease);
+		items.back ().setKeyCode (key);
+	}
+	items.emplace_back (Macro::Item::MouseButtonPress);
+	items.back ().setButtons (1);
+	items.emplace_back (Macro::Item::MouseButtonRelease);
+	items.back ().setButtons (1);
+	items.emplace_back (Macro::Item::End);
+	std::size_t length = 0;
+	for (const auto &item: items)
+		length += format.getLength (item);
+	std::vector<uint8_t> data (length);
+	auto encode = [&] () {
+		auto it = data.begin ();
+		std::vector<uint8_t>::iterator jump;
+		for (const auto &item: items)
+			it = format.writeItem (it, item, jump);
+	};
+	bench ("macro/" + name + "/encode", encode, items.size ());
+	encode ();
+	bench ("macro/" + name + "/decode", [&] () {
+		std::vector<uint8_t>::const_iterator it = data.begin ();
+		HIDPP::Address jump;
+		for (std::size_t i = 0; i < items.size (); ++i)
+			keep (format.parseItem (it, jump));
+	}, items.size ());
+}
+
+static void benchMacroText ()
+{
+	using HIDPP::Macro;
+	Macro macro;
+	for (unsigned int i = 0; i < 64; ++i) {
+		unsigned int key = 4 + i % 26;
+		macro.emplace_back (Macro::Item::KeyPress);
+		macro.back ().setKeyCode (key);
+		macro.emplace_back (Macro::Item::Delay);
+		macro.back ().setDelay (20);
+		macro.emplace_back (Macro::Item::KeyRelease);
+		macro.back ().setKeyCode (key);
+		macro.emplace_back (Macro::Item::MouseButtonPress);
+		macro.back ().setButtons (1);
+		macro.emplace_back (Macro::Item::MouseButtonRelease);
+		macro.back ().setButtons (1);
+	}
+	macro.emplace_back (Macro::Item::End);
+	// One instruction per line, ns per line is the inverse of lines/s
+	std::string text = macroToText (macro.begin (), macro.end ());
+	auto lines = std::count (text.begin (), text.end (), '\n');
+	bench ("macro_text/parse", [&text] () {
+		keep (textToMacro (text));
+	}, lines);
+	bench ("macro_text/format", [&macro] () {
+		keep (macroToText (macro.begin (), macro.end ()));
+	}, lines);
+}
+
+static void benchProfileFormat (const std::string &name, const HIDPP::AbstractProfileFormat &format,
+				std::size_t size)
+{
+	// Profile with default settings, written first so that the read
+	// benchmark parses valid data.
+	HIDPP::Profile profile;
+	for (const auto &[name, desc]: format.generalSettings ())
+		profile.settings.set (name, desc.defaultValue ());
+	profile.modes.resize (format.maxModeCount ());
+	for (auto &mode: profile.modes)
+		for (const auto &[name, desc]: format.modeSettings ())
+			mode.set (name, desc.defaultValue ());
+	profile.buttons.resize (format.maxButtonCount ());
+	std::vector<uint8_t> data (size, 0xff);
+	format.write (profile, data.begin ());
+	bench ("profile/" + name + "/read", [&] () {
+		keep (format.read (data.begin ()));
+	});
+	bench ("profile/" + name + "/write", [&] () {
+		format.write (profile, data.begin ());
+	});
+}
+
+static void benchFormats ()
+{
+	benchMacroFormat ("hidpp10", HIDPP10::MacroFormat ());
+	benchMacroFormat ("hidpp20", HIDPP20::MacroFormat ());
+	benchProfileFormat ("hidpp10_g500", HIDPP10::ProfileFormatG500 (HIDPP10::RangeSensor::S9500), 512);
+	HIDPP20::IOnboardProfiles::Description desc = {};
+	desc.memory_model = 1;
+	desc.profile_format = 2;
+	desc.macro_format = 1;
+	desc.profile_count = 5;
+	desc.button_count = 11;
+	desc.sector_count = 16;
+	desc.sector_size = 255;
+	desc.mechanical_layout = 0x0a; // G-shift and DPI shift
+	desc.various_info = 0x01; // corded
+	benchProfileFormat ("hidpp20_format2", HIDPP20::ProfileFormat (desc), desc.sector_size);
+}
+
+static void benchUsageStrings ()
+{
+	bench ("usage_strings/key_string", [] () {
+		keep (HID::keyString (0x04));
+	});
+	bench ("usage_strings/key_usage_code", [] () {
+		keep (HID::keyUsageCode ("A"));
+	});
+	bench ("usage_strings/consumer_control_string", [] () {
+		keep (HID::consumerControlString (0xe9));
+	});
+	bench ("usage_strings/consumer_control_code", [] () {
+		keep (HID::consumerControlCode ("Volume Up"));
+	});
+}
+
+int main (int argc, char *argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp (argv[i], "-h") == 0 || strcmp (argv[i], "--help") == 0) {
+			fprintf (stderr, "Usage: %s [-t milliseconds] [filter]\n"
+				 "Run the benchmarks whose name contains filter and print\n"
+				 "their results as JSON lines.\n", argv[0]);
+			return EXIT_SUCCESS;
+		}
+		else if (strcmp (argv[i], "-t") == 0 && i+1 < argc)
+			min_time = std::chrono::milliseconds (atoi (argv[++i]));
+		else
+			filter = argv[i];
+	}
+	benchReport ();
+	benchProcessEvent ();
+	benchProcessEventMultimap ();
+	benchProcessReport ();
+	benchMatchReport ();
+	benchCRC ();
+	benchReportDescriptor ();
+	benchFormats ();
+	benchMacroText ();
+	benchUsageStrings ();
+	return EXIT_SUCCESS;
+}
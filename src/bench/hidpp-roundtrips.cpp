@@ -0,0 +1,180 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hidpp/DispatcherThread.h>
+#include <hidpp/SimulatedReceiver.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/DeviceStateMirror.h>
+#include <hidpp20/IAdjustableDPI.h>
+#include <hidpp20/IFeatureSet.h>
+#include <hidpp20/IOnboardProfiles.h>
+#include <hidpp20/IReprogControlsV4.h>
+#include <hidpp20/MemoryMapping.h>
+#include <hidpp20/ProfileDirectoryFormat.h>
+#include <hidpp20/ProfileFormat.h>
+
+/*
+ * Round-trip budgets of high-level operations against a simulated
+ * receiver. Each operation is run with a fresh state (no cached feature
+ * indices nor memory pages) and the commands it sends are counted from
+ * the dispatcher statistics. Except for "open device", devices are
+ * constructed from a saved identity, as a daemon would do, so that only
+ * the operation itself is counted. The program fails if any count exceeds its
+ * budget, so that a change adding round trips to a common operation is
+ * noticed. Budgets are the counts at the time they were recorded: lower
+ * them when an operation gets cheaper.
+ */
+
+struct Operation
+{
+	const char *name;
+	uint64_t budget;
+	std::function<void (HIDPP::Dispatcher *, const HIDPP::Device::Identity &)> run;
+};
+
+static uint64_t sentCommands (HIDPP::Dispatcher *dispatcher)
+{
+	auto stats = dispatcher->statistics ();
+	uint64_t count = stats.timeouts;
+	for (const auto &[key, histogram]: stats.latency)
+		count += histogram.count;
+	return count;
+}
+
+static const HIDPP::Address DirectoryAddress = { HIDPP20::IOnboardProfiles::Writeable, 0, 0 };
+
+// Untimed setup: a profile directory with every profile enabled
+static HIDPP::Device::Identity writeProfiles (HIDPP::Dispatcher *dispatcher)
+{
+	HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1);
+	auto dir_format = HIDPP20::getProfileDirectoryFormat (&dev);
+	auto profile_format = HIDPP20::getProfileFormat (&dev);
+	HIDPP20::MemoryMapping memory (&dev);
+	HIDPP::ProfileDirectory directory;
+	for (unsigned int i = 0; i < memory.description ().profile_count; ++i) {
+		HIDPP::Address address = { HIDPP20::IOnboardProfiles::Writeable, i+1, 0 };
+		directory.entries.push_back ({ address, {} });
+		HIDPP::Profile profile;
+		for (unsigned int j = 0; j < profile_format->maxButtonCount (); ++j)
+			profile.buttons.emplace_back (HIDPP::Profile::Button::MouseButtonsType (), 1u << j);
+		profile_format->write (profile, memory.getWritableIterator (address));
+	}
+	dir_format->write (directory, memory.getWritableIterator (DirectoryAddress));
+	memory.sync ();
+	return dev.identity ();
+}
+
+static const Operation Operations[] = {
+	{ "open device", 1, [] (HIDPP::Dispatcher *dispatcher, const HIDPP::Device::Identity &) {
+		HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1);
+	} },
+	{ "list features", 9, [] (HIDPP::Dispatcher *dispatcher, const HIDPP::Device::Identity &identity) {
+		HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1, identity);
+		HIDPP20::IFeatureSet ifeatureset (&dev);
+		unsigned int count = ifeatureset.getCount ();
+		for (unsigned int i = 1; i <= count; ++i)
+			ifeatureset.getFeatureID (i);
+	} },
+	{ "read all profiles", 34, [] (HIDPP::Dispatcher *dispatcher, const HIDPP::Device::Identity &identity) {
+		HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1, identity);
+		auto dir_format = HIDPP20::getProfileDirectoryFormat (&dev);
+		auto profile_format = HIDPP20::getProfileFormat (&dev);
+		HIDPP20::MemoryMapping memory (&dev);
+		auto directory = dir_format->read (memory.getReadOnlyIterator (DirectoryAddress));
+		std::vector<HIDPP::Address> addresses;
+		for (const auto &entry: directory.entries)
+			addresses.push_back (entry.profile_address);
+		memory.prefetch (addresses);
+		for (const auto &address: addresses)
+			profile_format->read (memory.getReadOnlyRange (address, profile_format->size ()));
+	} },
+	{ "write one button", 36, [] (HIDPP::Dispatcher *dispatcher, const HIDPP::Device::Identity &identity) {
+		HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1, identity);
+		auto profile_format = HIDPP20::getProfileFormat (&dev);
+		HIDPP20::MemoryMapping memory (&dev);
+		HIDPP::Address address = { HIDPP20::IOnboardProfiles::Writeable, 1, 0 };
+		profile_format->writeButton (memory.getWritableIterator (address), 0,
+				HIDPP::Profile::Button (HIDPP::Profile::Button::MouseButtonsType (), 2));
+		memory.sync ();
+	} },
+	{ "set DPI", 2, [] (HIDPP::Dispatcher *dispatcher, const HIDPP::Device::Identity &identity) {
+		HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1, identity);
+		HIDPP20::IAdjustableDPI iadjustabledpi (&dev);
+		iadjustabledpi.setSensorDPI (0, 1600);
+	} },
+	{ "divert controls", 17, [] (HIDPP::Dispatcher *dispatcher, const HIDPP::Device::Identity &identity) {
+		HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1, identity);
+		HIDPP20::IReprogControlsV4 ireprog (&dev);
+		std::vector<HIDPP20::IReprogControlsV4::ControlReporting> reportings;
+		for (const auto &state: ireprog.getAllControlState ())
+			reportings.push_back ({ state.info.control_id,
+					HIDPP20::IReprogControlsV4::TemporaryDiverted |
+					HIDPP20::IReprogControlsV4::ChangeTemporaryDivert, 0 });
+		ireprog.setControlReporting (reportings);
+	} },
+	{ "switch profile", 6, [] (HIDPP::Dispatcher *dispatcher, const HIDPP::Device::Identity &identity) {
+		HIDPP20::Device dev (dispatcher, HIDPP::WirelessDevice1, identity);
+		HIDPP20::DeviceStateMirror state (&dev);
+		// The second switch only changes the DPI index
+		for (unsigned int dpi_index: { 0, 1 }) {
+			state.setMode (HIDPP20::IOnboardProfiles::Mode::Onboard);
+			state.setCurrentProfile (HIDPP20::IOnboardProfiles::Writeable, 2);
+			state.setCurrentDPIIndex (dpi_index);
+		}
+	} },
+};
+
+int main ()
+{
+	HIDPP::SimulatedReceiver::registerScheme ();
+	HIDPP::DispatcherThread dispatcher ("sim:devices=1,latency=0");
+	std::thread thread ([&dispatcher] () { dispatcher.run (); });
+
+	int ret = EXIT_SUCCESS;
+	try {
+		auto identity = writeProfiles (&dispatcher);
+		for (const auto &op: Operations) {
+			dispatcher.resetStatistics ();
+			op.run (&dispatcher, identity);
+			auto count = sentCommands (&dispatcher);
+			bool over = count > op.budget;
+			printf ("%-20s %4llu / %4llu%s\n", op.name,
+				static_cast<unsigned long long> (count),
+				static_cast<unsigned long long> (op.budget),
+				over ? "  OVER BUDGET" : "");
+			if (over)
+				ret = EXIT_FAILURE;
+		}
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "%s\n", e.what ());
+		ret = EXIT_FAILURE;
+	}
+
+	dispatcher.stop ();
+	thread.join ();
+	return ret;
+}
@@ -0,0 +1,497 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <hidpp/DispatcherThread.h>
+#include <hidpp/SimulatedReceiver.h>
+#include <hidpp/Subscription.h>
+#include <hidpp10/defs.h>
+#include <hidpp10/Error.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IOnboardProfiles.h>
+#include <hidpp20/IRoot.h>
+#include <hidpp20/MemoryMapping.h>
+
+/*
+ * Soak test against simulated receivers with six devices each. Every
+ * device is pinged in a closed loop while it sends events (see the
+ * SimulatedReceiver event and fault options), and onboard memory is
+ * rewritten periodically through HIDPP20::MemoryMapping. Results are
+ * printed as one JSON object per interval.
+ */
+
+using clock_type = std::chrono::steady_clock;
+
+static std::atomic<bool> interrupted (false);
+
+static constexpr unsigned int DeviceCount = 6;
+// Simulated device feature indices
+static constexpr uint8_t EventFeatures[] = { 3, 4, 5 };
+
+struct Settings
+{
+	unsigned int receivers = 4;
+	std::chrono::seconds duration {60}; // 0 runs until interrupted
+	std::chrono::seconds interval {10};
+	int timeout = 1000;
+	std::chrono::milliseconds memory_interval {1000}; // 0 disables memory writes
+	std::string sim_options = "jitter=500,events=5000,drop=1,spike=2,sleep=1,disconnects=10000000";
+};
+
+struct Counters
+{
+	std::vector<double> rtt_us;
+	uint64_t answers = 0, timeouts = 0, errors = 0, failures = 0;
+	uint64_t events = 0;
+	uint64_t syncs = 0, sync_failures = 0;
+
+	void merge (const Counters &other)
+	{
+		answers += other.answers;
+		timeouts += other.timeouts;
+		errors += other.errors;
+		failures += other.failures;
+		events += other.events;
+		syncs += other.syncs;
+		sync_failures += other.sync_failures;
+	}
+};
+
+/**
+ * Counters of the current interval, updated from every thread.
+ */
+class Stats
+{
+public:
+	template<typename F>
+	void update (F f)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		f (_current);
+	}
+
+	Counters take ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		Counters counters = std::move (_current);
+		_current = Counters ();
+		return counters;
+	}
+
+private:
+	std::mutex _mutex;
+	Counters _current;
+};
+
+/**
+ * Keep one IRoot ping in flight to a device, sent again from the
+ * completion handler.
+ */
+class PingLoop
+{
+public:
+	PingLoop (HIDPP::DispatcherThread *dispatcher, HIDPP::DeviceIndex index, Stats *stats, int timeout):
+		_dispatcher (dispatcher), _index (index), _stats (stats), _timeout (timeout),
+		_running (false), _in_flight (false)
+	{
+	}
+
+	void start ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_running = true;
+		send ();
+	}
+
+	// Wait for the ping in flight
+	void stop ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_running = false;
+		_cond.wait (lock, [this] () { return !_in_flight; });
+	}
+
+private:
+	void send () // _mutex must be held
+	{
+		HIDPP::Report request (HIDPP::Report::Long, _index,
+				       HIDPP20::IRoot::index, HIDPP20::IRoot::Ping,
+				       _dispatcher->nextSoftwareID ());
+		auto start = clock_type::now ();
+		_in_flight = true;
+		try {
+			_dispatcher->sendCommand (std::move (request), [this, start] (const HIDPP::Report *response, std::exception_ptr error) {
+				completed (response, error, start);
+			}, _timeout);
+		}
+		catch (std::exception &) {
+			_stats->update ([] (Counters &c) { ++c.failures; });
+			_in_flight = false;
+			_cond.notify_all ();
+		}
+	}
+
+	void completed (const HIDPP::Report *response, std::exception_ptr error, clock_type::time_point start)
+	{
+		double rtt = std::chrono::duration<double, std::micro> (clock_type::now () - start).count ();
+		_stats->update ([&] (Counters &c) {
+			if (response) {
+				c.rtt_us.push_back (rtt);
+				++c.answers;
+				return;
+			}
+			try {
+				std::rethrow_exception (error);
+			}
+			catch (HIDPP::Dispatcher::TimeoutError &) {
+				++c.timeouts;
+			}
+			catch (HIDPP10::Error &) { // e.g. link lost
+				++c.errors;
+			}
+			catch (HIDPP20::Error &) {
+				++c.errors;
+			}
+			catch (std::exception &) {
+				++c.failures;
+			}
+		});
+		std::unique_lock<std::mutex> lock (_mutex);
+		_in_flight = false;
+		if (_running)
+			send ();
+		_cond.notify_all ();
+	}
+
+	HIDPP::DispatcherThread *_dispatcher;
+	HIDPP::DeviceIndex _index;
+	Stats *_stats;
+	int _timeout;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _running, _in_flight;
+};
+
+struct Receiver
+{
+	std::unique_ptr<HIDPP::DispatcherThread> dispatcher;
+	std::thread thread;
+	std::vector<std::unique_ptr<PingLoop>> pings;
+	std::vector<std::unique_ptr<HIDPP::Subscription>> subscriptions;
+	std::thread consumer;
+
+	Receiver (const std::string &path, Stats *stats, int timeout):
+		dispatcher (std::make_unique<HIDPP::DispatcherThread> (path.c_str ()))
+	{
+		thread = std::thread (&HIDPP::DispatcherThread::run, dispatcher.get ());
+		for (unsigned int i = 0; i < DeviceCount; ++i) {
+			auto index = static_cast<HIDPP::DeviceIndex> (HIDPP::WirelessDevice1 + i);
+			pings.push_back (std::make_unique<PingLoop> (dispatcher.get (), index, stats, timeout));
+			for (auto feature: EventFeatures)
+				subscriptions.push_back (dispatcher->subscribe (index, feature));
+			subscriptions.push_back (dispatcher->subscribe (index, HIDPP10::DeviceConnection));
+		}
+	}
+
+	~Receiver ()
+	{
+		for (auto &ping: pings)
+			ping->stop ();
+		if (consumer.joinable ())
+			consumer.join ();
+		subscriptions.clear ();
+		dispatcher->stop ();
+		thread.join ();
+	}
+
+	uint64_t dropped () const
+	{
+		uint64_t total = 0;
+		for (const auto &sub: subscriptions)
+			total += sub->dropped ();
+		return total;
+	}
+};
+
+// Poll every subscription of the receiver, as an application handling
+// all its devices from one thread would.
+static void consumeEvents (Receiver *receiver, Stats *stats, const std::atomic<bool> *running)
+{
+	while (*running) {
+		uint64_t count = 0;
+		for (auto &sub: receiver->subscriptions)
+			while (sub->tryNext ())
+				++count;
+		if (count)
+			stats->update ([count] (Counters &c) { c.events += count; });
+		else
+			std::this_thread::sleep_for (std::chrono::milliseconds (1));
+	}
+}
+
+// Rewrite the first byte of a writeable page of each device in turn. The
+// device and mapping objects are created again for every write so that
+// leaks show in the memory growth.
+static void rewriteMemory (HIDPP::Dispatcher *dispatcher, Stats *stats,
+			   std::chrono::milliseconds interval, const std::atomic<bool> *running)
+{
+	unsigned int n = 0;
+	while (*running) {
+		auto index = static_cast<HIDPP::DeviceIndex> (HIDPP::WirelessDevice1 + n % DeviceCount);
+		try {
+			HIDPP20::Device dev (dispatcher, index);
+			HIDPP20::MemoryMapping memory (&dev);
+			HIDPP::Address address = { HIDPP20::IOnboardProfiles::Writeable,
+						   (n / DeviceCount) % memory.description ().sector_count, 0 };
+			memory.getWritablePage (address)[0] = n;
+			memory.sync ();
+			stats->update ([] (Counters &c) { ++c.syncs; });
+		}
+		catch (std::exception &) {
+			stats->update ([] (Counters &c) { ++c.sync_failures; });
+		}
+		++n;
+		auto end = clock_type::now () + interval;
+		while (*running && clock_type::now () < end)
+			std::this_thread::sleep_for (std::min<clock_type::duration> (end - clock_type::now (), std::chrono::milliseconds (100)));
+	}
+}
+
+static long residentKB ()
+{
+#ifdef __linux__
+	FILE *f = fopen ("/proc/self/statm", "r");
+	if (!f)
+		return -1;
+	long size, resident;
+	int n = fscanf (f, "%ld %ld", &size, &resident);
+	fclose (f);
+	if (n != 2)
+		return -1;
+	return resident * (sysconf (_SC_PAGESIZE) / 1024);
+#else
+	return -1;
+#endif
+}
+
+static double percentile (const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty ())
+		return 0;
+	std::size_t i = static_cast<std::size_t> (p * (sorted.size () - 1) + 0.5);
+	return sorted[std::min (i, sorted.size () - 1)];
+}
+
+static void printCounters (const char *kind, double elapsed, double seconds, Counters &c,
+			   const std::vector<std::unique_ptr<Receiver>> &receivers, long rss_kb)
+{
+	std::sort (c.rtt_us.begin (), c.rtt_us.end ());
+	uint64_t dropped = 0, unmatched = 0, dispatcher_timeouts = 0;
+	std::size_t queued = 0;
+	for (const auto &receiver: receivers) {
+		dropped += receiver->dropped ();
+		auto stats = receiver->dispatcher->statistics ();
+		unmatched += stats.unmatched_answers;
+		dispatcher_timeouts += stats.timeouts;
+		queued += stats.commands_queued;
+	}
+	printf ("{\"kind\":\"%s\",\"elapsed_s\":%.1f,"
+		"\"commands\":%llu,\"commands_per_s\":%.1f,"
+		"\"rtt_p50_us\":%.0f,\"rtt_p99_us\":%.0f,\"rtt_p999_us\":%.0f,\"rtt_max_us\":%.0f,"
+		"\"timeouts\":%llu,\"errors\":%llu,\"failures\":%llu,"
+		"\"events\":%llu,\"events_per_s\":%.1f,\"events_dropped\":%llu,"
+		"\"unmatched_answers\":%llu,\"dispatcher_timeouts\":%llu,\"commands_queued\":%zu,"
+		"\"memory_syncs\":%llu,\"memory_failures\":%llu,\"rss_kb\":%ld}\n",
+		kind, elapsed,
+		static_cast<unsigned long long> (c.answers), seconds > 0 ? c.answers / seconds : 0,
+		percentile (c.rtt_us, 0.50), percentile (c.rtt_us, 0.99), percentile (c.rtt_us, 0.999),
+		c.rtt_us.empty () ? 0 : c.rtt_us.back (),
+		static_cast<unsigned long long> (c.timeouts),
+		static_cast<unsigned long long> (c.errors),
+		static_cast<unsigned long long> (c.failures),
+		static_cast<unsigned long long> (c.events), seconds > 0 ? c.events / seconds : 0,
+		static_cast<unsigned long long> (dropped),
+		static_cast<unsigned long long> (unmatched),
+		static_cast<unsigned long long> (dispatcher_timeouts), queued,
+		static_cast<unsigned long long> (c.syncs),
+		static_cast<unsigned long long> (c.sync_failures),
+		rss_kb);
+	fflush (stdout);
+}
+
+static bool parseUnsigned (const char *arg, unsigned long &value)
+{
+	char *end;
+	value = strtoul (arg, &end, 0);
+	return end != arg && *end == '\0';
+}
+
+int main (int argc, char *argv[])
+{
+	Settings settings;
+	for (int i = 1; i < argc; ++i) {
+		unsigned long value;
+		bool has_value = i+1 < argc;
+		if (strcmp (argv[i], "-h") == 0 || strcmp (argv[i], "--help") == 0) {
+			fprintf (stderr, "Usage: %s [-r receivers] [-d seconds] [-i seconds] [-t ms] [-m ms] [-s sim_options]\n"
+				 "Ping every device of simulated receivers (six devices each) while\n"
+				 "they send events, rewrite onboard memory periodically and print\n"
+				 "throughput, latency and memory usage as JSON lines.\n"
+				 "  -r  receivers (default: %u)\n"
+				 "  -d  duration in seconds, 0 runs until interrupted (default: %lld)\n"
+				 "  -i  report interval in seconds (default: %lld)\n"
+				 "  -t  command timeout in milliseconds (default: %d)\n"
+				 "  -m  memory rewrite interval in milliseconds, 0 disables it (default: %lld)\n"
+				 "  -s  simulator options added to the defaults (default: %s)\n",
+				 argv[0], settings.receivers,
+				 static_cast<long long> (settings.duration.count ()),
+				 static_cast<long long> (settings.interval.count ()),
+				 settings.timeout,
+				 static_cast<long long> (settings.memory_interval.count ()),
+				 settings.sim_options.c_str ());
+			return EXIT_SUCCESS;
+		}
+		else if (strcmp (argv[i], "-s") == 0 && has_value)
+			settings.sim_options += std::string (",") + argv[++i];
+		else if (has_value && parseUnsigned (argv[i+1], value) && strlen (argv[i]) == 2 && argv[i][0] == '-') {
+			switch (argv[i][1]) {
+			case 'r': settings.receivers = value; break;
+			case 'd': settings.duration = std::chrono::seconds (value); break;
+			case 'i': settings.interval = std::chrono::seconds (std::max (1ul, value)); break;
+			case 't': settings.timeout = value; break;
+			case 'm': settings.memory_interval = std::chrono::milliseconds (value); break;
+			default:
+				fprintf (stderr, "Unknown option %s.\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			++i;
+		}
+		else {
+			fprintf (stderr, "Invalid argument %s.\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	HIDPP::SimulatedReceiver::registerScheme ();
+	std::signal (SIGINT, [] (int) { interrupted = true; });
+	std::signal (SIGTERM, [] (int) { interrupted = true; });
+
+	Stats stats;
+	std::atomic<bool> running (true);
+	std::vector<std::unique_ptr<Receiver>> receivers;
+	std::thread memory_thread;
+	try {
+		for (unsigned int i = 0; i < settings.receivers; ++i) {
+			auto path = "sim:devices=6,seed=" + std::to_string (i+1) + "," + settings.sim_options;
+			receivers.push_back (std::make_unique<Receiver> (path, &stats, settings.timeout));
+		}
+		// Blocking memory calls have no timeout, the receiver used for
+		// memory writes never drops answers nor sleeps.
+		if (settings.memory_interval.count () > 0) {
+			auto path = "sim:devices=6,seed=0," + settings.sim_options + ",drop=0,sleep=0";
+			receivers.push_back (std::make_unique<Receiver> (path, &stats, settings.timeout));
+			memory_thread = std::thread (rewriteMemory, receivers.back ()->dispatcher.get (),
+						     &stats, settings.memory_interval, &running);
+		}
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to create the simulated receivers: %s\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	for (auto &receiver: receivers) {
+		receiver->consumer = std::thread (consumeEvents, receiver.get (), &stats, &running);
+		for (auto &ping: receiver->pings)
+			ping->start ();
+	}
+
+	auto start = clock_type::now ();
+	auto last_report = start;
+	long first_rss = -1;
+	Counters total;
+	double worst_p99 = 0, max_rtt = 0; // over the intervals
+	while (!interrupted) {
+		auto now = clock_type::now ();
+		bool finished = settings.duration.count () > 0 && now - start >= settings.duration;
+		if (finished || now - last_report >= settings.interval) {
+			auto counters = stats.take ();
+			long rss = residentKB ();
+			if (first_rss < 0)
+				first_rss = rss;
+			printCounters ("interval",
+				       std::chrono::duration<double> (now - start).count (),
+				       std::chrono::duration<double> (now - last_report).count (),
+				       counters, receivers, rss);
+			if (!counters.rtt_us.empty ()) { // sorted by printCounters
+				worst_p99 = std::max (worst_p99, percentile (counters.rtt_us, 0.99));
+				max_rtt = std::max (max_rtt, counters.rtt_us.back ());
+			}
+			total.merge (counters);
+			last_report = now;
+		}
+		if (finished)
+			break;
+		std::this_thread::sleep_for (std::chrono::milliseconds (100));
+	}
+
+	running = false;
+	if (memory_thread.joinable ())
+		memory_thread.join ();
+	auto elapsed = std::chrono::duration<double> (clock_type::now () - start).count ();
+	total.merge (stats.take ());
+	uint64_t dropped = 0;
+	for (const auto &receiver: receivers)
+		dropped += receiver->dropped ();
+	long rss = residentKB ();
+	printf ("{\"kind\":\"total\",\"elapsed_s\":%.1f,"
+		"\"commands\":%llu,\"commands_per_s\":%.1f,"
+		"\"worst_rtt_p99_us\":%.0f,\"rtt_max_us\":%.0f,"
+		"\"timeouts\":%llu,\"errors\":%llu,\"failures\":%llu,"
+		"\"events\":%llu,\"events_dropped\":%llu,"
+		"\"memory_syncs\":%llu,\"memory_failures\":%llu,"
+		"\"rss_kb\":%ld,\"rss_growth_kb\":%ld}\n",
+		elapsed,
+		static_cast<unsigned long long> (total.answers), elapsed > 0 ? total.answers / elapsed : 0,
+		worst_p99, max_rtt,
+		static_cast<unsigned long long> (total.timeouts),
+		static_cast<unsigned long long> (total.errors),
+		static_cast<unsigned long long> (total.failures),
+		static_cast<unsigned long long> (total.events),
+		static_cast<unsigned long long> (dropped),
+		static_cast<unsigned long long> (total.syncs),
+		static_cast<unsigned long long> (total.sync_failures),
+		rss, first_rss >= 0 && rss >= 0 ? rss - first_rss : 0);
+	receivers.clear ();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HID_COMPLETION_PORT_H
+#define LIBHIDPP_HID_COMPLETION_PORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+
+namespace HID
+{
+
+class RawDevice;
+
+/**
+ * Reads reports from many devices with an I/O completion port.
+ *
+ * Each added device keeps several overlapped reads queued on every one of
+ * its handles, so no report is lost while a previous one is processed.
+ * Completions are processed by the threads calling \ref wait, any number
+ * of them. The handlers of a device are called by one thread at a time
+ * and in the order the reports were read.
+ *
+ * Only implemented by the windows backend.
+ */
+class CompletionPort
+{
+public:
+	typedef std::function<void (const uint8_t *report, std::size_t length)> report_handler;
+	typedef std::function<void (std::exception_ptr error)> error_handler;
+
+	CompletionPort ();
+	~CompletionPort ();
+
+	CompletionPort (const CompletionPort &) = delete;
+	CompletionPort &operator= (const CompletionPort &) = delete;
+
+	/**
+	 * Start reading \p dev, with \p queued_reads reads of \p report_size
+	 * bytes on each of its handles.
+	 *
+	 * The device handles are reopened so that synchronous uses of \p dev
+	 * (e.g. \ref RawDevice::writeReport) are not reported to the port.
+	 * After \p error_handler is called, reading the device stops but it
+	 * must still be removed.
+	 *
+	 * \throws std::system_error
+	 */
+	void add (const RawDevice &dev, report_handler &&report_handler,
+		  error_handler &&error_handler,
+		  std::size_t report_size, unsigned int queued_reads = 4);
+	/**
+	 * Cancel the reads of \p dev and wait for them to finish.
+	 *
+	 * Must not be called from a handler of \p dev.
+	 */
+	void remove (const RawDevice &dev);
+
+	/**
+	 * Process one completion, waiting at most \p timeout milliseconds
+	 * (forever if negative).
+	 *
+	 * \returns false on timeout or if woken up by \ref wakeup.
+	 */
+	bool wait (int timeout = -1);
+	/**
+	 * Make one thread waiting in \ref wait return. Can be called from any
+	 * thread.
+	 */
+	void wakeup ();
+
+private:
+	struct PrivateImpl;
+	std::unique_ptr<PrivateImpl> _p;
+};
+
+}
+
+#endif
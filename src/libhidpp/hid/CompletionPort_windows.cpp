@@ -0,0 +1,299 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "CompletionPort.h"
+
+#include "RawDevice.h"
+
+#include <misc/Log.h>
+#include <misc/Probes.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+#include <cstring>
+
+extern "C" {
+#include <windows.h>
+}
+
+#include "windows/error_category.h"
+
+using namespace HID;
+
+static Log::Handle ReportLog (Log::Debug, "report");
+
+namespace
+{
+
+struct Source;
+
+struct Read
+{
+	OVERLAPPED overlapped; // completions give back its address
+	Source *source;
+	std::size_t stream;
+	std::vector<uint8_t> buffer;
+	DWORD length;
+	DWORD error;
+	bool done;
+};
+
+struct Stream
+{
+	HANDLE file;
+	std::vector<std::unique_ptr<Read>> reads;
+	std::size_t next; // next read to complete, in issuing order
+	bool failed;
+};
+
+struct Source
+{
+	const RawDevice *device;
+	CompletionPort::report_handler report_handler;
+	CompletionPort::error_handler error_handler;
+	std::vector<Stream> streams;
+	std::mutex mutex; // held while calling the handlers
+	std::condition_variable finished;
+	unsigned int outstanding; // issued reads not yet passed to complete
+	bool removing;
+
+	~Source ()
+	{
+		for (auto &stream: streams)
+			CloseHandle (stream.file);
+	}
+
+	// Called with mutex locked. A read that cannot be issued is marked as
+	// completed with an error and fails its stream.
+	bool issue (Read &read)
+	{
+		auto &stream = streams[read.stream];
+		memset (&read.overlapped, 0, sizeof (OVERLAPPED));
+		read.done = false;
+		read.error = ERROR_SUCCESS;
+		++outstanding;
+		// The completion is queued to the port even if the read
+		// finishes immediately.
+		if (!ReadFile (stream.file, read.buffer.data (), read.buffer.size (),
+			       nullptr, &read.overlapped)) {
+			DWORD err = GetLastError ();
+			if (err != ERROR_IO_PENDING) {
+				read.error = err;
+				read.done = true;
+				fail (stream, err);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Called with mutex locked.
+	void fail (Stream &stream, DWORD err)
+	{
+		if (stream.failed)
+			return;
+		stream.failed = true;
+		CancelIoEx (stream.file, nullptr);
+		if (removing)
+			return;
+		try {
+			error_handler (std::make_exception_ptr (std::system_error (
+					err, windows_category (), "ReadFile")));
+		}
+		catch (std::exception &e) {
+			Log::error () << "Exception in read error handler: " << e.what () << std::endl;
+		}
+	}
+
+	// Called with mutex locked, delivers the completed reads of the
+	// stream in issuing order.
+	void complete (Stream &stream)
+	{
+		while (stream.reads[stream.next]->done) {
+			Read &read = *stream.reads[stream.next];
+			stream.next = (stream.next + 1) % stream.reads.size ();
+			read.done = false;
+			--outstanding;
+			if (removing || stream.failed)
+				continue;
+			if (read.error != ERROR_SUCCESS) {
+				fail (stream, read.error);
+				continue;
+			}
+			LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Recv HID report:",
+					read.buffer.begin (),
+					read.buffer.begin () + read.length);
+			device->captureReport (ReportCapture::Input,
+					       read.buffer.data (), read.length);
+			LIBHIDPP_PROBE_REPORT (report_received,
+					       read.buffer.data (), read.length);
+			try {
+				report_handler (read.buffer.data (), read.length);
+			}
+			catch (std::exception &e) {
+				Log::error () << "Exception in report handler: " << e.what () << std::endl;
+			}
+			if (!removing && !stream.failed)
+				issue (read);
+		}
+		if (outstanding == 0)
+			finished.notify_all ();
+	}
+
+	// Cancel every read and wait for the kernel to release them.
+	void cancel (std::unique_lock<std::mutex> &lock)
+	{
+		removing = true;
+		for (auto &stream: streams) {
+			CancelIoEx (stream.file, nullptr);
+			if (!stream.reads.empty ())
+				complete (stream); // reads that failed to be issued
+		}
+		finished.wait (lock, [this] () { return outstanding == 0; });
+	}
+};
+
+}
+
+struct CompletionPort::PrivateImpl
+{
+	HANDLE port;
+	std::mutex mutex;
+	std::map<const RawDevice *, std::unique_ptr<Source>> sources;
+};
+
+CompletionPort::CompletionPort ():
+	_p (std::make_unique<PrivateImpl> ())
+{
+	_p->port = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, 0);
+	if (_p->port == NULL)
+		throw std::system_error (GetLastError (), windows_category (),
+					 "CreateIoCompletionPort");
+}
+
+CompletionPort::~CompletionPort ()
+{
+	std::vector<const RawDevice *> devices;
+	for (const auto &[dev, source]: _p->sources)
+		devices.push_back (dev);
+	for (auto dev: devices)
+		remove (*dev);
+	CloseHandle (_p->port);
+}
+
+void CompletionPort::add (const RawDevice &dev, report_handler &&report_handler,
+			  error_handler &&error_handler,
+			  std::size_t report_size, unsigned int queued_reads)
+{
+	if (queued_reads == 0)
+		throw std::invalid_argument ("CompletionPort needs at least one queued read");
+	auto source = std::make_unique<Source> ();
+	source->device = &dev;
+	source->report_handler = std::move (report_handler);
+	source->error_handler = std::move (error_handler);
+	source->outstanding = 0;
+	source->removing = false;
+	for (HANDLE handle: dev.handles ()) {
+		HANDLE file = ReOpenFile (handle,
+					  GENERIC_READ | GENERIC_WRITE,
+					  FILE_SHARE_READ | FILE_SHARE_WRITE,
+					  FILE_FLAG_OVERLAPPED);
+		if (file == INVALID_HANDLE_VALUE)
+			throw std::system_error (GetLastError (), windows_category (),
+						 "ReOpenFile");
+		source->streams.push_back ({ file, {}, 0, false });
+		if (NULL == CreateIoCompletionPort (file, _p->port, 0, 0))
+			throw std::system_error (GetLastError (), windows_category (),
+						 "CreateIoCompletionPort");
+	}
+	std::unique_lock<std::mutex> lock (source->mutex);
+	for (std::size_t i = 0; i < source->streams.size (); ++i) {
+		auto &stream = source->streams[i];
+		for (unsigned int j = 0; j < queued_reads; ++j) {
+			auto read = std::make_unique<Read> ();
+			read->source = source.get ();
+			read->stream = i;
+			read->buffer.resize (report_size);
+			read->done = false;
+			stream.reads.push_back (std::move (read));
+		}
+		for (auto &read: stream.reads) {
+			if (!source->issue (*read)) {
+				DWORD err = read->error;
+				source->cancel (lock);
+				throw std::system_error (err, windows_category (), "ReadFile");
+			}
+		}
+	}
+	lock.unlock ();
+	std::unique_lock<std::mutex> sources_lock (_p->mutex);
+	_p->sources.emplace (&dev, std::move (source));
+}
+
+void CompletionPort::remove (const RawDevice &dev)
+{
+	std::unique_ptr<Source> source;
+	{
+		std::unique_lock<std::mutex> lock (_p->mutex);
+		auto it = _p->sources.find (&dev);
+		if (it == _p->sources.end ())
+			throw std::invalid_argument ("Device is not read by this completion port");
+		source = std::move (it->second);
+		_p->sources.erase (it);
+	}
+	// Pending completions still point to the source, it is destroyed
+	// once they are all processed.
+	std::unique_lock<std::mutex> lock (source->mutex);
+	source->cancel (lock);
+}
+
+bool CompletionPort::wait (int timeout)
+{
+	DWORD length;
+	ULONG_PTR key;
+	OVERLAPPED *overlapped;
+	BOOL ok = GetQueuedCompletionStatus (_p->port, &length, &key, &overlapped,
+					     timeout < 0 ? INFINITE : timeout);
+	DWORD err = ok ? ERROR_SUCCESS : GetLastError ();
+	if (!overlapped) {
+		if (ok || err == WAIT_TIMEOUT)
+			return false; // woken up or timed out
+		throw std::system_error (err, windows_category (),
+					 "GetQueuedCompletionStatus");
+	}
+	// Read is not standard-layout, find it from its member.
+	Read *read = CONTAINING_RECORD (overlapped, Read, overlapped);
+	Source *source = read->source;
+	std::unique_lock<std::mutex> lock (source->mutex);
+	read->length = length;
+	read->error = err;
+	read->done = true;
+	source->complete (source->streams[read->stream]);
+	return true;
+}
+
+void CompletionPort::wakeup ()
+{
+	if (!PostQueuedCompletionStatus (_p->port, 0, 0, NULL))
+		throw std::system_error (GetLastError (), windows_category (),
+					 "PostQueuedCompletionStatus");
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DeviceMonitor.h"
+
+#include <misc/Log.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace HID;
+
+struct DeviceMonitor::Workers
+{
+	struct PathCalls
+	{
+		std::deque<bool> calls; // true for addDevice, false for removeDevice
+		bool running = false;
+	};
+
+	std::mutex mutex;
+	std::condition_variable ready_cond, idle_cond;
+	// Paths with calls waiting and no call running
+	std::deque<std::string> ready;
+	// Paths with calls waiting or running
+	std::map<std::string, PathCalls> paths;
+	bool stopping = false;
+	std::vector<std::thread> threads;
+
+	void post (const char *path, bool add);
+	void serve (DeviceMonitor *monitor);
+	void wait ();
+	void stop ();
+};
+
+void DeviceMonitor::Workers::post (const char *path, bool add)
+{
+	std::unique_lock<std::mutex> lock (mutex);
+	auto &path_calls = paths[path];
+	path_calls.calls.push_back (add);
+	if (!path_calls.running && path_calls.calls.size () == 1) {
+		ready.emplace_back (path);
+		ready_cond.notify_one ();
+	}
+}
+
+void DeviceMonitor::Workers::serve (DeviceMonitor *monitor)
+{
+	std::unique_lock<std::mutex> lock (mutex);
+	while (true) {
+		ready_cond.wait (lock, [this] () { return stopping || !ready.empty (); });
+		if (ready.empty ())
+			return; // stopping with nothing left
+		std::string path = std::move (ready.front ());
+		ready.pop_front ();
+		auto &path_calls = paths[path];
+		bool add = path_calls.calls.front ();
+		path_calls.calls.pop_front ();
+		path_calls.running = true;
+		lock.unlock ();
+		try {
+			if (add)
+				monitor->addDevice (path.c_str ());
+			else
+				monitor->removeDevice (path.c_str ());
+		}
+		catch (std::exception &e) {
+			Log::error ().printf ("Failed to %s device %s: %s\n",
+					      add ? "add" : "remove", path.c_str (), e.what ());
+		}
+		lock.lock ();
+		// The map node is not invalidated by other paths
+		path_calls.running = false;
+		if (path_calls.calls.empty ()) {
+			paths.erase (path);
+			if (paths.empty ())
+				idle_cond.notify_all ();
+		}
+		else {
+			ready.push_back (std::move (path));
+			ready_cond.notify_one ();
+		}
+	}
+}
+
+void DeviceMonitor::Workers::wait ()
+{
+	std::unique_lock<std::mutex> lock (mutex);
+	idle_cond.wait (lock, [this] () { return paths.empty (); });
+}
+
+void DeviceMonitor::Workers::stop ()
+{
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		stopping = true;
+	}
+	ready_cond.notify_all ();
+	for (auto &thread: threads)
+		thread.join ();
+}
+
+void DeviceMonitor::WorkersDeleter::operator() (Workers *workers) const
+{
+	delete workers;
+}
+
+void DeviceMonitor::setWorkerCount (unsigned int count)
+{
+	if (_workers) {
+		_workers->stop ();
+		_workers.reset ();
+	}
+	if (count == 0)
+		return;
+	_workers.reset (new Workers);
+	for (unsigned int i = 0; i < count; ++i)
+		_workers->threads.emplace_back (&Workers::serve, _workers.get (), this);
+}
+
+void DeviceMonitor::deviceAdded (const char *path)
+{
+	if (_workers)
+		_workers->post (path, true);
+	else
+		addDevice (path);
+}
+
+void DeviceMonitor::deviceRemoved (const char *path)
+{
+	if (_workers)
+		_workers->post (path, false);
+	else
+		removeDevice (path);
+}
+
+void DeviceMonitor::waitWorkers ()
+{
+	if (_workers)
+		_workers->wait ();
+}
+
+void DeviceMonitor::setSettleTime (std::chrono::milliseconds settle_time)
+{
+	_settle_time = settle_time;
+}
+
+int DeviceMonitor::settleTimeout () const
+{
+	if (_held_events.empty ())
+		return -1;
+	auto deadline = std::chrono::steady_clock::time_point::max ();
+	for (const auto &p: _held_events)
+		deadline = std::min (deadline, p.second.deadline);
+	auto remaining = std::chrono::ceil<std::chrono::milliseconds> (
+			deadline - std::chrono::steady_clock::now ());
+	return std::max (0, static_cast<int> (remaining.count ()));
+}
+
+void DeviceMonitor::hotplugEvent (const char *path, bool add)
+{
+	if (_settle_time.count () == 0) {
+		if (add)
+			deviceAdded (path);
+		else
+			deviceRemoved (path);
+		return;
+	}
+	auto deadline = std::chrono::steady_clock::now () + _settle_time;
+	auto it = _held_events.find (path);
+	if (it == _held_events.end ())
+		// A device is added when it was absent, and removed when present
+		it = _held_events.emplace (path, HeldEvents { !add, false, !add, deadline }).first;
+	auto &held = it->second;
+	held.removed |= !add;
+	held.present = add;
+	held.deadline = deadline;
+}
+
+void DeviceMonitor::reportSettled ()
+{
+	auto now = std::chrono::steady_clock::now ();
+	for (auto it = _held_events.begin (); it != _held_events.end (); ) {
+		if (it->second.deadline > now) {
+			++it;
+			continue;
+		}
+		auto path = it->first;
+		auto held = it->second;
+		it = _held_events.erase (it);
+		if (held.reported_present && held.removed)
+			deviceRemoved (path.c_str ());
+		if (held.present && (!held.reported_present || held.removed))
+			deviceAdded (path.c_str ());
+	}
+}
@@ -19,11 +19,21 @@
 #ifndef LIBHIDPP_HID_DEVICE_MONITOR_H
 #define LIBHIDPP_HID_DEVICE_MONITOR_H
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace HID
 {
 
+class InterfaceRoleCache;
+
 /**
  * Enumerates and monitors HID devices.
  *
@@ -39,6 +49,54 @@ public:
 	DeviceMonitor ();
 	virtual ~DeviceMonitor ();
 
+	/**
+	 * Match rules applied before \ref addDevice, from the device
+	 * properties known to the system, so that unwanted devices are
+	 * never opened. Empty rules match every device.
+	 */
+	struct Filter
+	{
+		std::vector<uint16_t> vendor_ids;
+		std::vector<uint16_t> product_ids;
+		/**
+		 * USB interface number, devices that are not on USB never
+		 * match.
+		 */
+		std::optional<int> interface_number;
+		/**
+		 * Called with the raw report descriptor. Results are cached
+		 * by descriptor content, and devices whose descriptor cannot
+		 * be read or makes the check throw are accepted.
+		 *
+		 * Only applied by the linux backend.
+		 */
+		std::function<bool (const uint8_t *descriptor, std::size_t length)> descriptor_check;
+		/**
+		 * Results of \ref descriptor_check by model and USB
+		 * interface, kept across runs. Known interfaces are
+		 * accepted or rejected without reading their descriptor,
+		 * the others are checked and stored. Devices that are not
+		 * on USB are always checked.
+		 *
+		 * Only applied by the linux backend, the cache is saved
+		 * after each enumeration.
+		 */
+		std::shared_ptr<InterfaceRoleCache> interface_cache;
+
+		bool matchIDs (uint16_t vendor_id, uint16_t product_id) const noexcept {
+			auto match = [] (const std::vector<uint16_t> &ids, uint16_t id) {
+				return ids.empty () || ids.end () != std::find (ids.begin (), ids.end (), id);
+			};
+			return match (vendor_ids, vendor_id) && match (product_ids, product_id);
+		}
+	};
+
+	/**
+	 * Set the filter for the following enumerations and added devices.
+	 * Removed devices are always reported.
+	 */
+	void setFilter (const Filter &filter);
+
 	/**
 	 * Enumerate current devices.
 	 *
@@ -62,13 +120,96 @@ public:
 	 */
 	void stop ();
 
+	/**
+	 * Start monitoring HID devices without blocking.
+	 *
+	 * Like \ref run, it starts by enumerating present devices. It returns
+	 * a file descriptor that becomes readable when hot plug events are
+	 * pending, \ref processEvents must then be called. This is meant for
+	 * integrating the monitor in an external event loop (e.g.
+	 * HIDPP::DispatcherReactor).
+	 *
+	 * Only implemented by the linux backend.
+	 */
+	int startMonitoring ();
+	/**
+	 * Call \ref addDevice or \ref removeDevice for pending events.
+	 *
+	 * It must also be called when the \ref settleTimeout expires.
+	 *
+	 * \see startMonitoring
+	 */
+	void processEvents ();
+	/**
+	 * Milliseconds until an event held by \ref setSettleTime must be
+	 * reported by \ref processEvents, -1 if no event is held.
+	 */
+	int settleTimeout () const;
+	/**
+	 * Stop monitoring started with \ref startMonitoring.
+	 */
+	void stopMonitoring ();
+
+	/**
+	 * Call \ref addDevice and \ref removeDevice from \p count worker
+	 * threads instead of the thread enumerating or processing events,
+	 * so that a slow device probe does not delay the other devices.
+	 *
+	 * Calls for the same path are made one at a time, in event order.
+	 * Calls for different paths may run concurrently and the subclass
+	 * must synchronize its own state. \ref enumerate returns when the
+	 * calls for the enumerated devices are done. Exceptions thrown by
+	 * the calls are logged.
+	 *
+	 * With a \p count of 0 (the default), calls are made synchronously.
+	 * Changing the count waits for the pending calls. A subclass using
+	 * workers must set the count back to 0 in its destructor, so that
+	 * no call is made on a partially destroyed object.
+	 */
+	void setWorkerCount (unsigned int count);
+
+	/**
+	 * Hold hot plug events until no other event happened on the same
+	 * path for \p settle_time, so that flapping devices (e.g. rapid
+	 * remove and add sequences) are reported once.
+	 *
+	 * The held events of a path are coalesced: a device added then
+	 * removed is not reported, a device removed and added again any
+	 * number of times is reported by one \ref removeDevice and one
+	 * \ref addDevice. Enumerations are not delayed. A zero settle
+	 * time (the default) reports events immediately.
+	 */
+	void setSettleTime (std::chrono::milliseconds settle_time);
+
 protected:
 	virtual void addDevice (const char *path) = 0;
 	virtual void removeDevice (const char *path) = 0;
 
 private:
+	// Call addDevice or removeDevice directly or through the workers
+	void deviceAdded (const char *path);
+	void deviceRemoved (const char *path);
+	void waitWorkers ();
+	// Report or hold a hot plug event
+	void hotplugEvent (const char *path, bool add);
+	// Report the held events whose settle time elapsed
+	void reportSettled ();
+
 	struct PrivateImpl;
 	std::unique_ptr<PrivateImpl> _p;
+	struct Workers;
+	// Workers are only complete in the backend-independent source
+	struct WorkersDeleter { void operator() (Workers *) const; };
+	std::unique_ptr<Workers, WorkersDeleter> _workers;
+	struct HeldEvents
+	{
+		bool reported_present; // state reported before the first held event
+		bool removed;
+		bool present;
+		std::chrono::steady_clock::time_point deadline;
+	};
+	std::chrono::milliseconds _settle_time;
+	std::map<std::string, HeldEvents> _held_events;
 };
 
 }
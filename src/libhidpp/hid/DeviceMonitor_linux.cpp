@@ -18,9 +18,15 @@
 
 #include "DeviceMonitor.h"
 
+#include <hid/InterfaceRoleCache.h>
 #include <misc/Log.h>
 
 #include <string>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
 
 extern "C" {
 #include <unistd.h>
@@ -33,12 +39,93 @@ using namespace HID;
 struct DeviceMonitor::PrivateImpl
 {
 	struct udev *ctx;
+	struct udev_monitor *monitor;
 	int pipe[2];
+	Filter filter;
+	std::map<std::vector<uint8_t>, bool> descriptor_checks;
+
+	bool accept (struct udev_device *device);
+	void saveInterfaceCache ();
 };
 
+bool DeviceMonitor::PrivateImpl::accept (struct udev_device *device)
+{
+	if (filter.vendor_ids.empty () && filter.product_ids.empty () &&
+			!filter.interface_number && !filter.descriptor_check)
+		return true;
+
+	struct udev_device *hid = udev_device_get_parent_with_subsystem_devtype (device, "hid", nullptr);
+	if (!hid)
+		return false;
+
+	// HID_ID is "bus:vendor:product" in hexadecimal
+	unsigned int bus, vendor_id, product_id;
+	const char *hid_id = udev_device_get_property_value (hid, "HID_ID");
+	if (!hid_id || 3 != sscanf (hid_id, "%x:%x:%x", &bus, &vendor_id, &product_id))
+		return false;
+	if (!filter.matchIDs (vendor_id, product_id))
+		return false;
+
+	std::optional<int> interface_number;
+	if (filter.interface_number || filter.interface_cache) {
+		struct udev_device *intf = udev_device_get_parent_with_subsystem_devtype (
+				device, "usb", "usb_interface");
+		const char *number = intf ? udev_device_get_sysattr_value (intf, "bInterfaceNumber") : nullptr;
+		if (number)
+			interface_number = strtol (number, nullptr, 16);
+	}
+	if (filter.interface_number && filter.interface_number != interface_number)
+		return false;
+
+	if (filter.descriptor_check && filter.interface_cache && interface_number) {
+		if (auto accepted = filter.interface_cache->find (vendor_id, product_id, *interface_number))
+			return *accepted;
+	}
+
+	if (filter.descriptor_check) {
+		std::ifstream file (std::string (udev_device_get_syspath (hid)) + "/report_descriptor",
+				    std::ios::binary);
+		std::vector<uint8_t> descriptor ((std::istreambuf_iterator<char> (file)),
+						 std::istreambuf_iterator<char> ());
+		if (!file.bad () && !descriptor.empty ()) {
+			auto it = descriptor_checks.find (descriptor);
+			if (it == descriptor_checks.end ()) {
+				bool ok = true;
+				try {
+					ok = filter.descriptor_check (descriptor.data (), descriptor.size ());
+				}
+				catch (std::exception &e) {
+					Log::debug ().printf ("Invalid report descriptor for %s: %s\n",
+							      udev_device_get_syspath (device), e.what ());
+				}
+				it = descriptor_checks.emplace (std::move (descriptor), ok).first;
+			}
+			if (filter.interface_cache && interface_number)
+				filter.interface_cache->store (vendor_id, product_id, *interface_number, it->second);
+			if (!it->second)
+				return false;
+		}
+	}
+	return true;
+}
+
+void DeviceMonitor::PrivateImpl::saveInterfaceCache ()
+{
+	if (!filter.interface_cache)
+		return;
+	try {
+		filter.interface_cache->save ();
+	}
+	catch (std::exception &e) {
+		Log::error () << "Failed to save interface cache: " << e.what () << std::endl;
+	}
+}
+
 DeviceMonitor::DeviceMonitor ():
-	_p (std::make_unique<PrivateImpl> ())
+	_p (std::make_unique<PrivateImpl> ()),
+	_settle_time (0)
 {
+	_p->monitor = nullptr;
 	if (-1 == pipe (_p->pipe))
 		throw std::system_error (errno, std::system_category (), "pipe");
 
@@ -49,11 +136,18 @@ DeviceMonitor::DeviceMonitor ():
 
 DeviceMonitor::~DeviceMonitor ()
 {
+	stopMonitoring ();
 	udev_unref (_p->ctx);
 	for (int i = 0; i < 2; ++i)
 		close (_p->pipe[i]);
 }
 
+void DeviceMonitor::setFilter (const Filter &filter)
+{
+	_p->filter = filter;
+	_p->descriptor_checks.clear ();
+}
+
 void DeviceMonitor::enumerate ()
 {
 	int ret;
@@ -76,62 +170,101 @@ void DeviceMonitor::enumerate ()
 	udev_list_entry_foreach (current, udev_enumerate_get_list_entry (enumerator)) {
 		const char *name = udev_list_entry_get_name (current);
 		struct udev_device *device = udev_device_new_from_syspath (_p->ctx, name);
-		addDevice (udev_device_get_devnode (device));
+		if (_p->accept (device))
+			deviceAdded (udev_device_get_devnode (device));
 		udev_device_unref (device);
 	}
 	udev_enumerate_unref (enumerator);
+	_p->saveInterfaceCache ();
+	waitWorkers ();
 }
 
 void DeviceMonitor::run ()
+{
+	int fd = startMonitoring ();
+	while (true) {
+		fd_set fds;
+		FD_ZERO (&fds);
+		FD_SET (_p->pipe[0], &fds);
+		FD_SET (fd, &fds);
+		int timeout = settleTimeout ();
+		timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+		if (-1 == select (std::max (_p->pipe[0], fd)+1, &fds, nullptr, nullptr,
+				  timeout < 0 ? nullptr : &tv)) {
+			if (errno == EINTR)
+				continue;
+			throw std::system_error (errno, std::system_category (), "select");
+		}
+		if (FD_ISSET (fd, &fds) || timeout >= 0)
+			processEvents ();
+		if (FD_ISSET (_p->pipe[0], &fds)) {
+			char c;
+			if (-1 == read (_p->pipe[0], &c, sizeof (char)))
+				throw std::system_error (errno, std::system_category (),
+							 "read pipe");
+			break;
+		}
+	}
+	stopMonitoring ();
+}
+
+int DeviceMonitor::startMonitoring ()
 {
 	int ret;
 
+	if (_p->monitor)
+		throw std::logic_error ("DeviceMonitor is already monitoring");
+
 	struct udev_monitor *monitor = udev_monitor_new_from_netlink (_p->ctx, "udev");
 	if (!monitor)
 		throw std::runtime_error ("udev_monitor_new_from_netlink failed");
 
 	ret = udev_monitor_filter_add_match_subsystem_devtype (monitor, "hidraw", nullptr);
-	if (0 != ret)
+	if (0 != ret) {
+		udev_monitor_unref (monitor);
 		throw std::system_error (-ret, std::system_category (),
 					 "udev_monitor_filter_add_match_subsystem_devtype");
+	}
 
 	ret = udev_monitor_enable_receiving (monitor);
-	if (0 != ret)
+	if (0 != ret) {
+		udev_monitor_unref (monitor);
 		throw std::system_error (-ret, std::system_category (),
 					 "udev_monitor_enable_receiving");
+	}
+	_p->monitor = monitor;
 
 	enumerate ();
 
-	int fd = udev_monitor_get_fd (monitor);
-	while (true) {
-		fd_set fds;
-		FD_ZERO (&fds);
-		FD_SET (_p->pipe[0], &fds);
-		FD_SET (fd, &fds);
-		if (-1 == select (std::max (_p->pipe[0], fd)+1, &fds, nullptr, nullptr, nullptr)) {
-			if (errno == EINTR)
-				continue;
-			throw std::system_error (errno, std::system_category (), "select");
-		}
-		if (FD_ISSET (fd, &fds)) {
-			struct udev_device *device = udev_monitor_receive_device (monitor);
-			std::string action = udev_device_get_action (device);
-			if (action == "add")
-				addDevice (udev_device_get_devnode (device));
-			else if (action == "remove")
-				removeDevice (udev_device_get_devnode (device));
-			udev_device_unref (device);
-		}
-		if (FD_ISSET (_p->pipe[0], &fds)) {
-			char c;
-			if (-1 == read (_p->pipe[0], &c, sizeof (char)))
-				throw std::system_error (errno, std::system_category (),
-							 "read pipe");
-			break;
+	return udev_monitor_get_fd (monitor);
+}
+
+void DeviceMonitor::processEvents ()
+{
+	// The monitor socket is non-blocking, receive until every pending event is read.
+	while (struct udev_device *device = udev_monitor_receive_device (_p->monitor)) {
+		const char *action = udev_device_get_action (device);
+		const char *devnode = udev_device_get_devnode (device);
+		if (action && devnode) {
+			if (0 == strcmp (action, "add")) {
+				if (_p->accept (device))
+					hotplugEvent (devnode, true);
+			}
+			else if (0 == strcmp (action, "remove"))
+				hotplugEvent (devnode, false);
 		}
+		udev_device_unref (device);
 	}
+	reportSettled ();
+}
 
-	udev_monitor_unref (monitor);
+void DeviceMonitor::stopMonitoring ()
+{
+	_held_events.clear ();
+	if (_p->monitor) {
+		udev_monitor_unref (_p->monitor);
+		_p->monitor = nullptr;
+	}
 }
 
 void DeviceMonitor::stop ()
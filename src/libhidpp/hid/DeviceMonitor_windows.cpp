@@ -24,16 +24,16 @@
 #include <locale>
 #include <codecvt>
 #include <condition_variable>
+#include <deque>
 #include <set>
+#include <cwchar>
 
 extern "C" {
 #include <windows.h>
-#include <hidsdi.h>
-#include <setupapi.h>
 }
 
 #include "windows/error_category.h"
-#include "windows/DeviceData.h"
+#include "windows/InterfaceCache.h"
 
 using namespace HID;
 
@@ -41,10 +41,43 @@ struct DeviceMonitor::PrivateImpl
 {
 	std::mutex mutex;
 	std::condition_variable cond;
+	// Parent device arrivals and removals from InterfaceCache
+	std::deque<std::pair<std::wstring, bool>> events;
+	bool stopping = false;
+	Filter filter;
+
+	bool accept (const std::wstring &device_id) const;
 };
 
+// Read the hexadecimal value following key (e.g. "VID_") in a device ID
+static std::optional<unsigned long> deviceIDValue (const std::wstring &device_id, const wchar_t *key)
+{
+	auto pos = device_id.find (key);
+	if (pos == std::wstring::npos)
+		return std::nullopt;
+	return std::wcstoul (device_id.c_str () + pos + wcslen (key), nullptr, 16);
+}
+
+bool DeviceMonitor::PrivateImpl::accept (const std::wstring &device_id) const
+{
+	// IDs look like "HID\VID_046D&PID_C52B&MI_02&Col01\..."
+	if (!filter.vendor_ids.empty () || !filter.product_ids.empty ()) {
+		auto vendor_id = deviceIDValue (device_id, L"VID_");
+		auto product_id = deviceIDValue (device_id, L"PID_");
+		if (!vendor_id || !product_id || !filter.matchIDs (*vendor_id, *product_id))
+			return false;
+	}
+	if (filter.interface_number) {
+		auto number = deviceIDValue (device_id, L"MI_");
+		if (!number || *number != static_cast<unsigned long> (*filter.interface_number))
+			return false;
+	}
+	return true;
+}
+
 DeviceMonitor::DeviceMonitor ():
-	_p (std::make_unique<PrivateImpl> ())
+	_p (std::make_unique<PrivateImpl> ()),
+	_settle_time (0)
 {
 }
 
@@ -52,39 +85,91 @@ DeviceMonitor::~DeviceMonitor ()
 {
 }
 
+void DeviceMonitor::setFilter (const Filter &filter)
+{
+	_p->filter = filter;
+}
+
 void DeviceMonitor::enumerate ()
 {
 	std::wstring_convert<std::codecvt_utf8<wchar_t, 0x10ffff, std::little_endian>> wconv;
 
-	GUID hid_guid;
-	HidD_GetHidGuid (&hid_guid);
-
 	std::set<std::wstring> ids;
-	DeviceEnumerator enumerator (&hid_guid);
-	int i = 0;
-	while (auto dev = enumerator.get (i++)) {
-		bool ok;
-		DEVINST parent;
-		std::tie (ok, parent) = dev->parentInst ();
-		if (!ok)
-			continue;
-		auto ret = ids.emplace (DeviceData::getDeviceID (parent));
-		if (ret.second)
-			addDevice (wconv.to_bytes (*ret.first).c_str ());
+	for (const auto &iface: InterfaceCache::instance ().interfaces ()) {
+		auto ret = ids.emplace (iface.parent_id);
+		if (ret.second && _p->accept (*ret.first))
+			deviceAdded (wconv.to_bytes (*ret.first).c_str ());
 	}
+	waitWorkers ();
 }
 
 void DeviceMonitor::run ()
 {
-	enumerate ();
+	auto &cache = InterfaceCache::instance ();
+	bool listening = cache.addListener (this, [this] (const std::wstring &parent_id, bool added) {
+		std::unique_lock<std::mutex> lock (_p->mutex);
+		_p->events.emplace_back (parent_id, added);
+		_p->cond.notify_all ();
+	});
+	if (!listening)
+		Log::warning () << "Hot plug monitoring not supported" << std::endl;
 
-	Log::warning () << "Hot plug monitoring not supported" << std::endl;
+	enumerate ();
 
 	std::unique_lock<std::mutex> lock (_p->mutex);
-	_p->cond.wait (lock);
+	auto ready = [this] () { return _p->stopping || !_p->events.empty (); };
+	while (!_p->stopping) {
+		int timeout = settleTimeout ();
+		if (timeout < 0)
+			_p->cond.wait (lock, ready);
+		else
+			_p->cond.wait_for (lock, std::chrono::milliseconds (timeout), ready);
+		if (_p->stopping)
+			break;
+		lock.unlock ();
+		processEvents ();
+		lock.lock ();
+	}
+	_p->stopping = false;
+	lock.unlock ();
+
+	cache.removeListener (this);
+	stopMonitoring ();
 }
 
 void DeviceMonitor::stop ()
 {
+	std::unique_lock<std::mutex> lock (_p->mutex);
+	_p->stopping = true;
 	_p->cond.notify_all ();
 }
+
+int DeviceMonitor::startMonitoring ()
+{
+	throw std::runtime_error ("Non-blocking monitoring is not supported");
+}
+
+void DeviceMonitor::processEvents ()
+{
+	std::wstring_convert<std::codecvt_utf8<wchar_t, 0x10ffff, std::little_endian>> wconv;
+
+	std::deque<std::pair<std::wstring, bool>> events;
+	{
+		std::unique_lock<std::mutex> lock (_p->mutex);
+		std::swap (events, _p->events);
+	}
+	for (const auto &[parent_id, added]: events) {
+		if (!added)
+			hotplugEvent (wconv.to_bytes (parent_id).c_str (), false);
+		else if (_p->accept (parent_id))
+			hotplugEvent (wconv.to_bytes (parent_id).c_str (), true);
+	}
+	reportSettled ();
+}
+
+void DeviceMonitor::stopMonitoring ()
+{
+	_held_events.clear ();
+	std::unique_lock<std::mutex> lock (_p->mutex);
+	_p->events.clear ();
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "InterfaceRoleCache.h"
+
+#include <misc/Log.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+using namespace HID;
+
+static constexpr char Header[] = "# libhidpp interface cache 1";
+
+InterfaceRoleCache::InterfaceRoleCache (const std::string &path):
+	_path (path),
+	_modified (false)
+{
+	try {
+		load ();
+	}
+	catch (std::exception &e) {
+		Log::warning () << "Ignoring invalid interface cache " << path
+				<< ": " << e.what () << std::endl;
+		_roles.clear ();
+	}
+}
+
+InterfaceRoleCache::~InterfaceRoleCache ()
+{
+	try {
+		save ();
+	}
+	catch (std::exception &e) {
+		Log::error () << "Failed to save interface cache " << _path
+			      << ": " << e.what () << std::endl;
+	}
+}
+
+void InterfaceRoleCache::load ()
+{
+	std::ifstream in (_path);
+	if (!in)
+		return; // no cache yet
+	std::string line;
+	if (!std::getline (in, line) || line != Header)
+		throw std::runtime_error ("unknown format");
+	unsigned int line_number = 1;
+	while (std::getline (in, line)) {
+		++line_number;
+		std::istringstream ss (line);
+		unsigned int vendor_id, product_id, interface_number, accepted;
+		if (!(ss >> std::hex >> vendor_id >> product_id >> interface_number >> accepted) ||
+				vendor_id > 0xffff || product_id > 0xffff || accepted > 1)
+			throw std::runtime_error ("invalid interface at line " + std::to_string (line_number));
+		_roles[Key (vendor_id, product_id, interface_number)] = accepted;
+	}
+}
+
+void InterfaceRoleCache::save ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (!_modified)
+		return;
+	std::string tmp_path = _path + ".tmp";
+	{
+		std::ofstream out (tmp_path, std::ios::trunc);
+		if (!out)
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+		out << Header << std::endl << std::hex << std::setfill ('0');
+		for (const auto &[key, accepted]: _roles) {
+			const auto &[vendor_id, product_id, interface_number] = key;
+			out << std::setw (4) << vendor_id
+			    << " " << std::setw (4) << product_id
+			    << " " << std::setw (2) << interface_number
+			    << " " << accepted << std::endl;
+		}
+		if (!out.flush ())
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+	}
+	if (0 != std::rename (tmp_path.c_str (), _path.c_str ()))
+		throw std::system_error (errno, std::generic_category (), "rename");
+	_modified = false;
+}
+
+std::optional<bool> InterfaceRoleCache::find (uint16_t vendor_id, uint16_t product_id, int interface_number) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _roles.find (Key (vendor_id, product_id, interface_number));
+	if (it == _roles.end ())
+		return std::nullopt;
+	return it->second;
+}
+
+void InterfaceRoleCache::store (uint16_t vendor_id, uint16_t product_id, int interface_number, bool accepted)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto [it, inserted] = _roles.emplace (Key (vendor_id, product_id, interface_number), accepted);
+	if (inserted || it->second != accepted) {
+		it->second = accepted;
+		_modified = true;
+	}
+}
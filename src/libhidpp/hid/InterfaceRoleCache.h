@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HID_INTERFACE_ROLE_CACHE_H
+#define LIBHIDPP_HID_INTERFACE_ROLE_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+
+namespace HID
+{
+
+/**
+ * On-disk cache of DeviceMonitor::Filter::descriptor_check results by
+ * device model and USB interface, so that the report descriptor of an
+ * interface already seen is not read again.
+ *
+ * A cache file must only be used with a single descriptor check (e.g.
+ * HIDPP::deviceFilter). It is a text file with one interface per line
+ * and can be shared by several threads.
+ */
+class InterfaceRoleCache
+{
+public:
+	/**
+	 * Load the cache from \p path if it exists.
+	 *
+	 * Invalid files are ignored (with a warning) and overwritten when
+	 * saving.
+	 */
+	InterfaceRoleCache (const std::string &path);
+	/**
+	 * Save the cache if it was modified, errors are only logged.
+	 */
+	~InterfaceRoleCache ();
+
+	InterfaceRoleCache (const InterfaceRoleCache &) = delete;
+	InterfaceRoleCache &operator= (const InterfaceRoleCache &) = delete;
+
+	/**
+	 * Write the cache if it was modified, replacing the file
+	 * atomically.
+	 *
+	 * \throws std::system_error
+	 */
+	void save ();
+
+	/**
+	 * Cached result of the descriptor check for the interface, if known.
+	 */
+	std::optional<bool> find (uint16_t vendor_id, uint16_t product_id, int interface_number) const;
+	void store (uint16_t vendor_id, uint16_t product_id, int interface_number, bool accepted);
+
+private:
+	void load ();
+
+	typedef std::tuple<uint16_t, uint16_t, int> Key;
+
+	std::string _path;
+	mutable std::mutex _mutex;
+	std::map<Key, bool> _roles;
+	bool _modified;
+};
+
+}
+
+#endif
@@ -19,15 +19,90 @@
 #include "RawDevice.h"
 
 #include <misc/Log.h>
+#include <misc/Probes.h>
 
 using namespace HID;
 
+static Log::Handle ReportLog (Log::Debug, "report");
+
+int RawDevice::writeReport (const std::vector<uint8_t> &report)
+{
+	return writeReport (report.data (), report.size ());
+}
+
+int RawDevice::readReport (std::vector<uint8_t> &report, int timeout)
+{
+	int ret = readReport (report.data (), report.size (), timeout);
+	report.resize (ret);
+	return ret;
+}
+
+void RawDevice::setCapture (std::shared_ptr<ReportCapture> capture, uint16_t device)
+{
+	_capture = std::move (capture);
+	_capture_device = device;
+}
+
+void RawDevice::openVirtualDevice (std::shared_ptr<VirtualDevice> device)
+{
+	_virtual = std::move (device);
+	_vendor_id = _virtual->vendorID ();
+	_product_id = _virtual->productID ();
+	_name = _virtual->name ();
+	_report_desc = std::make_shared<const ReportDescriptor> (_virtual->reportDescriptor ());
+	Log::debug ("hid").printf ("Opened virtual device \"%s\" (%04x:%04x)\n",
+			_name.c_str (), _vendor_id, _product_id);
+	logReportDescriptor ();
+}
+
+std::size_t RawDevice::readVirtualReports (uint8_t *reports, std::size_t report_size,
+					   int *lengths, std::size_t count, int timeout,
+					   std::chrono::steady_clock::time_point *times)
+{
+	std::size_t n = 0;
+	while (n < count) {
+		int ret = _virtual->readReport (reports + n*report_size, report_size,
+						n == 0 ? timeout : 0);
+		if (ret == 0)
+			break;
+		if (times)
+			times[n] = std::chrono::steady_clock::now ();
+		LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Recv HID report:",
+				reports + n*report_size,
+				reports + n*report_size + ret);
+		captureReport (ReportCapture::Input, reports + n*report_size, ret);
+		LIBHIDPP_PROBE_REPORT (report_received, reports + n*report_size, ret);
+		lengths[n++] = ret;
+	}
+	return n;
+}
+
+const ReportDescriptor &RawDevice::getReportDescriptor () const
+{
+	auto desc = std::atomic_load (&_report_desc);
+	if (desc)
+		return *desc;
+	try {
+		const auto &raw = rawReportDescriptor ();
+		desc = ReportDescriptor::fromRawDataCached (raw.data (), raw.size ());
+	}
+	catch (std::exception &e) {
+		Log::error () << "Invalid report descriptor: " << e.what () << std::endl;
+		desc = std::make_shared<const ReportDescriptor> ();
+	}
+	// Keep the descriptor stored by a concurrent call, if any
+	std::shared_ptr<const ReportDescriptor> expected;
+	if (!std::atomic_compare_exchange_strong (&_report_desc, &expected, desc))
+		return *expected;
+	return *desc;
+}
+
 void RawDevice::logReportDescriptor () const
 {
 	auto debug = Log::debug ("reportdesc");
 	if (!debug)
 		return;
-	for (const auto &collection: _report_desc.collections) {
+	for (const auto &collection: getReportDescriptor ().collections) {
 		debug << "Collection: " << std::hex << uint32_t (collection.usage) << std::dec << std::endl;
 		for (const auto &[id, fields]: collection.reports) {
 			const char *type;
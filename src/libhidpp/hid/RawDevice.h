@@ -19,11 +19,14 @@
 #ifndef LIBHIDPP_HID_RAW_DEVICE_H
 #define LIBHIDPP_HID_RAW_DEVICE_H
 
+#include <chrono>
 #include <string>
 #include <vector>
 #include <memory>
 
+#include <hid/ReportCapture.h>
 #include <hid/ReportDescriptor.h>
+#include <hid/VirtualDevice.h>
 
 namespace HID
 {
@@ -31,11 +34,38 @@ namespace HID
 class RawDevice
 {
 public:
+	/**
+	 * Bus the HID device is connected through.
+	 */
+	enum class Bus {
+		Unknown,
+		USB,
+		Bluetooth,
+	};
+
+	/**
+	 * Open the device at \p path, or a virtual device if the path
+	 * starts with a scheme registered with VirtualDevice::registerScheme.
+	 */
 	RawDevice (const std::string &path);
+	/**
+	 * Use \p device instead of a real HID device.
+	 */
+	RawDevice (std::shared_ptr<VirtualDevice> device);
 	RawDevice (const RawDevice &other);
 	RawDevice (RawDevice &&other);
 	~RawDevice ();
 
+	/**
+	 * Use \p fd, an open hidraw node, for the next RawDevice opening
+	 * \p path instead of opening it again. The device takes ownership
+	 * of \p fd, reports already queued in it are not lost.
+	 *
+	 * This is for a process taking over the devices of another one
+	 * (see HIDPP::Handoff). Only implemented by the linux backend.
+	 */
+	static void adoptFileDescriptor (const std::string &path, int fd);
+
 	inline uint16_t vendorID () const
 	{
 		return _vendor_id;
@@ -44,16 +74,42 @@ public:
 	{
 		return _product_id;
 	}
+	/**
+	 * Bus of the device, Bus::Unknown for virtual devices or when the
+	 * backend cannot tell.
+	 */
+	inline Bus bus () const
+	{
+		return _bus;
+	}
 	const std::string &name () const
 	{
 		return _name;
 	}
-	const ReportDescriptor &getReportDescriptor () const
+	/**
+	 * Parsed report descriptor.
+	 *
+	 * Raw descriptors are only parsed when first needed, and devices
+	 * of the same model share the parsed descriptor (see
+	 * ReportDescriptor::fromRawDataCached). An invalid descriptor is
+	 * logged and parsed as empty.
+	 */
+	const ReportDescriptor &getReportDescriptor () const;
+	/**
+	 * Raw report descriptor bytes, empty when the backend only gives a
+	 * parsed descriptor (virtual devices, Windows).
+	 */
+	const std::vector<uint8_t> &rawReportDescriptor () const
 	{
-		return _report_desc;
+		static const std::vector<uint8_t> empty;
+		return _raw_report_desc ? *_raw_report_desc : empty;
 	}
 
 	int writeReport (const std::vector<uint8_t> &report);
+	/**
+	 * Write the \p length bytes of \p report without copying them.
+	 */
+	int writeReport (const uint8_t *report, std::size_t length);
 
 	/**
 	 * \param[out]	report	HID report
@@ -62,21 +118,123 @@ public:
 	 * \returns report size or 0 if interrupted or timed out.
 	 */
 	int readReport (std::vector<uint8_t> &report, int timeout = -1);
+	/**
+	 * Read a report in a caller-provided buffer.
+	 *
+	 * \param[out]	report	Buffer for the HID report
+	 * \param[in]	length	Size of the \p report buffer
+	 * \param[in]	timeout	Time-out in milliseconds, negative for no timeout.
+	 * \param[out]	time	If not null, the time the report was read at
+	 *
+	 * On Windows, the first call queues overlapped reads on every
+	 * handle of the device that stay queued between calls, with buffers
+	 * of \p length bytes at least.
+	 *
+	 * \returns report size or 0 if interrupted or timed out.
+	 */
+	int readReport (uint8_t *report, std::size_t length, int timeout = -1,
+			std::chrono::steady_clock::time_point *time = nullptr);
+	/**
+	 * Wait for a report and read every report already queued, up to \p count.
+	 *
+	 * Reports are stored in \p reports as consecutive slots of
+	 * \p report_size bytes, the length of each one is written in \p lengths.
+	 *
+	 * \param[out]	reports		Buffer of \p count * \p report_size bytes
+	 * \param[in]	report_size	Size of each report slot
+	 * \param[out]	lengths		Lengths of the read reports
+	 * \param[in]	count		Maximum number of reports to read
+	 * \param[in]	timeout		Time-out in milliseconds, negative for no timeout.
+	 * \param[out]	times		If not null, the time each report was read
+	 *				at, taken right after the read call.
+	 *
+	 * \returns the number of reports read or 0 if interrupted or timed out.
+	 */
+	std::size_t readReports (uint8_t *reports, std::size_t report_size,
+				 int *lengths, std::size_t count, int timeout = -1,
+				 std::chrono::steady_clock::time_point *times = nullptr);
 
 	/**
 	 * Interrupts the current (or next) readReport call so it returns immediately.
 	 */
 	void interruptRead ();
 
+	/**
+	 * Poll the device without sleeping for up to \p duration at the
+	 * start of each read, before waiting for reports. This trades a
+	 * busy CPU core for the wakeup latency of each report (use
+	 * with RealTime::Options::cpus). A zero duration (the default)
+	 * always waits.
+	 *
+	 * It may be changed at any time, the next read uses the new
+	 * duration. Only implemented by the linux backend, readers using
+	 * \ref fileDescriptor are not affected.
+	 */
+	void setBusyPoll (std::chrono::microseconds duration);
+
+	/**
+	 * File descriptor that becomes readable when a report is available,
+	 * for integrating the device in an external event loop.
+	 *
+	 * Only implemented by the linux backend, -1 for virtual devices.
+	 */
+	int fileDescriptor () const;
+	/**
+	 * Event file descriptor that becomes readable when \ref interruptRead
+	 * is called, for external event loops waiting on \ref fileDescriptor.
+	 *
+	 * Each interruption is a count of one read from it (EFD_SEMAPHORE).
+	 *
+	 * Only implemented by the linux backend, -1 for virtual devices.
+	 */
+	int interruptFileDescriptor () const;
+	/**
+	 * Handles of the HID collections of the device, opened for
+	 * overlapped I/O, for reading the device with a CompletionPort.
+	 *
+	 * Only implemented by the windows backend, empty for virtual devices.
+	 */
+	std::vector<void *> handles () const;
+
+	/**
+	 * Record every report written or read to \p capture as coming from
+	 * \p device, or stop recording if \p capture is null.
+	 *
+	 * Must not be called while the device is used by other threads.
+	 */
+	void setCapture (std::shared_ptr<ReportCapture> capture, uint16_t device = 0);
+	/**
+	 * Record a report to the capture, for readers using the
+	 * \ref fileDescriptor or \ref handles directly.
+	 */
+	inline void captureReport (ReportCapture::Direction direction,
+				   const uint8_t *report, std::size_t length) const noexcept
+	{
+		if (_capture)
+			_capture->record (_capture_device, direction, report, length);
+	}
+
 private:
 	RawDevice ();
 
+	void openVirtualDevice (std::shared_ptr<VirtualDevice> device);
+	std::size_t readVirtualReports (uint8_t *reports, std::size_t report_size,
+					int *lengths, std::size_t count, int timeout,
+					std::chrono::steady_clock::time_point *times);
+
 	struct PrivateImpl;
 	std::unique_ptr<PrivateImpl> _p;
 
 	uint16_t _vendor_id, _product_id;
+	Bus _bus = Bus::Unknown;
 	std::string _name;
-	ReportDescriptor _report_desc;
+	// Both are shared by the devices with the same descriptor (see
+	// ReportDescriptor::internRawData)
+	std::shared_ptr<const std::vector<uint8_t>> _raw_report_desc;
+	mutable std::shared_ptr<const ReportDescriptor> _report_desc; // parsed lazily from _raw_report_desc
+	std::shared_ptr<VirtualDevice> _virtual;
+	std::shared_ptr<ReportCapture> _capture;
+	uint16_t _capture_device = 0;
 
 	void logReportDescriptor () const;
 };
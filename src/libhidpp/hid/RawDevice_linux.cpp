@@ -19,37 +19,139 @@
 #include "RawDevice.h"
 
 #include <misc/Log.h>
+#include <misc/Probes.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 
 extern "C" {
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
 #include <linux/hidraw.h>
+#include <linux/input.h>
 }
 
 using namespace HID;
 
+static Log::Handle ReportLog (Log::Debug, "report");
+
+// File descriptors given with RawDevice::adoptFileDescriptor, by path
+static std::mutex adopted_mutex;
+static std::map<std::string, int> adopted_fds;
+
 struct RawDevice::PrivateImpl
 {
 	int fd;
-	int pipe[2];
+	int interrupt_fd; // eventfd counting pending interruptions
+	std::atomic<std::chrono::microseconds::rep> busy_poll {0};
+
+	/**
+	 * Create \c interrupt_fd.
+	 */
+	void openInterrupt ();
+
+	/**
+	 * Wait until a report can be read or the wait is interrupted.
+	 *
+	 * \returns true if the device is readable.
+	 */
+	bool waitForReport (int timeout);
 };
 
+void RawDevice::PrivateImpl::openInterrupt ()
+{
+	// As a semaphore, each read consumes one interruption.
+	interrupt_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	if (interrupt_fd == -1)
+		throw std::system_error (errno, std::system_category (), "eventfd");
+}
+
+bool RawDevice::PrivateImpl::waitForReport (int timeout)
+{
+	int ret;
+	pollfd fds[2] = {
+		{ fd, POLLIN, 0 },
+		{ interrupt_fd, POLLIN, 0 },
+	};
+	auto now = std::chrono::steady_clock::now ();
+	auto deadline = now + std::chrono::milliseconds (timeout);
+	if (auto busy = busy_poll.load (std::memory_order_relaxed)) {
+		auto spin_end = now + std::chrono::microseconds (busy);
+		if (timeout >= 0)
+			spin_end = std::min (spin_end, deadline);
+		do {
+			ret = poll (fds, 2, 0);
+			if (ret == -1 && errno != EINTR)
+				throw std::system_error (errno, std::system_category (), "poll");
+		} while (ret <= 0 && std::chrono::steady_clock::now () < spin_end);
+		if (ret > 0)
+			goto ready;
+		if (timeout >= 0 && std::chrono::steady_clock::now () >= deadline)
+			return false;
+	}
+	do {
+		int remaining = timeout;
+		if (timeout > 0)
+			remaining = std::max (0, static_cast<int> (std::chrono::ceil<std::chrono::milliseconds> (
+					deadline - std::chrono::steady_clock::now ()).count ()));
+		ret = poll (fds, 2, remaining);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+		throw std::system_error (errno, std::system_category (), "poll");
+ready:
+	if (fds[0].revents)
+		return true; // also when an error is pending, read will report it
+	if (fds[1].revents & POLLIN) {
+		uint64_t value;
+		if (-1 == read (interrupt_fd, &value, sizeof (value)) && errno != EAGAIN)
+			throw std::system_error (errno, std::system_category (), "read eventfd");
+	}
+	return false;
+}
+
 RawDevice::RawDevice ():
 	_p (std::make_unique<PrivateImpl> ())
 {
-	_p->fd = _p->pipe[0] = _p->pipe[1] = -1;
+	_p->fd = _p->interrupt_fd = -1;
 }
 
 RawDevice::RawDevice (const std::string &path):
 	_p (std::make_unique<PrivateImpl> ())
 {
-	_p->fd = ::open (path.c_str (), O_RDWR);
+	if (auto device = VirtualDevice::open (path)) {
+		_p->fd = _p->interrupt_fd = -1;
+		openVirtualDevice (std::move (device));
+		return;
+	}
+
+	_p->fd = -1;
+	{
+		std::unique_lock<std::mutex> lock (adopted_mutex);
+		auto it = adopted_fds.find (path);
+		if (it != adopted_fds.end ()) {
+			_p->fd = it->second;
+			adopted_fds.erase (it);
+		}
+	}
 	if (_p->fd == -1) {
-		throw std::system_error (errno, std::system_category (), "open");
+		// Reads are always preceded by a poll, the device is non-blocking
+		// so that readReports can drain it until it is empty.
+		_p->fd = ::open (path.c_str (), O_RDWR | O_NONBLOCK);
+		if (_p->fd == -1) {
+			throw std::system_error (errno, std::system_category (), "open");
+		}
+	}
+	else if (-1 == ::fcntl (_p->fd, F_SETFL, O_NONBLOCK)) {
+		int err = errno;
+		::close (_p->fd);
+		throw std::system_error (err, std::system_category (), "fcntl");
 	}
 
 	struct hidraw_devinfo di;
@@ -60,6 +162,14 @@ RawDevice::RawDevice (const std::string &path):
 	}
 	_vendor_id = di.vendor;
 	_product_id = di.product;
+	switch (di.bustype) {
+	case BUS_USB:
+		_bus = Bus::USB;
+		break;
+	case BUS_BLUETOOTH:
+		_bus = Bus::Bluetooth;
+		break;
+	}
 
 	char string[256];
 	int ret;
@@ -83,104 +193,174 @@ RawDevice::RawDevice (const std::string &path):
 		::close (_p->fd);
 		throw std::system_error (err, std::system_category (), "HIDIOCGRDESC");
 	}
+	_raw_report_desc = ReportDescriptor::internRawData (rdesc.value, rdesc.size);
+	logReportDescriptor ();
+
 	try {
-		_report_desc = ReportDescriptor::fromRawData (rdesc.value, rdesc.size);
-		logReportDescriptor ();
+		_p->openInterrupt ();
 	}
-	catch (std::exception &e) {
-		Log::error () << "Invalid report descriptor: " << e.what () << std::endl;
-	}
-
-	if (-1 == ::pipe (_p->pipe)) {
-		int err = errno;
+	catch (...) {
 		::close (_p->fd);
-		throw std::system_error (err, std::system_category (), "pipe");
+		throw;
 	}
 }
 
+RawDevice::RawDevice (std::shared_ptr<VirtualDevice> device):
+	RawDevice ()
+{
+	openVirtualDevice (std::move (device));
+}
+
 RawDevice::RawDevice (const RawDevice &other):
 	_p (std::make_unique<PrivateImpl> ()),
 	_vendor_id (other._vendor_id), _product_id (other._product_id),
+	_bus (other._bus),
 	_name (other._name),
-	_report_desc (other._report_desc)
+	_raw_report_desc (other._raw_report_desc),
+	_report_desc (std::atomic_load (&other._report_desc)),
+	_virtual (other._virtual),
+	_capture (other._capture),
+	_capture_device (other._capture_device)
 {
+	if (_virtual) {
+		_p->fd = _p->interrupt_fd = -1;
+		return;
+	}
 	_p->fd = ::dup (other._p->fd);
 	if (-1 == _p->fd) {
 		throw std::system_error (errno, std::system_category (), "dup");
 	}
-	if (-1 == ::pipe (_p->pipe)) {
-		int err = errno;
+	try {
+		_p->openInterrupt ();
+	}
+	catch (...) {
 		::close (_p->fd);
-		throw std::system_error (err, std::system_category (), "pipe");
+		throw;
 	}
 }
 
 RawDevice::RawDevice (RawDevice &&other):
 	_p (std::make_unique<PrivateImpl> ()),
 	_vendor_id (other._vendor_id), _product_id (other._product_id),
+	_bus (other._bus),
 	_name (std::move (other._name)),
-	_report_desc (std::move (other._report_desc))
+	_raw_report_desc (std::move (other._raw_report_desc)),
+	_report_desc (std::move (other._report_desc)),
+	_virtual (std::move (other._virtual)),
+	_capture (std::move (other._capture)),
+	_capture_device (other._capture_device)
 {
 	_p->fd = other._p->fd;
-	_p->pipe[0] = other._p->pipe[0];
-	_p->pipe[1] = other._p->pipe[1];
-	other._p->fd = other._p->pipe[0] = other._p->pipe[1] = -1;
+	_p->interrupt_fd = other._p->interrupt_fd;
+	other._p->fd = other._p->interrupt_fd = -1;
+}
+
+void RawDevice::adoptFileDescriptor (const std::string &path, int fd)
+{
+	std::unique_lock<std::mutex> lock (adopted_mutex);
+	auto [it, inserted] = adopted_fds.emplace (path, fd);
+	if (!inserted) {
+		::close (it->second);
+		it->second = fd;
+	}
 }
 
 RawDevice::~RawDevice ()
 {
 	if (_p->fd != -1) {
 		::close (_p->fd);
-		::close (_p->pipe[0]);
-		::close (_p->pipe[1]);
+		::close (_p->interrupt_fd);
 	}
 }
 
-int RawDevice::writeReport (const std::vector<uint8_t> &report)
+int RawDevice::writeReport (const uint8_t *report, std::size_t length)
 {
-	int ret = write (_p->fd, report.data (), report.size ());
-	if (ret == -1) {
+	int ret;
+	if (_virtual)
+		ret = _virtual->writeReport (report, length);
+	else if (-1 == (ret = write (_p->fd, report, length)))
 		throw std::system_error (errno, std::system_category (), "write");
-	}
-	Log::debug ("report").printBytes ("Send HID report:", report.begin (), report.end ());
+	LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Send HID report:", report, report+length);
+	captureReport (ReportCapture::Output, report, length);
+	LIBHIDPP_PROBE_REPORT (report_sent, report, length);
 	return ret;
 }
 
-int RawDevice::readReport (std::vector<uint8_t> &report, int timeout)
+int RawDevice::readReport (uint8_t *report, std::size_t length, int timeout,
+			   std::chrono::steady_clock::time_point *time)
 {
-	int ret;
-	timeval to = { timeout/1000, (timeout%1000) * 1000 };
-	fd_set fds;
-	do {
-		FD_ZERO (&fds);
-		FD_SET (_p->fd, &fds);
-		FD_SET (_p->pipe[0], &fds);
-		ret = select (std::max (_p->fd, _p->pipe[0])+1,
-				&fds, nullptr, nullptr,
-				(timeout < 0 ? nullptr : &to));
-	} while (ret == -1 && errno == EINTR);
-	if (ret == -1)
-		throw std::system_error (errno, std::system_category (), "select");
-	if (FD_ISSET (_p->fd, &fds)) {
-		ret = read (_p->fd, report.data (), report.size ());
-		if (ret == -1)
+	if (_virtual) {
+		int ret;
+		return readVirtualReports (report, length, &ret, 1, timeout, time) ? ret : 0;
+	}
+	while (_p->waitForReport (timeout)) {
+		int ret = read (_p->fd, report, length);
+		if (ret == -1) {
+			if (errno == EAGAIN)
+				continue; // the report was read by another copy of this device
 			throw std::system_error (errno, std::system_category (), "read");
-		report.resize (ret);
-		Log::debug ("report").printBytes ("Recv HID report:", report.begin (), report.end ());
+		}
+		if (time)
+			*time = std::chrono::steady_clock::now ();
+		LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Recv HID report:", report, report+ret);
+		captureReport (ReportCapture::Input, report, ret);
+		LIBHIDPP_PROBE_REPORT (report_received, report, ret);
 		return ret;
 	}
-	if (FD_ISSET (_p->pipe[0], &fds)) {
-		char c;
-		ret = read (_p->pipe[0], &c, sizeof (char));
-		if (ret == -1)
-			throw std::system_error (errno, std::system_category (), "read pipe");
-	}
 	return 0;
 }
 
+std::size_t RawDevice::readReports (uint8_t *reports, std::size_t report_size,
+				    int *lengths, std::size_t count, int timeout,
+				    std::chrono::steady_clock::time_point *times)
+{
+	if (_virtual)
+		return readVirtualReports (reports, report_size, lengths, count, timeout, times);
+	if (count == 0 || !_p->waitForReport (timeout))
+		return 0;
+	std::size_t n = 0;
+	while (n < count) {
+		uint8_t *report = reports + n*report_size;
+		int ret = read (_p->fd, report, report_size);
+		if (ret == -1) {
+			if (errno == EAGAIN)
+				break;
+			if (n > 0)
+				break; // return what has been read, the error will be raised by the next call
+			throw std::system_error (errno, std::system_category (), "read");
+		}
+		if (times)
+			times[n] = std::chrono::steady_clock::now ();
+		LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Recv HID report:", report, report+ret);
+		captureReport (ReportCapture::Input, report, ret);
+		LIBHIDPP_PROBE_REPORT (report_received, report, ret);
+		lengths[n++] = ret;
+	}
+	return n;
+}
+
 void RawDevice::interruptRead ()
 {
-	char c = 0;
-	if (-1 == write (_p->pipe[1], &c, sizeof (char)))
-		throw std::system_error (errno, std::system_category (), "write pipe");
+	if (_virtual) {
+		_virtual->interruptRead ();
+		return;
+	}
+	uint64_t value = 1;
+	if (-1 == write (_p->interrupt_fd, &value, sizeof (value)))
+		throw std::system_error (errno, std::system_category (), "write eventfd");
+}
+
+void RawDevice::setBusyPoll (std::chrono::microseconds duration)
+{
+	_p->busy_poll.store (duration.count (), std::memory_order_relaxed);
+}
+
+int RawDevice::fileDescriptor () const
+{
+	return _p->fd;
+}
+
+int RawDevice::interruptFileDescriptor () const
+{
+	return _p->interrupt_fd;
 }
@@ -19,7 +19,9 @@
 #include "RawDevice.h"
 
 #include <misc/Log.h>
+#include <misc/Probes.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <locale>
 #include <codecvt>
@@ -36,7 +38,7 @@ extern "C" {
 }
 
 #include "windows/error_category.h"
-#include "windows/DeviceData.h"
+#include "windows/InterfaceCache.h"
 
 #define ARRAY_SIZE(a) (sizeof (a)/sizeof ((a)[0]))
 
@@ -133,19 +135,177 @@ static_assert(sizeof(preparsed_data_item) == 104);
 
 using namespace HID;
 
+static Log::Handle ReportLog (Log::Debug, "report");
+
+// Build the top-level collection of an interface from its preparsed data
+static ReportCollection parseCollection (PHIDP_PREPARSED_DATA preparsed_data)
+{
+	auto header = reinterpret_cast<const preparsed_data_header *> (preparsed_data);
+	auto item = reinterpret_cast<const preparsed_data_item *> (header+1);
+
+	ReportCollection collection;
+	collection.usage = {header->usage_page, header->usage};
+
+	for (auto [report_type, item_count]: {
+			std::make_tuple (ReportID::Type::Input, header->input_item_count),
+			std::make_tuple (ReportID::Type::Output, header->output_item_count),
+			std::make_tuple (ReportID::Type::Feature, header->feature_item_count)}) {
+		std::map<ReportID, int> last_bit_pos; // byte_index * 8 + bit_index
+		for (int i = 0; i < item_count; ++i, ++item) {
+			ReportID id = {report_type, item->report_id};
+			auto [pos_it, pos_inserted] = last_bit_pos.emplace (id, -1);
+			auto [it, report_inserted] = collection.reports.emplace (id, 0);
+			int pos = item->byte_index * 8 + item->bit_index;
+			if (pos_it->second != -1 && pos_it->second >= pos) {
+				// Split items are in reverse order, try merging them if the position goes backward
+				auto &f = it->second.back ();
+				auto usages = std::get_if<std::vector<Usage>> (&f.usages);
+				if (!usages || item->usage_minimum != item->usage_maximum) {
+					Log::error ("reportdesc") << "Split item is a range item" << std::endl;
+					continue;
+				}
+				auto item_usage = Usage {item->usage_page, item->usage_minimum};
+				if (item->bit_size != f.size || item->bit_field != f.flags.bits)
+					Log::error ("reportdesc") << "Split item mismatch" << std::endl;
+				if (pos_it->second == pos) {
+					if (item->report_count != f.count)
+						Log::error ("reportdesc") << "Split item report count mismatch" << std::endl;
+					usages->insert (usages->begin (), item_usage);
+				}
+				else {
+					if (pos_it->second - pos != item->bit_size)
+						Log::error ("reportdesc") << "Split item unexpected position" << std::endl;
+					f.count += item->report_count;
+					f.offset = pos - 8; // after the report ID byte
+					if (usages->size () > 1 || usages->front () != item_usage)
+						usages->insert (usages->begin (), item_usage);
+				}
+			}
+			else {
+				// Create new item
+				auto &f = it->second.emplace_back ();
+				f.flags.bits = item->bit_field;
+				f.count = item->report_count;
+				f.size = item->bit_size;
+				f.offset = pos - 8; // after the report ID byte
+				f.logical_minimum = item->logical_minimum;
+				f.logical_maximum = item->logical_maximum;
+				if (item->usage_minimum == item->usage_maximum)
+					f.usages = std::vector {Usage {item->usage_page, item->usage_minimum}};
+				else
+					f.usages = std::make_pair (
+							Usage {item->usage_page, item->usage_minimum},
+							Usage {item->usage_page, item->usage_maximum});
+			}
+			pos_it->second = pos;
+		}
+	}
+	return collection;
+}
+
 struct RawDevice::PrivateImpl
 {
+	/**
+	 * Overlapped read kept queued on a handle between readReport calls,
+	 * its buffer is reused by the next read.
+	 */
+	struct QueuedRead
+	{
+		OVERLAPPED overlapped;
+		RAII_HANDLE event;
+		std::vector<uint8_t> buffer;
+		bool pending = false;
+	};
+	// Reports arriving between two readReport calls complete the next
+	// queued reads instead of being dropped.
+	static constexpr std::size_t QueuedReadCount = 4;
+	// ReadFile fails with buffers shorter than the input reports of the
+	// handle, callers asking for less only get truncated copies.
+	static constexpr std::size_t MinReadLength = 64;
 	struct Device
 	{
 		RAII_HANDLE file;
-		RAII_HANDLE event;
 		HIDP_CAPS caps;
+		// Completed in issue order, starting from reads[next]
+		std::vector<std::unique_ptr<QueuedRead>> reads;
+		std::size_t next = 0;
 	};
 	std::vector<Device> devices;
 	std::map<uint8_t, HANDLE> reports;
 	RAII_HANDLE interrupted_event;
+	// interrupted_event, then the event of the next read of each
+	// device. Empty until the reads are armed.
+	std::vector<HANDLE> wait_handles;
+
+	~PrivateImpl ();
+	/**
+	 * Queue the reads of every device, with buffers of at least
+	 * \p length bytes.
+	 */
+	void arm (std::size_t length);
+	void issue (HANDLE file, QueuedRead &read, std::size_t length);
 };
 
+RawDevice::PrivateImpl::~PrivateImpl ()
+{
+	// Buffers must outlive the reads using them.
+	for (auto &dev: devices) {
+		for (auto &read: dev.reads) {
+			if (!read->pending)
+				continue;
+			DWORD err, bytes;
+			if (!CancelIoEx (dev.file, &read->overlapped) &&
+					(err = GetLastError ()) != ERROR_NOT_FOUND) {
+				Log::error () << "Failed to cancel async read: "
+					      << windows_category ().message (err)
+					      << std::endl;
+				continue;
+			}
+			GetOverlappedResult (dev.file, &read->overlapped, &bytes, TRUE);
+		}
+	}
+}
+
+void RawDevice::PrivateImpl::arm (std::size_t length)
+{
+	DWORD err;
+	std::vector<HANDLE> handles = { interrupted_event };
+	for (auto &dev: devices) {
+		for (std::size_t i = 0; i < QueuedReadCount; ++i) {
+			auto read = std::make_unique<QueuedRead> ();
+			read->event = CreateEvent (NULL, TRUE, FALSE, NULL);
+			if (read->event == NULL) {
+				err = GetLastError ();
+				throw std::system_error (err, windows_category (),
+							 "CreateEvent");
+			}
+			issue (dev.file, *read, length);
+			dev.reads.push_back (std::move (read));
+		}
+		dev.next = 0;
+		handles.push_back (dev.reads.front ()->event);
+	}
+	wait_handles = std::move (handles);
+}
+
+void RawDevice::PrivateImpl::issue (HANDLE file, QueuedRead &read, std::size_t length)
+{
+	length = std::max<std::size_t> (length, MinReadLength);
+	if (read.buffer.size () < length)
+		read.buffer.resize (length);
+	memset (&read.overlapped, 0, sizeof (OVERLAPPED));
+	read.overlapped.hEvent = read.event;
+	// Reads completing immediately also signal their event, they are
+	// finished like the others.
+	if (!ReadFile (file, read.buffer.data (), read.buffer.size (), NULL, &read.overlapped)) {
+		DWORD err = GetLastError ();
+		if (err != ERROR_IO_PENDING)
+			throw std::system_error (err, windows_category (),
+						 "ReadFile");
+	}
+	read.pending = true;
+}
+
 RawDevice::RawDevice ():
 	_p (std::make_unique<PrivateImpl> ())
 {
@@ -154,6 +314,11 @@ RawDevice::RawDevice ():
 RawDevice::RawDevice (const std::string &path):
 	_p (std::make_unique<PrivateImpl> ())
 {
+	if (auto device = VirtualDevice::open (path)) {
+		openVirtualDevice (std::move (device));
+		return;
+	}
+
 	std::wstring_convert<std::codecvt_utf8<wchar_t, 0x10ffff, std::little_endian>> wconv;
 	std::wstring_convert<std::codecvt_utf8<char16_t>, char16_t> u16conv;
 
@@ -161,21 +326,14 @@ RawDevice::RawDevice (const std::string &path):
 
 	DWORD err;
 
-	GUID hid_guid;
-	HidD_GetHidGuid (&hid_guid);
-
 	bool first = true;
-	DeviceEnumerator enumerator (&hid_guid);
-	DEVINST parent_inst = DeviceData (enumerator.devinfo (), parent_id.c_str ()).deviceInst ();
-	int i = 0;
-	while (auto dev = enumerator.get (i++)) {
-		bool ok;
-		DEVINST parent;
-		std::tie (ok, parent) = dev->parentInst ();
-		if (!ok || parent != parent_inst)
-			continue;
-
-		HANDLE hdev = CreateFile (dev->devicePath (),
+	auto report_desc = std::make_shared<ReportDescriptor> ();
+	auto interfaces = InterfaceCache::instance ().interfaces (parent_id);
+	if (interfaces.empty ())
+		throw std::system_error (ERROR_DEVICE_NOT_CONNECTED, windows_category (),
+					 "No HID interface for " + path);
+	for (const auto &iface: interfaces) {
+		HANDLE hdev = CreateFile (iface.path.c_str (),
 					  GENERIC_READ | GENERIC_WRITE,
 					  FILE_SHARE_READ | FILE_SHARE_WRITE,
 					  NULL, OPEN_EXISTING,
@@ -183,29 +341,25 @@ RawDevice::RawDevice (const std::string &path):
 		if (hdev == INVALID_HANDLE_VALUE) {
 			err = GetLastError ();
 			Log::debug () << "Failed to open device "
-				      << wconv.to_bytes (dev->devicePath ()) << ": "
+				      << wconv.to_bytes (iface.path) << ": "
 				      << windows_category ().message (err) << std::endl;
 			continue;
 		}
 
-		HANDLE event = CreateEvent (NULL, TRUE, TRUE, NULL);
-		if (event == INVALID_HANDLE_VALUE) {
-			err = GetLastError ();
-			throw std::system_error (err, windows_category (),
-						 "CreateEvent");
-		}
+		_p->devices.push_back ({hdev});
 
-		_p->devices.push_back ({hdev, event});
-
-		if (first) {
+		// Interface data is read once, then kept in the cache until it is removed
+		auto info = iface.info;
+		if (!info) {
+			auto new_info = std::make_shared<InterfaceCache::Info> ();
 			HIDD_ATTRIBUTES attrs;
 			if (!HidD_GetAttributes (hdev, &attrs)) {
 				err = GetLastError ();
 				throw std::system_error (err, windows_category (),
 							 "HidD_GetAttributes");
 			}
-			_vendor_id = attrs.VendorID;
-			_product_id = attrs.ProductID;
+			new_info->vendor_id = attrs.VendorID;
+			new_info->product_id = attrs.ProductID;
 
 			char16_t buffer[256];
 			if (!HidD_GetManufacturerString (hdev, buffer, ARRAY_SIZE (buffer))) {
@@ -213,90 +367,44 @@ RawDevice::RawDevice (const std::string &path):
 				throw std::system_error (err, windows_category (),
 							 "HidD_GetManufacturerString");
 			}
-			_name = u16conv.to_bytes (buffer);
+			new_info->name = u16conv.to_bytes (buffer);
 			if (!HidD_GetProductString (hdev, buffer, ARRAY_SIZE (buffer))) {
 				err = GetLastError ();
 				throw std::system_error (err, windows_category (),
 							 "HidD_GetProductString");
 			}
-			_name += " " + u16conv.to_bytes (buffer);
-			Log::debug ("hid").printf ("Opened device \"%s\" (%04x:%04x)\n",
-					_name.c_str (), _vendor_id, _product_id);
-			first = false;
-		}
+			new_info->name += " " + u16conv.to_bytes (buffer);
 
-		PHIDP_PREPARSED_DATA preparsed_data;
-		if (!HidD_GetPreparsedData (hdev, &preparsed_data)) {
-			err = GetLastError ();
-			throw std::system_error (err, windows_category (),
-						 "HidD_GetPreparsedData");
+			PHIDP_PREPARSED_DATA preparsed_data;
+			if (!HidD_GetPreparsedData (hdev, &preparsed_data)) {
+				err = GetLastError ();
+				throw std::system_error (err, windows_category (),
+							 "HidD_GetPreparsedData");
+			}
+			std::unique_ptr<_HIDP_PREPARSED_DATA, decltype(&HidD_FreePreparsedData)> unique_preparsed_data (preparsed_data, &HidD_FreePreparsedData);
+			new_info->collection = std::make_shared<const ReportCollection> (parseCollection (preparsed_data));
+
+			InterfaceCache::instance ().setInfo (iface.path, new_info);
+			info = std::move (new_info);
 		}
 
-		std::unique_ptr<_HIDP_PREPARSED_DATA, decltype(&HidD_FreePreparsedData)> unique_preparsed_data (preparsed_data, &HidD_FreePreparsedData);
-
-		auto header = reinterpret_cast<const preparsed_data_header *> (preparsed_data);
-		auto item = reinterpret_cast<const preparsed_data_item *> (header+1);
-
-		auto &collection = _report_desc.collections.emplace_back ();
-		collection.usage = {header->usage_page, header->usage};
-
-		for (auto [report_type, item_count]: {
-				std::make_tuple (ReportID::Type::Input, header->input_item_count),
-				std::make_tuple (ReportID::Type::Output, header->output_item_count),
-				std::make_tuple (ReportID::Type::Feature, header->feature_item_count)}) {
-			std::map<ReportID, int> last_bit_pos; // byte_index * 8 + bit_index
-			for (int i = 0; i < item_count; ++i, ++item) {
-				ReportID id = {report_type, item->report_id};
-				auto [pos_it, pos_inserted] = last_bit_pos.emplace (id, -1);
-				auto [it, report_inserted] = collection.reports.emplace (id, 0);
-				int pos = item->byte_index * 8 + item->bit_index;
-				if (pos_it->second != -1 && pos_it->second >= pos) {
-					// Split items are in reverse order, try merging them if the position goes backward
-					auto &f = it->second.back ();
-					auto usages = std::get_if<std::vector<Usage>> (&f.usages);
-					if (!usages || item->usage_minimum != item->usage_maximum) {
-						Log::error ("reportdesc") << "Split item is a range item" << std::endl;
-						continue;
-					}
-					auto item_usage = Usage {item->usage_page, item->usage_minimum};
-					if (item->bit_size != f.size || item->bit_field != f.flags.bits)
-						Log::error ("reportdesc") << "Split item mismatch" << std::endl;
-					if (pos_it->second == pos) {
-						if (item->report_count != f.count)
-							Log::error ("reportdesc") << "Split item report count mismatch" << std::endl;
-						usages->insert (usages->begin (), item_usage);
-					}
-					else {
-						if (pos_it->second - pos != item->bit_size)
-							Log::error ("reportdesc") << "Split item unexpected position" << std::endl;
-						f.count += item->report_count;
-						if (usages->size () > 1 || usages->front () != item_usage)
-							usages->insert (usages->begin (), item_usage);
-					}
-				}
-				else {
-					// Create new item
-					auto &f = it->second.emplace_back ();
-					f.flags.bits = item->bit_field;
-					f.count = item->report_count;
-					f.size = item->bit_size;
-					if (item->usage_minimum == item->usage_maximum)
-						f.usages = std::vector {Usage {item->usage_page, item->usage_minimum}};
-					else
-						f.usages = std::make_pair (
-								Usage {item->usage_page, item->usage_minimum},
-								Usage {item->usage_page, item->usage_maximum});
-				}
-				pos_it->second = pos;
-			}
+		if (first) {
+			_vendor_id = info->vendor_id;
+			_product_id = info->product_id;
+			_name = info->name;
+			Log::debug ("hid").printf ("Opened device \"%s\" (%04x:%04x)\n",
+					_name.c_str (), _vendor_id, _product_id);
+			first = false;
 		}
 
+		const auto &collection = report_desc->collections.emplace_back (*info->collection);
 		for (const auto &[id, fields]: collection.reports) {
 			auto [it, inserted] = _p->reports.emplace (id.id, hdev);
 			if (!inserted && it->second != hdev)
 				throw std::runtime_error ("Same Report ID on different handle.");
 		}
 	}
+	_report_desc = std::move (report_desc);
 	logReportDescriptor ();
 
 
@@ -308,12 +416,24 @@ RawDevice::RawDevice (const std::string &path):
 	}
 }
 
+RawDevice::RawDevice (std::shared_ptr<VirtualDevice> device):
+	RawDevice ()
+{
+	openVirtualDevice (std::move (device));
+}
+
 RawDevice::RawDevice (const RawDevice &other):
 	_p (std::make_unique<PrivateImpl> ()),
 	_vendor_id (other._vendor_id), _product_id (other._product_id),
+	_bus (other._bus),
 	_name (other._name),
-	_report_desc (other._report_desc)
+	_report_desc (std::atomic_load (&other._report_desc)),
+	_virtual (other._virtual),
+	_capture (other._capture),
+	_capture_device (other._capture_device)
 {
+	if (_virtual)
+		return;
 	DWORD err;
 
 	for (const auto &dev: other._p->devices) {
@@ -327,14 +447,7 @@ RawDevice::RawDevice (const RawDevice &other):
 						 "ReOpenFile");
 		}
 
-		HANDLE event = CreateEvent (NULL, TRUE, TRUE, NULL);
-		if (event == INVALID_HANDLE_VALUE) {
-			err = GetLastError ();
-			throw std::system_error (err, windows_category (),
-						 "CreateEvent");
-		}
-
-		_p->devices.push_back ({hdev, event});
+		_p->devices.push_back ({hdev});
 	}
 
 	_p->interrupted_event = CreateEvent (NULL, FALSE, FALSE, NULL);
@@ -348,8 +461,12 @@ RawDevice::RawDevice (const RawDevice &other):
 RawDevice::RawDevice (RawDevice &&other):
 	_p (std::make_unique<PrivateImpl> ()),
 	_vendor_id (other._vendor_id), _product_id (other._product_id),
+	_bus (other._bus),
 	_name (std::move (other._name)),
-	_report_desc (std::move (other._report_desc))
+	_report_desc (std::move (other._report_desc)),
+	_virtual (std::move (other._virtual)),
+	_capture (std::move (other._capture)),
+	_capture_device (other._capture_device)
 {
 	std::swap (_p, other._p);
 }
@@ -358,15 +475,22 @@ RawDevice::~RawDevice ()
 {
 }
 
-int RawDevice::writeReport (const std::vector<uint8_t> &report)
+int RawDevice::writeReport (const uint8_t *report, std::size_t length)
 {
+	if (_virtual) {
+		int ret = _virtual->writeReport (report, length);
+		LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Send HID report:", report, report+length);
+		captureReport (ReportCapture::Output, report, length);
+		LIBHIDPP_PROBE_REPORT (report_sent, report, length);
+		return ret;
+	}
 	DWORD err, written;
 	OVERLAPPED overlapped;
 	memset (&overlapped, 0, sizeof (OVERLAPPED));
 	auto it = _p->reports.find (report[0]);
 	if (it == _p->reports.end ())
 		throw std::runtime_error ("Report ID not found.");
-	if (!WriteFile (it->second, report.data (), report.size (),
+	if (!WriteFile (it->second, report, length,
 			&written, &overlapped)) {
 		err = GetLastError ();
 		if (err == ERROR_IO_PENDING) {
@@ -380,77 +504,27 @@ int RawDevice::writeReport (const std::vector<uint8_t> &report)
 		else
 			throw std::system_error (err, windows_category (), "WriteFile");
 	}
-	Log::debug ("report").printBytes ("Send HID report:", report.begin (), report.end ());
+	LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Send HID report:", report, report+length);
+	captureReport (ReportCapture::Output, report, length);
+	LIBHIDPP_PROBE_REPORT (report_sent, report, length);
 	return written;
 }
 
-class AsyncRead
+int RawDevice::readReport (uint8_t *report, std::size_t length, int timeout,
+			   std::chrono::steady_clock::time_point *time)
 {
-	HANDLE file;
-	OVERLAPPED overlapped;
-	bool pending;
-
-public:
-	AsyncRead (HANDLE file, HANDLE event):
-		file (file),
-		pending (false)
-	{
-		memset (&overlapped, 0, sizeof (OVERLAPPED));
-		overlapped.hEvent = event;
-	}
-
-	bool read (LPVOID buffer, DWORD size, LPDWORD read)
-	{
-		DWORD err;
-		if (ReadFile (file, buffer, size, read, &overlapped))
-			return pending = false;
-		err = GetLastError ();
-		if (err == ERROR_IO_PENDING)
-			return pending = true;
-		else
-			throw std::system_error (err, windows_category (),
-						 "ReadFile");
-	}
-
-	void finish (LPDWORD read)
-	{
-		DWORD err;
-		pending = false;
-		if (!GetOverlappedResult (file, &overlapped, read, FALSE)) {
-			err = GetLastError ();
-			throw std::system_error (err, windows_category (),
-						 "GetOverlappedResult");
-		}
+	if (_virtual) {
+		int ret;
+		return readVirtualReports (report, length, &ret, 1, timeout, time) ? ret : 0;
 	}
-
-	~AsyncRead ()
-	{
-		DWORD err;
-		if (pending && !CancelIoEx (file, &overlapped)) {
-			err = GetLastError ();
-			Log::error () << "Failed to cancel async read: "
-				      << windows_category ().message (err)
-				      << std::endl;
-		}
-	}
-};
-
-int RawDevice::readReport (std::vector<uint8_t> &report, int timeout)
-{
-	DWORD err, read, ret, i;
+	DWORD err, read, ret;
+	std::size_t i;
 	assert (_p->interrupted_event != INVALID_HANDLE_VALUE);
-	std::vector<HANDLE> handles = { _p->interrupted_event };
-	std::vector<AsyncRead> reads; // vector destructor will automatically cancel pending IOs.
-	reads.reserve (_p->devices.size ()); // Reserve memory so overlapped are not moved.
-
-	for (auto &dev: _p->devices) {
-		if (report.size () < dev.caps.InputReportByteLength)
-			continue; // skip device with reports that would not fit in the buffer
-		reads.emplace_back (dev.file, dev.event);
-		if (!reads.back ().read (report.data (), report.size (), &read))
-			goto report_read;
-		handles.push_back (dev.event);
-	}
+	// Reads stay queued between calls, so that waiting does not need
+	// to build the wait list or issue new reads.
+	if (_p->wait_handles.empty ())
+		_p->arm (length);
+	auto &handles = _p->wait_handles;
 	ret = WaitForMultipleObjects (handles.size (), handles.data (), FALSE,
 				      (timeout < 0 ? INFINITE : timeout));
 	switch (ret) {
@@ -462,22 +536,72 @@ int RawDevice::readReport (std::vector<uint8_t> &report, int timeout)
 		throw std::system_error (err, windows_category (), "WaitForMultipleObject");
 	default:
 		i = ret-WAIT_OBJECT_0-1;
-		if (i < 0 || i >= reads.size ())
+		if (ret < WAIT_OBJECT_0+1 || i >= _p->devices.size ())
 			throw std::runtime_error ("Unexpected return value from WaitForMultipleObject");
-		else
-			reads[i].finish (&read);
 	}
-report_read:
-	report.resize (read);
-	Log::debug ("report").printBytes ("Recv HID report:", report.begin (), report.end ());
+	auto &dev = _p->devices[i];
+	auto &queued = *dev.reads[dev.next];
+	queued.pending = false;
+	if (!GetOverlappedResult (dev.file, &queued.overlapped, &read, FALSE)) {
+		err = GetLastError ();
+		throw std::system_error (err, windows_category (),
+					 "GetOverlappedResult");
+	}
+	if (time)
+		*time = std::chrono::steady_clock::now ();
+	read = std::min<DWORD> (read, length);
+	std::copy (queued.buffer.begin (), queued.buffer.begin () + read, report);
+	_p->issue (dev.file, queued, length);
+	dev.next = (dev.next + 1) % dev.reads.size ();
+	handles[i+1] = dev.reads[dev.next]->event;
+	LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Recv HID report:", report, report+read);
+	captureReport (ReportCapture::Input, report, read);
+	LIBHIDPP_PROBE_REPORT (report_received, report, read);
 	return read;
 }
 
+std::size_t RawDevice::readReports (uint8_t *reports, std::size_t report_size,
+				    int *lengths, std::size_t count, int timeout,
+				    std::chrono::steady_clock::time_point *times)
+{
+	if (_virtual)
+		return readVirtualReports (reports, report_size, lengths, count, timeout, times);
+	// Reports already completed by the queued reads are returned
+	// without waiting.
+	std::size_t n = 0;
+	while (n < count) {
+		lengths[n] = readReport (reports + n*report_size, report_size,
+					 n == 0 ? timeout : 0,
+					 times ? times + n : nullptr);
+		if (lengths[n] == 0)
+			break;
+		++n;
+	}
+	return n;
+}
+
 void RawDevice::interruptRead ()
 {
+	if (_virtual) {
+		_virtual->interruptRead ();
+		return;
+	}
 	DWORD err;
 	if (!SetEvent (_p->interrupted_event)) {
 		err = GetLastError ();
 		throw std::system_error (err, windows_category (), "SetEvent");
 	}
 }
+
+void RawDevice::setBusyPoll (std::chrono::microseconds)
+{
+	// Overlapped reads cannot be polled cheaply, always wait.
+}
+
+std::vector<void *> RawDevice::handles () const
+{
+	std::vector<void *> handles;
+	for (const auto &dev: _p->devices)
+		handles.push_back (dev.file);
+	return handles;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ReportCapture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace HID;
+
+static constexpr char Magic[] = "HIDCAP01";
+static constexpr std::size_t MagicLength = sizeof (Magic) - 1;
+static constexpr std::size_t RecordHeaderLength = 12;
+
+// Slots are written as a sequence lock: sequence is odd while the slot
+// is written and 2*(n+1) once it holds the n-th recorded report.
+struct ReportCapture::Slot
+{
+	std::atomic<uint64_t> sequence {0};
+	int64_t time;
+	uint16_t device;
+	uint8_t direction;
+	uint8_t length;
+	uint8_t data[MaxReportLength];
+};
+
+ReportCapture::ReportCapture (std::size_t capacity):
+	_start (std::chrono::steady_clock::now ()),
+	_capacity (capacity),
+	_slots (std::make_unique<Slot[]> (capacity)),
+	_next (0)
+{
+	if (capacity == 0)
+		throw std::invalid_argument ("Capture capacity must not be zero");
+}
+
+ReportCapture::~ReportCapture ()
+{
+}
+
+void ReportCapture::record (uint16_t device, Direction direction,
+			    const uint8_t *report, std::size_t length) noexcept
+{
+	auto now = std::chrono::steady_clock::now ();
+	uint64_t n = _next.fetch_add (1, std::memory_order_relaxed);
+	Slot &slot = _slots[n % _capacity];
+	slot.sequence.store (2*n+1, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_release);
+	slot.time = std::chrono::duration_cast<std::chrono::nanoseconds> (now - _start).count ();
+	slot.device = device;
+	slot.direction = direction;
+	slot.length = std::min (length, MaxReportLength);
+	memcpy (slot.data, report, slot.length);
+	slot.sequence.store (2*n+2, std::memory_order_release);
+}
+
+uint64_t ReportCapture::recorded () const noexcept
+{
+	return _next.load (std::memory_order_relaxed);
+}
+
+std::vector<ReportCapture::Entry> ReportCapture::snapshot () const
+{
+	std::vector<Entry> entries;
+	uint64_t end = _next.load (std::memory_order_acquire);
+	uint64_t begin = end > _capacity ? end - _capacity : 0;
+	entries.reserve (end - begin);
+	for (uint64_t n = begin; n < end; ++n) {
+		const Slot &slot = _slots[n % _capacity];
+		if (slot.sequence.load (std::memory_order_acquire) != 2*n+2)
+			continue; // not written yet or already overwritten
+		Entry entry;
+		entry.time = std::chrono::nanoseconds (slot.time);
+		entry.device = slot.device;
+		entry.direction = static_cast<Direction> (slot.direction);
+		entry.report.assign (slot.data, slot.data + std::min<std::size_t> (slot.length, MaxReportLength));
+		std::atomic_thread_fence (std::memory_order_acquire);
+		if (slot.sequence.load (std::memory_order_relaxed) != 2*n+2)
+			continue; // overwritten while copying
+		entries.push_back (std::move (entry));
+	}
+	return entries;
+}
+
+void ReportCapture::save (std::ostream &out) const
+{
+	std::vector<uint8_t> buffer (Magic, Magic + MagicLength);
+	for (const auto &entry: snapshot ()) {
+		uint64_t time = entry.time.count ();
+		for (unsigned int i = 0; i < 8; ++i)
+			buffer.push_back (time >> (8*i));
+		buffer.push_back (entry.device);
+		buffer.push_back (entry.device >> 8);
+		buffer.push_back (entry.direction);
+		buffer.push_back (entry.report.size ());
+		buffer.insert (buffer.end (), entry.report.begin (), entry.report.end ());
+	}
+	out.write (reinterpret_cast<const char *> (buffer.data ()), buffer.size ());
+	if (!out)
+		throw std::runtime_error ("Failed to write capture");
+}
+
+void ReportCapture::save (const std::string &path) const
+{
+	std::ofstream out (path, std::ios::binary);
+	if (!out)
+		throw std::runtime_error ("Cannot open " + path);
+	save (out);
+}
+
+std::vector<ReportCapture::Entry> ReportCapture::load (std::istream &in)
+{
+	char magic[MagicLength];
+	if (!in.read (magic, MagicLength) || memcmp (magic, Magic, MagicLength) != 0)
+		throw std::runtime_error ("Not a HID report capture");
+	std::vector<Entry> entries;
+	uint8_t header[RecordHeaderLength];
+	while (in.read (reinterpret_cast<char *> (header), RecordHeaderLength)) {
+		uint64_t time = 0;
+		for (unsigned int i = 0; i < 8; ++i)
+			time |= uint64_t (header[i]) << (8*i);
+		Entry entry;
+		entry.time = std::chrono::nanoseconds (time);
+		entry.device = header[8] | header[9] << 8;
+		if (header[10] > Output)
+			throw std::runtime_error ("Invalid direction in capture");
+		entry.direction = static_cast<Direction> (header[10]);
+		entry.report.resize (header[11]);
+		if (!in.read (reinterpret_cast<char *> (entry.report.data ()), entry.report.size ()))
+			throw std::runtime_error ("Truncated capture");
+		entries.push_back (std::move (entry));
+	}
+	if (in.gcount () != 0)
+		throw std::runtime_error ("Truncated capture");
+	return entries;
+}
+
+std::vector<ReportCapture::Entry> ReportCapture::load (const std::string &path)
+{
+	std::ifstream in (path, std::ios::binary);
+	if (!in)
+		throw std::runtime_error ("Cannot open " + path);
+	return load (in);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HID_REPORT_CAPTURE_H
+#define LIBHIDPP_HID_REPORT_CAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace HID
+{
+
+/**
+ * Fixed-size ring of timestamped raw reports, cheap enough to stay
+ * enabled at full input rate.
+ *
+ * Recording is lock-free and can be done from any number of threads,
+ * the oldest reports are overwritten when the ring is full. Reports
+ * being overwritten while a snapshot is taken are left out of it.
+ *
+ * Captures are saved in a compact binary format: the "HIDCAP01" magic
+ * followed by one record per report (little-endian 64 bits time in
+ * nanoseconds, 16 bits device, 8 bits direction, 8 bits length, then
+ * the report bytes).
+ */
+class ReportCapture
+{
+public:
+	enum Direction: uint8_t
+	{
+		Input = 0, ///< Read from the device
+		Output = 1, ///< Written to the device
+	};
+
+	/**
+	 * Longer reports are truncated.
+	 */
+	static constexpr std::size_t MaxReportLength = 64;
+
+	struct Entry
+	{
+		std::chrono::nanoseconds time; ///< Since the capture was created
+		uint16_t device;
+		Direction direction;
+		std::vector<uint8_t> report;
+	};
+
+	/**
+	 * Create a ring keeping the last \p capacity reports.
+	 */
+	ReportCapture (std::size_t capacity);
+	~ReportCapture ();
+
+	ReportCapture (const ReportCapture &) = delete;
+	ReportCapture &operator= (const ReportCapture &) = delete;
+
+	void record (uint16_t device, Direction direction,
+		     const uint8_t *report, std::size_t length) noexcept;
+
+	/**
+	 * Number of reports recorded since creation, including overwritten
+	 * ones.
+	 */
+	uint64_t recorded () const noexcept;
+
+	/**
+	 * Copy the reports currently in the ring, oldest first.
+	 */
+	std::vector<Entry> snapshot () const;
+
+	/**
+	 * Write a snapshot.
+	 *
+	 * \throws std::runtime_error
+	 */
+	void save (std::ostream &out) const;
+	void save (const std::string &path) const;
+
+	/**
+	 * Read a saved capture.
+	 *
+	 * \throws std::runtime_error
+	 */
+	static std::vector<Entry> load (std::istream &in);
+	static std::vector<Entry> load (const std::string &path);
+
+private:
+	struct Slot;
+	std::chrono::steady_clock::time_point _start;
+	std::size_t _capacity;
+	std::unique_ptr<Slot[]> _slots;
+	std::atomic<uint64_t> _next;
+};
+
+}
+
+#endif
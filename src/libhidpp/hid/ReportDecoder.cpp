@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ReportDecoder.h"
+
+#include <algorithm>
+#include <map>
+
+using namespace HID;
+
+ReportDecoder::ReportDecoder (const ReportDescriptor &descriptor):
+	_uses_report_ids (false)
+{
+	// Gather the input fields of every collection by report ID
+	std::map<uint8_t, std::vector<const ReportField *>> reports;
+	for (const auto &collection: descriptor.collections) {
+		for (const auto &[id, fields]: collection.reports) {
+			if (id.type != ReportID::Type::Input)
+				continue;
+			if (id.id != 0)
+				_uses_report_ids = true;
+			auto &report = reports[id.id];
+			for (const auto &field: fields)
+				report.push_back (&field);
+		}
+	}
+	_ranges.fill ({0, 0});
+	for (auto &[id, fields]: reports) {
+		std::stable_sort (fields.begin (), fields.end (), [] (auto a, auto b) {
+			return a->offset < b->offset;
+		});
+		uint32_t first = _extractors.size ();
+		for (const ReportField *field: fields) {
+			if (field->size == 0 || field->size > 32)
+				continue;
+			Extractor e;
+			e.bit_size = field->size;
+			e.is_signed = field->logical_minimum < 0;
+			e.array = field->flags.Array ();
+			e.logical_minimum = field->logical_minimum;
+			e.usage_index = e.usage_count = 0;
+			const auto *list = std::get_if<std::vector<Usage>> (&field->usages);
+			const auto *range = std::get_if<std::pair<Usage, Usage>> (&field->usages);
+			if (e.array) {
+				e.usage_index = _array_usages.size ();
+				if (list)
+					_array_usages.insert (_array_usages.end (), list->begin (), list->end ());
+				else if (range->first.usage_page == range->second.usage_page)
+					for (uint32_t u = range->first.usage; u <= range->second.usage; ++u)
+						_array_usages.push_back (Usage (range->first.usage_page, u));
+				e.usage_count = _array_usages.size () - e.usage_index;
+			}
+			for (unsigned int i = 0; i < field->count; ++i) {
+				e.bit_offset = field->offset + i * field->size;
+				if (!e.array) {
+					if (list)
+						// the last usage is repeated for the remaining values
+						e.usage = list->empty () ? Usage () : (*list)[std::min<std::size_t> (i, list->size ()-1)];
+					else
+						e.usage = Usage (range->first.usage_page,
+								 std::min<uint32_t> (range->first.usage + i, range->second.usage));
+				}
+				_extractors.push_back (e);
+			}
+		}
+		_ranges[id] = { first, static_cast<uint32_t> (_extractors.size ()) };
+	}
+}
+
+std::size_t ReportDecoder::decode (const uint8_t *report, std::size_t length,
+				   Value *values, std::size_t max_values) const noexcept
+{
+	if (length == 0)
+		return 0;
+	uint8_t id = 0;
+	if (_uses_report_ids) {
+		id = report[0];
+		++report;
+		--length;
+	}
+	const Extractor *e = begin (id), *last = end (id);
+	std::size_t bit_length = length * 8;
+	std::size_t n = 0;
+	for (; e != last && n < max_values; ++e) {
+		if (e->bit_offset + e->bit_size > bit_length)
+			break;
+		// Read the (up to 5) bytes containing the value, they are
+		// all in the report after the check above
+		std::size_t byte = e->bit_offset / 8;
+		unsigned int shift = e->bit_offset % 8;
+		unsigned int byte_count = (shift + e->bit_size + 7) / 8;
+		uint64_t raw = 0;
+		for (unsigned int i = 0; i < byte_count; ++i)
+			raw |= uint64_t (report[byte+i]) << (8*i);
+		// Move the value to the top bits, then back with or without sign extension
+		uint64_t top = raw << (64 - shift - e->bit_size);
+		int32_t value = e->is_signed ?
+			static_cast<int32_t> (static_cast<int64_t> (top) >> (64 - e->bit_size)) :
+			static_cast<int32_t> (top >> (64 - e->bit_size));
+		Usage usage = e->usage;
+		if (e->array) {
+			uint32_t index = static_cast<uint32_t> (value - e->logical_minimum);
+			usage = index < e->usage_count ? _array_usages[e->usage_index + index] : Usage ();
+		}
+		values[n++] = { usage, value };
+	}
+	return n;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HID_REPORT_DECODER_H
+#define LIBHIDPP_HID_REPORT_DECODER_H
+
+#include <hid/ReportDescriptor.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace HID
+{
+
+/**
+ * Decoder for the input reports of a report descriptor (e.g. the
+ * standard mouse or keyboard reports of a HID node).
+ *
+ * The descriptor fields are compiled once into a flat table of
+ * extractors, one per value, grouped by report ID. Decoding a report
+ * only reads that table and writes into a caller-provided array, it
+ * does not allocate.
+ */
+class ReportDecoder
+{
+public:
+	/**
+	 * Read one value from the report data.
+	 */
+	struct Extractor
+	{
+		uint32_t bit_offset; // from the start of the report data (after the report ID)
+		uint8_t bit_size; // 1 to 32
+		bool is_signed; // the logical minimum is negative
+		bool array; // the value selects a usage from the field usages
+		Usage usage; // usage of a variable value
+		// Array fields: the value minus logical_minimum indexes
+		// arrayUsages() from usage_index, up to usage_count.
+		int32_t logical_minimum;
+		uint32_t usage_index, usage_count;
+	};
+
+	/**
+	 * Decoded value.
+	 *
+	 * For array fields, \p usage is the selected usage (null when the
+	 * value selects nothing, e.g. no key pressed) and \p value is the
+	 * raw index.
+	 */
+	struct Value
+	{
+		Usage usage;
+		int32_t value;
+	};
+
+	/**
+	 * Compile the input reports of \p descriptor.
+	 *
+	 * Fields larger than 32 bits are ignored.
+	 */
+	explicit ReportDecoder (const ReportDescriptor &descriptor);
+
+	/**
+	 * True if the reports start with a report ID byte.
+	 */
+	bool usesReportIDs () const noexcept
+	{
+		return _uses_report_ids;
+	}
+
+	/**
+	 * Extractors of the input report \p report_id, in report order.
+	 */
+	const Extractor *begin (uint8_t report_id) const noexcept
+	{
+		return _extractors.data () + _ranges[report_id].first;
+	}
+	const Extractor *end (uint8_t report_id) const noexcept
+	{
+		return _extractors.data () + _ranges[report_id].second;
+	}
+
+	/**
+	 * Usages selectable by array fields.
+	 */
+	const std::vector<Usage> &arrayUsages () const noexcept
+	{
+		return _array_usages;
+	}
+
+	/**
+	 * Decode the input \p report as read from the device (starting with
+	 * the report ID when \ref usesReportIDs).
+	 *
+	 * Values beyond the end of a short report are not decoded.
+	 *
+	 * \returns the number of values written to \p values, at most
+	 * \p max_values.
+	 */
+	std::size_t decode (const uint8_t *report, std::size_t length,
+			    Value *values, std::size_t max_values) const noexcept;
+
+private:
+	std::vector<Extractor> _extractors;
+	std::array<std::pair<uint32_t, uint32_t>, 256> _ranges; // by report ID
+	std::vector<Usage> _array_usages;
+	bool _uses_report_ids;
+};
+
+}
+
+#endif
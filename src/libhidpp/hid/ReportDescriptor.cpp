@@ -18,11 +18,15 @@
 
 #include "ReportDescriptor.h"
 
+#include <algorithm>
+#include <mutex>
 #include <type_traits>
 #include <stack>
 #include <stdexcept>
+#include <unordered_map>
 
 #include <misc/Log.h>
+#include <misc/MemoryAccounting.h>
 
 using namespace HID;
 
@@ -46,6 +50,8 @@ enum MainItem
 enum GlobalItem
 {
 	UsagePage = 0,
+	LogicalMinimum = 1,
+	LogicalMaximum = 2,
 	ReportSize = 7,
 	ReportID = 8,
 	ReportCount = 9,
@@ -95,7 +101,7 @@ struct item_t
 		T value = 0;
 		for (unsigned int i = 0; i < size; ++i)
 			value |= (data[i]&0xFF) << (8*i);
-		if (data[size-1] & 0x80) // sign extend
+		if (size > 0 && data[size-1] & 0x80) // sign extend
 			for (unsigned int i = size; i < sizeof (T); ++i)
 				value |= 0xFF << (8*i);
 		return value;
@@ -135,6 +141,7 @@ ReportDescriptor ReportDescriptor::fromRawData (const uint8_t *data, std::size_t
 {
 	struct global_context_t {
 		uint16_t usage_page;
+		int32_t logical_minimum, logical_maximum;
 		unsigned int report_size;
 		uint8_t report_id;
 		unsigned int report_count;
@@ -151,6 +158,7 @@ ReportDescriptor ReportDescriptor::fromRawData (const uint8_t *data, std::size_t
 		OpenedOthers,
 	} delimiter_state = Closed;
 	ReportDescriptor descriptor;
+	std::map<ReportID, unsigned int> report_sizes; // in bits, including padding
 	int collection_depth = 0;
 	while (length > 0) {
 		auto [item, next_data] = read_item (data, length);
@@ -168,6 +176,7 @@ ReportDescriptor ReportDescriptor::fromRawData (const uint8_t *data, std::size_t
 				};
 				auto [it, inserted] = descriptor.collections.back ().reports.emplace (id, 0);
 				ReportField::Flags flags = {item.get<unsigned int> ()};
+				unsigned int &offset = report_sizes[id];
 				if (!local.usages.empty () ||
 						local.usage_min != Usage () || local.usage_max != Usage () ||
 						!flags.Constant ()) { // exclude padding fields
@@ -175,11 +184,15 @@ ReportDescriptor ReportDescriptor::fromRawData (const uint8_t *data, std::size_t
 					f.flags = flags;
 					f.count = global.top ().report_count;
 					f.size = global.top ().report_size;
+					f.offset = offset;
+					f.logical_minimum = global.top ().logical_minimum;
+					f.logical_maximum = global.top ().logical_maximum;
 					if (!local.usages.empty ())
 						f.usages = std::move (local.usages);
 					else
 						f.usages = std::make_pair (local.usage_min, local.usage_max);
 				}
+				offset += global.top ().report_count * global.top ().report_size;
 				break;
 			}
 			case MainItem::Collection:
@@ -207,6 +220,12 @@ ReportDescriptor ReportDescriptor::fromRawData (const uint8_t *data, std::size_t
 			case GlobalItem::UsagePage:
 				global.top ().usage_page = item.get<uint16_t> ();
 				break;
+			case GlobalItem::LogicalMinimum:
+				global.top ().logical_minimum = item.get<int32_t> ();
+				break;
+			case GlobalItem::LogicalMaximum:
+				global.top ().logical_maximum = item.get<int32_t> ();
+				break;
 			case GlobalItem::ReportSize:
 				global.top ().report_size = item.get<unsigned int> ();
 				break;
@@ -267,3 +286,104 @@ ReportDescriptor ReportDescriptor::fromRawData (const uint8_t *data, std::size_t
 		Log::warning ("reportdescriptor") << "Some collections are not closed";
 	return descriptor;
 }
+
+namespace
+{
+// FNV-1a
+std::size_t rawDataHash (const uint8_t *data, std::size_t length) noexcept
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (std::size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 0x100000001b3;
+	}
+	return static_cast<std::size_t> (hash);
+}
+
+struct InternedDescriptor
+{
+	std::shared_ptr<const std::vector<uint8_t>> raw;
+	std::shared_ptr<const ReportDescriptor> parsed; // null until parsed
+	bool accounted;
+};
+
+// Process-wide table of the descriptors by raw data hash. Few different
+// models are opened by a process, the table is simply emptied if it
+// grows too much: devices keep their shared instances.
+class DescriptorTable
+{
+public:
+	static constexpr std::size_t MaxDescriptors = 64;
+
+	std::mutex mutex;
+
+	/**
+	 * Find or add the entry for \p data, \c mutex must be held.
+	 */
+	InternedDescriptor &find (const uint8_t *data, std::size_t length)
+	{
+		auto hash = rawDataHash (data, length);
+		auto [begin, end] = _entries.equal_range (hash);
+		for (auto it = begin; it != end; ++it) {
+			const auto &raw = *it->second.raw;
+			if (raw.size () == length && std::equal (raw.begin (), raw.end (), data))
+				return it->second;
+		}
+		if (_entries.size () >= MaxDescriptors)
+			clear ();
+		InternedDescriptor entry = {
+			std::make_shared<const std::vector<uint8_t>> (data, data+length),
+			nullptr,
+			MemoryAccounting::enabled ()
+		};
+		if (entry.accounted)
+			MemoryAccounting::charge (MemoryAccounting::Subsystem::ReportDescriptors,
+						  entry.raw->capacity (), 1);
+		return _entries.emplace (hash, std::move (entry))->second;
+	}
+
+private:
+	void clear ()
+	{
+		for (const auto &[hash, entry]: _entries)
+			if (entry.accounted)
+				MemoryAccounting::charge (MemoryAccounting::Subsystem::ReportDescriptors,
+							  -int64_t (entry.raw->capacity ()), -1);
+		_entries.clear ();
+	}
+
+	std::unordered_multimap<std::size_t, InternedDescriptor> _entries;
+};
+
+DescriptorTable &descriptorTable ()
+{
+	// Never destroyed: devices may be closed after static destruction.
+	static auto *table = new DescriptorTable ();
+	return *table;
+}
+}
+
+std::shared_ptr<const std::vector<uint8_t>> ReportDescriptor::internRawData (const uint8_t *data, std::size_t length)
+{
+	auto &table = descriptorTable ();
+	std::unique_lock<std::mutex> lock (table.mutex);
+	return table.find (data, length).raw;
+}
+
+std::shared_ptr<const ReportDescriptor> ReportDescriptor::fromRawDataCached (const uint8_t *data, std::size_t length)
+{
+	auto &table = descriptorTable ();
+	{
+		std::unique_lock<std::mutex> lock (table.mutex);
+		auto &entry = table.find (data, length);
+		if (entry.parsed)
+			return entry.parsed;
+	}
+	auto descriptor = std::make_shared<const ReportDescriptor> (fromRawData (data, length));
+	std::unique_lock<std::mutex> lock (table.mutex);
+	// Keep the descriptor parsed by a concurrent call, if any
+	auto &entry = table.find (data, length);
+	if (!entry.parsed)
+		entry.parsed = std::move (descriptor);
+	return entry.parsed;
+}
@@ -21,6 +21,7 @@
 
 #include <cstdint>
 #include <map>
+#include <memory>
 #include <variant>
 #include <vector>
 
@@ -111,6 +112,12 @@ struct ReportField
 		bool BufferedBytes () const noexcept { return bits & BitField_BufferedBytes; }
 	} flags;
 	unsigned int count, size;
+	/**
+	 * Position of the first value in bits, from the start of the
+	 * report data (after the report ID).
+	 */
+	unsigned int offset = 0;
+	int32_t logical_minimum = 0, logical_maximum = 0;
 	std::variant<
 		std::vector<Usage>, // usage list
 		std::pair<Usage, Usage> // usage range
@@ -137,6 +144,23 @@ struct ReportDescriptor
 	std::vector<ReportCollection> collections; // only top-level
 
 	static ReportDescriptor fromRawData (const uint8_t *data, std::size_t length);
+	/**
+	 * Same as \ref fromRawData, but descriptors already parsed in this
+	 * process are shared instead of parsed again.
+	 *
+	 * Parsed descriptors are kept in a process-wide cache keyed by a
+	 * hash of the raw bytes, devices of the same model get the same
+	 * object.
+	 *
+	 * \throws std::runtime_error if the descriptor is invalid.
+	 */
+	static std::shared_ptr<const ReportDescriptor> fromRawDataCached (const uint8_t *data, std::size_t length);
+	/**
+	 * Immutable copy of the raw descriptor \p data, shared with every
+	 * identical descriptor interned by this process (in the same cache
+	 * as fromRawDataCached).
+	 */
+	static std::shared_ptr<const std::vector<uint8_t>> internRawData (const uint8_t *data, std::size_t length);
 };
 
 }
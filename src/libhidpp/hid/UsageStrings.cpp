@@ -19,13 +19,143 @@
 #include "UsageStrings.h"
 
 #include <sstream>
-#include <map>
-#include <vector>
+#include <array>
 #include <stdexcept>
 
 #include <misc/Log.h>
 
-static const std::map<std::string, unsigned int> key_string_map {
+namespace
+{
+
+struct UsageName
+{
+	const char *name;
+	unsigned int code;
+};
+
+constexpr std::size_t stringLength (const char *str)
+{
+	std::size_t len = 0;
+	while (str[len] != '\0')
+		++len;
+	return len;
+}
+
+// FNV-1a
+constexpr uint32_t hashString (const char *str, std::size_t len, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ (seed * 16777619u);
+	for (std::size_t i = 0; i < len; ++i) {
+		h ^= static_cast<uint8_t> (str[i]);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+constexpr std::size_t roundUpPowerOfTwo (std::size_t n)
+{
+	std::size_t p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+/**
+ * Perfect hash of the names in a UsageName table (hash and displace):
+ * keys are split in buckets by a first hash, each bucket has a seed
+ * for a second hash that gives distinct slots to all the names.
+ *
+ * A lookup costs two hashes and a single string comparison.
+ */
+template<std::size_t N>
+struct PerfectHash
+{
+	static constexpr std::size_t BucketCount = N / 4 + 1;
+	static constexpr std::size_t SlotCount = roundUpPowerOfTwo (2*N);
+
+	const UsageName *names;
+	std::array<uint32_t, BucketCount> seeds;
+	std::array<int16_t, SlotCount> slots; // index in names, or -1
+
+	constexpr PerfectHash (const UsageName (&table)[N]):
+		names (table), seeds (), slots ()
+	{
+		static_assert (N < 0x7fff, "too many names");
+		for (auto &slot: slots)
+			slot = -1;
+		std::array<std::size_t, N> bucket {};
+		std::array<std::size_t, BucketCount> bucket_size {};
+		for (std::size_t i = 0; i < N; ++i) {
+			bucket[i] = hashString (table[i].name, stringLength (table[i].name), 0) % BucketCount;
+			++bucket_size[bucket[i]];
+		}
+		// Place the largest buckets first
+		std::array<bool, BucketCount> placed {};
+		for (std::size_t n = 0; n < BucketCount; ++n) {
+			std::size_t b = 0;
+			while (placed[b])
+				++b;
+			for (std::size_t i = b+1; i < BucketCount; ++i)
+				if (!placed[i] && bucket_size[i] > bucket_size[b])
+					b = i;
+			placed[b] = true;
+			if (bucket_size[b] == 0)
+				continue;
+			for (uint32_t seed = 1;; ++seed) {
+				bool ok = true;
+				for (std::size_t i = 0; i < N && ok; ++i) {
+					if (bucket[i] != b)
+						continue;
+					auto &slot = slots[slot_index (table[i].name, stringLength (table[i].name), seed)];
+					if (slot == -1)
+						slot = static_cast<int16_t> (i);
+					else
+						ok = false;
+				}
+				if (ok) {
+					seeds[b] = seed;
+					break;
+				}
+				// Undo the partial placement
+				for (auto &slot: slots)
+					if (slot != -1 && bucket[slot] == b)
+						slot = -1;
+			}
+		}
+	}
+
+	static constexpr std::size_t slot_index (const char *str, std::size_t len, uint32_t seed)
+	{
+		return hashString (str, len, seed) & (SlotCount - 1);
+	}
+
+	const UsageName *find (const std::string &str) const
+	{
+		std::size_t b = hashString (str.data (), str.size (), 0) % BucketCount;
+		int16_t index = slots[slot_index (str.data (), str.size (), seeds[b])];
+		if (index == -1 || str != names[index].name)
+			return nullptr;
+		return &names[index];
+	}
+};
+
+/**
+ * Names indexed by usage code, the first name of aliased codes is
+ * used.
+ */
+template<std::size_t Max, std::size_t N>
+constexpr std::array<const char *, Max+1> makeUsageStrings (const UsageName (&table)[N])
+{
+	std::array<const char *, Max+1> strings {};
+	for (std::size_t i = 0; i < N; ++i)
+		if (!strings[table[i].code])
+			strings[table[i].code] = table[i].name;
+	return strings;
+}
+
+}
+
+static constexpr UsageName key_names[] = {
 	{ "A", 0x04 },
 	{ "B", 0x05 },
 	{ "C", 0x06 },
@@ -151,17 +281,12 @@ static const std::map<std::string, unsigned int> key_string_map {
 
 constexpr unsigned int KeyMax = 0xff;
 
-static const std::vector<std::string> key_strings = []() {
-	std::vector<std::string> vec (KeyMax+1);
-	for (const auto &pair: key_string_map) {
-		vec[pair.second] = pair.first;
-	}
-	return vec;
-} ();
+static constexpr PerfectHash<std::size (key_names)> key_name_hash (key_names);
+static constexpr auto key_strings = makeUsageStrings<KeyMax> (key_names);
 
 std::string HID::keyString (unsigned int usage_code)
 {
-	if (usage_code > KeyMax || key_strings[usage_code].empty ()) {
+	if (usage_code > KeyMax || !key_strings[usage_code]) {
 		std::stringstream ss;
 		ss << "0x" << std::hex << std::setw (2) << std::setfill ('0') << usage_code;
 		return ss.str ();
@@ -171,9 +296,8 @@ std::string HID::keyString (unsigned int usage_code)
 
 unsigned int HID::keyUsageCode (const std::string &string)
 {
-	auto it = key_string_map.find (string);
-	if (it != key_string_map.end ())
-		return it->second;
+	if (auto usage = key_name_hash.find (string))
+		return usage->code;
 
 	std::size_t pos;
 	unsigned int code = std::stoul (string, &pos, 0);
@@ -215,12 +339,11 @@ uint8_t HID::modifierMask (const std::string &string)
 			mod = string.substr (current, next-current);
 			current = next + 1;
 		}
-		auto it = key_string_map.find (mod);
-		if (it != key_string_map.end ()) {
-			if (it->second < 0xe0 || it->second >= 0xe8) {
+		if (auto usage = key_name_hash.find (mod)) {
+			if (usage->code < 0xe0 || usage->code >= 0xe8) {
 				throw std::invalid_argument ("Invalid modifier key");
 			}
-			mask |= 1<<(it->second - 0xe0);
+			mask |= 1<<(usage->code - 0xe0);
 		}
 		else {
 			std::size_t pos;
@@ -235,7 +358,7 @@ uint8_t HID::modifierMask (const std::string &string)
 	return mask;
 }
 
-static const std::map<std::string, unsigned int> cc_string_map {
+static constexpr UsageName cc_names[] = {
 	{ "Unassigned", 0x00 },
 	{ "Consumer Control", 0x01 },
 	{ "Numeric Key Pad", 0x02 },
@@ -468,17 +591,12 @@ static const std::map<std::string, unsigned int> cc_string_map {
 
 constexpr unsigned int CCMax = 0x240;
 
-static const std::vector<std::string> cc_strings = []() {
-	std::vector<std::string> vec (CCMax+1);
-	for (const auto &pair: cc_string_map) {
-		vec[pair.second] = pair.first;
-	}
-	return vec;
-} ();
+static constexpr PerfectHash<std::size (cc_names)> cc_name_hash (cc_names);
+static constexpr auto cc_strings = makeUsageStrings<CCMax> (cc_names);
 
 std::string HID::consumerControlString (unsigned int usage_code)
 {
-	if (usage_code > CCMax || cc_strings[usage_code].empty ()) {
+	if (usage_code > CCMax || !cc_strings[usage_code]) {
 		std::stringstream ss;
 		ss << "0x" << std::hex << std::setw (4) << std::setfill ('0') << usage_code;
 		return ss.str ();
@@ -488,9 +606,8 @@ std::string HID::consumerControlString (unsigned int usage_code)
 
 unsigned int HID::consumerControlCode (const std::string &string)
 {
-	auto it = cc_string_map.find (string);
-	if (it != cc_string_map.end ())
-		return it->second;
+	if (auto usage = cc_name_hash.find (string))
+		return usage->code;
 
 	std::size_t pos;
 	unsigned int code = std::stoul (string, &pos, 0);
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "VirtualDevice.h"
+
+#include <map>
+#include <mutex>
+
+using namespace HID;
+
+namespace
+{
+
+struct SchemeRegistry
+{
+	std::mutex mutex;
+	std::map<std::string, VirtualDevice::factory> factories;
+	std::string default_scheme;
+};
+
+SchemeRegistry &registry ()
+{
+	static SchemeRegistry registry;
+	return registry;
+}
+
+}
+
+VirtualDevice::~VirtualDevice ()
+{
+}
+
+void VirtualDevice::registerScheme (const std::string &scheme, factory &&f)
+{
+	auto &r = registry ();
+	std::unique_lock<std::mutex> lock (r.mutex);
+	r.factories[scheme] = std::move (f);
+}
+
+void VirtualDevice::setDefaultScheme (const std::string &scheme)
+{
+	auto &r = registry ();
+	std::unique_lock<std::mutex> lock (r.mutex);
+	r.default_scheme = scheme;
+}
+
+std::shared_ptr<VirtualDevice> VirtualDevice::open (const std::string &path)
+{
+	auto &r = registry ();
+	factory f;
+	std::string args;
+	{
+		std::unique_lock<std::mutex> lock (r.mutex);
+		auto colon = path.find (':');
+		auto it = colon == std::string::npos
+			? r.factories.end ()
+			: r.factories.find (path.substr (0, colon));
+		if (it != r.factories.end ()) {
+			f = it->second;
+			args = path.substr (colon+1);
+		}
+		else if (!r.default_scheme.empty ()) {
+			it = r.factories.find (r.default_scheme);
+			if (it == r.factories.end ())
+				return nullptr;
+			f = it->second;
+			args = path;
+		}
+		else
+			return nullptr;
+	}
+	return f (args);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HID_VIRTUAL_DEVICE_H
+#define LIBHIDPP_HID_VIRTUAL_DEVICE_H
+
+#include <hid/ReportDescriptor.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace HID
+{
+
+/**
+ * In-process device that can be opened as a RawDevice instead of a real
+ * HID device, e.g. a simulator for testing or benchmarking.
+ *
+ * Methods may be called concurrently by the writing and reading threads.
+ */
+class VirtualDevice
+{
+public:
+	virtual ~VirtualDevice ();
+
+	virtual uint16_t vendorID () const = 0;
+	virtual uint16_t productID () const = 0;
+	virtual std::string name () const = 0;
+	virtual ReportDescriptor reportDescriptor () const = 0;
+
+	/**
+	 * Receive a report written by the host.
+	 *
+	 * \returns the number of bytes written.
+	 */
+	virtual int writeReport (const uint8_t *report, std::size_t length) = 0;
+	/**
+	 * Same as RawDevice::readReport.
+	 *
+	 * \returns report size or 0 if interrupted or timed out.
+	 */
+	virtual int readReport (uint8_t *report, std::size_t length, int timeout) = 0;
+	/**
+	 * Same as RawDevice::interruptRead.
+	 */
+	virtual void interruptRead () = 0;
+
+	typedef std::function<std::shared_ptr<VirtualDevice> (const std::string &args)> factory;
+
+	/**
+	 * Make RawDevice open paths starting with "\p scheme:" with \p f,
+	 * which is given the rest of the path.
+	 */
+	static void registerScheme (const std::string &scheme, factory &&f);
+	/**
+	 * Open paths without a registered scheme with the factory of
+	 * \p scheme, which is given the whole path (e.g. for accessing
+	 * every device through a daemon). An empty \p scheme restores
+	 * direct access.
+	 */
+	static void setDefaultScheme (const std::string &scheme);
+	/**
+	 * Create the virtual device for \p path.
+	 *
+	 * \returns null if the path scheme is not registered and there is
+	 * no default scheme.
+	 */
+	static std::shared_ptr<VirtualDevice> open (const std::string &path);
+};
+
+}
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "InterfaceCache.h"
+
+#include <misc/Log.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cwctype>
+#include <tuple>
+
+extern "C" {
+#include <hidsdi.h>
+#include <setupapi.h>
+}
+
+#include "error_category.h"
+#include "DeviceData.h"
+
+// Interface paths are case-insensitive and notifications may not use the SetupAPI case
+static std::wstring key (const std::wstring &path)
+{
+	std::wstring k = path;
+	std::transform (k.begin (), k.end (), k.begin (), [] (wchar_t c) { return std::towlower (c); });
+	return k;
+}
+
+InterfaceCache &InterfaceCache::instance ()
+{
+	static InterfaceCache cache;
+	return cache;
+}
+
+InterfaceCache::InterfaceCache ():
+	_notification (nullptr),
+	_scanned (false)
+{
+	// Register before the first scan so that no change is missed
+	CM_NOTIFY_FILTER filter;
+	memset (&filter, 0, sizeof (filter));
+	filter.cbSize = sizeof (filter);
+	filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+	HidD_GetHidGuid (&filter.u.DeviceInterface.ClassGuid);
+	CONFIGRET cr = CM_Register_Notification (&filter, this, &InterfaceCache::notify, &_notification);
+	if (cr != CR_SUCCESS) {
+		Log::warning ().printf ("CM_Register_Notification failed (%lu), HID interfaces will not be cached\n",
+					static_cast<unsigned long> (cr));
+		_notification = nullptr;
+	}
+}
+
+InterfaceCache::~InterfaceCache ()
+{
+	if (_notification)
+		CM_Unregister_Notification (_notification);
+}
+
+std::map<std::wstring, InterfaceCache::Interface> InterfaceCache::scan ()
+{
+	GUID hid_guid;
+	HidD_GetHidGuid (&hid_guid);
+
+	std::map<std::wstring, Interface> interfaces;
+	DeviceEnumerator enumerator (&hid_guid);
+	int i = 0;
+	while (auto dev = enumerator.get (i++)) {
+		bool ok;
+		DEVINST parent;
+		std::tie (ok, parent) = dev->parentInst ();
+		if (!ok)
+			continue;
+		Interface iface = { dev->devicePath (), DeviceData::getDeviceID (parent), nullptr };
+		interfaces.emplace (key (iface.path), std::move (iface));
+	}
+	return interfaces;
+}
+
+const std::map<std::wstring, InterfaceCache::Interface> &InterfaceCache::current ()
+{
+	if (!_notification || !_scanned) {
+		_interfaces = scan ();
+		_scanned = true;
+	}
+	return _interfaces;
+}
+
+std::vector<InterfaceCache::Interface> InterfaceCache::interfaces ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::vector<Interface> result;
+	for (const auto &p: current ())
+		result.push_back (p.second);
+	return result;
+}
+
+std::vector<InterfaceCache::Interface> InterfaceCache::interfaces (const std::wstring &parent_id)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::vector<Interface> result;
+	for (const auto &p: current ())
+		if (p.second.parent_id == parent_id)
+			result.push_back (p.second);
+	return result;
+}
+
+void InterfaceCache::setInfo (const std::wstring &path, std::shared_ptr<const Info> info)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (!_notification)
+		return;
+	auto it = _interfaces.find (key (path));
+	if (it != _interfaces.end ())
+		it->second.info = std::move (info);
+}
+
+bool InterfaceCache::addListener (const void *key, Listener listener)
+{
+	if (!_notification)
+		return false;
+	std::unique_lock<std::mutex> lock (_listeners_mutex);
+	_listeners.emplace (key, std::move (listener));
+	return true;
+}
+
+void InterfaceCache::removeListener (const void *key)
+{
+	// Also waits for a running call of the listener
+	std::unique_lock<std::mutex> lock (_listeners_mutex);
+	_listeners.erase (key);
+}
+
+DWORD CALLBACK InterfaceCache::notify (HCMNOTIFICATION notification, PVOID context,
+				       CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA data,
+				       DWORD size)
+{
+	auto cache = static_cast<InterfaceCache *> (context);
+	try {
+		switch (action) {
+		case CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL:
+			cache->arrived (data->u.DeviceInterface.SymbolicLink);
+			break;
+		case CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL:
+			cache->removed (data->u.DeviceInterface.SymbolicLink);
+			break;
+		default:
+			break;
+		}
+	}
+	catch (std::exception &e) {
+		Log::warning ().printf ("Failed to process HID interface notification: %s\n", e.what ());
+	}
+	return ERROR_SUCCESS;
+}
+
+void InterfaceCache::arrived (const wchar_t *path)
+{
+	// Find the parent device before locking, it may take a while
+	HDEVINFO devinfo = SetupDiCreateDeviceInfoList (nullptr, nullptr);
+	if (devinfo == INVALID_HANDLE_VALUE)
+		throw std::system_error (GetLastError (), windows_category (),
+					 "SetupDiCreateDeviceInfoList");
+	std::unique_ptr<void, decltype (&SetupDiDestroyDeviceInfoList)> devinfo_ptr (
+			devinfo, &SetupDiDestroyDeviceInfoList);
+	SP_DEVICE_INTERFACE_DATA interface_data;
+	interface_data.cbSize = sizeof (SP_DEVICE_INTERFACE_DATA);
+	if (!SetupDiOpenDeviceInterface (devinfo, path, 0, &interface_data))
+		throw std::system_error (GetLastError (), windows_category (),
+					 "SetupDiOpenDeviceInterface");
+	DeviceInterfaceData dev (devinfo, &interface_data);
+	bool ok;
+	DEVINST parent;
+	std::tie (ok, parent) = dev.parentInst ();
+	if (!ok)
+		return;
+	Interface iface = { dev.devicePath (), DeviceData::getDeviceID (parent), nullptr };
+
+	bool first = true;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (!_scanned)
+			return; // the first scan will find it
+		for (const auto &p: _interfaces)
+			if (p.second.parent_id == iface.parent_id)
+				first = false;
+		if (!_interfaces.emplace (key (iface.path), iface).second)
+			return; // already found by the scan
+	}
+	if (first)
+		notifyListeners (iface.parent_id, true);
+}
+
+void InterfaceCache::removed (const wchar_t *path)
+{
+	std::wstring parent_id;
+	bool last = true;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		auto it = _interfaces.find (key (path));
+		if (it == _interfaces.end ())
+			return;
+		parent_id = std::move (it->second.parent_id);
+		_interfaces.erase (it);
+		for (const auto &p: _interfaces)
+			if (p.second.parent_id == parent_id)
+				last = false;
+	}
+	if (last)
+		notifyListeners (parent_id, false);
+}
+
+void InterfaceCache::notifyListeners (const std::wstring &parent_id, bool added)
+{
+	std::unique_lock<std::mutex> lock (_listeners_mutex);
+	for (const auto &p: _listeners)
+		p.second (parent_id, added);
+}
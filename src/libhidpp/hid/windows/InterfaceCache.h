@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HID_WINDOWS_INTERFACE_CACHE_H
+#define LIBHIDPP_HID_WINDOWS_INTERFACE_CACHE_H
+
+#include <hid/ReportDescriptor.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <windows.h>
+#include <cfgmgr32.h>
+}
+
+/**
+ * Process-wide cache of the present HID interfaces.
+ *
+ * Interfaces are enumerated with SetupAPI once, then the cache is kept
+ * up to date by interface arrival and removal notifications
+ * (CM_Register_Notification) instead of enumerating again each time a
+ * device is opened or a monitor enumerates. The data read when an
+ * interface is first opened (attributes, strings and parsed collection)
+ * is kept until the interface is removed.
+ *
+ * If notifications cannot be registered, every call enumerates again
+ * and nothing is kept.
+ */
+class InterfaceCache
+{
+public:
+	struct Info
+	{
+		uint16_t vendor_id, product_id;
+		std::string name;
+		std::shared_ptr<const HID::ReportCollection> collection;
+	};
+
+	struct Interface
+	{
+		std::wstring path; ///< Path for CreateFile
+		std::wstring parent_id; ///< Device instance ID of the parent device
+		std::shared_ptr<const Info> info; ///< Null until \ref setInfo is called
+	};
+
+	/**
+	 * Called from a system thread when the first interface of a parent
+	 * device arrives or its last interface is removed.
+	 */
+	typedef std::function<void (const std::wstring &parent_id, bool added)> Listener;
+
+	static InterfaceCache &instance ();
+
+	/**
+	 * Every present interface.
+	 */
+	std::vector<Interface> interfaces ();
+	/**
+	 * Present interfaces of the device \p parent_id.
+	 */
+	std::vector<Interface> interfaces (const std::wstring &parent_id);
+
+	/**
+	 * Keep \p info for the interface at \p path until it is removed.
+	 */
+	void setInfo (const std::wstring &path, std::shared_ptr<const Info> info);
+
+	/**
+	 * Call \p listener for every parent device arrival or removal
+	 * until \ref removeListener is called with the same \p key.
+	 * The listener must not call the cache.
+	 *
+	 * \returns false if notifications are not available.
+	 */
+	bool addListener (const void *key, Listener listener);
+	void removeListener (const void *key);
+
+private:
+	InterfaceCache ();
+	~InterfaceCache ();
+
+	static DWORD CALLBACK notify (HCMNOTIFICATION notification, PVOID context,
+				      CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA data,
+				      DWORD size);
+	void arrived (const wchar_t *path);
+	void removed (const wchar_t *path);
+	void notifyListeners (const std::wstring &parent_id, bool added);
+
+	// Enumerate with SetupAPI, indexed by lower case path
+	static std::map<std::wstring, Interface> scan ();
+	// Scan if needed, _mutex must be held
+	const std::map<std::wstring, Interface> &current ();
+
+	std::mutex _mutex;
+	HCMNOTIFICATION _notification;
+	bool _scanned;
+	std::map<std::wstring, Interface> _interfaces;
+	std::mutex _listeners_mutex;
+	std::map<const void *, Listener> _listeners;
+};
+
+#endif
@@ -46,6 +46,15 @@ std::size_t AbstractMacroFormat::getJumpLength () const
 	return getLength (Macro::Item::Jump);
 }
 
+std::size_t AbstractMacroFormat::getLengths (Macro::const_iterator begin, Macro::const_iterator end,
+					       std::size_t *lengths) const
+{
+	std::size_t total = 0;
+	for (auto it = begin; it != end; ++it)
+		total += *(lengths++) = getLength (*it);
+	return total;
+}
+
 std::vector<uint8_t>::iterator AbstractMacroFormat::writeNoOp (std::vector<uint8_t>::iterator it) const
 {
 	std::vector<uint8_t>::iterator addr_it;
@@ -33,6 +33,8 @@ namespace HIDPP
  *
  * At least getLength(), writeAddress(), writeItem()
  * and parseItem() must be implemented by the subclass.
+ * Concrete formats derive from MacroFormatKernel for faster bulk
+ * functions.
  */
 class AbstractMacroFormat
 {
@@ -65,6 +67,15 @@ public:
 	 */
 	virtual std::size_t getJumpLength () const;
 
+	/**
+	 * Get the length of every item from \p begin to \p end into
+	 * \p lengths, with a single virtual call (see MacroFormatKernel).
+	 *
+	 * \returns the total length.
+	 */
+	virtual std::size_t getLengths (Macro::const_iterator begin, Macro::const_iterator end,
+					std::size_t *lengths) const;
+
 	/**
 	 * Write the address at the given location. The location
 	 * must be the iterator give as \p jump_addr_it by writeItem().
@@ -18,54 +18,1032 @@
 
 #include "AbstractMemoryMapping.h"
 
+#include <hidpp/PageCache.h>
+#include <hidpp/SyncJournal.h>
 #include <misc/Endian.h>
 #include <misc/CRC.h>
 #include <misc/Log.h>
+#include <misc/Probes.h>
+#include <misc/Trace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <stdexcept>
+#include <tuple>
 
 using namespace HIDPP;
 
+static bool hasValidCRC (const std::vector<uint8_t> &data)
+{
+	if (data.size () < sizeof (uint16_t))
+		return false;
+	auto crc_it = data.end () - sizeof (uint16_t);
+	return CRC::CCITT (data.begin (), crc_it) == readBE<uint16_t> (crc_it);
+}
+
 AbstractMemoryMapping::AbstractMemoryMapping (bool write_crc):
-	_write_crc (write_crc)
+	_write_crc (write_crc),
+	_verify_writes (false),
+	_table_page_count (0),
+	_table_page_size (0),
+	_read_ahead_max (0),
+	_read_ahead_window (0),
+	_account (MemoryAccounting::Subsystem::MemoryMappings),
+	_page_budget (0),
+	_use_clock (0)
+{
+}
+
+AbstractMemoryMapping::~AbstractMemoryMapping ()
+{
+	waitReadAhead ();
+}
+
+void AbstractMemoryMapping::setPageTable (int mem_type_count, unsigned int page_count, std::size_t page_size)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (!_pages.empty () || !_table.empty ())
+		throw std::logic_error ("page table set after reading pages");
+	_table_page_count = page_count;
+	_table_page_size = page_size;
+	_table.resize (mem_type_count * page_count);
+	_arena.resize (_table.size () * 2 * page_size);
+	updateAccount ();
+}
+
+AbstractMemoryMapping::Page *AbstractMemoryMapping::tableSlot (const Address &address)
+{
+	if (address.mem_type < 0 || address.page >= _table_page_count)
+		return nullptr;
+	std::size_t index = address.mem_type * _table_page_count + address.page;
+	if (index >= _table.size ())
+		return nullptr;
+	return &_table[index];
+}
+
+AbstractMemoryMapping::Page *AbstractMemoryMapping::findPage (const Address &address)
+{
+	if (auto slot = tableSlot (address))
+		return slot->present ? slot : nullptr;
+	auto it = _pages.find (address);
+	return it == _pages.end () ? nullptr : &it->second;
+}
+
+AbstractMemoryMapping::Page &AbstractMemoryMapping::addPage (const Address &address)
+{
+	Page *page = tableSlot (address);
+	if (!page)
+		page = &_pages[address];
+	page->present = true;
+	return *page;
+}
+
+void AbstractMemoryMapping::removePage (const Address &address)
+{
+	if (auto slot = tableSlot (address))
+		*slot = Page ();
+	else
+		_pages.erase (address);
+	updateAccount ();
+}
+
+void AbstractMemoryMapping::initPage (const Address &address, Page &page)
+{
+	std::size_t size = page.data.size ();
+	if (!page.device_data) {
+		Page *slot = tableSlot (address);
+		if (slot == &page && size == _table_page_size) {
+			page.device_data = &_arena[(slot - _table.data ()) * 2 * size];
+		}
+		else {
+			page.snapshots.resize (2 * size);
+			page.device_data = page.snapshots.data ();
+		}
+		page.crc_data = page.device_data + size;
+	}
+	std::copy (page.data.begin (), page.data.end (), page.device_data);
+	page.crc_valid = false;
+	updateAccount ();
+}
+
+template<typename F>
+void AbstractMemoryMapping::forEachPage (F f)
+{
+	for (std::size_t i = 0; i < _table.size (); ++i) {
+		if (!_table[i].present)
+			continue;
+		Address address = { static_cast<int> (i / _table_page_count), static_cast<unsigned int> (i % _table_page_count), 0 };
+		f (address, _table[i]);
+	}
+	for (auto &[address, page]: _pages)
+		f (address, page);
+}
+
+std::size_t AbstractMemoryMapping::pageBytes (const Page &page)
+{
+	return page.data.capacity () + page.snapshots.capacity ()
+		+ page.line_crcs.capacity () * sizeof (uint16_t)
+		+ page.loaded.capacity () / 8;
+}
+
+std::size_t AbstractMemoryMapping::footprint () const
+{
+	std::size_t size = _table.capacity () * sizeof (Page) + _arena.capacity ();
+	for (const auto &page: _table)
+		size += pageBytes (page);
+	for (const auto &[address, page]: _pages)
+		size += sizeof (std::pair<const Address, Page>) + MemoryAccounting::NodeOverhead + pageBytes (page);
+	return size;
+}
+
+void AbstractMemoryMapping::setPageBudget (std::size_t bytes)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_page_budget = bytes;
+}
+
+void AbstractMemoryMapping::pinPage (const Address &address)
+{
+	Address page_address = address;
+	page_address.offset = 0;
+	std::unique_lock<std::mutex> lock (_mutex);
+	++_pins[page_address];
+}
+
+void AbstractMemoryMapping::unpinPage (const Address &address)
+{
+	Address page_address = address;
+	page_address.offset = 0;
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _pins.find (page_address);
+	if (it != _pins.end () && --it->second == 0)
+		_pins.erase (it);
+}
+
+void AbstractMemoryMapping::evictPages ()
+{
+	if (_page_budget == 0)
+		return;
+	std::size_t total = 0;
+	forEachPage ([&total] (const Address &, Page &page) {
+		total += pageBytes (page);
+	});
+	while (total > _page_budget) {
+		std::optional<Address> lru;
+		std::size_t lru_bytes = 0;
+		uint64_t lru_use = 0;
+		forEachPage ([&, this] (const Address &address, Page &page) {
+			if (page.modified || page.loading || !page.loaded.empty () ||
+					_pins.count (address))
+				return;
+			if (!lru || page.last_use < lru_use) {
+				lru = address;
+				lru_use = page.last_use;
+				lru_bytes = pageBytes (page);
+			}
+		});
+		if (!lru)
+			break; // every page is in use
+		Log::debug ("memory") << "Evicting page " << lru->page << std::endl;
+		removePage (*lru);
+		total -= lru_bytes;
+	}
+}
+
+void AbstractMemoryMapping::updateAccount ()
+{
+	if (MemoryAccounting::enabled ())
+		_account.set (footprint ());
+}
+
+std::size_t AbstractMemoryMapping::memoryUsage ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	updateAccount ();
+	return footprint ();
+}
+
+std::shared_lock<std::shared_mutex> AbstractMemoryMapping::readLock ()
+{
+	return std::shared_lock<std::shared_mutex> (_content_mutex);
+}
+
+std::unique_lock<std::shared_mutex> AbstractMemoryMapping::writeLock ()
 {
+	std::unique_lock<std::shared_mutex> content_lock (_content_mutex);
+	// No reader is using page content, their buffers can be freed.
+	std::unique_lock<std::mutex> lock (_mutex);
+	evictPages ();
+	return content_lock;
 }
 
 const std::vector<uint8_t> &AbstractMemoryMapping::getReadOnlyPage (const Address &address)
 {
+	readAhead (address);
 	return getPage (address).data;
 }
 
 std::vector<uint8_t> &AbstractMemoryMapping::getWritablePage (const Address &address)
 {
 	auto &page = getPage (address);
+	std::unique_lock<std::mutex> lock (_mutex);
 	page.modified = true;
+	++page.generation;
 	return page.data;
 }
 
-void AbstractMemoryMapping::sync ()
+std::vector<uint8_t> &AbstractMemoryMapping::getOverwritePage (const Address &address, uint8_t fill)
 {
-	for (auto &p: _pages) {
-		auto &address = p.first;
-		auto &page = p.second;
-		if (page.modified) {
-			if (_write_crc) {
-				uint16_t crc = CRC::CCITT (page.data.begin (),
-							   page.data.end () - sizeof (crc));
-				writeBE (page.data.end () - sizeof (crc), crc);
+	std::size_t line_size = lineSize ();
+	if (line_size == 0) {
+		auto &data = getWritablePage (address);
+		std::fill (data.begin (), data.end (), fill);
+		return data;
+	}
+	Address page_address = address;
+	page_address.offset = 0;
+	std::unique_lock<std::mutex> lock (_mutex);
+	Page *page;
+	while ((page = findPage (page_address)) && page->loading)
+		_loaded.wait (lock);
+	if (!page) {
+		page = &addPage (page_address);
+		page->data.resize (pageSize (page_address));
+	}
+	std::fill (page->data.begin (), page->data.end (), fill);
+	if (!page->device_data || !page->loaded.empty ()) {
+		// Never completely read: pending lines are dropped
+		page->loaded.clear ();
+		page->overwritten = true;
+		initPage (page_address, *page);
+	}
+	page->last_use = ++_use_clock;
+	page->modified = true;
+	++page->generation;
+	return page->data;
+}
+
+unsigned int AbstractMemoryMapping::pageGeneration (const Address &address)
+{
+	Address page_address = address;
+	page_address.offset = 0;
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto page = findPage (page_address);
+	return page ? page->generation : 0;
+}
+
+std::vector<AbstractMemoryMapping::PageWrite> AbstractMemoryMapping::prepareSync ()
+{
+	// Reads must not be interleaved with the write sessions
+	waitReadAhead ();
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::vector<PageWrite> writes;
+	forEachPage ([&, this] (const Address &address, Page &page) {
+		if (!page.modified)
+			return;
+		uint16_t crc = pageCRC (page);
+		if (_write_crc)
+			writeBE (page.data.end () - sizeof (crc), crc);
+		std::vector<Range> ranges;
+		std::size_t i = 0;
+		if (page.overwritten) {
+			ranges.emplace_back (0, page.data.size ());
+			i = page.data.size ();
+		}
+		while (i < page.data.size ()) {
+			if (page.data[i] == page.device_data[i]) {
+				++i;
+				continue;
 			}
-			writePage (address, page.data);
+			std::size_t begin = i;
+			while (i < page.data.size () && page.data[i] != page.device_data[i])
+				++i;
+			ranges.emplace_back (begin, i);
+		}
+		if (ranges.empty ()) {
+			Log::debug ("memory") << "Skipping unchanged page " << address.page << std::endl;
 			page.modified = false;
 		}
+		else
+			writes.push_back ({ address, &page, std::move (ranges) });
+	});
+	return writes;
+}
+
+std::vector<AbstractMemoryMapping::PlannedWrite> AbstractMemoryMapping::pendingWrites ()
+{
+	std::vector<PlannedWrite> plan;
+	for (auto &write: prepareSync ())
+		plan.push_back ({ write.address, std::move (write.ranges) });
+	return plan;
+}
+
+std::vector<AbstractMemoryMapping::PageWrite> AbstractMemoryMapping::resumeSync (SyncJournal &journal, const std::string &fingerprint,
+									    std::vector<PageWrite> writes)
+{
+	std::vector<SyncJournal::PlannedPage> plan;
+	std::vector<PageWrite> remaining;
+	std::vector<uint8_t> end;
+	for (auto &write: writes) {
+		const auto &data = write.page->data;
+		SyncJournal::PlannedPage planned = {
+			write.address,
+			SyncJournal::digest (data),
+			readBE<uint16_t> (data.end () - sizeof (uint16_t))
+		};
+		plan.push_back (planned);
+		if (journal.completed (fingerprint, write.address, planned.digest) &&
+				(!readPageEnd (write.address, end) ||
+				 (end.size () >= sizeof (uint16_t) &&
+				  readBE<uint16_t> (end.end () - sizeof (uint16_t)) == planned.crc))) {
+			Log::debug ("memory") << "Page " << write.address.page
+					      << " was written by an interrupted sync" << std::endl;
+			finishSync (write);
+		}
+		else
+			remaining.push_back (std::move (write));
 	}
+	journal.begin (fingerprint, plan);
+	return remaining;
 }
 
-AbstractMemoryMapping::Page &AbstractMemoryMapping::getPage (Address address)
+void AbstractMemoryMapping::finishSync (const PageWrite &write)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	Page &page = *write.page;
+	std::copy (page.data.begin (), page.data.end (), page.device_data);
+	page.modified = false;
+	page.overwritten = false;
+	if (_cache) {
+		auto crc_it = page.data.end () - sizeof (uint16_t);
+		if (readBE<uint16_t> (crc_it) == pageCRC (page))
+			_cache->storePage (_fingerprint, write.address, page.data);
+		else
+			_cache->removePage (_fingerprint, write.address);
+	}
+}
+
+void AbstractMemoryMapping::verifyPage (const PageWrite &write)
+{
+	const auto &data = write.page->data;
+	std::vector<uint8_t> read;
+	if (readPageEnd (write.address, read) && read.size () <= data.size () &&
+			std::equal (read.begin (), read.end (), data.end () - read.size ()))
+		return;
+	Log::debug ("memory") << "Reading back page " << write.address.page << std::endl;
+	readPage (write.address, read);
+	LIBHIDPP_PROBE (page_read, this, write.address.mem_type, write.address.page, read.size ());
+	if (read != data)
+		throw VerifyError (write.address);
+}
+
+AbstractMemoryMapping::VerifyError::VerifyError (const Address &address):
+	_address (address)
+{
+}
+
+const char *AbstractMemoryMapping::VerifyError::what () const noexcept
+{
+	return "Page content differs after writing";
+}
+
+const Address &AbstractMemoryMapping::VerifyError::address () const
+{
+	return _address;
+}
+
+void AbstractMemoryMapping::setVerifyWrites (bool verify)
+{
+	_verify_writes = verify;
+}
+
+std::size_t AbstractMemoryMapping::writtenBytes (const PageWrite &write, bool partial)
+{
+	if (!partial)
+		return write.page->data.size ();
+	std::size_t count = 0;
+	for (const auto &range: write.ranges)
+		count += range.second - range.first;
+	return count;
+}
+
+std::size_t AbstractMemoryMapping::syncedBytes (const std::vector<PageWrite> &writes, bool partial)
+{
+	std::size_t count = 0;
+	for (const auto &write: writes)
+		count += writtenBytes (write, partial);
+	return count;
+}
+
+void AbstractMemoryMapping::sync (bool partial)
+{
+	Trace::Scope trace ("memory", "sync", { { "partial", partial } });
+	// Modified pages cannot be removed or reloaded while the caller
+	// holds the write lock, the device is written without _mutex.
+	auto writes = prepareSync ();
+	std::shared_ptr<SyncJournal> journal;
+	std::string fingerprint;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		journal = _journal;
+		fingerprint = _journal_fingerprint;
+	}
+	if (journal) {
+		// One page at a time, so that the journal knows which are done
+		auto resumed = resumeSync (*journal, fingerprint, std::move (writes));
+		for (const auto &write: resumed) {
+			if (!partial || !writeRanges (write.address, write.page->data, write.ranges))
+				writePages ({ write.address }, { &write.page->data });
+			LIBHIDPP_PROBE (page_written, this, write.address.mem_type, write.address.page,
+					writtenBytes (write, partial));
+			verifyPage (write);
+			journal->complete (fingerprint, write.address);
+			finishSync (write);
+		}
+		journal->finish (fingerprint);
+		LIBHIDPP_PROBE (memory_synced, this, resumed.size (), syncedBytes (resumed, partial));
+		return;
+	}
+	std::vector<Address> full_addresses;
+	std::vector<const std::vector<uint8_t> *> full_data;
+	for (const auto &write: writes) {
+		if (!partial || !writeRanges (write.address, write.page->data, write.ranges)) {
+			// Written whole with the other pages
+			full_addresses.push_back (write.address);
+			full_data.push_back (&write.page->data);
+		}
+	}
+	if (!full_addresses.empty ())
+		writePages (full_addresses, full_data);
+	for (const auto &write: writes) {
+		LIBHIDPP_PROBE (page_written, this, write.address.mem_type, write.address.page,
+				writtenBytes (write, partial));
+		if (_verify_writes)
+			verifyPage (write);
+		finishSync (write);
+	}
+	LIBHIDPP_PROBE (memory_synced, this, writes.size (), syncedBytes (writes, partial));
+}
+
+std::unique_ptr<AbstractMemoryMapping::SyncOperation> AbstractMemoryMapping::syncAsync (bool partial)
+{
+	std::unique_ptr<SyncOperation> op (new SyncOperation ());
+	op->_result = std::async (std::launch::async, [this, op = op.get (), partial] () {
+		auto lock = writeLock ();
+		auto writes = prepareSync ();
+		std::shared_ptr<SyncJournal> journal;
+		std::string fingerprint;
+		{
+			std::unique_lock<std::mutex> journal_lock (_mutex);
+			journal = _journal;
+			fingerprint = _journal_fingerprint;
+		}
+		if (journal)
+			writes = resumeSync (*journal, fingerprint, std::move (writes));
+		{
+			std::unique_lock<std::mutex> progress_lock (op->_mutex);
+			op->_progress.page_count = writes.size ();
+			op->_progress.byte_count = syncedBytes (writes, partial);
+		}
+		for (const auto &write: writes) {
+			if (op->_cancelled)
+				return false;
+			// Pages are written one by one to be cancellable,
+			// the writes in a page are still pipelined.
+			if (!partial || !writeRanges (write.address, write.page->data, write.ranges))
+				writePages ({ write.address }, { &write.page->data });
+			LIBHIDPP_PROBE (page_written, this, write.address.mem_type, write.address.page,
+					writtenBytes (write, partial));
+			if (_verify_writes || journal)
+				verifyPage (write);
+			if (journal)
+				journal->complete (fingerprint, write.address);
+			finishSync (write);
+			std::unique_lock<std::mutex> progress_lock (op->_mutex);
+			++op->_progress.pages_written;
+			op->_progress.bytes_written += writtenBytes (write, partial);
+		}
+		if (journal)
+			journal->finish (fingerprint);
+		LIBHIDPP_PROBE (memory_synced, this, writes.size (), syncedBytes (writes, partial));
+		return true;
+	});
+	return op;
+}
+
+AbstractMemoryMapping::SyncOperation::SyncOperation ():
+	_progress {},
+	_cancelled (false)
+{
+}
+
+AbstractMemoryMapping::SyncOperation::~SyncOperation ()
+{
+	if (_result.valid ())
+		_result.wait ();
+}
+
+AbstractMemoryMapping::SyncOperation::Progress AbstractMemoryMapping::SyncOperation::progress () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _progress;
+}
+
+void AbstractMemoryMapping::SyncOperation::cancel ()
+{
+	_cancelled = true;
+}
+
+bool AbstractMemoryMapping::SyncOperation::finished () const
+{
+	return _result.wait_for (std::chrono::seconds (0)) == std::future_status::ready;
+}
+
+bool AbstractMemoryMapping::SyncOperation::wait ()
+{
+	return _result.get ();
+}
+
+uint16_t AbstractMemoryMapping::pageCRC (Page &page)
+{
+	std::size_t length = page.data.size () - sizeof (uint16_t);
+	bool all = !page.crc_valid;
+	if (all) {
+		page.line_crcs.resize ((length + CRCLineSize - 1) / CRCLineSize);
+		page.crc_valid = true;
+	}
+	uint16_t crc = 0xFFFF;
+	for (std::size_t i = 0; i < page.line_crcs.size (); ++i) {
+		auto begin = page.data.begin () + i * CRCLineSize;
+		auto line_length = std::min (CRCLineSize, length - i * CRCLineSize);
+		auto end = begin + line_length;
+		auto saved = page.crc_data + i * CRCLineSize;
+		if (all || !std::equal (begin, end, saved)) {
+			page.line_crcs[i] = CRC::CCITT (begin, end, 0);
+			std::copy (begin, end, saved);
+		}
+		crc = CRC::CCITTCombine (crc, page.line_crcs[i], line_length);
+	}
+	return crc;
+}
+
+void AbstractMemoryMapping::prefetch (const std::vector<Address> &addresses)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (_cache) {
+		lock.unlock ();
+		for (const auto &address: addresses)
+			getPage (address);
+		return;
+	}
+	// Pages loading in other threads are left to them
+	std::set<Address> pages;
+	for (Address address: addresses) {
+		address.offset = 0;
+		auto page = findPage (address);
+		if (!page || (!page->loading && !page->loaded.empty ()))
+			pages.insert (address);
+	}
+	if (pages.empty ())
+		return;
+	std::vector<Address> missing (pages.begin (), pages.end ());
+	std::vector<bool> partial;
+	for (const auto &address: missing) {
+		auto page = findPage (address);
+		partial.push_back (page != nullptr);
+		if (!page)
+			page = &addPage (address);
+		page->loading = true;
+	}
+	std::vector<std::vector<uint8_t>> data;
+	lock.unlock ();
+	try {
+		readPages (missing, data);
+		for (std::size_t i = 0; i < missing.size (); ++i)
+			LIBHIDPP_PROBE (page_read, this, missing[i].mem_type, missing[i].page, data[i].size ());
+	}
+	catch (...) {
+		lock.lock ();
+		for (std::size_t i = 0; i < missing.size (); ++i) {
+			if (partial[i])
+				findPage (missing[i])->loading = false;
+			else
+				removePage (missing[i]);
+		}
+		_loaded.notify_all ();
+		throw;
+	}
+	lock.lock ();
+	for (std::size_t i = 0; i < missing.size (); ++i) {
+		auto &page = *findPage (missing[i]);
+		if (partial[i]) {
+			// Keep the buffer of partially read pages for their
+			// iterators, and the loaded lines for their readers.
+			std::size_t line_size = lineSize ();
+			for (std::size_t line = 0; line < page.loaded.size (); ++line) {
+				if (page.loaded[line])
+					continue;
+				std::size_t begin = line * line_size;
+				std::size_t end = std::min (begin + line_size, page.data.size ());
+				std::copy (data[i].begin () + begin, data[i].begin () + end,
+					   page.data.begin () + begin);
+			}
+		}
+		else
+			page.data = std::move (data[i]);
+		page.loaded.clear ();
+		page.loading = false;
+		page.last_use = ++_use_clock;
+		initPage (missing[i], page);
+	}
+	_loaded.notify_all ();
+}
+
+static bool isErased (std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end)
+{
+	return std::all_of (begin, end, [] (uint8_t byte) { return byte == 0xff; });
+}
+
+std::optional<std::vector<uint8_t>> AbstractMemoryMapping::expectedPage (const Address &address)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	Page *page = findPage (address);
+	if (page && page->present && !page->loading && !page->modified &&
+			page->loaded.empty () && page->device_data) {
+		std::vector<uint8_t> data (page->device_data, page->device_data + page->data.size ());
+		if (hasValidCRC (data))
+			return data;
+	}
+	if (_cache) {
+		auto data = _cache->findPage (_fingerprint, address);
+		if (data && hasValidCRC (*data))
+			return data;
+	}
+	return std::nullopt;
+}
+
+std::vector<AbstractMemoryMapping::IntegrityResult> AbstractMemoryMapping::checkIntegrity (const std::vector<Address> &addresses)
+{
+	Trace::Scope trace ("memory", "checkIntegrity", { { "count", static_cast<unsigned int> (addresses.size ()) } });
+	std::vector<IntegrityResult> results;
+	std::vector<Address> pages;
+	for (Address address: addresses) {
+		address.offset = 0;
+		pages.push_back (address);
+		results.push_back ({ address, PageIntegrity::Corrupted, false });
+	}
+	std::size_t line_size = lineSize ();
+	std::vector<std::size_t> suspicious;
+	if (line_size == 0 || pages.empty ()) {
+		for (std::size_t i = 0; i < pages.size (); ++i)
+			suspicious.push_back (i);
+	}
+	else {
+		std::vector<Address> end_lines;
+		for (Address address: pages) {
+			address.offset = pageSize (address) - line_size;
+			end_lines.push_back (address);
+		}
+		std::vector<std::vector<uint8_t>> ends;
+		readPageLines (end_lines, ends);
+		std::vector<std::size_t> erased_ends;
+		std::vector<Address> start_lines;
+		for (std::size_t i = 0; i < pages.size (); ++i) {
+			const auto &end = ends[i];
+			if (isErased (end.begin (), end.end ())) {
+				erased_ends.push_back (i);
+				start_lines.push_back (pages[i]);
+				continue;
+			}
+			auto expected = expectedPage (pages[i]);
+			if (expected && expected->size () >= end.size () &&
+					std::equal (end.begin (), end.end (), expected->end () - end.size ()))
+				results[i].integrity = PageIntegrity::Valid;
+			else
+				suspicious.push_back (i);
+		}
+		if (!start_lines.empty ()) {
+			std::vector<std::vector<uint8_t>> starts;
+			readPageLines (start_lines, starts);
+			for (std::size_t j = 0; j < erased_ends.size (); ++j) {
+				if (isErased (starts[j].begin (), starts[j].end ()))
+					results[erased_ends[j]].integrity = PageIntegrity::Erased;
+				else
+					suspicious.push_back (erased_ends[j]);
+			}
+			std::sort (suspicious.begin (), suspicious.end ());
+		}
+	}
+	if (suspicious.empty ())
+		return results;
+
+	Log::debug ("memory") << "Reading " << suspicious.size () << " suspicious page(s)" << std::endl;
+	std::vector<Address> full_addresses;
+	for (auto i: suspicious)
+		full_addresses.push_back (pages[i]);
+	std::vector<std::vector<uint8_t>> data;
+	readPages (full_addresses, data);
+	for (std::size_t i = 0; i < full_addresses.size (); ++i)
+		LIBHIDPP_PROBE (page_read, this, full_addresses[i].mem_type, full_addresses[i].page, data[i].size ());
+	std::shared_ptr<PageCache> cache;
+	std::string fingerprint;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		cache = _cache;
+		fingerprint = _fingerprint;
+	}
+	for (std::size_t j = 0; j < suspicious.size (); ++j) {
+		auto &result = results[suspicious[j]];
+		result.full_read = true;
+		if (hasValidCRC (data[j])) {
+			result.integrity = PageIntegrity::Valid;
+			if (cache)
+				cache->storePage (fingerprint, result.address, data[j]);
+		}
+		else if (isErased (data[j].begin (), data[j].end ()))
+			result.integrity = PageIntegrity::Erased;
+	}
+	return results;
+}
+
+void AbstractMemoryMapping::setReadAhead (unsigned int max_pages)
+{
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_read_ahead_max = max_pages;
+		_read_ahead_window = 0;
+		_last_access.reset ();
+	}
+	if (max_pages == 0)
+		waitReadAhead ();
+}
+
+void AbstractMemoryMapping::waitReadAhead ()
+{
+	std::future<void> read_ahead;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		read_ahead = std::move (_read_ahead);
+	}
+	if (read_ahead.valid ())
+		read_ahead.wait ();
+}
+
+unsigned int AbstractMemoryMapping::pageCount (const Address &) const
+{
+	return 0;
+}
+
+void AbstractMemoryMapping::readAhead (Address address)
 {
 	address.offset = 0;
-	auto it = _pages.find (address);
-	if (it == _pages.end ()) {
-		it = _pages.emplace (address, Page { false }).first;
-		readPage (address, it->second.data);
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (_read_ahead_max == 0)
+		return;
+	if (_last_access && _last_access->mem_type == address.mem_type) {
+		if (_last_access->page == address.page)
+			return;
+		if (_last_access->page + 1 == address.page)
+			_read_ahead_window = std::min (std::max (2*_read_ahead_window, 1u), _read_ahead_max);
+		else
+			_read_ahead_window = 0;
 	}
-	return it->second;
+	else
+		_read_ahead_window = 0;
+	_last_access = address;
+	if (_read_ahead_window == 0)
+		return;
+	if (_read_ahead.valid () &&
+			_read_ahead.wait_for (std::chrono::seconds (0)) != std::future_status::ready)
+		return; // the next access will try again
+	unsigned int page_count = pageCount (address);
+	std::vector<Address> next;
+	for (unsigned int i = 1; i <= _read_ahead_window && address.page + i < page_count; ++i) {
+		Address next_address = address;
+		next_address.page += i;
+		auto page = findPage (next_address);
+		if (!page || (!page->loading && !page->loaded.empty ()))
+			next.push_back (next_address);
+	}
+	if (next.empty ())
+		return;
+	_read_ahead = std::async (std::launch::async, [this, next = std::move (next)] () {
+		try {
+			prefetch (next);
+		}
+		catch (std::exception &e) {
+			Log::debug ("memory") << "Read-ahead failed: " << e.what () << std::endl;
+		}
+	});
+}
+
+void AbstractMemoryMapping::setPageCache (std::shared_ptr<PageCache> cache, const std::string &fingerprint)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_cache = std::move (cache);
+	_fingerprint = fingerprint;
+}
+
+void AbstractMemoryMapping::setSyncJournal (std::shared_ptr<SyncJournal> journal, const std::string &fingerprint)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_journal = std::move (journal);
+	_journal_fingerprint = fingerprint;
+}
+
+std::vector<uint8_t>::const_iterator AbstractMemoryMapping::getReadOnlyRange (const Address &address, std::size_t)
+{
+	return getReadOnlyIterator (address);
+}
+
+const std::vector<uint8_t> &AbstractMemoryMapping::getReadOnlyPageRange (const Address &address, std::size_t begin, std::size_t end)
+{
+	std::size_t line_size = lineSize ();
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (line_size == 0 || _cache) {
+		lock.unlock ();
+		return getReadOnlyPage (address);
+	}
+	lock.unlock ();
+	readAhead (address);
+	lock.lock ();
+	Address page_address = address;
+	page_address.offset = 0;
+	Page *page = findPage (page_address);
+	if (!page) {
+		page = &addPage (page_address);
+		page->data.resize (pageSize (page_address));
+		page->loaded.resize ((page->data.size () + line_size - 1) / line_size, false);
+		updateAccount ();
+	}
+	page->last_use = ++_use_clock;
+	loadLines (lock, page_address, *page, begin, end);
+	return page->data;
+}
+
+void AbstractMemoryMapping::loadLines (std::unique_lock<std::mutex> &lock, const Address &address, Page &page, std::size_t begin, std::size_t end)
+{
+	std::size_t line_size = lineSize ();
+	while (true) {
+		_loaded.wait (lock, [&page] () { return !page.loading; });
+		if (page.loaded.empty ())
+			return;
+		// The last line is read from the end of the page not to overflow it
+		// when the page size is not a multiple of the line size.
+		std::vector<std::size_t> offsets;
+		for (std::size_t line = begin / line_size;
+				line * line_size < end && line < page.loaded.size ();
+				++line) {
+			if (!page.loaded[line])
+				offsets.push_back (std::min (line * line_size, page.data.size () - line_size));
+		}
+		if (offsets.empty ())
+			return;
+		// Other threads may read the lines already loaded while the
+		// missing ones are copied in the page buffer.
+		page.loading = true;
+		lock.unlock ();
+		try {
+			readLines (address, offsets, page.data);
+			LIBHIDPP_PROBE (page_read, this, address.mem_type, address.page,
+					offsets.size () * line_size);
+		}
+		catch (...) {
+			lock.lock ();
+			page.loading = false;
+			_loaded.notify_all ();
+			throw;
+		}
+		lock.lock ();
+		for (auto offset: offsets)
+			page.loaded[(offset + line_size - 1) / line_size] = true;
+		page.loading = false;
+		if (std::all_of (page.loaded.begin (), page.loaded.end (), [] (bool loaded) { return loaded; })) {
+			page.loaded.clear ();
+			initPage (address, page);
+		}
+		_loaded.notify_all ();
+		return;
+	}
+}
+
+void AbstractMemoryMapping::readPages (const std::vector<Address> &addresses, std::vector<std::vector<uint8_t>> &data)
+{
+	data.resize (addresses.size ());
+	for (std::size_t i = 0; i < addresses.size (); ++i)
+		readPage (addresses[i], data[i]);
+}
+
+void AbstractMemoryMapping::writePages (const std::vector<Address> &addresses, const std::vector<const std::vector<uint8_t> *> &data)
+{
+	for (std::size_t i = 0; i < addresses.size (); ++i)
+		writePage (addresses[i], *data[i]);
+}
+
+std::size_t AbstractMemoryMapping::lineSize () const
+{
+	return 0;
+}
+
+std::size_t AbstractMemoryMapping::pageSize (const Address &) const
+{
+	throw std::logic_error ("memory mapping without line reads");
+}
+
+void AbstractMemoryMapping::readPageLines (const std::vector<Address> &addresses, std::vector<std::vector<uint8_t>> &data)
+{
+	std::size_t line_size = lineSize ();
+	data.resize (addresses.size ());
+	for (std::size_t i = 0; i < addresses.size (); ++i) {
+		Address page_address = addresses[i];
+		page_address.offset = 0;
+		std::vector<uint8_t> page (pageSize (page_address));
+		readLines (page_address, { static_cast<std::size_t> (addresses[i].offset) }, page);
+		data[i].assign (page.begin () + addresses[i].offset,
+				page.begin () + addresses[i].offset + line_size);
+	}
+}
+
+void AbstractMemoryMapping::readLines (const Address &, const std::vector<std::size_t> &, std::vector<uint8_t> &)
+{
+	throw std::logic_error ("memory mapping without line reads");
+}
+
+bool AbstractMemoryMapping::writeRanges (const Address &, const std::vector<uint8_t> &, const std::vector<Range> &)
+{
+	return false;
+}
+
+bool AbstractMemoryMapping::readPageEnd (const Address &, std::vector<uint8_t> &)
+{
+	return false;
+}
+
+bool AbstractMemoryMapping::isReadOnly (const Address &) const
+{
+	return false;
 }
 
+AbstractMemoryMapping::Page &AbstractMemoryMapping::getPage (Address address)
+{
+	address.offset = 0;
+	std::unique_lock<std::mutex> lock (_mutex);
+	Page *page;
+	while ((page = findPage (address)) && page->loading)
+		_loaded.wait (lock);
+	if (page) {
+		page->last_use = ++_use_clock;
+		if (!page->loaded.empty ()) {
+			// Complete the partially read page
+			loadLines (lock, address, *page, 0, page->data.size ());
+			if (_cache && page->loaded.empty () && hasValidCRC (page->data))
+				_cache->storePage (_fingerprint, address, page->data);
+		}
+		return *page;
+	}
+	// Other threads missing the same page wait for this read
+	addPage (address).loading = true;
+	auto cache = _cache;
+	auto fingerprint = _fingerprint;
+	lock.unlock ();
+	std::vector<uint8_t> data;
+	try {
+		std::optional<std::vector<uint8_t>> cached;
+		if (cache)
+			cached = cache->findPage (fingerprint, address);
+		bool read_only = isReadOnly (address);
+		if (cached && !read_only) {
+			std::vector<uint8_t> end;
+			if (!hasValidCRC (*cached) ||
+					!readPageEnd (address, end) ||
+					end.size () > cached->size () ||
+					!std::equal (end.begin (), end.end (), cached->end () - end.size ()))
+				cached.reset ();
+		}
+		if (cached) {
+			Log::debug ("memory") << "Using cached page " << address.page << std::endl;
+			data = std::move (*cached);
+		}
+		else {
+			readPage (address, data);
+			LIBHIDPP_PROBE (page_read, this, address.mem_type, address.page, data.size ());
+			if (cache && (read_only || hasValidCRC (data)))
+				cache->storePage (fingerprint, address, data);
+		}
+	}
+	catch (...) {
+		lock.lock ();
+		removePage (address);
+		_loaded.notify_all ();
+		throw;
+	}
+	lock.lock ();
+	page = findPage (address);
+	page->data = std::move (data);
+	page->loading = false;
+	page->last_use = ++_use_clock;
+	initPage (address, *page);
+	_loaded.notify_all ();
+	return *page;
+}
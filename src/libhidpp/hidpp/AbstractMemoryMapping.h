@@ -20,13 +20,28 @@
 #define LIBHIDPP_HIDPP_ABSTRACT_MEMORY_MAPPING_H
 
 #include <hidpp/Address.h>
+#include <misc/MemoryAccounting.h>
 #include <vector>
 #include <map>
+#include <optional>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <cstddef>
 #include <cstdint>
 
 namespace HIDPP
 {
 
+class PageCache;
+class SyncJournal;
+
 /**
  * Abstract class for accessing paged memory.
  *
@@ -34,11 +49,31 @@ namespace HIDPP
  * for memory access, and getReadOnlyIterator,
  * getWritableIterator and computeOffset to convert
  * between address offsets and iterators.
+ *
+ * Pages can be read from several threads: pages already read are
+ * shared, missing pages are fetched in parallel and a page missed by
+ * several threads at once is read only once. Page content must not be
+ * read while it is modified: readers hold \ref readLock while using
+ * page content, and \ref writeLock is held for getting writable pages,
+ * modifying them and calling sync.
  */
 class AbstractMemoryMapping
 {
 public:
 	AbstractMemoryMapping (bool write_crc = true);
+	virtual ~AbstractMemoryMapping ();
+
+	/**
+	 * Shared lock for reading page content.
+	 */
+	std::shared_lock<std::shared_mutex> readLock ();
+	/**
+	 * Exclusive lock for modifying page content.
+	 *
+	 * Pages over the budget (see setPageBudget) are evicted once it is
+	 * acquired.
+	 */
+	std::unique_lock<std::shared_mutex> writeLock ();
 
 	/**
 	 * Get the page at \p address (offset is ignored) as read-only.
@@ -48,11 +83,268 @@ public:
 	 * Get the page at \p address (offset is ignored) and mark it as "modified".
 	 */
 	std::vector<uint8_t> &getWritablePage (const Address &address);
+	/**
+	 * Get the page at \p address (offset is ignored) filled with
+	 * \p fill and mark it as "modified", for callers replacing the whole
+	 * page content.
+	 *
+	 * The page is not read from the device memory when it is not
+	 * already, it is then entirely written by the next sync (even if
+	 * the device memory has the same content). Mappings without line
+	 * reads (see lineSize) read the page as getWritablePage does.
+	 */
+	std::vector<uint8_t> &getOverwritePage (const Address &address, uint8_t fill = 0xff);
+	/**
+	 * Number of times the page at \p address (offset is ignored) was
+	 * got with getWritablePage, 0 if it was not read.
+	 *
+	 * Lets data decoded from a page be invalidated when it may have
+	 * been modified.
+	 */
+	unsigned int pageGeneration (const Address &address);
 
 	/**
 	 * Write all modified pages to the device memory.
+	 *
+	 * Pages whose content (including the CRC) is the same as in the
+	 * device memory are skipped. When \p partial is true and the
+	 * mapping supports it (see writeRanges), only the changed byte
+	 * ranges of a page are written.
+	 */
+	void sync (bool partial = true);
+
+	/**
+	 * Byte range [first, second) in a page.
+	 */
+	typedef std::pair<std::size_t, std::size_t> Range;
+	/**
+	 * Modified page and its byte ranges that differ from the device
+	 * memory.
 	 */
-	void sync ();
+	struct PlannedWrite
+	{
+		Address address;
+		std::vector<Range> ranges;
+	};
+	/**
+	 * Compute what sync would write: the modified pages (with their
+	 * CRC updated) and their changed ranges. Pages whose content is
+	 * unchanged are no longer modified.
+	 */
+	std::vector<PlannedWrite> pendingWrites ();
+
+	/**
+	 * Page content read back after a write does not match.
+	 */
+	class VerifyError: public std::exception
+	{
+	public:
+		VerifyError (const Address &address);
+
+		virtual const char *what () const noexcept;
+
+		const Address &address () const;
+
+	private:
+		Address _address;
+	};
+
+	/**
+	 * Check every page after sync writes it.
+	 *
+	 * The end of the page, with its CRC, is read back with readPageEnd
+	 * and compared with the written data. The whole page is read only if
+	 * they differ or if the mapping cannot read page ends. sync throws
+	 * VerifyError if the page still differs.
+	 */
+	void setVerifyWrites (bool verify);
+
+	/**
+	 * Handle of a sync running in the background, see syncAsync.
+	 *
+	 * Destroying the handle waits for the end of the sync.
+	 */
+	class SyncOperation
+	{
+	public:
+		~SyncOperation ();
+
+		struct Progress
+		{
+			unsigned int pages_written;
+			unsigned int page_count;
+			/**
+			 * Changed bytes, or whole pages if the sync is not
+			 * partial.
+			 */
+			std::size_t bytes_written;
+			std::size_t byte_count;
+		};
+		Progress progress () const;
+
+		/**
+		 * Stop writing at the next page boundary. Pages already
+		 * written are not modified anymore, the others are left
+		 * modified for a later sync.
+		 */
+		void cancel ();
+
+		/**
+		 * Check if the sync is over, without blocking.
+		 */
+		bool finished () const;
+		/**
+		 * Wait for the end of the sync.
+		 *
+		 * \returns false if it was cancelled.
+		 *
+		 * \throws the error that stopped the sync.
+		 */
+		bool wait ();
+
+	private:
+		SyncOperation ();
+		friend class AbstractMemoryMapping;
+
+		mutable std::mutex _mutex;
+		Progress _progress;
+		std::atomic<bool> _cancelled;
+		std::future<bool> _result;
+	};
+
+	/**
+	 * Same as sync, but the pages are written by another thread and one
+	 * page at a time so that the returned operation can report progress
+	 * and be cancelled.
+	 *
+	 * The sync takes \ref writeLock itself, the caller must not hold it
+	 * while waiting for the operation. The mapping must outlive the
+	 * operation.
+	 */
+	std::unique_ptr<SyncOperation> syncAsync (bool partial = true);
+
+	/**
+	 * Read every page of \p addresses (offsets are ignored) that is not
+	 * already read, with a single readPages call.
+	 *
+	 * When a page cache is used, pages are read one by one as with
+	 * getReadOnlyPage.
+	 */
+	void prefetch (const std::vector<Address> &addresses);
+
+	enum class PageIntegrity
+	{
+		Valid,
+		Corrupted, ///< CRC does not match the content
+		Erased, ///< first and last lines erased (only 0xff)
+	};
+	struct IntegrityResult
+	{
+		Address address;
+		PageIntegrity integrity;
+		bool full_read; ///< the whole page had to be read
+	};
+	/**
+	 * Check the CRC of the pages at \p addresses (offsets are ignored),
+	 * reading as little as possible.
+	 *
+	 * The last line of every page, with its CRC, is read first in a
+	 * single readPageLines batch. A page is valid without reading more
+	 * if its end matches the content expected: the page in the mapping
+	 * if it is read and not modified, or its page cache entry (see
+	 * setPageCache), either with a valid CRC. The first line of pages
+	 * whose end is erased is read in a second batch, so that writes
+	 * interrupted before the end are not taken for erased pages. The
+	 * other pages are read whole, in a single readPages batch, and their
+	 * CRC is checked. Valid ones are stored in the page cache. Mappings
+	 * without line reads (see lineSize) read every page whole.
+	 *
+	 * Pages read are not added to the mapping.
+	 *
+	 * \returns one result per address, in the same order.
+	 */
+	std::vector<IntegrityResult> checkIntegrity (const std::vector<Address> &addresses);
+
+	/**
+	 * Read pages ahead of sequential accesses, up to \p max_pages
+	 * pages, 0 (the default) disabling it.
+	 *
+	 * When getReadOnlyPage or getReadOnlyRange moves to the page
+	 * following the previously accessed one, the next pages missing
+	 * from the mapping are prefetched by another thread while the caller
+	 * uses the current one. The window starts at one page and doubles
+	 * with each sequential access, it is reset by any other access. It
+	 * is bounded by the page count of the memory (see pageCount), there
+	 * is no read-ahead for mappings that do not know it.
+	 *
+	 * Failed read-ahead is ignored, the pages are read again when
+	 * accessed. Sync waits for the read-ahead in progress before
+	 * writing.
+	 */
+	void setReadAhead (unsigned int max_pages);
+
+	/**
+	 * Use \p cache for the pages of the device identified by
+	 * \p fingerprint, or stop using a cache if \p cache is null.
+	 *
+	 * A cached page is only used if its CRC is valid and its end, read
+	 * from the device with readPageEnd, is unchanged. Read-only pages
+	 * (see isReadOnly) are used without any check. Pages without a
+	 * valid CRC are not cached.
+	 */
+	void setPageCache (std::shared_ptr<PageCache> cache, const std::string &fingerprint);
+
+	/**
+	 * Record the page writes of sync and syncAsync in \p journal for the
+	 * device identified by \p fingerprint, or stop journaling if
+	 * \p journal is null.
+	 *
+	 * With a journal, pages are written one at a time and each one is
+	 * checked (as with setVerifyWrites) before it is marked completed.
+	 * A sync interrupted by an error resumes with the next sync of the
+	 * same content, even from another mapping or process: the pages
+	 * already completed are not written again. Their end is read back
+	 * to check their CRC if the mapping can (see readPageEnd),
+	 * otherwise the journal is trusted.
+	 */
+	void setSyncJournal (std::shared_ptr<SyncJournal> journal, const std::string &fingerprint);
+
+	/**
+	 * Keep the pages of the mapping under \p bytes (see memoryUsage, the
+	 * page table itself is not counted), 0 (the default) disabling the
+	 * limit.
+	 *
+	 * Eviction frees page buffers, so it only happens when \ref writeLock
+	 * is acquired (including by sync), when no reader can be using page
+	 * content: the least recently used pages are then evicted until the
+	 * budget is met. Reads, on the caller's thread or by read-ahead
+	 * (see setReadAhead), never evict. Mappings that are only read apply
+	 * the budget by taking \ref writeLock between accesses.
+	 *
+	 * Only clean pages can be evicted: modified pages, pages being read
+	 * and pinned pages (see pinPage) stay until they are synced or
+	 * unpinned, even over budget. Evicted pages are read again, from the
+	 * page cache if any, when accessed. With a budget, references and
+	 * iterators to a page that is not pinned must not be kept across
+	 * \ref writeLock.
+	 */
+	void setPageBudget (std::size_t bytes);
+	/**
+	 * Keep the page at \p address (offset is ignored) resident once it
+	 * is read, e.g. the profile directory or the active profile. Pins
+	 * are counted, each call must be matched by unpinPage.
+	 */
+	void pinPage (const Address &address);
+	void unpinPage (const Address &address);
+
+	/**
+	 * Approximate number of bytes held by the pages of the mapping,
+	 * including their snapshots and the page table.
+	 *
+	 * It is also charged to MemoryAccounting::Subsystem::MemoryMappings
+	 * while accounting is enabled.
+	 */
+	std::size_t memoryUsage ();
 
 	/**
 	 * Get a read-only iterator to the position corresponding
@@ -61,6 +353,16 @@ public:
 	 * Implementation must retrieve the page using getReadOnlyPage.
 	 */
 	virtual std::vector<uint8_t>::const_iterator getReadOnlyIterator (const Address &address) = 0;
+	/**
+	 * Get a read-only iterator to the position corresponding
+	 * to the address \p address, only the next \p length bytes
+	 * are guaranteed to be read from the device.
+	 *
+	 * Implementation should retrieve the page using getReadOnlyPageRange.
+	 * The default implementation reads the whole page with
+	 * getReadOnlyIterator.
+	 */
+	virtual std::vector<uint8_t>::const_iterator getReadOnlyRange (const Address &address, std::size_t length);
 	/**
 	 * Get a read-only iterator to the position corresponding
 	 *
@@ -79,24 +381,241 @@ public:
 	virtual bool computeOffset (std::vector<uint8_t>::const_iterator it, Address &address) = 0;
 
 protected:
+	/**
+	 * Keep the pages of memory types below \p mem_type_count and page
+	 * numbers below \p page_count in a dense table instead of a map.
+	 * Their device content and CRC snapshots of \p page_size bytes are
+	 * allocated at once, in a single arena.
+	 *
+	 * Page data is never reallocated once read, so iterators stay valid
+	 * with or without the table. Must be called before reading any page.
+	 */
+	void setPageTable (int mem_type_count, unsigned int page_count, std::size_t page_size);
+
+	/**
+	 * Get the page at \p address (offset is ignored) with at least the
+	 * bytes from \p begin to \p end read from the device.
+	 *
+	 * If the mapping can read lines (see lineSize), only the missing
+	 * lines of the range are read, the other bytes may be left
+	 * uninitialized until the whole page is needed. Otherwise, or when a
+	 * page cache is used, this is the same as getReadOnlyPage.
+	 */
+	const std::vector<uint8_t> &getReadOnlyPageRange (const Address &address, std::size_t begin, std::size_t end);
+
+	/**
+	 * Number of pages in the memory of \p address (only mem_type is
+	 * used), bounding the read-ahead (see setReadAhead).
+	 *
+	 * The default implementation returns 0 (unknown). Mappings
+	 * returning a page count must call waitReadAhead in their
+	 * destructor, as the read-ahead thread calls readPages.
+	 */
+	virtual unsigned int pageCount (const Address &address) const;
+	/**
+	 * Wait for the read-ahead in progress, if any.
+	 */
+	void waitReadAhead ();
+
 	/**
 	 * Read the page at \p address and fill data.
 	 */
 	virtual void readPage (const Address &address, std::vector<uint8_t> &data) = 0;
+	/**
+	 * Read the pages at \p addresses and fill \p data with their
+	 * content, in the same order.
+	 *
+	 * The default implementation calls readPage for each page,
+	 * mappings able to pipeline reads across pages should override it.
+	 */
+	virtual void readPages (const std::vector<Address> &addresses, std::vector<std::vector<uint8_t>> &data);
+	/**
+	 * Size of the lines that readLines can read, or 0 if pages can only
+	 * be read whole (the default).
+	 */
+	virtual std::size_t lineSize () const;
+	/**
+	 * Size of the page at \p address, only used when lineSize is not 0.
+	 */
+	virtual std::size_t pageSize (const Address &address) const;
+	/**
+	 * Read the lines of page \p address starting at the byte offsets
+	 * \p offsets in \p data, which is already of the page size.
+	 *
+	 * Only used when lineSize is not 0.
+	 */
+	virtual void readLines (const Address &address, const std::vector<std::size_t> &offsets, std::vector<uint8_t> &data);
+	/**
+	 * Read the line at each of \p addresses, possibly in different
+	 * pages, in \p data in the same order.
+	 *
+	 * Only used when lineSize is not 0. The default implementation
+	 * calls readLines for each address, mappings able to pipeline reads
+	 * across pages should override it.
+	 */
+	virtual void readPageLines (const std::vector<Address> &addresses, std::vector<std::vector<uint8_t>> &data);
 	/**
 	 * Write the data in \p data in page at \p address.
 	 */
 	virtual void writePage (const Address &address, const std::vector<uint8_t> &data) = 0;
+	/**
+	 * Write the pages at \p addresses with the content in \p data,
+	 * called once by sync for every page written whole.
+	 *
+	 * The default implementation calls writePage for each page,
+	 * mappings able to pipeline writes across pages should override it.
+	 */
+	virtual void writePages (const std::vector<Address> &addresses, const std::vector<const std::vector<uint8_t> *> &data);
+
+	/**
+	 * Write only the \p ranges of \p data in page at \p address.
+	 *
+	 * The default implementation does nothing and returns false, for
+	 * memory that can only be written a page at a time. The page is
+	 * then written with writePage.
+	 *
+	 * \returns true if the ranges were written.
+	 */
+	virtual bool writeRanges (const Address &address, const std::vector<uint8_t> &data, const std::vector<Range> &ranges);
+
+	/**
+	 * Read the end of the page at \p address, including its CRC, in
+	 * \p data.
+	 *
+	 * The default implementation returns false, cached pages are then
+	 * never used unless they are read-only.
+	 *
+	 * \returns true if \p data was read.
+	 */
+	virtual bool readPageEnd (const Address &address, std::vector<uint8_t> &data);
+	/**
+	 * Check if the page at \p address can never change, so that it can
+	 * be cached permanently.
+	 *
+	 * The default implementation returns false.
+	 */
+	virtual bool isReadOnly (const Address &address) const;
 
 private:
 	bool _write_crc;
+	bool _verify_writes;
 	struct Page {
-		bool modified;
+		bool present = false;
+		bool loading = false; // being read by a thread, without _mutex
+		bool modified = false;
+		bool overwritten = false; // device content unknown, written entirely
+		unsigned int generation = 0; // see pageGeneration
+		uint64_t last_use = 0; // _use_clock of the last access
 		std::vector<uint8_t> data;
+		// Last content read or written, and content line_crcs were
+		// computed on, both of the data size. They are in the arena
+		// for pages of the table and in snapshots for the others.
+		uint8_t *device_data = nullptr;
+		uint8_t *crc_data = nullptr;
+		bool crc_valid = false;
+		std::vector<bool> loaded; // lines of a partially read page
+		// CRC of each CRCLineSize bytes of crc_data, with a null start
+		std::vector<uint16_t> line_crcs;
+		std::vector<uint8_t> snapshots;
 	};
-	std::map<Address, Page> _pages;
+	static constexpr std::size_t CRCLineSize = 16;
+	std::map<Address, Page> _pages; // pages outside the table
+	std::vector<Page> _table; // by memory type and page, see setPageTable
+	std::vector<uint8_t> _arena;
+	unsigned int _table_page_count;
+	std::size_t _table_page_size;
+	std::shared_ptr<PageCache> _cache;
+	std::string _fingerprint;
+	std::shared_ptr<SyncJournal> _journal;
+	std::string _journal_fingerprint;
+	std::mutex _mutex; // protects the page states and the cache settings
+	std::condition_variable _loaded; // a page stopped loading
+	std::shared_mutex _content_mutex;
+	// Read-ahead state, protected by _mutex
+	unsigned int _read_ahead_max;
+	unsigned int _read_ahead_window;
+	std::optional<Address> _last_access;
+	std::future<void> _read_ahead;
+	MemoryAccounting::Account _account;
+	// Eviction state, protected by _mutex
+	std::size_t _page_budget;
+	uint64_t _use_clock;
+	std::map<Address, unsigned int> _pins;
+
+	Page *tableSlot (const Address &address);
+	Page *findPage (const Address &address);
+	Page &addPage (const Address &address);
+	void removePage (const Address &address);
+	/**
+	 * Mark \p page present with its current data, as read from the device.
+	 */
+	void initPage (const Address &address, Page &page);
+	template<typename F>
+	void forEachPage (F f);
+	static std::size_t pageBytes (const Page &page);
+	std::size_t footprint () const; // _mutex must be held
+	void updateAccount (); // _mutex must be held
+	/**
+	 * Evict least recently used pages until the budget is met,
+	 * \c _content_mutex must be held exclusively and \c _mutex held.
+	 */
+	void evictPages ();
 
 	Page &getPage (Address address);
+	/**
+	 * Record an access to \p address and start reading the next pages
+	 * if the accesses are sequential.
+	 */
+	void readAhead (Address address);
+
+	struct PageWrite
+	{
+		Address address;
+		Page *page;
+		std::vector<Range> ranges; // changed since the last read or write
+	};
+	/**
+	 * Compute the CRC and changed ranges of the modified pages,
+	 * unchanged pages are no longer modified.
+	 */
+	std::vector<PageWrite> prepareSync ();
+	/**
+	 * Skip the pages of \p writes completed by an interrupted sync
+	 * (marking them written) and record the plan in \p journal.
+	 *
+	 * \returns the pages left to write.
+	 */
+	std::vector<PageWrite> resumeSync (SyncJournal &journal, const std::string &fingerprint,
+					   std::vector<PageWrite> writes);
+	/**
+	 * Mark the page of \p write as written.
+	 */
+	void finishSync (const PageWrite &write);
+	/**
+	 * \throws VerifyError
+	 */
+	void verifyPage (const PageWrite &write);
+	/**
+	 * Bytes sent for \p write: the whole page, or only its changed
+	 * ranges for a \p partial sync.
+	 */
+	static std::size_t writtenBytes (const PageWrite &write, bool partial);
+	static std::size_t syncedBytes (const std::vector<PageWrite> &writes, bool partial);
+	/**
+	 * CRC of the page content (without the CRC itself), only the lines
+	 * changed since the last call are computed again.
+	 */
+	static uint16_t pageCRC (Page &page);
+	/**
+	 * Content of the page at \p address as last read or written, from
+	 * the mapping or the page cache, if it has a valid CRC.
+	 */
+	std::optional<std::vector<uint8_t>> expectedPage (const Address &address);
+	/**
+	 * Load the missing lines of \p page in the range, \p lock is
+	 * released while reading.
+	 */
+	void loadLines (std::unique_lock<std::mutex> &lock, const Address &address, Page &page, std::size_t begin, std::size_t end);
 };
 
 }
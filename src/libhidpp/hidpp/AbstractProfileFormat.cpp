@@ -46,3 +46,51 @@ unsigned int AbstractProfileFormat::maxModeCount () const
 	return _max_mode_count;
 }
 
+unsigned int AbstractProfileFormat::readModeCount (std::vector<uint8_t>::const_iterator begin) const
+{
+	return read (begin).modes.size ();
+}
+
+SettingMap AbstractProfileFormat::readMode (std::vector<uint8_t>::const_iterator begin, unsigned int index) const
+{
+	return read (begin).modes.at (index);
+}
+
+unsigned int AbstractProfileFormat::readButtonCount (std::vector<uint8_t>::const_iterator begin) const
+{
+	return read (begin).buttons.size ();
+}
+
+Profile::Button AbstractProfileFormat::readButton (std::vector<uint8_t>::const_iterator begin, unsigned int index) const
+{
+	return read (begin).buttons.at (index);
+}
+
+Setting AbstractProfileFormat::readSetting (std::vector<uint8_t>::const_iterator begin, const std::string &name) const
+{
+	return read (begin).settings.at (name);
+}
+
+void AbstractProfileFormat::writeMode (std::vector<uint8_t>::iterator begin, unsigned int index, const SettingMap &mode) const
+{
+	Profile profile = read (begin);
+	if (index == profile.modes.size () && index < maxModeCount ())
+		profile.modes.push_back (mode);
+	else
+		profile.modes.at (index) = mode;
+	write (profile, begin);
+}
+
+void AbstractProfileFormat::writeButton (std::vector<uint8_t>::iterator begin, unsigned int index, const Profile::Button &button) const
+{
+	Profile profile = read (begin);
+	profile.buttons.at (index) = button;
+	write (profile, begin);
+}
+
+void AbstractProfileFormat::writeSetting (std::vector<uint8_t>::iterator begin, const std::string &name, const Setting &value) const
+{
+	Profile profile = read (begin);
+	profile.settings.set (name, value);
+	write (profile, begin);
+}
@@ -77,6 +77,32 @@ public:
 	 */
 	virtual void write (const Profile &profile, std::vector<uint8_t>::iterator begin) const = 0;
 
+	/**
+	 * \name Partial access
+	 *
+	 * Read or write a part of the profile beginning at \p begin (see
+	 * ProfileView). The default implementations read the whole
+	 * profile (and write it back), formats override them to decode
+	 * and encode only the fields involved.
+	 *
+	 * \throws std::out_of_range if there is no such mode, button or
+	 * setting.
+	 *
+	 * \{
+	 */
+	virtual unsigned int readModeCount (std::vector<uint8_t>::const_iterator begin) const;
+	virtual SettingMap readMode (std::vector<uint8_t>::const_iterator begin, unsigned int index) const;
+	virtual unsigned int readButtonCount (std::vector<uint8_t>::const_iterator begin) const;
+	virtual Profile::Button readButton (std::vector<uint8_t>::const_iterator begin, unsigned int index) const;
+	virtual Setting readSetting (std::vector<uint8_t>::const_iterator begin, const std::string &name) const;
+	/**
+	 * Replace mode \p index, or add it if \p index is the mode count.
+	 */
+	virtual void writeMode (std::vector<uint8_t>::iterator begin, unsigned int index, const SettingMap &mode) const;
+	virtual void writeButton (std::vector<uint8_t>::iterator begin, unsigned int index, const Profile::Button &button) const;
+	virtual void writeSetting (std::vector<uint8_t>::iterator begin, const std::string &name, const Setting &value) const;
+	/**\}*/
+
 private:
 	size_t _size;
 	unsigned int _max_button_count;
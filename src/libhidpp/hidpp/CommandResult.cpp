@@ -0,0 +1,98 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "CommandResult.h"
+
+#include <hidpp/Dispatcher.h>
+#include <hidpp10/Error.h>
+#include <hidpp20/Error.h>
+
+using namespace HIDPP;
+
+CommandResult CommandResult::fromReport (const Report &report)
+{
+	CommandResult result;
+	uint8_t sub_id, address, feature;
+	unsigned int function, sw_id;
+	if (report.checkErrorMessage10 (&sub_id, &address, &result.error_code))
+		result.status = HIDPP10Error;
+	else if (report.checkErrorMessage20 (&feature, &function, &sw_id, &result.error_code))
+		result.status = HIDPP20Error;
+	else
+		result.status = Success;
+	result.report = report;
+	return result;
+}
+
+CommandResult CommandResult::fromCompletion (const Report *response, std::exception_ptr error)
+{
+	CommandResult result;
+	if (response) {
+		result.status = Success;
+		result.report = *response;
+		return result;
+	}
+	try {
+		std::rethrow_exception (error);
+	}
+	catch (Dispatcher::TimeoutError &) {
+		result.status = Timeout;
+	}
+	catch (HIDPP10::Error &e) {
+		result.status = HIDPP10Error;
+		result.error_code = e.errorCode ();
+	}
+	catch (HIDPP20::Error &e) {
+		result.status = HIDPP20Error;
+		result.error_code = e.errorCode ();
+	}
+	catch (...) {
+		result.exception = error;
+	}
+	return result;
+}
+
+std::exception_ptr CommandResult::error () const
+{
+	switch (status) {
+	case Success:
+		return nullptr;
+	case Timeout:
+		return std::make_exception_ptr (Dispatcher::TimeoutError ());
+	case HIDPP10Error:
+		return std::make_exception_ptr (HIDPP10::Error (error_code));
+	case HIDPP20Error: {
+		std::vector<uint8_t> error_data;
+		if (report) {
+			uint8_t feature, code;
+			unsigned int function, sw_id;
+			report->checkErrorMessage20 (&feature, &function, &sw_id, &code, &error_data);
+		}
+		return std::make_exception_ptr (HIDPP20::Error (error_code, std::move (error_data)));
+	}
+	case Failed:
+	default:
+		return exception;
+	}
+}
+
+void CommandResult::check () const
+{
+	if (status != Success)
+		std::rethrow_exception (error ());
+}
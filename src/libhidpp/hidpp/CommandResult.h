@@ -0,0 +1,83 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_COMMAND_RESULT_H
+#define LIBHIDPP_HIDPP_COMMAND_RESULT_H
+
+#include <hidpp/Report.h>
+
+#include <exception>
+#include <optional>
+
+namespace HIDPP
+{
+
+/**
+ * Outcome of a command, for code where failures are expected (probing,
+ * polling sleeping devices, looking up optional features) and should
+ * not cost an exception.
+ *
+ * \see Dispatcher::trySendCommand
+ */
+struct CommandResult
+{
+	enum Status
+	{
+		Success,
+		Timeout,
+		HIDPP10Error, ///< \ref report is the HID++ 1.0 error message
+		HIDPP20Error, ///< \ref report is the HID++ 2.0 error message
+		Failed, ///< other errors, see \ref exception
+	} status = Failed;
+	/**
+	 * The answer, or the error message for HID++ errors.
+	 */
+	std::optional<Report> report;
+	uint8_t error_code = 0; ///< for HID++ errors
+	std::exception_ptr exception; ///< only set when Failed
+
+	explicit operator bool () const noexcept { return status == Success; }
+
+	/**
+	 * Classify a report received for a command: an answer or an error
+	 * message.
+	 */
+	static CommandResult fromReport (const Report &report);
+	/**
+	 * Classify the arguments of a Dispatcher::completion_handler.
+	 *
+	 * This rethrows \p error to find its type, it is only meant for
+	 * dispatchers without a native non-throwing path.
+	 */
+	static CommandResult fromCompletion (const Report *response, std::exception_ptr error);
+
+	/**
+	 * The exception the throwing API would have raised (Dispatcher::TimeoutError,
+	 * HIDPP10::Error or HIDPP20::Error), built without throwing it.
+	 * Null on success.
+	 */
+	std::exception_ptr error () const;
+	/**
+	 * Throw \ref error if the command failed.
+	 */
+	void check () const;
+};
+
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "CommitScheduler.h"
+
+#include <misc/Log.h>
+
+#include <algorithm>
+
+using namespace HIDPP;
+
+CommitScheduler::CommitScheduler (AbstractMemoryMapping &mapping,
+				  clock::duration debounce,
+				  clock::duration min_interval,
+				  clock::duration max_delay):
+	_mapping (mapping),
+	_debounce (debounce),
+	_min_interval (min_interval),
+	_max_delay (max_delay),
+	_last_sync (clock::time_point::min ()),
+	_syncing (false),
+	_stopping (false)
+{
+	_thread = std::thread (&CommitScheduler::run, this);
+}
+
+CommitScheduler::~CommitScheduler ()
+{
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_stopping = true;
+	}
+	_cond.notify_all ();
+	_thread.join ();
+}
+
+void CommitScheduler::setErrorHandler (error_handler handler)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_handler = std::move (handler);
+}
+
+void CommitScheduler::touch ()
+{
+	auto now = clock::now ();
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (!_first_touch)
+		_first_touch = now;
+	_last_touch = now;
+	++_stats.touches;
+	lock.unlock ();
+	_cond.notify_all ();
+}
+
+void CommitScheduler::flush ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_cond.wait (lock, [this] () { return !_syncing; });
+	commit (lock, false);
+}
+
+bool CommitScheduler::pending () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _first_touch.has_value ();
+}
+
+CommitScheduler::Statistics CommitScheduler::statistics () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _stats;
+}
+
+void CommitScheduler::run ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	while (!_stopping) {
+		if (!_first_touch || _syncing) {
+			_cond.wait (lock);
+			continue;
+		}
+		auto due = std::min (*_last_touch + _debounce, *_first_touch + _max_delay);
+		if (_last_sync != clock::time_point::min ())
+			due = std::max (due, _last_sync + _min_interval);
+		if (clock::now () < due) {
+			_cond.wait_until (lock, due);
+			continue;
+		}
+		commit (lock, true);
+	}
+}
+
+void CommitScheduler::commit (std::unique_lock<std::mutex> &lock, bool background)
+{
+	// Changes touched from now on are part of the next batch
+	_first_touch.reset ();
+	_last_touch.reset ();
+	_syncing = true;
+	lock.unlock ();
+	std::exception_ptr error;
+	try {
+		auto write_lock = _mapping.writeLock ();
+		_mapping.sync ();
+	}
+	catch (...) {
+		error = std::current_exception ();
+	}
+	lock.lock ();
+	_syncing = false;
+	_last_sync = clock::now ();
+	++_stats.syncs;
+	if (error)
+		++_stats.failed_syncs;
+	auto handler = _handler;
+	_cond.notify_all ();
+	if (!error)
+		return;
+	if (!background)
+		std::rethrow_exception (error);
+	lock.unlock ();
+	if (handler)
+		handler (error);
+	else {
+		try {
+			std::rethrow_exception (error);
+		}
+		catch (std::exception &e) {
+			Log::error () << "Failed to commit memory changes: " << e.what () << std::endl;
+		}
+	}
+	lock.lock ();
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_COMMIT_SCHEDULER_H
+#define LIBHIDPP_HIDPP_COMMIT_SCHEDULER_H
+
+#include <hidpp/AbstractMemoryMapping.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace HIDPP
+{
+
+/**
+ * Debounced and throttled sync of a memory mapping, for editors
+ * changing profiles interactively.
+ *
+ * Instead of calling AbstractMemoryMapping::sync after every change,
+ * callers modify the pages (holding \ref AbstractMemoryMapping::writeLock)
+ * and call \ref touch. The mapping is synced by a background thread
+ * once no change was touched for the debounce window, or at the latest
+ * after the maximum delay from the first change of the batch. All the
+ * changes of a batch are written by a single partial sync, so changes
+ * that cancel out write nothing. Background syncs are never started
+ * sooner than the minimum interval after the previous one ended, to
+ * limit flash wear. Use one scheduler per device memory.
+ *
+ * \ref flush syncs immediately, e.g. before closing the editor.
+ */
+class CommitScheduler
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	/**
+	 * Called from the scheduler thread when a background sync fails.
+	 * The changes that were not written stay modified in the mapping
+	 * and are written by the next sync.
+	 */
+	typedef std::function<void (std::exception_ptr error)> error_handler;
+
+	struct Statistics
+	{
+		uint64_t touches = 0;
+		uint64_t syncs = 0; ///< background syncs and flushes
+		uint64_t failed_syncs = 0;
+	};
+
+	/**
+	 * \p mapping must outlive the scheduler.
+	 *
+	 * \param debounce	Time without changes before syncing.
+	 * \param min_interval	Minimum time between the end of a sync and
+	 *			the start of a background sync.
+	 * \param max_delay	Maximum time from the first change of a
+	 *			batch before syncing, even if changes
+	 *			keep coming.
+	 */
+	CommitScheduler (AbstractMemoryMapping &mapping,
+			 clock::duration debounce = std::chrono::milliseconds (500),
+			 clock::duration min_interval = std::chrono::seconds (2),
+			 clock::duration max_delay = std::chrono::seconds (5));
+	/**
+	 * Stop the thread, changes not synced yet are left modified in
+	 * the mapping (call \ref flush first to write them).
+	 */
+	~CommitScheduler ();
+
+	CommitScheduler (const CommitScheduler &) = delete;
+	CommitScheduler &operator= (const CommitScheduler &) = delete;
+
+	void setErrorHandler (error_handler handler);
+
+	/**
+	 * Tell that pages of the mapping were modified.
+	 *
+	 * The caller must not hold the write lock for long after touching:
+	 * the background sync takes it.
+	 */
+	void touch ();
+
+	/**
+	 * Sync the mapping now, waiting for a background sync in progress.
+	 *
+	 * The caller must not hold the mapping write lock.
+	 *
+	 * \throws the error of the sync.
+	 */
+	void flush ();
+
+	/**
+	 * Check if touched changes are waiting for a sync.
+	 */
+	bool pending () const;
+
+	Statistics statistics () const;
+
+private:
+	void run ();
+	// Sync with _mutex unlocked during the sync.
+	void commit (std::unique_lock<std::mutex> &lock, bool background);
+
+	AbstractMemoryMapping &_mapping;
+	const clock::duration _debounce, _min_interval, _max_delay;
+	mutable std::mutex _mutex;
+	std::condition_variable _cond;
+	std::optional<clock::time_point> _first_touch, _last_touch;
+	clock::time_point _last_sync;
+	bool _syncing;
+	bool _stopping;
+	Statistics _stats;
+	error_handler _handler;
+	std::thread _thread;
+};
+
+}
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_COROUTINE_H
+#define LIBHIDPP_HIDPP_COROUTINE_H
+
+/**
+ * \file
+ * C++20 awaitables for dispatcher commands and notifications.
+ *
+ * The library itself is built as C++17, this header is only usable from
+ * code compiled with coroutine support and is otherwise empty.
+ *
+ * Coroutines are resumed from the thread completing the command, that is
+ * the dispatcher thread for DispatcherThread and DispatcherReactor. They
+ * must not block on that thread (e.g. with AsyncReport::get).
+ */
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+
+#include <hidpp/Dispatcher.h>
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace HIDPP
+{
+
+/**
+ * Awaitable sending a command and resuming with its answer.
+ *
+ * \see call
+ */
+class CommandAwaiter
+{
+public:
+	CommandAwaiter (Dispatcher *dispatcher, Report &&request, int timeout = -1):
+		_dispatcher (dispatcher), _request (std::move (request)), _timeout (timeout)
+	{
+	}
+
+	bool await_ready () const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend (std::coroutine_handle<> coroutine)
+	{
+		// The coroutine may be resumed (and this awaiter destroyed)
+		// before sendCommand returns, do not use members after.
+		_dispatcher->sendCommand (std::move (_request), [this, coroutine] (const Report *response, std::exception_ptr error) {
+			if (response)
+				_response.emplace (*response);
+			else
+				_error = error;
+			coroutine.resume ();
+		}, _timeout);
+	}
+
+	Report await_resume ()
+	{
+		if (_error)
+			std::rethrow_exception (_error);
+		return std::move (*_response);
+	}
+
+private:
+	Dispatcher *_dispatcher;
+	Report _request;
+	int _timeout;
+	std::optional<Report> _response;
+	std::exception_ptr _error;
+};
+
+/**
+ * Awaitable resuming with the next notification matching a device index
+ * and sub ID.
+ *
+ * \see nextNotification
+ */
+class NotificationAwaiter
+{
+public:
+	NotificationAwaiter (Dispatcher *dispatcher, DeviceIndex index, uint8_t sub_id):
+		_dispatcher (dispatcher), _index (index), _sub_id (sub_id),
+		_state (std::make_shared<State> ())
+	{
+	}
+
+	/**
+	 * Unregister the handler if the coroutine is destroyed before the
+	 * notification is received.
+	 */
+	~NotificationAwaiter ()
+	{
+		Dispatcher::listener_iterator listener;
+		{
+			std::unique_lock<std::mutex> lock (_state->mutex);
+			listener = std::move (_state->listener);
+		}
+		if (listener)
+			_dispatcher->unregisterEventHandler (listener);
+	}
+
+	NotificationAwaiter (const NotificationAwaiter &) = delete;
+	NotificationAwaiter &operator= (const NotificationAwaiter &) = delete;
+
+	bool await_ready () const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend (std::coroutine_handle<> coroutine)
+	{
+		// The handler only uses the shared state: the coroutine may be
+		// resumed (and this awaiter destroyed) before
+		// registerEventHandler returns.
+		auto state = _state;
+		auto listener = _dispatcher->registerEventHandler (_index, _sub_id, [state, coroutine] (const Report &report) {
+			{
+				std::unique_lock<std::mutex> lock (state->mutex);
+				state->notification.emplace (report);
+			}
+			coroutine.resume ();
+			return false;
+		});
+		// Once notified, the listener is already removed and keeping
+		// it would make a reference cycle with the state.
+		std::unique_lock<std::mutex> lock (state->mutex);
+		if (!state->notification)
+			state->listener = std::move (listener);
+	}
+
+	Report await_resume ()
+	{
+		return std::move (*_state->notification);
+	}
+
+private:
+	struct State
+	{
+		std::mutex mutex; // protects listener and notification
+		Dispatcher::listener_iterator listener;
+		std::optional<Report> notification;
+	};
+
+	Dispatcher *_dispatcher;
+	DeviceIndex _index;
+	uint8_t _sub_id;
+	std::shared_ptr<State> _state;
+};
+
+/**
+ * Send \p request and resume the awaiting coroutine with the answer.
+ *
+ * \throws HIDPP10::Error, HIDPP20::Error, Dispatcher::TimeoutError,
+ * std::system_error from the co_await expression.
+ */
+inline CommandAwaiter call (Dispatcher &dispatcher, Report &&request, int timeout = -1)
+{
+	return CommandAwaiter (&dispatcher, std::move (request), timeout);
+}
+
+/**
+ * Resume the awaiting coroutine when a notification matching \p index and
+ * \p sub_id is received.
+ */
+inline NotificationAwaiter nextNotification (Dispatcher &dispatcher, DeviceIndex index, uint8_t sub_id)
+{
+	return NotificationAwaiter (&dispatcher, index, sub_id);
+}
+
+}
+
+#endif
+
+#endif
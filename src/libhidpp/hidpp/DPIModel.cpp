@@ -0,0 +1,197 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DPIModel.h"
+
+#include <hidpp10/defs.h>
+#include <hidpp10/Device.h>
+#include <hidpp10/DeviceInfo.h>
+#include <hidpp10/Sensor.h>
+#include <hidpp20/IOnboardProfiles.h>
+#include <hidpp20/UnsupportedFeature.h>
+
+#include <stdexcept>
+
+using namespace HIDPP;
+
+DPIModel::DPIModel (HIDPP20::Device *dev):
+	_dev (dev)
+{
+	_iadjustabledpi.emplace (dev);
+	unsigned int count = _iadjustabledpi->getSensorCount ();
+	for (unsigned int i = 0; i < count; ++i) {
+		SensorInfo info = { {}, 0 };
+		if (!_iadjustabledpi->getSensorDPIList (i, info.dpi_list, info.dpi_step))
+			info.dpi_step = 0;
+		_sensors.push_back (std::move (info));
+	}
+	_current.resize (count);
+	try {
+		// The DPI follows the current profile and DPI index
+		_onboard_profiles_index = HIDPP20::IOnboardProfiles (dev).index ();
+		listen (*_onboard_profiles_index);
+	}
+	catch (HIDPP20::UnsupportedFeature &) {
+	}
+	listen (HIDPP10::DeviceConnection);
+}
+
+DPIModel::DPIModel (HIDPP10::Device *dev):
+	_dev (dev)
+{
+	const HIDPP10::MouseInfo *info = HIDPP10::getMouseInfo (dev->productID ());
+	if (!info)
+		throw std::runtime_error ("Unsupported mouse");
+	switch (info->iresolution_type) {
+	case HIDPP10::IResolutionType0:
+		_iresolution0.emplace (dev, info->sensor);
+		break;
+	case HIDPP10::IResolutionType3:
+		_iresolution3.emplace (dev, info->sensor);
+		break;
+	default:
+		throw std::runtime_error ("Unsupported resolution type");
+	}
+	SensorInfo sensor = { {}, 0 };
+	const HIDPP10::ListSensor *list;
+	const HIDPP10::RangeSensor *range;
+	if ((list = dynamic_cast<const HIDPP10::ListSensor *> (info->sensor)) != nullptr) {
+		sensor.dpi_list.assign (list->begin (), list->end ());
+	}
+	else if ((range = dynamic_cast<const HIDPP10::RangeSensor *> (info->sensor)) != nullptr) {
+		sensor.dpi_list = { range->minimumResolution (), range->maximumResolution () };
+		sensor.dpi_step = range->resolutionStepHint ();
+	}
+	_sensors.push_back (std::move (sensor));
+	_current.resize (1);
+	listen (HIDPP10::DeviceConnection);
+}
+
+DPIModel::~DPIModel ()
+{
+	for (auto &it: _listeners)
+		_dev->dispatcher ()->unregisterEventHandler (it);
+}
+
+bool DPIModel::separatedAxes () const
+{
+	return _iresolution3.has_value ();
+}
+
+unsigned int DPIModel::sensorCount () const
+{
+	return _sensors.size ();
+}
+
+const DPIModel::SensorInfo &DPIModel::sensor (unsigned int index) const
+{
+	return _sensors.at (index);
+}
+
+std::tuple<unsigned int, unsigned int> DPIModel::currentDPI (unsigned int sensor)
+{
+	unsigned int changes;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		const auto &current = _current.at (sensor);
+		if (current.known)
+			return std::make_tuple (current.x_dpi, current.y_dpi);
+		changes = current.changes;
+	}
+	// Query without the lock held, the value is only stored if no
+	// event changed it meanwhile.
+	unsigned int x_dpi, y_dpi;
+	if (_iadjustabledpi)
+		std::tie (x_dpi, std::ignore) = _iadjustabledpi->getSensorDPI (sensor);
+	else if (_iresolution0)
+		x_dpi = _iresolution0->getCurrentResolution ();
+	else
+		_iresolution3->getCurrentResolution (x_dpi, y_dpi);
+	if (!separatedAxes ())
+		y_dpi = x_dpi;
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto &current = _current[sensor];
+	if (current.changes == changes) {
+		current.x_dpi = x_dpi;
+		current.y_dpi = y_dpi;
+		current.known = true;
+	}
+	return std::make_tuple (x_dpi, y_dpi);
+}
+
+void DPIModel::setDPI (unsigned int sensor, unsigned int x_dpi, unsigned int y_dpi)
+{
+	if (sensor >= _current.size ())
+		throw std::out_of_range ("Invalid sensor index");
+	if (!separatedAxes ())
+		y_dpi = x_dpi;
+	if (_iadjustabledpi)
+		_iadjustabledpi->setSensorDPI (sensor, x_dpi);
+	else if (_iresolution0)
+		_iresolution0->setCurrentResolution (x_dpi);
+	else
+		_iresolution3->setCurrentResolution (x_dpi, y_dpi);
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto &current = _current[sensor];
+	current.x_dpi = x_dpi;
+	current.y_dpi = y_dpi;
+	changed (sensor, true);
+}
+
+void DPIModel::invalidate ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	for (unsigned int i = 0; i < _current.size (); ++i)
+		changed (i, false);
+}
+
+void DPIModel::listen (uint8_t sub_id)
+{
+	auto index = _dev->deviceIndex ();
+	if (sub_id == HIDPP10::DeviceConnection &&
+			!(index >= HIDPP::WirelessDevice1 && index <= HIDPP::WirelessDevice6))
+		return;
+	_listeners.push_back (_dev->dispatcher ()->registerEventHandler (index, sub_id,
+		[this] (const HIDPP::Report &report) {
+			return event (report);
+		}));
+}
+
+bool DPIModel::event (const HIDPP::Report &report)
+{
+	if (report.subID () == HIDPP10::DeviceConnection) {
+		if (!(report.parameterBegin ()[0] & 0x40)) // link established
+			invalidate ();
+	}
+	else if (_onboard_profiles_index && report.featureIndex () == *_onboard_profiles_index) {
+		switch (report.function ()) {
+		case HIDPP20::IOnboardProfiles::CurrentProfileChanged:
+		case HIDPP20::IOnboardProfiles::CurrentDPIIndexChanged:
+			invalidate ();
+			break;
+		}
+	}
+	return true;
+}
+
+void DPIModel::changed (unsigned int sensor, bool known)
+{
+	auto &current = _current[sensor];
+	++current.changes;
+	current.known = known;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_DPI_MODEL_H
+#define LIBHIDPP_HIDPP_DPI_MODEL_H
+
+#include <hidpp/Dispatcher.h>
+#include <hidpp10/IResolution.h>
+#include <hidpp20/IAdjustableDPI.h>
+
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+namespace HIDPP10 { class Device; }
+
+namespace HIDPP
+{
+
+/**
+ * Sensors and current resolution of a mouse, for both HID++ 1.0
+ * (HIDPP10::IResolution0 or HIDPP10::IResolution3 with the sensor from
+ * HIDPP10::getMouseInfo) and HID++ 2.0 (HIDPP20::IAdjustableDPI).
+ *
+ * The sensor list and their supported resolutions are read once, when
+ * the model is built. The current resolution of each sensor is read
+ * when first accessed, then kept from the model writes, so that
+ * changing the resolution is a single write. It is read again after a
+ * wireless device reconnects or, for HID++ 2.0, after an on-board
+ * profile or DPI index change event.
+ *
+ * Accessors may be called from any thread except the dispatcher reading
+ * thread (they may need to query the device).
+ */
+class DPIModel
+{
+public:
+	struct SensorInfo
+	{
+		/**
+		 * Supported resolutions, or minimum and maximum if
+		 * \ref dpi_step is not zero.
+		 */
+		std::vector<unsigned int> dpi_list;
+		unsigned int dpi_step;
+	};
+
+	/**
+	 * Model a HID++ 2.0 device, \p dev must outlive the model.
+	 *
+	 * \throws HIDPP20::UnsupportedFeature if the device has no
+	 * adjustable DPI feature.
+	 */
+	DPIModel (HIDPP20::Device *dev);
+	/**
+	 * Model a HID++ 1.0 device, \p dev must outlive the model.
+	 *
+	 * \throws std::runtime_error if the mouse is not known.
+	 */
+	DPIModel (HIDPP10::Device *dev);
+	~DPIModel ();
+
+	DPIModel (const DPIModel &) = delete;
+	DPIModel &operator= (const DPIModel &) = delete;
+
+	/**
+	 * \returns true if X and Y resolutions can be different.
+	 */
+	bool separatedAxes () const;
+	unsigned int sensorCount () const;
+	const SensorInfo &sensor (unsigned int index) const;
+
+	/**
+	 * \returns the X and Y resolutions of \p sensor (the same value
+	 * twice if axes are not separated).
+	 */
+	std::tuple<unsigned int, unsigned int> currentDPI (unsigned int sensor);
+	/**
+	 * Set the resolution of \p sensor, \p y_dpi is ignored if axes are
+	 * not separated.
+	 */
+	void setDPI (unsigned int sensor, unsigned int x_dpi, unsigned int y_dpi);
+
+	/**
+	 * Read current resolutions again on next access.
+	 */
+	void invalidate ();
+
+private:
+	void listen (uint8_t sub_id);
+	bool event (const HIDPP::Report &report);
+	// Called with _mutex locked
+	void changed (unsigned int sensor, bool known);
+
+	HIDPP::Device *_dev;
+	std::optional<HIDPP20::IAdjustableDPI> _iadjustabledpi;
+	std::optional<HIDPP10::IResolution0> _iresolution0;
+	std::optional<HIDPP10::IResolution3> _iresolution3;
+	std::optional<uint8_t> _onboard_profiles_index;
+	std::vector<SensorInfo> _sensors;
+	std::vector<HIDPP::Dispatcher::listener_iterator> _listeners;
+
+	struct Current
+	{
+		bool known = false;
+		// Changes are counted so that reads racing with events cannot
+		// overwrite the newer value.
+		unsigned int changes = 0;
+		unsigned int x_dpi, y_dpi;
+	};
+	std::mutex _mutex;
+	std::vector<Current> _current;
+};
+
+}
+
+#endif
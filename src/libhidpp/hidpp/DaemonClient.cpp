@@ -0,0 +1,282 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DaemonClient.h"
+
+#include <hidpp/DaemonProtocol.h>
+#include <hidpp/Dispatcher.h>
+#include <hidpp/EventRing.h>
+#include <hidpp/SimulatedReceiver.h>
+#include <misc/Endian.h>
+#include <misc/Log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+extern "C" {
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+}
+
+using namespace HIDPP;
+
+std::string DaemonProtocol::defaultSocketPath ()
+{
+	if (const char *path = getenv ("HIDPPD_SOCKET"))
+		return path;
+	const char *dir = getenv ("XDG_RUNTIME_DIR");
+	return std::string (dir ? dir : "/tmp") + "/hidppd.sock";
+}
+
+// Consume the value of an eventfd
+static void clearEventFD (int fd)
+{
+	uint64_t value;
+	if (-1 == read (fd, &value, sizeof (value)) && errno != EAGAIN)
+		throw std::system_error (errno, std::system_category (), "read eventfd");
+}
+
+// Wait for any of fds to be readable
+static void waitReadable (pollfd *fds, std::size_t count, int timeout)
+{
+	int ret;
+	do {
+		ret = poll (fds, count, timeout);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+		throw std::system_error (errno, std::system_category (), "poll");
+}
+
+// Receive a message and the fds passed with it
+static std::size_t receive (int fd, uint8_t *message, std::size_t length, std::vector<int> &fds)
+{
+	union {
+		cmsghdr header;
+		char buffer[CMSG_SPACE (2*sizeof (int))];
+	} control;
+	iovec iov = { message, length };
+	msghdr msg;
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof (control.buffer);
+	int ret = recvmsg (fd, &msg, MSG_CMSG_CLOEXEC);
+	if (ret == -1)
+		throw std::system_error (errno, std::system_category (), "recvmsg");
+	for (cmsghdr *cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		std::size_t count = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+		for (std::size_t i = 0; i < count; ++i) {
+			int received;
+			memcpy (&received, CMSG_DATA (cmsg) + i*sizeof (int), sizeof (int));
+			fds.push_back (received);
+		}
+	}
+	return ret;
+}
+
+DaemonClient::DaemonClient (const std::string &socket_path, const std::string &device_path,
+			    bool shared_events):
+	_fd (-1), _interrupt_fd (-1), _event_fd (-1), _lost_events (0)
+{
+	sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size () >= sizeof (addr.sun_path))
+		throw std::system_error (ENAMETOOLONG, std::system_category (), "daemon socket path");
+	strcpy (addr.sun_path, socket_path.c_str ());
+
+	std::vector<uint8_t> message;
+	message.push_back (DaemonProtocol::Open);
+	message.push_back (DaemonProtocol::Version);
+	message.push_back (shared_events ? DaemonProtocol::SharedEvents : 0);
+	message.insert (message.end (), device_path.begin (), device_path.end ());
+	if (message.size () > DaemonProtocol::MaxMessageSize)
+		throw std::system_error (ENAMETOOLONG, std::system_category (), "device path");
+
+	_fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (_fd == -1)
+		throw std::system_error (errno, std::system_category (), "socket");
+	try {
+		if (-1 == connect (_fd, reinterpret_cast<sockaddr *> (&addr), sizeof (addr)))
+			throw std::system_error (errno, std::system_category (), "connect to hidppd");
+		if (-1 == send (_fd, message.data (), message.size (), MSG_NOSIGNAL))
+			throw std::system_error (errno, std::system_category (), "send");
+		// Opening a device may need a few round trips in the daemon
+		pollfd fds[] = { { _fd, POLLIN, 0 } };
+		waitReadable (fds, 1, 5000);
+		if (!fds[0].revents)
+			throw std::system_error (ETIMEDOUT, std::system_category (), "hidppd");
+		message.resize (DaemonProtocol::MaxMessageSize);
+		std::vector<int> received_fds;
+		message.resize (receive (_fd, message.data (), message.size (), received_fds));
+		if (received_fds.size () == 2) {
+			_event_fd = received_fds[1];
+			_events = std::make_unique<EventRing> (EventRing::attach (received_fds[0]));
+		}
+		else
+			for (int fd: received_fds)
+				close (fd);
+		if (message.size () >= 5 && message[0] == DaemonProtocol::Failed) {
+			int err = readLE<int32_t> (message, 1);
+			std::string what (message.begin () + 5, message.end ());
+			throw std::system_error (err, std::system_category (), what);
+		}
+		if (message.size () < 6 || message[0] != DaemonProtocol::Opened)
+			throw std::system_error (EPROTO, std::system_category (), "hidppd");
+		_vendor_id = readLE<uint16_t> (message, 1);
+		_product_id = readLE<uint16_t> (message, 3);
+		_report_flags = message[5];
+		_name.assign (message.begin () + 6, message.end ());
+
+		_interrupt_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+		if (_interrupt_fd == -1)
+			throw std::system_error (errno, std::system_category (), "eventfd");
+	}
+	catch (...) {
+		if (_event_fd != -1)
+			close (_event_fd);
+		close (_fd);
+		throw;
+	}
+}
+
+DaemonClient::~DaemonClient ()
+{
+	if (_event_fd != -1)
+		close (_event_fd);
+	close (_interrupt_fd);
+	close (_fd);
+}
+
+void DaemonClient::registerScheme (const std::string &socket_path)
+{
+	HID::VirtualDevice::registerScheme ("hidppd", [socket_path] (const std::string &args) {
+		return std::make_shared<DaemonClient> (
+				socket_path.empty () ? DaemonProtocol::defaultSocketPath () : socket_path,
+				args);
+	});
+}
+
+static const bool hidppd_scheme_registered = (DaemonClient::registerScheme (), true);
+
+uint16_t DaemonClient::vendorID () const
+{
+	return _vendor_id;
+}
+
+uint16_t DaemonClient::productID () const
+{
+	return _product_id;
+}
+
+std::string DaemonClient::name () const
+{
+	return _name;
+}
+
+HID::ReportDescriptor DaemonClient::reportDescriptor () const
+{
+	// The dispatcher only looks for the HID++ collections
+	std::vector<Report::Type> types;
+	if (_report_flags & Dispatcher::ReportInfo::HasShortReport)
+		types.push_back (Report::Short);
+	if (_report_flags & Dispatcher::ReportInfo::HasLongReport)
+		types.push_back (Report::Long);
+	if (_report_flags & Dispatcher::ReportInfo::HasVeryLongReport)
+		types.push_back (Report::VeryLong);
+	return SimulatedReceiver::hidppReportDescriptor (types);
+}
+
+int DaemonClient::writeReport (const uint8_t *report, std::size_t length)
+{
+	uint8_t message[DaemonProtocol::MaxMessageSize];
+	length = std::min (length, sizeof (message) - 1);
+	message[0] = DaemonProtocol::Report;
+	std::copy_n (report, length, &message[1]);
+	if (-1 == send (_fd, message, length + 1, MSG_NOSIGNAL))
+		throw std::system_error (errno, std::system_category (), "send");
+	return length;
+}
+
+int DaemonClient::readReport (uint8_t *report, std::size_t length, int timeout)
+{
+	uint8_t message[DaemonProtocol::MaxMessageSize];
+	auto deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeout);
+	while (true) {
+		if (_events) {
+			// The eventfd is cleared before popping, so that no wake up is missed
+			uint64_t lost = _lost_events;
+			std::size_t ret = _events->pop (report, length, &_lost_events);
+			if (_lost_events != lost)
+				Log::warning ().printf ("Lost %lu events from hidppd\n",
+							(unsigned long) (_lost_events - lost));
+			if (ret > 0)
+				return ret;
+		}
+		int remaining = timeout;
+		if (timeout > 0)
+			remaining = std::max (0, static_cast<int> (std::chrono::ceil<std::chrono::milliseconds> (
+					deadline - std::chrono::steady_clock::now ()).count ()));
+		pollfd fds[3] = {
+			{ _fd, POLLIN, 0 },
+			{ _interrupt_fd, POLLIN, 0 },
+			{ _event_fd, POLLIN, 0 },
+		};
+		waitReadable (fds, _events ? 3 : 2, remaining);
+		if (_events && fds[2].revents) {
+			clearEventFD (_event_fd);
+			continue;
+		}
+		if (fds[1].revents) {
+			clearEventFD (_interrupt_fd);
+			return 0;
+		}
+		if (!fds[0].revents)
+			return 0; // timed out
+		int ret = recv (_fd, message, sizeof (message), MSG_DONTWAIT);
+		if (ret == -1) {
+			if (errno == EAGAIN)
+				continue;
+			throw std::system_error (errno, std::system_category (), "recv");
+		}
+		if (ret == 0)
+			throw std::system_error (ENODEV, std::system_category (), "hidppd closed the connection");
+		if (message[0] != DaemonProtocol::Report)
+			continue;
+		length = std::min (length, static_cast<std::size_t> (ret - 1));
+		std::copy_n (&message[1], length, report);
+		return length;
+	}
+}
+
+void DaemonClient::interruptRead ()
+{
+	uint64_t value = 1;
+	if (-1 == write (_interrupt_fd, &value, sizeof (value)))
+		throw std::system_error (errno, std::system_category (), "write eventfd");
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_DAEMON_CLIENT_H
+#define LIBHIDPP_HIDPP_DAEMON_CLIENT_H
+
+#include <hid/VirtualDevice.h>
+
+#include <memory>
+#include <string>
+
+namespace HIDPP
+{
+
+class EventRing;
+
+/**
+ * Device opened through the hidppd daemon, which keeps the real device
+ * open and answers static requests (feature indices, protocol version,
+ * receiver pairing information) from its cache.
+ *
+ * The "hidppd" scheme is registered when libhidpp is loaded, with
+ * paths like "hidppd:/dev/hidraw0" using the default socket (see
+ * DaemonProtocol::defaultSocketPath). \ref registerScheme can change
+ * the socket, and HID::VirtualDevice::setDefaultScheme can make every
+ * plain path go through the daemon.
+ *
+ * Only implemented on Linux.
+ */
+class DaemonClient: public HID::VirtualDevice
+{
+public:
+	/**
+	 * Connect to the daemon listening on \p socket_path and open
+	 * \p device_path.
+	 *
+	 * With \p shared_events, events are read from a shared memory
+	 * ring (see EventRing) instead of the socket. Only answers go
+	 * through the socket then, and the daemon does not copy the
+	 * events in a socket buffer for every client.
+	 *
+	 * \throws std::system_error if the daemon cannot be reached or
+	 * could not open the device.
+	 */
+	DaemonClient (const std::string &socket_path, const std::string &device_path,
+		      bool shared_events = true);
+	virtual ~DaemonClient ();
+
+	/**
+	 * Register the "hidppd" virtual device scheme connecting to
+	 * \p socket_path (the default socket if empty).
+	 */
+	static void registerScheme (const std::string &socket_path = {});
+
+	virtual uint16_t vendorID () const;
+	virtual uint16_t productID () const;
+	virtual std::string name () const;
+	virtual HID::ReportDescriptor reportDescriptor () const;
+	virtual int writeReport (const uint8_t *report, std::size_t length);
+	/**
+	 * \throws std::system_error if the daemon closed the connection.
+	 */
+	virtual int readReport (uint8_t *report, std::size_t length, int timeout);
+	virtual void interruptRead ();
+
+private:
+	int _fd;
+	int _interrupt_fd;
+	std::unique_ptr<EventRing> _events;
+	int _event_fd;
+	uint64_t _lost_events;
+	uint16_t _vendor_id, _product_id;
+	int _report_flags;
+	std::string _name;
+};
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_DAEMON_PROTOCOL_H
+#define LIBHIDPP_HIDPP_DAEMON_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace HIDPP
+{
+
+/**
+ * Protocol between the hidppd daemon and its clients (see DaemonClient).
+ *
+ * Clients connect to a Unix SOCK_SEQPACKET socket, one connection per
+ * opened device. Each packet is a message starting with its type.
+ *
+ * The client sends \ref Open and the daemon answers \ref Opened or
+ * \ref Failed. Then both send \ref Report messages: the client its
+ * commands, the daemon their answers (or errors) and the events of
+ * the device.
+ *
+ * With \ref SharedEvents, events are written in a shared memory
+ * EventRing instead, and an eventfd is signaled after each event.
+ *
+ * A new daemon replacing the running one sends \ref Handoff instead of
+ * \ref Open.
+ */
+namespace DaemonProtocol
+{
+	constexpr uint8_t Version = 2;
+	constexpr std::size_t MaxMessageSize = 512;
+
+	enum MessageType: uint8_t {
+		/**
+		 * Client: protocol version, open flags, then the device
+		 * path.
+		 */
+		Open = 1,
+		/**
+		 * Daemon: vendor and product IDs (16 bits, little endian),
+		 * report flags (see Dispatcher::ReportInfo), then the
+		 * device name.
+		 *
+		 * With \ref SharedEvents, the ring memfd and the eventfd
+		 * are passed with the message (SCM_RIGHTS).
+		 */
+		Opened = 2,
+		/**
+		 * Daemon: errno value (32 bits, little endian), then an
+		 * error message. The daemon closes the connection.
+		 */
+		Failed = 3,
+		/**
+		 * Both: a raw HID++ report.
+		 */
+		Report = 4,
+		/**
+		 * Client: protocol version. Only accepted from a process
+		 * of the same user as the daemon.
+		 *
+		 * Daemon: no content, one end of a stream socket is passed
+		 * with the message (SCM_RIGHTS). The daemon sends its
+		 * listening socket, devices and clients on it (see
+		 * HIDPP::Handoff) and exits.
+		 */
+		Handoff = 5,
+	};
+
+	enum OpenFlags: uint8_t {
+		/**
+		 * Deliver events through an EventRing.
+		 */
+		SharedEvents = 1<<0,
+	};
+
+	/**
+	 * Slots in the event rings created by the daemon.
+	 */
+	constexpr std::size_t EventRingSize = 1024;
+
+	/**
+	 * Socket path from HIDPPD_SOCKET, or hidppd.sock in
+	 * XDG_RUNTIME_DIR (/tmp if not set).
+	 */
+	std::string defaultSocketPath ();
+}
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include <hidpp10/Device.h>
 #include <hidpp10/IReceiver.h>
 #include <hidpp10/Error.h>
+#include <hidpp10/ReceiverState.h>
 #include <hidpp20/IRoot.h>
 #include <misc/Log.h>
 
@@ -44,54 +45,89 @@ const char *Device::InvalidProtocolVersion::what () const noexcept
 	return _msg.c_str ();
 }
 
-Device::Device (Dispatcher *dispatcher, DeviceIndex device_index):
-	_dispatcher (dispatcher), _device_index (device_index)
+Device::Device (Dispatcher *dispatcher, DeviceIndex device_index,
+		const HIDPP10::ReceiverState *receiver):
+	_dispatcher (dispatcher), _device_index (device_index),
+	_info (std::make_shared<ProductInfo> ())
 {
 	bool is_wireless = device_index >= WirelessDevice1 && device_index <= WirelessDevice6;
-	if (is_wireless) {
-		// Ask receiver for device info when wireless
-		HIDPP10::Device ur (_dispatcher, DefaultDevice);
-		HIDPP10::IReceiver ireceiver (&ur);
-		try {
-			ireceiver.getDeviceInformation (device_index - 1,
-							nullptr,
-							nullptr,
-							&_product_id,
-							nullptr);
-			_name = ireceiver.getDeviceName (device_index - 1);
-		}
-		catch (HIDPP10::Error &e) {
-			if (e.errorCode () == HIDPP10::Error::InvalidValue) {
-				// the invalid value is the device index
-				throw HIDPP10::Error (HIDPP10::Error::UnknownDevice);
-			}
-			Log::error () << "Error while asking receiver for infos: " << e.what () << std::endl;
-			throw;
-		}
+	if (is_wireless && receiver) {
+		receiver->checkConnected (device_index);
+		// If not paired yet, the receiver is asked on first use
+		_info->known = receiver->pairingInfo (device_index, &_info->product_id, &_info->name);
 	}
-	else {
+	else if (!is_wireless) {
 		// Use HID info for corded devices
-		_product_id = _dispatcher->productID ();
-		_name = _dispatcher->name ();
+		_info->product_id = _dispatcher->productID ();
+		_info->name = _dispatcher->name ();
+		_info->known = true;
 	}
 
 	// Check protocol version
-	static constexpr unsigned int software_id = 1;
 	auto type = _dispatcher->reportInfo ().findReport ();
 	assert (type);
-	Report request (*type, _device_index, HIDPP20::IRoot::index, HIDPP20::IRoot::Ping, software_id);
-	auto response = _dispatcher->sendCommand (std::move (request));
-	try {
-		auto report = response->get (is_wireless ? 2000 : 500); // use longer timeout for wireless devices that can be sleeping.
-		auto params = report.parameterBegin ();
+	Report request (*type, _device_index, HIDPP20::IRoot::index, HIDPP20::IRoot::Ping, _dispatcher->nextSoftwareID ());
+	// use longer timeout for wireless devices that can be sleeping,
+	// unless the dispatcher already knows how fast the device answers.
+	auto result = _dispatcher->trySendCommand (std::move (request),
+			_dispatcher->commandTimeout (device_index, is_wireless ? 2000 : 500));
+	if (result) {
+		auto params = result.report->parameterBegin ();
 		_version = std::make_tuple (params[0], params[1]);
 	}
-	catch (HIDPP10::Error &e) {
-		// Valid HID++1.0 devices should send a "Invalid SubID" error.
-		if (e.errorCode () != HIDPP10::Error::InvalidSubID)
-			throw;
+	// Valid HID++1.0 devices should send a "Invalid SubID" error.
+	else if (result.status == CommandResult::HIDPP10Error &&
+			result.error_code == HIDPP10::Error::InvalidSubID)
 		_version = std::make_tuple (1, 0);
+	else
+		result.check ();
+	_dispatcher->setDeviceProtocol (_device_index, std::get<0> (_version));
+}
+
+Device::Device (Dispatcher *dispatcher, DeviceIndex device_index, const Identity &identity):
+	_dispatcher (dispatcher), _device_index (device_index),
+	_info (std::make_shared<ProductInfo> ()),
+	_version (identity.version)
+{
+	_info->product_id = identity.product_id;
+	_info->name = identity.name;
+	_info->known = true;
+	_dispatcher->setDeviceProtocol (_device_index, std::get<0> (_version));
+}
+
+Device::Identity Device::identity () const
+{
+	const auto &info = productInfo ();
+	return { info.product_id, info.name, _version };
+}
+
+const Device::ProductInfo &Device::productInfo () const
+{
+	std::unique_lock<std::mutex> lock (_info->mutex);
+	if (_info->known)
+		return *_info;
+	// Ask receiver for device info when wireless
+	HIDPP10::Device ur (_dispatcher, DefaultDevice);
+	HIDPP10::IReceiver ireceiver (&ur);
+	try {
+		ireceiver.getDeviceInformation (_device_index - 1,
+						nullptr,
+						nullptr,
+						&_info->product_id,
+						nullptr);
+		_info->name = ireceiver.getDeviceName (_device_index - 1);
+	}
+	catch (HIDPP10::Error &e) {
+		if (e.errorCode () == HIDPP10::Error::InvalidValue) {
+			// the invalid value is the device index
+			throw HIDPP10::Error (HIDPP10::Error::UnknownDevice);
+		}
+		Log::error () << "Error while asking receiver for infos: " << e.what () << std::endl;
+		throw;
 	}
+	// Fields are not modified once known, they are read without the lock
+	_info->known = true;
+	return *_info;
 }
 
 Dispatcher *Device::dispatcher () const
@@ -106,12 +142,12 @@ DeviceIndex Device::deviceIndex () const
 
 uint16_t Device::productID () const
 {
-	return _product_id;
+	return productInfo ().product_id;
 }
 
 std::string Device::name () const
 {
-	return _name;
+	return productInfo ().name;
 }
 
 std::tuple<unsigned int, unsigned int> Device::protocolVersion ()
@@ -21,9 +21,13 @@
 
 #include <hidpp/defs.h>
 #include <hidpp/Report.h>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 
+namespace HIDPP10 { class ReceiverState; }
+
 namespace HIDPP
 {
 
@@ -53,12 +57,44 @@ public:
 	 * For receivers and wireless devices, multiple devices use the same hidraw
 	 * node, \p device_index is needed to select a particular device.
 	 *
-	 * The constructor ask the receiver for information for wireless devices and
-	 * check the protocol version. If something goes wrong it may throw HID++ errors
-	 * (HIDPP10::Error or HIDPP20::Error) or other exception (e.g. std::system_error
-	 * for errors with the HID node).
+	 * The constructor only checks the protocol version (one round trip).
+	 * If something goes wrong it may throw HID++ errors (HIDPP10::Error
+	 * or HIDPP20::Error) or other exception (e.g. std::system_error for
+	 * errors with the HID node).
+	 *
+	 * The product ID and name of wireless devices are asked to the
+	 * receiver on first use (see productID and name). If \p receiver is
+	 * given for a wireless device, absent devices fail immediately (see
+	 * HIDPP10::ReceiverState::checkConnected) and the pairing information
+	 * it already read is used.
+	 */
+	Device (Dispatcher *dispatcher, DeviceIndex device_index = DefaultDevice,
+		const HIDPP10::ReceiverState *receiver = nullptr);
+
+	/**
+	 * What the constructor learns from the device and the receiver.
+	 */
+	struct Identity
+	{
+		uint16_t product_id;
+		std::string name;
+		std::tuple<unsigned int, unsigned int> version;
+	};
+
+	/**
+	 * Construct a device already identified (e.g. by probeDevices or
+	 * from a saved \ref identity), without any round trip.
+	 *
+	 * Nothing is checked, commands fail later if \p identity does not
+	 * match the device.
 	 */
-	Device (Dispatcher *dispatcher, DeviceIndex device_index = DefaultDevice);
+	Device (Dispatcher *dispatcher, DeviceIndex device_index, const Identity &identity);
+
+	/**
+	 * Get what is needed to construct this device again without round
+	 * trips.
+	 */
+	Identity identity () const;
 
 	Dispatcher *dispatcher () const;
 
@@ -72,6 +108,12 @@ public:
 	 *
 	 *  - Use HID product ID for wired device or receivers.
 	 *  - Use wireless PID given by the receiver for wireless devices.
+	 *
+	 * For wireless devices, the first call of productID, name or
+	 * identity (by this device or a copy) asks the receiver.
+	 *
+	 * \throws HIDPP10::Error (\ref HIDPP10::Error::UnknownDevice if the
+	 * slot is not paired) when asking the receiver fails.
 	 */
 	uint16_t productID () const;
 
@@ -80,6 +122,8 @@ public:
 	 *
 	 *  - Use HID product name for wired device or receivers.
 	 *  - Use the name given by the receiver for wireless devices.
+	 *
+	 * \throws HIDPP10::Error as productID.
 	 */
 	std::string name () const;
 
@@ -95,10 +139,20 @@ public:
 	std::tuple<unsigned int, unsigned int> protocolVersion ();
 
 private:
+	// Product information, shared by copies so that the receiver is
+	// asked once
+	struct ProductInfo
+	{
+		std::mutex mutex;
+		bool known = false;
+		uint16_t product_id = 0;
+		std::string name;
+	};
+	const ProductInfo &productInfo () const;
+
 	Dispatcher *_dispatcher;
 	DeviceIndex _device_index;
-	uint16_t _product_id;
-	std::string _name;
+	std::shared_ptr<ProductInfo> _info;
 	std::tuple<unsigned int, unsigned int> _version;
 };
 
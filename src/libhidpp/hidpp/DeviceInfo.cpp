@@ -20,6 +20,10 @@
 
 #include <hidpp/ids.h>
 #include <hidpp10/DeviceInfo.h>
+#include <hidpp20/DeviceInfo.h>
+
+#include <algorithm>
+#include <iterator>
 
 using namespace HIDPP;
 
@@ -71,41 +75,64 @@ HIDPP10::MouseInfo G700sInfo = {
 	HIDPP10::G700ProfileType
 };
 
-const DeviceInfo *HIDPP::getDeviceInfo (uint16_t product_id)
-{
-	switch (product_id) {
-	case 0xc52b: // Unifying receiver
-	case 0xc52f: // Nano receiver advanced
-	case 0xc531: // G700 receiver
-	case 0xc532: // Unifying receiver
-	case 0xc537: // G602 receiver
-		return &ReceiverInfo;
-
-	case ID::G5:
-	case ID::G5_2007:
-	case ID::G7:
-		return &G5Info;
-
-	case ID::G9:
-		return &G9Info;
-
-	case ID::G9x:
-	case ID::G9x_MW3:
-		return &G9xInfo;
+static constexpr uint16_t G502HeroFeatures[] = {
+	0x0001, // Feature set
+	0x0003, // Device information
+	0x0005, // Device name
+	0x1b04, // Reprogrammable controls v4
+	0x2201, // Adjustable DPI
+	0x8070, // Color LED effects
+	0x8100, // Onboard profiles
+	0x8110, // Mouse button spy
+};
 
-	case ID::G500:
-		return &G500Info;
+HIDPP20::ModelInfo G502HeroInfo (G502HeroFeatures);
 
-	case ID::G500s:
-		return &G500sInfo;
+namespace
+{
+	struct Record
+	{
+		uint16_t product_id;
+		const DeviceInfo *info;
+	};
+}
 
-	case ID::G700:
-		return &G700Info;
+// Sorted by product ID for binary search
+static constexpr Record Records[] = {
+	{ ID::G5,		&G5Info },
+	{ ID::G9,		&G9Info },
+	{ ID::G5_2007,		&G5Info },
+	{ ID::G9x,		&G9xInfo },
+	{ ID::G500,		&G500Info },
+	{ ID::G700,		&G700Info },
+	{ ID::G700s,		&G700sInfo },
+	{ ID::G502Hero,		&G502HeroInfo },
+	{ ID::G9x_MW3,		&G9xInfo },
+	{ ID::G500s,		&G500sInfo },
+	{ ID::G7,		&G5Info },
+	{ 0xc52b,		&ReceiverInfo }, // Unifying receiver
+	{ 0xc52f,		&ReceiverInfo }, // Nano receiver advanced
+	{ 0xc531,		&ReceiverInfo }, // G700 receiver
+	{ 0xc532,		&ReceiverInfo }, // Unifying receiver
+	{ 0xc537,		&ReceiverInfo }, // G602 receiver
+};
 
-	case ID::G700s:
-		return &G700sInfo;
+static constexpr bool isSorted ()
+{
+	for (std::size_t i = 1; i < std::size (Records); ++i)
+		if (Records[i-1].product_id >= Records[i].product_id)
+			return false;
+	return true;
+}
+static_assert (isSorted (), "Records must be sorted by product ID");
 
-	default:
+const DeviceInfo *HIDPP::getDeviceInfo (uint16_t product_id)
+{
+	auto it = std::lower_bound (std::begin (Records), std::end (Records), product_id,
+		[] (const Record &record, uint16_t id) {
+			return record.product_id < id;
+		});
+	if (it == std::end (Records) || it->product_id != product_id)
 		return nullptr;
-	}
+	return it->info;
 }
@@ -0,0 +1,516 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DeviceRegistry.h"
+
+#include <hidpp/DispatcherThread.h>
+#include <hidpp/Probe.h>
+#include <hidpp10/Device.h>
+#include <hidpp10/Error.h>
+#include <hidpp10/IReceiver.h>
+#include <hidpp10/ReceiverState.h>
+#include <hidpp10/defs.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/IDeviceInformation.h>
+#include <hidpp20/IRoot.h>
+#include <hidpp20/UnsupportedFeature.h>
+#include <misc/Log.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <condition_variable>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using namespace HIDPP;
+
+static constexpr DeviceIndex WirelessDevices[] = {
+	WirelessDevice1, WirelessDevice2, WirelessDevice3,
+	WirelessDevice4, WirelessDevice5, WirelessDevice6,
+};
+
+struct DeviceRegistry::Node
+{
+	std::string path;
+	DispatcherThread dispatcher;
+	std::thread thread;
+	// Set before the wireless devices are probed
+	std::unique_ptr<HIDPP10::ReceiverState> receiver;
+	Device::Identity receiver_identity;
+	std::vector<Dispatcher::listener_iterator> listeners;
+	// Probes of devices connecting after the node was probed
+	std::mutex probes_mutex;
+	std::vector<std::future<void>> probes;
+	bool closed;
+
+	Node (const std::string &path):
+		path (path),
+		dispatcher (path.c_str ()),
+		thread (std::bind (&DispatcherThread::run, &dispatcher)),
+		closed (false)
+	{
+	}
+
+	~Node ()
+	{
+		close ();
+		receiver.reset ();
+		dispatcher.stop ();
+		thread.join ();
+	}
+
+	/**
+	 * Stop probing new devices, the dispatcher may still be used.
+	 */
+	void close ()
+	{
+		for (const auto &it: listeners)
+			dispatcher.unregisterEventHandler (it);
+		listeners.clear ();
+		std::vector<std::future<void>> pending;
+		{
+			std::unique_lock<std::mutex> lock (probes_mutex);
+			closed = true;
+			pending = std::move (probes);
+		}
+		for (auto &f: pending)
+			f.wait ();
+	}
+};
+
+static std::string hexString (const uint8_t *data, std::size_t length)
+{
+	std::string str;
+	char byte[3];
+	for (std::size_t i = 0; i < length; ++i) {
+		snprintf (byte, sizeof (byte), "%02x", data[i]);
+		str += byte;
+	}
+	return str;
+}
+
+DeviceRegistry::DeviceRegistry ()
+{
+	setFilter (deviceFilter ());
+}
+
+DeviceRegistry::~DeviceRegistry ()
+{
+	std::map<std::string, std::shared_ptr<Node>> nodes;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		nodes = std::move (_nodes);
+		_nodes.clear ();
+	}
+	for (auto &[path, node]: nodes)
+		node->close ();
+	std::unique_lock<std::mutex> lock (_mutex);
+	_slots.clear ();
+}
+
+void DeviceRegistry::setChangeHandler (change_handler handler)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_handler = std::move (handler);
+}
+
+std::vector<DeviceRegistry::DeviceEntry> DeviceRegistry::devices () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::vector<DeviceEntry> entries;
+	for (const auto &slot: _slots)
+		entries.push_back (slot.entry);
+	return entries;
+}
+
+DeviceRegistry::DeviceEntry DeviceRegistry::device (DeviceID id) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _slots.at (id).entry;
+}
+
+std::optional<DeviceRegistry::DeviceID> DeviceRegistry::find (const std::string &key) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _keys.find (key);
+	if (it == _keys.end ())
+		return std::nullopt;
+	return it->second;
+}
+
+std::shared_ptr<Dispatcher> DeviceRegistry::dispatcher (DeviceID id) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	const auto &slot = _slots.at (id);
+	if (!slot.node)
+		throw std::runtime_error ("device is absent");
+	return std::shared_ptr<Dispatcher> (slot.node, &slot.node->dispatcher);
+}
+
+Device DeviceRegistry::open (DeviceID id, std::shared_ptr<Dispatcher> &dispatcher) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	const auto &slot = _slots.at (id);
+	if (!slot.node)
+		throw std::runtime_error ("device is absent");
+	dispatcher = std::shared_ptr<Dispatcher> (slot.node, &slot.node->dispatcher);
+	return Device (dispatcher.get (), slot.entry.index, slot.entry.identity);
+}
+
+void DeviceRegistry::sendCommand (DeviceID id, Report &&report,
+				  Dispatcher::completion_handler &&handler, int timeout) const
+{
+	DeviceIndex index;
+	std::shared_ptr<Dispatcher> d;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		const auto &slot = _slots.at (id);
+		if (!slot.node)
+			throw std::runtime_error ("device is absent");
+		d = std::shared_ptr<Dispatcher> (slot.node, &slot.node->dispatcher);
+		index = slot.entry.index;
+	}
+	std::vector<uint8_t> raw (report.rawData (), report.rawData () + report.rawLength ());
+	raw[1] = index;
+	d->sendCommand (Report (std::move (raw)), std::move (handler), timeout);
+}
+
+std::map<DeviceRegistry::DeviceID, std::exception_ptr> DeviceRegistry::forEach (const std::function<void (Device &dev)> &function) const
+{
+	// Devices of a node share its dispatcher, which sends their commands concurrently
+	std::vector<std::tuple<DeviceID, std::future<void>>> calls;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (const auto &slot: _slots) {
+			if (!slot.node)
+				continue;
+			std::shared_ptr<Dispatcher> d (slot.node, &slot.node->dispatcher);
+			Device dev (d.get (), slot.entry.index, slot.entry.identity);
+			calls.emplace_back (slot.entry.id, std::async (std::launch::async,
+				[&function, d, dev] () mutable {
+					function (dev);
+				}));
+		}
+	}
+	std::map<DeviceID, std::exception_ptr> errors;
+	for (auto &[id, call]: calls) {
+		try {
+			call.get ();
+		}
+		catch (...) {
+			errors.emplace (id, std::current_exception ());
+		}
+	}
+	return errors;
+}
+
+std::vector<DeviceRegistry::BroadcastResult> DeviceRegistry::broadcast (const selector &select,
+									 const BroadcastCommand &command,
+									 int timeout) const
+{
+	typedef std::chrono::steady_clock clock;
+	struct Target
+	{
+		std::shared_ptr<Node> node;
+		DeviceIndex index;
+		Device::Identity identity;
+		std::optional<uint8_t> feature_index;
+	};
+	// Results are written from the dispatcher threads
+	struct State
+	{
+		clock::time_point start;
+		std::mutex mutex;
+		std::condition_variable cond;
+		std::size_t pending;
+		std::vector<BroadcastResult> results;
+	};
+	auto state = std::make_shared<State> ();
+	std::vector<Target> targets;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (const auto &slot: _slots) {
+			if (!slot.node || !select (slot.entry))
+				continue;
+			Target target = { slot.node, slot.entry.index, slot.entry.identity, std::nullopt };
+			auto it = slot.features.find (command.feature_id);
+			if (it != slot.features.end ())
+				target.feature_index = it->second;
+			targets.push_back (std::move (target));
+			state->results.push_back ({ slot.entry.id, {}, nullptr, clock::duration::zero () });
+		}
+	}
+	state->pending = targets.size ();
+	state->start = clock::now ();
+
+	auto complete = [state] (std::size_t i, const std::vector<uint8_t> *results, std::exception_ptr error) {
+		std::unique_lock<std::mutex> lock (state->mutex);
+		auto &result = state->results[i];
+		if (results)
+			result.results = *results;
+		result.error = error;
+		result.latency = clock::now () - state->start;
+		if (--state->pending == 0)
+			state->cond.notify_all ();
+	};
+	auto call = [&command, timeout, complete] (HIDPP20::Device &dev, std::size_t i, uint8_t feature_index) {
+		if (feature_index == 0) {
+			complete (i, nullptr, std::make_exception_ptr (
+					HIDPP20::UnsupportedFeature (command.feature_id, "broadcast")));
+			return;
+		}
+		try {
+			dev.callFunctionAsync (feature_index, command.function, command.params,
+				[i, complete] (const std::vector<uint8_t> *results, std::exception_ptr error) {
+					complete (i, results, error);
+				}, timeout);
+		}
+		catch (...) {
+			complete (i, nullptr, std::current_exception ());
+		}
+	};
+
+	for (std::size_t i = 0; i < targets.size (); ++i) {
+		auto &target = targets[i];
+		std::shared_ptr<Dispatcher> d (target.node, &target.node->dispatcher);
+		std::optional<HIDPP20::Device> dev;
+		try {
+			dev.emplace (d.get (), target.index, target.identity);
+		}
+		catch (...) {
+			complete (i, nullptr, std::current_exception ());
+			continue;
+		}
+		if (target.feature_index) {
+			call (*dev, i, *target.feature_index);
+			continue;
+		}
+		// The command is sent from the dispatcher thread once the
+		// index is known. Handlers must not own the node: it would
+		// be destroyed from its own thread. targets keeps it alive
+		// until every call completes.
+		try {
+			uint16_t feature_id = command.feature_id;
+			DeviceID id = state->results[i].id;
+			dev->callFunctionAsync (HIDPP20::IRoot::index, HIDPP20::IRoot::GetFeature,
+				{ uint8_t (feature_id >> 8), uint8_t (feature_id) },
+				[this, dev = *dev, node = std::weak_ptr<Node> (target.node), id, i, feature_id, call, complete]
+				(const std::vector<uint8_t> *results, std::exception_ptr error) mutable {
+					if (!results) {
+						complete (i, nullptr, error);
+						return;
+					}
+					uint8_t index = results->at (0);
+					storeFeature (id, node, feature_id, index);
+					call (dev, i, index);
+				}, timeout);
+		}
+		catch (...) {
+			complete (i, nullptr, std::current_exception ());
+		}
+	}
+
+	std::unique_lock<std::mutex> lock (state->mutex);
+	state->cond.wait (lock, [&state] () { return state->pending == 0; });
+	return std::move (state->results);
+}
+
+void DeviceRegistry::storeFeature (DeviceID id, const std::weak_ptr<Node> &node,
+				   uint16_t feature_id, uint8_t index) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto &slot = _slots.at (id);
+	if (slot.node && slot.node == node.lock ()) // not bound again since the lookup
+		slot.features[feature_id] = index;
+}
+
+void DeviceRegistry::addDevice (const char *path)
+{
+	std::shared_ptr<Node> node;
+	try {
+		node = std::make_shared<Node> (path);
+	}
+	catch (Dispatcher::NoHIDPPReportException &e) {
+		return;
+	}
+	catch (std::exception &e) {
+		Log::warning ().printf ("Failed to open %s: %s\n", path, e.what ());
+		return;
+	}
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (!_nodes.emplace (path, node).second)
+			return;
+	}
+	// Probe like probeDevices: default and corded indices together,
+	// then every paired wireless device together.
+	auto corded = std::async (std::launch::async, &DeviceRegistry::probe, this, node, CordedDevice);
+	probe (node, DefaultDevice);
+	corded.get ();
+	std::optional<DeviceID> receiver_id;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (const auto &slot: _slots)
+			if (slot.node == node && slot.entry.index == DefaultDevice)
+				receiver_id = slot.entry.id;
+		if (receiver_id)
+			node->receiver_identity = _slots[*receiver_id].entry.identity;
+	}
+	if (!receiver_id || node->receiver_identity.version != std::make_tuple (1u, 0u))
+		return;
+	try {
+		node->receiver = std::make_unique<HIDPP10::ReceiverState> (&node->dispatcher);
+	}
+	catch (std::exception &e) {
+		Log::debug ().printf ("Failed to read the pairing information of %s: %s\n", path, e.what ());
+	}
+	std::vector<std::future<void>> probes;
+	for (auto index: WirelessDevices)
+		if (!node->receiver || node->receiver->isPaired (index))
+			probes.push_back (std::async (std::launch::async, &DeviceRegistry::probe, this, node, index));
+	for (auto &f: probes)
+		f.get ();
+	// Then probe the devices connecting later
+	std::weak_ptr<Node> weak = node;
+	for (auto index: WirelessDevices)
+		node->listeners.push_back (node->dispatcher.registerEventHandler (
+			index, HIDPP10::DeviceConnection,
+			[this, weak] (const Report &report) {
+				return connectionEvent (weak, report);
+			}));
+}
+
+void DeviceRegistry::removeDevice (const char *path)
+{
+	std::shared_ptr<Node> node;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		auto it = _nodes.find (path);
+		if (it == _nodes.end ())
+			return;
+		node = std::move (it->second);
+		_nodes.erase (it);
+	}
+	node->close ();
+	std::vector<DeviceEntry> removed;
+	change_handler handler;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (auto &slot: _slots) {
+			if (slot.node != node)
+				continue;
+			slot.node.reset ();
+			slot.entry.path.clear ();
+			removed.push_back (slot.entry);
+		}
+		handler = _handler;
+	}
+	if (handler)
+		for (const auto &entry: removed)
+			handler (entry);
+}
+
+void DeviceRegistry::probe (const std::shared_ptr<Node> &node, DeviceIndex index)
+{
+	try {
+		Device dev (&node->dispatcher, index, node->receiver.get ());
+		auto identity = dev.identity ();
+		std::string key;
+		if (std::get<0> (identity.version) >= 2) {
+			try {
+				HIDPP20::Device dev20 (&node->dispatcher, index, identity);
+				auto info = HIDPP20::IDeviceInformation (&dev20).getDeviceInfo ();
+				if (std::any_of (info.unit_id.begin (), info.unit_id.end (),
+						[] (uint8_t b) { return b != 0; }))
+					key = "unit:" + hexString (info.model_id.data (), info.model_id.size ()) +
+						":" + hexString (info.unit_id.data (), info.unit_id.size ());
+			}
+			catch (HIDPP20::UnsupportedFeature &e) {
+			}
+		}
+		if (key.empty () && node->receiver && index != DefaultDevice && index != CordedDevice) {
+			try {
+				HIDPP10::Device receiver (&node->dispatcher, DefaultDevice, node->receiver_identity);
+				uint32_t serial;
+				HIDPP10::IReceiver (&receiver).getDeviceExtendedInformation (index - 1, &serial, nullptr, nullptr);
+				char str[16];
+				snprintf (str, sizeof (str), "%08x", serial);
+				key = std::string ("serial:") + str;
+			}
+			catch (HIDPP10::Error &e) {
+				// not every receiver has the extended pairing information
+			}
+		}
+		if (key.empty ())
+			key = "node:" + node->path + ":" + std::to_string (index);
+		bind (key, node, index, identity);
+	}
+	catch (std::exception &e) {
+		Log::debug ().printf ("No device %s:%d: %s\n", node->path.c_str (), index, e.what ());
+	}
+}
+
+void DeviceRegistry::bind (const std::string &key, const std::shared_ptr<Node> &node,
+			   DeviceIndex index, const Device::Identity &identity)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (_nodes.find (node->path) == _nodes.end () || _nodes.at (node->path) != node)
+		return; // removed while probing
+	auto [it, inserted] = _keys.emplace (key, _slots.size ());
+	if (inserted)
+		_slots.emplace_back ();
+	auto &slot = _slots[it->second];
+	slot.entry.id = it->second;
+	slot.entry.key = key;
+	slot.entry.path = node->path;
+	slot.entry.index = index;
+	slot.entry.vendor_id = node->dispatcher.vendorID ();
+	slot.entry.identity = identity;
+	slot.node = node;
+	slot.features.clear ();
+	auto entry = slot.entry;
+	auto handler = _handler;
+	lock.unlock ();
+	if (handler)
+		handler (entry);
+}
+
+bool DeviceRegistry::connectionEvent (const std::weak_ptr<Node> &weak, const Report &report)
+{
+	if (report.parameterBegin ()[0] & 0x40) // link lost
+		return true;
+	auto node = weak.lock ();
+	if (!node)
+		return true;
+	DeviceIndex index = report.deviceIndex ();
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (const auto &slot: _slots)
+			if (slot.node == node && slot.entry.index == index)
+				return true; // already known
+	}
+	// Probing waits for answers that this dispatcher thread reads
+	std::unique_lock<std::mutex> lock (node->probes_mutex);
+	if (!node->closed)
+		node->probes.push_back (std::async (std::launch::async, [this, weak, index] () {
+			if (auto node = weak.lock ())
+				probe (node, index);
+		}));
+	return true;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_DEVICE_REGISTRY_H
+#define LIBHIDPP_HIDPP_DEVICE_REGISTRY_H
+
+#include <hid/DeviceMonitor.h>
+#include <hidpp/Device.h>
+#include <hidpp/Dispatcher.h>
+#include <hidpp/defs.h>
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * Every HID++ device of every node, with stable IDs.
+ *
+ * The registry monitors the HID++ nodes (see deviceFilter), keeps one
+ * DispatcherThread per node and probes its device indices like
+ * probeDevices. Each device found gets an ID bound to a key telling
+ * the same device apart when it comes back, on another node or index:
+ *  - "unit:<model>:<unit>" for HID++ 2.0 devices with
+ *    HIDPP20::IDeviceInformation,
+ *  - "serial:<serial>" for other devices paired to a HID++ 1.0
+ *    receiver,
+ *  - "node:<path>:<index>" otherwise.
+ *
+ * IDs are small integers, never reused, so that commands are routed
+ * to the dispatcher of a device with an array lookup instead of a path
+ * search. Wireless devices paired but absent while their receiver is
+ * probed are probed when the receiver notifies their connection.
+ *
+ * Call \ref run (or the DeviceMonitor event loop functions) to keep the
+ * registry up to date, and \ref enumerate for a one-shot scan. All
+ * other functions may be called from any thread.
+ */
+class DeviceRegistry: public HID::DeviceMonitor
+{
+public:
+	typedef unsigned int DeviceID;
+
+	struct DeviceEntry
+	{
+		DeviceID id;
+		std::string key;
+		std::string path; ///< empty while the device is absent
+		DeviceIndex index;
+		uint16_t vendor_id;
+		Device::Identity identity;
+
+		bool present () const
+		{
+			return !path.empty ();
+		}
+	};
+
+	/**
+	 * Called when a device is found or removed (from the monitoring
+	 * or a dispatcher thread). It must not call the registry.
+	 */
+	typedef std::function<void (const DeviceEntry &entry)> change_handler;
+
+	DeviceRegistry ();
+	/**
+	 * Close every node.
+	 */
+	~DeviceRegistry ();
+
+	DeviceRegistry (const DeviceRegistry &) = delete;
+	DeviceRegistry &operator= (const DeviceRegistry &) = delete;
+
+	void setChangeHandler (change_handler handler);
+
+	/**
+	 * Every device ever found, present or not, by ID.
+	 */
+	std::vector<DeviceEntry> devices () const;
+	/**
+	 * \throws std::out_of_range if \p id was never assigned.
+	 */
+	DeviceEntry device (DeviceID id) const;
+	std::optional<DeviceID> find (const std::string &key) const;
+
+	/**
+	 * Dispatcher of the present device \p id, kept open as long as
+	 * the returned pointer is, even if the node is removed.
+	 *
+	 * \throws std::out_of_range if \p id was never assigned or
+	 * std::runtime_error if the device is absent.
+	 */
+	std::shared_ptr<Dispatcher> dispatcher (DeviceID id) const;
+	/**
+	 * Construct the present device \p id without any round trip.
+	 *
+	 * \p dispatcher receives the dispatcher the device uses, and must
+	 * be kept as long as the device is used.
+	 *
+	 * \throws as \ref dispatcher.
+	 */
+	Device open (DeviceID id, std::shared_ptr<Dispatcher> &dispatcher) const;
+
+	/**
+	 * Send \p report to the device \p id, setting its device index.
+	 *
+	 * \throws as \ref dispatcher, and any error of
+	 * Dispatcher::sendCommand.
+	 */
+	void sendCommand (DeviceID id, Report &&report,
+			  Dispatcher::completion_handler &&handler, int timeout = -1) const;
+
+	/**
+	 * Call \p function with each present device (constructed as with
+	 * \ref open), concurrently on every node, and wait for all calls.
+	 *
+	 * \returns the exception thrown by each failed call, by ID.
+	 */
+	std::map<DeviceID, std::exception_ptr> forEach (const std::function<void (Device &dev)> &function) const;
+
+	/**
+	 * Chooses the devices of a \ref broadcast.
+	 */
+	typedef std::function<bool (const DeviceEntry &entry)> selector;
+
+	/**
+	 * HID++ 2.0 function call sent to many devices.
+	 */
+	struct BroadcastCommand
+	{
+		uint16_t feature_id;
+		unsigned int function;
+		std::vector<uint8_t> params;
+	};
+
+	struct BroadcastResult
+	{
+		DeviceID id;
+		std::vector<uint8_t> results; ///< empty if the call failed
+		std::exception_ptr error;
+		/**
+		 * From the start of the broadcast to the answer, including
+		 * the feature lookup and the wait for room in the in-flight
+		 * window of the receiver.
+		 */
+		std::chrono::steady_clock::duration latency;
+	};
+
+	/**
+	 * Call \p command on every present device accepted by \p select
+	 * and wait for all the answers.
+	 *
+	 * Nothing blocks between the calls: they are all queued at once on
+	 * the dispatchers, which send them as their in-flight windows
+	 * allow (see DispatcherThread::setInFlightWindow). A broadcast
+	 * takes about one round trip per window of each receiver, not one
+	 * per device.
+	 *
+	 * Feature indices are remembered for each device until it is
+	 * bound again, only the first broadcast of a feature to a device
+	 * makes an IRoot query first.
+	 *
+	 * HID++ 1.0 devices fail with Device::InvalidProtocolVersion and
+	 * devices without the feature with HIDPP20::UnsupportedFeature.
+	 *
+	 * \param timeout	Timeout of each call in milliseconds.
+	 *
+	 * \returns one result for each selected device, by ID.
+	 */
+	std::vector<BroadcastResult> broadcast (const selector &select,
+						const BroadcastCommand &command,
+						int timeout = 1000) const;
+
+protected:
+	void addDevice (const char *path) override;
+	void removeDevice (const char *path) override;
+
+private:
+	struct Node;
+
+	void probe (const std::shared_ptr<Node> &node, DeviceIndex index);
+	void bind (const std::string &key, const std::shared_ptr<Node> &node,
+		   DeviceIndex index, const Device::Identity &identity);
+	bool connectionEvent (const std::weak_ptr<Node> &node, const Report &report);
+	void storeFeature (DeviceID id, const std::weak_ptr<Node> &node,
+			   uint16_t feature_id, uint8_t index) const;
+
+	struct Slot
+	{
+		DeviceEntry entry;
+		std::shared_ptr<Node> node; ///< null while absent
+		// Feature indices learned by broadcasts, 0 if unsupported
+		mutable std::map<uint16_t, uint8_t> features;
+	};
+
+	mutable std::mutex _mutex;
+	std::vector<Slot> _slots; ///< by ID
+	std::map<std::string, DeviceID> _keys;
+	std::map<std::string, std::shared_ptr<Node>> _nodes;
+	change_handler _handler;
+};
+
+}
+
+#endif
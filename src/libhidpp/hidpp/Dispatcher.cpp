@@ -17,8 +17,19 @@
  */
 
 #include "Dispatcher.h"
+#include "Subscription.h"
 
+#include <hid/RawDevice.h>
+#include <hidpp10/defs.h>
 #include <misc/Log.h>
+#include <misc/Probes.h>
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
 
 using namespace HIDPP;
 
@@ -36,29 +47,639 @@ Dispatcher::AsyncReport::~AsyncReport ()
 {
 }
 
+struct Dispatcher::Listener
+{
+	DeviceIndex index;
+	uint8_t sub_id;
+	event_handler handler;
+	std::atomic<bool> active;
+	std::mutex call_mutex; // held while the handler is running
+
+	Listener (DeviceIndex index, uint8_t sub_id, const event_handler &handler):
+		index (index), sub_id (sub_id), handler (handler), active (true)
+	{
+	}
+};
+
+// Listener whose handler is running on this thread.
+static thread_local const Dispatcher::Listener *current_listener = nullptr;
+
+// Event being passed to handlers on this thread, shared on the first
+// call of Dispatcher::shareEvent.
+struct CurrentEvent
+{
+	const Report *report;
+	SharedReport shared;
+};
+static thread_local CurrentEvent *current_event = nullptr;
+
+static thread_local Dispatcher::Priority current_priority = Dispatcher::Priority::Interactive;
+static thread_local bool current_read_only = false;
+
+Dispatcher::Dispatcher ():
+	_listeners (ListenerSlotCount),
+	_listener_count (0),
+	_listener_bytes (ListenerSlotCount * sizeof (std::shared_ptr<const listener_list>)),
+	_listener_account (MemoryAccounting::Subsystem::Listeners),
+	_software_id (0),
+	_has_activity_handlers (false),
+	_histograms (ListenerSlotCount),
+	_timeouts (0),
+	_unmatched_answers (0),
+	_reader_wakeups (0),
+	_device_timeouts (DeviceSlotCount),
+	_event_counts (ListenerSlotCount),
+	_report_routes (ListenerSlotCount),
+	_dump_enabled (false),
+	_dump_interval (0)
+{
+}
+
 Dispatcher::~Dispatcher ()
 {
+	for (auto &histograms: _histograms)
+		delete[] histograms.load ();
+}
+
+void Dispatcher::sendCommand (Report &&report, completion_handler &&handler, int timeout)
+{
+	auto async_report = sendCommand (std::move (report));
+	std::optional<Report> response;
+	std::exception_ptr error;
+	try {
+		if (timeout < 0)
+			response = async_report->get ();
+		else
+			response = async_report->get (timeout);
+	}
+	catch (...) {
+		error = std::current_exception ();
+	}
+	handler (response ? &*response : nullptr, error);
+}
+
+void Dispatcher::trySendCommand (Report &&report, result_handler &&handler, int timeout)
+{
+	// Shared so that it can still be called if sending fails
+	auto h = std::make_shared<result_handler> (std::move (handler));
+	try {
+		sendCommand (std::move (report), [h] (const Report *response, std::exception_ptr error) {
+			(*h) (CommandResult::fromCompletion (response, error));
+		}, timeout);
+	}
+	catch (...) {
+		CommandResult result;
+		result.exception = std::current_exception ();
+		(*h) (std::move (result));
+	}
+}
+
+CommandResult Dispatcher::trySendCommand (Report &&report, int timeout)
+{
+	std::promise<CommandResult> promise;
+	auto future = promise.get_future ();
+	trySendCommand (std::move (report), [&promise] (CommandResult &&result) {
+		promise.set_value (std::move (result));
+	}, timeout);
+	return future.get ();
+}
+
+Dispatcher::PriorityScope::PriorityScope (Priority priority) noexcept:
+	_previous (current_priority)
+{
+	current_priority = priority;
+}
+
+Dispatcher::PriorityScope::~PriorityScope ()
+{
+	current_priority = _previous;
+}
+
+Dispatcher::Priority Dispatcher::currentPriority () noexcept
+{
+	return current_priority;
+}
+
+Dispatcher::ReadOnlyScope::ReadOnlyScope () noexcept:
+	_previous (current_read_only)
+{
+	current_read_only = true;
+}
+
+Dispatcher::ReadOnlyScope::~ReadOnlyScope ()
+{
+	current_read_only = _previous;
+}
+
+bool Dispatcher::currentReadOnly () noexcept
+{
+	return current_read_only;
+}
+
+unsigned int Dispatcher::nextSoftwareID () noexcept
+{
+	return _software_id.fetch_add (1, std::memory_order_relaxed) % MaxSoftwareID + 1;
+}
+
+std::optional<std::size_t> Dispatcher::deviceSlot (DeviceIndex index) noexcept
+{
+	if (index == DefaultDevice)
+		return 7;
+	else if (index <= WirelessDevice6)
+		return index;
+	else
+		return std::nullopt;
+}
+
+DeviceIndex Dispatcher::slotDeviceIndex (std::size_t slot) noexcept
+{
+	return slot == DeviceSlotCount-1 ? DefaultDevice : static_cast<DeviceIndex> (slot);
+}
+
+std::optional<std::size_t> Dispatcher::listenerSlot (DeviceIndex index, uint8_t sub_id) noexcept
+{
+	auto i = deviceSlot (index);
+	if (!i)
+		return std::nullopt;
+	return *i << 8 | sub_id;
 }
 
 Dispatcher::listener_iterator Dispatcher::registerEventHandler (DeviceIndex index, uint8_t sub_id, const event_handler &handler)
 {
-	return _listeners.emplace (std::make_tuple (index, sub_id), handler);
+	auto slot = listenerSlot (index, sub_id);
+	if (!slot)
+		throw std::invalid_argument ("invalid device index");
+	auto listener = std::make_shared<Listener> (index, sub_id, handler);
+	std::unique_lock<std::mutex> lock (_listener_mutex);
+	auto &current = _listeners[*slot];
+	auto listeners = current ?
+		std::make_shared<listener_list> (*current) :
+		std::make_shared<listener_list> ();
+	listeners->push_back (listener);
+	updateListenerBytes (current.get (), listeners.get ());
+	std::atomic_store (&current, std::shared_ptr<const listener_list> (std::move (listeners)));
+	++_listener_count;
+	return listener;
 }
 
 void Dispatcher::unregisterEventHandler (listener_iterator it)
 {
-	_listeners.erase (it);
+	removeEventHandler (it);
+	if (current_listener != it.get ()) {
+		// Wait for the handler if it is running on another thread.
+		std::unique_lock<std::mutex> lock (it->call_mutex);
+	}
+}
+
+void Dispatcher::removeEventHandler (const listener_iterator &it)
+{
+	if (!it->active.exchange (false))
+		return;
+	std::unique_lock<std::mutex> lock (_listener_mutex);
+	auto &current = _listeners[*listenerSlot (it->index, it->sub_id)];
+	std::shared_ptr<const listener_list> listeners;
+	if (current->size () > 1) {
+		auto copy = std::make_shared<listener_list> ();
+		copy->reserve (current->size () - 1);
+		std::copy_if (current->begin (), current->end (), std::back_inserter (*copy),
+				[&it] (const listener_iterator &l) { return l != it; });
+		listeners = std::move (copy);
+	}
+	updateListenerBytes (current.get (), listeners.get ());
+	std::atomic_store (&current, std::move (listeners));
+	--_listener_count;
+}
+
+static std::size_t listenerListBytes (const Dispatcher::listener_list *listeners)
+{
+	// lists and listeners are allocated with make_shared, count their
+	// control blocks as two words.
+	static constexpr std::size_t ControlBlock = 2 * sizeof (long);
+	if (!listeners)
+		return 0;
+	return ControlBlock + sizeof (Dispatcher::listener_list)
+		+ listeners->capacity () * sizeof (Dispatcher::listener_iterator)
+		+ listeners->size () * (ControlBlock + sizeof (Dispatcher::Listener));
+}
+
+void Dispatcher::updateListenerBytes (const listener_list *old_list, const listener_list *new_list)
+{
+	auto bytes = _listener_bytes.load (std::memory_order_relaxed)
+		- listenerListBytes (old_list) + listenerListBytes (new_list);
+	_listener_bytes.store (bytes, std::memory_order_relaxed);
+	_listener_account.set (bytes);
+}
+
+unsigned int Dispatcher::eventHandlerCount () const noexcept
+{
+	return _listener_count;
 }
 
 void Dispatcher::processEvent (const Report &report)
 {
-	auto range = _listeners.equal_range (std::make_tuple (report.deviceIndex (), report.subID ()));
-	for (auto it = range.first; it != range.second;) {
-		if (it->second (report))
-			++it;
+	auto slot = listenerSlot (report.deviceIndex (), report.subID ());
+	if (!slot)
+		return;
+	_event_counts[*slot].fetch_add (1, std::memory_order_relaxed);
+	// The snapshot keeps the listeners alive even if they are
+	// unregistered while dispatching.
+	auto listeners = std::atomic_load (&_listeners[*slot]);
+	if (!listeners)
+		return;
+	LIBHIDPP_PROBE (event_dispatched, this, report.deviceIndex (), report.subID (),
+			report.address (), listeners->size ());
+	CurrentEvent event = { &report, {} };
+	auto previous_event = current_event;
+	current_event = &event;
+	for (const auto &listener: *listeners) {
+		std::unique_lock<std::mutex> lock (listener->call_mutex);
+		if (!listener->active)
+			continue;
+		auto previous = current_listener;
+		current_listener = listener.get ();
+		bool keep;
+		try {
+			keep = listener->handler (report);
+		}
+		catch (...) {
+			current_listener = previous;
+			current_event = previous_event;
+			throw;
+		}
+		current_listener = previous;
+		lock.unlock ();
+		if (!keep)
+			removeEventHandler (listener);
+	}
+	current_event = previous_event;
+}
+
+std::unique_ptr<Subscription> Dispatcher::subscribe (DeviceIndex index, uint8_t sub_id, std::size_t capacity)
+{
+	return std::make_unique<Subscription> (this, index, sub_id, capacity);
+}
+
+SharedReport Dispatcher::shareEvent (const Report &report)
+{
+	if (current_event && current_event->report == &report) {
+		if (!current_event->shared)
+			current_event->shared = _event_pool.share (report);
+		return current_event->shared;
+	}
+	return _event_pool.share (report);
+}
+
+void Dispatcher::setDeviceProtocol (DeviceIndex index, unsigned int major)
+{
+	auto device_slot = deviceSlot (index);
+	if (!device_slot)
+		throw std::invalid_argument ("invalid device index");
+	auto routes = &_report_routes[*device_slot << 8];
+	for (unsigned int sub_id = 0; sub_id < 256; ++sub_id) {
+		ReportRoute route;
+		if (major < 2)
+			route = sub_id < 0x80 ? ReportRoute::Notification : ReportRoute::Answer;
 		else
-			it = _listeners.erase (it);
+			route = sub_id == 0 ? ReportRoute::Feature : ReportRoute::Unknown;
+		routes[sub_id].store (route, std::memory_order_relaxed);
+	}
+}
+
+void Dispatcher::addFeatureIndex (DeviceIndex index, uint8_t feature_index)
+{
+	auto slot = listenerSlot (index, feature_index);
+	if (!slot)
+		throw std::invalid_argument ("invalid device index");
+	_report_routes[*slot].store (ReportRoute::Feature, std::memory_order_relaxed);
+}
+
+void Dispatcher::setFeatureCount (DeviceIndex index, unsigned int count)
+{
+	auto device_slot = deviceSlot (index);
+	if (!device_slot)
+		throw std::invalid_argument ("invalid device index");
+	auto routes = &_report_routes[*device_slot << 8];
+	for (unsigned int sub_id = 0; sub_id < 0x80; ++sub_id)
+		routes[sub_id].store (sub_id < count ? ReportRoute::Feature : ReportRoute::Notification,
+				      std::memory_order_relaxed);
+	for (unsigned int sub_id = 0x80; sub_id < count && sub_id < 256; ++sub_id)
+		routes[sub_id].store (ReportRoute::Feature, std::memory_order_relaxed);
+}
+
+Dispatcher::ReportRoute Dispatcher::reportRoute (DeviceIndex index, uint8_t sub_id) const noexcept
+{
+	auto slot = listenerSlot (index, sub_id);
+	if (!slot)
+		return ReportRoute::Unknown;
+	return _report_routes[*slot].load (std::memory_order_relaxed);
+}
+
+int Dispatcher::commandTimeout (DeviceIndex index, int default_timeout) const
+{
+	auto slot = deviceSlot (index);
+	if (!slot)
+		return default_timeout;
+	const auto &latency = _latency[*slot];
+	if (latency.unlinked.load (std::memory_order_relaxed))
+		return default_timeout;
+	if (latency.asleep.load (std::memory_order_relaxed))
+		return AsleepCommandTimeout;
+	if (latency.samples.load (std::memory_order_relaxed) > 0) {
+		double srtt = latency.srtt.load (std::memory_order_relaxed);
+		double rttvar = latency.rttvar.load (std::memory_order_relaxed);
+		int timeout = std::max (MinCommandTimeout,
+				static_cast<int> (std::ceil (srtt + 4*rttvar)));
+		return default_timeout < 0 ? timeout : std::min (timeout, default_timeout);
+	}
+	if (index >= WirelessDevice1 && index <= WirelessDevice6) {
+		// Devices paired to the same receiver are likely to be asleep
+		// too, do not wait long for them.
+		for (unsigned int i = WirelessDevice1; i <= WirelessDevice6; ++i)
+			if (_latency[i].asleep.load (std::memory_order_relaxed))
+				return AsleepCommandTimeout;
+	}
+	return default_timeout;
+}
+
+bool Dispatcher::isAsleep (DeviceIndex index) const
+{
+	auto slot = deviceSlot (index);
+	if (!slot)
+		return false;
+	return _latency[*slot].asleep.load (std::memory_order_relaxed);
+}
+
+bool Dispatcher::isLinked (DeviceIndex index) const
+{
+	auto slot = deviceSlot (index);
+	if (!slot)
+		return true;
+	return !_latency[*slot].unlinked.load (std::memory_order_relaxed);
+}
+
+void Dispatcher::recordRoundTrip (DeviceIndex index, uint8_t sub_id, uint8_t address,
+				  std::chrono::steady_clock::duration rtt)
+{
+	auto slot = deviceSlot (index);
+	if (!slot)
+		return;
+	// HID++ 2.0 histograms are by function, ignoring the software ID
+	std::size_t i = sub_id < 0x80 ? address >> 4 : address;
+	auto &histograms = _histograms[*listenerSlot (index, sub_id)];
+	auto block = histograms.load (std::memory_order_acquire);
+	if (!block) {
+		auto new_block = new AtomicHistogram[histogramCount (sub_id)];
+		if (histograms.compare_exchange_strong (block, new_block, std::memory_order_acq_rel))
+			block = new_block;
+		else
+			delete[] new_block; // block is the one from the other thread
+	}
+	block[i].add (rtt);
+
+	double r = std::chrono::duration<double, std::milli> (rtt).count ();
+	auto &latency = _latency[*slot];
+	if (latency.samples.fetch_add (1, std::memory_order_relaxed) == 0) {
+		latency.srtt.store (r, std::memory_order_relaxed);
+		latency.rttvar.store (r/2, std::memory_order_relaxed);
 	}
+	else {
+		double srtt = latency.srtt.load (std::memory_order_relaxed);
+		double rttvar = latency.rttvar.load (std::memory_order_relaxed);
+		latency.rttvar.store (0.75*rttvar + 0.25*std::abs (srtt - r), std::memory_order_relaxed);
+		latency.srtt.store (0.875*srtt + 0.125*r, std::memory_order_relaxed);
+	}
+	latency.asleep.store (false, std::memory_order_relaxed);
+}
+
+void Dispatcher::recordTimeout (DeviceIndex index)
+{
+	auto slot = deviceSlot (index);
+	if (!slot)
+		return;
+	_timeouts.fetch_add (1, std::memory_order_relaxed);
+	_device_timeouts[*slot].fetch_add (1, std::memory_order_relaxed);
+	if (!_latency[*slot].asleep.exchange (true, std::memory_order_relaxed))
+		Log::debug ("dispatcher").printf ("Device %d is not answering, considered asleep.\n", index);
+}
+
+void Dispatcher::recordActivity (DeviceIndex index)
+{
+	auto slot = deviceSlot (index);
+	if (!slot)
+		return;
+	notifyActivity (index);
+	_latency[*slot].asleep.store (false, std::memory_order_relaxed);
+	_latency[*slot].unlinked.store (false, std::memory_order_relaxed);
+	if (!_dump_enabled.load (std::memory_order_relaxed))
+		return;
+	std::unique_lock<std::mutex> lock (_dump_mutex);
+	if (_dump_interval.count () == 0)
+		return;
+	auto now = std::chrono::steady_clock::now ();
+	if (now < _next_dump)
+		return;
+	_next_dump = now + _dump_interval;
+	lock.unlock ();
+	auto log = Log::info ("dispatcher");
+	statistics ().print (log);
+}
+
+std::optional<bool> Dispatcher::recordConnection (const Report &report)
+{
+	auto index = report.deviceIndex ();
+	if (report.subID () != HIDPP10::DeviceConnection ||
+			index < WirelessDevice1 || index > WirelessDevice6 ||
+			reportRoute (index, report.subID ()) == ReportRoute::Feature)
+		return std::nullopt;
+	bool linked = !(report.parameterBegin ()[0] & 0x40);
+	auto &latency = _latency[index];
+	if (latency.unlinked.exchange (!linked, std::memory_order_relaxed) == linked)
+		Log::debug ("dispatcher").printf ("Device %d is %s.\n", index, linked ? "linked" : "unlinked");
+	if (linked) {
+		latency.asleep.store (false, std::memory_order_relaxed);
+		notifyActivity (index);
+	}
+	return linked;
+}
+
+Dispatcher::activity_iterator Dispatcher::registerActivityHandler (const activity_handler &handler)
+{
+	std::unique_lock<std::mutex> lock (_activity_mutex);
+	auto it = _activity_handlers.insert (_activity_handlers.end (), handler);
+	_has_activity_handlers = true;
+	return it;
+}
+
+void Dispatcher::unregisterActivityHandler (activity_iterator it)
+{
+	std::unique_lock<std::mutex> lock (_activity_mutex);
+	_activity_handlers.erase (it);
+	_has_activity_handlers = !_activity_handlers.empty ();
+}
+
+void Dispatcher::notifyActivity (DeviceIndex index)
+{
+	if (!_has_activity_handlers.load (std::memory_order_relaxed))
+		return;
+	std::unique_lock<std::mutex> lock (_activity_mutex);
+	for (const auto &handler: _activity_handlers)
+		handler (index);
+}
+
+void Dispatcher::recordUnmatchedAnswer () noexcept
+{
+	_unmatched_answers.fetch_add (1, std::memory_order_relaxed);
+}
+
+void Dispatcher::recordReaderWakeup () noexcept
+{
+	_reader_wakeups.fetch_add (1, std::memory_order_relaxed);
+}
+
+std::chrono::microseconds Dispatcher::LatencyHistogram::bucketLimit (std::size_t i) noexcept
+{
+	return std::chrono::microseconds (250 << i);
+}
+
+void Dispatcher::LatencyHistogram::add (std::chrono::steady_clock::duration rtt) noexcept
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds> (rtt);
+	std::size_t i = 0;
+	while (i < BucketCount-1 && us >= bucketLimit (i))
+		++i;
+	++buckets[i];
+	++count;
+	total += us;
+	max = std::max (max, us);
+}
+
+void Dispatcher::AtomicHistogram::add (std::chrono::steady_clock::duration rtt) noexcept
+{
+	auto us = std::chrono::duration_cast<std::chrono::microseconds> (rtt);
+	std::size_t i = 0;
+	while (i < LatencyHistogram::BucketCount-1 && us >= LatencyHistogram::bucketLimit (i))
+		++i;
+	buckets[i].fetch_add (1, std::memory_order_relaxed);
+	count.fetch_add (1, std::memory_order_relaxed);
+	uint64_t value = us.count ();
+	total.fetch_add (value, std::memory_order_relaxed);
+	uint64_t current = max.load (std::memory_order_relaxed);
+	while (value > current && !max.compare_exchange_weak (current, value, std::memory_order_relaxed));
+}
+
+Dispatcher::LatencyHistogram Dispatcher::AtomicHistogram::load () const noexcept
+{
+	LatencyHistogram histogram;
+	for (std::size_t i = 0; i < LatencyHistogram::BucketCount; ++i)
+		histogram.buckets[i] = buckets[i].load (std::memory_order_relaxed);
+	histogram.count = count.load (std::memory_order_relaxed);
+	histogram.total = std::chrono::microseconds (total.load (std::memory_order_relaxed));
+	histogram.max = std::chrono::microseconds (max.load (std::memory_order_relaxed));
+	return histogram;
+}
+
+void Dispatcher::AtomicHistogram::reset () noexcept
+{
+	for (auto &bucket: buckets)
+		bucket.store (0, std::memory_order_relaxed);
+	count.store (0, std::memory_order_relaxed);
+	total.store (0, std::memory_order_relaxed);
+	max.store (0, std::memory_order_relaxed);
+}
+
+void Dispatcher::Statistics::print (std::ostream &out) const
+{
+	out << "Commands in flight: " << commands_in_flight
+	    << ", queued: " << commands_queued
+	    << ", coalesced reads: " << coalesced_reads
+	    << ", timeouts: " << timeouts
+	    << ", unmatched answers: " << unmatched_answers
+	    << ", reader wakeups: " << reader_wakeups << std::endl;
+	out << "Listeners: " << listeners
+	    << ", memory: " << memory << " bytes" << std::endl;
+	auto flags = out.flags ();
+	for (const auto &[key, histogram]: latency) {
+		auto [index, sub_id, address] = key;
+		out << std::hex << std::setfill ('0')
+		    << "Command " << std::setw (2) << static_cast<unsigned int> (index)
+		    << " " << std::setw (2) << static_cast<unsigned int> (sub_id)
+		    << " " << std::setw (2) << static_cast<unsigned int> (address)
+		    << std::dec << ": " << histogram.count << " answers, mean "
+		    << histogram.total.count () / histogram.count << "µs, max "
+		    << histogram.max.count () << "µs, buckets";
+		for (auto n: histogram.buckets)
+			out << " " << n;
+		out << std::endl;
+	}
+	for (const auto &[key, count]: events) {
+		out << std::hex << std::setfill ('0')
+		    << "Event " << std::setw (2) << static_cast<unsigned int> (key.first)
+		    << " " << std::setw (2) << static_cast<unsigned int> (key.second)
+		    << std::dec << ": " << count << std::endl;
+	}
+	out.flags (flags);
+}
+
+Dispatcher::Statistics Dispatcher::statistics () const
+{
+	Statistics stats;
+	stats.timeouts = _timeouts.load (std::memory_order_relaxed);
+	stats.unmatched_answers = _unmatched_answers.load (std::memory_order_relaxed);
+	stats.reader_wakeups = _reader_wakeups.load (std::memory_order_relaxed);
+	for (std::size_t slot = 0; slot < DeviceSlotCount; ++slot) {
+		auto count = _device_timeouts[slot].load (std::memory_order_relaxed);
+		if (count != 0)
+			stats.device_timeouts.emplace (slotDeviceIndex (slot), count);
+	}
+	stats.listeners = _listener_count.load (std::memory_order_relaxed);
+	stats.memory = _listener_bytes.load (std::memory_order_relaxed);
+	for (std::size_t slot = 0; slot < ListenerSlotCount; ++slot) {
+		auto count = _event_counts[slot].load (std::memory_order_relaxed);
+		if (count == 0)
+			continue;
+		stats.events.emplace (std::make_pair (slotDeviceIndex (slot / 256), static_cast<uint8_t> (slot % 256)), count);
+	}
+	for (std::size_t slot = 0; slot < ListenerSlotCount; ++slot) {
+		auto block = _histograms[slot].load (std::memory_order_acquire);
+		if (!block)
+			continue;
+		auto index = slotDeviceIndex (slot / 256);
+		auto sub_id = static_cast<uint8_t> (slot % 256);
+		for (std::size_t i = 0; i < histogramCount (sub_id); ++i) {
+			auto histogram = block[i].load ();
+			if (histogram.count == 0)
+				continue;
+			auto address = static_cast<uint8_t> (sub_id < 0x80 ? i << 4 : i);
+			stats.latency.emplace (std::make_tuple (index, sub_id, address), histogram);
+		}
+	}
+	return stats;
+}
+
+void Dispatcher::resetStatistics ()
+{
+	_timeouts = 0;
+	_unmatched_answers = 0;
+	_reader_wakeups = 0;
+	for (auto &count: _device_timeouts)
+		count = 0;
+	for (auto &count: _event_counts)
+		count = 0;
+	for (std::size_t slot = 0; slot < ListenerSlotCount; ++slot) {
+		auto block = _histograms[slot].load (std::memory_order_acquire);
+		if (!block)
+			continue;
+		for (std::size_t i = 0; i < histogramCount (slot % 256); ++i)
+			block[i].reset ();
+	}
+}
+
+void Dispatcher::setStatisticsDumpInterval (std::chrono::milliseconds interval)
+{
+	std::unique_lock<std::mutex> lock (_dump_mutex);
+	_dump_interval = interval;
+	_next_dump = std::chrono::steady_clock::now () + interval;
+	_dump_enabled = interval.count () != 0;
 }
 
 static bool hasReport(const HID::ReportCollection &collection, HID::ReportID::Type type, uint8_t id, HID::Usage usage, unsigned int count)
@@ -80,16 +701,236 @@ static bool hasReport(const HID::ReportCollection &collection, HID::ReportID::Ty
 		return false;
 }
 
-void Dispatcher::checkReportDescriptor (const HID::ReportDescriptor &rdesc)
+static constexpr std::tuple<Report::Type, int> HIDPPReportTypes[] = {
+	{ Report::Short, Dispatcher::ReportInfo::HasShortReport },
+	{ Report::Long, Dispatcher::ReportInfo::HasLongReport },
+	{ Report::VeryLong, Dispatcher::ReportInfo::HasVeryLongReport },
+};
+
+namespace {
+/*
+ * Top-level collection with a HID++ usage page, and whether it has the
+ * input and output reports of the type given by its usage.
+ */
+struct HIDPPCollection
+{
+	HID::Usage usage;
+	bool has_input = false, has_output = false;
+};
+}
+
+static bool isHIDPPUsagePage (uint16_t usage_page)
+{
+	return usage_page == 0xFF43 || usage_page == 0xFF00; // Modern or legacy scheme
+}
+
+static std::vector<HIDPPCollection> findHIDPPCollections (const HID::ReportDescriptor &rdesc)
+{
+	std::vector<HIDPPCollection> collections;
+	for (const auto &collection: rdesc.collections) {
+		if (!isHIDPPUsagePage (collection.usage.usage_page))
+			continue;
+		auto &c = collections.emplace_back ();
+		c.usage = collection.usage;
+		for (auto [type, flag]: HIDPPReportTypes) {
+			if (static_cast<uint8_t> (collection.usage.usage) != flag)
+				continue;
+			auto usage = HID::Usage (collection.usage.usage_page, flag);
+			c.has_input = hasReport (collection, HID::ReportID::Type::Input,
+						 static_cast<uint8_t> (type), usage,
+						 Report::reportLength (type)-1);
+			c.has_output = hasReport (collection, HID::ReportID::Type::Output,
+						  static_cast<uint8_t> (type), usage,
+						  Report::reportLength (type)-1);
+		}
+	}
+	return collections;
+}
+
+/*
+ * Find the HID++ collections in a raw report descriptor, with the same
+ * rules as hasReport, but only decoding what they need: top-level
+ * collection usages and the fields of the HID++ reports.
+ *
+ * Returns nullopt if the descriptor is invalid or uses items this scan
+ * does not handle (delimiters), the full parser is used then.
+ */
+static std::optional<std::vector<HIDPPCollection>> scanHIDPPCollections (const uint8_t *data, std::size_t length)
+{
+	struct Global {
+		uint16_t usage_page = 0;
+		uint32_t report_size = 0, report_count = 0, report_id = 0;
+	};
+	static constexpr unsigned int MaxGlobalDepth = 16;
+	Global global[MaxGlobalDepth];
+	unsigned int global_depth = 0;
+	// Local items
+	unsigned int usage_count = 0;
+	HID::Usage first_usage;
+	bool has_usage_range = false;
+	// Fields of the HID++ reports in the current top-level collection,
+	// by output (0 for input, 1 for output) and report type
+	struct Field {
+		unsigned int count = 0; // number of non-padding fields
+		bool valid = false; // data, array, 8-bit, single usage
+		uint32_t report_count;
+		HID::Usage usage;
+	} fields[2][3];
+	std::vector<HIDPPCollection> collections;
+	bool in_hidpp_collection = false;
+	int collection_depth = 0;
+
+	while (length > 0) {
+		if (data[0] == 0xFE) { // long item, not used by HID++ descriptors
+			if (length < 3 || length < 3u + data[1])
+				return std::nullopt;
+			length -= 3 + data[1];
+			data += 3 + data[1];
+			continue;
+		}
+		unsigned int size = data[0] & 0x03;
+		if (size == 3)
+			size = 4;
+		if (length < 1+size)
+			return std::nullopt;
+		unsigned int type = (data[0] & 0x0C) >> 2;
+		unsigned int tag = (data[0] & 0xF0) >> 4;
+		uint32_t value = 0;
+		for (unsigned int i = 0; i < size; ++i)
+			value |= uint32_t (data[1+i]) << (8*i);
+		length -= 1+size;
+		data += 1+size;
+		switch (type) {
+		case 0: // Main
+			switch (tag) {
+			case 8: // Input
+			case 9: // Output
+				if (in_hidpp_collection && collection_depth > 0) {
+					const Global &g = global[global_depth];
+					bool constant = value & HID::ReportField::Flags::Data_Constant;
+					bool array = !(value & HID::ReportField::Flags::Array_Variable);
+					if (g.report_id >= 0x10 && g.report_id <= 0x12 &&
+							(usage_count > 0 || has_usage_range || !constant)) {
+						auto &f = fields[tag-8][g.report_id-0x10];
+						++f.count;
+						f.valid = !constant && array && g.report_size == 8 &&
+							  usage_count == 1;
+						f.report_count = g.report_count;
+						f.usage = first_usage;
+					}
+				}
+				break;
+			case 10: // Collection
+				if (collection_depth == 0) {
+					if (usage_count != 1)
+						return std::nullopt;
+					in_hidpp_collection = isHIDPPUsagePage (first_usage.usage_page);
+					if (in_hidpp_collection) {
+						collections.emplace_back ().usage = first_usage;
+						for (auto &output: fields)
+							for (auto &f: output)
+								f = {};
+					}
+				}
+				++collection_depth;
+				break;
+			case 12: // End Collection
+				if (collection_depth <= 0)
+					return std::nullopt;
+				if (--collection_depth == 0 && in_hidpp_collection) {
+					auto &c = collections.back ();
+					for (auto [type, flag]: HIDPPReportTypes) {
+						if (static_cast<uint8_t> (c.usage.usage) != flag)
+							continue;
+						auto usage = HID::Usage (c.usage.usage_page, flag);
+						auto matches = [&] (const Field &f) {
+							return f.count == 1 && f.valid && f.usage == usage &&
+								f.report_count == Report::reportLength (type)-1;
+						};
+						c.has_input = matches (fields[0][type-0x10]);
+						c.has_output = matches (fields[1][type-0x10]);
+					}
+					in_hidpp_collection = false;
+				}
+				break;
+			default:
+				break;
+			}
+			usage_count = 0;
+			has_usage_range = false;
+			break;
+		case 1: // Global
+			switch (tag) {
+			case 0: // Usage Page
+				global[global_depth].usage_page = value;
+				break;
+			case 7: // Report Size
+				global[global_depth].report_size = value;
+				break;
+			case 8: // Report ID
+				global[global_depth].report_id = value;
+				break;
+			case 9: // Report Count
+				global[global_depth].report_count = value;
+				break;
+			case 10: // Push
+				if (global_depth+1 >= MaxGlobalDepth)
+					return std::nullopt;
+				global[global_depth+1] = global[global_depth];
+				++global_depth;
+				break;
+			case 11: // Pop
+				if (global_depth == 0)
+					return std::nullopt;
+				--global_depth;
+				break;
+			default:
+				break;
+			}
+			break;
+		case 2: // Local
+			switch (tag) {
+			case 0: // Usage
+				if (size == 0)
+					return std::nullopt;
+				if (usage_count++ == 0)
+					first_usage = size == 4 ?
+						HID::Usage (value) :
+						HID::Usage (global[global_depth].usage_page, value);
+				break;
+			case 1: // Usage Minimum
+			case 2: // Usage Maximum
+				has_usage_range = true;
+				break;
+			case 10: // Delimiter
+				return std::nullopt;
+			default:
+				break;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	if (in_hidpp_collection) // not closed
+		return std::nullopt;
+	return collections;
+}
+
+/*
+ * Check the HID++ collections and return the ReportInfo flags of the
+ * reports they provide.
+ */
+static int hidppReportFlags (const std::vector<HIDPPCollection> &collections)
 {
 	enum {
 		Unknown,
 		Legacy,
 		Modern,
 	} scheme = Unknown;
-	_report_info.flags = 0;
+	int flags = 0;
 	uint8_t expected_reports = 0;
-	for (const auto &collection: rdesc.collections) {
+	for (const auto &collection: collections) {
 		auto collection_usage_msb = static_cast<uint8_t> (collection.usage.usage >> 8);
 		auto collection_usage_lsb = static_cast<uint8_t> (collection.usage.usage);
 		if (collection.usage.usage_page == 0xFF43) { // Modern scheme usage page
@@ -106,7 +947,7 @@ void Dispatcher::checkReportDescriptor (const HID::ReportDescriptor &rdesc)
 				continue;
 			}
 		}
-		else if (collection.usage.usage_page == 0xFF00) { // Legacy scheme usage page
+		else { // Legacy scheme usage page
 			if (scheme == Unknown)
 				scheme = Legacy;
 			else if (scheme != Legacy) {
@@ -118,38 +959,48 @@ void Dispatcher::checkReportDescriptor (const HID::ReportDescriptor &rdesc)
 				continue;
 			}
 		}
-		else // Not a HID++ collection
-			continue;
-		for (auto [type, flag]: {
-				std::make_tuple (Report::Short, ReportInfo::HasShortReport),
-				std::make_tuple (Report::Long, ReportInfo::HasLongReport),
-				std::make_tuple (Report::VeryLong, ReportInfo::HasVeryLongReport) }) {
+		for (auto [type, flag]: HIDPPReportTypes) {
 			if (collection_usage_lsb == flag) {
-				auto usage = HID::Usage (collection.usage.usage_page, flag);
-				bool has_input = hasReport (
-						collection,
-						HID::ReportID::Type::Input,
-						static_cast<uint8_t> (type),
-						usage,
-						Report::reportLength (type)-1);
-				if (!has_input)
+				if (!collection.has_input)
 					Log::warning () << "Missing input report for report " << type << std::endl;
-				bool has_output = hasReport (
-						collection,
-						HID::ReportID::Type::Output,
-						static_cast<uint8_t> (type),
-						usage,
-						Report::reportLength(type)-1);
-				if (!has_output)
+				if (!collection.has_output)
 					Log::warning () << "Missing output report for report " << type << std::endl;
-				if (has_input && has_output)
-					_report_info.flags |= flag;
+				if (collection.has_input && collection.has_output)
+					flags |= flag;
 			}
 		}
 	}
-	if (scheme == Modern && expected_reports != _report_info.flags)
+	if (scheme == Modern && expected_reports != flags)
 		Log::warning () << "Expected HID++ reports were not found." << std::endl;
+	return flags;
+}
+
+void Dispatcher::checkReportDescriptor (const HID::ReportDescriptor &rdesc)
+{
+	_report_info.flags = hidppReportFlags (findHIDPPCollections (rdesc));
 	if (_report_info.flags == 0)
 		throw Dispatcher::NoHIDPPReportException ();
 }
 
+void Dispatcher::checkReportDescriptor (const HID::RawDevice &dev)
+{
+	const auto &raw = dev.rawReportDescriptor ();
+	if (!raw.empty ()) {
+		if (auto collections = scanHIDPPCollections (raw.data (), raw.size ())) {
+			_report_info.flags = hidppReportFlags (*collections);
+			if (_report_info.flags == 0)
+				throw Dispatcher::NoHIDPPReportException ();
+			return;
+		}
+	}
+	checkReportDescriptor (dev.getReportDescriptor ());
+}
+
+int Dispatcher::reportFlags (const uint8_t *descriptor, std::size_t length)
+{
+	if (auto collections = scanHIDPPCollections (descriptor, length))
+		return hidppReportFlags (*collections);
+	return hidppReportFlags (findHIDPPCollections (
+			*HID::ReportDescriptor::fromRawDataCached (descriptor, length)));
+}
+
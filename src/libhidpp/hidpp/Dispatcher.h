@@ -19,21 +19,48 @@
 #ifndef LIBHIDPP_HIDPP_DISPATCHER_H
 #define LIBHIDPP_HIDPP_DISPATCHER_H
 
+#include <hidpp/CommandResult.h>
 #include <hidpp/Report.h>
+#include <hidpp/ReportPool.h>
+#include <misc/MemoryAccounting.h>
+#include <array>
 #include <memory>
-#include <map>
+#include <vector>
 #include <functional>
 #include <optional>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <iosfwd>
+#include <list>
+#include <tuple>
+
+namespace HID
+{
+class RawDevice;
+}
 
 namespace HIDPP
 {
 
+class Subscription;
+
 class Dispatcher
 {
 public:
 	typedef std::function<bool (const Report &)> event_handler;
-	typedef std::multimap<std::tuple<DeviceIndex, uint8_t>, event_handler> listener_container;
-	typedef listener_container::iterator listener_iterator;
+	struct Listener;
+	/**
+	 * Handle identifying a registered event handler.
+	 */
+	typedef std::shared_ptr<Listener> listener_iterator;
+	/**
+	 * Listeners for a single (device index, sub ID) pair, in registration
+	 * order. Lists are immutable snapshots, so events are dispatched
+	 * without locking while handlers are registered or unregistered.
+	 */
+	typedef std::vector<listener_iterator> listener_list;
 
 	/**
 	 * Exception when no HID++ report is found in the report descriptor.
@@ -78,6 +105,7 @@ public:
 		virtual Report get (int timeout) = 0;
 	};
 
+	Dispatcher ();
 	virtual ~Dispatcher ();
 
 	virtual uint16_t vendorID () const = 0;
@@ -97,6 +125,125 @@ public:
 	 */
 	virtual std::unique_ptr<AsyncReport> sendCommand (Report &&report) = 0;
 
+	/**
+	 * Completion handler for commands sent with a callback.
+	 *
+	 * \p response is the answer report, or null if the command failed
+	 * with \p error.
+	 */
+	typedef std::function<void (const Report *response, std::exception_ptr error)> completion_handler;
+
+	/**
+	 * Sends the report expecting a matching answer and calls \p handler
+	 * when the answer or an error is received.
+	 *
+	 * Asynchronous dispatchers call \p handler from their reading thread
+	 * and this method returns immediately. The default implementation
+	 * waits for the answer and calls \p handler before returning.
+	 *
+	 * If no answer is received in \p timeout milliseconds, \p handler is
+	 * called with a TimeoutError. A negative \p timeout waits forever.
+	 *
+	 * \throws std::system_error if the report cannot be sent
+	 */
+	virtual void sendCommand (Report &&report, completion_handler &&handler, int timeout = -1);
+
+	/**
+	 * Handler for commands sent with \ref trySendCommand.
+	 */
+	typedef std::function<void (CommandResult &&result)> result_handler;
+
+	/**
+	 * Same as sendCommand(Report &&, completion_handler &&, int), but
+	 * every outcome, including a failure to send the report, is passed
+	 * to \p handler as a CommandResult and nothing is thrown.
+	 *
+	 * DispatcherThread (and the dispatchers built on it) report HID++
+	 * errors and timeouts without creating any exception, this is meant
+	 * for probing and polling where they are common. The default
+	 * implementation classifies the exceptions of sendCommand.
+	 */
+	virtual void trySendCommand (Report &&report, result_handler &&handler, int timeout = -1);
+	/**
+	 * Send the report and wait for its CommandResult.
+	 */
+	virtual CommandResult trySendCommand (Report &&report, int timeout = -1);
+
+	/**
+	 * Scheduling class of commands, for dispatchers that queue them (see
+	 * DispatcherThread::setInFlightWindow). Queued interactive commands
+	 * are sent before queued bulk commands.
+	 */
+	enum class Priority
+	{
+		Interactive, ///< Default, for queries and setting changes
+		Bulk, ///< Long sequences of commands such as memory transfers
+	};
+	static constexpr std::size_t PriorityCount = 2;
+
+	/**
+	 * Set the priority of the commands sent by the current thread while
+	 * the scope exists.
+	 */
+	class PriorityScope
+	{
+	public:
+		PriorityScope (Priority priority) noexcept;
+		~PriorityScope ();
+
+		PriorityScope (const PriorityScope &) = delete;
+		PriorityScope &operator= (const PriorityScope &) = delete;
+
+	private:
+		Priority _previous;
+	};
+
+	/**
+	 * Priority of the commands sent by the current thread.
+	 */
+	static Priority currentPriority () noexcept;
+
+	/**
+	 * Mark the commands sent by the current thread while the scope
+	 * exists as read-only: they do not change the device state, so
+	 * dispatchers coalescing reads (see
+	 * DispatcherThread::setReadCoalescing) may answer them with the
+	 * answer of an identical command already in flight.
+	 */
+	class ReadOnlyScope
+	{
+	public:
+		ReadOnlyScope () noexcept;
+		~ReadOnlyScope ();
+
+		ReadOnlyScope (const ReadOnlyScope &) = delete;
+		ReadOnlyScope &operator= (const ReadOnlyScope &) = delete;
+
+	private:
+		bool _previous;
+	};
+
+	/**
+	 * Check if the commands sent by the current thread are read-only.
+	 */
+	static bool currentReadOnly () noexcept;
+
+	/**
+	 * Highest software ID usable in HID++ 2.0 requests.
+	 */
+	static constexpr unsigned int MaxSoftwareID = 15;
+
+	/**
+	 * Get a software ID for a new HID++ 2.0 request.
+	 *
+	 * Software IDs rotate through 1 to \ref MaxSoftwareID (0 is used
+	 * by notifications), so that concurrent requests on the same feature
+	 * and function can be told apart when their answers arrive. At most
+	 * \ref MaxSoftwareID requests should be in flight for a given device
+	 * index.
+	 */
+	unsigned int nextSoftwareID () noexcept;
+
 	/**
 	 * Get exactly one notification matching \p index and \p sub_id.
 	 *
@@ -104,22 +251,102 @@ public:
 	 */
 	virtual std::unique_ptr<AsyncReport> getNotification (DeviceIndex index, uint8_t sub_id) = 0;
 
+	/**
+	 * Queue every notification matching \p index and \p sub_id until
+	 * the returned subscription is destroyed, keeping at most
+	 * \p capacity of them.
+	 *
+	 * The default implementation relies on a reading thread calling
+	 * the event handlers.
+	 */
+	virtual std::unique_ptr<Subscription> subscribe (DeviceIndex index, uint8_t sub_id,
+							 std::size_t capacity = DefaultSubscriptionCapacity);
+	static constexpr std::size_t DefaultSubscriptionCapacity = 64;
+
 	/**
 	 * Add a listener function for events matching \p index and \p sub_id.
 	 *
+	 * \p index must be one of the values of DeviceIndex.
+	 *
 	 * \param index		Event device index
 	 * \param sub_id	Event sub_id (or feature index)
 	 * \param handler	Callback for handling the event
 	 *
-	 * \returns The listener iterator used for unregistering.
+	 * Handlers are called from the thread reading the reports without the
+	 * listener table locked, they may register or unregister handlers
+	 * themselves. Each call holds a lock of its own handler:
+	 * \ref unregisterEventHandler from another thread waits for a running
+	 * handler to return, so a handler must not wait on a thread that may
+	 * unregister it, or both deadlock.
+	 * Returning \c false from \p handler unregisters it.
+	 * Report::receiveTime tells when the event was read from the device.
+	 *
+	 * \returns The listener handle used for unregistering.
+	 *
+	 * \throws std::invalid_argument if \p index is not a valid device index.
 	 */
 	virtual listener_iterator registerEventHandler (DeviceIndex index, uint8_t sub_id, const event_handler &handler);
 
 	/**
-	 * Unregister the event handler given by the iterator.
+	 * Unregister the event handler given by the handle.
+	 *
+	 * When called from another thread, it waits for the current call of
+	 * the handler to finish, so that the handler is never called after
+	 * this returns. The handler must then not be waiting on the calling
+	 * thread.
 	 */
 	virtual void unregisterEventHandler (listener_iterator it);
 
+	/**
+	 * Keep \p report beyond the call of an event handler, without
+	 * copying it for each consumer.
+	 *
+	 * When \p report is the event being passed to the handlers on this
+	 * thread, every handler sharing it gets the same buffer. Other
+	 * reports are copied in a new buffer. Buffers come from a pool owned
+	 * by the dispatcher and are reused once released.
+	 */
+	SharedReport shareEvent (const Report &report);
+
+	/**
+	 * How received reports are told apart from answers and events, per
+	 * device index and sub ID (or feature index).
+	 */
+	enum class ReportRoute: uint8_t
+	{
+		/**
+		 * Not known: a report not matching any command is an event if
+		 * its software ID is 0 or its sub ID is below 0x80.
+		 */
+		Unknown,
+		Answer, ///< HID++ 1.0 register access, only matched with commands
+		Feature, ///< HID++ 2.0 feature, an event if its software ID is 0
+		Notification, ///< HID++ 1.0 notification, only passed to event handlers
+	};
+	/**
+	 * Reset the routes of \p index for a device using HID++ \p major
+	 * version (see HIDPP::Device::protocolVersion).
+	 *
+	 * HID++ 1.0 sub IDs are notifications below 0x80 and register
+	 * answers above. For HID++ 2.0, only the root feature is known until
+	 * \ref addFeatureIndex or \ref setFeatureCount are called.
+	 *
+	 * HIDPP::Device calls it when it checks the protocol version, and
+	 * HIDPP20::Device adds the feature indices it finds.
+	 */
+	void setDeviceProtocol (DeviceIndex index, unsigned int major);
+	/**
+	 * Route \p feature_index of a HID++ 2.0 device as a feature.
+	 */
+	void addFeatureIndex (DeviceIndex index, uint8_t feature_index);
+	/**
+	 * Route the \p count first indices of a HID++ 2.0 device as features,
+	 * and the other sub IDs below 0x80 as notifications (e.g. from its
+	 * receiver).
+	 */
+	void setFeatureCount (DeviceIndex index, unsigned int count);
+	ReportRoute reportRoute (DeviceIndex index, uint8_t sub_id) const noexcept;
+
 	struct ReportInfo {
 		enum Flags { // flags are also the usage for collections and reports
 			HasShortReport = 1<<0,
@@ -143,16 +370,310 @@ public:
 					return type;
 			return std::nullopt;
 		}
+
+		/**
+		 * Length of the longest HID++ report declared by the device,
+		 * no valid HID++ report can be longer.
+		 */
+		std::size_t maxReportLength () const noexcept {
+			for (auto type: { Report::VeryLong, Report::Long, Report::Short })
+				if (hasReport (type))
+					return Report::reportLength (type);
+			return MaxReportLength;
+		}
 	};
 	ReportInfo reportInfo () const noexcept { return _report_info; }
+	/**
+	 * Compute the ReportInfo flags from a raw report descriptor without
+	 * opening the device, e.g. for HID::DeviceMonitor::Filter.
+	 *
+	 * \returns 0 if the descriptor has no usable HID++ report.
+	 *
+	 * \throws std::runtime_error if the descriptor is invalid.
+	 */
+	static int reportFlags (const uint8_t *descriptor, std::size_t length);
+
+	/**
+	 * \name Adaptive timeouts
+	 *
+	 * The dispatcher times the answers of each device index and keeps
+	 * a smoothed round-trip time and its mean deviation (as TCP does,
+	 * RFC 6298). A device index is considered asleep after a command to
+	 * it timed out, until any report is received from it.
+	 *
+	 * The link of wireless devices is followed from the receiver
+	 * HIDPP10::DeviceConnection notifications: a device is unlinked
+	 * after a notification with the "link not established" flag, until
+	 * the link is established again or any report is received from the
+	 * device (e.g. the HIDPP20::IWirelessDeviceStatus broadcast sent on
+	 * reconnection).
+	 *
+	 * \{
+	 */
+
+	/**
+	 * Shortest timeout returned by \ref commandTimeout for an awake device.
+	 */
+	static constexpr int MinCommandTimeout = 20;
+	/**
+	 * Timeout used for probing a device that is likely asleep.
+	 */
+	static constexpr int AsleepCommandTimeout = 100;
+
+	/**
+	 * Timeout in milliseconds for a command to \p index.
+	 *
+	 * Once answers were timed, it is the smoothed round-trip time plus
+	 * four times its deviation, between \ref MinCommandTimeout and
+	 * \p default_timeout (if not negative). It is \ref
+	 * AsleepCommandTimeout if the device is asleep, or if it was never
+	 * timed and another wireless device on this dispatcher is asleep.
+	 * Otherwise, it is \p default_timeout.
+	 *
+	 * It is also \p default_timeout for an unlinked device: the
+	 * receiver answers commands to it at once with an error, or
+	 * dispatchers parking commands (see
+	 * DispatcherThread::setCommandParking) send them when it
+	 * reconnects.
+	 */
+	int commandTimeout (DeviceIndex index, int default_timeout) const;
+	/**
+	 * Check if the last command to \p index timed out.
+	 */
+	bool isAsleep (DeviceIndex index) const;
+	/**
+	 * Check if the receiver did not report \p index as unlinked.
+	 */
+	bool isLinked (DeviceIndex index) const;
+
+	/**
+	 * Called with the index of every report received (answers, errors
+	 * and events) and of receiver notifications telling a wireless
+	 * device linked, i.e. whenever a device is known to be awake.
+	 *
+	 * Handlers are called from the thread reading the reports with a
+	 * lock held: they must be quick and must not register or
+	 * unregister activity handlers.
+	 */
+	typedef std::function<void (DeviceIndex index)> activity_handler;
+	typedef std::list<activity_handler>::iterator activity_iterator;
+	activity_iterator registerActivityHandler (const activity_handler &handler);
+	/**
+	 * The handler is not called anymore once this returns.
+	 */
+	void unregisterActivityHandler (activity_iterator it);
+
+	/**\}*/
+
+	/**
+	 * \name Statistics
+	 *
+	 * Counters kept by the dispatcher for monitoring devices without
+	 * logging every report.
+	 *
+	 * \{
+	 */
+
+	/**
+	 * Distribution of round-trip times.
+	 */
+	struct LatencyHistogram
+	{
+		/**
+		 * Bucket \c i counts times below \ref bucketLimit (i), the last
+		 * bucket counts all longer times.
+		 */
+		static constexpr std::size_t BucketCount = 12;
+		/**
+		 * Upper limit of bucket \p i: 250µs times 2 to the power of \p i.
+		 */
+		static std::chrono::microseconds bucketLimit (std::size_t i) noexcept;
+
+		std::array<uint64_t, BucketCount> buckets = {};
+		uint64_t count = 0;
+		std::chrono::microseconds total {0}, max {0};
+
+		void add (std::chrono::steady_clock::duration rtt) noexcept;
+	};
+
+	struct Statistics
+	{
+		/**
+		 * Round-trip times of answered commands by device index, sub ID
+		 * (or feature index) and address. For HID++ 2.0 commands (sub ID
+		 * below 0x80), the address is only the function: software IDs
+		 * are masked.
+		 */
+		std::map<std::tuple<DeviceIndex, uint8_t, uint8_t>, LatencyHistogram> latency;
+		std::size_t commands_in_flight = 0; ///< Sent and waiting for their answer
+		std::size_t commands_queued = 0; ///< Waiting to be sent
+		uint64_t coalesced_reads = 0; ///< Answered with the answer of an identical read
+		uint64_t timeouts = 0;
+		std::map<DeviceIndex, uint64_t> device_timeouts; ///< Timeouts by device index
+		uint64_t unmatched_answers = 0; ///< Answers and errors not matching any command
+		/**
+		 * Events received by device index and sub ID, with or without
+		 * listeners.
+		 */
+		std::map<std::pair<DeviceIndex, uint8_t>, uint64_t> events;
+		uint64_t reader_wakeups = 0; ///< Returns from blocking reads
+		unsigned int listeners = 0; ///< Registered event handlers
+		/**
+		 * Approximate number of bytes held by the listener tables and,
+		 * for dispatchers with queues (e.g. DispatcherThread), the
+		 * command containers.
+		 */
+		std::size_t memory = 0;
+
+		/**
+		 * Write the statistics in a human-readable multi-line format.
+		 */
+		void print (std::ostream &out) const;
+	};
+
+	/**
+	 * Get a snapshot of the statistics.
+	 */
+	virtual Statistics statistics () const;
+	/**
+	 * Reset counters and histograms.
+	 */
+	void resetStatistics ();
+	/**
+	 * Print the statistics in the "dispatcher" info log every \p interval
+	 * while reports are received. A zero interval disables the dump.
+	 */
+	void setStatisticsDumpInterval (std::chrono::milliseconds interval);
+
+	/**\}*/
 
 protected:
 	void processEvent (const Report &);
 	void checkReportDescriptor (const HID::ReportDescriptor &report_desc);
+	/**
+	 * Same as checkReportDescriptor(const HID::ReportDescriptor &), but
+	 * the raw descriptor, when \p dev has one, is only scanned for the
+	 * HID++ collections without building the full parsed descriptor.
+	 */
+	void checkReportDescriptor (const HID::RawDevice &dev);
+	/**
+	 * Remove the listener from the table without waiting for a concurrent
+	 * call of its handler.
+	 */
+	void removeEventHandler (const listener_iterator &it);
+	/**
+	 * Number of registered event handlers, including notifications.
+	 */
+	unsigned int eventHandlerCount () const noexcept;
+
+	/**
+	 * Record the time between sending a command (\p index, \p sub_id and
+	 * \p address) and receiving its answer (or error).
+	 */
+	void recordRoundTrip (DeviceIndex index, uint8_t sub_id, uint8_t address,
+			      std::chrono::steady_clock::duration rtt);
+	/**
+	 * Record that a command to \p index was not answered in time.
+	 */
+	void recordTimeout (DeviceIndex index);
+	/**
+	 * Record that a report was received from \p index, the device is
+	 * awake and linked.
+	 */
+	void recordActivity (DeviceIndex index);
+	/**
+	 * Check if \p report is a receiver HIDPP10::DeviceConnection
+	 * notification and record the link status it carries.
+	 *
+	 * \returns the link status if \p report is a connection
+	 * notification.
+	 */
+	std::optional<bool> recordConnection (const Report &report);
+	/**
+	 * Record that an answer or error did not match any pending command.
+	 */
+	void recordUnmatchedAnswer () noexcept;
+	/**
+	 * Record that the reading thread returned from waiting for reports.
+	 */
+	void recordReaderWakeup () noexcept;
+
+	static constexpr std::size_t DeviceSlotCount = 8;
+	/**
+	 * Index in per-device tables: 0 to 6 for corded and wireless devices
+	 * and 7 for DefaultDevice.
+	 */
+	static std::optional<std::size_t> deviceSlot (DeviceIndex index) noexcept;
+	/**
+	 * Device index of a slot returned by \ref deviceSlot.
+	 */
+	static DeviceIndex slotDeviceIndex (std::size_t slot) noexcept;
 
 private:
-	listener_container _listeners;
+	/**
+	 * Listener lists are directly indexed by device index (0 to 6, and
+	 * 7 for DefaultDevice) and sub ID. Empty slots are null.
+	 */
+	static constexpr std::size_t ListenerSlotCount = DeviceSlotCount*256;
+	static std::optional<std::size_t> listenerSlot (DeviceIndex index, uint8_t sub_id) noexcept;
+	void updateListenerBytes (const listener_list *old_list, const listener_list *new_list); // _listener_mutex must be held
+
+	std::mutex _listener_mutex; // serializes listener table updates
+	std::vector<std::shared_ptr<const listener_list>> _listeners;
+	std::atomic<unsigned int> _listener_count;
+	std::atomic<std::size_t> _listener_bytes;
+	MemoryAccounting::Account _listener_account; // protected by _listener_mutex
+	ReportPool _event_pool;
 	ReportInfo _report_info;
+	std::atomic<unsigned int> _software_id;
+
+	// Answers of a device are normally recorded by a single reading
+	// thread, concurrent updates of the estimate would only lose a sample.
+	struct Latency
+	{
+		std::atomic<double> srtt {0}, rttvar {0}; // in milliseconds
+		std::atomic<unsigned int> samples {0};
+		std::atomic<bool> asleep {false};
+		std::atomic<bool> unlinked {false};
+	};
+	std::array<Latency, DeviceSlotCount> _latency;
+
+	void notifyActivity (DeviceIndex index);
+	std::mutex _activity_mutex;
+	std::list<activity_handler> _activity_handlers;
+	std::atomic<bool> _has_activity_handlers; // read without _activity_mutex for every report
+
+	/**
+	 * LatencyHistogram updated without locking.
+	 */
+	struct AtomicHistogram
+	{
+		std::array<std::atomic<uint64_t>, LatencyHistogram::BucketCount> buckets {};
+		std::atomic<uint64_t> count {0}, total {0}, max {0}; // in microseconds
+
+		void add (std::chrono::steady_clock::duration rtt) noexcept;
+		LatencyHistogram load () const noexcept;
+		void reset () noexcept;
+	};
+	/**
+	 * Histograms of a device index and sub ID, by address: functions
+	 * for HID++ 2.0 (software IDs are masked) and registers for HID++ 1.0.
+	 */
+	static constexpr std::size_t histogramCount (uint8_t sub_id) noexcept
+	{
+		return sub_id < 0x80 ? 16 : 256;
+	}
+	// Indexed by listener slot, each allocated on the first answer and
+	// kept until the dispatcher is destroyed.
+	std::vector<std::atomic<AtomicHistogram *>> _histograms;
+	std::atomic<uint64_t> _timeouts, _unmatched_answers, _reader_wakeups;
+	std::vector<std::atomic<uint64_t>> _device_timeouts; // indexed by device slot
+	std::vector<std::atomic<uint64_t>> _event_counts; // indexed by listener slot
+	std::vector<std::atomic<ReportRoute>> _report_routes; // indexed by listener slot
+	std::atomic<bool> _dump_enabled; // read without _dump_mutex for every report
+	std::mutex _dump_mutex;
+	std::chrono::steady_clock::duration _dump_interval;
+	std::chrono::steady_clock::time_point _next_dump;
 };
 
 }
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DispatcherPool.h"
+
+#include <misc/Log.h>
+
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace HIDPP;
+
+DispatcherPool::DispatcherPool (unsigned int thread_count, unsigned int queued_reads):
+	_thread_count (thread_count == 0 ? 1 : thread_count),
+	_queued_reads (queued_reads),
+	_stopping (false)
+{
+}
+
+DispatcherPool::~DispatcherPool ()
+{
+	while (!_devices.empty ())
+		removeDevice (_devices.begin ()->first);
+}
+
+Dispatcher *DispatcherPool::addDevice (const char *path)
+{
+	auto dispatcher = std::make_shared<DispatcherThread> (path);
+	DispatcherThread *d = dispatcher.get ();
+	d->_wakeup = [this] () { _port.wakeup (); };
+	std::unique_lock<std::mutex> lock (_devices_mutex);
+	_port.add (d->hidraw (),
+		   [d] (const uint8_t *report, std::size_t length) {
+			d->recordReaderWakeup ();
+			d->processRawReport (report, length, std::chrono::steady_clock::now ());
+		   },
+		   [d] (std::exception_ptr error) {
+			d->_exception = error;
+			d->terminate ();
+		   },
+		   MaxReportLength, _queued_reads);
+	_devices.emplace (d, std::move (dispatcher));
+	return d;
+}
+
+void DispatcherPool::removeDevice (Dispatcher *dispatcher)
+{
+	std::shared_ptr<DispatcherThread> d;
+	{
+		std::unique_lock<std::mutex> lock (_devices_mutex);
+		auto it = _devices.find (dispatcher);
+		if (it == _devices.end ())
+			throw std::invalid_argument ("Dispatcher is not served by this pool");
+		d = std::move (it->second);
+		_devices.erase (it);
+	}
+	_port.remove (d->hidraw ());
+	if (!d->_stopped)
+		d->_exception = std::make_exception_ptr (DispatcherThread::NotRunning ());
+	d->terminate ();
+}
+
+int DispatcherPool::nextTimeout ()
+{
+	// Expired command handlers are called without _devices_mutex held,
+	// the references keep removed devices alive until they return.
+	std::vector<std::shared_ptr<DispatcherThread>> devices;
+	{
+		std::unique_lock<std::mutex> lock (_devices_mutex);
+		devices.reserve (_devices.size ());
+		for (const auto &[ptr, d]: _devices)
+			devices.push_back (d);
+	}
+	int timeout = -1;
+	for (const auto &d: devices) {
+		int t = d->expireCommands ();
+		if (t >= 0 && (timeout < 0 || t < timeout))
+			timeout = t;
+	}
+	return timeout;
+}
+
+void DispatcherPool::serve ()
+{
+	while (!_stopping)
+		_port.wait (nextTimeout ());
+}
+
+void DispatcherPool::run ()
+{
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto worker = [this, &error, &error_mutex] () {
+		try {
+			serve ();
+		}
+		catch (std::exception &e) {
+			Log::error () << "Dispatcher pool thread failed: " << e.what () << std::endl;
+			std::unique_lock<std::mutex> lock (error_mutex);
+			if (!error)
+				error = std::current_exception ();
+			stop ();
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < _thread_count; ++i)
+		threads.emplace_back (worker);
+	worker ();
+	for (auto &thread: threads)
+		thread.join ();
+	_stopping = false;
+	if (error)
+		std::rethrow_exception (error);
+}
+
+void DispatcherPool::stop ()
+{
+	_stopping = true;
+	for (unsigned int i = 0; i < _thread_count; ++i)
+		_port.wakeup ();
+}
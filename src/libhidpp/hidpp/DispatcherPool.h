@@ -0,0 +1,101 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_DISPATCHER_POOL_H
+#define LIBHIDPP_HIDPP_DISPATCHER_POOL_H
+
+#include <hidpp/DispatcherThread.h>
+#include <hid/CompletionPort.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace HIDPP
+{
+
+/**
+ * Serves several HID++ devices from a small pool of threads.
+ *
+ * This is the windows counterpart of DispatcherReactor: each device added
+ * to the pool gets its own Dispatcher with the same semantics as a
+ * DispatcherThread, and the reports of every device are read through a
+ * single I/O completion port (see HID::CompletionPort).
+ *
+ * Reports of one device are processed by one thread at a time, in order.
+ * Command handlers, listeners and timeouts run on the pool threads and
+ * must not call \ref removeDevice, which waits for the pool threads.
+ *
+ * Only available with the windows HID backend.
+ */
+class DispatcherPool
+{
+public:
+	/**
+	 * \param thread_count	Number of threads serving the devices in \ref run.
+	 * \param queued_reads	Number of reads kept queued on each device handle.
+	 */
+	DispatcherPool (unsigned int thread_count = 2, unsigned int queued_reads = 4);
+	~DispatcherPool ();
+
+	/**
+	 * Open the device at \p path and serve it from this pool.
+	 *
+	 * The returned dispatcher is owned by the pool and stays valid
+	 * until \ref removeDevice is called. If reading the device fails,
+	 * pending commands fail and later commands throw the read error.
+	 *
+	 * Can be called from any thread.
+	 *
+	 * \throws Dispatcher::NoHIDPPReportException, std::system_error
+	 */
+	Dispatcher *addDevice (const char *path);
+	/**
+	 * Stop serving and destroy the dispatcher returned by \ref addDevice.
+	 *
+	 * Pending commands fail with DispatcherThread::NotRunning. Can be
+	 * called from any thread except the pool threads.
+	 */
+	void removeDevice (Dispatcher *dispatcher);
+
+	/**
+	 * Serve the devices with the calling thread and thread_count - 1
+	 * other threads until \ref stop is called.
+	 *
+	 * Command timeouts of every device are also handled by these threads.
+	 */
+	void run ();
+	/**
+	 * Make \ref run return. Can be called from any thread.
+	 */
+	void stop ();
+
+private:
+	void serve ();
+	int nextTimeout ();
+
+	HID::CompletionPort _port;
+	unsigned int _thread_count, _queued_reads;
+	std::atomic<bool> _stopping;
+	std::mutex _devices_mutex;
+	std::map<Dispatcher *, std::shared_ptr<DispatcherThread>> _devices;
+};
+
+}
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DispatcherReactor.h"
+
+#include <misc/Log.h>
+#ifdef LIBHIDPP_IO_URING
+#include <hidpp/IoUring.h>
+#endif
+
+#include <array>
+#include <stdexcept>
+#include <system_error>
+
+extern "C" {
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+}
+
+using namespace HIDPP;
+
+#ifdef LIBHIDPP_IO_URING
+struct DispatcherReactor::IoUringLoop
+{
+	static constexpr unsigned int Entries = 64;
+
+	// The low bits of the user data tell the kind of request, the others
+	// are the id of the watch.
+	enum Kind: uint64_t
+	{
+		Poll,
+		Cancel,
+	};
+	static constexpr unsigned int KindBits = 1;
+
+	static uint64_t userData (uint64_t id, Kind kind)
+	{
+		return id << KindBits | kind;
+	}
+
+	IoUring ring;
+	uint64_t next_id;
+	std::map<uint64_t, int> polls;
+	std::map<int, uint64_t> watch_polls;
+
+	IoUringLoop ():
+		ring (Entries),
+		next_id (0)
+	{
+	}
+};
+#else
+struct DispatcherReactor::IoUringLoop
+{
+};
+#endif
+
+DispatcherReactor::DispatcherReactor (Backend backend):
+	_epoll_fd (-1),
+	_stopping (false)
+{
+	_event_fd = eventfd (0, EFD_CLOEXEC);
+	if (_event_fd == -1)
+		throw std::system_error (errno, std::system_category (), "eventfd");
+	if (backend == Backend::IoUring) {
+#ifdef LIBHIDPP_IO_URING
+		try {
+			_uring = std::make_unique<IoUringLoop> ();
+		}
+		catch (...) {
+			::close (_event_fd);
+			throw;
+		}
+		_uring->polls.emplace (_uring->next_id, _event_fd);
+		_uring->ring.preparePoll (_event_fd, IoUringLoop::userData (_uring->next_id++, IoUringLoop::Poll));
+		return;
+#else
+		::close (_event_fd);
+		throw std::system_error (ENOSYS, std::system_category (), "libhidpp built without io_uring");
+#endif
+	}
+	_epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	if (_epoll_fd == -1) {
+		int err = errno;
+		::close (_event_fd);
+		throw std::system_error (err, std::system_category (), "epoll_create1");
+	}
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = _event_fd;
+	if (-1 == epoll_ctl (_epoll_fd, EPOLL_CTL_ADD, _event_fd, &event)) {
+		int err = errno;
+		::close (_event_fd);
+		::close (_epoll_fd);
+		throw std::system_error (err, std::system_category (), "epoll_ctl");
+	}
+}
+
+DispatcherReactor::~DispatcherReactor ()
+{
+	while (!_devices.empty ())
+		removeDevice (_devices.begin ()->first);
+#ifdef LIBHIDPP_IO_URING
+	_uring.reset ();
+#endif
+	::close (_event_fd);
+	if (_epoll_fd != -1)
+		::close (_epoll_fd);
+}
+
+Dispatcher *DispatcherReactor::addDevice (const char *path)
+{
+	auto dispatcher = std::make_unique<DispatcherThread> (path);
+	DispatcherThread *d = dispatcher.get ();
+	d->_wakeup = [this] () { wakeup (); };
+	// With io_uring too, the descriptor stays non-blocking and is only
+	// read once the ring polled it: a read request on a blocking hidraw
+	// node would hold an io_uring worker thread per device.
+	addWatch (d->hidraw ().fileDescriptor (), [this, d] () {
+		if (!d->readNextReport (0)) {
+			removeWatch (d->hidraw ().fileDescriptor ());
+			d->terminate ();
+		}
+	});
+	_devices.emplace (d, std::move (dispatcher));
+	return d;
+}
+
+void DispatcherReactor::removeDevice (Dispatcher *dispatcher)
+{
+	auto it = _devices.find (dispatcher);
+	if (it == _devices.end ())
+		throw std::invalid_argument ("Dispatcher is not served by this reactor");
+	auto &d = it->second;
+	int fd = d->hidraw ().fileDescriptor ();
+	if (_watches.find (fd) != _watches.end ())
+		removeWatch (fd);
+	d->_exception = std::make_exception_ptr (DispatcherThread::NotRunning ());
+	d->terminate ();
+	_devices.erase (it);
+}
+
+void DispatcherReactor::addWatch (int fd, const std::function<void ()> &handler)
+{
+#ifdef LIBHIDPP_IO_URING
+	if (_uring) {
+		if (_watches.find (fd) != _watches.end ())
+			throw std::system_error (EEXIST, std::system_category (), "addWatch");
+		uint64_t id = _uring->next_id++;
+		_uring->ring.preparePoll (fd, IoUringLoop::userData (id, IoUringLoop::Poll));
+		_uring->polls.emplace (id, fd);
+		_uring->watch_polls.emplace (fd, id);
+		_watches[fd] = handler;
+		return;
+	}
+#endif
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (-1 == epoll_ctl (_epoll_fd, EPOLL_CTL_ADD, fd, &event))
+		throw std::system_error (errno, std::system_category (), "epoll_ctl");
+	_watches[fd] = handler;
+}
+
+void DispatcherReactor::removeWatch (int fd)
+{
+#ifdef LIBHIDPP_IO_URING
+	if (_uring) {
+		auto it = _uring->watch_polls.find (fd);
+		if (it == _uring->watch_polls.end ())
+			throw std::system_error (ENOENT, std::system_category (), "removeWatch");
+		// The poll may have already completed, its completion is
+		// ignored once its id is unknown.
+		_uring->ring.prepareCancel (IoUringLoop::userData (it->second, IoUringLoop::Poll),
+					    IoUringLoop::userData (0, IoUringLoop::Cancel));
+		_uring->polls.erase (it->second);
+		_uring->watch_polls.erase (it);
+		_watches.erase (fd);
+		return;
+	}
+#endif
+	if (-1 == epoll_ctl (_epoll_fd, EPOLL_CTL_DEL, fd, nullptr))
+		throw std::system_error (errno, std::system_category (), "epoll_ctl");
+	_watches.erase (fd);
+}
+
+void DispatcherReactor::run ()
+{
+#ifdef LIBHIDPP_IO_URING
+	if (_uring) {
+		runIoUring ();
+		return;
+	}
+#endif
+	runEpoll ();
+}
+
+int DispatcherReactor::nextTimeout ()
+{
+	int timeout = -1;
+	for (auto &[ptr, d]: _devices) {
+		int t = d->expireCommands ();
+		if (t >= 0 && (timeout < 0 || t < timeout))
+			timeout = t;
+	}
+	return timeout;
+}
+
+void DispatcherReactor::runEpoll ()
+{
+	std::array<struct epoll_event, 16> events;
+	bool stopped = false;
+	while (!stopped) {
+		int count = epoll_wait (_epoll_fd, events.data (), events.size (), nextTimeout ());
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::system_error (errno, std::system_category (), "epoll_wait");
+		}
+		for (int i = 0; i < count; ++i) {
+			int fd = events[i].data.fd;
+			if (fd == _event_fd) {
+				uint64_t value;
+				if (-1 == read (_event_fd, &value, sizeof (value)))
+					throw std::system_error (errno, std::system_category (), "read eventfd");
+				if (_stopping.exchange (false))
+					stopped = true;
+				continue;
+			}
+			auto it = _watches.find (fd);
+			if (it == _watches.end ())
+				continue; // removed by a previous handler
+			auto handler = it->second; // the handler may remove its own watch
+			handler ();
+		}
+	}
+}
+
+void DispatcherReactor::stop ()
+{
+	_stopping = true;
+	wakeup ();
+}
+
+void DispatcherReactor::wakeup ()
+{
+	uint64_t value = 1;
+	if (-1 == write (_event_fd, &value, sizeof (value)))
+		throw std::system_error (errno, std::system_category (), "write eventfd");
+}
+
+#ifdef LIBHIDPP_IO_URING
+void DispatcherReactor::runIoUring ()
+{
+	constexpr uint64_t KindMask = (1 << IoUringLoop::KindBits) - 1;
+	bool stopped = false;
+	auto complete = [this, &stopped] (uint64_t user_data, int) {
+		uint64_t id = user_data >> IoUringLoop::KindBits;
+		switch (user_data & KindMask) {
+		case IoUringLoop::Poll: {
+			auto it = _uring->polls.find (id);
+			if (it == _uring->polls.end ())
+				return; // removed watch
+			int fd = it->second;
+			if (fd == _event_fd) {
+				uint64_t value;
+				if (-1 == read (_event_fd, &value, sizeof (value)))
+					throw std::system_error (errno, std::system_category (), "read eventfd");
+				_uring->ring.preparePoll (fd, user_data);
+				if (_stopping.exchange (false))
+					stopped = true;
+				return;
+			}
+			auto handler = _watches.at (fd); // the handler may remove its own watch
+			handler ();
+			if (_uring->polls.find (id) != _uring->polls.end ())
+				_uring->ring.preparePoll (fd, user_data);
+			return;
+		}
+		default: // cancellations
+			return;
+		}
+	};
+	while (!stopped)
+		_uring->ring.wait (nextTimeout (), complete);
+}
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_DISPATCHER_REACTOR_H
+#define LIBHIDPP_HIDPP_DISPATCHER_REACTOR_H
+
+#include <hidpp/DispatcherThread.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+
+namespace HIDPP
+{
+
+/**
+ * Serves several HID++ devices from a single thread.
+ *
+ * Each device added to the reactor gets its own Dispatcher that can be
+ * used from any thread, with the same semantics as a DispatcherThread.
+ * Reports from every device, and from other watched file descriptors (e.g.
+ * HID::DeviceMonitor::startMonitoring), are read by the thread calling
+ * \ref run on a single epoll or io_uring loop.
+ *
+ * Except for \ref stop, methods must be called before \ref run or from
+ * the reactor thread (i.e. from a watch handler).
+ *
+ * Only available with the linux HID backend.
+ */
+class DispatcherReactor
+{
+public:
+	enum class Backend
+	{
+		Epoll,
+		/**
+		 * Descriptors are polled through an io_uring, the polls being
+		 * re-armed and submitted together. Devices are then read
+		 * without blocking like with epoll, so that no kernel worker
+		 * thread waits on each hidraw node.
+		 *
+		 * Requires Linux 5.11 and libhidpp built with LIBHIDPP_IO_URING.
+		 */
+		IoUring,
+	};
+
+	/**
+	 * \throws std::system_error if the backend is not available.
+	 */
+	DispatcherReactor (Backend backend = Backend::Epoll);
+	~DispatcherReactor ();
+
+	/**
+	 * Open the hidraw node at \p path and serve it from this reactor.
+	 *
+	 * The returned dispatcher is owned by the reactor and stays valid
+	 * until \ref removeDevice is called. If reading the device fails,
+	 * pending commands fail and later commands throw the read error.
+	 *
+	 * \throws Dispatcher::NoHIDPPReportException, std::system_error
+	 */
+	Dispatcher *addDevice (const char *path);
+	/**
+	 * Stop serving and destroy the dispatcher returned by \ref addDevice.
+	 *
+	 * Pending commands fail with DispatcherThread::NotRunning.
+	 */
+	void removeDevice (Dispatcher *dispatcher);
+
+	/**
+	 * Call \p handler from the reactor thread each time \p fd is readable.
+	 */
+	void addWatch (int fd, const std::function<void ()> &handler);
+	/**
+	 * Stop watching \p fd.
+	 */
+	void removeWatch (int fd);
+
+	/**
+	 * Run the event loop until \ref stop is called.
+	 *
+	 * Command timeouts of every device are also handled by this loop.
+	 */
+	void run ();
+	/**
+	 * Make \ref run return. Can be called from any thread.
+	 */
+	void stop ();
+
+private:
+	void wakeup ();
+	int nextTimeout ();
+	void runEpoll ();
+
+	struct IoUringLoop;
+	void runIoUring ();
+
+	int _epoll_fd; // -1 with the io_uring backend
+	int _event_fd; // wakes up run for stop or new command deadlines
+	std::atomic<bool> _stopping;
+	std::map<int, std::function<void ()>> _watches;
+	std::map<Dispatcher *, std::unique_ptr<DispatcherThread>> _devices;
+	std::unique_ptr<IoUringLoop> _uring;
+};
+
+}
+
+#endif
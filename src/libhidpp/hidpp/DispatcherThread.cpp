@@ -21,13 +21,15 @@
 #include <hidpp10/Error.h>
 #include <hidpp20/Error.h>
 #include <misc/Log.h>
+#include <misc/Probes.h>
+#include <misc/Trace.h>
 #include <memory>
 #include <algorithm>
 
 using namespace HIDPP;
 
 template<typename Iterator,
-	 void (DispatcherThread::*cancel) (Iterator),
+	 bool (DispatcherThread::*cancel) (Iterator),
 	 std::mutex DispatcherThread::*mutex>
 class DispatcherThread::AsyncReport: public Dispatcher::AsyncReport
 {
@@ -52,21 +54,43 @@ public:
 			std::unique_lock<std::mutex> lock (dispatcher->*mutex);
 			// make sure there was no race before the lock.
 			auto status = report.wait_for (std::chrono::milliseconds (0));
-			if (status != std::future_status::ready) {
-				// cancel the command
-				(dispatcher->*cancel) (it);
+			// cancel the command, unless its answer is being delivered
+			if (status != std::future_status::ready && (dispatcher->*cancel) (it))
 				throw Dispatcher::TimeoutError ();
-			}
 		}
 		return report.get ();
 	}
 };
 
+static void complete (const Dispatcher::completion_handler &handler, const Report *response, std::exception_ptr error)
+{
+	try {
+		handler (response, error);
+	}
+	catch (std::exception &e) {
+		// Do not let user code stop the dispatcher.
+		Log::error () << "Command completion handler failed: " << e.what () << std::endl;
+	}
+}
+
 DispatcherThread::DispatcherThread (const char *path):
 	_dev (path),
+	_free_command_slot (NoSlot),
+	_pending_commands (0),
+	_in_flight_window (0), _in_flight (0),
+	_device_depth {}, _device_in_flight {},
+	_parking (false),
+	_read_coalescing (false),
+	_coalesced_read_count (0),
+	_next_deadline_check (TimerWheel<command_iterator>::clock::time_point::max ()),
+	_wakeup ([this] () { _dev.interruptRead (); }),
+	_command_account (MemoryAccounting::Subsystem::Commands),
 	_stopped (false)
 {
-	checkReportDescriptor (_dev.getReportDescriptor ());
+	for (auto &parked: _parked)
+		parked = false;
+	checkReportDescriptor (_dev);
+	_read_stride = reportInfo ().maxReportLength ();
 }
 
 DispatcherThread::~DispatcherThread ()
@@ -78,6 +102,11 @@ const HID::RawDevice &DispatcherThread::hidraw () const
 	return _dev;
 }
 
+HID::RawDevice &DispatcherThread::hidraw ()
+{
+	return _dev;
+}
+
 uint16_t DispatcherThread::vendorID () const
 {
 	return _dev.vendorID ();
@@ -95,170 +124,914 @@ std::string DispatcherThread::name () const
 
 void DispatcherThread::sendCommandWithoutResponse (const Report &report)
 {
-	_dev.writeReport (report.rawReport ());
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	auto priority = static_cast<std::size_t> (currentPriority ());
+	auto device_slot = deviceSlot (report.deviceIndex ()).value_or (DeviceSlotCount-1);
+	if (!hasWaitingCommands (device_slot, priority)) {
+		lock.unlock ();
+		_dev.writeReport (report.rawData (), report.rawLength ());
+		return;
+	}
+	// Written by sendWaitingCommands after the commands queued before.
+	auto slot = allocateCommandSlot (commandKey (report.deviceIndex (), report.subID (), report.address ()));
+	auto &cmd = _command_slots[slot];
+	cmd.handler = [] (const Report *, std::exception_ptr error) {
+		if (!error)
+			return;
+		try {
+			std::rethrow_exception (error);
+		}
+		catch (std::exception &e) {
+			Log::error () << "Failed to send queued report: " << e.what () << std::endl;
+		}
+	};
+	cmd.no_response = true;
+	cmd.waiting = true;
+	cmd.prev = cmd.next = NoSlot;
+	cmd.request = report;
+	auto &lane = _waiting_commands[priority];
+	lane.queues[device_slot].push_back ({ slot, cmd.generation });
+	++lane.count;
 }
 
 std::unique_ptr<Dispatcher::AsyncReport> DispatcherThread::sendCommand (Report &&report)
 {
+	auto promise = std::make_shared<std::promise<Report>> ();
+	auto future = promise->get_future ();
 	std::unique_lock<std::mutex> lock (_command_mutex);
-	if (_stopped)
-		throw _exception;
-	_dev.writeReport (report.rawReport ());
-	auto it = _commands.insert (_commands.end (), Command { std::move (report) });
-	return std::make_unique<AsyncCommandResponse> (this, it->response.get_future (), it);
+	auto it = addCommand (std::move (report), [promise] (const Report *response, std::exception_ptr error) {
+		if (response)
+			promise->set_value (*response);
+		else
+			promise->set_exception (error);
+	});
+	return std::make_unique<AsyncCommandResponse> (this, std::move (future), it);
+}
+
+void DispatcherThread::sendCommand (Report &&report, completion_handler &&handler, int timeout)
+{
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	addCommand (std::move (report), std::move (handler), timeout);
+}
+
+void DispatcherThread::trySendCommand (Report &&report, result_handler &&handler, int timeout)
+{
+	// Shared so that it can still be called if sending fails
+	auto h = std::make_shared<result_handler> (std::move (handler));
+	try {
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		addCommand (std::move (report), [h] (const Report *response, std::exception_ptr error) {
+			if (response)
+				(*h) (CommandResult::fromReport (*response));
+			else {
+				CommandResult result;
+				if (error)
+					result.exception = error;
+				else
+					result.status = CommandResult::Timeout;
+				(*h) (std::move (result));
+			}
+		}, timeout, true);
+	}
+	catch (...) {
+		CommandResult result;
+		result.exception = std::current_exception ();
+		(*h) (std::move (result));
+	}
 }
 
 std::unique_ptr<Dispatcher::AsyncReport> DispatcherThread::getNotification (DeviceIndex index, uint8_t sub_id)
 {
-	std::unique_lock<std::mutex> lock (_listener_mutex);
+	std::unique_lock<std::mutex> lock (_notification_mutex);
 	if (_stopped)
 		throw _exception;
-	auto it = _notifications.emplace (_notifications.end ());
-	it->listener = Dispatcher::registerEventHandler (index, sub_id, [this, it] (const Report &report) {
-		it->notification.set_value (report);
-		_notifications.erase (it);
+	auto n = std::make_shared<Notification> ();
+	auto it = _notifications.insert (_notifications.end (), n);
+	n->listener = Dispatcher::registerEventHandler (index, sub_id, [this, n, it] (const Report &report) {
+		std::unique_lock<std::mutex> lock (_notification_mutex);
+		if (n->pending) {
+			n->pending = false;
+			n->notification.set_value (report);
+			n->listener.reset (); // break the reference cycle with the handler
+			_notifications.erase (it);
+		}
 		return false;
 	});
-	return std::make_unique<AsyncNotification> (this, it->notification.get_future (), it);
+	return std::make_unique<AsyncNotification> (this, n->notification.get_future (), it);
 }
 
-DispatcherThread::listener_iterator DispatcherThread::registerEventHandler (DeviceIndex index, uint8_t sub_id, const event_handler &handler)
+void DispatcherThread::setInFlightWindow (unsigned int window)
 {
-	std::unique_lock<std::mutex> lock (_listener_mutex);
-	return Dispatcher::registerEventHandler (index, sub_id, handler);
+	{
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		_in_flight_window = window;
+	}
+	sendWaitingCommands ();
 }
 
-void DispatcherThread::unregisterEventHandler (listener_iterator it)
+void DispatcherThread::setDeviceInFlightDepth (unsigned int depth)
 {
-	std::unique_lock<std::mutex> lock (_listener_mutex);
-	Dispatcher::unregisterEventHandler (it);
+	{
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		_device_depth.fill (depth);
+	}
+	sendWaitingCommands ();
 }
 
-void DispatcherThread::cancelCommand (command_iterator it)
+void DispatcherThread::setDeviceInFlightDepth (DeviceIndex index, unsigned int depth)
 {
-	_commands.erase (it);
+	auto slot = deviceSlot (index);
+	if (!slot)
+		throw std::invalid_argument ("Invalid device index");
+	{
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		_device_depth[*slot] = depth;
+	}
+	sendWaitingCommands ();
 }
 
-void DispatcherThread::cancelNotification (notification_iterator it)
+void DispatcherThread::setCommandParking (bool enabled)
 {
-	Dispatcher::unregisterEventHandler (it->listener);
-	_notifications.erase (it);
+	{
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		_parking = enabled;
+		for (unsigned int i = WirelessDevice1; i <= WirelessDevice6; ++i) {
+			auto index = static_cast<DeviceIndex> (i);
+			_parked[*deviceSlot (index)] = enabled && !isLinked (index);
+		}
+	}
+	sendWaitingCommands ();
 }
 
-void DispatcherThread::run ()
+void DispatcherThread::setReadCoalescing (bool enabled)
 {
-	while (!_stopped) {
-		try {
-			std::vector<uint8_t> raw_report (MaxReportLength);
-			if (0 != _dev.readReport (raw_report))
-				processReport (std::move (raw_report));
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	_read_coalescing = enabled;
+}
+
+void DispatcherThread::updateParking (DeviceIndex index, bool linked)
+{
+	auto slot = deviceSlot (index);
+	if (!slot || (linked && !_parked[*slot].load (std::memory_order_relaxed)))
+		return;
+	{
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		bool park = !linked && _parking;
+		if (_parked[*slot] == park)
+			return;
+		_parked[*slot] = park;
+	}
+	if (!linked)
+		return;
+	Log::debug ("dispatcher").printf ("Device %d reconnected, sending its parked commands.\n", index);
+	sendWaitingCommands ();
+}
+
+DispatcherThread::command_key DispatcherThread::commandKey (DeviceIndex index, uint8_t sub_id, uint8_t address) noexcept
+{
+	return static_cast<command_key> (index) << 16
+		| static_cast<command_key> (sub_id) << 8
+		| address;
+}
+
+std::size_t DispatcherThread::commandDeviceSlot (command_key key) noexcept
+{
+	return deviceSlot (static_cast<DeviceIndex> (key >> 16)).value_or (DeviceSlotCount-1);
+}
+
+DispatcherThread::command_iterator DispatcherThread::addCommand (Report &&request, completion_handler &&handler, int timeout,
+								 bool raw_errors)
+{
+	if (_stopped)
+		throw _exception;
+	if (_drain_deadline)
+		throw NotRunning ();
+	if (timeout < 0 && _in_flight_window != 0)
+		timeout = WindowCommandTimeout;
+	// Only overtake waiting commands with a lower priority, and never
+	// commands to the same device.
+	auto priority = static_cast<std::size_t> (currentPriority ());
+	auto device_slot = deviceSlot (request.deviceIndex ()).value_or (DeviceSlotCount-1);
+	bool coalesce = _read_coalescing && currentReadOnly ();
+	std::optional<command_iterator> leader;
+	if (coalesce)
+		leader = findCoalescedRead (request);
+	bool wait = !leader && (!deviceHasRoom (device_slot) ||
+		(_in_flight_window != 0 && _in_flight >= _in_flight_window) ||
+		hasWaitingCommands (device_slot, priority));
+	// Commands to other devices waiting for the window are sent first.
+	for (std::size_t p = 0; !leader && !wait && _in_flight_window != 0 && p <= priority; ++p) {
+		auto &lane = _waiting_commands[p];
+		for (std::size_t i = 0; !wait && lane.count > 0 && i < DeviceSlotCount; ++i)
+			wait = !lane.queues[i].empty () && deviceHasRoom (i);
+	}
+	auto submitted = Trace::enabled ()
+		? std::chrono::steady_clock::now ()
+		: std::chrono::steady_clock::time_point ();
+	if (!leader && !wait)
+		_dev.writeReport (request.rawData (), request.rawLength ());
+	auto key = commandKey (request.deviceIndex (), request.subID (), request.address ());
+	LIBHIDPP_PROBE (command_submitted, this, key >> 16, (key >> 8) & 0xff, key & 0xff,
+			request.rawLength ());
+	std::size_t slot = allocateCommandSlot (key);
+	auto &cmd = _command_slots[slot];
+	cmd.handler = std::move (handler);
+	cmd.submitted = submitted;
+	cmd.raw_errors = raw_errors;
+	command_iterator it { slot, cmd.generation };
+	if (leader) {
+		cmd.attached = true;
+		cmd.prev = cmd.next = NoSlot;
+		_command_slots[leader->slot].followers.push_back (it);
+		++_coalesced_read_count;
+	}
+	else if (wait) {
+		cmd.waiting = true;
+		cmd.prev = cmd.next = NoSlot;
+		auto &lane = _waiting_commands[priority];
+		lane.queues[device_slot].push_back (it);
+		++lane.count;
+		cmd.request = std::move (request);
+	}
+	else
+		linkCommand (slot);
+	if (coalesce && !leader) {
+		if (!wait)
+			cmd.request = std::move (request);
+		_coalesced_reads.push_back (it);
+	}
+	if (timeout >= 0) {
+		auto deadline = TimerWheel<command_iterator>::clock::now () + std::chrono::milliseconds (timeout);
+		_deadlines.add (deadline, it);
+		if (deadline < _next_deadline_check) {
+			_next_deadline_check = deadline;
+			_wakeup ();
 		}
-		catch (Report::InvalidReportID &e) {
-			// There may be other reports on this device, just ignore them.
+	}
+	return it;
+}
+
+bool DispatcherThread::hasWaitingCommands (std::size_t device_slot, std::size_t priority)
+{
+	bool waiting = false;
+	for (std::size_t p = 0; p <= priority; ++p) {
+		auto &lane = _waiting_commands[p];
+		auto &queue = lane.queues[device_slot];
+		// Entries of cancelled commands would hold back new commands
+		// until the next answer.
+		while (!queue.empty () && (!_command_slots[queue.front ().slot].pending ||
+				_command_slots[queue.front ().slot].generation != queue.front ().generation)) {
+			queue.pop_front ();
+			--lane.count;
 		}
-		catch (Report::InvalidReportLength &e) {
-			Log::error () << "Ignored report with invalid length" << std::endl;
+		waiting = waiting || !queue.empty ();
+	}
+	return waiting;
+}
+
+std::size_t DispatcherThread::allocateCommandSlot (command_key key)
+{
+	std::size_t slot = _free_command_slot;
+	if (slot == NoSlot) {
+		slot = _command_slots.size ();
+		_command_slots.push_back (Command { key, {}, {}, {}, NoSlot, NoSlot, 0, false, false, false, false, false, std::nullopt, {} });
+		if (MemoryAccounting::enabled ())
+			_command_account.set (commandBytes ());
+	}
+	else
+		_free_command_slot = _command_slots[slot].next;
+	auto &cmd = _command_slots[slot];
+	cmd.key = key;
+	cmd.pending = true;
+	++_pending_commands;
+	return slot;
+}
+
+void DispatcherThread::linkCommand (std::size_t slot)
+{
+	auto &cmd = _command_slots[slot];
+	auto &queue = _commands[cmd.key];
+	cmd.sent = std::chrono::steady_clock::now ();
+	cmd.prev = queue.last;
+	cmd.next = NoSlot;
+	cmd.waiting = false;
+	if (queue.last == NoSlot)
+		queue.first = slot;
+	else
+		_command_slots[queue.last].next = slot;
+	queue.last = slot;
+	++_in_flight;
+	++_device_in_flight[commandDeviceSlot (cmd.key)];
+}
+
+bool DispatcherThread::deviceHasRoom (std::size_t device_slot) const noexcept
+{
+	if (_parked[device_slot].load (std::memory_order_relaxed))
+		return false;
+	return _device_depth[device_slot] == 0 ||
+		_device_in_flight[device_slot] < _device_depth[device_slot];
+}
+
+bool DispatcherThread::takeWaitingCommand (command_iterator &it)
+{
+	for (auto &lane: _waiting_commands) {
+		if (lane.count == 0)
+			continue;
+		for (std::size_t i = 0; i < DeviceSlotCount; ++i) {
+			std::size_t device_slot = (lane.next_slot + i) % DeviceSlotCount;
+			auto &queue = lane.queues[device_slot];
+			if (queue.empty () || !deviceHasRoom (device_slot))
+				continue;
+			it = queue.front ();
+			queue.pop_front ();
+			--lane.count;
+			lane.next_slot = (device_slot + 1) % DeviceSlotCount;
+			return true;
 		}
-		catch (std::exception &e) {
-			Log::error () << "Failed to read HID report: " << e.what () << std::endl;
-			_exception = std::current_exception ();
-			goto stop;
+		// Devices with commands of this priority are full, lower
+		// priorities may use the window.
+	}
+	return false;
+}
+
+void DispatcherThread::sendWaitingCommands ()
+{
+	std::vector<std::pair<completion_handler, std::exception_ptr>> failed;
+	{
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		while (_in_flight_window == 0 || _in_flight < _in_flight_window) {
+			command_iterator it;
+			if (!takeWaitingCommand (it))
+				break;
+			auto &cmd = _command_slots[it.slot];
+			if (!cmd.pending || cmd.generation != it.generation)
+				continue; // timed out or cancelled while waiting
+			try {
+				_dev.writeReport (cmd.request->rawData (), cmd.request->rawLength ());
+			}
+			catch (std::exception &e) {
+				failed.emplace_back (std::move (cmd.handler), std::current_exception ());
+				releaseCommand (it.slot);
+				continue;
+			}
+			if (cmd.no_response)
+				releaseCommand (it.slot);
+			else
+				linkCommand (it.slot);
 		}
 	}
-	_exception = std::make_exception_ptr (NotRunning ());
-stop:
-	_stopped = true;
+	for (auto &[handler, error]: failed)
+		complete (handler, nullptr, error);
+}
+
+int DispatcherThread::expireCommands ()
+{
+	using clock = TimerWheel<command_iterator>::clock;
+	std::vector<std::pair<completion_handler, bool>> expired; // handlers and raw_errors
+	int timeout = -1;
 	{
 		std::unique_lock<std::mutex> lock (_command_mutex);
-		if (!_commands.empty ()) {
-			Log::warning () << "Unfinished commands while stopping dispatcher." << std::endl;
-			for (auto &cmd: _commands) {
-				cmd.response.set_exception (_exception);
+		auto now = clock::now ();
+		_deadlines.advance (now, [this, &expired] (command_iterator it) {
+			auto &cmd = _command_slots[it.slot];
+			if (!cmd.pending || cmd.generation != it.generation)
+				return; // already completed
+			LIBHIDPP_PROBE (command_timeout, this, cmd.key >> 16, (cmd.key >> 8) & 0xff, cmd.key & 0xff);
+			if (!cmd.waiting && !cmd.attached)
+				recordTimeout (static_cast<DeviceIndex> (cmd.key >> 16));
+			expired.emplace_back (std::move (cmd.handler), cmd.raw_errors);
+			releaseCommand (it.slot);
+		});
+		if (auto next = _deadlines.nextDeadline ()) {
+			_next_deadline_check = *next;
+			timeout = std::chrono::ceil<std::chrono::milliseconds> (*next - now).count ();
+		}
+		else
+			_next_deadline_check = clock::time_point::max ();
+	}
+	for (auto &[handler, raw_errors]: expired)
+		complete (handler, nullptr, raw_errors
+				? nullptr
+				: std::make_exception_ptr (Dispatcher::TimeoutError ()));
+	// Expired and cancelled commands make room for waiting commands.
+	// Always flush: cancelCommand only wakes this thread up.
+	sendWaitingCommands ();
+	return timeout;
+}
+
+DispatcherThread::completion_handler DispatcherThread::takeCommand (command_key key, CommandTimes *times,
+								   bool *raw_errors, attached_handlers *attached)
+{
+	auto it = _commands.find (key);
+	if (it == _commands.end () || it->second.first == NoSlot)
+		return {};
+	std::size_t slot = it->second.first;
+	auto &cmd = _command_slots[slot];
+	recordRoundTrip (static_cast<DeviceIndex> (key >> 16),
+			 static_cast<uint8_t> (key >> 8), static_cast<uint8_t> (key),
+			 std::chrono::steady_clock::now () - cmd.sent);
+	if (times)
+		*times = { cmd.submitted, cmd.sent };
+	if (raw_errors)
+		*raw_errors = cmd.raw_errors;
+	if (attached) {
+		for (auto f: cmd.followers) {
+			auto &follower = _command_slots[f.slot];
+			if (!follower.pending || follower.generation != f.generation)
+				continue; // timed out or cancelled
+			attached->emplace_back (std::move (follower.handler), follower.raw_errors);
+			releaseCommand (f.slot);
+		}
+		cmd.followers.clear ();
+	}
+	auto handler = std::move (cmd.handler);
+	releaseCommand (slot);
+	return handler;
+}
+
+namespace
+{
+bool sameRead (const Report &a, const Report &b)
+{
+	if (a.deviceIndex () != b.deviceIndex () || a.subID () != b.subID () ||
+			a.rawLength () != b.rawLength ())
+		return false;
+	uint8_t mask = a.subID () < 0x80 ? 0xF0 : 0xFF; // ignore HID++ 2.0 software IDs
+	return (a.address () & mask) == (b.address () & mask) &&
+		std::equal (a.parameterBegin (), a.parameterEnd (), b.parameterBegin ());
+}
+}
+
+std::optional<DispatcherThread::command_iterator> DispatcherThread::findCoalescedRead (const Report &request)
+{
+	for (std::size_t i = 0; i < _coalesced_reads.size (); ) {
+		auto it = _coalesced_reads[i];
+		const auto &cmd = _command_slots[it.slot];
+		if (!cmd.pending || cmd.generation != it.generation) {
+			_coalesced_reads[i] = _coalesced_reads.back ();
+			_coalesced_reads.pop_back ();
+			continue;
+		}
+		if (cmd.request && sameRead (*cmd.request, request))
+			return it;
+		++i;
+	}
+	return std::nullopt;
+}
+
+void DispatcherThread::promoteFollower (std::size_t slot)
+{
+	auto &cmd = _command_slots[slot];
+	auto followers = std::move (cmd.followers);
+	cmd.followers.clear ();
+	auto first = std::find_if (followers.begin (), followers.end (), [this] (command_iterator it) {
+		const auto &follower = _command_slots[it.slot];
+		return follower.pending && follower.generation == it.generation;
+	});
+	if (first == followers.end () || !cmd.request)
+		return;
+	auto &next = _command_slots[first->slot];
+	next.attached = false;
+	next.waiting = true;
+	next.request = std::move (cmd.request);
+	next.key = commandKey (next.request->deviceIndex (), next.request->subID (), next.request->address ());
+	next.followers.assign (first+1, followers.end ());
+	// Ahead of the other interactive commands to the device, as the
+	// read was already sent once.
+	auto &lane = _waiting_commands[static_cast<std::size_t> (Priority::Interactive)];
+	lane.queues[commandDeviceSlot (next.key)].push_front (*first);
+	++lane.count;
+	_coalesced_reads.push_back (*first);
+}
+
+void DispatcherThread::traceCommand (command_key key, const CommandTimes &times,
+				     std::chrono::steady_clock::time_point response, bool error)
+{
+	LIBHIDPP_PROBE (command_matched, this, key >> 16, (key >> 8) & 0xff, key & 0xff, error);
+	// Commands submitted before tracing started have no submit time
+	if (!Trace::enabled () || times.submitted == std::chrono::steady_clock::time_point ())
+		return;
+	auto end = std::chrono::steady_clock::now ();
+	if (response == std::chrono::steady_clock::time_point ())
+		response = end;
+	auto id = Trace::nextID ();
+	Trace::asyncSpan ("command", "command", id, times.submitted, end, {
+		{ "device_index", key >> 16 },
+		{ "feature_index", (key >> 8) & 0xff },
+		{ "function", (key >> 4) & 0x0f },
+		{ "sw_id", key & 0x0f },
+	});
+	if (times.sent > times.submitted)
+		Trace::asyncSpan ("command", "write", id, times.submitted, times.sent);
+	Trace::asyncSpan ("command", "response", id, times.sent, response, {
+		{ "error", error },
+	});
+	Trace::asyncSpan ("command", "completion", id, response, end);
+}
+
+void DispatcherThread::releaseCommand (std::size_t slot)
+{
+	auto &cmd = _command_slots[slot];
+	if (!cmd.followers.empty ())
+		promoteFollower (slot);
+	if (cmd.attached) // never linked
+		cmd.attached = false;
+	else if (cmd.waiting) // never linked
+		cmd.waiting = false;
+	else {
+		auto &queue = _commands[cmd.key];
+		if (cmd.prev == NoSlot)
+			queue.first = cmd.next;
+		else
+			_command_slots[cmd.prev].next = cmd.next;
+		if (cmd.next == NoSlot)
+			queue.last = cmd.prev;
+		else
+			_command_slots[cmd.next].prev = cmd.prev;
+		--_in_flight;
+		--_device_in_flight[commandDeviceSlot (cmd.key)];
+	}
+	cmd.request.reset ();
+	cmd.handler = nullptr;
+	cmd.pending = false;
+	cmd.no_response = false;
+	++cmd.generation;
+	cmd.next = _free_command_slot;
+	_free_command_slot = slot;
+	if (--_pending_commands == 0 && _drain_deadline)
+		_wakeup (); // draining is finished
+}
+
+bool DispatcherThread::cancelCommand (command_iterator it)
+{
+	auto &cmd = _command_slots[it.slot];
+	if (!cmd.pending || cmd.generation != it.generation)
+		return false;
+	if (!cmd.waiting && !cmd.attached)
+		recordTimeout (static_cast<DeviceIndex> (cmd.key >> 16));
+	releaseCommand (it.slot);
+	// The reading thread sends the next command: expireCommands flushes
+	// the waiting queues on every wakeup, even when nothing expired.
+	if (std::any_of (_waiting_commands.begin (), _waiting_commands.end (),
+			[] (const WaitingLane &lane) { return lane.count > 0; }))
+		_wakeup ();
+	return true;
+}
+
+bool DispatcherThread::cancelNotification (notification_iterator it)
+{
+	auto n = *it;
+	auto listener = std::move (n->listener);
+	n->pending = false;
+	_notifications.erase (it);
+	// The handler may be waiting for _notification_mutex, do not wait for it.
+	removeEventHandler (listener);
+	return true;
+}
+
+bool DispatcherThread::readNextReport (int timeout)
+{
+	std::array<uint8_t, ReadBatchSize*MaxReportLength> raw_reports;
+	std::array<int, ReadBatchSize> lengths;
+	std::array<std::chrono::steady_clock::time_point, ReadBatchSize> times;
+	try {
+		// Packed with the device stride, the batch only touches the
+		// first _read_stride*ReadBatchSize bytes of the buffer.
+		auto count = _dev.readReports (raw_reports.data (), _read_stride,
+					       lengths.data (), ReadBatchSize,
+					       timeout, times.data ());
+		recordReaderWakeup ();
+		std::array<ReportKind, ReadBatchSize> kinds;
+		classifyReports (raw_reports.data (), _read_stride, lengths.data (), count, kinds.data ());
+		for (std::size_t i = 0; i < count; ++i)
+			processRawReport (&raw_reports[i*_read_stride], lengths[i], times[i], kinds[i]);
+	}
+	catch (std::exception &e) {
+		Log::error () << "Failed to read HID report: " << e.what () << std::endl;
+		_exception = std::current_exception ();
+		return false;
+	}
+	return true;
+}
+
+void DispatcherThread::classifyReports (const uint8_t *reports, std::size_t stride,
+					const int *lengths, std::size_t count,
+					ReportKind *kinds)
+{
+	constexpr uint8_t ShortLength = Report::reportLength (Report::Short);
+	constexpr uint8_t LongLength = Report::reportLength (Report::Long);
+	constexpr uint8_t VeryLongLength = Report::reportLength (Report::VeryLong);
+	std::array<uint8_t, ReadBatchSize> ids, sizes, sub_ids, out;
+	for (std::size_t first = 0; first < count; first += ReadBatchSize) {
+		std::size_t n = std::min (count - first, ReadBatchSize);
+		// Gather the header fields, unused lanes are foreign
+		ids.fill (0);
+		sizes.fill (0);
+		sub_ids.fill (0);
+		for (std::size_t i = 0; i < n; ++i) {
+			const uint8_t *report = reports + (first+i)*stride;
+			int length = lengths[first+i];
+			sizes[i] = std::clamp (length, 0, 255);
+			ids[i] = length > 0 ? report[0] : 0;
+			sub_ids[i] = length > 2 ? report[2] : 0;
+		}
+		// No branches: one vector compare per field
+		for (std::size_t i = 0; i < ReadBatchSize; ++i) {
+			uint8_t is_short = ids[i] == Report::Short;
+			uint8_t is_long = ids[i] == Report::Long;
+			uint8_t is_very_long = ids[i] == Report::VeryLong;
+			uint8_t hidpp = is_short | is_long | is_very_long;
+			uint8_t valid = (is_short & (sizes[i] == ShortLength)) |
+					(is_long & (sizes[i] == LongLength)) |
+					(is_very_long & (sizes[i] == VeryLongLength));
+			uint8_t error10 = is_short & (sub_ids[i] == HIDPP10::ErrorMessage);
+			uint8_t error20 = sub_ids[i] == HIDPP20::ErrorMessage;
+			out[i] = hidpp * (1 + valid * (1 + error10 + 2*error20));
+		}
+		for (std::size_t i = 0; i < n; ++i)
+			kinds[first+i] = static_cast<ReportKind> (out[i]);
+	}
+}
+
+void DispatcherThread::processRawReport (const uint8_t *report, std::size_t length,
+					 std::chrono::steady_clock::time_point time)
+{
+	int l = length;
+	ReportKind kind;
+	classifyReports (report, length, &l, 1, &kind);
+	processRawReport (report, length, time, kind);
+}
+
+void DispatcherThread::processRawReport (const uint8_t *report, std::size_t length,
+					 std::chrono::steady_clock::time_point time,
+					 ReportKind kind)
+{
+	switch (kind) {
+	case ReportKind::Foreign:
+		// There may be other reports on this device, just ignore them.
+		break;
+	case ReportKind::BadLength:
+		Log::error () << "Ignored report with invalid length" << std::endl;
+		break;
+	default: {
+		Report r (report, length);
+		r.setReceiveTime (time);
+		r.setSequence (Report::nextSequence ());
+		processReport (std::move (r), kind);
+	}
+	}
+	// Answers make room in the in-flight window
+	sendWaitingCommands ();
+}
+
+void DispatcherThread::terminate ()
+{
+	_stopped = true;
+	{
+		std::vector<completion_handler> unfinished;
+		{
+			std::unique_lock<std::mutex> lock (_command_mutex);
+			unfinished.reserve (_pending_commands);
+			// Slots are reused first, pending commands are at the
+			// start of the pool.
+			for (std::size_t slot = 0; _pending_commands > 0 && slot < _command_slots.size (); ++slot) {
+				if (!_command_slots[slot].pending)
+					continue;
+				unfinished.push_back (std::move (_command_slots[slot].handler));
+				releaseCommand (slot);
+			}
+			for (auto &lane: _waiting_commands) {
+				for (auto &queue: lane.queues)
+					queue.clear ();
+				lane.count = 0;
 			}
 		}
+		if (!unfinished.empty ()) {
+			Log::warning () << unfinished.size () << " unfinished commands while stopping dispatcher." << std::endl;
+			for (auto &handler: unfinished)
+				complete (handler, nullptr, _exception);
+		}
 	}
 	{
-		std::unique_lock<std::mutex> lock (_listener_mutex);
+		std::unique_lock<std::mutex> lock (_notification_mutex);
 		if (!_notifications.empty ()) {
 			Log::warning () << "Unreceived notifications while stopping dispatcher." << std::endl;
 			for (auto &n: _notifications) {
-				n.notification.set_exception (_exception);
+				auto listener = std::move (n->listener);
+				n->pending = false;
+				n->notification.set_exception (_exception);
+				removeEventHandler (listener);
 			}
+			_notifications.clear ();
 		}
 	}
 }
 
+Dispatcher::Statistics DispatcherThread::statistics () const
+{
+	auto stats = Dispatcher::statistics ();
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	stats.commands_in_flight = _in_flight;
+	stats.coalesced_reads = _coalesced_read_count;
+	stats.commands_queued = std::count_if (_command_slots.begin (), _command_slots.end (),
+			[] (const Command &cmd) { return cmd.pending && cmd.waiting; });
+	auto command_bytes = commandBytes ();
+	_command_account.set (command_bytes);
+	stats.memory += command_bytes;
+	return stats;
+}
+
+std::size_t DispatcherThread::commandBytes () const
+{
+	std::size_t bytes = _command_slots.capacity () * sizeof (Command)
+		+ _coalesced_reads.capacity () * sizeof (command_iterator)
+		+ _commands.bucket_count () * sizeof (void *)
+		+ _commands.size () * (sizeof (command_container::value_type) + 2 * sizeof (void *));
+	for (const auto &cmd: _command_slots)
+		bytes += cmd.followers.capacity () * sizeof (command_iterator);
+	for (const auto &lane: _waiting_commands)
+		for (const auto &queue: lane.queues)
+			bytes += queue.size () * sizeof (command_iterator);
+	return bytes;
+}
+
+void DispatcherThread::setRealTimeOptions (const RealTime::Options &options)
+{
+	_realtime = options;
+}
+
+void DispatcherThread::applyRealTimeOptions ()
+{
+	if (_realtime.empty ())
+		return;
+	try {
+		RealTime::applyToCurrentThread (_realtime);
+	}
+	catch (std::exception &e) {
+		Log::error () << "Failed to apply real-time options to dispatcher thread: " << e.what () << std::endl;
+	}
+	if (_realtime.lock_memory) {
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		_command_slots.reserve (MaxSoftwareID*DeviceSlotCount);
+	}
+}
+
+void DispatcherThread::run ()
+{
+	applyRealTimeOptions ();
+	while (!_stopped) {
+		int timeout = expireCommands ();
+		if (!continueDraining (timeout))
+			break;
+		if (!readNextReport (timeout))
+			goto stop;
+	}
+	_exception = std::make_exception_ptr (NotRunning ());
+stop:
+	terminate ();
+}
+
 void DispatcherThread::stop ()
 {
 	_stopped = true;
 	_dev.interruptRead ();
 }
 
-void DispatcherThread::processReport (std::vector<uint8_t> &&raw_report)
+void DispatcherThread::stop (std::chrono::steady_clock::time_point drain_deadline)
+{
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	if (!_drain_deadline || drain_deadline < *_drain_deadline)
+		_drain_deadline = drain_deadline;
+	_wakeup ();
+}
+
+bool DispatcherThread::continueDraining (int &timeout)
+{
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	if (!_drain_deadline)
+		return true;
+	auto now = std::chrono::steady_clock::now ();
+	if (_pending_commands == 0 || now >= *_drain_deadline)
+		return false;
+	int remaining = std::chrono::ceil<std::chrono::milliseconds> (*_drain_deadline - now).count ();
+	if (timeout < 0 || remaining < timeout)
+		timeout = remaining;
+	return true;
+}
+
+void DispatcherThread::processReport (Report &&report)
 {
+	int length = report.rawLength ();
+	ReportKind kind;
+	classifyReports (report.rawData (), length, &length, 1, &kind);
+	processReport (std::move (report), kind);
+}
 
-	Report report (std::move (raw_report));
+void DispatcherThread::processReport (Report &&report, ReportKind kind)
+{
 	DeviceIndex index = report.deviceIndex ();
+	if (auto linked = recordConnection (report))
+		updateParking (index, *linked);
+	else {
+		recordActivity (index);
+		updateParking (index, true);
+	}
 
-	uint8_t sub_id, address, feature, error_code;
+	// Error messages are decoded from typed views, the kind tells
+	// their type was already checked.
+	typedef TypedReportView<Report::Short> ShortView;
+	const uint8_t *raw = report.rawData ();
+	std::size_t length = report.rawLength ();
+	uint8_t address, feature, error_code;
 	unsigned int function, sw_id;
 	std::vector<uint8_t> error_data;
+	auto error20 = [&] (const auto &view) {
+		// The request header follows the error sub ID
+		feature = view.address ();
+		function = view.template parameter<0> () >> 4;
+		sw_id = view.template parameter<0> () & 0x0f;
+		error_code = view.template parameter<1> ();
+		// Error data ends at the last non-zero byte
+		auto params = view.parameters ();
+		std::size_t end = std::decay_t<decltype (view)>::ParameterLength;
+		while (end > 2 && params[end-1] == 0)
+			--end;
+		error_data.assign (params+2, params+end);
+		return true;
+	};
 
-	if (report.checkErrorMessage10 (&sub_id, &address, &error_code)) {
+	if (kind == ReportKind::Error10) {
+		ShortView error (raw);
 		std::unique_lock<std::mutex> lock (_command_mutex);
-		auto it = std::find_if (_commands.begin (), _commands.end (),
-			[index, sub_id, address] (const Command &cmd) {
-				return index == cmd.request.deviceIndex () &&
-					sub_id == cmd.request.subID () &&
-					address == cmd.request.address ();
-			});
-		if (it != _commands.end ()) {
-			it->response.set_exception (std::make_exception_ptr (HIDPP10::Error (error_code)));
-			_commands.erase (it);
+		auto key = commandKey (index, error.address (), error.parameter<0> ());
+		error_code = error.parameter<1> ();
+		CommandTimes times;
+		bool raw_errors;
+		attached_handlers attached;
+		if (auto handler = takeCommand (key, &times, &raw_errors, &attached)) {
+			lock.unlock ();
+			auto error = std::make_exception_ptr (HIDPP10::Error (error_code));
+			attached.emplace (attached.begin (), std::move (handler), raw_errors);
+			for (auto &[h, raw]: attached)
+				complete (h, raw ? &report : nullptr, raw ? nullptr : error);
+			traceCommand (key, times, report.receiveTime (), true);
 		}
-		else
+		else {
+			recordUnmatchedAnswer ();
 			Log::warning () << "HID++1.0 error message was not matched with any command." << std::endl;
+		}
 	}
-	else if (report.checkErrorMessage20 (&feature, &function, &sw_id, &error_code, &error_data)) {
+	else if (kind == ReportKind::Error20 && visitReport (raw, length, error20)) {
 		std::unique_lock<std::mutex> lock (_command_mutex);
-		auto it = std::find_if (_commands.begin (), _commands.end (),
-			[index, feature, function, sw_id] (const Command &cmd) {
-				return index == cmd.request.deviceIndex () &&
-					feature == cmd.request.featureIndex () &&
-					function == cmd.request.function () &&
-					sw_id == cmd.request.softwareID ();
-			});
-		if (it != _commands.end ()) {
-			it->response.set_exception (std::make_exception_ptr (HIDPP20::Error (error_code, std::move(error_data))));
-			_commands.erase (it);
+		address = (function & 0x0f) << 4 | (sw_id & 0x0f);
+		auto key = commandKey (index, feature, address);
+		CommandTimes times;
+		bool raw_errors;
+		attached_handlers attached;
+		if (auto handler = takeCommand (key, &times, &raw_errors, &attached)) {
+			lock.unlock ();
+			auto error = std::make_exception_ptr (HIDPP20::Error (error_code, std::move(error_data)));
+			attached.emplace (attached.begin (), std::move (handler), raw_errors);
+			for (auto &[h, raw]: attached)
+				complete (h, raw ? &report : nullptr, raw ? nullptr : error);
+			traceCommand (key, times, report.receiveTime (), true);
 		}
-		else
+		else {
+			recordUnmatchedAnswer ();
 			Log::warning () << "HID++2.0 error message was not matched with any command." << std::endl;
+		}
 	}
 	else {
+		auto route = reportRoute (index, report.subID ());
+		if (route == ReportRoute::Notification ||
+				(route == ReportRoute::Feature && report.softwareID () == 0)) {
+			processEvent (report);
+			return;
+		}
 		std::unique_lock<std::mutex> cmd_lock (_command_mutex);
-		auto it = std::find_if (_commands.begin (), _commands.end (),
-			[&report] (const Command &cmd) {
-				return report.deviceIndex () == cmd.request.deviceIndex () &&
-					report.subID () == cmd.request.subID () &&
-					report.address () == cmd.request.address ();
-			});
-		if (it != _commands.end ()) {
-			it->response.set_value (std::move (report));
-			_commands.erase (it);
+		auto key = commandKey (index, report.subID (), report.address ());
+		CommandTimes times;
+		attached_handlers attached;
+		if (auto handler = takeCommand (key, &times, nullptr, &attached)) {
+			cmd_lock.unlock ();
+			complete (handler, &report, nullptr);
+			for (auto &[h, raw]: attached)
+				complete (h, &report, nullptr);
+			traceCommand (key, times, report.receiveTime (), false);
 		}
-		else if (report.softwareID () == 0 || report.subID () < 0x80) { // is an event
-			// TODO: fix this test, HID++2.0 answers could
-			// be mistaken for HID++1.0 notifications:
-			// feature index/subID is usually below 0x80.
-			// But the lowest known HID++1.0 notification is 0x40,
-			// if no HID++2.0 device has more than 64 features,
+		else if (route == ReportRoute::Unknown &&
+				(report.softwareID () == 0 || report.subID () < 0x80)) { // is an event
+			// Without the device protocol (see setDeviceProtocol),
+			// HID++2.0 answers could be mistaken for HID++1.0
+			// notifications: feature index/subID is usually below
+			// 0x80. But the lowest known HID++1.0 notification is
+			// 0x40, if no HID++2.0 device has more than 64 features,
 			// there should be no confusion in practice.
 			cmd_lock.unlock ();
-			std::unique_lock<std::mutex> lock (_listener_mutex);
 			processEvent (report);
 		}
 		else {
+			recordUnmatchedAnswer ();
 			Log::warning () << "Answer was not matched with any command." << std::endl;
 		}
 	}
@@ -21,9 +21,16 @@
 
 #include <hidpp/Dispatcher.h>
 #include <hid/RawDevice.h>
+#include <misc/RealTime.h>
+#include <misc/TimerWheel.h>
+#include <array>
+#include <deque>
 #include <future>
 #include <list>
 #include <map>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 #include <chrono>
 
 namespace HIDPP
@@ -42,53 +49,428 @@ public:
 	~DispatcherThread ();
 
 	const HID::RawDevice &hidraw () const;
+	/**
+	 * Access the device for configuring it (e.g.
+	 * HID::RawDevice::setCapture) before using the dispatcher.
+	 */
+	HID::RawDevice &hidraw ();
 
 	virtual uint16_t vendorID () const;
 	virtual uint16_t productID () const;
 	virtual std::string name () const;
+	/**
+	 * Write \p report, or queue it behind the waiting commands to the
+	 * same device index with the priority of the current thread. Write
+	 * errors of queued reports are only logged.
+	 */
 	virtual void sendCommandWithoutResponse (const Report &report);
 	virtual std::unique_ptr<Dispatcher::AsyncReport> sendCommand (Report &&report);
+	/**
+	 * \p handler is called from the dispatcher thread without any lock
+	 * held, it may send other commands. Timeouts are also handled by the
+	 * dispatcher thread, no thread waits for the answer.
+	 */
+	virtual void sendCommand (Report &&report, completion_handler &&handler, int timeout = -1);
+	/**
+	 * HID++ errors and timeouts are passed to \p handler without
+	 * creating exceptions.
+	 */
+	virtual void trySendCommand (Report &&report, result_handler &&handler, int timeout = -1);
+	using Dispatcher::trySendCommand;
 	virtual std::unique_ptr<Dispatcher::AsyncReport> getNotification (DeviceIndex index, uint8_t sub_id);
 
+	/**
+	 * Timeout in milliseconds of commands sent without one while an
+	 * in-flight window is set (see \ref setInFlightWindow).
+	 */
+	static constexpr int WindowCommandTimeout = 5000;
+	/**
+	 * Limit the number of commands written to the device and not
+	 * answered yet to \p window, 0 (the default) meaning no limit.
+	 *
+	 * Receivers may drop reports when flooded. Commands beyond the window
+	 * wait in a queue per device index and priority. Interactive commands
+	 * are sent before bulk commands (see Dispatcher::PriorityScope), and
+	 * queues of the same priority are served in round-robin so that a
+	 * device index sending many commands does not delay the others.
+	 * Command timeouts include the waiting time. Commands sent without a
+	 * timeout get \ref WindowCommandTimeout, so that a command never
+	 * answered does not hold its place in the window forever.
+	 *
+	 * Without a window, commands are never queued and priorities have
+	 * no effect. Reports sent with \ref sendCommandWithoutResponse are
+	 * not counted in the window but still wait behind the queued
+	 * commands to the same device index.
+	 */
+	void setInFlightWindow (unsigned int window);
+	/**
+	 * Limit the number of commands in flight to each device index to
+	 * \p depth, 0 (the default) meaning no limit.
+	 *
+	 * Commands beyond the depth wait in the queue of their device index
+	 * (see \ref setInFlightWindow) and are sent in order, while commands
+	 * to other devices fill the rest of the window. A slow or sleeping
+	 * device then only holds \p depth slots of the window. HID++ 2.0
+	 * devices should not have more than Dispatcher::MaxSoftwareID
+	 * commands in flight.
+	 */
+	void setDeviceInFlightDepth (unsigned int depth);
+	void setDeviceInFlightDepth (DeviceIndex index, unsigned int depth);
+	/**
+	 * Park commands to unlinked wireless devices (see
+	 * Dispatcher::isLinked) instead of writing them, disabled by
+	 * default.
+	 *
+	 * Parked commands wait in the queue of their device index (see
+	 * \ref setInFlightWindow) and are sent as soon as the device
+	 * reconnects, their timeout still applies. A command to a sleeping
+	 * device is then executed when the device wakes up instead of
+	 * failing and being retried later.
+	 */
+	void setCommandParking (bool enabled);
+	/**
+	 * Coalesce identical read-only commands (see
+	 * Dispatcher::ReadOnlyScope), disabled by default.
+	 *
+	 * A read identical to a command in flight or waiting (same device
+	 * index, feature index or sub ID, function or address, and
+	 * parameters, ignoring the software ID) is not written: it gets the
+	 * answer of the first one. Its own timeout still applies. If the
+	 * first command fails without an answer (timeout or cancellation),
+	 * the next attached read is sent instead.
+	 *
+	 * A coalesced read may be answered with a state read before a
+	 * change the caller made concurrently, only enable it when such
+	 * reads can be ordered by the caller.
+	 */
+	void setReadCoalescing (bool enabled);
 
-	virtual listener_iterator registerEventHandler (DeviceIndex index, uint8_t sub_id, const event_handler &handler);
-	virtual void unregisterEventHandler (listener_iterator it);
+	virtual Statistics statistics () const;
+
+	/**
+	 * Scheduling settings applied by \ref run to the calling thread,
+	 * before reading any report. Failures are logged and do not stop
+	 * the dispatcher.
+	 *
+	 * With RealTime::Options::lock_memory, the command pool is also
+	 * allocated for MaxSoftwareID commands per device index, so that
+	 * sending commands does not fault new pages.
+	 */
+	void setRealTimeOptions (const RealTime::Options &options);
 
 	void run ();
+	/**
+	 * Make \ref run return, pending commands and notifications fail
+	 * with NotRunning.
+	 */
 	void stop ();
+	/**
+	 * Stop accepting commands (they fail with NotRunning) and make
+	 * \ref run return once the accepted commands are completed, or at
+	 * \p drain_deadline at the latest. Commands still pending then fail
+	 * with NotRunning all at once.
+	 *
+	 * Commands waiting for the in-flight window are still written while
+	 * draining, parked commands wait for their device or the deadline.
+	 * An earlier deadline from a later call replaces the previous one.
+	 * Only \ref run drains, other loops (e.g. DispatcherReactor) ignore
+	 * the deadline until they are stopped.
+	 */
+	void stop (std::chrono::steady_clock::time_point drain_deadline);
+
+protected:
+	/**
+	 * Process a report read from the device at \p time, ignoring
+	 * invalid reports.
+	 *
+	 * Normally only called by the reading loop, subclasses may use it to
+	 * feed reports without running it (e.g. for benchmarking).
+	 */
+	void processRawReport (const uint8_t *report, std::size_t length,
+			       std::chrono::steady_clock::time_point time);
 
 private:
+	/**
+	 * Pending commands are indexed by the fields matched in the answer
+	 * (device index, sub ID or feature index, and address or
+	 * function/software ID) packed in a single integer.
+	 */
+	typedef uint32_t command_key;
+	static command_key commandKey (DeviceIndex index, uint8_t sub_id, uint8_t address) noexcept;
+	static std::size_t commandDeviceSlot (command_key key) noexcept;
+
+	/**
+	 * Commands are stored in a pool of reusable slots. Slots of pending
+	 * commands with the same key are linked in sending order, free slots
+	 * are linked in a free list. Neither the pool nor the per-key queues
+	 * are shrunk, so sending commands does not allocate once enough slots
+	 * exist.
+	 *
+	 * Commands waiting for room in the in-flight window keep their
+	 * request and are only linked in their key queue once written.
+	 */
+	static constexpr std::size_t NoSlot = static_cast<std::size_t> (-1);
+	struct command_iterator
+	{
+		std::size_t slot;
+		unsigned int generation;
+	};
 	struct Command
 	{
-		Report request;
-		std::promise<Report> response;
+		command_key key;
+		completion_handler handler;
+		std::chrono::steady_clock::time_point submitted; // only set while tracing
+		std::chrono::steady_clock::time_point sent;
+		std::size_t prev, next;
+		unsigned int generation; // incremented each time the slot is freed
+		bool pending;
+		bool waiting; // not written yet
+		bool raw_errors; // errors and timeouts are passed as reports (see trySendCommand)
+		bool attached; // coalesced read waiting for the answer of another command
+		bool no_response; // queued by sendCommandWithoutResponse, released once written
+		std::optional<Report> request; // set while waiting and for coalesced reads, kept until released
+		std::vector<command_iterator> followers; // reads attached to this one
+	};
+	struct CommandQueue
+	{
+		std::size_t first = NoSlot, last = NoSlot;
 	};
-	typedef std::list<Command> command_container;
-	typedef command_container::iterator command_iterator;
+	typedef std::unordered_map<command_key, CommandQueue> command_container;
 
-	void cancelCommand (command_iterator);
+	/**
+	 * Write \p report and queue its command, or queue it for writing
+	 * later if the in-flight window is full. \c _command_mutex must be
+	 * held.
+	 *
+	 * With \p raw_errors, error messages are passed to \p handler as
+	 * the response and timeouts as a null response and a null error.
+	 *
+	 * Read-only commands may be attached to an identical command
+	 * instead of being written (see \ref setReadCoalescing).
+	 *
+	 * \throws \c _exception if the dispatcher is stopped
+	 */
+	command_iterator addCommand (Report &&request, completion_handler &&handler, int timeout = -1,
+				     bool raw_errors = false);
+	/**
+	 * Drop cancelled entries at the front of the waiting queues of
+	 * \p device_slot up to \p priority and check if any command is
+	 * left. \c _command_mutex must be held.
+	 */
+	bool hasWaitingCommands (std::size_t device_slot, std::size_t priority);
+	/**
+	 * Take a free command slot, \c _command_mutex must be held.
+	 */
+	std::size_t allocateCommandSlot (command_key key);
+	/**
+	 * Link a written command in its key queue and count it in flight,
+	 * \c _command_mutex must be held.
+	 */
+	void linkCommand (std::size_t slot);
+	/**
+	 * Write waiting commands while the in-flight window has room.
+	 * Commands whose write failed are completed with the error.
+	 */
+	void sendWaitingCommands ();
+	/**
+	 * Park or unpark the commands to \p index after a change of its
+	 * link status, sending the waiting commands when unparking.
+	 */
+	void updateParking (DeviceIndex index, bool linked);
+	/**
+	 * Check if device slot \p device_slot can have one more command in
+	 * flight, \c _command_mutex must be held.
+	 */
+	bool deviceHasRoom (std::size_t device_slot) const noexcept;
+	/**
+	 * Remove the next waiting command in round-robin order among the
+	 * device slots with room, \c _command_mutex must be held.
+	 *
+	 * \returns false if no command can be sent.
+	 */
+	bool takeWaitingCommand (command_iterator &it);
+	/**
+	 * Find and remove the oldest command matching \p key, and record its
+	 * round-trip time.
+	 *
+	 * \returns an empty handler if no command is matching.
+	 */
+	struct CommandTimes
+	{
+		std::chrono::steady_clock::time_point submitted, sent;
+	};
+	/**
+	 * Handlers of the reads attached to a command and their raw_errors
+	 * flag, completed with the same answer.
+	 */
+	typedef std::vector<std::pair<completion_handler, bool>> attached_handlers;
+	completion_handler takeCommand (command_key key, CommandTimes *times = nullptr,
+					bool *raw_errors = nullptr,
+					attached_handlers *attached = nullptr);
+	/**
+	 * Find a pending coalesced read identical to \p request, \c
+	 * _command_mutex must be held.
+	 */
+	std::optional<command_iterator> findCoalescedRead (const Report &request);
+	/**
+	 * Approximate size of the command containers, \c _command_mutex
+	 * must be held.
+	 */
+	std::size_t commandBytes () const;
+	/**
+	 * Replace the command in \p slot, released without an answer, by
+	 * its first pending follower: it is queued for writing with the
+	 * other followers attached. \c _command_mutex must be held.
+	 */
+	void promoteFollower (std::size_t slot);
+	/**
+	 * Record the probe and trace spans of a command completed at
+	 * \p response.
+	 */
+	void traceCommand (command_key key, const CommandTimes &times,
+			   std::chrono::steady_clock::time_point response, bool error);
+	void releaseCommand (std::size_t slot);
+	/**
+	 * Remove the timed out command if it is still pending.
+	 *
+	 * \returns false if the command was already completed.
+	 */
+	bool cancelCommand (command_iterator);
+
+	/**
+	 * Fail the commands whose deadline has passed.
+	 *
+	 * \returns the time in milliseconds until the next deadline, or -1
+	 * if there is none.
+	 */
+	int expireCommands ();
+	/**
+	 * Reduce the read \p timeout (in milliseconds, -1 for none) to the
+	 * drain deadline.
+	 *
+	 * \returns false if \ref run must stop: draining is finished or
+	 * its deadline passed.
+	 */
+	bool continueDraining (int &timeout);
 
+	/**
+	 * Notifications are shared with their listener so that a handler
+	 * running concurrently with a cancellation does not use a destroyed
+	 * notification. \c pending is only accessed with
+	 * \c _notification_mutex held.
+	 */
 	struct Notification
 	{
 		listener_iterator listener;
 		std::promise<Report> notification;
+		bool pending = true;
 	};
-	typedef std::list<Notification> notification_container;
+	typedef std::list<std::shared_ptr<Notification>> notification_container;
 	typedef notification_container::iterator notification_iterator;
 
-	void cancelNotification (notification_iterator);
+	bool cancelNotification (notification_iterator);
+
+	/**
+	 * What a raw report is, from its header.
+	 */
+	enum class ReportKind: uint8_t {
+		Foreign = 0, ///< not a HID++ report ID, ignored
+		BadLength = 1,
+		Message = 2, ///< answer or event
+		Error10 = 3,
+		Error20 = 4,
+	};
+	/**
+	 * Classify the \p count reports stored every \p stride bytes at
+	 * \p reports.
+	 *
+	 * Header bytes are first gathered in arrays, then classified by
+	 * branchless byte compares over whole arrays that the compiler
+	 * vectorizes (a batch of \ref ReadBatchSize reports fits in one
+	 * 128-bit vector per header field).
+	 */
+	static void classifyReports (const uint8_t *reports, std::size_t stride,
+				     const int *lengths, std::size_t count,
+				     ReportKind *kinds);
 
-	void processReport (std::vector<uint8_t> &&raw_report);
+	void processReport (Report &&report);
+	void processReport (Report &&report, ReportKind kind);
+
+	friend class DispatcherReactor;
+	friend class DispatcherPool;
+	friend class HybridDispatcher;
+	/**
+	 * Maximum number of reports read at once by \ref readNextReport.
+	 */
+	static constexpr std::size_t ReadBatchSize = 16;
+	// Bytes between two reports of a batch: the longest HID++ report of
+	// the device, longer foreign reports are truncated.
+	std::size_t _read_stride;
+	/**
+	 * Read and process the reports queued on the device, waiting at most
+	 * \p timeout for the first one.
+	 *
+	 * \returns false if reading failed, \c _exception is then set.
+	 */
+	bool readNextReport (int timeout);
+	void processRawReport (const uint8_t *report, std::size_t length,
+			       std::chrono::steady_clock::time_point time,
+			       ReportKind kind);
+	/**
+	 * Stop the dispatcher and fail pending commands and notifications
+	 * with \c _exception.
+	 */
+	void terminate ();
+	/**
+	 * Apply \ref setRealTimeOptions to the calling thread.
+	 */
+	void applyRealTimeOptions ();
 
 	HID::RawDevice _dev;
 	command_container _commands;
+	std::vector<Command> _command_slots;
+	std::size_t _free_command_slot;
+	std::size_t _pending_commands; // slots in use
+	// Set by stop (drain_deadline), new commands are refused.
+	std::optional<std::chrono::steady_clock::time_point> _drain_deadline;
+	unsigned int _in_flight_window, _in_flight;
+	std::array<unsigned int, DeviceSlotCount> _device_depth, _device_in_flight;
+	// Device slots whose commands wait for a reconnection, only modified
+	// with _command_mutex held but read without it for every report.
+	std::atomic<bool> _parking;
+	std::array<std::atomic<bool>, DeviceSlotCount> _parked;
+	// Pending commands that identical reads may attach to, entries of
+	// completed commands are removed when searching.
+	bool _read_coalescing;
+	std::vector<command_iterator> _coalesced_reads;
+	uint64_t _coalesced_read_count;
+	// Commands waiting for the in-flight window, per priority and device
+	// slot. Entries of cancelled commands are skipped when their turn
+	// comes.
+	struct WaitingLane
+	{
+		std::array<std::deque<command_iterator>, DeviceSlotCount> queues;
+		std::size_t count = 0; // including cancelled entries
+		std::size_t next_slot = 0; // round-robin position
+	};
+	std::array<WaitingLane, PriorityCount> _waiting_commands;
+	// Command deadlines. Entries are not removed when their command
+	// completes, the slot generation tells expired entries apart.
+	TimerWheel<command_iterator> _deadlines;
+	// When the reading thread checks deadlines next, a command with an
+	// earlier deadline must wake it up with _wakeup.
+	TimerWheel<command_iterator>::clock::time_point _next_deadline_check;
+	std::function<void ()> _wakeup; // replaced by DispatcherReactor
 	notification_container _notifications;
-	std::mutex _command_mutex, _listener_mutex;
+	mutable std::mutex _command_mutex;
+	mutable MemoryAccounting::Account _command_account; // protected by _command_mutex
+	std::mutex _notification_mutex;
 	bool _stopped;
 	std::exception_ptr _exception;
+	RealTime::Options _realtime;
 
 	template<typename Iterator,
-		 void (DispatcherThread::*cancel) (Iterator),
+		 bool (DispatcherThread::*cancel) (Iterator),
 		 std::mutex DispatcherThread::*mutex>
 	class AsyncReport;
 	using AsyncCommandResponse = DispatcherThread::AsyncReport<
@@ -99,7 +481,7 @@ private:
 	using AsyncNotification = DispatcherThread::AsyncReport<
 		DispatcherThread::notification_iterator,
 		&DispatcherThread::cancelNotification,
-		&DispatcherThread::_listener_mutex>;
+		&DispatcherThread::_notification_mutex>;
 	friend AsyncNotification;
 };
 
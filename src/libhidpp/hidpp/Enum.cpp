@@ -18,6 +18,7 @@
 
 #include "Enum.h"
 
+#include <algorithm>
 #include <sstream>
 
 using namespace HIDPP;
@@ -41,43 +42,57 @@ const char *InvalidEnumValueError::what () const noexcept
 	return _msg.c_str ();
 }
 
-EnumDesc::EnumDesc (std::initializer_list<container::value_type> values):
-	_values (values)
-{
-}
-
 EnumDesc::const_iterator EnumDesc::begin () const
 {
-	return _values.begin ();
+	return _entries;
 }
 
 EnumDesc::const_iterator EnumDesc::end () const
 {
-	return _values.end ();
+	return _entries + _count;
 }
 
 int EnumDesc::fromString (const std::string &str) const
 {
-	auto it = _values.find (str);
-	if (it == _values.end ())
+	int value;
+	if (!tryFromString (str, value))
 		throw InvalidEnumValueError (str);
-	return it->second;
+	return value;
+}
+
+bool EnumDesc::tryFromString (std::string_view str, int &value) const
+{
+	auto it = std::lower_bound (_by_name, _by_name + _count, str,
+				    [this] (uint16_t index, std::string_view str) {
+		return str.compare (_entries[index].name) > 0;
+	});
+	if (it == _by_name + _count || str != _entries[*it].name)
+		return false;
+	value = _entries[*it].value;
+	return true;
 }
 
 std::string EnumDesc::toString (int value) const
 {
-	for (const auto &p: _values)
-		if (p.second == value)
-			return p.first;
+	if (auto entry = findValue (value))
+		return entry->name;
 	throw InvalidEnumValueError (value);
 }
 
 bool EnumDesc::check (int value) const
 {
-	for (const auto &p: _values)
-		if (p.second == value)
-			return true;
-	return false;
+	return findValue (value) != nullptr;
+}
+
+const EnumEntry *EnumDesc::findValue (int value) const
+{
+	auto it = std::lower_bound (_by_value, _by_value + _count, value,
+				    [this] (uint16_t index, int value) {
+		return _entries[index].value < value;
+	});
+	if (it == _by_value + _count || _entries[*it].value != value)
+		return nullptr;
+	return &_entries[*it];
 }
 
 EnumValue::EnumValue (const EnumDesc &desc, int value):
@@ -19,8 +19,9 @@
 #ifndef LIBHIDPP_HIDPP_ENUM_H
 #define LIBHIDPP_HIDPP_ENUM_H
 
-#include <map>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace HIDPP
 {
@@ -37,24 +38,110 @@ private:
 	std::string _msg;
 };
 
-class EnumDesc
+struct EnumEntry
 {
-public:
-	typedef std::map<std::string, int> container;
-	typedef container::const_iterator const_iterator;
+	const char *name;
+	int value;
+};
 
-	EnumDesc (std::initializer_list<container::value_type> values);
+namespace detail
+{
+constexpr int compareNames (const char *a, const char *b)
+{
+	while (*a != '\0' && *a == *b) {
+		++a;
+		++b;
+	}
+	return static_cast<unsigned char> (*a) - static_cast<unsigned char> (*b);
+}
+}
 
+/**
+ * Enum entries with indexes sorted by name and by value, built at
+ * compile time:
+ *
+ *     static constexpr EnumTable Table ({ { "A", 1 }, { "B", 2 } });
+ *     const EnumDesc Desc (Table);
+ */
+template<std::size_t N>
+struct EnumTable
+{
+	EnumEntry entries[N];
+	uint16_t by_name[N];
+	uint16_t by_value[N];
+
+	constexpr EnumTable (const EnumEntry (&values)[N]):
+		entries (), by_name (), by_value ()
+	{
+		static_assert (N <= 0xffff, "too many enum entries");
+		for (std::size_t i = 0; i < N; ++i) {
+			entries[i] = values[i];
+			// insertion sorts
+			std::size_t j = i;
+			for (; j > 0 && detail::compareNames (entries[by_name[j-1]].name, values[i].name) > 0; --j)
+				by_name[j] = by_name[j-1];
+			by_name[j] = i;
+			j = i;
+			for (; j > 0 && entries[by_value[j-1]].value > values[i].value; --j)
+				by_value[j] = by_value[j-1];
+			by_value[j] = i;
+		}
+	}
+};
+
+template<std::size_t N>
+EnumTable (const EnumEntry (&)[N]) -> EnumTable<N>;
+
+/**
+ * Names of the values of an enum.
+ *
+ * Descriptions refer to a static EnumTable, they are constant
+ * initialized and lookups are binary searches that do not allocate.
+ */
+class EnumDesc
+{
+public:
+	typedef const EnumEntry *const_iterator;
+
+	template<std::size_t N>
+	constexpr EnumDesc (const EnumTable<N> &table):
+		_entries (table.entries),
+		_by_name (table.by_name),
+		_by_value (table.by_value),
+		_count (N)
+	{
+	}
+
+	/**
+	 * Iterate over entries in declaration order.
+	 */
 	const_iterator begin () const;
 	const_iterator end () const;
 
+	/**
+	 * \throws InvalidEnumValueError if \p str is not a name in the enum.
+	 */
 	int fromString (const std::string &str) const;
+	/**
+	 * Non-throwing version of fromString.
+	 *
+	 * \returns false if \p str is not a name in the enum.
+	 */
+	bool tryFromString (std::string_view str, int &value) const;
+	/**
+	 * \throws InvalidEnumValueError if \p value is not in the enum.
+	 */
 	std::string toString (int value) const;
 
 	bool check (int value) const;
 
 private:
-	std::map<std::string, int> _values;
+	const EnumEntry *findValue (int value) const;
+
+	const EnumEntry *_entries;
+	const uint16_t *_by_name;
+	const uint16_t *_by_value;
+	std::size_t _count;
 };
 
 class EnumValue
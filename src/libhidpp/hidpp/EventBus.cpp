@@ -0,0 +1,151 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "EventBus.h"
+
+#include <algorithm>
+
+using namespace HIDPP;
+
+EventBus::Cursor::Cursor (EventBus *bus, uint64_t position):
+	_bus (bus),
+	_position (position),
+	_lost (0)
+{
+}
+
+std::optional<Report> EventBus::Cursor::tryNext ()
+{
+	while (true) {
+		uint64_t write_position = _bus->_write_position.load (std::memory_order_acquire);
+		if (write_position - _position > _bus->_capacity) {
+			_lost += write_position - _bus->_capacity - _position;
+			_position = write_position - _bus->_capacity;
+		}
+		if (_position == write_position)
+			return std::nullopt;
+		// Read the slot as a seqlock, the copy is discarded if the
+		// writer overwrote it meanwhile.
+		const Slot &slot = _bus->_slots[_position % _bus->_capacity];
+		uint64_t expected = 2*_position+2;
+		if (slot.sequence.load (std::memory_order_acquire) == expected) {
+			std::size_t length = slot.length;
+			std::array<uint8_t, MaxReportLength> data = slot.data;
+			auto receive_time = slot.receive_time;
+			auto report_sequence = slot.report_sequence;
+			std::atomic_thread_fence (std::memory_order_acquire);
+			if (slot.sequence.load (std::memory_order_relaxed) == expected) {
+				++_position;
+				Report report (data.data (), length);
+				report.setReceiveTime (receive_time);
+				report.setSequence (report_sequence);
+				return report;
+			}
+		}
+		// The writer lapped this cursor
+		++_lost;
+		++_position;
+	}
+}
+
+std::optional<Report> EventBus::Cursor::next (int timeout)
+{
+	auto deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeout);
+	while (true) {
+		if (auto report = tryNext ())
+			return report;
+		std::unique_lock<std::mutex> lock (_bus->_mutex);
+		_bus->_waiters.fetch_add (1, std::memory_order_seq_cst);
+		bool ready = true;
+		while (_bus->_write_position.load (std::memory_order_seq_cst) == _position &&
+				!_bus->_interrupted) {
+			if (timeout < 0)
+				_bus->_condvar.wait (lock);
+			else if (_bus->_condvar.wait_until (lock, deadline) == std::cv_status::timeout) {
+				ready = _bus->_write_position.load () != _position;
+				break;
+			}
+		}
+		_bus->_waiters.fetch_sub (1, std::memory_order_relaxed);
+		if (!ready || _bus->_write_position.load () == _position)
+			return std::nullopt;
+	}
+}
+
+uint64_t EventBus::Cursor::lost () const
+{
+	return _lost;
+}
+
+EventBus::EventBus (Dispatcher *dispatcher, std::size_t capacity):
+	_dispatcher (dispatcher),
+	_capacity (capacity > 0 ? capacity : 1),
+	_slots (new Slot[_capacity]),
+	_write_position (0),
+	_waiters (0),
+	_interrupted (false)
+{
+	for (std::size_t i = 0; i < _capacity; ++i)
+		_slots[i].sequence.store (0, std::memory_order_relaxed);
+}
+
+EventBus::~EventBus ()
+{
+	for (const auto &it: _listeners)
+		_dispatcher->unregisterEventHandler (it);
+}
+
+void EventBus::subscribe (DeviceIndex index, uint8_t sub_id)
+{
+	_listeners.push_back (_dispatcher->registerEventHandler (index, sub_id,
+		[this] (const Report &report) {
+			publish (report);
+			return true;
+		}));
+}
+
+void EventBus::publish (const Report &report)
+{
+	uint64_t position = _write_position.load (std::memory_order_relaxed);
+	Slot &slot = _slots[position % _capacity];
+	slot.sequence.store (2*position+1, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_release);
+	slot.length = report.rawLength ();
+	std::copy_n (report.rawData (), slot.length, slot.data.begin ());
+	slot.receive_time = report.receiveTime ();
+	slot.report_sequence = report.sequence ();
+	slot.sequence.store (2*position+2, std::memory_order_release);
+	_write_position.store (position+1, std::memory_order_seq_cst);
+	if (_waiters.load (std::memory_order_seq_cst) > 0) {
+		std::unique_lock<std::mutex> lock (_mutex);
+		lock.unlock ();
+		_condvar.notify_all ();
+	}
+}
+
+EventBus::Cursor EventBus::cursor ()
+{
+	return Cursor (this, _write_position.load (std::memory_order_acquire));
+}
+
+void EventBus::interrupt ()
+{
+	// Not locking the mutex lets signal handlers interrupt the bus
+	_interrupted = true;
+	_condvar.notify_all ();
+}
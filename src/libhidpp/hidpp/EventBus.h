@@ -0,0 +1,139 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_EVENT_BUS_H
+#define LIBHIDPP_HIDPP_EVENT_BUS_H
+
+#include <hidpp/Dispatcher.h>
+#include <hidpp/Report.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * Broadcast ring of event reports.
+ *
+ * The reading thread writes each event once in the ring. Any number of
+ * consumers read them at their own pace through a Cursor, so adding
+ * consumers does not add work to the reading thread.
+ *
+ * The ring has a fixed capacity: a consumer that falls more than
+ * \c capacity events behind skips the oldest ones and they are counted
+ * as lost.
+ *
+ * There must be only one writer (the dispatcher reading thread when
+ * using subscribe()).
+ */
+class EventBus
+{
+	struct Slot
+	{
+		// 2*position+1 while the slot is written, 2*position+2 once done
+		std::atomic<uint64_t> sequence;
+		std::size_t length;
+		std::array<uint8_t, MaxReportLength> data;
+		std::chrono::steady_clock::time_point receive_time;
+		uint64_t report_sequence;
+	};
+public:
+	class Cursor
+	{
+	public:
+		/**
+		 * Get the next event.
+		 *
+		 * \param timeout	Time-out in milliseconds, negative for no timeout.
+		 *
+		 * \returns the next event report or an invalid value if
+		 * interrupted or timed out.
+		 */
+		std::optional<Report> next (int timeout = -1);
+		/**
+		 * Get the next event if there is one, without waiting nor
+		 * locking.
+		 */
+		std::optional<Report> tryNext ();
+
+		/**
+		 * Number of events skipped because this cursor fell behind.
+		 */
+		uint64_t lost () const;
+
+	private:
+		friend class EventBus;
+		Cursor (EventBus *bus, uint64_t position);
+
+		EventBus *_bus;
+		uint64_t _position;
+		uint64_t _lost;
+	};
+
+	/**
+	 * \param dispatcher	Dispatcher used by subscribe(), it must outlive the bus.
+	 * \param capacity	Number of events kept in the ring.
+	 */
+	EventBus (Dispatcher *dispatcher, std::size_t capacity = 256);
+	~EventBus ();
+
+	/**
+	 * Publish the events matching \p index and \p sub_id from the
+	 * dispatcher on the bus.
+	 */
+	void subscribe (DeviceIndex index, uint8_t sub_id);
+
+	/**
+	 * Write an event in the ring.
+	 */
+	void publish (const Report &report);
+
+	/**
+	 * Create a cursor reading the events published from now on.
+	 */
+	Cursor cursor ();
+
+	/**
+	 * Make the current and future calls to Cursor::next return false
+	 * once they reach the last event.
+	 */
+	void interrupt ();
+
+private:
+	Dispatcher *_dispatcher;
+	std::vector<Dispatcher::listener_iterator> _listeners;
+	std::size_t _capacity;
+	std::unique_ptr<Slot[]> _slots;
+	std::atomic<uint64_t> _write_position;
+	std::atomic<unsigned int> _waiters;
+	std::atomic<bool> _interrupted;
+	std::mutex _mutex;
+	std::condition_variable _condvar;
+};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "EventMerge.h"
+
+#include <algorithm>
+#include <thread>
+
+using namespace HIDPP;
+
+namespace
+{
+// Polling period bounds while waiting for the buses
+constexpr std::chrono::microseconds MinPollPeriod (50), MaxPollPeriod (1000);
+}
+
+EventMerge::EventMerge (std::chrono::microseconds window):
+	_window (window),
+	_last_sequence (0),
+	_late (0),
+	_interrupted (false)
+{
+}
+
+void EventMerge::add (EventBus &bus)
+{
+	_streams.push_back ({ bus.cursor (), std::nullopt });
+}
+
+std::optional<Report> EventMerge::next (int timeout)
+{
+	auto deadline = clock::now () + std::chrono::milliseconds (timeout);
+	// The buses cannot be waited for together without locking them,
+	// they are polled with a backoff instead.
+	auto period = MinPollPeriod;
+	while (!_interrupted) {
+		auto now = clock::now ();
+		if (auto report = tryNext (now))
+			return report;
+		if (timeout >= 0 && now >= deadline)
+			break;
+		auto wake = now + period;
+		if (!_heap.empty ())
+			wake = std::min (wake, releaseTime ());
+		if (timeout >= 0)
+			wake = std::min (wake, deadline);
+		std::this_thread::sleep_until (wake);
+		period = std::min (2*period, MaxPollPeriod);
+	}
+	return std::nullopt;
+}
+
+std::optional<Report> EventMerge::tryNext ()
+{
+	return tryNext (clock::now ());
+}
+
+std::optional<Report> EventMerge::tryNext (clock::time_point now)
+{
+	auto later = [this] (std::size_t a, std::size_t b) {
+		return _streams[a].head->sequence () > _streams[b].head->sequence ();
+	};
+	for (std::size_t i = 0; i < _streams.size (); ++i) {
+		auto &stream = _streams[i];
+		if (stream.head)
+			continue;
+		stream.head = stream.cursor.tryNext ();
+		if (stream.head) {
+			_heap.push_back (i);
+			std::push_heap (_heap.begin (), _heap.end (), later);
+		}
+	}
+	if (_heap.empty ())
+		return std::nullopt;
+	// An idle bus may still publish an older event during the window
+	if (_heap.size () < _streams.size () && now < releaseTime ())
+		return std::nullopt;
+	std::pop_heap (_heap.begin (), _heap.end (), later);
+	auto &stream = _streams[_heap.back ()];
+	_heap.pop_back ();
+	Report report = std::move (*stream.head);
+	stream.head.reset ();
+	if (report.sequence () < _last_sequence)
+		++_late;
+	else
+		_last_sequence = report.sequence ();
+	return report;
+}
+
+EventMerge::clock::time_point EventMerge::releaseTime () const
+{
+	return _streams[_heap.front ()].head->receiveTime () + _window;
+}
+
+void EventMerge::interrupt ()
+{
+	_interrupted = true;
+}
+
+uint64_t EventMerge::lost () const
+{
+	uint64_t lost = 0;
+	for (const auto &stream: _streams)
+		lost += stream.cursor.lost ();
+	return lost;
+}
+
+uint64_t EventMerge::late () const
+{
+	return _late;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_EVENT_MERGE_H
+#define LIBHIDPP_HIDPP_EVENT_MERGE_H
+
+#include <hidpp/EventBus.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * K-way merge of the events of several EventBus (e.g. one per
+ * dispatcher) into a single stream ordered by Report::sequence.
+ *
+ * The next event of every bus is kept in a heap, so merging costs
+ * O(log k) per event for k buses. Buses are read with
+ * EventBus::Cursor::tryNext: the merge never locks and never slows
+ * down the dispatchers.
+ *
+ * An event is only returned once no bus can still publish an older
+ * one: when every bus has an event pending, or when the event was read
+ * more than \c window ago (the window covers the time a dispatcher takes
+ * from reading a report to publishing it). An older event published
+ * after that is still returned, out of order, and counted by \ref late.
+ *
+ * Events published without a sequence (0) come first. A merge must be
+ * read from a single thread.
+ */
+class EventMerge
+{
+public:
+	EventMerge (std::chrono::microseconds window = std::chrono::milliseconds (2));
+
+	/**
+	 * Merge the events published on \p bus from now on, the bus must
+	 * outlive the merge.
+	 */
+	void add (EventBus &bus);
+
+	/**
+	 * Get the next event in sequence order.
+	 *
+	 * \param timeout	Time-out in milliseconds, negative for no timeout.
+	 *
+	 * \returns the next event or an invalid value if interrupted or
+	 * timed out.
+	 */
+	std::optional<Report> next (int timeout = -1);
+	/**
+	 * Get the next event if it can already be ordered, without waiting.
+	 */
+	std::optional<Report> tryNext ();
+
+	/**
+	 * Make \ref next return, from any thread or a signal handler.
+	 */
+	void interrupt ();
+
+	/**
+	 * Events skipped because the merge fell behind a bus.
+	 */
+	uint64_t lost () const;
+	/**
+	 * Events returned after a newer event.
+	 */
+	uint64_t late () const;
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	std::optional<Report> tryNext (clock::time_point now);
+	// Time when the first pending event can be returned
+	clock::time_point releaseTime () const;
+
+	struct Stream
+	{
+		EventBus::Cursor cursor;
+		std::optional<Report> head;
+	};
+	const std::chrono::microseconds _window;
+	std::vector<Stream> _streams;
+	std::vector<std::size_t> _heap; // streams with a head, by head sequence
+	uint64_t _last_sequence;
+	uint64_t _late;
+	std::atomic<bool> _interrupted;
+};
+
+}
+
+#endif
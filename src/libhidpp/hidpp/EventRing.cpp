@@ -0,0 +1,216 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "EventRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+extern "C" {
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+using namespace HIDPP;
+
+static constexpr uint32_t Magic = 0x48455652; // "HEVR"
+
+struct EventRing::Header
+{
+	uint32_t magic;
+	uint32_t slot_count;
+	alignas (64) std::atomic<uint64_t> head; // index of the next report written
+};
+
+struct EventRing::Slot
+{
+	// index+1 of the report in the slot, 0 while it is written
+	std::atomic<uint64_t> sequence;
+	std::atomic<uint64_t> length;
+	std::atomic<uint64_t> words[MaxReportLength/8];
+};
+
+static_assert (std::atomic<uint64_t>::is_always_lock_free,
+	       "shared memory atomics must be lock-free");
+
+std::size_t EventRing::mapSize (std::size_t slot_count)
+{
+	return sizeof (Header) + slot_count * sizeof (Slot);
+}
+
+EventRing::EventRing (int fd, std::size_t map_size):
+	_fd (fd), _map (MAP_FAILED), _map_size (map_size),
+	_header (nullptr), _slots (nullptr), _read_index (0)
+{
+}
+
+EventRing::EventRing (std::size_t slot_count):
+	EventRing (-1, 0)
+{
+	std::size_t count = 1;
+	while (count < slot_count)
+		count <<= 1;
+	_map_size = mapSize (count);
+	_fd = memfd_create ("hidpp-events", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (_fd == -1)
+		throw std::system_error (errno, std::system_category (), "memfd_create");
+	// The reader can trust the size once it is sealed
+	if (-1 == ftruncate (_fd, _map_size)) {
+		int err = errno;
+		close (_fd);
+		throw std::system_error (err, std::system_category (), "ftruncate");
+	}
+	if (-1 == fcntl (_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+		int err = errno;
+		close (_fd);
+		throw std::system_error (err, std::system_category (), "F_ADD_SEALS");
+	}
+	_map = mmap (nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (_map == MAP_FAILED) {
+		int err = errno;
+		close (_fd);
+		throw std::system_error (err, std::system_category (), "mmap");
+	}
+	_header = new (_map) Header;
+	_header->magic = Magic;
+	_header->slot_count = count;
+	_header->head.store (0, std::memory_order_relaxed);
+	_slots = reinterpret_cast<Slot *> (_header + 1);
+	for (std::size_t i = 0; i < count; ++i) {
+		new (&_slots[i]) Slot;
+		_slots[i].sequence.store (0, std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence (std::memory_order_release);
+}
+
+EventRing EventRing::attach (int fd)
+{
+	struct stat st;
+	if (-1 == fstat (fd, &st)) {
+		int err = errno;
+		close (fd);
+		throw std::system_error (err, std::system_category (), "fstat");
+	}
+	EventRing ring (fd, st.st_size);
+	if (ring._map_size < sizeof (Header))
+		throw std::runtime_error ("Invalid event ring size");
+	// The reader only needs read access
+	ring._map = mmap (nullptr, ring._map_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (ring._map == MAP_FAILED)
+		throw std::system_error (errno, std::system_category (), "mmap");
+	ring._header = static_cast<Header *> (ring._map);
+	auto count = ring._header->slot_count;
+	if (ring._header->magic != Magic || count == 0 || (count & (count-1)) != 0 ||
+			mapSize (count) != ring._map_size)
+		throw std::runtime_error ("Invalid event ring");
+	ring._slots = reinterpret_cast<Slot *> (ring._header + 1);
+	ring._read_index = ring._header->head.load (std::memory_order_acquire);
+	return ring;
+}
+
+EventRing::EventRing (EventRing &&other):
+	_fd (other._fd), _map (other._map), _map_size (other._map_size),
+	_header (other._header), _slots (other._slots),
+	_read_index (other._read_index)
+{
+	other._fd = -1;
+	other._map = MAP_FAILED;
+}
+
+EventRing::~EventRing ()
+{
+	if (_map != MAP_FAILED)
+		munmap (_map, _map_size);
+	if (_fd != -1)
+		close (_fd);
+}
+
+int EventRing::fd () const noexcept
+{
+	return _fd;
+}
+
+std::size_t EventRing::slotCount () const noexcept
+{
+	return _header->slot_count;
+}
+
+void EventRing::push (const uint8_t *report, std::size_t length) noexcept
+{
+	uint64_t index = _header->head.load (std::memory_order_relaxed);
+	Slot &slot = _slots[index & (_header->slot_count-1)];
+	slot.sequence.store (0, std::memory_order_relaxed);
+	std::atomic_thread_fence (std::memory_order_release);
+	length = std::min (length, MaxReportLength);
+	uint8_t buffer[MaxReportLength] = {};
+	std::copy_n (report, length, buffer);
+	slot.length.store (length, std::memory_order_relaxed);
+	for (std::size_t i = 0; i < MaxReportLength/8; ++i) {
+		uint64_t word;
+		memcpy (&word, &buffer[i*8], sizeof (word));
+		slot.words[i].store (word, std::memory_order_relaxed);
+	}
+	slot.sequence.store (index+1, std::memory_order_release);
+	_header->head.store (index+1, std::memory_order_release);
+}
+
+std::size_t EventRing::pop (uint8_t *report, std::size_t length, uint64_t *lost) noexcept
+{
+	uint64_t count = _header->slot_count;
+	uint64_t head = _header->head.load (std::memory_order_acquire);
+	uint64_t skipped = 0;
+	std::size_t ret = 0;
+	while (_read_index < head) {
+		if (head - _read_index > count) {
+			skipped += head - count - _read_index;
+			_read_index = head - count;
+		}
+		const Slot &slot = _slots[_read_index & (count-1)];
+		uint64_t sequence = slot.sequence.load (std::memory_order_acquire);
+		if (sequence != _read_index+1) {
+			// Overwritten by a later report
+			++skipped;
+			++_read_index;
+			continue;
+		}
+		uint8_t buffer[MaxReportLength];
+		std::size_t report_length = slot.length.load (std::memory_order_relaxed);
+		for (std::size_t i = 0; i < MaxReportLength/8; ++i) {
+			uint64_t word = slot.words[i].load (std::memory_order_relaxed);
+			memcpy (&buffer[i*8], &word, sizeof (word));
+		}
+		std::atomic_thread_fence (std::memory_order_acquire);
+		++_read_index;
+		if (slot.sequence.load (std::memory_order_relaxed) != sequence) {
+			++skipped; // overwritten while copying
+			continue;
+		}
+		ret = std::min ({ length, report_length, MaxReportLength });
+		std::copy_n (buffer, ret, report);
+		break;
+	}
+	if (lost)
+		*lost += skipped;
+	return ret;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_EVENT_RING_H
+#define LIBHIDPP_HIDPP_EVENT_RING_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace HIDPP
+{
+
+/**
+ * Ring of HID++ reports in shared memory, written by one process and
+ * read by another (the hidppd daemon and one of its clients).
+ *
+ * The ring lives in a memfd that is passed to the reader. The writer
+ * never waits for the reader: when the reader falls more than the
+ * ring size behind, the oldest reports are overwritten and the reader
+ * counts them as lost. Each slot is protected by a sequence number so
+ * that the reader detects slots overwritten while it copies them.
+ *
+ * Only one thread may push and one thread may pop. Only implemented on
+ * Linux.
+ */
+class EventRing
+{
+public:
+	static constexpr std::size_t MaxReportLength = 64;
+
+	/**
+	 * Create a ring with at least \p slot_count slots (rounded up to a
+	 * power of two) in a new memfd.
+	 *
+	 * \throws std::system_error
+	 */
+	explicit EventRing (std::size_t slot_count);
+	/**
+	 * Map the ring created by another process, taking ownership of
+	 * \p fd. Reading starts at the current write position.
+	 *
+	 * \throws std::system_error if \p fd cannot be mapped or
+	 * std::runtime_error if it does not hold a ring.
+	 */
+	static EventRing attach (int fd);
+	EventRing (EventRing &&other);
+	EventRing (const EventRing &) = delete;
+	~EventRing ();
+
+	/**
+	 * File descriptor of the memfd, to be passed to the reader.
+	 */
+	int fd () const noexcept;
+	std::size_t slotCount () const noexcept;
+
+	/**
+	 * Write a report, reports longer than \ref MaxReportLength are
+	 * truncated.
+	 */
+	void push (const uint8_t *report, std::size_t length) noexcept;
+	/**
+	 * Read the next report.
+	 *
+	 * \param lost	Incremented by the number of reports overwritten
+	 *		before they were read.
+	 * \returns the report length, 0 if the ring is empty.
+	 */
+	std::size_t pop (uint8_t *report, std::size_t length, uint64_t *lost = nullptr) noexcept;
+
+private:
+	struct Header;
+	struct Slot;
+
+	EventRing (int fd, std::size_t map_size);
+	static std::size_t mapSize (std::size_t slot_count);
+
+	int _fd;
+	void *_map;
+	std::size_t _map_size;
+	Header *_header;
+	Slot *_slots;
+	uint64_t _read_index;
+};
+
+}
+
+#endif
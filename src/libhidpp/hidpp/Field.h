@@ -19,6 +19,7 @@
 #ifndef LIBHIDPP_HIDPP_FIELD_H
 #define LIBHIDPP_HIDPP_FIELD_H
 
+#include <hidpp/Setting.h>
 #include <misc/Endian.h>
 
 namespace HIDPP
@@ -31,6 +32,12 @@ enum ByteOrder
 	LittleEndian,
 };
 
+/**
+ * Fields describe the layout of a byte buffer (e.g. a profile) as
+ * constexpr offsets. They access either vector iterators or raw byte
+ * pointers (stack buffers, mapped images), multi-byte values are read
+ * and written with single loads and stores (see misc/Endian.h).
+ */
 template<typename T, ByteOrder BO = Undefined>
 class Field;
 
@@ -46,12 +53,24 @@ public:
 	{
 	}
 
+	typename std::enable_if<sizeof (T) == sizeof (uint8_t), T>::type
+	read (const uint8_t *data) const
+	{
+		return static_cast<T> (data[offset]);
+	}
+
 	typename std::enable_if<sizeof (T) == sizeof (uint8_t), T>::type
 	read (std::vector<uint8_t>::const_iterator it) const
 	{
 		return static_cast<T> (*(it+offset));
 	}
 
+	typename std::enable_if<sizeof (T) == sizeof (uint8_t)>::type
+	write (uint8_t *data, T value) const
+	{
+		data[offset] = static_cast<uint8_t> (value);
+	}
+
 	typename std::enable_if<sizeof (T) == sizeof (uint8_t)>::type
 	write (std::vector<uint8_t>::iterator it, T value) const
 	{
@@ -71,14 +90,24 @@ public:
 	{
 	}
 
+	T read (const uint8_t *data) const
+	{
+		return readBE<T> (data+offset);
+	}
+
 	T read (std::vector<uint8_t>::const_iterator it) const
 	{
-		return readBE<T> (it+offset);
+		return read (&*it);
+	}
+
+	void write (uint8_t *data, T value) const
+	{
+		writeBE (data+offset, value);
 	}
 
 	void write (std::vector<uint8_t>::iterator it, T value) const
 	{
-		writeBE (it+offset, value);
+		write (&*it, value);
 	}
 };
 
@@ -94,14 +123,24 @@ public:
 	{
 	}
 
+	T read (const uint8_t *data) const
+	{
+		return readLE<T> (data+offset);
+	}
+
 	T read (std::vector<uint8_t>::const_iterator it) const
 	{
-		return readLE<T> (it+offset);
+		return read (&*it);
+	}
+
+	void write (uint8_t *data, T value) const
+	{
+		writeLE (data+offset, value);
 	}
 
 	void write (std::vector<uint8_t>::iterator it, T value) const
 	{
-		writeLE (it+offset, value);
+		write (&*it, value);
 	}
 };
 
@@ -117,12 +156,14 @@ public:
 	{
 	}
 
-	Color read (std::vector<uint8_t>::const_iterator it) const
+	template<typename It>
+	Color read (It it) const
 	{
 		return { it[offset+0], it[offset+1], it[offset+2] };
 	}
 
-	void write (std::vector<uint8_t>::iterator it, Color value) const
+	template<typename It>
+	void write (It it, Color value) const
 	{
 		it[offset+0] = value.r;
 		it[offset+1] = value.g;
@@ -130,6 +171,21 @@ public:
 	}
 };
 
+/**
+ * Offset of the byte following \p field, for declaring consecutive
+ * fields without computing their offsets:
+ * \code
+ * static constexpr auto First =	Field<uint16_t, BigEndian> (0);
+ * static constexpr auto Second =	Field<uint8_t> (after (First));
+ * static_assert (after (Second) == 3);
+ * \endcode
+ */
+template<typename F>
+constexpr unsigned int after (const F &field)
+{
+	return field.offset + F::size;
+}
+
 template<typename T, std::size_t Count, ByteOrder BO = Undefined>
 class ArrayField
 {
@@ -143,12 +199,14 @@ public:
 	{
 	}
 
-	T read (std::vector<uint8_t>::const_iterator it, unsigned int index) const
+	template<typename It>
+	T read (It it, unsigned int index) const
 	{
 		return ItemField (offset + index * sizeof (T)).read (it);
 	}
 
-	void write (std::vector<uint8_t>::iterator it, unsigned int index, T value) const
+	template<typename It>
+	void write (It it, unsigned int index, T value) const
 	{
 		ItemField (offset + index * sizeof (T)).write (it, value);
 	}
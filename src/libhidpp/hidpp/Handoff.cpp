@@ -0,0 +1,170 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Handoff.h"
+
+#include <misc/Endian.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+extern "C" {
+#include <unistd.h>
+#include <sys/socket.h>
+}
+
+using namespace HIDPP;
+
+// Each item is a header (name length, data length and file descriptor
+// count, 32 bits little endian) carrying the file descriptors, followed
+// by the name and the data. The stream starts with the item count.
+static constexpr std::size_t HeaderSize = 12;
+
+static void sendAll (int socket, const uint8_t *data, std::size_t length,
+		     const std::vector<int> &fds = {})
+{
+	union {
+		cmsghdr header;
+		char buffer[CMSG_SPACE (sizeof (int) * Handoff::MaxItemFDs)];
+	} control;
+	bool send_fds = !fds.empty ();
+	while (length > 0) {
+		iovec iov = { const_cast<uint8_t *> (data), length };
+		msghdr msg;
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (send_fds) {
+			memset (&control, 0, sizeof (control));
+			msg.msg_control = control.buffer;
+			msg.msg_controllen = CMSG_SPACE (sizeof (int) * fds.size ());
+			cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN (sizeof (int) * fds.size ());
+			memcpy (CMSG_DATA (cmsg), fds.data (), sizeof (int) * fds.size ());
+		}
+		ssize_t ret = sendmsg (socket, &msg, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::system_error (errno, std::system_category (), "sendmsg");
+		}
+		send_fds = false; // sent with the first byte
+		data += ret;
+		length -= ret;
+	}
+}
+
+static void receiveAll (int socket, uint8_t *data, std::size_t length,
+			std::vector<int> *fds = nullptr)
+{
+	union {
+		cmsghdr header;
+		char buffer[CMSG_SPACE (sizeof (int) * Handoff::MaxItemFDs)];
+	} control;
+	while (length > 0) {
+		iovec iov = { data, length };
+		msghdr msg;
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (fds) {
+			msg.msg_control = control.buffer;
+			msg.msg_controllen = sizeof (control.buffer);
+		}
+		ssize_t ret = recvmsg (socket, &msg, MSG_CMSG_CLOEXEC);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::system_error (errno, std::system_category (), "recvmsg");
+		}
+		if (ret == 0)
+			throw std::runtime_error ("handoff stream ended early");
+		if (fds) {
+			for (cmsghdr *cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+				if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+					continue;
+				std::size_t count = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+				const uint8_t *fd_data = CMSG_DATA (cmsg);
+				for (std::size_t i = 0; i < count; ++i) {
+					int fd;
+					memcpy (&fd, fd_data + i*sizeof (int), sizeof (int));
+					fds->push_back (fd);
+				}
+			}
+			if (msg.msg_flags & MSG_CTRUNC) {
+				for (int fd: *fds)
+					close (fd);
+				fds->clear ();
+				throw std::runtime_error ("too many file descriptors in handoff item");
+			}
+			fds = nullptr; // only the first byte carries them
+		}
+		data += ret;
+		length -= ret;
+	}
+}
+
+void Handoff::send (int socket, const std::vector<Item> &items)
+{
+	uint8_t count[4];
+	writeLE<uint32_t> (count, items.size ());
+	sendAll (socket, count, sizeof (count));
+	for (const auto &item: items) {
+		if (item.fds.size () > MaxItemFDs)
+			throw std::invalid_argument ("too many file descriptors in handoff item");
+		uint8_t header[HeaderSize];
+		writeLE<uint32_t> (&header[0], item.name.size ());
+		writeLE<uint32_t> (&header[4], item.data.size ());
+		writeLE<uint32_t> (&header[8], item.fds.size ());
+		sendAll (socket, header, sizeof (header), item.fds);
+		sendAll (socket, reinterpret_cast<const uint8_t *> (item.name.data ()), item.name.size ());
+		sendAll (socket, item.data.data (), item.data.size ());
+	}
+}
+
+std::vector<Handoff::Item> Handoff::receive (int socket)
+{
+	std::vector<Item> items;
+	try {
+		uint8_t count[4];
+		receiveAll (socket, count, sizeof (count));
+		for (uint32_t i = readLE<uint32_t> (count); i > 0; --i) {
+			Item item;
+			uint8_t header[HeaderSize];
+			receiveAll (socket, header, sizeof (header), &item.fds);
+			items.push_back (item);
+			if (item.fds.size () != readLE<uint32_t> (&header[8]))
+				throw std::runtime_error ("missing file descriptors in handoff item");
+			auto &last = items.back ();
+			last.name.resize (readLE<uint32_t> (&header[0]));
+			last.data.resize (readLE<uint32_t> (&header[4]));
+			receiveAll (socket, reinterpret_cast<uint8_t *> (last.name.data ()), last.name.size ());
+			receiveAll (socket, last.data.data (), last.data.size ());
+		}
+	}
+	catch (...) {
+		for (const auto &item: items)
+			for (int fd: item.fds)
+				close (fd);
+		throw;
+	}
+	return items;
+}
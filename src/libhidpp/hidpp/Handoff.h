@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_HANDOFF_H
+#define LIBHIDPP_HIDPP_HANDOFF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * State handed by a process to its replacement through a Unix socket,
+ * so that a service can restart without reopening and rediscovering
+ * its devices.
+ *
+ * A handoff is a list of items, each with a name, opaque data and file
+ * descriptors passed with SCM_RIGHTS. Devices are passed as their
+ * hidraw file descriptor (see HID::RawDevice::fileDescriptor and
+ * HID::RawDevice::adoptFileDescriptor): the reports queued in it are
+ * kept, the new process reads them after the old one stops.
+ *
+ * On-disk caches (HIDPP20::DescriptorCache, PageCache) are handed off
+ * by saving them before sending and loading them in the new process.
+ *
+ * Only implemented on Linux.
+ */
+namespace Handoff
+{
+	/**
+	 * Maximum number of file descriptors in an item.
+	 */
+	constexpr std::size_t MaxItemFDs = 16;
+
+	struct Item
+	{
+		std::string name;
+		std::vector<uint8_t> data;
+		std::vector<int> fds;
+	};
+
+	/**
+	 * Send \p items on the connected stream socket \p socket. The
+	 * file descriptors are duplicated in the receiving process, the
+	 * caller still owns them.
+	 *
+	 * \throws std::system_error
+	 */
+	void send (int socket, const std::vector<Item> &items);
+	/**
+	 * Receive every item sent with \ref send. The caller owns the
+	 * received file descriptors.
+	 *
+	 * \throws std::system_error, or std::runtime_error if the stream
+	 * is invalid or ends early.
+	 */
+	std::vector<Item> receive (int socket);
+}
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "HybridDispatcher.h"
+
+#include <misc/Log.h>
+
+using namespace HIDPP;
+
+class HybridDispatcher::AsyncReport: public Dispatcher::AsyncReport
+{
+	HybridDispatcher *dispatcher;
+	std::shared_ptr<Completion> completion;
+	command_iterator it;
+public:
+	AsyncReport (HybridDispatcher *dispatcher, std::shared_ptr<Completion> &&completion, command_iterator it):
+		dispatcher (dispatcher), completion (std::move (completion)), it (it)
+	{
+	}
+
+	virtual Report get ()
+	{
+		dispatcher->wait (*completion, std::nullopt);
+		return result (*completion);
+	}
+
+	virtual Report get (int timeout)
+	{
+		auto deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeout);
+		// cancel the command, unless its answer is being delivered
+		if (!dispatcher->wait (*completion, deadline) && dispatcher->cancel (it))
+			throw Dispatcher::TimeoutError ();
+		dispatcher->wait (*completion, std::nullopt);
+		return result (*completion);
+	}
+};
+
+HybridDispatcher::HybridDispatcher (const char *path):
+	DispatcherThread (path),
+	_leading (false),
+	_followers (0),
+	_async_commands (0),
+	_reader_running (false),
+	_closing (false)
+{
+}
+
+HybridDispatcher::~HybridDispatcher ()
+{
+	{
+		std::unique_lock<std::mutex> lock (_leader_mutex);
+		_closing = true;
+		_leader_cond.notify_all ();
+	}
+	_dev.interruptRead ();
+	if (_reader.joinable ())
+		_reader.join ();
+	_exception = std::make_exception_ptr (NotRunning ());
+	terminate ();
+}
+
+std::unique_ptr<Dispatcher::AsyncReport> HybridDispatcher::sendCommand (Report &&report)
+{
+	auto completion = std::make_shared<Completion> ();
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	auto it = addCommand (std::move (report), completionHandler (completion));
+	return std::make_unique<AsyncReport> (this, std::move (completion), it);
+}
+
+void HybridDispatcher::sendCommand (Report &&report, completion_handler &&handler, int timeout)
+{
+	startReader (true);
+	try {
+		DispatcherThread::sendCommand (std::move (report), [this, handler = std::move (handler)] (const Report *response, std::exception_ptr error) {
+			asyncCommandFinished ();
+			handler (response, error);
+		}, timeout);
+	}
+	catch (...) {
+		asyncCommandFinished ();
+		throw;
+	}
+}
+
+void HybridDispatcher::trySendCommand (Report &&report, result_handler &&handler, int timeout)
+{
+	startReader (true);
+	// Failures to send are also passed to the handler
+	DispatcherThread::trySendCommand (std::move (report), [this, handler = std::move (handler)] (CommandResult &&result) {
+		asyncCommandFinished ();
+		handler (std::move (result));
+	}, timeout);
+}
+
+CommandResult HybridDispatcher::trySendCommand (Report &&report, int timeout)
+{
+	auto completion = std::make_shared<Completion> ();
+	try {
+		std::unique_lock<std::mutex> lock (_command_mutex);
+		addCommand (std::move (report), completionHandler (completion), timeout, true);
+	}
+	catch (...) {
+		CommandResult result;
+		result.exception = std::current_exception ();
+		return result;
+	}
+	wait (*completion, std::nullopt);
+	if (completion->response)
+		return CommandResult::fromReport (*completion->response);
+	CommandResult result;
+	if (completion->error)
+		result.exception = completion->error;
+	else
+		result.status = CommandResult::Timeout;
+	return result;
+}
+
+std::unique_ptr<Dispatcher::AsyncReport> HybridDispatcher::getNotification (DeviceIndex index, uint8_t sub_id)
+{
+	auto notification = DispatcherThread::getNotification (index, sub_id);
+	startReader ();
+	return notification;
+}
+
+Dispatcher::listener_iterator HybridDispatcher::registerEventHandler (DeviceIndex index, uint8_t sub_id, const event_handler &handler)
+{
+	auto it = DispatcherThread::registerEventHandler (index, sub_id, handler);
+	startReader ();
+	return it;
+}
+
+void HybridDispatcher::unregisterEventHandler (listener_iterator it)
+{
+	DispatcherThread::unregisterEventHandler (it);
+	if (eventHandlerCount () == 0)
+		_dev.interruptRead (); // let the reader thread stop
+}
+
+HybridDispatcher::completion_handler HybridDispatcher::completionHandler (const std::shared_ptr<Completion> &completion)
+{
+	return [this, completion] (const Report *response, std::exception_ptr error) {
+		std::unique_lock<std::mutex> lock (_leader_mutex);
+		if (response)
+			completion->response = *response;
+		else
+			completion->error = error;
+		completion->done = true;
+		if (_followers > 0)
+			_leader_cond.notify_all ();
+		// Commands failed by another thread (e.g. when writing) must
+		// not leave their waiting thread reading.
+		if (_leading && _leader != std::this_thread::get_id ())
+			_dev.interruptRead ();
+	};
+}
+
+bool HybridDispatcher::wait (const Completion &completion,
+			     std::optional<std::chrono::steady_clock::time_point> deadline)
+{
+	std::unique_lock<std::mutex> lock (_leader_mutex);
+	while (!completion.done) {
+		auto now = std::chrono::steady_clock::now ();
+		if (deadline && now >= *deadline)
+			return false;
+		if (_leading || _reader_running) {
+			++_followers;
+			if (deadline)
+				_leader_cond.wait_until (lock, *deadline);
+			else
+				_leader_cond.wait (lock);
+			--_followers;
+			continue;
+		}
+		_leading = true;
+		_leader = std::this_thread::get_id ();
+		lock.unlock ();
+		int timeout = expireCommands ();
+		if (deadline) {
+			int left = std::chrono::ceil<std::chrono::milliseconds> (*deadline - now).count ();
+			if (timeout < 0 || left < timeout)
+				timeout = left;
+		}
+		lock.lock ();
+		if (!completion.done) { // expireCommands may have completed it
+			lock.unlock ();
+			if (!readNextReport (timeout))
+				terminate ();
+			lock.lock ();
+		}
+		_leading = false;
+		if (_followers > 0)
+			_leader_cond.notify_all ();
+	}
+	return true;
+}
+
+bool HybridDispatcher::cancel (command_iterator it)
+{
+	std::unique_lock<std::mutex> lock (_command_mutex);
+	return cancelCommand (it);
+}
+
+Report HybridDispatcher::result (const Completion &completion)
+{
+	if (completion.response)
+		return *completion.response;
+	std::rethrow_exception (completion.error);
+}
+
+bool HybridDispatcher::needReader () const
+{
+	return !_closing && !_stopped && (_async_commands > 0 || eventHandlerCount () > 0);
+}
+
+void HybridDispatcher::startReader (bool async_command)
+{
+	std::unique_lock<std::mutex> lock (_leader_mutex);
+	if (async_command)
+		++_async_commands;
+	if (!_reader_running && !_closing) {
+		if (_reader.joinable ())
+			_reader.join (); // it has already stopped
+		_reader_running = true;
+		_reader = std::thread (&HybridDispatcher::readerLoop, this);
+	}
+}
+
+void HybridDispatcher::asyncCommandFinished ()
+{
+	std::unique_lock<std::mutex> lock (_leader_mutex);
+	--_async_commands;
+}
+
+void HybridDispatcher::readerLoop ()
+{
+	applyRealTimeOptions ();
+	std::unique_lock<std::mutex> lock (_leader_mutex);
+	// Wait for the thread reading an answer, it will not lead again
+	// while the reader is running.
+	++_followers;
+	_leader_cond.wait (lock, [this] () { return !_leading || !needReader (); });
+	--_followers;
+	if (needReader ()) {
+		_leading = true;
+		_leader = std::this_thread::get_id ();
+		while (needReader ()) {
+			lock.unlock ();
+			if (!readNextReport (expireCommands ()))
+				terminate ();
+			lock.lock ();
+		}
+		_leading = false;
+	}
+	_reader_running = false;
+	if (_followers > 0)
+		_leader_cond.notify_all ();
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_HYBRID_DISPATCHER_H
+#define LIBHIDPP_HIDPP_HYBRID_DISPATCHER_H
+
+#include <hidpp/DispatcherThread.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace HIDPP
+{
+
+/**
+ * Dispatcher with the semantics of DispatcherThread, but without a
+ * thread switch for synchronous commands.
+ *
+ * The thread waiting for an answer reads the device itself (it becomes
+ * the leader) and delivers the answers of the other waiting threads
+ * (its followers), one of which takes over when its own answer is
+ * received. A dedicated reader thread is only started while event
+ * handlers are registered or commands with a completion handler are
+ * pending, and stops when they are gone.
+ *
+ * Event handlers and completion handlers are called from the reader
+ * thread. Events received while the reader is starting may be handled
+ * by the thread waiting for an answer.
+ *
+ * There is no \ref run or \ref stop, the dispatcher can be used as soon
+ * as it is constructed. Pending commands fail with
+ * DispatcherThread::NotRunning when it is destroyed.
+ */
+class HybridDispatcher: public DispatcherThread
+{
+public:
+	HybridDispatcher (const char *path);
+	~HybridDispatcher ();
+
+	virtual std::unique_ptr<Dispatcher::AsyncReport> sendCommand (Report &&report);
+	/**
+	 * Starts the reader thread until \p handler is called.
+	 */
+	virtual void sendCommand (Report &&report, completion_handler &&handler, int timeout = -1);
+	/**
+	 * Starts the reader thread until \p handler is called.
+	 */
+	virtual void trySendCommand (Report &&report, result_handler &&handler, int timeout = -1);
+	/**
+	 * Reads the answer from the calling thread like \ref sendCommand.
+	 */
+	virtual CommandResult trySendCommand (Report &&report, int timeout = -1);
+	/**
+	 * Starts the reader thread until the notification is received.
+	 */
+	virtual std::unique_ptr<Dispatcher::AsyncReport> getNotification (DeviceIndex index, uint8_t sub_id);
+	/**
+	 * Starts the reader thread until every handler is unregistered.
+	 */
+	virtual listener_iterator registerEventHandler (DeviceIndex index, uint8_t sub_id, const event_handler &handler);
+	virtual void unregisterEventHandler (listener_iterator it);
+
+private:
+	using DispatcherThread::run;
+	using DispatcherThread::stop;
+
+	/**
+	 * Outcome of a synchronous command, protected by \c _leader_mutex.
+	 */
+	struct Completion
+	{
+		std::optional<Report> response;
+		std::exception_ptr error;
+		bool done = false;
+	};
+	completion_handler completionHandler (const std::shared_ptr<Completion> &completion);
+	/**
+	 * Wait until \p completion is done, reading reports while no other
+	 * thread does.
+	 *
+	 * \returns false if \p deadline passed first.
+	 */
+	bool wait (const Completion &completion,
+		   std::optional<std::chrono::steady_clock::time_point> deadline);
+	/**
+	 * Cancel the command if it is still pending.
+	 */
+	bool cancel (command_iterator it);
+	static Report result (const Completion &completion);
+
+	class AsyncReport;
+
+	bool needReader () const; // _leader_mutex must be held
+	/**
+	 * Start the reader thread if it is not running. With
+	 * \p async_command, it runs at least until \ref asyncCommandFinished
+	 * is called.
+	 */
+	void startReader (bool async_command = false);
+	void asyncCommandFinished ();
+	void readerLoop ();
+
+	std::mutex _leader_mutex;
+	std::condition_variable _leader_cond; // signaled for followers
+	bool _leading; // a thread is reading reports
+	std::thread::id _leader;
+	unsigned int _followers; // threads waiting on _leader_cond
+	unsigned int _async_commands; // pending commands with a handler
+	bool _reader_running, _closing;
+	std::thread _reader;
+};
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "IoUring.h"
+
+#include <cstring>
+#include <system_error>
+
+extern "C" {
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+}
+
+using namespace HIDPP;
+
+template<typename T>
+static T *ringPointer (void *ring, unsigned int offset)
+{
+	return reinterpret_cast<T *> (static_cast<char *> (ring) + offset);
+}
+
+IoUring::IoUring (unsigned int entries):
+	_sq_ring (MAP_FAILED), _cq_ring (MAP_FAILED), _sqes (nullptr),
+	_pending (0)
+{
+	io_uring_params params;
+	memset (&params, 0, sizeof (params));
+	_fd = syscall (__NR_io_uring_setup, entries, &params);
+	if (_fd == -1)
+		throw std::system_error (errno, std::system_category (), "io_uring_setup");
+	if (!(params.features & IORING_FEAT_EXT_ARG)) {
+		::close (_fd);
+		throw std::system_error (ENOSYS, std::system_category (), "io_uring without IORING_FEAT_EXT_ARG");
+	}
+	_sq_entries = params.sq_entries;
+
+	_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+	_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+	_sqes_size = params.sq_entries * sizeof (io_uring_sqe);
+	_sq_ring = mmap (nullptr, _sq_ring_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+	_cq_ring = mmap (nullptr, _cq_ring_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+	void *sqes = mmap (nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+	if (_sq_ring == MAP_FAILED || _cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+		int err = errno;
+		if (sqes != MAP_FAILED)
+			munmap (sqes, _sqes_size);
+		if (_cq_ring != MAP_FAILED)
+			munmap (_cq_ring, _cq_ring_size);
+		if (_sq_ring != MAP_FAILED)
+			munmap (_sq_ring, _sq_ring_size);
+		::close (_fd);
+		throw std::system_error (err, std::system_category (), "mmap io_uring");
+	}
+	_sqes = static_cast<io_uring_sqe *> (sqes);
+
+	_sq_head = ringPointer<unsigned int> (_sq_ring, params.sq_off.head);
+	_sq_tail = ringPointer<unsigned int> (_sq_ring, params.sq_off.tail);
+	_sq_mask = ringPointer<unsigned int> (_sq_ring, params.sq_off.ring_mask);
+	_sq_array = ringPointer<unsigned int> (_sq_ring, params.sq_off.array);
+	_cq_head = ringPointer<unsigned int> (_cq_ring, params.cq_off.head);
+	_cq_tail = ringPointer<unsigned int> (_cq_ring, params.cq_off.tail);
+	_cq_mask = ringPointer<unsigned int> (_cq_ring, params.cq_off.ring_mask);
+	_cqes = ringPointer<io_uring_cqe> (_cq_ring, params.cq_off.cqes);
+}
+
+IoUring::~IoUring ()
+{
+	munmap (_sqes, _sqes_size);
+	munmap (_cq_ring, _cq_ring_size);
+	munmap (_sq_ring, _sq_ring_size);
+	::close (_fd);
+}
+
+io_uring_sqe *IoUring::getSqe ()
+{
+	if (_pending == _sq_entries)
+		enter (0, -1); // submit to make room
+	unsigned int tail = *_sq_tail;
+	unsigned int index = tail & *_sq_mask;
+	io_uring_sqe *sqe = &_sqes[index];
+	memset (sqe, 0, sizeof (*sqe));
+	_sq_array[index] = index;
+	__atomic_store_n (_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++_pending;
+	return sqe;
+}
+
+void IoUring::prepareRead (int fd, void *buffer, std::size_t length, uint64_t user_data)
+{
+	auto sqe = getSqe ();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t> (buffer);
+	sqe->len = length;
+	sqe->off = -1; // current file position, hidraw is not seekable
+	sqe->user_data = user_data;
+}
+
+void IoUring::preparePoll (int fd, uint64_t user_data)
+{
+	auto sqe = getSqe ();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = user_data;
+}
+
+void IoUring::prepareCancel (uint64_t target_user_data, uint64_t user_data)
+{
+	auto sqe = getSqe ();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target_user_data;
+	sqe->user_data = user_data;
+}
+
+void IoUring::enter (unsigned int wait_count, int timeout)
+{
+	__kernel_timespec ts = { timeout / 1000, (timeout % 1000) * 1000000 };
+	io_uring_getevents_arg arg;
+	memset (&arg, 0, sizeof (arg));
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = timeout < 0 ? 0 : reinterpret_cast<uint64_t> (&ts);
+	unsigned int flags = IORING_ENTER_EXT_ARG;
+	if (wait_count > 0)
+		flags |= IORING_ENTER_GETEVENTS;
+	int ret;
+	do {
+		ret = syscall (__NR_io_uring_enter, _fd, _pending, wait_count, flags,
+			       &arg, sizeof (arg));
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1 && errno != ETIME)
+		throw std::system_error (errno, std::system_category (), "io_uring_enter");
+	if (ret > 0)
+		_pending -= static_cast<unsigned int> (ret);
+}
+
+void IoUring::wait (int timeout, const std::function<void (uint64_t user_data, int result)> &handler)
+{
+	enter (1, timeout);
+	unsigned int head = *_cq_head;
+	unsigned int tail = __atomic_load_n (_cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		io_uring_cqe cqe = _cqes[head & *_cq_mask];
+		++head;
+		// Free the entry before calling the handler so that it can
+		// queue requests.
+		__atomic_store_n (_cq_head, head, __ATOMIC_RELEASE);
+		handler (cqe.user_data, cqe.res);
+	}
+}
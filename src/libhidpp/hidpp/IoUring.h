@@ -0,0 +1,85 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_IO_URING_H
+#define LIBHIDPP_HIDPP_IO_URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace HIDPP
+{
+
+/**
+ * Minimal io_uring instance using the raw system calls.
+ *
+ * Requests are queued with the prepare methods and submitted all at once
+ * by \ref wait, which also collects the completions. The ring is not
+ * thread-safe.
+ *
+ * Requires Linux 5.11 (IORING_FEAT_EXT_ARG) and is only built when
+ * libhidpp is configured with LIBHIDPP_IO_URING.
+ */
+class IoUring
+{
+public:
+	/**
+	 * \throws std::system_error if io_uring is not available.
+	 */
+	IoUring (unsigned int entries);
+	~IoUring ();
+
+	IoUring (const IoUring &) = delete;
+	IoUring &operator= (const IoUring &) = delete;
+
+	void prepareRead (int fd, void *buffer, std::size_t length, uint64_t user_data);
+	void preparePoll (int fd, uint64_t user_data);
+	void prepareCancel (uint64_t target_user_data, uint64_t user_data);
+
+	/**
+	 * Submit the queued requests and wait for at least one completion or
+	 * for \p timeout milliseconds (forever if negative).
+	 *
+	 * \p handler is called with the user data and result of each
+	 * completion. It may queue new requests.
+	 */
+	void wait (int timeout, const std::function<void (uint64_t user_data, int result)> &handler);
+
+private:
+	io_uring_sqe *getSqe ();
+	void enter (unsigned int wait_count, int timeout);
+
+	int _fd;
+	void *_sq_ring, *_cq_ring;
+	std::size_t _sq_ring_size, _cq_ring_size;
+	io_uring_sqe *_sqes;
+	std::size_t _sqes_size;
+	unsigned int *_sq_head, *_sq_tail, *_sq_mask, *_sq_array;
+	unsigned int *_cq_head, *_cq_tail, *_cq_mask;
+	io_uring_cqe *_cqes;
+	unsigned int _sq_entries;
+	unsigned int _pending; // queued but not submitted
+};
+
+}
+
+#endif
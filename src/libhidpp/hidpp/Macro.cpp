@@ -23,6 +23,7 @@
 
 #include <misc/Log.h>
 
+#include <algorithm>
 #include <cassert>
 #include <map>
 #include <vector>
@@ -59,7 +60,8 @@ const std::map<Macro::Item::Instruction, std::string> Macro::Item::InstructionSt
 };
 
 Macro::Item::Item (Instruction instr):
-	_instr (instr)
+	_instr (instr),
+	_jump (0)
 {
 }
 
@@ -139,19 +141,14 @@ bool Macro::Item::isJump () const
 	return _instr == Jump || _instr == JumpIfPressed || _instr == JumpIfReleased;
 }
 
-std::list<Macro::Item>::iterator Macro::Item::jumpDestination ()
+int Macro::Item::jumpOffset () const
 {
-	return _dest;
+	return _jump;
 }
 
-std::list<Macro::Item>::const_iterator Macro::Item::jumpDestination () const
+void Macro::Item::setJumpOffset (int offset)
 {
-	return _dest;
-}
-
-void Macro::Item::setJumpDestination (std::list<Item>::iterator dest)
-{
-	_dest = dest;
+	_jump = offset;
 }
 
 int Macro::Item::mouseX () const
@@ -217,12 +214,20 @@ Macro::Macro ()
 {
 }
 
-Macro::Macro (const AbstractMacroFormat &format, AbstractMemoryMapping &mem, Address address)
+Macro::Macro (const AbstractMacroFormat &format, AbstractMemoryMapping &mem, Address address, std::set<Address> *pages)
 {
-	std::map<Address, iterator> parsed_items;
-	std::vector<std::pair <Item *, Address>> incomplete_ref;
+	auto add_page = [pages] (Address page) {
+		if (!pages)
+			return;
+		page.offset = 0;
+		pages->insert (page);
+	};
+
+	std::map<Address, std::size_t> parsed_items;
+	std::vector<std::pair <std::size_t, Address>> incomplete_ref;
 
 	std::vector<uint8_t>::const_iterator current = mem.getReadOnlyIterator (address);
+	add_page (address);
 
 	std::stack<Address> jump_dests;
 	while (true) {
@@ -233,12 +238,12 @@ Macro::Macro (const AbstractMacroFormat &format, AbstractMemoryMapping &mem, Add
 
 		// Memorize aligned items by address
 		if (mem.computeOffset (last, address)) {
-			parsed_items.emplace (address, std::prev(_items.end ()));
+			parsed_items.emplace (address, _items.size () - 1);
 		}
 
 		if (item.isJump ()) {
 			jump_dests.push (dest); // Keep destination for later parsing
-			incomplete_ref.emplace_back (&item, dest);
+			incomplete_ref.emplace_back (_items.size () - 1, dest);
 		}
 
 		if (!item.hasSuccessor ()) {
@@ -251,42 +256,16 @@ Macro::Macro (const AbstractMacroFormat &format, AbstractMemoryMapping &mem, Add
 			} while (parsed_items.find (address) != parsed_items.end ());
 
 			current = mem.getReadOnlyIterator (address);
+			add_page (address);
 		}
 	}
 parse_end:
 
 	for (auto pair: incomplete_ref) {
-		// Find item iterator at referenced address
-		Item *item = pair.first;
+		// Find item index at referenced address
+		std::size_t index = pair.first;
 		const Address &address = pair.second;
-		item->setJumpDestination (parsed_items.at (address));
-	}
-}
-
-Macro::Macro (const Macro &other):
-	_items (other._items)
-{
-	auto debug = Log::debug ("macro");
-	debug << "Copying macro" << std::endl;
-	// The destination of every jump needs to be corrected in the copied list
-	std::map<const Item *, iterator> translation;
-
-	const_iterator other_it = other._items.begin ();
-	for (iterator it = _items.begin ();
-	     it != _items.end ();
-	     ++it, ++other_it) {
-		debug.printf ("Add translation %p to %p\n", &(*other_it), &(*it));
-		translation.insert ({ &(*other_it), it });
-	}
-
-	for (Item &item: _items) {
-		if (item.isJump ()) {
-			Item *old_item = &(*item.jumpDestination ());
-			iterator new_item = translation[old_item];
-			debug.printf ("Replace %p with %p\n", old_item, &(*new_item));
-
-			item.setJumpDestination (new_item);
-		}
+		_items[index].setJumpOffset (static_cast<int> (parsed_items.at (address)) - static_cast<int> (index));
 	}
 }
 
@@ -295,11 +274,11 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 	auto debug = Log::debug ("macro");
 	typedef std::vector<uint8_t>::iterator iterator;
 	std::map<const Item *, Address> jump_dests; // Associate address with jump destination items
-	std::vector<std::pair<const Item *, iterator>> jump_addrs; // Jumps and their address positions
+	std::vector<std::pair<const Item *, iterator>> jump_addrs; // Jump destinations and their address positions
 
-	for (auto item: _items) {
-		if (item.isJump ()) {
-			jump_dests.emplace(&*item.jumpDestination (), Address ());
+	for (auto it = _items.begin (); it != _items.end (); ++it) {
+		if (it->isJump ()) {
+			jump_dests.emplace(&*jumpDestination (it), Address ());
 		}
 	}
 
@@ -310,6 +289,8 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 
 	constexpr std::size_t CRCLength = 2;
 	const std::size_t jump_len = format.getJumpLength ();
+	std::vector<std::size_t> lengths (_items.size ());
+	format.getLengths (_items.begin (), _items.end (), lengths.data ());
 	bool check_end_of_page_jump = true;
 	bool first_instruction = true;
 
@@ -318,7 +299,7 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 		auto jump_dest = jump_dests.find (&item);
 		bool is_jump_dest = jump_dest != jump_dests.end ();
 
-		std::size_t item_len = format.getLength (item);
+		std::size_t item_len = lengths[std::distance (_items.begin (), it)];
 
 		Address item_addr = current_page;
 
@@ -341,7 +322,7 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 						// Padding will be needed
 						++instr_location;
 					}
-					instr_location += format.getLength (*it2);
+					instr_location += lengths[std::distance (_items.begin (), it2)];
 					if ((int) CRCLength > std::distance (instr_location, page_end)) {
 						// index reached end of page
 						need_jump = true;
@@ -352,7 +333,7 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 					// Jump to the beginning of the next page
 					++current_page.page;
 					if (!first_instruction) {
-						assert (std::distance (current, page_end) > (int) (jump_len + CRCLength));
+						assert (std::distance (current, page_end) >= (int) (jump_len + CRCLength));
 						debug << "Adding jump to page " << current_page.page << std::endl;
 						format.writeJump (current, current_page);
 					}
@@ -385,7 +366,7 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 
 		// Remember jump address position for later resolution
 		if (item.isJump ()) {
-			jump_addrs.emplace_back (&item, jump_addr_it);
+			jump_addrs.emplace_back (&*jumpDestination (it), jump_addr_it);
 		}
 
 		// Remember item address for later jump resolution
@@ -399,8 +380,7 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 
 	// Write jump addresses
 	for (auto jump_addr: jump_addrs) {
-		const Item &dest = *jump_addr.first->jumpDestination ();
-		const Address &addr = jump_dests.at (&dest);
+		const Address &addr = jump_dests.at (jump_addr.first);
 		auto jump_addr_it = jump_addr.second;
 		format.writeAddress (jump_addr_it, addr);
 	}
@@ -415,46 +395,237 @@ Address Macro::write (const AbstractMacroFormat &format, AbstractMemoryMapping &
 void Macro::simplify ()
 {
 	auto debug = Log::debug ("macro");
-	std::map<Item *, std::vector<Item *>> back_refs;
+	std::vector<bool> removed (_items.size ());
+	for (std::size_t i = 0; i < _items.size (); ++i) {
+		const Item &item = _items[i];
+		if (item.instruction () == Item::NoOp ||
+		    (item.instruction () == Item::Jump && item.jumpOffset () == 1)) {
+			debug.printf ("Remove useless macro item %zu: instruction = %d\n", i, item.instruction ());
+			removed[i] = true;
+		}
+	}
+	removeItems (removed);
+}
 
-	for (auto item: _items) {
-		if (item.isJump ()) {
-			back_refs[&*item.jumpDestination ()].push_back (&item);
+static bool isDelay (const Macro::Item &item)
+{
+	return item.instruction () == Macro::Item::Delay ||
+		item.instruction () == Macro::Item::ShortDelay;
+}
+
+static bool isKeyPress (const Macro::Item &item)
+{
+	switch (item.instruction ()) {
+	case Macro::Item::KeyPress:
+	case Macro::Item::ModifiersPress:
+	case Macro::Item::ModifiersKeyPress:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool isKeyRelease (const Macro::Item &item)
+{
+	switch (item.instruction ()) {
+	case Macro::Item::KeyRelease:
+	case Macro::Item::ModifiersRelease:
+	case Macro::Item::ModifiersKeyRelease:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static uint8_t itemModifiers (const Macro::Item &item)
+{
+	switch (item.instruction ()) {
+	case Macro::Item::KeyPress:
+	case Macro::Item::KeyRelease:
+		return 0;
+	default:
+		return item.modifiers ();
+	}
+}
+
+static uint8_t itemKeyCode (const Macro::Item &item)
+{
+	switch (item.instruction ()) {
+	case Macro::Item::ModifiersPress:
+	case Macro::Item::ModifiersRelease:
+		return 0;
+	default:
+		return item.keyCode ();
+	}
+}
+
+// Merge second into first if the merged item is shorter in format.
+static bool mergeItems (const AbstractMacroFormat &format, Macro::Item &first, const Macro::Item &second)
+{
+	Macro::Item merged (Macro::Item::NoOp);
+	if (isDelay (first) && isDelay (second)) {
+		unsigned int delay = first.delay () + second.delay ();
+		if (delay > 0xffff)
+			return false;
+		merged = Macro::Item (Macro::Item::Delay);
+		merged.setDelay (delay);
+	}
+	// Modifiers are pressed before the key, so the first press must
+	// not have a key. Releases can be merged in any order.
+	else if ((isKeyPress (first) && isKeyPress (second) && itemKeyCode (first) == 0) ||
+		 (isKeyRelease (first) && isKeyRelease (second) &&
+		  (itemKeyCode (first) == 0 || itemKeyCode (second) == 0))) {
+		merged = Macro::Item (isKeyPress (first)
+				      ? Macro::Item::ModifiersKeyPress
+				      : Macro::Item::ModifiersKeyRelease);
+		merged.setModifiers (itemModifiers (first) | itemModifiers (second));
+		merged.setKeyCode (itemKeyCode (first) | itemKeyCode (second));
+	}
+	else
+		return false;
+	try {
+		if (format.getLength (merged) >= format.getLength (first) + format.getLength (second))
+			return false;
+	}
+	catch (AbstractMacroFormat::UnsupportedInstruction &e) {
+		return false;
+	}
+	first = merged;
+	return true;
+}
+
+void Macro::optimize (const AbstractMacroFormat &format)
+{
+	auto debug = Log::debug ("macro");
+	simplify ();
+
+	// Merge items into the last kept item, unless they are jump
+	// destinations.
+	std::vector<bool> is_dest = jumpDestinationFlags ();
+	std::vector<bool> removed (_items.size ());
+	std::size_t last = _items.size ();
+	for (std::size_t i = 0; i < _items.size (); ++i) {
+		Item &item = _items[i];
+		if (item.instruction () == Item::Delay && item.delay () == 0) {
+			debug.printf ("Remove null delay %zu\n", i);
+			removed[i] = true;
+			continue;
+		}
+		if (last < _items.size () && !is_dest[i] && !_items[last].isJump () &&
+		    mergeItems (format, _items[last], item)) {
+			debug.printf ("Merge macro item %zu into %zu\n", i, last);
+			removed[i] = true;
+			continue;
 		}
+		last = i;
 	}
+	removeItems (removed);
+
+	while (shareTail (format))
+		;
+}
+
+bool Macro::shareTail (const AbstractMacroFormat &format)
+{
+	// Padding may be added before a jump destination
+	constexpr std::size_t MaxPadding = 1;
+	const std::size_t jump_len = format.getJumpLength ();
 
+	std::vector<std::vector<uint8_t>> encoded;
+	for (const auto &item: _items) {
+		encoded.emplace_back ();
+		if (item.isSimple () || item.instruction () == Item::End) {
+			std::vector<uint8_t>::iterator unused;
+			encoded.back ().resize (format.getLength (item));
+			format.writeItem (encoded.back ().begin (), item, unused);
+		}
+	}
+	std::vector<bool> is_dest = jumpDestinationFlags ();
 
-	auto it = _items.begin ();
-	while (it != _items.end ()) {
-		if (it->instruction () == Item::NoOp ||
-		    (it->instruction () == Item::Jump && it->jumpDestination () == std::next(it))) {
-			for (Item *jump: back_refs[&*it]) {
-				jump->setJumpDestination (std::next(it));
+	for (std::size_t end2 = 0; end2 < _items.size (); ++end2) {
+		if (_items[end2].instruction () != Item::End)
+			continue;
+		for (std::size_t end1 = 0; end1 < end2; ++end1) {
+			if (_items[end1].instruction () != Item::End)
+				continue;
+			// Extend the common tail backward, items inside the
+			// later tail must not be jump destinations.
+			std::size_t len = 0, bytes = 0;
+			while (len <= end1 && end1 < end2 - len) {
+				std::size_t i1 = end1 - len, i2 = end2 - len;
+				if (encoded[i1].empty () || encoded[i1] != encoded[i2] ||
+				    (len > 0 && !_items[i1].isSimple ()))
+					break;
+				bytes += encoded[i2].size ();
+				++len;
+				if (is_dest[i2])
+					break;
 			}
-			debug.printf ("Remove useless macro item %p: instruction = %d\n", &*it, it->instruction ());
-			it = _items.erase (it);
+			if (bytes <= jump_len + MaxPadding)
+				continue;
+			std::size_t start1 = end1 + 1 - len, start2 = end2 + 1 - len;
+			Log::debug ("macro").printf ("Replace macro tail %zu-%zu with a jump to %zu\n",
+						     start2, end2, start1);
+			_items[start2] = Item (Item::Jump);
+			_items[start2].setJumpOffset (static_cast<int> (start1) - static_cast<int> (start2));
+			std::vector<bool> removed (_items.size ());
+			std::fill (removed.begin () + start2 + 1, removed.begin () + end2 + 1, true);
+			removeItems (removed);
+			return true;
 		}
-		else
-			++it;
 	}
+	return false;
+}
+
+void Macro::removeItems (const std::vector<bool> &removed)
+{
+	// new_index[i] is the index of item i (or of the next kept item)
+	// after removal.
+	std::vector<int> new_index (_items.size () + 1);
+	int kept = 0;
+	for (std::size_t i = 0; i < _items.size (); ++i) {
+		new_index[i] = kept;
+		if (!removed[i])
+			++kept;
+	}
+	new_index[_items.size ()] = kept;
+
+	for (std::size_t i = 0; i < _items.size (); ++i) {
+		Item &item = _items[i];
+		if (!removed[i] && item.isJump ())
+			item.setJumpOffset (new_index[i + item.jumpOffset ()] - new_index[i]);
+	}
+	std::size_t i = 0;
+	_items.erase (std::remove_if (_items.begin (), _items.end (),
+				      [&removed, &i] (const Item &) { return removed[i++]; }),
+		      _items.end ());
 }
 
-std::list<Macro::Item>::iterator Macro::begin ()
+std::vector<bool> Macro::jumpDestinationFlags () const
+{
+	std::vector<bool> is_dest (_items.size ());
+	for (std::size_t i = 0; i < _items.size (); ++i)
+		if (_items[i].isJump ())
+			is_dest[i + _items[i].jumpOffset ()] = true;
+	return is_dest;
+}
+
+Macro::iterator Macro::begin ()
 {
 	return _items.begin ();
 }
 
-std::list<Macro::Item>::const_iterator Macro::begin () const
+Macro::const_iterator Macro::begin () const
 {
 	return _items.begin ();
 }
 
-std::list<Macro::Item>::iterator Macro::end ()
+Macro::iterator Macro::end ()
 {
 	return _items.end ();
 }
 
-std::list<Macro::Item>::const_iterator Macro::end () const
+Macro::const_iterator Macro::end () const
 {
 	return _items.end ();
 }
@@ -474,6 +645,26 @@ void Macro::emplace_back (Item::Instruction instr)
 	_items.emplace_back (instr);
 }
 
+void Macro::reserve (std::size_t count)
+{
+	_items.reserve (count);
+}
+
+Macro::iterator Macro::jumpDestination (iterator jump)
+{
+	return jump + jump->jumpOffset ();
+}
+
+Macro::const_iterator Macro::jumpDestination (const_iterator jump) const
+{
+	return jump + jump->jumpOffset ();
+}
+
+void Macro::setJumpDestination (iterator jump, const_iterator dest)
+{
+	jump->setJumpOffset (dest - const_iterator (jump));
+}
+
 bool Macro::isSimple () const
 {
 	for (auto it = _items.begin (); it != _items.end (); ++it) {
@@ -516,7 +707,7 @@ bool Macro::isLoop (const_iterator &pre_begin, const_iterator &pre_end,
 			break;
 
 		case Item::JumpIfPressed: {
-			const_iterator dest = it->jumpDestination ();
+			const_iterator dest = jumpDestination (it);
 			if (state == Init) {
 				// Check that the destination is before
 				// the current instruction.
@@ -538,7 +729,7 @@ bool Macro::isLoop (const_iterator &pre_begin, const_iterator &pre_end,
 				loop_end = it;
 				post_begin = std::next (it);
 				// Check jump destinations (pre_end is JumpIfReleased)
-				if (pre_end->jumpDestination () != post_begin ||
+				if (jumpDestination (pre_end) != post_begin ||
 				    dest != loop_begin)
 					return false;
 				state = AfterLoop;
@@ -621,15 +812,19 @@ Macro Macro::buildLoop (const_iterator pre_begin, const_iterator pre_end,
 	else if (loop_delay > 0) {
 		// Use JumpIfReleased to delay the loop
 		macro._items.insert (macro._items.end (), pre_begin, pre_end);
-		iterator released_jump = macro._items.emplace (macro._items.end (), Item::JumpIfReleased);
-		iterator loop = macro._items.insert (macro._items.end (), loop_begin, loop_end);
-		iterator pressed_jump = macro._items.emplace (macro._items.end (), Item::JumpIfPressed);
-		iterator post = macro._items.insert (macro._items.end (), post_begin, post_end);
+		std::size_t released_jump = macro._items.size ();
+		macro._items.emplace_back (Item::JumpIfReleased);
+		std::size_t loop = macro._items.size ();
+		macro._items.insert (macro._items.end (), loop_begin, loop_end);
+		std::size_t pressed_jump = macro._items.size ();
+		macro._items.emplace_back (Item::JumpIfPressed);
+		std::size_t post = macro._items.size ();
+		macro._items.insert (macro._items.end (), post_begin, post_end);
 		macro._items.emplace_back (Item::End);
 
-		released_jump->setDelay (loop_delay);
-		released_jump->setJumpDestination (post);
-		pressed_jump->setJumpDestination (loop);
+		macro._items[released_jump].setDelay (loop_delay);
+		macro._items[released_jump].setJumpOffset (post - released_jump);
+		macro._items[pressed_jump].setJumpOffset (static_cast<int> (loop) - static_cast<int> (pressed_jump));
 	}
 	else if (pre_begin == pre_end) {
 		// No pre-loop instruction, use repeat instruction
@@ -642,8 +837,11 @@ Macro Macro::buildLoop (const_iterator pre_begin, const_iterator pre_end,
 		// Pre-loop is non-empty, and loop is played at least once
 		// Use a single JumpIfpressed at the end of loop
 		macro._items.insert (macro._items.end (), pre_begin, pre_end);
-		iterator loop = macro._items.insert (macro._items.end (), loop_begin, loop_end);
-		macro._items.emplace (macro._items.end (), Item::JumpIfPressed)->setJumpDestination (loop);
+		std::size_t loop = macro._items.size ();
+		macro._items.insert (macro._items.end (), loop_begin, loop_end);
+		std::size_t pressed_jump = macro._items.size ();
+		macro._items.emplace_back (Item::JumpIfPressed);
+		macro._items.back ().setJumpOffset (static_cast<int> (loop) - static_cast<int> (pressed_jump));
 		macro._items.insert (macro._items.end (), post_begin, post_end);
 		macro._items.emplace_back (Item::End);
 	}
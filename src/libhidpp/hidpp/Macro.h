@@ -21,8 +21,9 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <cstdint>
-#include <list>
+#include <vector>
 #include <hidpp/Address.h>
 
 namespace HIDPP
@@ -34,6 +35,10 @@ class AbstractMemoryMapping;
 /**
  * Store a macro as a list of macro items.
  *
+ * Items are stored contiguously and jumps refer to their destination
+ * by a relative item offset, so that macros are copied without fixing
+ * jumps and ranges of items can be moved together.
+ *
  * ### Loop macro
  *
  * Loops recognized by isLoop() and created by buildLoop() are
@@ -248,20 +253,17 @@ public:
 		 */
 		bool isJump () const;
 		/**
-		 * \returns the destination of the jump.
-		 * \see setJumpDestination()
-		 */
-		std::list<Item>::iterator jumpDestination ();
-		/**
-		 * \returns the destination of the jump.
-		 * \see setJumpDestination()
+		 * \returns the position of the jump destination relative to
+		 * this item, in items.
+		 * \see setJumpOffset() Macro::jumpDestination()
 		 */
-		std::list<Item>::const_iterator jumpDestination () const;
+		int jumpOffset () const;
 		/**
-		 * \param dest destination of the jump.
-		 * \see jumpDestination()
+		 * \param offset position of the jump destination relative to
+		 * this item, in items.
+		 * \see jumpOffset() Macro::setJumpDestination()
 		 */
-		void setJumpDestination (std::list<Item>::iterator dest);
+		void setJumpOffset (int offset);
 
 		/**
 		 * \returns horizontal mouse pointer delta.
@@ -315,7 +317,7 @@ public:
 				int x, y;
 			} mouse;
 		} _params;
-		std::list<Item>::iterator _dest;
+		int _jump;
 	};
 
 	/**
@@ -329,10 +331,12 @@ public:
 	 * \param format	Format for parsing the macro.
 	 * \param mem		Memory for accessing the macro.
 	 * \param address	Address of the macro start.
+	 * \param pages	If not null, filled with the addresses of the
+	 *			pages the macro was read from.
 	 */
-	Macro (const AbstractMacroFormat &format, AbstractMemoryMapping &mem, Address address);
+	Macro (const AbstractMacroFormat &format, AbstractMemoryMapping &mem, Address address, std::set<Address> *pages = nullptr);
 
-	explicit Macro (const Macro &);
+	explicit Macro (const Macro &) = default;
 	Macro (Macro &&) = default;
 
 	Macro &operator= (const Macro &) = delete;
@@ -356,9 +360,19 @@ public:
 	 * Remove no-op and useless unconditional jumps.
 	 */
 	void simplify ();
+	/**
+	 * Make the macro shorter when encoded with \p format without
+	 * changing what it plays.
+	 *
+	 * Besides what simplify() removes, null delays are removed,
+	 * adjacent delays are merged, modifier and key items are merged
+	 * when \p format has a shorter combined instruction, and macro
+	 * tails identical to an earlier one are replaced by a jump to it.
+	 */
+	void optimize (const AbstractMacroFormat &format);
 
-	typedef std::list<Item>::iterator iterator;
-	typedef std::list<Item>::const_iterator const_iterator;
+	typedef std::vector<Item>::iterator iterator;
+	typedef std::vector<Item>::const_iterator const_iterator;
 
 	iterator begin ();
 	const_iterator begin () const;
@@ -369,6 +383,23 @@ public:
 	Item &back ();
 
 	void emplace_back (Item::Instruction instr);
+	/**
+	 * Allocate room for \p count items.
+	 */
+	void reserve (std::size_t count);
+
+	/**
+	 * \returns the destination of the jump item at \p jump.
+	 */
+	iterator jumpDestination (iterator jump);
+	/**
+	 * \returns the destination of the jump item at \p jump.
+	 */
+	const_iterator jumpDestination (const_iterator jump) const;
+	/**
+	 * Set the destination of the jump item at \p jump to \p dest.
+	 */
+	void setJumpDestination (iterator jump, const_iterator dest);
 
 	/**
 	 * Check if the macro only contains simple instructions
@@ -414,7 +445,23 @@ public:
 				unsigned int loop_delay);
 
 private:
-	std::list<Item> _items;
+	/**
+	 * Remove the items whose \p removed flag is set. Jumps to a
+	 * removed item go to the next item that is kept.
+	 */
+	void removeItems (const std::vector<bool> &removed);
+	/**
+	 * \returns flags telling which items are jump destinations.
+	 */
+	std::vector<bool> jumpDestinationFlags () const;
+	/**
+	 * Replace one tail identical to an earlier one with a jump.
+	 *
+	 * \returns false if no tail was worth sharing.
+	 */
+	bool shareTail (const AbstractMacroFormat &format);
+
+	std::vector<Item> _items;
 };
 
 }
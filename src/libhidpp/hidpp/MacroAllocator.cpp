@@ -0,0 +1,182 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MacroAllocator.h"
+
+#include <hidpp/AbstractMacroFormat.h>
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+using namespace HIDPP;
+
+// Every page ends with a CRC
+static constexpr std::size_t CRCLength = 2;
+
+MacroAllocator::MacroAllocator (const AbstractMacroFormat &format, std::size_t page_size, std::size_t offset_unit):
+	_format (format),
+	_page_size (page_size),
+	_offset_unit (offset_unit)
+{
+}
+
+void MacroAllocator::addPage (const Address &page, std::size_t used)
+{
+	Address page_address = page;
+	page_address.offset = 0;
+	auto it = std::lower_bound (_pages.begin (), _pages.end (), page_address,
+				    [] (const Page &p, const Address &a) { return p.address < a; });
+	if (it != _pages.end () && !(page_address < it->address))
+		it->used = std::max (it->used, used);
+	else
+		_pages.insert (it, Page { page_address, used, false });
+}
+
+void MacroAllocator::markDirty (const Address &page)
+{
+	for (auto &p: _pages)
+		if (p.address.mem_type == page.mem_type && p.address.page == page.page)
+			p.dirty = true;
+}
+
+std::size_t MacroAllocator::length (const Macro &macro) const
+{
+	std::size_t length = 0;
+	std::set<const Macro::Item *> jump_dests;
+	for (auto it = macro.begin (); it != macro.end (); ++it)
+		if (it->isJump ())
+			jump_dests.insert (&*macro.jumpDestination (it));
+	std::vector<std::size_t> lengths (std::distance (macro.begin (), macro.end ()));
+	_format.getLengths (macro.begin (), macro.end (), lengths.data ());
+	auto item_length = lengths.begin ();
+	for (const auto &item: macro) {
+		if (jump_dests.count (&item))
+			length = align (length);
+		length += *(item_length++);
+	}
+	return align (length);
+}
+
+Address MacroAllocator::allocate (const Macro &macro)
+{
+	const std::size_t length = this->length (macro);
+	const std::size_t capacity = _page_size - CRCLength;
+	if (length <= capacity) {
+		// Best fit, in dirty pages first
+		auto best = _pages.end ();
+		for (auto it = _pages.begin (); it != _pages.end (); ++it) {
+			std::size_t end = align (it->used) + length;
+			if (end > capacity)
+				continue;
+			if (best == _pages.end () ||
+			    (it->dirty && !best->dirty) ||
+			    (it->dirty == best->dirty && it->used > best->used))
+				best = it;
+		}
+		if (best != _pages.end ()) {
+			Address address = best->address;
+			address.offset = align (best->used) / _offset_unit;
+			best->used = align (best->used) + length;
+			best->dirty = true;
+			return address;
+		}
+	}
+	return allocatePages (length, maxItemLength (macro));
+}
+
+std::size_t MacroAllocator::pageCount (const Macro &macro) const
+{
+	const std::size_t length = this->length (macro);
+	if (length == 0)
+		return 0;
+	if (length <= _page_size - CRCLength)
+		return 1;
+	const std::size_t usable = usableLength (maxItemLength (macro));
+	return (length + usable - 1) / usable;
+}
+
+std::vector<Address> MacroAllocator::allocate (const std::vector<const Macro *> &macros)
+{
+	std::vector<std::size_t> lengths, order (macros.size ());
+	for (const Macro *macro: macros)
+		lengths.push_back (length (*macro));
+	std::iota (order.begin (), order.end (), 0);
+	std::stable_sort (order.begin (), order.end (), [&lengths] (std::size_t a, std::size_t b) {
+		return lengths[a] > lengths[b];
+	});
+	std::vector<Address> addresses (macros.size ());
+	for (std::size_t i: order)
+		addresses[i] = allocate (*macros[i]);
+	return addresses;
+}
+
+std::set<Address> MacroAllocator::dirtyPages () const
+{
+	std::set<Address> pages;
+	for (const auto &p: _pages)
+		if (p.dirty)
+			pages.insert (p.address);
+	return pages;
+}
+
+std::size_t MacroAllocator::align (std::size_t offset) const
+{
+	return (offset + _offset_unit - 1) / _offset_unit * _offset_unit;
+}
+
+std::size_t MacroAllocator::maxItemLength (const Macro &macro) const
+{
+	std::vector<std::size_t> lengths (std::distance (macro.begin (), macro.end ()));
+	_format.getLengths (macro.begin (), macro.end (), lengths.data ());
+	return lengths.empty () ? 0 : *std::max_element (lengths.begin (), lengths.end ());
+}
+
+std::size_t MacroAllocator::usableLength (std::size_t max_item_length) const
+{
+	// Macro::write jumps to the next page when the next item and a
+	// jump do not fit before the CRC, a padding may follow the jump.
+	return _page_size - CRCLength - _format.getJumpLength ()
+		- max_item_length - (_offset_unit - 1);
+}
+
+Address MacroAllocator::allocatePages (std::size_t length, std::size_t max_item_length)
+{
+	const std::size_t usable = usableLength (max_item_length);
+	const std::size_t page_count = (length + usable - 1) / usable;
+	// First run of consecutive empty pages long enough
+	for (std::size_t first = 0; first + page_count <= _pages.size (); ++first) {
+		std::size_t count = 0;
+		while (count < page_count) {
+			const Page &p = _pages[first + count];
+			if (p.used > 0 || p.address.mem_type != _pages[first].address.mem_type ||
+			    p.address.page != _pages[first].address.page + count)
+				break;
+			++count;
+		}
+		if (count < page_count)
+			continue;
+		for (std::size_t i = 0; i < page_count; ++i) {
+			_pages[first + i].used = _page_size;
+			_pages[first + i].dirty = true;
+		}
+		_pages[first + page_count - 1].used = align (length - (page_count - 1) * usable);
+		return _pages[first].address;
+	}
+	throw std::out_of_range ("No room left for macro");
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_MACRO_ALLOCATOR_H
+#define LIBHIDPP_HIDPP_MACRO_ALLOCATOR_H
+
+#include <hidpp/Address.h>
+#include <hidpp/Macro.h>
+#include <set>
+#include <vector>
+
+namespace HIDPP
+{
+
+class AbstractMacroFormat;
+
+/**
+ * Choose where macros are written in onboard memory.
+ *
+ * Macros that fit in a page are never split across pages: pages are
+ * filled best fit, preferring pages that are already modified (see
+ * markDirty) so that a rewrite touches as few pages as possible.
+ * Longer macros start on an empty page and use the following
+ * consecutive empty pages, with a single jump per page boundary.
+ *
+ * The lengths are upper bounds of what Macro::write uses, so the
+ * macros written at the allocated addresses never overflow them.
+ */
+class MacroAllocator
+{
+public:
+	/**
+	 * \param format	Format the macros are written with.
+	 * \param page_size	Size of the pages in bytes, including their CRC.
+	 * \param offset_unit	Size in bytes of an address offset unit.
+	 */
+	MacroAllocator (const AbstractMacroFormat &format, std::size_t page_size, std::size_t offset_unit = 1);
+
+	/**
+	 * Make page \p page available for macros, without its first
+	 * \p used bytes.
+	 */
+	void addPage (const Address &page, std::size_t used = 0);
+	/**
+	 * Prefer \p page for the next macros because it is written
+	 * anyway.
+	 */
+	void markDirty (const Address &page);
+
+	/**
+	 * \returns the maximum length of \p macro in bytes, including
+	 * alignment padding.
+	 */
+	std::size_t length (const Macro &macro) const;
+	/**
+	 * \returns the number of pages \p macro uses at most, when it is
+	 * allocated alone.
+	 */
+	std::size_t pageCount (const Macro &macro) const;
+
+	/**
+	 * Choose the start address of \p macro.
+	 *
+	 * \throws std::out_of_range if there is no room left for \p macro.
+	 */
+	Address allocate (const Macro &macro);
+	/**
+	 * Choose the start addresses of \p macros, in the same order.
+	 *
+	 * Longer macros are placed first, this packs the macros in fewer
+	 * pages than allocating them one by one.
+	 *
+	 * \throws std::out_of_range if there is no room left for a macro.
+	 */
+	std::vector<Address> allocate (const std::vector<const Macro *> &macros);
+
+	/**
+	 * Pages where macros were allocated or marked with markDirty.
+	 */
+	std::set<Address> dirtyPages () const;
+
+private:
+	struct Page
+	{
+		Address address;
+		std::size_t used;
+		bool dirty;
+	};
+	std::size_t align (std::size_t offset) const;
+	std::size_t maxItemLength (const Macro &macro) const;
+	// Bytes of a macro split across pages that fit in each page
+	std::size_t usableLength (std::size_t max_item_length) const;
+	Address allocatePages (std::size_t length, std::size_t max_item_length);
+
+	const AbstractMacroFormat &_format;
+	std::size_t _page_size, _offset_unit;
+	std::vector<Page> _pages; // sorted by address
+};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MacroCache.h"
+
+#include <hidpp/AbstractMemoryMapping.h>
+
+using namespace HIDPP;
+
+MacroCache::MacroCache (const AbstractMacroFormat &format, AbstractMemoryMapping &mem):
+	_format (format),
+	_mem (mem)
+{
+}
+
+std::shared_ptr<const Macro> MacroCache::get (const Address &address)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _entries.find (address);
+	if (it != _entries.end ()) {
+		bool valid = true;
+		for (const auto &[page, generation]: it->second.page_generations) {
+			if (_mem.pageGeneration (page) != generation) {
+				valid = false;
+				break;
+			}
+		}
+		if (valid)
+			return it->second.macro;
+		_entries.erase (it);
+	}
+	// Parse without the lock so that other macros can be parsed
+	// meanwhile, a macro missed by several threads at once may be
+	// parsed more than once.
+	lock.unlock ();
+	std::set<Address> pages;
+	auto macro = std::make_shared<const Macro> (_format, _mem, address, &pages);
+	Entry entry;
+	entry.macro = macro;
+	for (const auto &page: pages)
+		entry.page_generations.emplace (page, _mem.pageGeneration (page));
+	lock.lock ();
+	_entries.insert_or_assign (address, std::move (entry));
+	return macro;
+}
+
+void MacroCache::clear ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_entries.clear ();
+}
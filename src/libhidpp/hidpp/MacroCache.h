@@ -0,0 +1,79 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_MACRO_CACHE_H
+#define LIBHIDPP_HIDPP_MACRO_CACHE_H
+
+#include <hidpp/Address.h>
+#include <hidpp/Macro.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+namespace HIDPP
+{
+
+class AbstractMacroFormat;
+class AbstractMemoryMapping;
+
+/**
+ * Macros decoded from a memory mapping, by start address.
+ *
+ * Each macro is parsed once, later requests for the same address share
+ * the decoded macro until one of the pages it was read from is got
+ * writable (see AbstractMemoryMapping::pageGeneration). The cache can
+ * be used from several threads, different macros are parsed in
+ * parallel.
+ */
+class MacroCache
+{
+public:
+	/**
+	 * The format and the memory mapping must outlive the cache.
+	 */
+	MacroCache (const AbstractMacroFormat &format, AbstractMemoryMapping &mem);
+
+	/**
+	 * Get the macro starting at \p address, parsing it if it is not
+	 * cached or if its pages changed.
+	 */
+	std::shared_ptr<const Macro> get (const Address &address);
+
+	/**
+	 * Forget every cached macro.
+	 */
+	void clear ();
+
+private:
+	const AbstractMacroFormat &_format;
+	AbstractMemoryMapping &_mem;
+
+	struct Entry
+	{
+		std::shared_ptr<const Macro> macro;
+		std::map<Address, unsigned int> page_generations;
+	};
+	std::map<Address, Entry> _entries;
+	std::mutex _mutex;
+};
+
+}
+
+#endif
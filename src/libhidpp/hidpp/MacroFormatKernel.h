@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_MACRO_FORMAT_KERNEL_H
+#define LIBHIDPP_HIDPP_MACRO_FORMAT_KERNEL_H
+
+#include <hidpp/AbstractMacroFormat.h>
+
+#include <array>
+#include <utility>
+
+namespace HIDPP
+{
+
+/**
+ * Op code lookup tables of a macro format, built at compile time from
+ * (instruction, op code) pairs.
+ */
+class MacroOpCodeTable
+{
+public:
+	typedef std::pair<Macro::Item::Instruction, uint8_t> Entry;
+
+	template<std::size_t N>
+	constexpr MacroOpCodeTable (const Entry (&entries)[N]):
+		_codes {}, _instructions {}
+	{
+		for (std::size_t i = 0; i < _codes.size (); ++i)
+			_codes[i] = -1;
+		for (std::size_t i = 0; i < _instructions.size (); ++i)
+			_instructions[i] = -1;
+		for (std::size_t i = 0; i < N; ++i) {
+			_codes[entries[i].first] = entries[i].second;
+			_instructions[entries[i].second] = entries[i].first;
+		}
+	}
+
+	/**
+	 * \returns the op code of \p instr, or -1 if it is not supported.
+	 */
+	constexpr int code (Macro::Item::Instruction instr) const
+	{
+		return _codes[instr];
+	}
+
+	/**
+	 * \returns the instruction for \p op_code, or -1 if it is not
+	 * a valid op code.
+	 */
+	constexpr int instruction (uint8_t op_code) const
+	{
+		return _instructions[op_code];
+	}
+
+private:
+	std::array<int16_t, Macro::Item::End+1> _codes;
+	std::array<int16_t, 256> _instructions;
+};
+
+/**
+ * Base for concrete macro formats implementing the bulk functions of
+ * AbstractMacroFormat.
+ *
+ * \p Format must be final so that the per-item calls in the bulk
+ * functions are resolved at compile time and can be inlined. The format
+ * source file should explicitly instantiate the kernel after defining
+ * the item functions (the header declaring it extern).
+ */
+template<typename Format>
+class MacroFormatKernel: public AbstractMacroFormat
+{
+public:
+	std::size_t getJumpLength () const override
+	{
+		return format ().getLength (Macro::Item::Jump);
+	}
+
+	std::size_t getLengths (Macro::const_iterator begin, Macro::const_iterator end,
+				std::size_t *lengths) const override
+	{
+		const Format &f = format ();
+		std::size_t total = 0;
+		for (auto it = begin; it != end; ++it)
+			total += *(lengths++) = f.getLength (*it);
+		return total;
+	}
+
+private:
+	const Format &format () const
+	{
+		return static_cast<const Format &> (*this);
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MacroSimulator.h"
+
+#include <hidpp/MacroAllocator.h>
+
+#include <algorithm>
+#include <limits>
+
+using namespace HIDPP;
+
+static bool isEvent (const Macro::Item &item)
+{
+	switch (item.instruction ()) {
+	case Macro::Item::NoOp:
+	case Macro::Item::Delay:
+	case Macro::Item::ShortDelay:
+		return false;
+	default:
+		return item.isSimple ();
+	}
+}
+
+MacroSimulator::MacroSimulator (unsigned int hold_time, unsigned int step_limit):
+	_hold_time (hold_time),
+	_step_limit (step_limit)
+{
+}
+
+MacroSimulator::Run MacroSimulator::run (const Macro &macro, unsigned int hold_time) const
+{
+	Run run = { Stop::End, 0, 0, 0 };
+	auto begin = macro.begin ();
+	auto it = begin;
+	while (it != macro.end ()) {
+		if (run.instructions == _step_limit) {
+			run.stop = Stop::StepLimit;
+			return run;
+		}
+		++run.instructions;
+		bool pressed = run.duration < hold_time;
+		switch (it->instruction ()) {
+		case Macro::Item::End:
+			return run;
+		case Macro::Item::Delay:
+		case Macro::Item::ShortDelay:
+			run.duration += it->delay ();
+			break;
+		case Macro::Item::WaitRelease:
+			if (pressed)
+				run.duration = hold_time;
+			break;
+		case Macro::Item::RepeatUntilRelease:
+			if (pressed) {
+				it = begin;
+				continue;
+			}
+			break;
+		case Macro::Item::RepeatForever:
+			run.stop = Stop::Repeat;
+			return run;
+		case Macro::Item::Jump:
+			it += it->jumpOffset ();
+			continue;
+		case Macro::Item::JumpIfPressed:
+			if (pressed) {
+				it += it->jumpOffset ();
+				continue;
+			}
+			break;
+		case Macro::Item::JumpIfReleased:
+			if (run.duration + it->delay () >= hold_time) {
+				// Released during the time-out, jump right away
+				run.duration = std::max (run.duration, hold_time);
+				it += it->jumpOffset ();
+				continue;
+			}
+			run.duration += it->delay ();
+			break;
+		default:
+			if (isEvent (*it))
+				++run.events;
+		}
+		++it;
+	}
+	return run;
+}
+
+MacroSimulator::Analysis MacroSimulator::analyze (const Macro &macro) const
+{
+	Analysis analysis = { run (macro, 0), run (macro, _hold_time), std::nullopt };
+	Macro::const_iterator pre_begin, pre_end, loop_begin, loop_end, post_begin, post_end;
+	unsigned int loop_delay;
+	if (macro.isLoop (pre_begin, pre_end, loop_begin, loop_end, post_begin, post_end, loop_delay) &&
+	    loop_begin != loop_end) {
+		// The loop ends with a JumpIfPressed or RepeatUntilRelease
+		Loop loop = { loop_delay, 0, 1, 0, 0.0 };
+		for (auto it = loop_begin; it != loop_end; ++it) {
+			++loop.iteration_instructions;
+			auto instr = it->instruction ();
+			if (instr == Macro::Item::Delay || instr == Macro::Item::ShortDelay)
+				loop.iteration_duration += it->delay ();
+			else if (isEvent (*it))
+				++loop.iteration_events;
+		}
+		if (loop.iteration_events == 0)
+			loop.event_rate = 0.0;
+		else if (loop.iteration_duration == 0)
+			loop.event_rate = std::numeric_limits<double>::infinity ();
+		else
+			loop.event_rate = loop.iteration_events * 1000.0 / loop.iteration_duration;
+		analysis.loop = loop;
+	}
+	return analysis;
+}
+
+std::vector<MacroSimulator::Analysis> MacroSimulator::analyze (const std::vector<const Macro *> &macros) const
+{
+	std::vector<Analysis> analyses;
+	analyses.reserve (macros.size ());
+	for (const Macro *macro: macros)
+		analyses.push_back (analyze (*macro));
+	return analyses;
+}
+
+MacroSimulator::Size MacroSimulator::size (const Macro &macro, const AbstractMacroFormat &format,
+					   std::size_t page_size, std::size_t offset_unit)
+{
+	MacroAllocator allocator (format, page_size, offset_unit);
+	return { allocator.length (macro), allocator.pageCount (macro) };
+}
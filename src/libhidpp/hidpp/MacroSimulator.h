@@ -0,0 +1,124 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_MACRO_SIMULATOR_H
+#define LIBHIDPP_HIDPP_MACRO_SIMULATOR_H
+
+#include <hidpp/Macro.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace HIDPP
+{
+
+class AbstractMacroFormat;
+
+/**
+ * Execute macros on the host with a virtual clock, for knowing their
+ * timing and size before writing them.
+ *
+ * The button playing the macro is pressed at time 0 and released after
+ * the hold time. Delays advance the clock, WaitRelease waits for the
+ * release, JumpIfPressed, RepeatUntilRelease and JumpIfReleased use the
+ * button state at the current virtual time. Other simple items are
+ * counted as events and take no time.
+ *
+ * Running a macro does not allocate, analyzing many macros in a batch
+ * costs their executed instruction count.
+ */
+class MacroSimulator
+{
+public:
+	enum class Stop {
+		End,		///< End item or end of the items
+		Repeat,		///< RepeatForever: the macro never stops by itself
+		StepLimit,	///< a loop did not stop within the step limit
+	};
+
+	struct Run
+	{
+		Stop stop;
+		unsigned int instructions;	///< executed items
+		unsigned int events;		///< executed key, button, wheel, pointer and consumer items
+		unsigned int duration;		///< virtual time in milliseconds when the macro stopped
+	};
+
+	/**
+	 * Inner loop of a macro recognized by Macro::isLoop.
+	 */
+	struct Loop
+	{
+		unsigned int delay;		///< delay before the first iteration
+		unsigned int iteration_duration;	///< milliseconds
+		unsigned int iteration_instructions;
+		unsigned int iteration_events;
+		/**
+		 * Events per second while the button is held, the worst
+		 * case of the loop. Infinite if the iterations take no time.
+		 */
+		double event_rate;
+	};
+
+	struct Size
+	{
+		std::size_t bytes;	///< with alignment padding
+		std::size_t pages;	///< when written alone
+	};
+
+	struct Analysis
+	{
+		Run tap;	///< button released immediately
+		Run held;	///< button held for the hold time
+		std::optional<Loop> loop;
+	};
+
+	/**
+	 * \param hold_time	Time in milliseconds the button is held for
+	 *			Analysis::held.
+	 * \param step_limit	Maximum number of executed items in a run.
+	 */
+	MacroSimulator (unsigned int hold_time = 1000, unsigned int step_limit = 100000);
+
+	/**
+	 * Execute \p macro with the button released after \p hold_time
+	 * milliseconds.
+	 */
+	Run run (const Macro &macro, unsigned int hold_time) const;
+
+	Analysis analyze (const Macro &macro) const;
+	/**
+	 * Analyze every macro in \p macros, in the same order.
+	 */
+	std::vector<Analysis> analyze (const std::vector<const Macro *> &macros) const;
+
+	/**
+	 * Size of \p macro in \p format, written in pages of \p page_size
+	 * bytes (see MacroAllocator).
+	 */
+	static Size size (const Macro &macro, const AbstractMacroFormat &format,
+			  std::size_t page_size, std::size_t offset_unit = 1);
+
+private:
+	unsigned int _hold_time, _step_limit;
+};
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MemorySnapshot.h"
+
+#include <misc/CRC.h>
+#include <misc/Endian.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+using namespace HIDPP;
+
+static constexpr char Magic[8] = { 'H', 'I', 'D', 'P', 'P', 'M', 'E', 'M' };
+static constexpr uint8_t Version = 1;
+static constexpr uint8_t CompressedFlag = 0x01;
+
+enum RecordType: uint8_t
+{
+	EndRecord = 0,
+	PageRecord = 1,
+};
+
+enum Encoding: uint8_t
+{
+	Raw = 0,
+	RunLength = 1,
+};
+
+// Record header: type, memory type, page (LE16), size (LE16), CRC (LE16),
+// encoding and stored length (LE16).
+static constexpr std::size_t RecordHeaderLength = 11;
+
+/*
+ * PackBits-like run-length encoding: a control byte c < 0x80 is
+ * followed by c+1 literal bytes, c >= 0x80 is followed by one byte
+ * repeated c-0x80+2 times.
+ */
+static constexpr std::size_t MaxLiteral = 0x80;
+static constexpr std::size_t MaxRun = 0x81;
+
+static void encodeRunLength (const std::vector<uint8_t> &data, std::vector<uint8_t> &out)
+{
+	out.clear ();
+	std::size_t i = 0;
+	while (i < data.size ()) {
+		std::size_t run = 1;
+		while (i + run < data.size () && run < MaxRun && data[i + run] == data[i])
+			++run;
+		if (run >= 2) {
+			out.push_back (0x80 + run - 2);
+			out.push_back (data[i]);
+			i += run;
+			continue;
+		}
+		// Literal bytes until the next run of at least 2 bytes
+		std::size_t begin = i++;
+		while (i < data.size () && i - begin < MaxLiteral &&
+				!(i + 1 < data.size () && data[i] == data[i + 1]))
+			++i;
+		out.push_back (i - begin - 1);
+		out.insert (out.end (), data.begin () + begin, data.begin () + i);
+	}
+}
+
+static bool decodeRunLength (const uint8_t *in, std::size_t length, std::vector<uint8_t> &data)
+{
+	std::size_t j = 0;
+	for (std::size_t i = 0; i < length;) {
+		uint8_t c = in[i++];
+		if (c < 0x80) {
+			std::size_t count = c + 1;
+			if (i + count > length || j + count > data.size ())
+				return false;
+			std::copy_n (in + i, count, data.begin () + j);
+			i += count;
+			j += count;
+		}
+		else {
+			std::size_t count = c - 0x80 + 2;
+			if (i >= length || j + count > data.size ())
+				return false;
+			std::fill_n (data.begin () + j, count, in[i++]);
+			j += count;
+		}
+	}
+	return j == data.size ();
+}
+
+SnapshotWriter::SnapshotWriter (std::ostream &out, const SnapshotHeader &header):
+	_out (out),
+	_compressed (header.compressed)
+{
+	if (header.fingerprint.size () > 0xffff || header.description.size () > 0xffff)
+		throw std::invalid_argument ("snapshot header too long");
+	std::vector<uint8_t> buffer (Magic, Magic + sizeof (Magic));
+	buffer.push_back (Version);
+	buffer.push_back (_compressed ? CompressedFlag : 0);
+	pushLE<uint16_t> (buffer, header.fingerprint.size ());
+	buffer.insert (buffer.end (), header.fingerprint.begin (), header.fingerprint.end ());
+	pushLE<uint16_t> (buffer, header.description.size ());
+	buffer.insert (buffer.end (), header.description.begin (), header.description.end ());
+	write (buffer.data (), buffer.size ());
+}
+
+void SnapshotWriter::writePage (const Address &address, const std::vector<uint8_t> &data)
+{
+	if (data.size () > 0xffff || address.page > 0xffff)
+		throw std::invalid_argument ("page too large for snapshot");
+	uint8_t encoding = Raw;
+	if (_compressed) {
+		encodeRunLength (data, _buffer);
+		if (_buffer.size () < data.size ())
+			encoding = RunLength;
+	}
+	const std::vector<uint8_t> &stored = encoding == Raw ? data : _buffer;
+	std::array<uint8_t, RecordHeaderLength> record;
+	auto it = record.begin ();
+	*it++ = PageRecord;
+	*it++ = address.mem_type;
+	it = writeLE<uint16_t> (it, address.page);
+	it = writeLE<uint16_t> (it, data.size ());
+	it = writeLE<uint16_t> (it, CRC::CCITT (data.data (), data.size ()));
+	*it++ = encoding;
+	writeLE<uint16_t> (it, stored.size ());
+	write (record.data (), record.size ());
+	write (stored.data (), stored.size ());
+}
+
+void SnapshotWriter::finish ()
+{
+	uint8_t end = EndRecord;
+	write (&end, 1);
+	if (!_out.flush ())
+		throw std::runtime_error ("failed to write snapshot");
+}
+
+void SnapshotWriter::write (const uint8_t *data, std::size_t length)
+{
+	if (!_out.write (reinterpret_cast<const char *> (data), length))
+		throw std::runtime_error ("failed to write snapshot");
+}
+
+SnapshotReader::SnapshotReader (std::istream &in):
+	_in (in),
+	_finished (false)
+{
+	std::array<uint8_t, sizeof (Magic) + 4> start;
+	read (start.data (), start.size ());
+	if (!std::equal (Magic, Magic + sizeof (Magic), start.begin ()))
+		throw std::runtime_error ("not a memory snapshot");
+	if (start[sizeof (Magic)] != Version)
+		throw std::runtime_error ("unsupported snapshot version");
+	_header.compressed = start[sizeof (Magic) + 1] & CompressedFlag;
+	std::size_t fingerprint_length = readLE<uint16_t> (start.begin () + sizeof (Magic) + 2);
+	_header.fingerprint.resize (fingerprint_length);
+	read (reinterpret_cast<uint8_t *> (&_header.fingerprint[0]), fingerprint_length);
+	std::array<uint8_t, 2> length;
+	read (length.data (), length.size ());
+	_header.description.resize (readLE<uint16_t> (length.begin ()));
+	read (_header.description.data (), _header.description.size ());
+}
+
+const SnapshotHeader &SnapshotReader::header () const
+{
+	return _header;
+}
+
+bool SnapshotReader::readPage (SnapshotPage &page)
+{
+	if (_finished)
+		return false;
+	std::array<uint8_t, RecordHeaderLength> record;
+	read (record.data (), 1);
+	if (record[0] == EndRecord) {
+		_finished = true;
+		return false;
+	}
+	if (record[0] != PageRecord)
+		throw std::runtime_error ("invalid snapshot record");
+	read (record.data () + 1, record.size () - 1);
+	auto it = record.begin () + 1;
+	page.address.mem_type = *it++;
+	page.address.page = readLE<uint16_t> (it);
+	page.address.offset = 0;
+	page.data.resize (readLE<uint16_t> (it + 2));
+	page.crc = readLE<uint16_t> (it + 4);
+	uint8_t encoding = it[6];
+	std::size_t stored_length = readLE<uint16_t> (it + 7);
+	if (encoding == Raw) {
+		if (stored_length != page.data.size ())
+			throw std::runtime_error ("invalid snapshot page length");
+		read (page.data.data (), stored_length);
+	}
+	else if (encoding == RunLength) {
+		_buffer.resize (stored_length);
+		read (_buffer.data (), stored_length);
+		if (!decodeRunLength (_buffer.data (), stored_length, page.data))
+			throw std::runtime_error ("invalid run-length encoded snapshot page");
+	}
+	else
+		throw std::runtime_error ("unknown snapshot page encoding");
+	if (CRC::CCITT (page.data.data (), page.data.size ()) != page.crc)
+		throw std::runtime_error ("snapshot page does not match its CRC");
+	return true;
+}
+
+void SnapshotReader::read (uint8_t *data, std::size_t length)
+{
+	if (!_in.read (reinterpret_cast<char *> (data), length))
+		throw std::runtime_error ("truncated snapshot");
+}
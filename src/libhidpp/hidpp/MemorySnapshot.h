@@ -0,0 +1,137 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_MEMORY_SNAPSHOT_H
+#define LIBHIDPP_HIDPP_MEMORY_SNAPSHOT_H
+
+#include <hidpp/Address.h>
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * \name Memory snapshots
+ *
+ * Binary backup of onboard memory pages. A snapshot starts with a
+ * header describing the device, followed by one record per page with
+ * its address, size and CRC-CCITT, and ends with an end record.
+ *
+ * Pages can be run-length encoded (erased memory is mostly 0xff), a
+ * page is stored raw when encoding would not make it smaller.
+ *
+ * \{
+ */
+
+struct SnapshotHeader
+{
+	/**
+	 * Device fingerprint (e.g. HIDPP20::Device::fingerprint).
+	 */
+	std::string fingerprint;
+	/**
+	 * Memory description in the device protocol format (e.g. the
+	 * HIDPP20::IOnboardProfiles::getDescription results).
+	 */
+	std::vector<uint8_t> description;
+	bool compressed = false;
+};
+
+struct SnapshotPage
+{
+	Address address;
+	uint16_t crc; ///< CRC-CCITT of the whole page data
+	std::vector<uint8_t> data;
+};
+
+/**
+ * Write a snapshot to a stream, page by page.
+ */
+class SnapshotWriter
+{
+public:
+	/**
+	 * Write \p header to \p out.
+	 *
+	 * \throws std::runtime_error on write errors.
+	 */
+	SnapshotWriter (std::ostream &out, const SnapshotHeader &header);
+
+	/**
+	 * \throws std::runtime_error on write errors.
+	 */
+	void writePage (const Address &address, const std::vector<uint8_t> &data);
+	/**
+	 * Write the end record and flush the stream.
+	 *
+	 * \throws std::runtime_error on write errors.
+	 */
+	void finish ();
+
+private:
+	void write (const uint8_t *data, std::size_t length);
+
+	std::ostream &_out;
+	bool _compressed;
+	std::vector<uint8_t> _buffer;
+};
+
+/**
+ * Read a snapshot from a stream, page by page.
+ */
+class SnapshotReader
+{
+public:
+	/**
+	 * Read the header from \p in.
+	 *
+	 * \throws std::runtime_error if the stream is not a snapshot.
+	 */
+	SnapshotReader (std::istream &in);
+
+	const SnapshotHeader &header () const;
+
+	/**
+	 * Read the next page in \p page, its buffer is reused.
+	 *
+	 * \returns false after the last page.
+	 *
+	 * \throws std::runtime_error if the snapshot is truncated or a page
+	 * does not match its CRC.
+	 */
+	bool readPage (SnapshotPage &page);
+
+private:
+	void read (uint8_t *data, std::size_t length);
+
+	std::istream &_in;
+	SnapshotHeader _header;
+	bool _finished;
+	std::vector<uint8_t> _buffer;
+};
+
+/**\}*/
+
+}
+
+#endif
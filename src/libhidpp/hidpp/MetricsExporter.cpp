@@ -0,0 +1,313 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MetricsExporter.h"
+
+#include <hidpp/Dispatcher.h>
+#include <hidpp/PageCache.h>
+#include <hidpp20/BatteryMonitor.h>
+#include <hidpp20/DescriptorCache.h>
+#include <hidpp20/Device.h>
+
+#include <algorithm>
+#include <atomic>
+#include <locale>
+#include <sstream>
+
+using namespace HIDPP;
+
+namespace
+{
+
+std::string escape (const std::string &value)
+{
+	std::string escaped;
+	for (char c: value) {
+		switch (c) {
+		case '\\': escaped += "\\\\"; break;
+		case '"': escaped += "\\\""; break;
+		case '\n': escaped += "\\n"; break;
+		default: escaped += c;
+		}
+	}
+	return escaped;
+}
+
+void family (std::ostream &out, const char *name, const char *type, const char *help,
+	     const char *unit = nullptr)
+{
+	out << "# TYPE " << name << " " << type << "\n";
+	if (unit)
+		out << "# UNIT " << name << " " << unit << "\n";
+	out << "# HELP " << name << " " << help << "\n";
+}
+
+// Labels of device index metrics
+std::string labels (const std::string &name, DeviceIndex index)
+{
+	return "device=\"" + escape (name) + "\",index=\"" + std::to_string (index) + "\"";
+}
+
+double seconds (std::chrono::microseconds us)
+{
+	return std::chrono::duration<double> (us).count ();
+}
+
+}
+
+MetricsExporter::MetricsExporter (std::chrono::milliseconds interval):
+	_interval (interval),
+	_stopped (false),
+	_snapshot (std::make_shared<const std::string> ("# EOF\n"))
+{
+}
+
+MetricsExporter::~MetricsExporter ()
+{
+}
+
+void MetricsExporter::addDispatcher (const std::string &name, const Dispatcher *dispatcher)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_dispatchers[dispatcher] = name;
+}
+
+void MetricsExporter::removeDispatcher (const Dispatcher *dispatcher)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_dispatchers.erase (dispatcher);
+	for (auto it = _event_samples.begin (); it != _event_samples.end (); ) {
+		if (std::get<0> (it->first) == dispatcher)
+			it = _event_samples.erase (it);
+		else
+			++it;
+	}
+}
+
+void MetricsExporter::addBatteryMonitor (const HIDPP20::BatteryMonitor *monitor)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_battery_monitors.push_back (monitor);
+}
+
+void MetricsExporter::removeBatteryMonitor (const HIDPP20::BatteryMonitor *monitor)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_battery_monitors.erase (std::remove (_battery_monitors.begin (), _battery_monitors.end (), monitor),
+				 _battery_monitors.end ());
+}
+
+void MetricsExporter::addCache (const std::string &cache, const std::string &name,
+				std::shared_ptr<const CacheCounter> counter)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_caches[std::make_tuple (cache, name)] = std::move (counter);
+}
+
+void MetricsExporter::addFeatureCache (const std::string &name, const HIDPP20::Device &device)
+{
+	addCache ("feature", name, device.featureCacheCounter ());
+}
+
+void MetricsExporter::addPageCache (const std::string &name, std::shared_ptr<const PageCache> cache)
+{
+	auto counter = &cache->counter ();
+	addCache ("page", name, std::shared_ptr<const CacheCounter> (std::move (cache), counter));
+}
+
+void MetricsExporter::addDescriptorCache (const std::string &name,
+					  std::shared_ptr<const HIDPP20::DescriptorCache> cache)
+{
+	auto counter = &cache->counter ();
+	addCache ("descriptor", name, std::shared_ptr<const CacheCounter> (std::move (cache), counter));
+}
+
+void MetricsExporter::removeCaches (const std::string &name)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	for (auto it = _caches.begin (); it != _caches.end (); ) {
+		if (std::get<1> (it->first) == name)
+			it = _caches.erase (it);
+		else
+			++it;
+	}
+}
+
+void MetricsExporter::collect ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto now = clock::now ();
+
+	// Sample everything first, samples of a family must be contiguous
+	struct DeviceSample
+	{
+		Dispatcher::LatencyHistogram rtt;
+		uint64_t timeouts = 0;
+		uint64_t events = 0;
+	};
+	struct DispatcherSample
+	{
+		const Dispatcher *dispatcher;
+		const std::string *name;
+		Dispatcher::Statistics stats;
+		std::map<DeviceIndex, DeviceSample> devices;
+	};
+	std::vector<DispatcherSample> dispatchers;
+	for (const auto &[dispatcher, name]: _dispatchers) {
+		DispatcherSample sample = { dispatcher, &name, dispatcher->statistics (), {} };
+		for (const auto &[key, histogram]: sample.stats.latency) {
+			auto &rtt = sample.devices[std::get<0> (key)].rtt;
+			for (std::size_t i = 0; i < histogram.buckets.size (); ++i)
+				rtt.buckets[i] += histogram.buckets[i];
+			rtt.count += histogram.count;
+			rtt.total += histogram.total;
+		}
+		for (const auto &[index, count]: sample.stats.device_timeouts)
+			sample.devices[index].timeouts = count;
+		for (const auto &[key, count]: sample.stats.events)
+			sample.devices[key.first].events += count;
+		dispatchers.push_back (std::move (sample));
+	}
+
+	std::ostringstream out;
+	out.imbue (std::locale::classic ());
+	out.precision (15);
+
+	family (out, "hidpp_command_rtt_seconds", "histogram", "Round-trip time of answered commands.", "seconds");
+	for (const auto &dispatcher: dispatchers) {
+		for (const auto &[index, device]: dispatcher.devices) {
+			if (device.rtt.count == 0)
+				continue;
+			auto l = labels (*dispatcher.name, index);
+			uint64_t cumulative = 0;
+			for (std::size_t i = 0; i+1 < device.rtt.buckets.size (); ++i) {
+				cumulative += device.rtt.buckets[i];
+				out << "hidpp_command_rtt_seconds_bucket{" << l << ",le=\""
+				    << seconds (Dispatcher::LatencyHistogram::bucketLimit (i))
+				    << "\"} " << cumulative << "\n";
+			}
+			out << "hidpp_command_rtt_seconds_bucket{" << l << ",le=\"+Inf\"} " << device.rtt.count << "\n";
+			out << "hidpp_command_rtt_seconds_sum{" << l << "} " << seconds (device.rtt.total) << "\n";
+			out << "hidpp_command_rtt_seconds_count{" << l << "} " << device.rtt.count << "\n";
+		}
+	}
+	family (out, "hidpp_command_timeouts", "counter", "Commands not answered in time.");
+	for (const auto &dispatcher: dispatchers)
+		for (const auto &[index, device]: dispatcher.devices)
+			if (device.timeouts)
+				out << "hidpp_command_timeouts_total{" << labels (*dispatcher.name, index) << "} "
+				    << device.timeouts << "\n";
+	family (out, "hidpp_events", "counter", "Events received, with or without listeners.");
+	for (const auto &dispatcher: dispatchers)
+		for (const auto &[index, device]: dispatcher.devices)
+			if (device.events)
+				out << "hidpp_events_total{" << labels (*dispatcher.name, index) << "} "
+				    << device.events << "\n";
+	family (out, "hidpp_event_rate", "gauge", "Events per second since the previous collection.");
+	for (const auto &dispatcher: dispatchers) {
+		for (const auto &[index, device]: dispatcher.devices) {
+			if (device.events == 0)
+				continue;
+			auto [it, inserted] = _event_samples.try_emplace (std::make_tuple (dispatcher.dispatcher, index),
+									  EventSample { device.events, now });
+			if (inserted)
+				continue; // no previous sample
+			auto elapsed = std::chrono::duration<double> (now - it->second.time).count ();
+			// Counts lower than the previous sample were reset
+			auto delta = device.events >= it->second.count
+				? device.events - it->second.count
+				: device.events;
+			if (elapsed > 0)
+				out << "hidpp_event_rate{" << labels (*dispatcher.name, index) << "} "
+				    << delta / elapsed << "\n";
+			it->second = { device.events, now };
+		}
+	}
+	family (out, "hidpp_commands_in_flight", "gauge", "Commands sent and waiting for their answer.");
+	for (const auto &dispatcher: dispatchers)
+		out << "hidpp_commands_in_flight{device=\"" << escape (*dispatcher.name) << "\"} "
+		    << dispatcher.stats.commands_in_flight << "\n";
+	family (out, "hidpp_commands_queued", "gauge", "Commands waiting to be sent.");
+	for (const auto &dispatcher: dispatchers)
+		out << "hidpp_commands_queued{device=\"" << escape (*dispatcher.name) << "\"} "
+		    << dispatcher.stats.commands_queued << "\n";
+	family (out, "hidpp_unmatched_answers", "counter", "Answers and errors not matching any command.");
+	for (const auto &dispatcher: dispatchers)
+		out << "hidpp_unmatched_answers_total{device=\"" << escape (*dispatcher.name) << "\"} "
+		    << dispatcher.stats.unmatched_answers << "\n";
+
+	std::vector<std::tuple<std::string, HIDPP20::BatteryMonitor::Level>> levels;
+	for (auto monitor: _battery_monitors) {
+		for (const auto &[dev, level]: monitor->levels ()) {
+			auto it = _dispatchers.find (dev->dispatcher ());
+			if (it == _dispatchers.end () || level.status.discharge_level == 0)
+				continue;
+			levels.emplace_back (labels (it->second, dev->deviceIndex ()), level);
+		}
+	}
+	family (out, "hidpp_battery_level_percent", "gauge", "Last battery level received.");
+	for (const auto &[l, level]: levels)
+		out << "hidpp_battery_level_percent{" << l << "} "
+		    << static_cast<unsigned int> (level.status.discharge_level) << "\n";
+	family (out, "hidpp_battery_level_age_seconds", "gauge", "Time since the battery level was received.", "seconds");
+	for (const auto &[l, level]: levels)
+		out << "hidpp_battery_level_age_seconds{" << l << "} "
+		    << std::chrono::duration<double> (now - level.time).count () << "\n";
+
+	std::vector<std::tuple<std::string, CacheCounter::Snapshot>> caches;
+	for (const auto &[key, counter]: _caches)
+		caches.emplace_back ("cache=\"" + escape (std::get<0> (key)) +
+				     "\",device=\"" + escape (std::get<1> (key)) + "\"",
+				     counter->snapshot ());
+	family (out, "hidpp_cache_hits", "counter", "Cache lookups answered without the device.");
+	for (const auto &[l, counts]: caches)
+		out << "hidpp_cache_hits_total{" << l << "} " << counts.hits << "\n";
+	family (out, "hidpp_cache_misses", "counter", "Cache lookups that needed the device.");
+	for (const auto &[l, counts]: caches)
+		out << "hidpp_cache_misses_total{" << l << "} " << counts.misses << "\n";
+	family (out, "hidpp_cache_hit_ratio", "gauge", "Ratio of hits among cache lookups.");
+	for (const auto &[l, counts]: caches)
+		out << "hidpp_cache_hit_ratio{" << l << "} " << counts.hitRatio () << "\n";
+
+	out << "# EOF\n";
+	std::atomic_store (&_snapshot, std::make_shared<const std::string> (out.str ()));
+}
+
+std::shared_ptr<const std::string> MetricsExporter::text () const
+{
+	return std::atomic_load (&_snapshot);
+}
+
+void MetricsExporter::run ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	while (!_stopped) {
+		lock.unlock ();
+		collect ();
+		lock.lock ();
+		_cond.wait_for (lock, _interval, [this] () { return _stopped; });
+	}
+	_stopped = false;
+}
+
+void MetricsExporter::stop ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_stopped = true;
+	_cond.notify_all ();
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_METRICS_EXPORTER_H
+#define LIBHIDPP_HIDPP_METRICS_EXPORTER_H
+
+#include <hidpp/defs.h>
+#include <misc/CacheCounter.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace HIDPP20
+{
+class BatteryMonitor;
+class DescriptorCache;
+class Device;
+}
+
+namespace HIDPP
+{
+
+class Dispatcher;
+class PageCache;
+
+/**
+ * Telemetry of a libhidpp service in the OpenMetrics text format (e.g.
+ * for a Prometheus scraper).
+ *
+ * Exported metrics, labelled with the name given to the dispatcher
+ * ("device") and the device index ("index"):
+ *  - hidpp_command_rtt_seconds: histogram of command round-trip times,
+ *  - hidpp_command_timeouts_total: unanswered commands,
+ *  - hidpp_events_total and hidpp_event_rate (events per second since
+ *    the previous collection),
+ *  - hidpp_commands_in_flight and hidpp_commands_queued: queue depths
+ *    of the dispatcher,
+ *  - hidpp_unmatched_answers_total,
+ *  - hidpp_battery_level_percent and hidpp_battery_level_age_seconds,
+ *  - hidpp_cache_hits_total, hidpp_cache_misses_total and
+ *    hidpp_cache_hit_ratio, with a "cache" label (e.g. "feature",
+ *    "page" or "descriptor").
+ *
+ * Sources are sampled by \ref collect (periodically when \ref run is
+ * used) from their counters and last known values only: devices are
+ * never queried. Each collection publishes an immutable snapshot that
+ * \ref text returns without waiting for the collector, so scrapes
+ * neither block nor are blocked by each other.
+ *
+ * Dispatchers and battery monitors must outlive their registration,
+ * caches are kept alive by the exporter.
+ */
+class MetricsExporter
+{
+public:
+	/**
+	 * HTTP content type of \ref text.
+	 */
+	static constexpr const char *ContentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+	/**
+	 * \param interval	Collection period of \ref run.
+	 */
+	MetricsExporter (std::chrono::milliseconds interval = std::chrono::seconds (5));
+	~MetricsExporter ();
+
+	MetricsExporter (const MetricsExporter &) = delete;
+	MetricsExporter &operator= (const MetricsExporter &) = delete;
+
+	/**
+	 * Export the statistics of \p dispatcher as device \p name.
+	 */
+	void addDispatcher (const std::string &name, const Dispatcher *dispatcher);
+	void removeDispatcher (const Dispatcher *dispatcher);
+
+	/**
+	 * Export the last levels received by \p monitor. Devices are
+	 * labelled with the name of their dispatcher, the levels of devices
+	 * on dispatchers that are not exported are ignored.
+	 */
+	void addBatteryMonitor (const HIDPP20::BatteryMonitor *monitor);
+	void removeBatteryMonitor (const HIDPP20::BatteryMonitor *monitor);
+
+	/**
+	 * Export the hits and misses of \p counter as cache \p cache of
+	 * device \p name.
+	 */
+	void addCache (const std::string &cache, const std::string &name,
+		       std::shared_ptr<const CacheCounter> counter);
+	void addFeatureCache (const std::string &name, const HIDPP20::Device &device);
+	void addPageCache (const std::string &name, std::shared_ptr<const PageCache> cache);
+	void addDescriptorCache (const std::string &name,
+				 std::shared_ptr<const HIDPP20::DescriptorCache> cache);
+	/**
+	 * Stop exporting the caches of device \p name.
+	 */
+	void removeCaches (const std::string &name);
+
+	/**
+	 * Sample every source and publish a new snapshot.
+	 */
+	void collect ();
+	/**
+	 * Last published snapshot, an empty exposition before the first
+	 * collection.
+	 *
+	 * This never locks the exporter and can be called from any thread.
+	 */
+	std::shared_ptr<const std::string> text () const;
+
+	/**
+	 * Collect every interval until \ref stop is called.
+	 */
+	void run ();
+	void stop ();
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct EventSample
+	{
+		uint64_t count;
+		clock::time_point time;
+	};
+
+	const std::chrono::milliseconds _interval;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _stopped;
+	std::map<const Dispatcher *, std::string> _dispatchers;
+	std::vector<const HIDPP20::BatteryMonitor *> _battery_monitors;
+	std::map<std::tuple<std::string, std::string>, std::shared_ptr<const CacheCounter>> _caches;
+	// Previous event counts by dispatcher and device index, for rates
+	std::map<std::tuple<const Dispatcher *, DeviceIndex>, EventSample> _event_samples;
+	std::shared_ptr<const std::string> _snapshot; // only accessed atomically
+};
+
+}
+
+#endif
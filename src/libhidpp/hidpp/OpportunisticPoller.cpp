@@ -0,0 +1,156 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "OpportunisticPoller.h"
+
+#include <misc/Log.h>
+
+using namespace HIDPP;
+
+OpportunisticPoller::OpportunisticPoller (Dispatcher *dispatcher, clock::duration awake_window):
+	_dispatcher (dispatcher),
+	_awake_window (awake_window),
+	_next_id (0),
+	_stopped (false),
+	_stats {}
+{
+	_activity_handler = _dispatcher->registerActivityHandler ([this] (DeviceIndex index) {
+		activity (index);
+	});
+}
+
+OpportunisticPoller::~OpportunisticPoller ()
+{
+	_dispatcher->unregisterActivityHandler (_activity_handler);
+}
+
+OpportunisticPoller::poll_id OpportunisticPoller::addPoll (DeviceIndex index, clock::duration interval,
+							   poll_function poll,
+							   std::optional<clock::duration> max_wait)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto id = _next_id++;
+	_polls.emplace (id, Poll { index, interval, max_wait, std::move (poll), clock::now (), false });
+	_cond.notify_all ();
+	return id;
+}
+
+void OpportunisticPoller::removePoll (poll_id id)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_polls.erase (id);
+}
+
+OpportunisticPoller::Statistics OpportunisticPoller::statistics () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _stats;
+}
+
+void OpportunisticPoller::run ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	while (!_stopped) {
+		auto now = clock::now ();
+		std::optional<clock::time_point> wake;
+		auto next = _polls.end ();
+		bool forced = false;
+		for (auto it = _polls.begin (); it != _polls.end (); ++it) {
+			const auto &poll = it->second;
+			if (poll.running)
+				continue;
+			if (now < poll.due) {
+				if (!wake || poll.due < *wake)
+					wake = poll.due;
+				continue;
+			}
+			if (isAwake (poll)) {
+				next = it;
+				forced = false;
+				break;
+			}
+			if (poll.max_wait) {
+				auto deadline = poll.due + *poll.max_wait;
+				if (deadline <= now) {
+					// Keep looking for a poll to an awake device
+					if (next == _polls.end ()) {
+						next = it;
+						forced = true;
+					}
+				}
+				else if (!wake || deadline < *wake)
+					wake = deadline;
+			}
+			// else woken by activity
+		}
+		if (next == _polls.end ()) {
+			if (wake)
+				_cond.wait_until (lock, *wake);
+			else
+				_cond.wait (lock);
+			continue;
+		}
+		auto id = next->first;
+		auto &poll = next->second;
+		poll.running = true;
+		++(forced ? _stats.forced : _stats.piggybacked);
+		auto function = poll.function;
+		auto index = poll.index;
+		lock.unlock ();
+		try {
+			Dispatcher::PriorityScope priority (Dispatcher::Priority::Bulk);
+			function ();
+		}
+		catch (std::exception &e) {
+			Log::debug () << "Poll to device " << index << " failed: " << e.what () << std::endl;
+		}
+		lock.lock ();
+		auto it = _polls.find (id);
+		if (it != _polls.end ()) {
+			it->second.running = false;
+			it->second.due = clock::now () + it->second.interval;
+		}
+	}
+	_stopped = false;
+}
+
+void OpportunisticPoller::stop ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_stopped = true;
+	_cond.notify_all ();
+}
+
+void OpportunisticPoller::activity (DeviceIndex index)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto now = clock::now ();
+	_last_activity[index] = now;
+	for (const auto &[id, poll]: _polls) {
+		if (poll.index == index && !poll.running && poll.due <= now) {
+			_cond.notify_all ();
+			return;
+		}
+	}
+}
+
+bool OpportunisticPoller::isAwake (const Poll &poll) const
+{
+	auto it = _last_activity.find (poll.index);
+	return it != _last_activity.end () && it->second + _awake_window >= poll.due;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_OPPORTUNISTIC_POLLER_H
+#define LIBHIDPP_HIDPP_OPPORTUNISTIC_POLLER_H
+
+#include <hidpp/Dispatcher.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+
+namespace HIDPP
+{
+
+/**
+ * Periodic low-priority reads (e.g. battery level, mode or profile
+ * checks) sent when their device is known to be awake instead of at
+ * fixed times.
+ *
+ * A poll becomes due its interval after its last run (at once when
+ * added). A due poll runs if its device was active (see
+ * Dispatcher::registerActivityHandler) within the awake window before
+ * becoming due, otherwise it waits for the next report from the
+ * device. Polling then neither wakes up sleeping wireless devices nor
+ * waits for their timeouts. A poll may also be forced after waiting
+ * for some time.
+ *
+ * Polls are run one at a time, with Dispatcher::Priority::Bulk, from
+ * the thread calling \ref run. The answer of a poll is activity too,
+ * so the other due polls of the same device follow it.
+ */
+class OpportunisticPoller
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	/**
+	 * Sends the read and waits for its answer, exceptions are logged.
+	 */
+	typedef std::function<void ()> poll_function;
+	typedef uint64_t poll_id;
+
+	struct Statistics
+	{
+		uint64_t piggybacked; ///< polls run after device activity
+		uint64_t forced; ///< polls run after waiting too long
+	};
+
+	/**
+	 * \param dispatcher	Dispatcher observed for device activity.
+	 * \param awake_window	How long a device is assumed awake after a
+	 *			report was received from it.
+	 */
+	OpportunisticPoller (Dispatcher *dispatcher,
+			     clock::duration awake_window = std::chrono::seconds (1));
+	/**
+	 * \ref run must have returned.
+	 */
+	~OpportunisticPoller ();
+
+	OpportunisticPoller (const OpportunisticPoller &) = delete;
+	OpportunisticPoller &operator= (const OpportunisticPoller &) = delete;
+
+	/**
+	 * Add a poll to device \p index, every \p interval at most.
+	 *
+	 * \param max_wait	Run the poll anyway when it has been due for
+	 *			that long, never by default.
+	 */
+	poll_id addPoll (DeviceIndex index, clock::duration interval, poll_function poll,
+			 std::optional<clock::duration> max_wait = std::nullopt);
+	/**
+	 * Remove a poll, it may still be running when this returns but will
+	 * not run again.
+	 */
+	void removePoll (poll_id id);
+
+	Statistics statistics () const;
+
+	/**
+	 * Run the polls until \ref stop is called.
+	 */
+	void run ();
+	void stop ();
+
+private:
+	struct Poll
+	{
+		DeviceIndex index;
+		clock::duration interval;
+		std::optional<clock::duration> max_wait;
+		poll_function function;
+		clock::time_point due;
+		bool running;
+	};
+
+	void activity (DeviceIndex index);
+	bool isAwake (const Poll &poll) const; // _mutex must be held
+
+	Dispatcher *_dispatcher;
+	Dispatcher::activity_iterator _activity_handler;
+	const clock::duration _awake_window;
+	mutable std::mutex _mutex;
+	std::condition_variable _cond;
+	std::map<poll_id, Poll> _polls;
+	std::map<DeviceIndex, clock::time_point> _last_activity;
+	poll_id _next_id;
+	bool _stopped;
+	Statistics _stats;
+};
+
+}
+
+#endif
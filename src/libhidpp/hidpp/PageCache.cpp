@@ -0,0 +1,162 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "PageCache.h"
+
+#include <misc/Log.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+using namespace HIDPP;
+
+static constexpr char Header[] = "# libhidpp page cache 1";
+
+static std::string toHex (const std::vector<uint8_t> &bytes)
+{
+	std::ostringstream ss;
+	ss << std::hex << std::setfill ('0');
+	for (auto byte: bytes)
+		ss << std::setw (2) << static_cast<unsigned int> (byte);
+	return ss.str ();
+}
+
+static std::vector<uint8_t> fromHex (const std::string &str)
+{
+	std::vector<uint8_t> bytes;
+	if (str.size () % 2 != 0)
+		throw std::runtime_error ("Invalid hexadecimal string");
+	for (std::size_t i = 0; i < str.size (); i += 2)
+		bytes.push_back (std::stoul (str.substr (i, 2), nullptr, 16));
+	return bytes;
+}
+
+PageCache::PageCache (const std::string &path):
+	_path (path),
+	_modified (false)
+{
+	try {
+		load ();
+	}
+	catch (std::exception &e) {
+		Log::warning () << "Ignoring invalid page cache " << path
+				<< ": " << e.what () << std::endl;
+		_pages.clear ();
+	}
+}
+
+PageCache::~PageCache ()
+{
+	try {
+		if (_modified)
+			save ();
+	}
+	catch (std::exception &e) {
+		Log::error () << "Failed to save page cache " << _path
+			      << ": " << e.what () << std::endl;
+	}
+}
+
+void PageCache::load ()
+{
+	std::ifstream in (_path);
+	if (!in)
+		return; // no cache yet
+	std::string line;
+	if (!std::getline (in, line) || line != Header)
+		throw std::runtime_error ("unknown format");
+	unsigned int line_number = 1;
+	while (std::getline (in, line)) {
+		++line_number;
+		std::istringstream ss (line);
+		std::string type;
+		if (!(ss >> type))
+			continue;
+		if (type != "page")
+			throw std::runtime_error ("unknown record at line " + std::to_string (line_number));
+		std::string fingerprint, data;
+		int mem_type;
+		unsigned int page;
+		if (!(ss >> fingerprint >> std::hex >> mem_type >> page >> data))
+			throw std::runtime_error ("invalid page at line " + std::to_string (line_number));
+		_pages[key_type (fingerprint, mem_type, page)] = fromHex (data);
+	}
+}
+
+void PageCache::save ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::string tmp_path = _path + ".tmp";
+	{
+		std::ofstream out (tmp_path, std::ios::trunc);
+		if (!out)
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+		out << Header << std::endl << std::hex << std::setfill ('0');
+		for (const auto &[key, data]: _pages) {
+			const auto &[fingerprint, mem_type, page] = key;
+			out << "page " << fingerprint
+			    << " " << std::setw (2) << mem_type
+			    << " " << std::setw (2) << page
+			    << " " << toHex (data) << std::endl;
+		}
+		if (!out.flush ())
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+	}
+	if (0 != std::rename (tmp_path.c_str (), _path.c_str ()))
+		throw std::system_error (errno, std::generic_category (), "rename");
+	_modified = false;
+}
+
+std::optional<std::vector<uint8_t>> PageCache::findPage (const std::string &fingerprint,
+							 const Address &address) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _pages.find (key_type (fingerprint, address.mem_type, address.page));
+	_counter.count (it != _pages.end ());
+	if (it == _pages.end ())
+		return std::nullopt;
+	return it->second;
+}
+
+void PageCache::storePage (const std::string &fingerprint,
+			   const Address &address,
+			   const std::vector<uint8_t> &data)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto &page = _pages[key_type (fingerprint, address.mem_type, address.page)];
+	if (page != data) {
+		page = data;
+		_modified = true;
+	}
+}
+
+void PageCache::removePage (const std::string &fingerprint, const Address &address)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (_pages.erase (key_type (fingerprint, address.mem_type, address.page)))
+		_modified = true;
+}
+
+const CacheCounter &PageCache::counter () const noexcept
+{
+	return _counter;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_PAGE_CACHE_H
+#define LIBHIDPP_HIDPP_PAGE_CACHE_H
+
+#include <hidpp/Address.h>
+#include <misc/CacheCounter.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * On-disk cache of onboard memory pages (see
+ * AbstractMemoryMapping::setPageCache).
+ *
+ * Pages are keyed by a device fingerprint (e.g.
+ * HIDPP20::Device::fingerprint), memory type and page number. The
+ * cache does not check the content, the memory mapping validates it
+ * against the device before using it.
+ *
+ * The cache is a text file with one record per line. It can be shared
+ * by several devices and threads.
+ */
+class PageCache
+{
+public:
+	/**
+	 * Load the cache from \p path if it exists.
+	 *
+	 * Invalid files are ignored (with a warning) and overwritten when
+	 * saving.
+	 */
+	PageCache (const std::string &path);
+	/**
+	 * Save the cache if it was modified, errors are only logged.
+	 */
+	~PageCache ();
+
+	PageCache (const PageCache &) = delete;
+	PageCache &operator= (const PageCache &) = delete;
+
+	/**
+	 * Write the cache, replacing the file atomically.
+	 *
+	 * \throws std::system_error
+	 */
+	void save ();
+
+	/**
+	 * Find the page at \p address (offset is ignored).
+	 */
+	std::optional<std::vector<uint8_t>> findPage (const std::string &fingerprint,
+						      const Address &address) const;
+	void storePage (const std::string &fingerprint,
+			const Address &address,
+			const std::vector<uint8_t> &data);
+	void removePage (const std::string &fingerprint, const Address &address);
+
+	/**
+	 * Hits and misses of findPage.
+	 */
+	const CacheCounter &counter () const noexcept;
+
+private:
+	void load ();
+
+	typedef std::tuple<std::string, int, unsigned int> key_type;
+
+	std::string _path;
+	mutable std::mutex _mutex;
+	std::map<key_type, std::vector<uint8_t>> _pages;
+	bool _modified;
+	mutable CacheCounter _counter;
+};
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Probe.h"
+
+#include <hidpp/Device.h>
+#include <hidpp/Dispatcher.h>
+#include <hidpp/DispatcherThread.h>
+#include <hidpp10/ReceiverState.h>
+
+#include <future>
+#include <memory>
+#include <thread>
+
+using namespace HIDPP;
+
+static ProbeResult probeIndex (Dispatcher *dispatcher, const std::string &path, DeviceIndex index,
+			       const HIDPP10::ReceiverState *receiver)
+{
+	ProbeResult result;
+	result.path = path;
+	result.index = index;
+	try {
+		Device dev (dispatcher, index, receiver);
+		result.vendor_id = dispatcher->vendorID ();
+		result.product_id = dev.productID ();
+		result.name = dev.name ();
+		result.version = dev.protocolVersion ();
+	}
+	catch (...) {
+		result.error = std::current_exception ();
+	}
+	return result;
+}
+
+static std::vector<ProbeResult> probeNode (const std::string &path)
+{
+	std::unique_ptr<DispatcherThread> dispatcher;
+	try {
+		dispatcher = std::make_unique<DispatcherThread> (path.c_str ());
+	}
+	catch (...) {
+		ProbeResult result;
+		result.path = path;
+		result.index = DefaultDevice;
+		result.error = std::current_exception ();
+		return { result };
+	}
+	std::thread thread ([&dispatcher] () { dispatcher->run (); });
+	Dispatcher *d = dispatcher.get ();
+	std::unique_ptr<HIDPP10::ReceiverState> receiver_state;
+	auto probe = [d, &path, &receiver_state] (DeviceIndex index) {
+		return std::async (std::launch::async, probeIndex, d, path, index,
+				   receiver_state.get ());
+	};
+	std::vector<std::future<ProbeResult>> probes;
+	probes.push_back (probe (DefaultDevice));
+	probes.push_back (probe (CordedDevice));
+	ProbeResult receiver = probes.front ().get ();
+	std::vector<ProbeResult> results = { receiver };
+	probes.erase (probes.begin ());
+	if (!receiver.error && receiver.version == std::make_tuple (1u, 0u)) {
+		try {
+			receiver_state = std::make_unique<HIDPP10::ReceiverState> (d);
+		}
+		catch (...) {
+			// Probe every index without knowing which are paired.
+		}
+		for (auto index: { WirelessDevice1, WirelessDevice2, WirelessDevice3,
+				   WirelessDevice4, WirelessDevice5, WirelessDevice6 })
+			probes.push_back (probe (index));
+	}
+	for (auto &f: probes)
+		results.push_back (f.get ());
+	receiver_state.reset ();
+	dispatcher->stop ();
+	thread.join ();
+	return results;
+}
+
+std::vector<ProbeResult> HIDPP::probeDevices (const std::vector<std::string> &paths)
+{
+	std::vector<std::future<std::vector<ProbeResult>>> nodes;
+	for (const auto &path: paths)
+		nodes.push_back (std::async (std::launch::async, probeNode, path));
+	std::vector<ProbeResult> results;
+	for (auto &node: nodes) {
+		auto node_results = node.get ();
+		results.insert (results.end (), node_results.begin (), node_results.end ());
+	}
+	return results;
+}
+
+HID::DeviceMonitor::Filter HIDPP::deviceFilter (std::shared_ptr<HID::InterfaceRoleCache> interface_cache)
+{
+	HID::DeviceMonitor::Filter filter;
+	filter.interface_cache = std::move (interface_cache);
+	filter.vendor_ids = { 0x046d };
+	filter.descriptor_check = [] (const uint8_t *descriptor, std::size_t length) {
+		return Dispatcher::reportFlags (descriptor, length) != 0;
+	};
+	return filter;
+}
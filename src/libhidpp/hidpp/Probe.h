@@ -0,0 +1,85 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_PROBE_H
+#define LIBHIDPP_HIDPP_PROBE_H
+
+#include <hid/DeviceMonitor.h>
+#include <hidpp/defs.h>
+#include <hidpp/Device.h>
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace HIDPP
+{
+	struct ProbeResult
+	{
+		std::string path;
+		DeviceIndex index;
+		/**
+		 * Why the device could not be probed: opening errors (e.g.
+		 * Dispatcher::NoHIDPPReportException, reported with
+		 * DefaultDevice), HID++ errors for absent devices, or
+		 * Dispatcher::TimeoutError. Null on success.
+		 */
+		std::exception_ptr error;
+		uint16_t vendor_id = 0, product_id = 0;
+		std::string name;
+		std::tuple<unsigned int, unsigned int> version;
+
+		/**
+		 * For constructing the probed device without round trips.
+		 */
+		Device::Identity identity () const
+		{
+			return { product_id, name, version };
+		}
+	};
+
+	/**
+	 * Ping every device index of the HID++ nodes at \p paths.
+	 *
+	 * Nodes are probed concurrently, each with its own DispatcherThread.
+	 * On each node, the default and corded indices are probed together,
+	 * then the wireless indices are all probed together if the default
+	 * index is a HID++ 1.0 receiver. A full scan takes about two
+	 * timeouts of the slowest sleeping device instead of their sum.
+	 * Indices the receiver reports unpaired or disconnected (see
+	 * HIDPP10::ReceiverState) fail without waiting.
+	 *
+	 * \returns one result per probed index, in \p paths and index order.
+	 */
+	std::vector<ProbeResult> probeDevices (const std::vector<std::string> &paths);
+
+	/**
+	 * Device monitor filter for Logitech nodes whose report descriptor
+	 * has HID++ reports, so that other nodes are never opened.
+	 *
+	 * With \p interface_cache, the HID++ interfaces of known models are
+	 * recognized without reading their descriptor (see
+	 * HID::DeviceMonitor::Filter::interface_cache).
+	 */
+	HID::DeviceMonitor::Filter deviceFilter (std::shared_ptr<HID::InterfaceRoleCache> interface_cache = nullptr);
+}
+
+#endif
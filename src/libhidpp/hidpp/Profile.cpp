@@ -18,42 +18,50 @@
 
 #include "Profile.h"
 
+#include <type_traits>
+
 using namespace HIDPP;
 
-Profile::Button::Button ():
-	_type (Type::Disabled)
+static_assert (sizeof (Profile::Button) == 8 && std::is_trivially_copyable_v<Profile::Button>);
+static_assert (std::is_trivially_copyable_v<Profile::ButtonArray>);
+static_assert (sizeof (Profile::ButtonArray) == Profile::MaxButtonCount*sizeof (Profile::Button) + sizeof (uint32_t));
+
+Profile::Button::Button ()
 {
+	set (Type::Disabled, 0, 0, 0);
 }
 
-Profile::Button::Button (MouseButtonsType, unsigned int buttons):
-	_type (Type::MouseButtons)
+Profile::Button::Button (MouseButtonsType, unsigned int buttons)
 {
-	_params.buttons = buttons;
+	set (Type::MouseButtons, 0, 0, buttons);
 }
 
-Profile::Button::Button (uint8_t modifiers, uint8_t key):
-	_type (Type::Key)
+Profile::Button::Button (uint8_t modifiers, uint8_t key)
 {
-	_params.key.mod = modifiers;
-	_params.key.key = key;
+	set (Type::Key, modifiers, 0, key);
 }
 
-Profile::Button::Button (ConsumerControlType, unsigned int code):
-	_type (Type::ConsumerControl)
+Profile::Button::Button (ConsumerControlType, unsigned int code)
 {
-	_params.code = code;
+	set (Type::ConsumerControl, 0, 0, code);
 }
 
-Profile::Button::Button (SpecialType, unsigned int code):
-	_type (Type::Special)
+Profile::Button::Button (SpecialType, unsigned int code)
 {
-	_params.code = code;
+	set (Type::Special, 0, 0, code);
 }
 
-Profile::Button::Button (Address address):
-	_type (Type::Macro)
+Profile::Button::Button (Address address)
 {
-	_params.address = address;
+	setMacro (address);
+}
+
+void Profile::Button::set (Type type, uint8_t byte, uint16_t page, uint32_t value) noexcept
+{
+	_type = type;
+	_byte = byte;
+	_page = page;
+	_value = value;
 }
 
 Profile::Button::Type Profile::Button::type () const
@@ -63,67 +71,71 @@ Profile::Button::Type Profile::Button::type () const
 
 void Profile::Button::disable ()
 {
-	_type = Type::Disabled;
+	set (Type::Disabled, 0, 0, 0);
 }
 
 unsigned int Profile::Button::mouseButtons () const
 {
-	return _params.buttons;
+	return _value;
 }
 
 void Profile::Button::setMouseButtons (unsigned int buttons)
 {
-	_type = Type::MouseButtons;
-	_params.buttons = buttons;
+	set (Type::MouseButtons, 0, 0, buttons);
 }
 
 uint8_t Profile::Button::modifierKeys () const
 {
-	return _params.key.mod;
+	return _byte;
 }
 
 uint8_t Profile::Button::key () const
 {
-	return _params.key.key;
+	return _value;
 }
 
 void Profile::Button::setKey (uint8_t modifiers, uint8_t key)
 {
-	_type = Type::Key;
-	_params.key.mod = modifiers;
-	_params.key.key = key;
+	set (Type::Key, modifiers, 0, key);
 }
 
 unsigned int Profile::Button::consumerControl () const
 {
-	return _params.code;
+	return _value;
 }
 
 void Profile::Button::setConsumerControl (unsigned int code)
 {
-	_type = Type::ConsumerControl;
-	_params.code = code;
+	set (Type::ConsumerControl, 0, 0, code);
 }
 
 unsigned int Profile::Button::special () const
 {
-	return _params.code;
+	return _value;
 }
 
 void Profile::Button::setSpecial (unsigned int code)
 {
-	_type = Type::Special;
-	_params.code = code;
+	set (Type::Special, 0, 0, code);
 }
 
 Address Profile::Button::macro () const
 {
-	return _params.address;
+	return Address { _byte, _page, _value };
 }
 
 void Profile::Button::setMacro (Address address)
 {
-	_type = Type::Macro;
-	_params.address = address;
+	if (address.mem_type < 0 || address.mem_type > 0xff || address.page > 0xffff)
+		throw std::out_of_range ("Macro address does not fit in a button");
+	set (Type::Macro, address.mem_type, address.page, address.offset);
 }
 
+std::size_t Profile::ButtonArray::hash () const noexcept
+{
+	auto bytes = reinterpret_cast<const uint8_t *> (this);
+	uint64_t h = 0xcbf29ce484222325;
+	for (std::size_t i = 0; i < sizeof (ButtonArray); ++i)
+		h = (h ^ bytes[i]) * 0x100000001b3;
+	return h;
+}
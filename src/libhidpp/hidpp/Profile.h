@@ -20,17 +20,29 @@
 #define LIBHIDPP_HIDPP_PROFILE_H
 
 #include <hidpp/Address.h>
-#include <hidpp/Setting.h>
+#include <hidpp/SettingMap.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
 
 namespace HIDPP
 {
 
 struct Profile
 {
+	/**
+	 * Button binding packed in 8 bytes.
+	 *
+	 * Buttons are trivially copyable and unused fields are always zero,
+	 * so that equal buttons have the same bytes.
+	 */
 	class Button
 	{
 	public:
-		enum class Type {
+		enum class Type: uint8_t {
 			Disabled,
 			MouseButtons,
 			Key,
@@ -48,6 +60,10 @@ struct Profile
 		Button (uint8_t modifiers, uint8_t key);
 		Button (ConsumerControlType, unsigned int code);
 		Button (SpecialType, unsigned int code);
+		/**
+		 * \throws std::out_of_range if the memory type is not a byte
+		 * or the page does not fit 16 bits.
+		 */
 		Button (Address address);
 
 		Type type () const;
@@ -68,24 +84,133 @@ struct Profile
 		void setSpecial (unsigned int code);
 
 		Address macro () const;
+		/**
+		 * \throws std::out_of_range if the memory type is not a byte
+		 * or the page does not fit 16 bits.
+		 */
 		void setMacro (Address address);
 
+		bool operator== (const Button &other) const noexcept
+		{
+			return std::memcmp (this, &other, sizeof (Button)) == 0;
+		}
+		bool operator!= (const Button &other) const noexcept
+		{
+			return !(*this == other);
+		}
+
 	private:
+		void set (Type type, uint8_t byte, uint16_t page, uint32_t value) noexcept;
+
 		Type _type;
-		union {
-			unsigned int buttons;
-			struct {
-				uint8_t mod;
-				uint8_t key;
-			} key;
-			unsigned int code;
-			Address address;
-		} _params;
+		uint8_t _byte; // key modifiers or macro memory type
+		uint16_t _page; // macro page
+		uint32_t _value; // mouse buttons, key, code or macro offset
+	};
+
+	/**
+	 * Largest button count of the profile formats, including G-shift
+	 * buttons (see AbstractProfileFormat::maxButtonCount).
+	 */
+	static constexpr std::size_t MaxButtonCount = 32;
+
+	/**
+	 * Buttons stored inline with a fixed capacity, with the subset of
+	 * the std::vector interface used for profiles.
+	 *
+	 * Elements past the size are disabled buttons, so that arrays
+	 * compare and hash as a single block of bytes.
+	 */
+	class ButtonArray
+	{
+	public:
+		typedef Button value_type;
+		typedef Button *iterator;
+		typedef const Button *const_iterator;
+
+		ButtonArray () noexcept: _size (0) { }
+		/**
+		 * \throws std::length_error if \p count exceeds the capacity.
+		 */
+		explicit ButtonArray (std::size_t count): _size (0) { resize (count); }
+
+		static constexpr std::size_t capacity () noexcept { return MaxButtonCount; }
+		std::size_t size () const noexcept { return _size; }
+		bool empty () const noexcept { return _size == 0; }
+
+		iterator begin () noexcept { return _buttons.data (); }
+		iterator end () noexcept { return _buttons.data () + _size; }
+		const_iterator begin () const noexcept { return _buttons.data (); }
+		const_iterator end () const noexcept { return _buttons.data () + _size; }
+
+		Button &operator[] (std::size_t i) noexcept { return _buttons[i]; }
+		const Button &operator[] (std::size_t i) const noexcept { return _buttons[i]; }
+		Button &at (std::size_t i) { checkIndex (i); return _buttons[i]; }
+		const Button &at (std::size_t i) const { checkIndex (i); return _buttons[i]; }
+		Button &front () noexcept { return _buttons[0]; }
+		const Button &front () const noexcept { return _buttons[0]; }
+		Button &back () noexcept { return _buttons[_size-1]; }
+		const Button &back () const noexcept { return _buttons[_size-1]; }
+
+		void clear () noexcept { resize (0); }
+		/**
+		 * \throws std::length_error if \p count exceeds the capacity.
+		 */
+		void resize (std::size_t count)
+		{
+			checkLength (count);
+			for (std::size_t i = count; i < _size; ++i)
+				_buttons[i] = Button ();
+			_size = count;
+		}
+		/**
+		 * \throws std::length_error if the array is full.
+		 */
+		void push_back (const Button &button)
+		{
+			checkLength (_size+1);
+			_buttons[_size++] = button;
+		}
+		template<typename... Args>
+		Button &emplace_back (Args &&... args)
+		{
+			push_back (Button (std::forward<Args> (args)...));
+			return back ();
+		}
+		void pop_back () noexcept { _buttons[--_size] = Button (); }
+
+		bool operator== (const ButtonArray &other) const noexcept
+		{
+			return std::memcmp (this, &other, sizeof (ButtonArray)) == 0;
+		}
+		bool operator!= (const ButtonArray &other) const noexcept
+		{
+			return !(*this == other);
+		}
+		/**
+		 * FNV-1a hash of the buttons.
+		 */
+		std::size_t hash () const noexcept;
+
+	private:
+		void checkIndex (std::size_t i) const
+		{
+			if (i >= _size)
+				throw std::out_of_range ("Button index out of range");
+		}
+		static void checkLength (std::size_t count)
+		{
+			if (count > MaxButtonCount)
+				throw std::length_error ("Too many buttons");
+		}
+
+		std::array<Button, MaxButtonCount> _buttons;
+		uint32_t _size; // no padding
 	};
 
-	std::map<std::string, Setting> settings;
-	std::vector<Button> buttons;
-	std::vector<std::map<std::string, Setting>> modes;
+	SettingMap settings;
+	ButtonArray buttons;
+	std::vector<SettingMap> modes;
 };
 
 }
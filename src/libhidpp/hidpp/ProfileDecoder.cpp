@@ -0,0 +1,209 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileDecoder.h"
+
+#include <algorithm>
+
+using namespace HIDPP;
+
+ProfileDecoder::ProfileDecoder (const AbstractProfileDirectoryFormat &profdir_format,
+				const AbstractProfileFormat &profile_format,
+				const AbstractMacroFormat &macro_format,
+				unsigned int threads):
+	_profdir_format (profdir_format),
+	_profile_format (profile_format),
+	_macro_format (macro_format),
+	_job (nullptr),
+	_generation (0),
+	_stopping (false)
+{
+	if (threads == 0)
+		threads = std::max (1u, std::thread::hardware_concurrency ());
+	for (unsigned int i = 1; i < threads; ++i)
+		_workers.emplace_back (&ProfileDecoder::work, this);
+}
+
+ProfileDecoder::~ProfileDecoder ()
+{
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_stopping = true;
+		_cond.notify_all ();
+	}
+	for (auto &worker: _workers)
+		worker.join ();
+}
+
+void ProfileDecoder::run (Job &job)
+{
+	std::size_t i;
+	while ((i = job.next++) < job.count) {
+		try {
+			(*job.f) (i);
+		}
+		catch (...) {
+			job.errors[i] = std::current_exception ();
+		}
+	}
+}
+
+void ProfileDecoder::work ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	uint64_t generation = 0;
+	while (true) {
+		_cond.wait (lock, [this, generation] () {
+			return _stopping || _generation != generation;
+		});
+		if (_stopping)
+			return;
+		generation = _generation;
+		Job *job = _job;
+		if (!job)
+			continue; // already finished by the others
+		++job->active;
+		lock.unlock ();
+		run (*job);
+		lock.lock ();
+		if (--job->active == 0)
+			_cond.notify_all ();
+	}
+}
+
+void ProfileDecoder::parallel (std::size_t count, const std::function<void (std::size_t)> &f)
+{
+	// Errors are kept by index so that the same one is thrown whatever
+	// the order the workers finished in.
+	Job job;
+	job.count = count;
+	job.f = &f;
+	job.next = 0;
+	job.active = 0;
+	job.errors.resize (count);
+	if (count > 1 && !_workers.empty ()) {
+		std::unique_lock<std::mutex> lock (_mutex);
+		_job = &job;
+		++_generation;
+		_cond.notify_all ();
+	}
+	run (job);
+	if (count > 1 && !_workers.empty ()) {
+		std::unique_lock<std::mutex> lock (_mutex);
+		// Workers that did not take the job yet will not after this
+		_cond.wait (lock, [&job] () { return job.active == 0; });
+		_job = nullptr;
+	}
+	for (const auto &error: job.errors)
+		if (error)
+			std::rethrow_exception (error);
+}
+
+ProfileDiff::ProfileSet ProfileDecoder::decode (AbstractMemoryMapping &mem,
+						const Address &dir_address,
+						MacroCache *cache)
+{
+	std::unique_lock<std::mutex> decode_lock (_decode_mutex);
+	ProfileDiff::ProfileSet set;
+	set.directory = _profdir_format.read (mem.getReadOnlyIterator (dir_address));
+
+	std::vector<Address> profile_addresses;
+	for (const auto &entry: set.directory.entries)
+		profile_addresses.push_back (entry.profile_address);
+	mem.prefetch (profile_addresses);
+	set.profiles.resize (profile_addresses.size ());
+	parallel (profile_addresses.size (), [&] (std::size_t i) {
+		auto it = mem.getReadOnlyRange (profile_addresses[i], _profile_format.size ());
+		set.profiles[i] = _profile_format.read (it);
+	});
+
+	// Each macro start address once, in order of first use
+	std::map<Address, std::size_t> macro_indices;
+	std::vector<Address> macro_addresses;
+	for (const auto &profile: set.profiles)
+		collectMacros (profile, macro_indices, macro_addresses);
+	auto macros = decodeMacros (mem, macro_addresses, cache);
+
+	for (const auto &profile: set.profiles)
+		set.macros.push_back (buttonMacros (profile, macro_indices, macros));
+	return set;
+}
+
+ProfileDirectory ProfileDecoder::decode (AbstractMemoryMapping &mem,
+					 const Address &dir_address,
+					 const profile_handler &handler,
+					 MacroCache *cache)
+{
+	std::unique_lock<std::mutex> decode_lock (_decode_mutex);
+	auto directory = _profdir_format.read (mem.getReadOnlyIterator (dir_address));
+
+	std::vector<Address> profile_addresses;
+	for (const auto &entry: directory.entries)
+		profile_addresses.push_back (entry.profile_address);
+	mem.prefetch (profile_addresses);
+	for (std::size_t i = 0; i < profile_addresses.size (); ++i) {
+		auto it = mem.getReadOnlyRange (profile_addresses[i], _profile_format.size ());
+		auto profile = _profile_format.read (it);
+		std::map<Address, std::size_t> macro_indices;
+		std::vector<Address> macro_addresses;
+		collectMacros (profile, macro_indices, macro_addresses);
+		auto macros = buttonMacros (profile, macro_indices,
+					    decodeMacros (mem, macro_addresses, cache));
+		handler (i, directory.entries[i], profile, macros);
+	}
+	return directory;
+}
+
+void ProfileDecoder::collectMacros (const Profile &profile,
+				    std::map<Address, std::size_t> &indices,
+				    std::vector<Address> &addresses)
+{
+	for (const auto &button: profile.buttons)
+		if (button.type () == Profile::Button::Type::Macro &&
+				indices.emplace (button.macro (), addresses.size ()).second)
+			addresses.push_back (button.macro ());
+}
+
+std::vector<std::shared_ptr<const Macro>> ProfileDecoder::decodeMacros (AbstractMemoryMapping &mem,
+									const std::vector<Address> &addresses,
+									MacroCache *cache)
+{
+	mem.prefetch (addresses);
+	std::vector<std::shared_ptr<const Macro>> macros (addresses.size ());
+	parallel (addresses.size (), [&] (std::size_t i) {
+		if (cache)
+			macros[i] = cache->get (addresses[i]);
+		else
+			macros[i] = std::make_shared<const Macro> (_macro_format, mem, addresses[i]);
+	});
+	return macros;
+}
+
+std::vector<Macro> ProfileDecoder::buttonMacros (const Profile &profile,
+						 const std::map<Address, std::size_t> &indices,
+						 const std::vector<std::shared_ptr<const Macro>> &macros)
+{
+	std::vector<Macro> button_macros;
+	for (const auto &button: profile.buttons) {
+		if (button.type () == Profile::Button::Type::Macro)
+			button_macros.emplace_back (*macros[indices.at (button.macro ())]);
+		else
+			button_macros.emplace_back ();
+	}
+	return button_macros;
+}
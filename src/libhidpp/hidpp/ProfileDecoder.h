@@ -0,0 +1,170 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_PROFILE_DECODER_H
+#define LIBHIDPP_HIDPP_PROFILE_DECODER_H
+
+#include <hidpp/AbstractMacroFormat.h>
+#include <hidpp/AbstractMemoryMapping.h>
+#include <hidpp/AbstractProfileDirectoryFormat.h>
+#include <hidpp/AbstractProfileFormat.h>
+#include <hidpp/MacroCache.h>
+#include <hidpp/ProfileDiff.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * Decode every profile and macro of a memory mapping (a device, an
+ * image or a snapshot loaded in a mapping) on a pool of threads.
+ *
+ * The profile pages are fetched in one batch then decoded in parallel,
+ * followed by the macros they use (each start address is parsed once).
+ * Results are stored by index, so the decoded set does not depend on
+ * the scheduling of the workers. The workers are kept between calls to
+ * \ref decode, use the same decoder for many images.
+ *
+ * Workers only read the mapping (see AbstractMemoryMapping for reading
+ * from several threads). Its pages must not be modified during
+ * decoding, and its writeLock must not be taken: that is when pages over
+ * a budget are evicted (see AbstractMemoryMapping::setPageBudget).
+ */
+class ProfileDecoder
+{
+public:
+	/**
+	 * The formats must outlive the decoder.
+	 *
+	 * \param threads	Number of threads decoding (including the one
+	 *			calling \ref decode), 0 for the hardware
+	 *			concurrency.
+	 */
+	ProfileDecoder (const AbstractProfileDirectoryFormat &profdir_format,
+			const AbstractProfileFormat &profile_format,
+			const AbstractMacroFormat &macro_format,
+			unsigned int threads = 0);
+	~ProfileDecoder ();
+
+	ProfileDecoder (const ProfileDecoder &) = delete;
+	ProfileDecoder &operator= (const ProfileDecoder &) = delete;
+
+	/**
+	 * Decode the profile directory at \p dir_address, the profiles it
+	 * lists and their macros (not simplified).
+	 *
+	 * Calls from several threads are decoded one after the other.
+	 *
+	 * \param cache	If not null, macros are got from \p cache (it
+	 *		must use the same format and mapping).
+	 *
+	 * \throws the error of the first profile, or then of the first
+	 * macro, that could not be decoded (in directory order).
+	 */
+	ProfileDiff::ProfileSet decode (AbstractMemoryMapping &mem,
+					const Address &dir_address,
+					MacroCache *cache = nullptr);
+
+	/**
+	 * Called with each decoded profile, its directory entry and the
+	 * macros of its buttons (empty for buttons without macro). The
+	 * profile and macros may be moved from.
+	 */
+	typedef std::function<void (std::size_t index,
+				    const ProfileDirectory::Entry &entry,
+				    Profile &profile,
+				    std::vector<Macro> &macros)> profile_handler;
+	/**
+	 * Same as above, but profiles are passed to \p handler one at a
+	 * time, in directory order, instead of being kept.
+	 *
+	 * The profile pages are prefetched together, then the macro pages
+	 * of each profile are prefetched and decoded just before it is
+	 * passed to \p handler. Only one profile and its macros are held
+	 * at a time.
+	 *
+	 * \returns the profile directory.
+	 *
+	 * \throws the error of the first profile, or of its first macro,
+	 * that could not be decoded, after the profiles before it were
+	 * passed to \p handler.
+	 */
+	ProfileDirectory decode (AbstractMemoryMapping &mem,
+				 const Address &dir_address,
+				 const profile_handler &handler,
+				 MacroCache *cache = nullptr);
+
+private:
+	/**
+	 * Add the macro start addresses of \p profile missing from
+	 * \p indices, in order of first use.
+	 */
+	static void collectMacros (const Profile &profile,
+				   std::map<Address, std::size_t> &indices,
+				   std::vector<Address> &addresses);
+	/**
+	 * Prefetch and decode the macros at \p addresses in parallel.
+	 */
+	std::vector<std::shared_ptr<const Macro>> decodeMacros (AbstractMemoryMapping &mem,
+								const std::vector<Address> &addresses,
+								MacroCache *cache);
+	/**
+	 * Macros of each button of \p profile.
+	 */
+	static std::vector<Macro> buttonMacros (const Profile &profile,
+						const std::map<Address, std::size_t> &indices,
+						const std::vector<std::shared_ptr<const Macro>> &macros);
+
+	struct Job
+	{
+		std::size_t count;
+		const std::function<void (std::size_t)> *f;
+		std::atomic<std::size_t> next;
+		unsigned int active; // workers running the job
+		std::vector<std::exception_ptr> errors;
+	};
+	// Call f (i) for i from 0 to count-1 on the workers and the
+	// calling thread
+	void parallel (std::size_t count, const std::function<void (std::size_t)> &f);
+	static void run (Job &job);
+	void work ();
+
+	const AbstractProfileDirectoryFormat &_profdir_format;
+	const AbstractProfileFormat &_profile_format;
+	const AbstractMacroFormat &_macro_format;
+	std::mutex _decode_mutex; // one decode at a time
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	Job *_job; // null when there is no job to join
+	uint64_t _generation;
+	bool _stopping;
+	std::vector<std::thread> _workers;
+};
+
+}
+
+#endif
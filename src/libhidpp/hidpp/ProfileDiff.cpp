@@ -0,0 +1,173 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileDiff.h"
+
+#include <hidpp/AbstractProfileFormat.h>
+#include <hidpp/AbstractProfileDirectoryFormat.h>
+#include <hidpp/AbstractMacroFormat.h>
+#include <hidpp/MacroAllocator.h>
+#include <misc/Log.h>
+
+#include <algorithm>
+
+using namespace HIDPP;
+
+static bool sameAddress (const Address &a, const Address &b)
+{
+	return !(a < b) && !(b < a);
+}
+
+static bool isMacro (const Profile::Button &button)
+{
+	return button.type () == Profile::Button::Type::Macro;
+}
+
+static std::vector<uint8_t> encodeItem (const AbstractMacroFormat &format, const Macro::Item &item)
+{
+	std::vector<uint8_t> data (format.getLength (item));
+	std::vector<uint8_t>::iterator unused;
+	format.writeItem (data.begin (), item, unused);
+	return data;
+}
+
+static bool sameMacro (const AbstractMacroFormat &format, const Macro &a, const Macro &b)
+{
+	Macro simple_a (a), simple_b (b);
+	simple_a.simplify ();
+	simple_b.simplify ();
+	if (std::distance (simple_a.begin (), simple_a.end ()) != std::distance (simple_b.begin (), simple_b.end ()))
+		return false;
+	for (auto it_a = simple_a.begin (), it_b = simple_b.begin (); it_a != simple_a.end (); ++it_a, ++it_b) {
+		if (it_a->instruction () != it_b->instruction ())
+			return false;
+		if (it_a->isJump ()) {
+			// Jump parameters are their offset and delay
+			if (it_a->jumpOffset () != it_b->jumpOffset ())
+				return false;
+			if (it_a->instruction () == Macro::Item::JumpIfReleased &&
+			    it_a->delay () != it_b->delay ())
+				return false;
+		}
+		else if (encodeItem (format, *it_a) != encodeItem (format, *it_b))
+			return false;
+	}
+	return true;
+}
+
+ProfileDiff::ProfileDiff (const AbstractProfileFormat &profile_format,
+			  const AbstractProfileDirectoryFormat &profdir_format,
+			  const AbstractMacroFormat &macro_format):
+	_profile_format (profile_format),
+	_profdir_format (profdir_format),
+	_macro_format (macro_format)
+{
+}
+
+bool ProfileDiff::macrosChanged (const ProfileSet &from, const ProfileSet &to) const
+{
+	if (from.profiles.size () != to.profiles.size ())
+		return true;
+	for (std::size_t i = 0; i < to.profiles.size (); ++i) {
+		const auto &from_buttons = from.profiles[i].buttons;
+		const auto &to_buttons = to.profiles[i].buttons;
+		if (from_buttons.size () != to_buttons.size ())
+			return true;
+		for (std::size_t j = 0; j < to_buttons.size (); ++j) {
+			if (isMacro (from_buttons[j]) != isMacro (to_buttons[j]))
+				return true;
+			if (isMacro (to_buttons[j]) &&
+			    !sameMacro (_macro_format, from.macros.at (i).at (j), to.macros.at (i).at (j)))
+				return true;
+		}
+	}
+	return false;
+}
+
+bool ProfileDiff::profileChanged (const ProfileSet &from, const ProfileSet &to, std::size_t index) const
+{
+	if (index >= from.profiles.size ())
+		return true;
+	if (!sameAddress (from.directory.entries.at (index).profile_address,
+			  to.directory.entries.at (index).profile_address))
+		return true;
+	std::vector<uint8_t> from_data (_profile_format.size ()), to_data (_profile_format.size ());
+	_profile_format.write (from.profiles[index], from_data.begin ());
+	_profile_format.write (to.profiles[index], to_data.begin ());
+	return from_data != to_data;
+}
+
+std::vector<AbstractMemoryMapping::PlannedWrite> ProfileDiff::apply (AbstractMemoryMapping &mem,
+								     const Address &dir_address,
+								     const ProfileSet &from,
+								     ProfileSet &to,
+								     MacroAllocator &allocator) const
+{
+	auto debug = Log::debug ("profile");
+	if (!macrosChanged (from, to)) {
+		debug << "Macros are unchanged" << std::endl;
+		for (std::size_t i = 0; i < to.profiles.size (); ++i) {
+			auto &buttons = to.profiles[i].buttons;
+			for (std::size_t j = 0; j < buttons.size (); ++j)
+				if (isMacro (buttons[j]))
+					buttons[j].setMacro (from.profiles[i].buttons[j].macro ());
+		}
+	}
+	else {
+		std::vector<const Macro *> macros;
+		for (std::size_t i = 0; i < to.profiles.size (); ++i)
+			for (std::size_t j = 0; j < to.profiles[i].buttons.size (); ++j)
+				if (isMacro (to.profiles[i].buttons[j]))
+					macros.push_back (&to.macros.at (i).at (j));
+		auto addresses = allocator.allocate (macros);
+		auto address = addresses.begin ();
+		for (std::size_t i = 0; i < to.profiles.size (); ++i) {
+			for (std::size_t j = 0; j < to.profiles[i].buttons.size (); ++j) {
+				auto &button = to.profiles[i].buttons[j];
+				if (isMacro (button)) {
+					Address start = *address++;
+					to.macros[i][j].write (_macro_format, mem, start);
+					button.setMacro (start);
+				}
+			}
+		}
+	}
+
+	for (std::size_t i = 0; i < to.profiles.size (); ++i) {
+		if (!profileChanged (from, to, i))
+			continue;
+		debug << "Profile " << i << " changed" << std::endl;
+		auto it = mem.getWritableIterator (to.directory.entries.at (i).profile_address);
+		_profile_format.write (to.profiles[i], it);
+	}
+
+	{
+		std::vector<uint8_t> from_data = mem.getReadOnlyPage (dir_address);
+		std::vector<uint8_t> to_data = from_data;
+		auto offset = mem.getReadOnlyIterator (dir_address) - mem.getReadOnlyPage (dir_address).begin ();
+		_profdir_format.write (from.directory, from_data.begin () + offset);
+		_profdir_format.write (to.directory, to_data.begin () + offset);
+		if (from_data != to_data) {
+			debug << "Profile directory changed" << std::endl;
+			auto it = mem.getWritableIterator (dir_address);
+			_profdir_format.write (to.directory, it);
+		}
+	}
+
+	return mem.pendingWrites ();
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_PROFILE_DIFF_H
+#define LIBHIDPP_HIDPP_PROFILE_DIFF_H
+
+#include <hidpp/AbstractMemoryMapping.h>
+#include <hidpp/Macro.h>
+#include <hidpp/Profile.h>
+#include <hidpp/ProfileDirectory.h>
+
+#include <vector>
+
+namespace HIDPP
+{
+
+class AbstractProfileFormat;
+class AbstractProfileDirectoryFormat;
+class AbstractMacroFormat;
+class MacroAllocator;
+
+/**
+ * Update the profiles in memory from one set of profiles to another,
+ * writing only what changed.
+ *
+ * Profiles and directories are compared as encoded by their formats,
+ * so differences that are not stored are ignored. Macros are compared
+ * after Macro::simplify, ignoring the jumps and padding added when
+ * they were written.
+ */
+class ProfileDiff
+{
+public:
+	/**
+	 * Profiles with their directory entries, and the macro of each
+	 * button (empty for non-macro buttons).
+	 */
+	struct ProfileSet
+	{
+		ProfileDirectory directory;
+		std::vector<Profile> profiles;
+		std::vector<std::vector<Macro>> macros;
+	};
+
+	ProfileDiff (const AbstractProfileFormat &profile_format,
+		     const AbstractProfileDirectoryFormat &profdir_format,
+		     const AbstractMacroFormat &macro_format);
+
+	/**
+	 * Check if any macro differs between \p from and \p to.
+	 */
+	bool macrosChanged (const ProfileSet &from, const ProfileSet &to) const;
+
+	/**
+	 * Check if profile \p index of \p to, with its macro addresses,
+	 * is stored differently than in \p from.
+	 */
+	bool profileChanged (const ProfileSet &from, const ProfileSet &to, std::size_t index) const;
+
+	/**
+	 * Write in \p mem what changes from \p from (the current memory
+	 * content) to \p to, and return the minimal write plan (see
+	 * AbstractMemoryMapping::pendingWrites) that sync will follow.
+	 *
+	 * If no macro changed, macros keep their addresses from \p from
+	 * and their pages are not touched, otherwise they are all placed
+	 * again by \p allocator and written. Macro buttons of \p to are
+	 * updated with the addresses used. Only the profiles and directory
+	 * that changed are then written, other pages are not even read.
+	 *
+	 * The caller must hold the write lock of \p mem.
+	 */
+	std::vector<AbstractMemoryMapping::PlannedWrite> apply (AbstractMemoryMapping &mem,
+								const Address &dir_address,
+								const ProfileSet &from,
+								ProfileSet &to,
+								MacroAllocator &allocator) const;
+
+private:
+	const AbstractProfileFormat &_profile_format;
+	const AbstractProfileDirectoryFormat &_profdir_format;
+	const AbstractMacroFormat &_macro_format;
+};
+
+}
+
+#endif
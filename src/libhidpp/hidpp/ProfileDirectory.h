@@ -20,7 +20,7 @@
 #define LIBHIDPP_HIDPP_PROFILE_DIRECTORY_H
 
 #include <hidpp/Address.h>
-#include <hidpp/Setting.h>
+#include <hidpp/SettingMap.h>
 
 namespace HIDPP
 {
@@ -30,7 +30,7 @@ struct ProfileDirectory
 	struct Entry
 	{
 		Address profile_address;
-		std::map<std::string, Setting> settings;
+		SettingMap settings;
 	};
 
 	std::vector<Entry> entries;
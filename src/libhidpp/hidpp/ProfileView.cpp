@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileView.h"
+
+#include <hidpp/AbstractProfileFormat.h>
+#include <stdexcept>
+
+using namespace HIDPP;
+
+ProfileView::ProfileView (const AbstractProfileFormat &format, std::vector<uint8_t>::const_iterator begin):
+	_format (format),
+	_begin (begin),
+	_mutable_begin (),
+	_writable (false)
+{
+}
+
+ProfileView::ProfileView (const AbstractProfileFormat &format, std::vector<uint8_t>::iterator begin):
+	_format (format),
+	_begin (begin),
+	_mutable_begin (begin),
+	_writable (true)
+{
+}
+
+const AbstractProfileFormat &ProfileView::format () const
+{
+	return _format;
+}
+
+bool ProfileView::writable () const
+{
+	return _writable;
+}
+
+unsigned int ProfileView::modeCount () const
+{
+	return _format.readModeCount (_begin);
+}
+
+SettingMap ProfileView::mode (unsigned int index) const
+{
+	return _format.readMode (_begin, index);
+}
+
+unsigned int ProfileView::buttonCount () const
+{
+	return _format.readButtonCount (_begin);
+}
+
+Profile::Button ProfileView::button (unsigned int index) const
+{
+	return _format.readButton (_begin, index);
+}
+
+Setting ProfileView::setting (const std::string &name) const
+{
+	return _format.readSetting (_begin, name);
+}
+
+void ProfileView::setMode (unsigned int index, const SettingMap &mode)
+{
+	_format.writeMode (mutableBegin (), index, mode);
+}
+
+void ProfileView::setButton (unsigned int index, const Profile::Button &button)
+{
+	_format.writeButton (mutableBegin (), index, button);
+}
+
+void ProfileView::setSetting (const std::string &name, const Setting &value)
+{
+	_format.writeSetting (mutableBegin (), name, value);
+}
+
+std::vector<uint8_t>::iterator ProfileView::mutableBegin () const
+{
+	if (!_writable)
+		throw std::logic_error ("read-only profile view");
+	return _mutable_begin;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_PROFILE_VIEW_H
+#define LIBHIDPP_HIDPP_PROFILE_VIEW_H
+
+#include <hidpp/Profile.h>
+#include <vector>
+#include <cstdint>
+
+namespace HIDPP
+{
+
+class AbstractProfileFormat;
+
+/**
+ * Access a profile in place in its page bytes.
+ *
+ * Unlike AbstractProfileFormat::read, nothing is decoded until it is
+ * asked for, and setters only encode the fields they change. Useful
+ * when a single setting is needed from many profiles.
+ *
+ * The view does not own the bytes, they must outlive it.
+ */
+class ProfileView
+{
+public:
+	/**
+	 * Read-only view, setters throw std::logic_error.
+	 */
+	ProfileView (const AbstractProfileFormat &format, std::vector<uint8_t>::const_iterator begin);
+	ProfileView (const AbstractProfileFormat &format, std::vector<uint8_t>::iterator begin);
+
+	const AbstractProfileFormat &format () const;
+	bool writable () const;
+
+	unsigned int modeCount () const;
+	SettingMap mode (unsigned int index) const;
+	unsigned int buttonCount () const;
+	Profile::Button button (unsigned int index) const;
+	Setting setting (const std::string &name) const;
+
+	/**
+	 * Replace mode \p index, or add it if \p index is modeCount ().
+	 */
+	void setMode (unsigned int index, const SettingMap &mode);
+	void setButton (unsigned int index, const Profile::Button &button);
+	void setSetting (const std::string &name, const Setting &value);
+
+private:
+	std::vector<uint8_t>::iterator mutableBegin () const;
+
+	const AbstractProfileFormat &_format;
+	std::vector<uint8_t>::const_iterator _begin;
+	std::vector<uint8_t>::iterator _mutable_begin;
+	bool _writable;
+};
+
+}
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ReplayDevice.h"
+
+#include <hidpp/SimulatedReceiver.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace HIDPP;
+
+ReplayDevice::ReplayDevice (const std::vector<HID::ReportCapture::Entry> &entries, double speed):
+	_speed (speed),
+	_next (0),
+	_interrupted (false)
+{
+	if (speed < 0)
+		throw std::invalid_argument ("Replay speed must not be negative");
+	std::copy_if (entries.begin (), entries.end (), std::back_inserter (_entries),
+		      [] (const HID::ReportCapture::Entry &entry) {
+			return entry.direction == HID::ReportCapture::Input;
+		      });
+}
+
+ReplayDevice::~ReplayDevice ()
+{
+}
+
+void ReplayDevice::registerScheme ()
+{
+	HID::VirtualDevice::registerScheme ("replay", [] (const std::string &args) {
+		std::istringstream ss (args);
+		std::string path, item;
+		std::getline (ss, path, ',');
+		std::optional<uint16_t> device;
+		double speed = 1.0;
+		while (std::getline (ss, item, ',')) {
+			auto sep = item.find ('=');
+			if (sep == std::string::npos)
+				throw std::invalid_argument ("Missing value for replay option " + item);
+			auto key = item.substr (0, sep);
+			auto value = item.substr (sep+1);
+			if (key == "device")
+				device = std::stoul (value);
+			else if (key == "speed")
+				speed = std::stod (value);
+			else
+				throw std::invalid_argument ("Unknown replay option " + key);
+		}
+		auto entries = HID::ReportCapture::load (path);
+		if (device)
+			entries.erase (std::remove_if (entries.begin (), entries.end (),
+					[&device] (const HID::ReportCapture::Entry &entry) {
+						return entry.device != *device;
+					}),
+				entries.end ());
+		return std::make_shared<ReplayDevice> (entries, speed);
+	});
+}
+
+static const bool replay_scheme_registered = (ReplayDevice::registerScheme (), true);
+
+bool ReplayDevice::finished () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _next == _entries.size ();
+}
+
+uint16_t ReplayDevice::vendorID () const
+{
+	return 0x046d;
+}
+
+uint16_t ReplayDevice::productID () const
+{
+	return 0xc52b;
+}
+
+std::string ReplayDevice::name () const
+{
+	return "Replayed Receiver";
+}
+
+HID::ReportDescriptor ReplayDevice::reportDescriptor () const
+{
+	return SimulatedReceiver::hidppReportDescriptor ();
+}
+
+int ReplayDevice::writeReport (const uint8_t *, std::size_t length)
+{
+	return length;
+}
+
+int ReplayDevice::readReport (uint8_t *report, std::size_t length, int timeout)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto now = clock::now ();
+	if (!_start)
+		_start = now;
+	auto deadline = timeout < 0
+		? clock::time_point::max ()
+		: now + std::chrono::milliseconds (timeout);
+	while (true) {
+		if (_interrupted) {
+			_interrupted = false;
+			return 0;
+		}
+		now = clock::now ();
+		auto due = clock::time_point::max ();
+		if (_next < _entries.size ()) {
+			auto elapsed = _entries[_next].time - _entries.front ().time;
+			due = _speed == 0
+				? *_start
+				: *_start + std::chrono::duration_cast<clock::duration> (elapsed / _speed);
+		}
+		if (due <= now) {
+			const auto &entry = _entries[_next++];
+			length = std::min (length, entry.report.size ());
+			std::copy_n (entry.report.begin (), length, report);
+			return length;
+		}
+		if (now >= deadline)
+			return 0;
+		auto wake = std::min (deadline, due);
+		if (wake == clock::time_point::max ())
+			_cond.wait (lock);
+		else
+			_cond.wait_until (lock, wake);
+	}
+}
+
+void ReplayDevice::interruptRead ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_interrupted = true;
+	_cond.notify_all ();
+}
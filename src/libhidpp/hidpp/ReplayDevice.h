@@ -0,0 +1,91 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_REPLAY_DEVICE_H
+#define LIBHIDPP_HIDPP_REPLAY_DEVICE_H
+
+#include <hid/VirtualDevice.h>
+#include <hid/ReportCapture.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * Virtual HID++ receiver reading the input reports of a capture (see
+ * HID::ReportCapture) with their original timing.
+ *
+ * Written reports are ignored: the answers come from the capture, so
+ * replaying through a dispatcher reproduces the load of the captured
+ * session rather than its exact behaviour. Once every report was read,
+ * the device stays silent.
+ *
+ * The "replay" scheme is registered when libhidpp is loaded, with
+ * paths like "replay:file[,device=N][,speed=S]". \c device selects the
+ * reports of one captured device, \c speed scales time (0 replays as
+ * fast as possible).
+ */
+class ReplayDevice: public HID::VirtualDevice
+{
+public:
+	/**
+	 * Replay the input reports of \p entries, \p speed times faster
+	 * than captured.
+	 */
+	ReplayDevice (const std::vector<HID::ReportCapture::Entry> &entries,
+		      double speed = 1.0);
+	virtual ~ReplayDevice ();
+
+	/**
+	 * Register the "replay" virtual device scheme.
+	 */
+	static void registerScheme ();
+
+	/**
+	 * Check if every report was read.
+	 */
+	bool finished () const;
+
+	virtual uint16_t vendorID () const;
+	virtual uint16_t productID () const;
+	virtual std::string name () const;
+	virtual HID::ReportDescriptor reportDescriptor () const;
+	virtual int writeReport (const uint8_t *report, std::size_t length);
+	virtual int readReport (uint8_t *report, std::size_t length, int timeout);
+	virtual void interruptRead ();
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	std::vector<HID::ReportCapture::Entry> _entries; // input reports only
+	double _speed;
+	std::size_t _next;
+	std::optional<clock::time_point> _start; // set by the first read
+	mutable std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _interrupted;
+};
+
+}
+
+#endif
@@ -21,6 +21,7 @@
 #include <hidpp10/defs.h>
 #include <hidpp20/defs.h>
 #include <algorithm>
+#include <atomic>
 #include <stdexcept>
 
 using namespace HIDPP;
@@ -54,25 +55,31 @@ static constexpr unsigned int Parameters = 4;
 
 Report::Report (uint8_t report_id, const uint8_t *data, std::size_t length)
 {
-
+	static_assert (reportLength (VeryLong) <= StorageLength);
 	auto expected_len = reportLength (static_cast<Type> (report_id));
 	if (expected_len == 0)
 		throw InvalidReportID ();
-	_data.resize (expected_len);
 	if (length != expected_len-1)
 		throw InvalidReportLength ();
+	_length = expected_len;
 	_data[Offset::Type] = report_id;
 	std::copy_n (data, length, &_data[1]);
 }
 
-Report::Report (std::vector<uint8_t> &&data)
+Report::Report (const uint8_t *data, std::size_t length)
 {
 	auto expected_len = reportLength (static_cast<Type> (data[0]));
 	if (expected_len == 0)
 		throw InvalidReportID ();
-	if (data.size () != expected_len)
+	if (length != expected_len)
 		throw InvalidReportLength ();
-	_data = std::move (data);
+	_length = expected_len;
+	std::copy_n (data, length, _data.begin ());
+}
+
+Report::Report (std::vector<uint8_t> &&data):
+	Report (data.data (), data.size ())
+{
 }
 
 Report::Report (Type type,
@@ -80,7 +87,8 @@ Report::Report (Type type,
 		uint8_t sub_id,
 		uint8_t address)
 {
-	_data.resize (reportLength (type), 0);
+	_length = reportLength (type);
+	std::fill_n (_data.begin (), _length, 0);
 	_data[Offset::Type] = type;
 	_data[Offset::DeviceIndex] = device_index;
 	_data[Offset::SubID] = sub_id;
@@ -96,12 +104,12 @@ Report::Report (HIDPP::DeviceIndex device_index,
 	std::size_t param_len = std::distance (param_begin, param_end);
 	for (auto type: { Short, Long, VeryLong }) {
 		if (param_len == parameterLength (type)) {
-			_data.resize (reportLength (type));
+			_length = reportLength (type);
 			_data[Offset::Type] = type;
 			break;
 		}
 	}
-	if (_data.empty ())
+	if (_length == 0)
 		throw InvalidReportLength ();
 	_data[Offset::DeviceIndex] = device_index;
 	_data[Offset::SubID] = sub_id;
@@ -115,7 +123,8 @@ Report::Report (Type type,
 		unsigned int function,
 		unsigned int sw_id)
 {
-	_data.resize (reportLength (type), 0);
+	_length = reportLength (type);
+	std::fill_n (_data.begin (), _length, 0);
 	_data[Offset::Type] = type;
 	_data[Offset::DeviceIndex] = device_index;
 	_data[Offset::SubID] = feature_index;
@@ -132,12 +141,12 @@ Report::Report (DeviceIndex device_index,
 	std::size_t param_len = std::distance (param_begin, param_end);
 	for (auto type: { Short, Long, VeryLong }) {
 		if (param_len == parameterLength (type)) {
-			_data.resize (reportLength (type));
+			_length = reportLength (type);
 			_data[Offset::Type] = type;
 			break;
 		}
 	}
-	if (_data.empty ())
+	if (_length == 0)
 		throw InvalidReportLength ();
 	_data[Offset::DeviceIndex] = device_index;
 	_data[Offset::SubID] = feature_index;
@@ -210,31 +219,111 @@ std::size_t Report::parameterLength () const
 	return parameterLength (static_cast<Type> (_data[Offset::Type]));
 }
 
-std::vector<uint8_t>::iterator Report::parameterBegin ()
+uint8_t *Report::parameterBegin ()
+{
+	return _data.data () + Offset::Parameters;
+}
+
+const uint8_t *Report::parameterBegin () const
+{
+	return _data.data () + Offset::Parameters;
+}
+
+uint8_t *Report::parameterEnd ()
+{
+	return _data.data () + _length;
+}
+
+const uint8_t *Report::parameterEnd () const
 {
-	return _data.begin () + Offset::Parameters;
+	return _data.data () + _length;
 }
 
-std::vector<uint8_t>::const_iterator Report::parameterBegin () const
+std::vector<uint8_t> Report::rawReport () const
 {
-	return _data.begin () + Offset::Parameters;
+	return std::vector<uint8_t> (_data.begin (), _data.begin () + _length);
 }
 
-std::vector<uint8_t>::iterator Report::parameterEnd ()
+const uint8_t *Report::rawData () const
 {
-	return _data.end ();
+	return _data.data ();
 }
 
-std::vector<uint8_t>::const_iterator Report::parameterEnd () const
+std::size_t Report::rawLength () const
 {
-	return _data.end ();
+	return _length;
 }
 
-const std::vector<uint8_t> &Report::rawReport () const
+ReportView::ReportView (const uint8_t *data, std::size_t length):
+	_data (data), _length (length)
+{
+}
+
+ReportView::ReportView (const Report &report):
+	_data (report.rawData ()), _length (report.rawLength ())
+{
+}
+
+const uint8_t *ReportView::data () const
 {
 	return _data;
 }
 
+std::size_t ReportView::length () const
+{
+	return _length;
+}
+
+uint8_t ReportView::deviceIndex () const
+{
+	return _length > Offset::DeviceIndex ? _data[Offset::DeviceIndex] : 0;
+}
+
+uint8_t ReportView::featureIndex () const
+{
+	return _length > Offset::SubID ? _data[Offset::SubID] : 0;
+}
+
+unsigned int ReportView::function () const
+{
+	return _length > Offset::Address ? (_data[Offset::Address] & 0xf0) >> 4 : 0;
+}
+
+const uint8_t *ReportView::parameters (std::size_t length) const
+{
+	if (_length < Offset::Parameters + length)
+		return nullptr;
+	return &_data[Offset::Parameters];
+}
+
+std::chrono::steady_clock::time_point Report::receiveTime () const
+{
+	return _receive_time;
+}
+
+void Report::setReceiveTime (std::chrono::steady_clock::time_point time)
+{
+	_receive_time = time;
+}
+
+uint64_t Report::sequence () const
+{
+	return _sequence;
+}
+
+void Report::setSequence (uint64_t sequence)
+{
+	_sequence = sequence;
+}
+
+uint64_t Report::nextSequence () noexcept
+{
+	static std::atomic<uint64_t> counter (0);
+	// Relaxed is enough: only the uniqueness and order of the numbers
+	// matter, the reports are passed to other threads by other means.
+	return counter.fetch_add (1, std::memory_order_relaxed) + 1;
+}
+
 bool Report::checkErrorMessage10 (uint8_t *sub_id,
 				  uint8_t *address,
 				  uint8_t *error_code) const
@@ -272,7 +361,7 @@ bool Report::checkErrorMessage20 (uint8_t *feature_index,
 
 	if (error_data)
 	{
-		size_t offset = _data.size() - 1;
+		size_t offset = _length - 1;
 		while(offset >= 6 && _data[offset] == 0x00)		// Look for the last non-zero byte
 			--offset;
 		*error_data = { _data.data() + 6, _data.data() + offset + 1 };	// Copy the error data
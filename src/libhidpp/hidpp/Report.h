@@ -23,6 +23,8 @@
 #include <hid/ReportDescriptor.h>
 
 #include <array>
+#include <chrono>
+#include <cstdint>
 #include <vector>
 
 namespace HIDPP
@@ -52,6 +54,7 @@ namespace HIDPP
 class Report
 {
 	static constexpr std::size_t HeaderLength = 4;
+	static constexpr std::size_t StorageLength = 64;
 public:
 	enum Type: uint8_t {
 		Short = 0x10,
@@ -110,7 +113,18 @@ public:
 	Report (uint8_t report_id, const uint8_t *data, std::size_t length);
 
 	/**
-	 * Build the report by moving the raw data.
+	 * Build the report by copying the raw data.
+	 *
+	 * \param data		Report data including the report ID in its first byte.
+	 * \param length	Length of the \p data array.
+	 *
+	 * \throws InvalidReportID
+	 * \throws InvalidReportLength
+	 */
+	Report (const uint8_t *data, std::size_t length);
+
+	/**
+	 * Build the report from the raw data.
 	 *
 	 * \param data	Report data including the report ID in its first byte.
 	 *
@@ -273,23 +287,182 @@ public:
 	std::size_t parameterLength () const;
 
 	/** Begin iterator for parameters. */
-	std::vector<uint8_t>::iterator parameterBegin ();
+	uint8_t *parameterBegin ();
 	/** Begin iterator for parameters. */
-	std::vector<uint8_t>::const_iterator parameterBegin () const;
+	const uint8_t *parameterBegin () const;
 	/** End iterator for parameters. */
-	std::vector<uint8_t>::iterator parameterEnd ();
+	uint8_t *parameterEnd ();
 	/** End iterator for parameters. */
-	std::vector<uint8_t>::const_iterator parameterEnd () const;
+	const uint8_t *parameterEnd () const;
+
+	/**
+	 * Get a copy of the raw HID report (including the ID).
+	 *
+	 * \sa rawData, rawLength
+	 */
+	std::vector<uint8_t> rawReport () const;
+
+	/**
+	 * Access the raw HID report (including the ID) without copying it.
+	 */
+	const uint8_t *rawData () const;
+	/**
+	 * Get the length of the raw HID report returned by \ref rawData.
+	 */
+	std::size_t rawLength () const;
+
+	/**
+	 * Time when the report was read from the device (steady clock,
+	 * CLOCK_MONOTONIC on Linux).
+	 *
+	 * Reports that were not read from a device have a default
+	 * constructed time point.
+	 */
+	std::chrono::steady_clock::time_point receiveTime () const;
+	void setReceiveTime (std::chrono::steady_clock::time_point time);
+
+	/**
+	 * Sequence number stamped with the receive time, from a counter
+	 * shared by every dispatcher of the process.
+	 *
+	 * Sequence numbers increase in the order reports are read, across
+	 * devices, so that streams from several dispatchers can be merged
+	 * without sorting (see EventMerge). Reports that were not read from
+	 * a device have sequence 0.
+	 */
+	uint64_t sequence () const;
+	void setSequence (uint64_t sequence);
+	/**
+	 * Take the next global sequence number (starting at 1).
+	 */
+	static uint64_t nextSequence () noexcept;
+
+private:
+	// Reports are stored inline so that building, copying or moving them
+	// never allocates.
+	std::array<uint8_t, StorageLength> _data;
+	uint8_t _length = 0;
+	std::chrono::steady_clock::time_point _receive_time;
+	uint64_t _sequence = 0;
+};
+
+/**
+ * Non-owning view of a raw HID++ 2.0 report (including the report ID).
+ *
+ * It lets event decoders read reports where they were received (e.g. in
+ * a batch buffer) without copying them in a Report first.
+ */
+class ReportView
+{
+public:
+	ReportView (const uint8_t *data, std::size_t length);
+	ReportView (const Report &report);
+
+	const uint8_t *data () const;
+	std::size_t length () const;
+	uint8_t deviceIndex () const;
+	uint8_t featureIndex () const;
+	unsigned int function () const;
+
+	/**
+	 * Parameters of the report, or null if the report is too short
+	 * for having \p length bytes of parameters.
+	 */
+	const uint8_t *parameters (std::size_t length) const;
+
+private:
+	const uint8_t *_data;
+	std::size_t _length;
+};
+
+/**
+ * Non-owning view of a raw HID++ report (including the report ID) of
+ * type \p T.
+ *
+ * Unlike Report and ReportView, nothing is checked by the accessors:
+ * the report is checked once with \ref matches (or \ref visitReport)
+ * and the length and field offsets are compile-time constants, so
+ * decoding a field is a single load.
+ */
+template<Report::Type T>
+class TypedReportView
+{
+public:
+	static constexpr Report::Type ReportType = T;
+	static constexpr std::size_t Length = Report::reportLength (T);
+	static constexpr std::size_t ParameterLength = Report::parameterLength (T);
+
+	/**
+	 * \returns whether \p data (\p length bytes) is a report of type \p T.
+	 */
+	static constexpr bool matches (const uint8_t *data, std::size_t length) noexcept
+	{
+		return length == Length && data[0] == T;
+	}
 
 	/**
-	 * Get the raw HID report (without the ID).
+	 * View the \ref Length bytes at \p data, it must match.
 	 */
-	const std::vector<uint8_t> &rawReport () const;
+	explicit constexpr TypedReportView (const uint8_t *data) noexcept:
+		_data (data)
+	{
+	}
+
+	constexpr const uint8_t *data () const noexcept { return _data; }
+	constexpr DeviceIndex deviceIndex () const noexcept { return static_cast<DeviceIndex> (_data[1]); }
+
+	/** HID++ 1.0 subID. */
+	constexpr uint8_t subID () const noexcept { return _data[2]; }
+	/** HID++ 1.0 address. */
+	constexpr uint8_t address () const noexcept { return _data[3]; }
+
+	/** HID++ 2.0 feature index. */
+	constexpr uint8_t featureIndex () const noexcept { return _data[2]; }
+	/** HID++ 2.0 function. */
+	constexpr unsigned int function () const noexcept { return _data[3] >> 4; }
+	/** HID++ 2.0 software ID. */
+	constexpr unsigned int softwareID () const noexcept { return _data[3] & 0x0f; }
+
+	/**
+	 * The \ref ParameterLength parameter bytes.
+	 */
+	constexpr const uint8_t *parameters () const noexcept { return _data + 4; }
+	/**
+	 * Parameter \p I, checked at compile time.
+	 */
+	template<std::size_t I>
+	constexpr uint8_t parameter () const noexcept
+	{
+		static_assert (I < ParameterLength, "parameter out of the report");
+		return _data[4+I];
+	}
 
 private:
-	std::vector<uint8_t> _data;
+	const uint8_t *_data;
 };
 
+/**
+ * Call \p f with the TypedReportView of the report at \p data
+ * (\p length bytes including the report ID).
+ *
+ * \p f takes any TypedReportView (e.g. a generic lambda) and returns a
+ * bool.
+ *
+ * \returns the result of \p f, or false without calling it if \p data
+ * is not a HID++ report.
+ */
+template<typename F>
+constexpr bool visitReport (const uint8_t *data, std::size_t length, F &&f)
+{
+	if (TypedReportView<Report::Short>::matches (data, length))
+		return f (TypedReportView<Report::Short> (data));
+	if (TypedReportView<Report::Long>::matches (data, length))
+		return f (TypedReportView<Report::Long> (data));
+	if (TypedReportView<Report::VeryLong>::matches (data, length))
+		return f (TypedReportView<Report::VeryLong> (data));
+	return false;
+}
+
 inline constexpr auto MaxReportLength = Report::reportLength (Report::VeryLong);
 inline constexpr auto ShortParamLength = Report::parameterLength (Report::Short);
 inline constexpr auto LongParamLength = Report::parameterLength (Report::Long);
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ReportPool.h"
+
+#include <algorithm>
+#include <optional>
+
+using namespace HIDPP;
+
+struct SharedReport::Buffer
+{
+	std::optional<Report> report;
+	std::atomic<unsigned int> refs;
+	ReportPool::State *pool;
+	Buffer *next_free;
+};
+
+struct ReportPool::State
+{
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<SharedReport::Buffer[]>> chunks;
+	SharedReport::Buffer *free = nullptr;
+	std::size_t capacity = 0, used = 0;
+	bool destroyed = false; // the pool is gone, free the state with the last buffer
+};
+
+SharedReport::SharedReport () noexcept:
+	_buffer (nullptr)
+{
+}
+
+SharedReport::SharedReport (Buffer *buffer) noexcept:
+	_buffer (buffer)
+{
+}
+
+SharedReport::SharedReport (const SharedReport &other) noexcept:
+	_buffer (other._buffer)
+{
+	if (_buffer)
+		_buffer->refs.fetch_add (1, std::memory_order_relaxed);
+}
+
+SharedReport::SharedReport (SharedReport &&other) noexcept:
+	_buffer (other._buffer)
+{
+	other._buffer = nullptr;
+}
+
+SharedReport::~SharedReport ()
+{
+	release ();
+}
+
+SharedReport &SharedReport::operator= (const SharedReport &other) noexcept
+{
+	if (other._buffer)
+		other._buffer->refs.fetch_add (1, std::memory_order_relaxed);
+	release ();
+	_buffer = other._buffer;
+	return *this;
+}
+
+SharedReport &SharedReport::operator= (SharedReport &&other) noexcept
+{
+	if (this != &other) {
+		release ();
+		_buffer = other._buffer;
+		other._buffer = nullptr;
+	}
+	return *this;
+}
+
+const Report &SharedReport::operator* () const noexcept
+{
+	return *_buffer->report;
+}
+
+const Report *SharedReport::operator-> () const noexcept
+{
+	return &*_buffer->report;
+}
+
+unsigned int SharedReport::useCount () const noexcept
+{
+	return _buffer ? _buffer->refs.load (std::memory_order_relaxed) : 0;
+}
+
+void SharedReport::release () noexcept
+{
+	if (!_buffer || _buffer->refs.fetch_sub (1, std::memory_order_acq_rel) != 1)
+		return;
+	auto state = _buffer->pool;
+	std::unique_lock<std::mutex> lock (state->mutex);
+	_buffer->report.reset ();
+	_buffer->next_free = state->free;
+	state->free = _buffer;
+	_buffer = nullptr;
+	if (--state->used == 0 && state->destroyed) {
+		lock.unlock ();
+		delete state;
+	}
+}
+
+ReportPool::ReportPool (std::size_t reserve):
+	_state (new State)
+{
+	this->reserve (reserve);
+}
+
+ReportPool::~ReportPool ()
+{
+	std::unique_lock<std::mutex> lock (_state->mutex);
+	if (_state->used > 0) {
+		_state->destroyed = true;
+		return;
+	}
+	lock.unlock ();
+	delete _state;
+}
+
+SharedReport ReportPool::share (const Report &report)
+{
+	std::unique_lock<std::mutex> lock (_state->mutex);
+	// Grow geometrically so that reaching a steady rate takes few
+	// allocations.
+	if (!_state->free)
+		grow (std::max<std::size_t> (_state->capacity, 16));
+	auto buffer = _state->free;
+	_state->free = buffer->next_free;
+	++_state->used;
+	lock.unlock ();
+	buffer->report.emplace (report);
+	buffer->refs.store (1, std::memory_order_relaxed);
+	return SharedReport (buffer);
+}
+
+void ReportPool::reserve (std::size_t count)
+{
+	std::unique_lock<std::mutex> lock (_state->mutex);
+	if (_state->capacity >= count)
+		return;
+	grow (count - _state->capacity);
+}
+
+void ReportPool::grow (std::size_t count)
+{
+	auto chunk = std::make_unique<SharedReport::Buffer[]> (count);
+	for (std::size_t i = 0; i < count; ++i) {
+		chunk[i].pool = _state;
+		chunk[i].next_free = i+1 < count ? &chunk[i+1] : _state->free;
+	}
+	_state->free = &chunk[0];
+	_state->chunks.push_back (std::move (chunk));
+	_state->capacity += count;
+}
+
+std::size_t ReportPool::capacity () const
+{
+	std::unique_lock<std::mutex> lock (_state->mutex);
+	return _state->capacity;
+}
+
+std::size_t ReportPool::used () const
+{
+	std::unique_lock<std::mutex> lock (_state->mutex);
+	return _state->used;
+}
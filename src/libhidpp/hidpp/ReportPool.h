@@ -0,0 +1,126 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_REPORT_POOL_H
+#define LIBHIDPP_HIDPP_REPORT_POOL_H
+
+#include <hidpp/Report.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace HIDPP
+{
+
+class ReportPool;
+
+/**
+ * Reference counted handle to a report stored in a ReportPool.
+ *
+ * Copying the handle shares the report instead of copying it, so the
+ * same report can be given to several consumers or queued across
+ * threads. The report is returned to its pool when the last handle is
+ * destroyed. Handles may outlive their pool.
+ */
+class SharedReport
+{
+public:
+	SharedReport () noexcept;
+	SharedReport (const SharedReport &other) noexcept;
+	SharedReport (SharedReport &&other) noexcept;
+	~SharedReport ();
+
+	SharedReport &operator= (const SharedReport &other) noexcept;
+	SharedReport &operator= (SharedReport &&other) noexcept;
+
+	explicit operator bool () const noexcept { return _buffer != nullptr; }
+
+	const Report &operator* () const noexcept;
+	const Report *operator-> () const noexcept;
+
+	/**
+	 * Number of handles sharing the report.
+	 */
+	unsigned int useCount () const noexcept;
+
+private:
+	struct Buffer;
+	explicit SharedReport (Buffer *buffer) noexcept;
+	void release () noexcept;
+
+	Buffer *_buffer;
+
+	friend class ReportPool;
+};
+
+/**
+ * Free list of report buffers for SharedReport.
+ *
+ * Buffers are allocated in chunks and never freed while the pool
+ * exists, so that a sustained rate of shared reports uses constant
+ * memory and does not allocate once enough buffers were created. The
+ * pool can be used from any thread.
+ */
+class ReportPool
+{
+public:
+	/**
+	 * \param reserve	Number of buffers allocated at once.
+	 */
+	explicit ReportPool (std::size_t reserve = 0);
+	/**
+	 * Buffers still shared are freed when their last handle is
+	 * destroyed.
+	 */
+	~ReportPool ();
+
+	ReportPool (const ReportPool &) = delete;
+	ReportPool &operator= (const ReportPool &) = delete;
+
+	/**
+	 * Copy \p report in a free buffer.
+	 */
+	SharedReport share (const Report &report);
+
+	/**
+	 * Allocate at least \p count buffers.
+	 */
+	void reserve (std::size_t count);
+	/**
+	 * Number of allocated buffers.
+	 */
+	std::size_t capacity () const;
+	/**
+	 * Number of buffers currently shared.
+	 */
+	std::size_t used () const;
+
+private:
+	void grow (std::size_t count); // _state->mutex must be held
+
+	struct State;
+	State *_state; // freed with the last buffer when the pool is destroyed
+
+	friend class SharedReport;
+};
+
+}
+
+#endif
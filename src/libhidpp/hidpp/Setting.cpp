@@ -19,8 +19,11 @@
 #include "Setting.h"
 
 #include <misc/Log.h>
+#include <misc/MemoryAccounting.h>
 
 #include <array>
+#include <cctype>
+#include <charconv>
 #include <sstream>
 #include <limits>
 #include <cassert>
@@ -64,69 +67,131 @@ Setting::Type Setting::type<EnumValue> ()
 }
 
 Setting::Setting (const Setting &other):
-	_type (other._type)
+	_type (other._type),
+	_accounted (false)
 {
 	switch (_type) {
 	case Type::String:
-		_value = new std::string (*reinterpret_cast<std::string *> (other._value));
-		break;
-	case Type::Boolean:
-		_value = new bool (*reinterpret_cast<bool *> (other._value));
-		break;
-	case Type::Integer:
-		_value = new int (*reinterpret_cast<int *> (other._value));
+		_value.ptr = new std::string (other.get<std::string> ());
+		account ();
 		break;
 	case Type::LEDVector:
-		_value = new LEDVector (*reinterpret_cast<LEDVector *> (other._value));
-		break;
-	case Type::Color:
-		_value = new Color (*reinterpret_cast<Color *> (other._value));
+		_value.ptr = new LEDVector (other.get<LEDVector> ());
+		account ();
 		break;
 	case Type::ComposedSetting:
-		_value = new ComposedSetting (*reinterpret_cast<ComposedSetting *> (other._value));
+		_value.ptr = new ComposedSetting (other.get<ComposedSetting> ());
+		account ();
 		break;
 	case Type::Enum:
-		_value = new EnumValue (*reinterpret_cast<EnumValue *> (other._value));
+		new (&_value) EnumValue (other.get<EnumValue> ());
+		break;
+	default:
+		_value = other._value;
 		break;
 	}
 }
 
 Setting::Setting (Setting &&other):
 	_type (other._type),
-	_value (other._value)
+	_accounted (other._accounted)
 {
-	other._value = nullptr;
+	if (_type == Type::Enum)
+		new (&_value) EnumValue (other.get<EnumValue> ());
+	else {
+		_value = other._value;
+		if (!isInline (_type)) {
+			other._value.ptr = nullptr;
+			other._accounted = false;
+		}
+	}
 }
 
-Setting::~Setting ()
+static std::size_t heapValueSize (Setting::Type type)
+{
+	switch (type) {
+	case Setting::Type::String:
+		return sizeof (std::string);
+	case Setting::Type::LEDVector:
+		return sizeof (LEDVector);
+	case Setting::Type::ComposedSetting:
+		return sizeof (ComposedSetting);
+	default:
+		return 0;
+	}
+}
+
+void Setting::account ()
 {
-	if (!_value)
+	if (!MemoryAccounting::enabled ())
 		return;
+	MemoryAccounting::charge (MemoryAccounting::Subsystem::Settings, heapValueSize (_type), 1);
+	_accounted = true;
+}
+
+Setting::~Setting ()
+{
+	if (_accounted)
+		MemoryAccounting::charge (MemoryAccounting::Subsystem::Settings, -int64_t (heapValueSize (_type)), -1);
 	switch (_type) {
 	case Type::String:
-		delete reinterpret_cast<std::string *> (_value);
-		break;
-	case Type::Boolean:
-		delete reinterpret_cast<bool *> (_value);
-		break;
-	case Type::Integer:
-		delete reinterpret_cast<int *> (_value);
+		delete reinterpret_cast<std::string *> (_value.ptr);
 		break;
 	case Type::LEDVector:
-		delete reinterpret_cast<LEDVector *> (_value);
-		break;
-	case Type::Color:
-		delete reinterpret_cast<Color *> (_value);
+		delete reinterpret_cast<LEDVector *> (_value.ptr);
 		break;
 	case Type::ComposedSetting:
-		delete reinterpret_cast<ComposedSetting *> (_value);
+		delete reinterpret_cast<ComposedSetting *> (_value.ptr);
 		break;
 	case Type::Enum:
-		delete reinterpret_cast<EnumValue *> (_value);
+		reinterpret_cast<EnumValue *> (&_value)->~EnumValue ();
+		break;
+	default:
 		break;
 	}
 }
 
+Setting &Setting::operator= (const Setting &other)
+{
+	if (this != &other) {
+		Setting copy (other);
+		*this = std::move (copy);
+	}
+	return *this;
+}
+
+Setting &Setting::operator= (Setting &&other)
+{
+	if (this != &other) {
+		this->~Setting ();
+		new (this) Setting (std::move (other));
+	}
+	return *this;
+}
+
+bool Setting::isInline (Type type)
+{
+	switch (type) {
+	case Type::Boolean:
+	case Type::Integer:
+	case Type::Color:
+	case Type::Enum:
+		return true;
+	default:
+		return false;
+	}
+}
+
+const void *Setting::data () const
+{
+	return isInline (_type) ? &_value : _value.ptr;
+}
+
+void *Setting::data ()
+{
+	return isInline (_type) ? &_value : _value.ptr;
+}
+
 Setting::Type Setting::type () const
 {
 	return _type;
@@ -224,29 +289,65 @@ SettingDesc::SettingDesc (const EnumDesc &enum_desc, int default_value):
 {
 }
 
-bool SettingDesc::check (const Setting &setting) const
+const char *SettingDesc::errorString (Error error)
+{
+	switch (error) {
+	case Error::None:
+		return "no error";
+	case Error::WrongType:
+		return "wrong setting type";
+	case Error::NotBoolean:
+		return "string is not a boolean value";
+	case Error::NotNumber:
+		return "string is not a number";
+	case Error::OutOfRange:
+		return "number is out of range";
+	case Error::LEDVectorLength:
+		return "LED vector has the wrong length";
+	case Error::NotLEDVector:
+		return "invalid character in LED vector";
+	case Error::NotColor:
+		return "string is not a color value";
+	case Error::InvalidEnumValue:
+		return "invalid enum value";
+	case Error::UnknownSetting:
+		return "unknown setting";
+	case Error::NotConvertible:
+		return "setting cannot be converted from a string";
+	}
+	return "unknown error";
+}
+
+SettingDesc::Error SettingDesc::checkValue (const Setting &setting) const
 {
 	if (setting.type () != _type)
-		return false;
+		return Error::WrongType;
 	switch (_type) {
-	case Setting::Type::String:
-	case Setting::Type::Boolean:
-	case Setting::Type::Color:
-		return true;
-
 	case Setting::Type::Integer: {
 		int value = setting.get<int> ();
-		return value >= _min && value <= _max;
+		return value >= _min && value <= _max ? Error::None : Error::OutOfRange;
 	}
 
 	case Setting::Type::LEDVector:
-		return setting.get<LEDVector> ().size () == _led_count;
+		return setting.get<LEDVector> ().size () == _led_count ? Error::None : Error::LEDVectorLength;
 
 	case Setting::Type::Enum: {
-		EnumValue value = setting.get<EnumValue> ();
-		return &value.desc () == _enum_desc && _enum_desc->check (value.get ());
+		const EnumValue &value = setting.get<EnumValue> ();
+		if (&value.desc () != _enum_desc)
+			return Error::WrongType;
+		return _enum_desc->check (value.get ()) ? Error::None : Error::InvalidEnumValue;
 	}
-	case Setting::Type::ComposedSetting:
+
+	default:
+		return Error::None;
+	}
+}
+
+bool SettingDesc::check (const Setting &setting) const
+{
+	if (checkValue (setting) != Error::None)
+		return false;
+	if (_type == Setting::Type::ComposedSetting) {
 		for (const auto &pair: setting.get<ComposedSetting> ()) {
 			auto it = _sub_settings.find (pair.first);
 			if (it == _sub_settings.end ()) {
@@ -258,66 +359,149 @@ bool SettingDesc::check (const Setting &setting) const
 				return false;
 			}
 		}
-		return true;
-	default:
-		return false;
 	}
+	return true;
 }
 
-Setting SettingDesc::convertFromString (const std::string &str) const
+std::size_t SettingDesc::validate (const Setting &setting, const std::string &name,
+				   std::vector<Issue> &issues) const
+{
+	std::size_t count = issues.size ();
+	Error error = checkValue (setting);
+	if (error != Error::None)
+		issues.push_back ({ name, error });
+	else if (_type == Setting::Type::ComposedSetting) {
+		for (const auto &pair: setting.get<ComposedSetting> ()) {
+			std::string sub_name = name + "." + pair.first;
+			auto it = _sub_settings.find (pair.first);
+			if (it == _sub_settings.end ())
+				issues.push_back ({ sub_name, Error::UnknownSetting });
+			else
+				it->second.validate (pair.second, sub_name, issues);
+		}
+	}
+	return issues.size () - count;
+}
+
+static SettingDesc::Error parseInteger (std::string_view str, long long &value)
+{
+	typedef SettingDesc::Error Error;
+	// Same syntax as strtol with base 0
+	while (!str.empty () && std::isspace (static_cast<unsigned char> (str.front ())))
+		str.remove_prefix (1);
+	bool negative = false;
+	if (!str.empty () && (str.front () == '-' || str.front () == '+')) {
+		negative = str.front () == '-';
+		str.remove_prefix (1);
+	}
+	int base = 10;
+	if (str.size () > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+		base = 16;
+		str.remove_prefix (2);
+	}
+	else if (str.size () > 1 && str[0] == '0') {
+		base = 8;
+		str.remove_prefix (1);
+	}
+	// Unsigned parsing rejects a second sign
+	unsigned long long magnitude;
+	auto result = std::from_chars (str.data (), str.data () + str.size (), magnitude, base);
+	if (result.ptr != str.data () + str.size () || result.ec == std::errc::invalid_argument)
+		return Error::NotNumber;
+	if (result.ec == std::errc::result_out_of_range ||
+			magnitude > static_cast<unsigned long long> (std::numeric_limits<long long>::max ()))
+		return Error::OutOfRange;
+	value = negative ? -static_cast<long long> (magnitude) : static_cast<long long> (magnitude);
+	return Error::None;
+}
+
+std::optional<Setting> SettingDesc::tryConvertFromString (std::string_view str, Error &error) const
 {
+	error = Error::None;
 	switch (_type) {
 	case Setting::Type::String:
-		return str;
+		return Setting (std::string (str));
 
 	case Setting::Type::Boolean:
 		if (str == "true" || str == "on")
-			return true;
+			return Setting (true);
 		else if (str == "false" || str == "off")
-			return false;
-		else
-			throw std::runtime_error ("string is not a boolean value");
+			return Setting (false);
+		error = Error::NotBoolean;
+		return std::nullopt;
 
 	case Setting::Type::Integer: {
-		char *end;
-		int value = strtol (str.c_str (), &end, 0);
-		if (*end != '\0')
-			throw std::runtime_error ("string is not a number");
-		if (value < _min || value > _max)
-			throw std::runtime_error ("number is out of range");
-		return value;
+		long long value;
+		error = parseInteger (str, value);
+		if (error == Error::None && (value < _min || value > _max))
+			error = Error::OutOfRange;
+		if (error != Error::None)
+			return std::nullopt;
+		return Setting (static_cast<int> (value));
 	}
 
 	case Setting::Type::LEDVector: {
-		LEDVector vec;
+		// Extra characters are ignored
+		if (str.size () < _led_count) {
+			error = Error::LEDVectorLength;
+			return std::nullopt;
+		}
+		LEDVector vec (_led_count);
 		for (unsigned int i = 0; i < _led_count; ++i) {
-			if (i >= str.size ())
-				throw std::runtime_error ("LED vector is too short");
-			char c = str[i];
-			if (c == '1')
-				vec.push_back (true);
-			else if (c == '0')
-				vec.push_back (false);
-			else
-				throw std::runtime_error ("invalid character in LED vector");
+			if (str[i] != '0' && str[i] != '1') {
+				error = Error::NotLEDVector;
+				return std::nullopt;
+			}
+			vec[i] = str[i] == '1';
 		}
-		return vec;
+		return Setting (std::move (vec));
 	}
 
 	case Setting::Type::Color: {
-		Color c;
-		if (3 != sscanf (str.c_str (), "%02hhx%02hhx%02hhx", &c.r, &c.g, &c.b))
-			throw  std::runtime_error ("string is not a color value");
-		return c;
+		uint8_t c[3];
+		if (str.size () != 6) {
+			error = Error::NotColor;
+			return std::nullopt;
+		}
+		for (unsigned int i = 0; i < 3; ++i) {
+			const char *begin = str.data () + 2*i;
+			auto result = std::from_chars (begin, begin + 2, c[i], 16);
+			if (result.ptr != begin + 2 || result.ec != std::errc ()) {
+				error = Error::NotColor;
+				return std::nullopt;
+			}
+		}
+		return Setting (Color { c[0], c[1], c[2] });
 	}
 
-	case Setting::Type::Enum:
-		return Setting (EnumValue (*_enum_desc, _enum_desc->fromString (str)));
+	case Setting::Type::Enum: {
+		int value;
+		if (!_enum_desc->tryFromString (str, value)) {
+			error = Error::InvalidEnumValue;
+			return std::nullopt;
+		}
+		return Setting (EnumValue (*_enum_desc, value));
+	}
 
 	case Setting::Type::ComposedSetting:
 	default:
-		throw std::logic_error ("invalid type in conversion");
+		error = Error::NotConvertible;
+		return std::nullopt;
+	}
+}
+
+Setting SettingDesc::convertFromString (const std::string &str) const
+{
+	Error error;
+	auto setting = tryConvertFromString (str, error);
+	if (!setting) {
+		if (error == Error::NotConvertible)
+			throw std::logic_error ("invalid type in conversion");
+		if (error == Error::InvalidEnumValue)
+			throw InvalidEnumValueError (str);
+		throw std::runtime_error (errorString (error));
 	}
+	return std::move (*setting);
 }
 
 Setting SettingDesc::defaultValue () const
@@ -21,7 +21,12 @@
 
 #include <vector>
 #include <map>
+#include <new>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <cstdint>
 
 #include <hidpp/Enum.h>
@@ -62,11 +67,32 @@ public:
 		typedef typename std::remove_cv<typename std::remove_reference<T>::type>::type type;
 	};
 
+	/**
+	 * Small values (bool, int, Color and EnumValue) are stored
+	 * inline, copying them does not allocate. Other values are
+	 * allocated on the heap.
+	 */
+	template<typename T>
+	static constexpr bool isInline ()
+	{
+		return std::is_same<T, bool>::value ||
+			std::is_same<T, int>::value ||
+			std::is_same<T, Color>::value ||
+			std::is_same<T, EnumValue>::value;
+	}
+
 	template<typename T>
 	Setting (T value):
 		_type (type<typename base_type<T>::type> ()),
-		_value (new typename base_type<T>::type (value))
+		_accounted (false)
 	{
+		typedef typename base_type<T>::type value_type;
+		if constexpr (isInline<value_type> ())
+			new (&_value) value_type (value);
+		else {
+			_value.ptr = new value_type (value);
+			account ();
+		}
 	}
 
 	Setting (const Setting &other);
@@ -74,26 +100,45 @@ public:
 
 	~Setting ();
 
+	Setting &operator= (const Setting &other);
+	Setting &operator= (Setting &&other);
+
 	Type type () const;
 
 	template<typename T>
 	const T &get () const {
 		if (_type != type<T> ())
 			throw std::runtime_error ("Invalid type");
-		return *reinterpret_cast<T *> (_value);
+		return *reinterpret_cast<const T *> (data ());
 	}
 
 	template<typename T>
 	T &get () {
 		if (_type != type<T> ())
 			throw std::runtime_error ("Invalid type");
-		return *reinterpret_cast<T *> (_value);
+		return *reinterpret_cast<T *> (data ());
 	}
 
 	std::string toString () const;
 private:
+	static bool isInline (Type type);
+	const void *data () const;
+	void *data ();
+	/**
+	 * Charge the heap allocated value to MemoryAccounting, if enabled.
+	 * Only the top-level object is counted, not what it allocates.
+	 */
+	void account ();
+
 	Type _type;
-	void *_value;
+	bool _accounted; // the heap value was charged
+	union {
+		bool boolean;
+		int integer;
+		Color color;
+		typename std::aligned_storage<sizeof (EnumValue), alignof (EnumValue)>::type enum_value;
+		void *ptr; // heap allocated value, null if moved
+	} _value;
 };
 
 template<> Setting::Type Setting::type<std::string> ();
@@ -119,8 +164,53 @@ public:
 	SettingDesc (const container &sub_settings);
 	SettingDesc (const EnumDesc &enum_desc, int default_value);
 
-	bool check (const Setting &setting) const;
+	/**
+	 * Reason why a value does not match the description.
+	 */
+	enum class Error {
+		None = 0,
+		WrongType,
+		NotBoolean,
+		NotNumber,
+		OutOfRange,
+		LEDVectorLength,
+		NotLEDVector,
+		NotColor,
+		InvalidEnumValue,
+		UnknownSetting,
+		NotConvertible,	///< Composed settings have no string form
+	};
+	static const char *errorString (Error error);
+
+	struct Issue
+	{
+		std::string name;	///< Sub-settings are named "parent.child"
+		Error error;
+	};
 
+	bool check (const Setting &setting) const;
+	/**
+	 * Check \p setting named \p name and every of its sub-settings,
+	 * instead of stopping at the first invalid one.
+	 *
+	 * \returns the number of issues appended to \p issues.
+	 */
+	std::size_t validate (const Setting &setting, const std::string &name,
+			      std::vector<Issue> &issues) const;
+
+	/**
+	 * Convert \p str without throwing on invalid input.
+	 *
+	 * Integers use the same syntax as strtol with base 0, they are
+	 * parsed with std::from_chars. Enum names are looked up in the
+	 * enum tables.
+	 *
+	 * \returns the setting, or nothing and the reason in \p error.
+	 */
+	std::optional<Setting> tryConvertFromString (std::string_view str, Error &error) const;
+	/**
+	 * \throws std::runtime_error if \p str is not valid.
+	 */
 	Setting convertFromString (const std::string &str) const;
 	Setting defaultValue () const;
 
@@ -135,6 +225,8 @@ public:
 	const_iterator find (const std::string &name) const;
 
 private:
+	Error checkValue (const Setting &setting) const; // ignores sub-settings
+
 	Setting::Type _type;
 	int _min, _max;
 	unsigned int _led_count;
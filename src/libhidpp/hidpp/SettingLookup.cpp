@@ -20,8 +20,28 @@
 
 using namespace HIDPP;
 
-SettingLookup::SettingLookup (const std::map<std::string, Setting> &values, const std::map<std::string, SettingDesc> &descs):
-	_values (values),
+SettingLookup::SettingLookup (const SettingMap &values, const std::map<std::string, SettingDesc> &descs):
+	_values (&values),
+	_composed_values (nullptr),
 	_descs (descs)
 {
 }
+
+SettingLookup::SettingLookup (const ComposedSetting &values, const std::map<std::string, SettingDesc> &descs):
+	_values (nullptr),
+	_composed_values (&values),
+	_descs (descs)
+{
+}
+
+const Setting *SettingLookup::find (const std::string &name) const
+{
+	if (_values) {
+		auto it = _values->find (name);
+		return it == _values->end () ? nullptr : &it->second;
+	}
+	else {
+		auto it = _composed_values->find (name);
+		return it == _composed_values->end () ? nullptr : &it->second;
+	}
+}
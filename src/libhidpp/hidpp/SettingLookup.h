@@ -19,7 +19,7 @@
 #ifndef LIBHIDPP_HIDPP_SETTING_LOOKUP_H
 #define LIBHIDPP_HIDPP_SETTING_LOOKUP_H
 
-#include <hidpp/Setting.h>
+#include <hidpp/SettingMap.h>
 #include <misc/Log.h>
 
 namespace HIDPP
@@ -28,42 +28,46 @@ namespace HIDPP
 class SettingLookup
 {
 public:
-	SettingLookup (const std::map<std::string, Setting> &values, const std::map<std::string, SettingDesc> &descs);
+	SettingLookup (const SettingMap &values, const std::map<std::string, SettingDesc> &descs);
+	SettingLookup (const ComposedSetting &values, const std::map<std::string, SettingDesc> &descs);
 
 	template<typename T>
 	T get (const std::string &name)
 	{
 		const SettingDesc &desc = _descs.at (name);
-		auto it = _values.find (name);
-		if (it == _values.end ())
+		const Setting *value = find (name);
+		if (!value)
 			return desc.defaultValue ().get<T> ();
-		if (!desc.check (it->second)) {
+		if (!desc.check (*value)) {
 			Log::error () << "Invalid value in setting \"" << name
 				      << "\", using default value instead."
 				      << std::endl;
 			return desc.defaultValue ().get<T> ();
 		}
-		return it->second.get<T> ();
+		return value->get<T> ();
 	}
 
 	template<typename T>
 	T get (const std::string &name, T default_value)
 	{
 		const SettingDesc &desc = _descs.at (name);
-		auto it = _values.find (name);
-		if (it == _values.end ())
+		const Setting *value = find (name);
+		if (!value)
 			return default_value;
-		if (!desc.check (it->second)) {
+		if (!desc.check (*value)) {
 			Log::error () << "Invalid value in setting \"" << name
 				      << "\", using default value instead."
 				      << std::endl;
 			return default_value;
 		}
-		return it->second.get<T> ();
+		return value->get<T> ();
 	}
 
 private:
-	const std::map<std::string, Setting> &_values;
+	const Setting *find (const std::string &name) const;
+
+	const SettingMap *_values;
+	const ComposedSetting *_composed_values;
 	const std::map<std::string, SettingDesc> &_descs;
 };
 
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "SettingMap.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+
+using namespace HIDPP;
+
+static const std::string *intern (const std::string &name)
+{
+	// Set nodes are never freed, the names keep their address.
+	static std::mutex mutex;
+	static std::unordered_set<std::string> names;
+	std::unique_lock<std::mutex> lock (mutex);
+	return &*names.insert (name).first;
+}
+
+SettingKey::SettingKey (const std::string &name):
+	_name (intern (name))
+{
+}
+
+SettingKey::SettingKey (const char *name):
+	_name (intern (name))
+{
+}
+
+const std::string &SettingKey::str () const
+{
+	return *_name;
+}
+
+const char *SettingKey::c_str () const
+{
+	return _name->c_str ();
+}
+
+SettingKey::operator const std::string & () const
+{
+	return *_name;
+}
+
+bool SettingKey::operator== (const SettingKey &other) const
+{
+	return _name == other._name;
+}
+
+bool SettingKey::operator!= (const SettingKey &other) const
+{
+	return _name != other._name;
+}
+
+bool SettingKey::operator< (const SettingKey &other) const
+{
+	return _name != other._name && *_name < *other._name;
+}
+
+SettingMap::SettingMap ():
+	_account (MemoryAccounting::Subsystem::Settings)
+{
+}
+
+SettingMap::SettingMap (std::initializer_list<value_type> values):
+	_account (MemoryAccounting::Subsystem::Settings)
+{
+	_values.reserve (values.size ());
+	for (const auto &value: values)
+		emplace (value.first, value.second);
+}
+
+SettingMap::SettingMap (const SettingMap &other):
+	_values (other._values),
+	_account (MemoryAccounting::Subsystem::Settings)
+{
+	updateAccount ();
+}
+
+SettingMap::SettingMap (SettingMap &&other):
+	_values (std::move (other._values)),
+	_account (MemoryAccounting::Subsystem::Settings)
+{
+	updateAccount ();
+	other._account.release ();
+}
+
+SettingMap &SettingMap::operator= (const SettingMap &other)
+{
+	_values = other._values;
+	updateAccount ();
+	return *this;
+}
+
+SettingMap &SettingMap::operator= (SettingMap &&other)
+{
+	if (this != &other) {
+		_values = std::move (other._values);
+		updateAccount ();
+		other._account.release ();
+	}
+	return *this;
+}
+
+SettingMap::iterator SettingMap::begin ()
+{
+	return _values.begin ();
+}
+
+SettingMap::const_iterator SettingMap::begin () const
+{
+	return _values.begin ();
+}
+
+SettingMap::iterator SettingMap::end ()
+{
+	return _values.end ();
+}
+
+SettingMap::const_iterator SettingMap::end () const
+{
+	return _values.end ();
+}
+
+std::size_t SettingMap::size () const
+{
+	return _values.size ();
+}
+
+bool SettingMap::empty () const
+{
+	return _values.empty ();
+}
+
+void SettingMap::clear ()
+{
+	_values.clear ();
+}
+
+SettingMap::iterator SettingMap::find (const SettingKey &key)
+{
+	auto it = lowerBound (key);
+	if (it != _values.end () && it->first == key)
+		return it;
+	return _values.end ();
+}
+
+SettingMap::const_iterator SettingMap::find (const SettingKey &key) const
+{
+	return const_cast<SettingMap *> (this)->find (key);
+}
+
+SettingMap::iterator SettingMap::find (const std::string &name)
+{
+	auto it = lowerBound (name);
+	if (it != _values.end () && it->first.str () == name)
+		return it;
+	return _values.end ();
+}
+
+SettingMap::const_iterator SettingMap::find (const std::string &name) const
+{
+	return const_cast<SettingMap *> (this)->find (name);
+}
+
+std::size_t SettingMap::count (const SettingKey &key) const
+{
+	return find (key) == _values.end () ? 0 : 1;
+}
+
+Setting &SettingMap::at (const SettingKey &key)
+{
+	auto it = find (key);
+	if (it == _values.end ())
+		throw std::out_of_range ("SettingMap::at");
+	return it->second;
+}
+
+const Setting &SettingMap::at (const SettingKey &key) const
+{
+	return const_cast<SettingMap *> (this)->at (key);
+}
+
+std::pair<SettingMap::iterator, bool> SettingMap::emplace (const SettingKey &key, Setting value)
+{
+	auto it = lowerBound (key);
+	if (it != _values.end () && it->first == key)
+		return { it, false };
+	it = _values.emplace (it, key, std::move (value));
+	updateAccount ();
+	return { it, true };
+}
+
+void SettingMap::set (const SettingKey &key, Setting value)
+{
+	auto it = lowerBound (key);
+	if (it != _values.end () && it->first == key)
+		it->second = std::move (value);
+	else {
+		_values.emplace (it, key, std::move (value));
+		updateAccount ();
+	}
+}
+
+std::size_t SettingMap::erase (const SettingKey &key)
+{
+	auto it = find (key);
+	if (it == _values.end ())
+		return 0;
+	_values.erase (it);
+	return 1;
+}
+
+void SettingMap::updateAccount ()
+{
+	// Heap values of the settings are accounted by Setting
+	if (MemoryAccounting::enabled ())
+		_account.set (_values.capacity () * sizeof (value_type));
+}
+
+SettingMap::iterator SettingMap::lowerBound (const SettingKey &key)
+{
+	return std::lower_bound (_values.begin (), _values.end (), key,
+				 [] (const value_type &value, const SettingKey &key) {
+		return value.first < key;
+	});
+}
+
+SettingMap::iterator SettingMap::lowerBound (const std::string &name)
+{
+	return std::lower_bound (_values.begin (), _values.end (), name,
+				 [] (const value_type &value, const std::string &name) {
+		return value.first.str () < name;
+	});
+}
+
+std::size_t HIDPP::validateSettings (const SettingMap &values,
+				     const std::map<std::string, SettingDesc> &descs,
+				     std::vector<SettingDesc::Issue> &issues)
+{
+	std::size_t count = issues.size ();
+	for (const auto &[key, value]: values) {
+		auto it = descs.find (key.str ());
+		if (it == descs.end ())
+			issues.push_back ({ key.str (), SettingDesc::Error::UnknownSetting });
+		else
+			it->second.validate (value, key.str (), issues);
+	}
+	return issues.size () - count;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_SETTING_MAP_H
+#define LIBHIDPP_HIDPP_SETTING_MAP_H
+
+#include <hidpp/Setting.h>
+#include <misc/MemoryAccounting.h>
+
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * Interned setting name.
+ *
+ * Every name is stored once for the whole program, keys are copied
+ * without allocation and compared for equality without comparing
+ * strings. Keys are ordered like their names.
+ */
+class SettingKey
+{
+public:
+	SettingKey (const std::string &name);
+	SettingKey (const char *name);
+
+	const std::string &str () const;
+	const char *c_str () const;
+	operator const std::string & () const;
+
+	bool operator== (const SettingKey &other) const;
+	bool operator!= (const SettingKey &other) const;
+	bool operator< (const SettingKey &other) const;
+
+private:
+	const std::string *_name;
+};
+
+/**
+ * Settings by name, stored in a vector sorted by name.
+ *
+ * The interface is a subset of std::map. Compared to
+ * std::map<std::string, Setting>, copying a map makes a single
+ * allocation for the whole table (and none for inline setting values,
+ * see Setting), and lookups search contiguous memory.
+ *
+ * Lookups with a std::string are kept for compatibility, they compare
+ * names instead of keys.
+ */
+class SettingMap
+{
+public:
+	typedef std::pair<SettingKey, Setting> value_type;
+	typedef std::vector<value_type>::iterator iterator;
+	typedef std::vector<value_type>::const_iterator const_iterator;
+
+	SettingMap ();
+	SettingMap (std::initializer_list<value_type> values);
+	SettingMap (const SettingMap &other);
+	SettingMap (SettingMap &&other);
+
+	SettingMap &operator= (const SettingMap &other);
+	SettingMap &operator= (SettingMap &&other);
+
+	iterator begin ();
+	const_iterator begin () const;
+	iterator end ();
+	const_iterator end () const;
+
+	std::size_t size () const;
+	bool empty () const;
+	void clear ();
+
+	iterator find (const SettingKey &key);
+	const_iterator find (const SettingKey &key) const;
+	iterator find (const std::string &name);
+	const_iterator find (const std::string &name) const;
+	std::size_t count (const SettingKey &key) const;
+
+	/**
+	 * \throws std::out_of_range if there is no setting for \p key.
+	 */
+	Setting &at (const SettingKey &key);
+	/**
+	 * \throws std::out_of_range if there is no setting for \p key.
+	 */
+	const Setting &at (const SettingKey &key) const;
+
+	/**
+	 * Insert \p value for \p key, unless the map already has a
+	 * setting for \p key.
+	 *
+	 * \returns the setting for \p key and true if \p value was
+	 * inserted.
+	 */
+	std::pair<iterator, bool> emplace (const SettingKey &key, Setting value);
+	/**
+	 * Insert or replace the setting for \p key.
+	 */
+	void set (const SettingKey &key, Setting value);
+	std::size_t erase (const SettingKey &key);
+
+private:
+	iterator lowerBound (const SettingKey &key);
+	iterator lowerBound (const std::string &name);
+	void updateAccount ();
+
+	std::vector<value_type> _values;
+	MemoryAccounting::Account _account;
+};
+
+/**
+ * Check every setting of \p values against \p descs in one pass,
+ * reporting all the invalid and unknown settings.
+ *
+ * \returns the number of issues appended to \p issues.
+ */
+std::size_t validateSettings (const SettingMap &values,
+			      const std::map<std::string, SettingDesc> &descs,
+			      std::vector<SettingDesc::Issue> &issues);
+
+}
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "SimpleDispatcher.h"
 
+#include <hidpp/Subscription.h>
 #include <hidpp10/Error.h>
 #include <hidpp20/Error.h>
 #include <misc/Log.h>
@@ -29,7 +30,7 @@ using namespace HIDPP;
 SimpleDispatcher::SimpleDispatcher (const char *path):
 	_dev (path)
 {
-	checkReportDescriptor (_dev.getReportDescriptor ());
+	checkReportDescriptor (_dev);
 }
 
 SimpleDispatcher::~SimpleDispatcher ()
@@ -41,6 +42,11 @@ const HID::RawDevice &SimpleDispatcher::hidraw () const
 	return _dev;
 }
 
+HID::RawDevice &SimpleDispatcher::hidraw ()
+{
+	return _dev;
+}
+
 uint16_t SimpleDispatcher::vendorID () const
 {
 	return _dev.vendorID ();
@@ -58,12 +64,12 @@ std::string SimpleDispatcher::name () const
 
 void SimpleDispatcher::sendCommandWithoutResponse (const Report &report)
 {
-	_dev.writeReport (report.rawReport ());
+	_dev.writeReport (report.rawData (), report.rawLength ());
 }
 
 std::unique_ptr<Dispatcher::AsyncReport> SimpleDispatcher::sendCommand (Report &&report)
 {
-	_dev.writeReport (report.rawReport ());
+	_dev.writeReport (report.rawData (), report.rawLength ());
 	return std::make_unique<CommandResponse> (this, std::move (report));
 }
 
@@ -77,7 +83,7 @@ void SimpleDispatcher::listen ()
 	auto debug = Log::debug ("dispatcher");
 	try {
 		while (true) {
-			Report report = getReport ();
+			getReport ();
 			debug << "Ignored report while listening for events." << std::endl;
 		}
 	}
@@ -91,14 +97,59 @@ void SimpleDispatcher::stop ()
 	_dev.interruptRead ();
 }
 
+class SimpleDispatcher::EventSubscription: public Subscription
+{
+	SimpleDispatcher *dispatcher;
+public:
+	EventSubscription (SimpleDispatcher *dispatcher, DeviceIndex index, uint8_t sub_id, std::size_t capacity):
+		Subscription (dispatcher, index, sub_id, capacity),
+		dispatcher (dispatcher)
+	{
+	}
+
+	virtual void interrupt ()
+	{
+		Subscription::interrupt ();
+		dispatcher->stop ();
+	}
+
+protected:
+	virtual void wait (std::optional<std::chrono::steady_clock::time_point> deadline)
+	{
+		int timeout = -1;
+		if (deadline)
+			timeout = std::max<int> (0, std::chrono::ceil<std::chrono::milliseconds> (
+					*deadline - std::chrono::steady_clock::now ()).count ());
+		try {
+			// Matching events are queued by the event handler
+			Report report = dispatcher->getReport (timeout);
+			if (report.deviceIndex () != deviceIndex () || report.subID () != subID ())
+				dispatcher->keepUnmatchedReport (std::move (report));
+		}
+		catch (Dispatcher::TimeoutError &e) {
+		}
+	}
+};
+
+std::unique_ptr<Subscription> SimpleDispatcher::subscribe (DeviceIndex index, uint8_t sub_id, std::size_t capacity)
+{
+	return std::make_unique<EventSubscription> (this, index, sub_id, capacity);
+}
+
 Report SimpleDispatcher::getReport (int timeout)
 {
 	while (true) {
-		std::vector<uint8_t> raw_report (MaxReportLength);
-		if (0 == _dev.readReport (raw_report, timeout))
+		std::array<uint8_t, MaxReportLength> raw_report;
+		std::chrono::steady_clock::time_point time;
+		int len = _dev.readReport (raw_report.data (), raw_report.size (), timeout, &time);
+		recordReaderWakeup ();
+		if (len == 0)
 			throw Dispatcher::TimeoutError ();
 		try {
-			HIDPP::Report report (std::move (raw_report));
+			HIDPP::Report report (raw_report.data (), len);
+			report.setReceiveTime (time);
+			report.setSequence (Report::nextSequence ());
+			recordActivity (report.deviceIndex ());
 			if (report.checkErrorMessage10 (nullptr, nullptr, nullptr)) {
 				return report;
 			}
@@ -117,8 +168,29 @@ Report SimpleDispatcher::getReport (int timeout)
 	}
 }
 
+void SimpleDispatcher::keepUnmatchedReport (Report &&report)
+{
+	if (_unmatched_reports.size () == UnmatchedReportCapacity)
+		_unmatched_reports.pop_front ();
+	_unmatched_reports.push_back (std::move (report));
+}
+
+std::optional<Report> SimpleDispatcher::takeUnmatchedReport (DeviceIndex index, uint8_t sub_id)
+{
+	auto it = std::find_if (_unmatched_reports.begin (), _unmatched_reports.end (),
+			[index, sub_id] (const Report &report) {
+				return report.deviceIndex () == index && report.subID () == sub_id;
+			});
+	if (it == _unmatched_reports.end ())
+		return std::nullopt;
+	Report report = std::move (*it);
+	_unmatched_reports.erase (it);
+	return report;
+}
+
 SimpleDispatcher::CommandResponse::CommandResponse (SimpleDispatcher *dispatcher, Report &&report):
-	dispatcher (dispatcher), report (std::move (report))
+	dispatcher (dispatcher), report (std::move (report)),
+	sent (std::chrono::steady_clock::now ())
 {
 }
 
@@ -127,36 +199,61 @@ Report SimpleDispatcher::CommandResponse::get ()
 	return get (-1);
 }
 
+Report SimpleDispatcher::CommandResponse::getResponse (int timeout)
+{
+	try {
+		return dispatcher->getReport (timeout);
+	}
+	catch (Dispatcher::TimeoutError &e) {
+		dispatcher->recordTimeout (report.deviceIndex ());
+		throw;
+	}
+}
+
 Report SimpleDispatcher::CommandResponse::get (int timeout)
 {
 	auto debug = Log::debug ("dispatcher");
+	auto answered = [this] () {
+		dispatcher->recordRoundTrip (report.deviceIndex (), report.subID (), report.address (),
+					     std::chrono::steady_clock::now () - sent);
+	};
 	while (true) {
-		Report response = dispatcher->getReport (timeout);
+		auto response = getResponse (timeout);
 		if (response.deviceIndex () != report.deviceIndex ()) {
 			debug << "Ignored response because of different device index." << std::endl;
+			dispatcher->keepUnmatchedReport (std::move (response));
 			continue;
 		}
 		unsigned int function, swid;
 		uint8_t sub_id, address, feature, error_code;
 		std::vector<uint8_t> error_data;
 		if (response.checkErrorMessage10 (&sub_id, &address, &error_code)) {
-			if (sub_id == report.subID () && address == report.address ())
+			if (sub_id == report.subID () && address == report.address ()) {
+				answered ();
 				throw HIDPP10::Error (error_code);
+			}
 			else {
+				dispatcher->recordUnmatchedAnswer ();
 				debug << "Ignored HID++1.0 error response." << std::endl;
 				continue;
 			}
 		}
 		if (response.checkErrorMessage20 (&feature, &function, &swid, &error_code, &error_data)) {
-			if (feature == report.featureIndex () && function == report.function () && swid == report.softwareID ())
+			if (feature == report.featureIndex () && function == report.function () && swid == report.softwareID ()) {
+				answered ();
 				throw HIDPP20::Error (error_code, std::move(error_data));
+			}
 			else {
+				dispatcher->recordUnmatchedAnswer ();
 				debug << "Ignored HID++2.0 error response." << std::endl;
 				continue;
 			}
 		}
-		if (report.subID () == response.subID () && report.address () == response.address ())
+		if (report.subID () == response.subID () && report.address () == response.address ()) {
+			answered ();
 			return response;
+		}
+		dispatcher->keepUnmatchedReport (std::move (response));
 	}
 }
 
@@ -173,12 +270,15 @@ Report SimpleDispatcher::Notification::get ()
 Report SimpleDispatcher::Notification::get (int timeout)
 {
 	auto debug = Log::debug ("dispatcher");
+	if (auto report = dispatcher->takeUnmatchedReport (index, sub_id))
+		return std::move (*report);
 	while (true) {
 		Report report = dispatcher->getReport (timeout);
 		if (report.deviceIndex () == index && report.subID () == sub_id) {
 			return report;
 		}
 		debug << "Ignored report while waiting for notification." << std::endl;
+		dispatcher->keepUnmatchedReport (std::move (report));
 	}
 }
 
@@ -22,6 +22,8 @@
 #include <hidpp/Dispatcher.h>
 #include <hid/RawDevice.h>
 
+#include <deque>
+
 namespace HIDPP
 {
 
@@ -36,6 +38,11 @@ namespace HIDPP
  * commands or wait for notifications on the same
  * dispatcher.
  *
+ * Reports received while waiting for a command response or another
+ * notification are kept in a small buffer (the last
+ * \ref UnmatchedReportCapacity ones), so that a later notification can
+ * still be matched with a report that arrived before it was requested.
+ *
  * TODO: Fix timeout being reset each time a report is received.
  */
 class SimpleDispatcher: public Dispatcher
@@ -45,26 +52,55 @@ public:
 	~SimpleDispatcher ();
 
 	const HID::RawDevice &hidraw () const;
+	/**
+	 * Access the device for configuring it (e.g.
+	 * HID::RawDevice::setCapture) before using the dispatcher.
+	 */
+	HID::RawDevice &hidraw ();
 
 	virtual uint16_t vendorID () const;
 	virtual uint16_t productID () const;
 	virtual std::string name () const;
 	virtual void sendCommandWithoutResponse (const Report &report);
 	virtual std::unique_ptr<Dispatcher::AsyncReport> sendCommand (Report &&report);
+	using Dispatcher::sendCommand;
 	virtual std::unique_ptr<Dispatcher::AsyncReport> getNotification (DeviceIndex index, uint8_t sub_id);
+	/**
+	 * Subscription::next reads reports from the calling thread, other
+	 * reports read meanwhile are kept for later commands and
+	 * notifications. Interrupting the subscription also stops the
+	 * dispatcher (see \ref stop).
+	 */
+	virtual std::unique_ptr<Subscription> subscribe (DeviceIndex index, uint8_t sub_id,
+							 std::size_t capacity = DefaultSubscriptionCapacity);
 
 	void listen ();
 	void stop ();
 
+	static constexpr std::size_t UnmatchedReportCapacity = 16;
+
 private:
 	Report getReport (int timeout = -1);
+	/**
+	 * Buffer a report that did not match what was waited for, dropping
+	 * the oldest one if the buffer is full.
+	 */
+	void keepUnmatchedReport (Report &&report);
+	/**
+	 * Remove and return the oldest buffered report matching \p index
+	 * and \p sub_id.
+	 */
+	std::optional<Report> takeUnmatchedReport (DeviceIndex index, uint8_t sub_id);
 
 	HID::RawDevice _dev;
+	std::deque<Report> _unmatched_reports;
 
 	class CommandResponse: public Dispatcher::AsyncReport
 	{
 		SimpleDispatcher *dispatcher;
 		Report report;
+		std::chrono::steady_clock::time_point sent;
+		Report getResponse (int timeout);
 	public:
 		CommandResponse (SimpleDispatcher *, Report &&);
 		virtual Report get ();
@@ -82,6 +118,8 @@ private:
 		virtual Report get (int timeout);
 	};
 	friend Notification;
+	class EventSubscription;
+	friend EventSubscription;
 };
 
 }
@@ -0,0 +1,753 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "SimulatedReceiver.h"
+
+#include <hidpp10/defs.h>
+#include <hidpp10/Error.h>
+#include <hidpp20/Error.h>
+#include <misc/Endian.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+using namespace HIDPP;
+
+namespace
+{
+
+constexpr uint8_t DevicePairingInfo = 0xB5;
+constexpr uint8_t PairingInfo = 0x20;
+constexpr uint8_t DeviceName = 0x40;
+constexpr uint8_t FakeDeviceArrival = 0x02;
+constexpr uint8_t UnifyingProtocol = 0x04;
+
+// Feature table of every paired device
+constexpr uint16_t DeviceFeatures[] = {
+	0x0000, // IRoot
+	0x0001, // IFeatureSet
+	0x8100, // IOnboardProfiles
+	0x1000, // IBatteryLevelStatus (events and GetBatteryLevelStatus)
+	0x1b04, // IReprogControlsV4 (events, controls and reporting)
+	0x6100, // ITouchpadRawXY (events only)
+	0x8110, // IMouseButtonSpy (events, count, start and stop)
+	0x2201, // IAdjustableDPI (one sensor)
+};
+constexpr unsigned int FeatureCount = sizeof (DeviceFeatures) / sizeof (DeviceFeatures[0]);
+enum FeatureIndex: uint8_t {
+	RootIndex = 0,
+	FeatureSetIndex = 1,
+	OnboardProfilesIndex = 2,
+	BatteryIndex = 3,
+	ReprogControlsIndex = 4,
+	TouchpadIndex = 5,
+	MouseButtonSpyIndex = 6,
+	AdjustableDPIIndex = 7,
+};
+
+constexpr std::size_t LineSize = 16;
+constexpr uint8_t WriteableMemory = 0;
+constexpr uint8_t ROM = 1;
+
+// Mouse button controls of IReprogControlsV4, with their task IDs
+constexpr std::pair<uint16_t, uint16_t> Controls[] = {
+	{ 0x0050, 0x0038 }, // left
+	{ 0x0051, 0x0039 }, // right
+	{ 0x0052, 0x003a }, // middle
+	{ 0x0053, 0x003c }, // back
+	{ 0x0056, 0x003e }, // forward
+};
+constexpr unsigned int ControlCount = sizeof (Controls) / sizeof (Controls[0]);
+
+constexpr uint16_t MinDPI = 200, MaxDPI = 8000, DPIStep = 50, DefaultDPI = 1000;
+
+std::string deviceName (unsigned int n)
+{
+	return "Sim Device " + std::to_string (n+1);
+}
+
+// Legacy HID++ collection for the reports of the given type
+HID::ReportCollection hidppCollection (Report::Type type)
+{
+	// The usage is the report flag of Dispatcher::ReportInfo
+	unsigned int flag = type == Report::Short ? 1 : type == Report::Long ? 2 : 4;
+	HID::Usage usage (0xFF00, flag);
+	HID::ReportField field;
+	field.flags.bits = 0; // Data, Array
+	field.count = Report::reportLength (type) - 1;
+	field.size = 8;
+	field.usages = std::vector<HID::Usage> { usage };
+	HID::ReportCollection collection;
+	collection.type = HID::ReportCollection::Type::Application;
+	collection.usage = usage;
+	auto id = static_cast<unsigned int> (type);
+	collection.reports.emplace (HID::ReportID { HID::ReportID::Type::Input, id },
+				    std::vector<HID::ReportField> { field });
+	collection.reports.emplace (HID::ReportID { HID::ReportID::Type::Output, id },
+				    std::vector<HID::ReportField> { field });
+	return collection;
+}
+
+}
+
+SimulatedReceiver::SimulatedReceiver ():
+	SimulatedReceiver (Config ())
+{
+}
+
+SimulatedReceiver::SimulatedReceiver (const Config &config):
+	_config (config),
+	_last_delivery (clock::now ()),
+	_next_event (_last_delivery + config.event_interval),
+	_next_disconnect (_last_delivery + config.disconnect_interval),
+	_interrupted (false),
+	_random (config.seed)
+{
+	if (_config.device_count > 6)
+		throw std::invalid_argument ("A receiver cannot have more than 6 devices");
+	if (_config.sector_size < LineSize || _config.sector_size > 0xFFFF)
+		throw std::invalid_argument ("Invalid sector size");
+	std::size_t memory_size = _config.sector_count * _config.sector_size;
+	for (unsigned int i = 0; i < _config.device_count; ++i) {
+		PairedDevice dev;
+		dev.rom.resize (memory_size);
+		for (std::size_t j = 0; j < memory_size; ++j)
+			dev.rom[j] = static_cast<uint8_t> (j / _config.sector_size + j);
+		dev.writeable.assign (memory_size, 0xFF);
+		dev.mode = 0;
+		dev.profile_mem = WriteableMemory;
+		dev.profile_page = 1;
+		dev.dpi_index = 0;
+		dev.write_offset = dev.write_end = 0;
+		dev.linked = !(_config.disconnected & 1 << i);
+		dev.relink_time = clock::time_point::max ();
+		dev.event_count = 0;
+		dev.diverted_control = 0;
+		dev.spying_buttons = false;
+		dev.dpi = DefaultDPI;
+		_devices.push_back (std::move (dev));
+	}
+}
+
+SimulatedReceiver::~SimulatedReceiver ()
+{
+}
+
+SimulatedReceiver::Config SimulatedReceiver::parseConfig (const std::string &args)
+{
+	Config config;
+	std::istringstream ss (args);
+	std::string item;
+	while (std::getline (ss, item, ',')) {
+		if (item.empty ())
+			continue;
+		auto sep = item.find ('=');
+		if (sep == std::string::npos)
+			throw std::invalid_argument ("Missing value for simulator option " + item);
+		auto key = item.substr (0, sep);
+		unsigned long value = std::stoul (item.substr (sep+1));
+		if (key == "devices")
+			config.device_count = value;
+		else if (key == "disconnected")
+			config.disconnected = value;
+		else if (key == "latency")
+			config.latency = std::chrono::microseconds (value);
+		else if (key == "jitter")
+			config.jitter = std::chrono::microseconds (value);
+		else if (key == "seed")
+			config.seed = value;
+		else if (key == "sectors")
+			config.sector_count = value;
+		else if (key == "sector_size")
+			config.sector_size = value;
+		else if (key == "events")
+			config.event_interval = std::chrono::microseconds (value);
+		else if (key == "drop")
+			config.drop_rate = value;
+		else if (key == "spike")
+			config.spike_rate = value;
+		else if (key == "spike_latency")
+			config.spike_latency = std::chrono::microseconds (value);
+		else if (key == "sleep")
+			config.sleep_rate = value;
+		else if (key == "sleep_time")
+			config.sleep_time = std::chrono::microseconds (value);
+		else if (key == "disconnects")
+			config.disconnect_interval = std::chrono::microseconds (value);
+		else if (key == "disconnect_time")
+			config.disconnect_time = std::chrono::microseconds (value);
+		else
+			throw std::invalid_argument ("Unknown simulator option " + key);
+	}
+	return config;
+}
+
+void SimulatedReceiver::registerScheme ()
+{
+	HID::VirtualDevice::registerScheme ("sim", [] (const std::string &args) {
+		return std::make_shared<SimulatedReceiver> (parseConfig (args));
+	});
+}
+
+static const bool sim_scheme_registered = (SimulatedReceiver::registerScheme (), true);
+
+uint16_t SimulatedReceiver::vendorID () const
+{
+	return 0x046d;
+}
+
+uint16_t SimulatedReceiver::productID () const
+{
+	return 0xc52b;
+}
+
+std::string SimulatedReceiver::name () const
+{
+	return "Simulated Receiver";
+}
+
+HID::ReportDescriptor SimulatedReceiver::reportDescriptor () const
+{
+	return hidppReportDescriptor ();
+}
+
+HID::ReportDescriptor SimulatedReceiver::hidppReportDescriptor ()
+{
+	return hidppReportDescriptor ({ Report::Short, Report::Long });
+}
+
+HID::ReportDescriptor SimulatedReceiver::hidppReportDescriptor (const std::vector<Report::Type> &types)
+{
+	HID::ReportDescriptor rdesc;
+	for (auto type: types)
+		rdesc.collections.push_back (hidppCollection (type));
+	return rdesc;
+}
+
+int SimulatedReceiver::writeReport (const uint8_t *report, std::size_t length)
+{
+	Report request (report, length);
+	std::unique_lock<std::mutex> lock (_mutex);
+	answer (request);
+	return length;
+}
+
+int SimulatedReceiver::readReport (uint8_t *report, std::size_t length, int timeout)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto deadline = timeout < 0
+		? clock::time_point::max ()
+		: clock::now () + std::chrono::milliseconds (timeout);
+	while (true) {
+		if (_interrupted) {
+			_interrupted = false;
+			return 0;
+		}
+		auto now = clock::now ();
+		generate (now);
+		// Deliver answers and events in time order
+		auto *queue = &_reports;
+		if (_reports.empty () || (!_events.empty () &&
+				_events.front ().time < _reports.front ().time))
+			queue = &_events;
+		if (!queue->empty () && queue->front ().time <= now) {
+			auto raw = queue->front ().report.rawReport ();
+			queue->pop_front ();
+			length = std::min (length, raw.size ());
+			std::copy_n (raw.begin (), length, report);
+			return length;
+		}
+		if (now >= deadline)
+			return 0;
+		auto wake = std::min (deadline, nextGeneration ());
+		if (!queue->empty ())
+			wake = std::min (wake, queue->front ().time);
+		if (wake == clock::time_point::max ())
+			_cond.wait (lock);
+		else
+			_cond.wait_until (lock, wake);
+	}
+}
+
+void SimulatedReceiver::interruptRead ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_interrupted = true;
+	_cond.notify_all ();
+}
+
+static Report error10 (const Report &request, uint8_t error_code)
+{
+	Report report (Report::Short, request.deviceIndex (),
+		       HIDPP10::ErrorMessage, request.subID ());
+	report.parameterBegin ()[0] = request.address ();
+	report.parameterBegin ()[1] = error_code;
+	return report;
+}
+
+static Report error20 (const Report &request, uint8_t error_code)
+{
+	// Same layout as HID++ 1.0 errors with a different sub ID.
+	Report report (Report::Long, request.deviceIndex (),
+		       0xFF, request.featureIndex ());
+	report.parameterBegin ()[0] = request.function () << 4 | request.softwareID ();
+	report.parameterBegin ()[1] = error_code;
+	return report;
+}
+
+void SimulatedReceiver::answer (const Report &request)
+{
+	auto index = request.deviceIndex ();
+	if (index == DefaultDevice)
+		answerReceiver (request);
+	else if (index >= WirelessDevice1 && index <= WirelessDevice6) {
+		unsigned int n = index - WirelessDevice1;
+		if (n >= _devices.size ()) {
+			queueReport (error10 (request, HIDPP10::Error::UnknownDevice));
+			return;
+		}
+		auto &dev = _devices[n];
+		if (!dev.linked) {
+			queueReport (error10 (request, HIDPP10::Error::ResourceError));
+			return;
+		}
+		// Sleeping devices and dropped answers let the request time out.
+		auto now = clock::now ();
+		if (now < dev.asleep_until)
+			return;
+		if (chance (_config.sleep_rate)) {
+			dev.asleep_until = now + _config.sleep_time;
+			return;
+		}
+		if (chance (_config.drop_rate))
+			return;
+		answerDevice (dev, request);
+	}
+	// Nothing answers on other indices, the request will time out.
+}
+
+void SimulatedReceiver::answerReceiver (const Report &request)
+{
+	if (request.subID () == HIDPP10::SetRegisterShort &&
+			request.address () == HIDPP10::ConnectionState) {
+		if (request.parameterBegin ()[0] != FakeDeviceArrival) {
+			queueReport (error10 (request, HIDPP10::Error::InvalidValue));
+			return;
+		}
+		queueReport (Report (Report::Short, DefaultDevice,
+				     HIDPP10::SetRegisterShort, HIDPP10::ConnectionState));
+		for (unsigned int n = 0; n < _devices.size (); ++n)
+			queueReport (connectionNotification (n));
+		return;
+	}
+	if (request.subID () != HIDPP10::GetRegisterLong) {
+		queueReport (error10 (request, HIDPP10::Error::InvalidSubID));
+		return;
+	}
+	if (request.address () != DevicePairingInfo) {
+		queueReport (error10 (request, HIDPP10::Error::InvalidAddress));
+		return;
+	}
+	uint8_t param = request.parameterBegin ()[0];
+	unsigned int n = param & 0x0F;
+	if (n >= _devices.size () || ((param & 0xF0) != PairingInfo && (param & 0xF0) != DeviceName)) {
+		queueReport (error10 (request, HIDPP10::Error::InvalidValue));
+		return;
+	}
+	Report report (Report::Long, DefaultDevice, HIDPP10::GetRegisterLong, DevicePairingInfo);
+	auto results = report.parameterBegin ();
+	results[0] = param;
+	if ((param & 0xF0) == PairingInfo) {
+		results[1] = n+1; // destination id
+		results[2] = 8; // report interval
+		writeBE<uint16_t> (results+3, 0x4000 + n); // wireless PID
+		results[7] = 2; // mouse
+	}
+	else {
+		auto name = deviceName (n);
+		std::size_t length = std::min (name.size (), LongParamLength - 2);
+		results[1] = length;
+		std::copy_n (name.begin (), length, results+2);
+	}
+	queueReport (std::move (report));
+}
+
+void SimulatedReceiver::answerDevice (PairedDevice &dev, const Report &request)
+{
+	auto feature = request.featureIndex ();
+	auto function = request.function ();
+	if (feature >= FeatureCount) {
+		queueReport (error20 (request, HIDPP20::Error::InvalidFeatureIndex));
+		return;
+	}
+	Report report (Report::Long, request.deviceIndex (), feature,
+		       function, request.softwareID ());
+	const uint8_t *params = request.parameterBegin ();
+	uint8_t *results = report.parameterBegin ();
+	auto memory = [this, &dev, params] () -> std::vector<uint8_t> * {
+		auto &mem = params[0] == ROM ? dev.rom : dev.writeable;
+		if (params[0] > ROM || params[1] >= _config.sector_count)
+			return nullptr;
+		return &mem;
+	};
+	auto address = [this, params] () -> std::size_t {
+		return params[1] * _config.sector_size + readBE<uint16_t> (params+2);
+	};
+	uint8_t error = HIDPP20::Error::NoError;
+	switch (feature) {
+	case RootIndex:
+		switch (function) {
+		case 0: { // GetFeature
+			uint16_t id = readBE<uint16_t> (params);
+			auto it = std::find (std::begin (DeviceFeatures), std::end (DeviceFeatures), id);
+			results[0] = it == std::end (DeviceFeatures) ? 0 : it - std::begin (DeviceFeatures);
+			break;
+		}
+		case 1: // Ping
+			results[0] = 4;
+			results[1] = 2;
+			results[2] = params[2];
+			break;
+		default:
+			error = HIDPP20::Error::InvalidFunctionID;
+		}
+		break;
+	case FeatureSetIndex:
+		switch (function) {
+		case 0: // GetCount
+			results[0] = FeatureCount - 1;
+			break;
+		case 1: // GetFeatureID
+			if (params[0] < FeatureCount)
+				writeBE<uint16_t> (results, DeviceFeatures[params[0]]);
+			else
+				error = HIDPP20::Error::InvalidArgument;
+			break;
+		default:
+			error = HIDPP20::Error::InvalidFunctionID;
+		}
+		break;
+	case OnboardProfilesIndex:
+		switch (function) {
+		case 0: // GetDescription
+			results[0] = 1; // memory model
+			results[1] = 1; // profile format
+			results[2] = 1; // macro format
+			results[3] = 1; // profile count
+			results[4] = 1; // profile count OOB
+			results[5] = 8; // button count
+			results[6] = _config.sector_count;
+			writeBE<uint16_t> (results+7, _config.sector_size);
+			break;
+		case 1: // SetMode
+			dev.mode = params[0];
+			break;
+		case 2: // GetMode
+			results[0] = dev.mode;
+			break;
+		case 3: // SetCurrentProfile
+			if (dev.mode != 1 || params[0] > 1 || params[1] == 0 ||
+					params[1] >= _config.sector_count)
+				error = HIDPP20::Error::InvalidArgument;
+			else {
+				dev.profile_mem = params[0];
+				dev.profile_page = params[1];
+				dev.dpi_index = 0;
+			}
+			break;
+		case 4: // GetCurrentProfile
+			results[0] = dev.profile_mem;
+			results[1] = dev.profile_page;
+			break;
+		case 5: { // MemoryRead
+			auto mem = memory ();
+			std::size_t offset = readBE<uint16_t> (params+2);
+			if (!mem || offset + LineSize > _config.sector_size)
+				error = HIDPP20::Error::InvalidArgument;
+			else
+				std::copy_n (mem->begin () + address (), LineSize, results);
+			break;
+		}
+		case 6: { // MemoryAddrWrite
+			std::size_t offset = readBE<uint16_t> (params+2);
+			std::size_t length = readBE<uint16_t> (params+4);
+			if (params[0] != WriteableMemory || !memory () ||
+					offset + length > _config.sector_size)
+				error = HIDPP20::Error::InvalidArgument;
+			else {
+				dev.write_offset = address ();
+				dev.write_end = dev.write_offset + length;
+			}
+			break;
+		}
+		case 7: { // MemoryWrite
+			if (dev.write_offset >= dev.write_end) {
+				error = HIDPP20::Error::InvalidArgument;
+				break;
+			}
+			std::size_t length = std::min (LineSize, dev.write_end - dev.write_offset);
+			std::copy_n (params, length, dev.writeable.begin () + dev.write_offset);
+			dev.write_offset += length;
+			break;
+		}
+		case 8: // MemoryWriteEnd
+			dev.write_offset = dev.write_end = 0;
+			break;
+		case 11: // GetCurrentDPIIndex
+			results[0] = dev.dpi_index;
+			break;
+		case 12: // SetCurrentDPIIndex
+			if (dev.mode != 1 || params[0] >= 5)
+				error = HIDPP20::Error::InvalidArgument;
+			else
+				dev.dpi_index = params[0];
+			break;
+		default:
+			error = HIDPP20::Error::InvalidFunctionID;
+		}
+		break;
+	case BatteryIndex:
+		if (function == 0) { // GetBatteryLevelStatus
+			results[0] = 100 - dev.event_count % 100;
+			results[1] = 0;
+			results[2] = 0; // discharging
+		}
+		else
+			error = HIDPP20::Error::InvalidFunctionID;
+		break;
+	case ReprogControlsIndex:
+		switch (function) {
+		case 0: // GetControlCount
+			results[0] = ControlCount;
+			break;
+		case 1: // GetControlInfo
+			if (params[0] >= ControlCount) {
+				error = HIDPP20::Error::InvalidArgument;
+				break;
+			}
+			writeBE<uint16_t> (results, Controls[params[0]].first);
+			writeBE<uint16_t> (results+2, Controls[params[0]].second);
+			results[4] = 0x31; // MouseButton, ReprogHint, TemporaryDivertable
+			break;
+		case 2: { // GetControlReporting
+			uint16_t control_id = readBE<uint16_t> (params);
+			std::copy (params, params+2, results);
+			results[2] = dev.diverted_control == control_id ? 0x01 : 0x00;
+			break;
+		}
+		case 3: { // SetControlReporting
+			// Only the last temporarily diverted control is remembered
+			uint16_t control_id = readBE<uint16_t> (params);
+			if (params[2] & 0x02) { // ChangeTemporaryDivert
+				if (params[2] & 0x01)
+					dev.diverted_control = control_id;
+				else if (dev.diverted_control == control_id)
+					dev.diverted_control = 0;
+			}
+			std::copy (params, params+5, results);
+			break;
+		}
+		default:
+			error = HIDPP20::Error::InvalidFunctionID;
+		}
+		break;
+	case MouseButtonSpyIndex:
+		switch (function) {
+		case 0: // GetMouseButtonCount
+			results[0] = 16;
+			break;
+		case 1: // StartMouseButtonSpy
+		case 2: // StopMouseButtonSpy
+			dev.spying_buttons = function == 1;
+			break;
+		default:
+			error = HIDPP20::Error::InvalidFunctionID;
+		}
+		break;
+	case AdjustableDPIIndex:
+		if (function != 0 && params[0] != 0) {
+			error = HIDPP20::Error::InvalidArgument;
+			break;
+		}
+		switch (function) {
+		case 0: // GetSensorCount
+			results[0] = 1;
+			break;
+		case 1: // GetSensorDPIList (range)
+			writeBE<uint16_t> (results+1, MinDPI);
+			writeBE<uint16_t> (results+3, 0xe000 + DPIStep);
+			writeBE<uint16_t> (results+5, MaxDPI);
+			break;
+		case 2: // GetSensorDPI
+			writeBE<uint16_t> (results+1, dev.dpi);
+			writeBE<uint16_t> (results+3, DefaultDPI);
+			break;
+		case 3: { // SetSensorDPI
+			uint16_t dpi = readBE<uint16_t> (params+1);
+			if (dpi < MinDPI || dpi > MaxDPI || (dpi - MinDPI) % DPIStep)
+				error = HIDPP20::Error::InvalidArgument;
+			else
+				dev.dpi = dpi;
+			std::copy (params, params+3, results);
+			break;
+		}
+		default:
+			error = HIDPP20::Error::InvalidFunctionID;
+		}
+		break;
+	default:
+		error = HIDPP20::Error::InvalidFunctionID;
+	}
+	if (error != HIDPP20::Error::NoError)
+		queueReport (error20 (request, error));
+	else
+		queueReport (std::move (report));
+}
+
+void SimulatedReceiver::queueReport (Report &&report)
+{
+	auto delay = _config.latency;
+	if (_config.jitter.count () > 0) {
+		std::uniform_int_distribution<std::chrono::microseconds::rep> jitter (0, _config.jitter.count ());
+		delay += std::chrono::microseconds (jitter (_random));
+	}
+	if (chance (_config.spike_rate))
+		delay += _config.spike_latency;
+	// Answers are never reordered.
+	_last_delivery = std::max (_last_delivery, clock::now () + delay);
+	_reports.push_back ({ _last_delivery, std::move (report) });
+	_cond.notify_all ();
+}
+
+bool SimulatedReceiver::chance (unsigned int per_mille)
+{
+	if (per_mille == 0)
+		return false;
+	return std::uniform_int_distribution<unsigned int> (0, 999) (_random) < per_mille;
+}
+
+Report SimulatedReceiver::connectionNotification (unsigned int n) const
+{
+	Report report (Report::Short, static_cast<DeviceIndex> (WirelessDevice1 + n),
+		       HIDPP10::DeviceConnection, UnifyingProtocol);
+	auto params = report.parameterBegin ();
+	params[0] = 2; // mouse
+	if (!_devices[n].linked)
+		params[0] |= 0x40; // link not established
+	writeLE<uint16_t> (params+1, 0x4000 + n);
+	return report;
+}
+
+Report SimulatedReceiver::deviceEvent (unsigned int n)
+{
+	auto index = static_cast<DeviceIndex> (WirelessDevice1 + n);
+	auto count = _devices[n].event_count++;
+	switch (count % 3) {
+	case 0: {
+		Report report (Report::Short, index, BatteryIndex, 0, 0); // BatteryLevelEvent
+		auto params = report.parameterBegin ();
+		params[0] = 100 - count % 100;
+		params[1] = 0;
+		params[2] = 0; // discharging
+		return report;
+	}
+	case 1: {
+		if (_devices[n].spying_buttons) {
+			// Alternate the first button and the first and third buttons
+			Report report (Report::Long, index, MouseButtonSpyIndex, 0, 0); // MouseButtonEvent
+			writeBE<uint16_t> (report.parameterBegin (), count % 2 ? 0x0005 : 0x0001);
+			return report;
+		}
+		if (auto control_id = _devices[n].diverted_control) {
+			// Alternate presses and releases of the diverted control
+			Report report (Report::Long, index, ReprogControlsIndex, 0, 0); // DivertedButtonEvent
+			if (count % 2)
+				writeBE<uint16_t> (report.parameterBegin (), control_id);
+			return report;
+		}
+		Report report (Report::Long, index, ReprogControlsIndex, 1, 0); // DivertedRawXYEvent
+		auto params = report.parameterBegin ();
+		writeBE<int16_t> (params, count % 2 ? 1 : -1);
+		writeBE<int16_t> (params+2, count % 4 < 2 ? 1 : -1);
+		return report;
+	}
+	default: {
+		Report report (Report::Long, index, TouchpadIndex, 0, 0); // TouchpadRawEvent
+		auto params = report.parameterBegin ();
+		writeBE<uint16_t> (params, count); // timestamp
+		params[2] = 1; // one finger
+		writeBE<uint16_t> (params+3, count % 1000); // x
+		writeBE<uint16_t> (params+5, 500); // y
+		return report;
+	}
+	}
+}
+
+void SimulatedReceiver::generate (clock::time_point now)
+{
+	if (_config.event_interval.count () > 0) {
+		// A slow reader loses events instead of accumulating them, as
+		// with real devices.
+		if (now - _next_event > 64 * _config.event_interval)
+			_next_event = now;
+		for (; _next_event <= now; _next_event += _config.event_interval) {
+			for (unsigned int n = 0; n < _devices.size (); ++n) {
+				auto &dev = _devices[n];
+				if (dev.linked && _next_event >= dev.asleep_until)
+					_events.push_back ({ _next_event, deviceEvent (n) });
+			}
+		}
+	}
+	if (_config.disconnect_interval.count () > 0 && _next_disconnect <= now) {
+		_next_disconnect = now + _config.disconnect_interval;
+		std::vector<unsigned int> linked;
+		for (unsigned int n = 0; n < _devices.size (); ++n)
+			if (_devices[n].linked)
+				linked.push_back (n);
+		if (!linked.empty ()) {
+			std::uniform_int_distribution<std::size_t> pick (0, linked.size () - 1);
+			auto n = linked[pick (_random)];
+			_devices[n].linked = false;
+			_devices[n].relink_time = now + _config.disconnect_time;
+			_events.push_back ({ now, connectionNotification (n) });
+		}
+	}
+	for (unsigned int n = 0; n < _devices.size (); ++n) {
+		auto &dev = _devices[n];
+		if (!dev.linked && dev.relink_time <= now) {
+			dev.linked = true;
+			dev.relink_time = clock::time_point::max ();
+			_events.push_back ({ now, connectionNotification (n) });
+		}
+	}
+}
+
+SimulatedReceiver::clock::time_point SimulatedReceiver::nextGeneration () const
+{
+	auto next = clock::time_point::max ();
+	if (_config.event_interval.count () > 0)
+		next = std::min (next, _next_event);
+	if (_config.disconnect_interval.count () > 0)
+		next = std::min (next, _next_disconnect);
+	for (const auto &dev: _devices)
+		next = std::min (next, dev.relink_time);
+	return next;
+}
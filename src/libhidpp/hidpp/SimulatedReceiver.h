@@ -0,0 +1,168 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_SIMULATED_RECEIVER_H
+#define LIBHIDPP_HIDPP_SIMULATED_RECEIVER_H
+
+#include <hid/VirtualDevice.h>
+#include <hidpp/Report.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * Simulated receiver with paired HID++ 2.0 devices, for testing and
+ * benchmarking dispatchers and tools without hardware.
+ *
+ * The receiver answers the HID++ 1.0 pairing information register
+ * (enough for HIDPP::Device), sends connection notifications when asked
+ * with the connection state register, and errors for everything else. Paired
+ * devices implement IRoot, IFeatureSet and IOnboardProfiles with
+ * in-memory ROM and writeable sectors, IReprogControlsV4 with five
+ * mouse buttons and IAdjustableDPI with a single sensor.
+ *
+ * Answers are delivered after the configured latency plus a random
+ * jitter, in request order. The jitter generator is seeded so runs are
+ * reproducible.
+ *
+ * For load and soak testing, connected devices can also send events
+ * periodically (battery, diverted XY and touchpad frames, in turn), and
+ * faults can be injected: dropped answers, latency spikes, devices
+ * falling asleep (not answering for a while) and temporary link losses.
+ *
+ * The "sim" scheme is registered when libhidpp is loaded, so that paths
+ * like "sim:devices=2,latency=2000" can be passed to any tool (see \ref
+ * parseConfig). Static builds must call \ref registerScheme.
+ */
+class SimulatedReceiver: public HID::VirtualDevice
+{
+public:
+	struct Config
+	{
+		unsigned int device_count = 1; ///< Paired devices, at most 6
+		unsigned int disconnected = 0; ///< Bitmap of paired devices without link
+		std::chrono::microseconds latency {1000};
+		std::chrono::microseconds jitter {0}; ///< Maximum random delay added to latency
+		unsigned int seed = 0;
+		unsigned int sector_count = 4; ///< Sectors in each memory type
+		unsigned int sector_size = 256;
+		/// Period of the events of each connected device, 0 for no events
+		std::chrono::microseconds event_interval {0};
+		unsigned int drop_rate = 0; ///< Per mille of device requests left unanswered
+		unsigned int spike_rate = 0; ///< Per mille of answers delayed by spike_latency
+		std::chrono::microseconds spike_latency {100000};
+		unsigned int sleep_rate = 0; ///< Per mille of device requests putting it to sleep
+		std::chrono::microseconds sleep_time {1000000};
+		/// Time between link losses of a random device, 0 for none
+		std::chrono::microseconds disconnect_interval {0};
+		std::chrono::microseconds disconnect_time {1000000};
+	};
+
+	SimulatedReceiver ();
+	SimulatedReceiver (const Config &config);
+	virtual ~SimulatedReceiver ();
+
+	/**
+	 * Parse a comma-separated list of key=value: devices, disconnected,
+	 * latency and jitter (in microseconds), seed, sectors, sector_size,
+	 * events (interval in microseconds), drop, spike and sleep (per
+	 * mille), spike_latency and sleep_time (in microseconds),
+	 * disconnects and disconnect_time (in microseconds).
+	 *
+	 * \throws std::invalid_argument
+	 */
+	static Config parseConfig (const std::string &args);
+	/**
+	 * Register the "sim" virtual device scheme.
+	 */
+	static void registerScheme ();
+	/**
+	 * Report descriptor with the legacy HID++ short and long report
+	 * collections, as found on receivers.
+	 */
+	static HID::ReportDescriptor hidppReportDescriptor ();
+	/**
+	 * Report descriptor with a legacy HID++ collection for each report
+	 * type in \p types.
+	 */
+	static HID::ReportDescriptor hidppReportDescriptor (const std::vector<Report::Type> &types);
+
+	virtual uint16_t vendorID () const;
+	virtual uint16_t productID () const;
+	virtual std::string name () const;
+	virtual HID::ReportDescriptor reportDescriptor () const;
+	virtual int writeReport (const uint8_t *report, std::size_t length);
+	virtual int readReport (uint8_t *report, std::size_t length, int timeout);
+	virtual void interruptRead ();
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	struct PairedDevice
+	{
+		std::vector<uint8_t> rom, writeable;
+		uint8_t mode;
+		uint8_t profile_mem, profile_page, dpi_index; // onboard mode only
+		std::size_t write_offset, write_end;
+		bool linked;
+		clock::time_point relink_time; // max for devices never linked
+		clock::time_point asleep_until;
+		unsigned int event_count;
+		uint16_t diverted_control; // 0 if none
+		bool spying_buttons;
+		uint16_t dpi;
+	};
+
+	void answer (const Report &request);
+	void answerReceiver (const Report &request);
+	void answerDevice (PairedDevice &dev, const Report &request);
+	void queueReport (Report &&report);
+	bool chance (unsigned int per_mille);
+	Report connectionNotification (unsigned int n) const;
+	Report deviceEvent (unsigned int n);
+	// Queue the events and link changes due at \p now.
+	void generate (clock::time_point now);
+	clock::time_point nextGeneration () const;
+
+	Config _config;
+	std::vector<PairedDevice> _devices;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	struct PendingReport
+	{
+		clock::time_point time;
+		Report report;
+	};
+	std::deque<PendingReport> _reports;
+	std::deque<PendingReport> _events; // generated, not answers
+	clock::time_point _last_delivery;
+	clock::time_point _next_event, _next_disconnect;
+	bool _interrupted;
+	std::mt19937 _random;
+};
+
+}
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Subscription.h"
+
+#include <stdexcept>
+
+using namespace HIDPP;
+
+Subscription::Subscription (Dispatcher *dispatcher, DeviceIndex index, uint8_t sub_id,
+			    std::size_t capacity):
+	_dispatcher (dispatcher),
+	_index (index),
+	_sub_id (sub_id),
+	_ring (std::make_unique<std::optional<Report>[]> (capacity)),
+	_capacity (capacity),
+	_head (0), _tail (0),
+	_dropped (0),
+	_waiting (false), _interrupted (false)
+{
+	if (capacity == 0)
+		throw std::invalid_argument ("subscription capacity must not be zero");
+	_listener = _dispatcher->registerEventHandler (index, sub_id, [this] (const Report &report) {
+		return push (report);
+	});
+}
+
+Subscription::~Subscription ()
+{
+	_dispatcher->unregisterEventHandler (_listener);
+}
+
+DeviceIndex Subscription::deviceIndex () const noexcept
+{
+	return _index;
+}
+
+uint8_t Subscription::subID () const noexcept
+{
+	return _sub_id;
+}
+
+std::optional<Report> Subscription::tryNext ()
+{
+	auto head = _head.load (std::memory_order_relaxed);
+	if (head == _tail.load (std::memory_order_acquire))
+		return std::nullopt;
+	auto &slot = _ring[head % _capacity];
+	std::optional<Report> report = std::move (slot);
+	slot.reset ();
+	_head.store (head+1, std::memory_order_release);
+	return report;
+}
+
+std::optional<Report> Subscription::next (int timeout)
+{
+	std::optional<std::chrono::steady_clock::time_point> deadline;
+	if (timeout >= 0)
+		deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeout);
+	while (true) {
+		if (auto report = tryNext ())
+			return report;
+		if (_interrupted)
+			return std::nullopt;
+		if (deadline && std::chrono::steady_clock::now () >= *deadline)
+			return std::nullopt;
+		wait (deadline);
+	}
+}
+
+void Subscription::interrupt ()
+{
+	_interrupted = true;
+	std::unique_lock<std::mutex> lock (_mutex);
+	_cond.notify_all ();
+}
+
+void Subscription::resetInterruption ()
+{
+	_interrupted = false;
+}
+
+uint64_t Subscription::dropped () const noexcept
+{
+	return _dropped.load (std::memory_order_relaxed);
+}
+
+Dispatcher *Subscription::dispatcher () const noexcept
+{
+	return _dispatcher;
+}
+
+bool Subscription::empty () const noexcept
+{
+	return _head.load (std::memory_order_relaxed) == _tail.load (std::memory_order_seq_cst);
+}
+
+void Subscription::wait (std::optional<std::chrono::steady_clock::time_point> deadline)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	// The handler checks _waiting after publishing an event, and this
+	// checks the queue after setting it: one of them sees the other.
+	_waiting = true;
+	if (empty () && !_interrupted) {
+		if (deadline)
+			_cond.wait_until (lock, *deadline);
+		else
+			_cond.wait (lock);
+	}
+	_waiting = false;
+}
+
+bool Subscription::push (const Report &report)
+{
+	auto tail = _tail.load (std::memory_order_relaxed);
+	if (tail - _head.load (std::memory_order_acquire) == _capacity) {
+		_dropped.fetch_add (1, std::memory_order_relaxed);
+		return true;
+	}
+	_ring[tail % _capacity] = report;
+	_tail.store (tail+1, std::memory_order_seq_cst);
+	if (_waiting) {
+		std::unique_lock<std::mutex> lock (_mutex);
+		_cond.notify_one ();
+	}
+	return true;
+}
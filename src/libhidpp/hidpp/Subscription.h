@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_SUBSCRIPTION_H
+#define LIBHIDPP_HIDPP_SUBSCRIPTION_H
+
+#include <hidpp/Dispatcher.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace HIDPP
+{
+
+/**
+ * Persistent subscription to the events matching a device index and a
+ * sub ID (or feature index).
+ *
+ * Unlike Dispatcher::getNotification, the event handler is registered
+ * once and every event received in the lifetime of the subscription is
+ * queued, so that none is missed between two calls of \ref next. The
+ * queue is a bounded lock-free ring filled by the dispatcher reading
+ * thread. Events received when it is full are dropped and counted (see
+ * \ref dropped).
+ *
+ * Events must be consumed from a single thread at a time.
+ *
+ * \see Dispatcher::subscribe
+ */
+class Subscription
+{
+public:
+	Subscription (Dispatcher *dispatcher, DeviceIndex index, uint8_t sub_id,
+		      std::size_t capacity = Dispatcher::DefaultSubscriptionCapacity);
+	/**
+	 * Unregister the event handler.
+	 */
+	virtual ~Subscription ();
+
+	Subscription (const Subscription &) = delete;
+	Subscription &operator= (const Subscription &) = delete;
+
+	DeviceIndex deviceIndex () const noexcept;
+	uint8_t subID () const noexcept;
+
+	/**
+	 * Pop the oldest queued event without waiting.
+	 */
+	std::optional<Report> tryNext ();
+	/**
+	 * Pop the oldest queued event, waiting at most \p timeout
+	 * milliseconds (or forever if negative) for one.
+	 *
+	 * \returns an empty value on timeout or if interrupted.
+	 */
+	std::optional<Report> next (int timeout = -1);
+
+	/**
+	 * Make the current and future calls to \ref next return an empty
+	 * value, until \ref resetInterruption is called.
+	 */
+	virtual void interrupt ();
+	void resetInterruption ();
+
+	/**
+	 * Number of events dropped because the queue was full.
+	 */
+	uint64_t dropped () const noexcept;
+
+protected:
+	Dispatcher *dispatcher () const noexcept;
+	bool empty () const noexcept;
+	/**
+	 * Wait until an event is queued, the subscription is interrupted or
+	 * \p deadline passes. Spurious returns are allowed.
+	 *
+	 * The default implementation waits for the dispatcher reading
+	 * thread. Dispatchers without one override it to read reports.
+	 */
+	virtual void wait (std::optional<std::chrono::steady_clock::time_point> deadline);
+
+private:
+	bool push (const Report &report);
+
+	Dispatcher *_dispatcher;
+	DeviceIndex _index;
+	uint8_t _sub_id;
+	Dispatcher::listener_iterator _listener;
+	// Single producer (the handler) and single consumer ring, positions
+	// only increase.
+	std::unique_ptr<std::optional<Report>[]> _ring;
+	std::size_t _capacity;
+	std::atomic<uint64_t> _head, _tail;
+	std::atomic<uint64_t> _dropped;
+	// The handler only locks _mutex when the consumer is waiting.
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::atomic<bool> _waiting, _interrupted;
+};
+
+}
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "SyncJournal.h"
+
+#include <misc/Log.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+using namespace HIDPP;
+
+static constexpr char Header[] = "# libhidpp sync journal 1";
+
+static std::tuple<std::string, int, unsigned int> firstKey (const std::string &fingerprint)
+{
+	return { fingerprint, std::numeric_limits<int>::min (), 0 };
+}
+
+SyncJournal::SyncJournal (const std::string &path):
+	_path (path)
+{
+	try {
+		load ();
+	}
+	catch (std::exception &e) {
+		Log::warning () << "Ignoring invalid sync journal " << path
+				<< ": " << e.what () << std::endl;
+		_pages.clear ();
+	}
+}
+
+uint64_t SyncJournal::digest (const std::vector<uint8_t> &data)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (uint8_t byte: data) {
+		hash ^= byte;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+bool SyncJournal::completed (const std::string &fingerprint, const Address &address,
+			     uint64_t digest) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _pages.find (key_type (fingerprint, address.mem_type, address.page));
+	return it != _pages.end () && it->second.completed && it->second.digest == digest;
+}
+
+std::vector<std::pair<SyncJournal::PlannedPage, bool>> SyncJournal::pages (const std::string &fingerprint) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::vector<std::pair<PlannedPage, bool>> pages;
+	for (auto it = _pages.lower_bound (firstKey (fingerprint));
+			it != _pages.end () && std::get<0> (it->first) == fingerprint; ++it) {
+		const auto &[key, record] = *it;
+		Address address = { std::get<1> (key), std::get<2> (key), 0 };
+		pages.emplace_back (PlannedPage { address, record.digest, record.crc }, record.completed);
+	}
+	return pages;
+}
+
+void SyncJournal::begin (const std::string &fingerprint, const std::vector<PlannedPage> &pages)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::map<key_type, Record> planned;
+	for (const auto &page: pages) {
+		key_type key (fingerprint, page.address.mem_type, page.address.page);
+		auto it = _pages.find (key);
+		bool completed = it != _pages.end () && it->second.completed &&
+				it->second.digest == page.digest;
+		planned.emplace (key, Record { page.digest, page.crc, completed });
+	}
+	auto it = _pages.lower_bound (firstKey (fingerprint));
+	while (it != _pages.end () && std::get<0> (it->first) == fingerprint)
+		it = _pages.erase (it);
+	_pages.merge (planned);
+	save ();
+}
+
+void SyncJournal::complete (const std::string &fingerprint, const Address &address)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _pages.find (key_type (fingerprint, address.mem_type, address.page));
+	if (it == _pages.end () || it->second.completed)
+		return;
+	it->second.completed = true;
+	save ();
+}
+
+void SyncJournal::finish (const std::string &fingerprint)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _pages.lower_bound (firstKey (fingerprint));
+	if (it == _pages.end () || std::get<0> (it->first) != fingerprint)
+		return;
+	while (it != _pages.end () && std::get<0> (it->first) == fingerprint)
+		it = _pages.erase (it);
+	save ();
+}
+
+void SyncJournal::load ()
+{
+	std::ifstream in (_path);
+	if (!in)
+		return; // no journal yet
+	std::string line;
+	if (!std::getline (in, line) || line != Header)
+		throw std::runtime_error ("unknown format");
+	unsigned int line_number = 1;
+	while (std::getline (in, line)) {
+		++line_number;
+		std::istringstream ss (line);
+		std::string type;
+		if (!(ss >> type))
+			continue;
+		if (type != "page")
+			throw std::runtime_error ("unknown record at line " + std::to_string (line_number));
+		std::string fingerprint;
+		int mem_type;
+		unsigned int page, crc, completed;
+		uint64_t digest;
+		if (!(ss >> fingerprint >> std::hex >> mem_type >> page >> digest >> crc >> completed) ||
+				crc > 0xffff || completed > 1)
+			throw std::runtime_error ("invalid page at line " + std::to_string (line_number));
+		_pages[key_type (fingerprint, mem_type, page)] = {
+			digest, static_cast<uint16_t> (crc), completed != 0
+		};
+	}
+}
+
+void SyncJournal::save ()
+{
+	std::string tmp_path = _path + ".tmp";
+	{
+		std::ofstream out (tmp_path, std::ios::trunc);
+		if (!out)
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+		out << Header << std::endl << std::hex << std::setfill ('0');
+		for (const auto &[key, record]: _pages) {
+			const auto &[fingerprint, mem_type, page] = key;
+			out << "page " << fingerprint
+			    << " " << std::setw (2) << mem_type
+			    << " " << std::setw (2) << page
+			    << " " << std::setw (16) << record.digest
+			    << " " << std::setw (4) << record.crc
+			    << " " << record.completed << std::endl;
+		}
+		if (!out.flush ())
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+	}
+	if (0 != std::rename (tmp_path.c_str (), _path.c_str ()))
+		throw std::system_error (errno, std::generic_category (), "rename");
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP_SYNC_JOURNAL_H
+#define LIBHIDPP_HIDPP_SYNC_JOURNAL_H
+
+#include <hidpp/Address.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace HIDPP
+{
+
+/**
+ * On-disk journal of the page writes of memory syncs (see
+ * AbstractMemoryMapping::setSyncJournal), so that an interrupted sync
+ * resumes from the pages not yet confirmed.
+ *
+ * A sync records its plan (each page with a digest of the content to
+ * write and the CRC the page ends with) before writing, then marks
+ * each page completed once it is written and checked. The journal of a
+ * device is cleared when its sync is over. Devices are told apart by
+ * their fingerprint (e.g. HIDPP20::Device::fingerprint).
+ *
+ * The journal is a text file with one record per line, written again
+ * (atomically) on every change. It can be shared by several devices
+ * and threads.
+ */
+class SyncJournal
+{
+public:
+	/**
+	 * Load the journal from \p path if it exists.
+	 *
+	 * Invalid files are ignored (with a warning), their syncs are then
+	 * written again entirely.
+	 */
+	SyncJournal (const std::string &path);
+
+	SyncJournal (const SyncJournal &) = delete;
+	SyncJournal &operator= (const SyncJournal &) = delete;
+
+	struct PlannedPage
+	{
+		Address address; ///< offset is ignored
+		uint64_t digest; ///< see \ref digest
+		uint16_t crc; ///< last two bytes of the page, big-endian
+	};
+
+	/**
+	 * Digest of page content identifying planned pages.
+	 */
+	static uint64_t digest (const std::vector<uint8_t> &data);
+
+	/**
+	 * Check if an interrupted sync of \p fingerprint confirmed the
+	 * page at \p address with the content of \p digest.
+	 */
+	bool completed (const std::string &fingerprint, const Address &address,
+			uint64_t digest) const;
+	/**
+	 * Pages of the interrupted sync of \p fingerprint, and if each was
+	 * completed, in address order.
+	 */
+	std::vector<std::pair<PlannedPage, bool>> pages (const std::string &fingerprint) const;
+
+	/**
+	 * Record the plan of a sync of \p fingerprint, replacing the plan
+	 * of an interrupted sync. Completion markers of pages planned again
+	 * with the same content are kept.
+	 *
+	 * \throws std::system_error if the journal cannot be written.
+	 */
+	void begin (const std::string &fingerprint, const std::vector<PlannedPage> &pages);
+	/**
+	 * Mark the page at \p address as written and checked.
+	 *
+	 * \throws std::system_error
+	 */
+	void complete (const std::string &fingerprint, const Address &address);
+	/**
+	 * Clear the journal of \p fingerprint after a complete sync.
+	 *
+	 * \throws std::system_error
+	 */
+	void finish (const std::string &fingerprint);
+
+private:
+	void load ();
+	void save (); // _mutex must be held
+
+	typedef std::tuple<std::string, int, unsigned int> key_type;
+	struct Record
+	{
+		uint64_t digest;
+		uint16_t crc;
+		bool completed;
+	};
+
+	std::string _path;
+	mutable std::mutex _mutex;
+	std::map<key_type, Record> _pages;
+};
+
+}
+
+#endif
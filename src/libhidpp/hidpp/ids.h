@@ -34,6 +34,7 @@ namespace HIDPP
 		constexpr uint16_t G700 =	0xc06b;
 		constexpr uint16_t G500s =	0xc24e;
 		constexpr uint16_t G700s =	0xc07c;
+		constexpr uint16_t G502Hero =	0xc08b;
 	}
 }
 
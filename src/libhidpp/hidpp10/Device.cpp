@@ -19,11 +19,13 @@
 #include "Device.h"
 
 #include <hidpp/Dispatcher.h>
+#include <hidpp/Subscription.h>
 #include <hidpp10/Error.h>
 #include <hidpp10/WriteError.h>
 #include <misc/Log.h>
 
 #include <cassert>
+#include <stdexcept>
 
 using namespace HIDPP10;
 
@@ -43,6 +45,15 @@ Device::Device (HIDPP::Device &&device):
 		throw HIDPP::Device::InvalidProtocolVersion (version);
 }
 
+Device::Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index,
+		const Identity &identity):
+	HIDPP::Device (dispatcher, device_index, identity)
+{
+	auto version = protocolVersion ();
+	if (version != std::make_tuple (1, 0))
+		throw HIDPP::Device::InvalidProtocolVersion (version);
+}
+
 template<uint8_t sub_id, HIDPP::Report::Type request_type, HIDPP::Report::Type result_type>
 void Device::accessRegister (uint8_t address,
 			     const std::vector<uint8_t> *params,
@@ -126,6 +137,57 @@ void Device::getRegister (uint8_t address,
 		throw std::logic_error ("Register too long");
 }
 
+Device::AsyncRegister::AsyncRegister (std::unique_ptr<HIDPP::Dispatcher::AsyncReport> &&report,
+				      HIDPP::Report::Type result_type):
+	_report (std::move (report)),
+	_result_type (result_type)
+{
+}
+
+std::vector<uint8_t> Device::AsyncRegister::get ()
+{
+	auto response = _report->get ();
+	if (response.type () != _result_type)
+		throw std::runtime_error ("Invalid result length");
+	std::vector<uint8_t> results (response.parameterBegin (), response.parameterEnd ());
+	Log::debug ("register").printBytes ("Results:", results.begin (), results.end ());
+	return results;
+}
+
+Device::AsyncRegister Device::getRegisterAsync (uint8_t address,
+						const std::vector<uint8_t> *params,
+						std::size_t result_size)
+{
+	auto debug = Log::debug ("register");
+	uint8_t sub_id;
+	HIDPP::Report::Type result_type;
+	if (result_size <= HIDPP::ShortParamLength) {
+		debug.printf ("Getting short register 0x%02hhx\n", address);
+		sub_id = GetRegisterShort;
+		result_type = HIDPP::Report::Short;
+	}
+	else if (result_size <= HIDPP::LongParamLength) {
+		debug.printf ("Getting long register 0x%02hhx\n", address);
+		sub_id = GetRegisterLong;
+		result_type = HIDPP::Report::Long;
+	}
+	else
+		throw std::logic_error ("Register too long");
+	HIDPP::Report request (HIDPP::Report::Short, deviceIndex (), sub_id, address);
+	if (params) {
+		debug.printBytes ("Parameters:", params->begin (), params->end ());
+		assert (params->size () <= request.parameterLength ());
+		std::copy (params->begin (), params->end (), request.parameterBegin ());
+	}
+	return AsyncRegister (dispatcher ()->sendCommand (std::move (request)), result_type);
+}
+
+Device::AsyncRegister Device::getLongRegisterAsync (uint8_t address,
+						    const std::vector<uint8_t> *params)
+{
+	return getRegisterAsync (address, params, HIDPP::LongParamLength);
+}
+
 void Device::sendDataPacket (uint8_t sub_id, uint8_t seq_num,
 			     std::vector<uint8_t>::const_iterator param_begin,
 			     std::vector<uint8_t>::const_iterator param_end,
@@ -164,3 +226,72 @@ void Device::sendDataPacket (uint8_t sub_id, uint8_t seq_num,
 	}
 }
 
+void Device::sendDataPackets (const std::vector<DataPacket> &packets,
+			      uint8_t first_seq_num, unsigned int window)
+{
+	auto debug = Log::debug ("data");
+	if (window == 0)
+		throw std::invalid_argument ("data packet window must not be empty");
+	// Acknowledgements are queued from the first packet, so that none is
+	// missed between two waits.
+	auto acks = dispatcher ()->subscribe (deviceIndex (), SendDataAcknowledgement);
+	auto next_ack = [&acks] (int timeout) {
+		auto report = acks->next (timeout);
+		if (!report)
+			throw HIDPP::Dispatcher::TimeoutError ();
+		return std::move (*report);
+	};
+
+	std::size_t acked = 0, sent = 0;
+	unsigned int retries = 0;
+	while (acked < packets.size ()) {
+		while (sent < packets.size () && sent - acked < window) {
+			const auto &packet = packets[sent];
+			uint8_t seq_num = first_seq_num + sent;
+			debug.printf ("Sending data packet %hhu\n", seq_num);
+			debug.printBytes ("Data packet", packet.params.begin (), packet.params.end ());
+			assert (packet.params.size () <= HIDPP::LongParamLength);
+			HIDPP::Report report (HIDPP::Report::Long, deviceIndex (), packet.sub_id, seq_num);
+			std::copy (packet.params.begin (), packet.params.end (), report.parameterBegin ());
+			dispatcher ()->sendCommandWithoutResponse (report);
+			++sent;
+		}
+		int timeout = dispatcher ()->commandTimeout (deviceIndex (), DataPacketTimeout);
+		std::exception_ptr error;
+		try {
+			auto response = next_ack (timeout);
+			uint8_t seq_num = first_seq_num + acked;
+			if (response.address () == 1) {
+				// Acknowledgements are cumulative, one may be
+				// lost while a later one is received.
+				uint8_t distance = response.parameterBegin ()[0] - seq_num;
+				if (distance < sent - acked) {
+					debug.printf ("Data packet %hhu acknowledged\n",
+						      static_cast<uint8_t> (seq_num + distance));
+					acked += distance + 1;
+					retries = 0;
+				}
+				continue;
+			}
+			debug.printf ("Data packet %hhu: error 0x%02hhx\n",
+				      seq_num, response.address ());
+			error = std::make_exception_ptr (WriteError (response.address ()));
+		}
+		catch (HIDPP::Dispatcher::TimeoutError &e) {
+			debug.printf ("Data packet %hhu: timeout\n",
+				      static_cast<uint8_t> (first_seq_num + acked));
+			error = std::current_exception ();
+		}
+		if (++retries > MaxDataPacketRetries)
+			std::rethrow_exception (error);
+		// Let the packets in flight be answered before sending
+		// them again.
+		try {
+			while (true)
+				next_ack (timeout);
+		}
+		catch (HIDPP::Dispatcher::TimeoutError &e) {
+		}
+		sent = acked;
+	}
+}
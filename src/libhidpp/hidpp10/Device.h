@@ -20,9 +20,10 @@
 #define LIBHIDPP_HIDPP10_DEVICE_H
 
 #include <hidpp/Device.h>
+#include <hidpp/Dispatcher.h>
 #include <hidpp/Report.h>
 
-namespace HIDPP { class Dispatcher; }
+#include <memory>
 
 namespace HIDPP10
 {
@@ -32,6 +33,13 @@ class Device: public HIDPP::Device
 public:
 	Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice);
 	Device (HIDPP::Device &&device);
+	/**
+	 * \see HIDPP::Device::Device(HIDPP::Dispatcher *, HIDPP::DeviceIndex, const Identity &)
+	 *
+	 * \throws HIDPP::Device::InvalidProtocolVersion if \p identity is
+	 * not a HID++ 1.0 device.
+	 */
+	Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index, const Identity &identity);
 
 	void setRegister (uint8_t address,
 			  const std::vector<uint8_t> &params,
@@ -40,10 +48,80 @@ public:
 			  const std::vector<uint8_t> *params,
 			  std::vector<uint8_t> &results);
 
+	/**
+	 * Register read whose results are retrieved later.
+	 *
+	 * \see getRegisterAsync
+	 */
+	class AsyncRegister
+	{
+	public:
+		AsyncRegister (std::unique_ptr<HIDPP::Dispatcher::AsyncReport> &&report,
+			       HIDPP::Report::Type result_type = HIDPP::Report::Long);
+
+		/**
+		 * Wait for the register value.
+		 *
+		 * \throws HIDPP10::Error, HIDPP::Dispatcher::TimeoutError
+		 */
+		std::vector<uint8_t> get ();
+
+	private:
+		std::unique_ptr<HIDPP::Dispatcher::AsyncReport> _report;
+		HIDPP::Report::Type _result_type;
+	};
+
+	/**
+	 * Send a register read without waiting for the value.
+	 *
+	 * \p result_size selects a short or long register read like the
+	 * results size in \ref getRegister.
+	 *
+	 * HID++ 1.0 answers have no software ID, concurrent reads of the
+	 * same register are matched with the answers in sending order.
+	 */
+	AsyncRegister getRegisterAsync (uint8_t address,
+					const std::vector<uint8_t> *params,
+					std::size_t result_size);
+	/**
+	 * Send a long register read without waiting for the value.
+	 */
+	AsyncRegister getLongRegisterAsync (uint8_t address,
+					    const std::vector<uint8_t> *params);
+
 	void sendDataPacket (uint8_t sub_id, uint8_t seq_num,
 			     std::vector<uint8_t>::const_iterator param_begin,
 			     std::vector<uint8_t>::const_iterator param_end,
 			     bool wait_for_ack = false);
+
+	struct DataPacket
+	{
+		uint8_t sub_id;
+		std::vector<uint8_t> params;
+	};
+	/**
+	 * Retransmissions of a data packet before \ref sendDataPackets
+	 * gives up.
+	 */
+	static constexpr unsigned int MaxDataPacketRetries = 3;
+	/**
+	 * Default timeout in milliseconds for a data packet
+	 * acknowledgement, see HIDPP::Dispatcher::commandTimeout.
+	 */
+	static constexpr int DataPacketTimeout = 1000;
+	/**
+	 * Send \p packets with sequence numbers starting at \p first_seq_num,
+	 * keeping up to \p window of them waiting for their acknowledgement.
+	 *
+	 * When a packet is refused or its acknowledgement times out, the
+	 * later acknowledgements are discarded and the packets are sent
+	 * again from the failed one.
+	 *
+	 * \throws WriteError, HIDPP::Dispatcher::TimeoutError after
+	 * \ref MaxDataPacketRetries retransmissions of the same packet.
+	 */
+	void sendDataPackets (const std::vector<DataPacket> &packets,
+			      uint8_t first_seq_num, unsigned int window);
 private:
 	template<uint8_t sub_id, HIDPP::Report::Type request_type, HIDPP::Report::Type result_type>
 	void accessRegister (uint8_t address,
@@ -35,6 +35,7 @@ unsigned int IIndividualFeatures::flags ()
 	unsigned int flags = 0;
 	for (unsigned int i = 0; i < 3; ++i)
 		flags |= results[i] << (i*8);
+	_flags = flags;
 	return flags;
 }
 
@@ -43,25 +44,42 @@ void IIndividualFeatures::setFlags (unsigned int f)
 	std::vector<uint8_t> params (HIDPP::ShortParamLength);
 	for (unsigned int i = 0; i < 3; ++i)
 		params[i] = (f >> (i*8)) & 0xFF;
+	_flags.reset (); // unknown if the write fails
 	_dev->setRegister (EnableIndividualFeatures, params, nullptr);
+	_flags = f;
+}
+
+unsigned int IIndividualFeatures::cachedFlags ()
+{
+	if (_flags)
+		return *_flags;
+	return flags ();
+}
+
+void IIndividualFeatures::invalidate ()
+{
+	_flags.reset ();
+}
+
+void IIndividualFeatures::updateFlags (unsigned int set_mask, unsigned int clear_mask)
+{
+	unsigned int old_flags = cachedFlags ();
+	unsigned int f = (old_flags | set_mask) & ~clear_mask;
+	if (f != old_flags)
+		setFlags (f);
 }
 
 bool IIndividualFeatures::hasFlag (IndividualFeature feature)
 {
-	return flags () & feature;
+	return cachedFlags () & feature;
 }
 
 void IIndividualFeatures::setFlag (IndividualFeature feature)
 {
-	unsigned int f = flags ();
-	f |= feature;
-	setFlags (f);
+	updateFlags (feature, 0);
 }
 
 void IIndividualFeatures::unsetFlag (IndividualFeature feature)
 {
-	unsigned int f = flags ();
-	f &= ~feature;
-	setFlags (f);
+	updateFlags (0, feature);
 }
-
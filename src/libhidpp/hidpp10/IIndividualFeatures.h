@@ -19,11 +19,21 @@
 #ifndef LIBHIDPP_HIDPP10_IINDIVIDUALFEATURES_H
 #define LIBHIDPP_HIDPP10_IINDIVIDUALFEATURES_H
 
+#include <optional>
+
 namespace HIDPP10
 {
 
 class Device;
 
+/**
+ * Individual features flags register.
+ *
+ * The last flags read or written are cached by this object so that
+ * checking and changing flags does not read the register again. Call
+ * \ref invalidate if something else may have changed the register (e.g.
+ * the device was reset or reconnected).
+ */
 class IIndividualFeatures
 {
 public:
@@ -40,15 +50,38 @@ public:
 
 	IIndividualFeatures (Device *dev);
 
+	/**
+	 * Read the flags from the device and update the cache.
+	 */
 	unsigned int flags ();
+	/**
+	 * Write the flags and update the cache.
+	 */
 	void setFlags (unsigned int flags);
 
+	/**
+	 * Cached flags, only read from the device if they are not known.
+	 */
+	unsigned int cachedFlags ();
+	/**
+	 * Forget the cached flags.
+	 */
+	void invalidate ();
+
+	/**
+	 * Set the flags in \p set_mask and clear those in \p clear_mask
+	 * with a single write, nothing is written if the cached flags
+	 * already match.
+	 */
+	void updateFlags (unsigned int set_mask, unsigned int clear_mask);
+
 	bool hasFlag (IndividualFeature feature);
 	void setFlag (IndividualFeature feature);
 	void unsetFlag (IndividualFeature feature);
 
 private:
 	Device *_dev;
+	std::optional<unsigned int> _flags;
 };
 
 }
@@ -20,10 +20,13 @@
 
 #include <hidpp10/Device.h>
 #include <hidpp10/defs.h>
+#include <hidpp/Dispatcher.h>
 
 #include <misc/Endian.h>
 
 #include <algorithm>
+#include <deque>
+#include <exception>
 #include <stdexcept>
 
 using namespace HIDPP;
@@ -48,20 +51,77 @@ int IMemory::readSome (Address address, uint8_t *buffer, std::size_t maxlen)
 
 void IMemory::readMem (Address address, std::vector<uint8_t> &data)
 {
-	std::size_t read = 0;
-	while (read < data.size ()) {
-		std::size_t len = readSome (address, &data[read], data.size () - read);
-		address.offset += len/2;
-		read += len;
+	Dispatcher::PriorityScope bulk (Dispatcher::Priority::Bulk);
+	// Reads in flight with the position of their data
+	std::deque<std::pair<std::size_t, Device::AsyncRegister>> reads;
+	std::size_t requested = 0;
+	std::exception_ptr error;
+	while (requested < data.size () || !reads.empty ()) {
+		// Stop sending after an error, but still wait for the reads in
+		// flight so that their answers are not mistaken for later ones.
+		while (!error && requested < data.size () && reads.size () < ReadWindow) {
+			std::vector<uint8_t> params (ShortParamLength);
+			params[0] = address.page;
+			params[1] = address.offset + requested/2; // offset is in words
+			try {
+				reads.emplace_back (requested, _dev->getLongRegisterAsync (MemoryRead, &params));
+				requested += LongParamLength;
+			}
+			catch (...) {
+				error = std::current_exception ();
+			}
+		}
+		if (reads.empty ())
+			break;
+		auto &[pos, read] = reads.front ();
+		try {
+			auto results = read.get ();
+			std::size_t len = std::min (LongParamLength, data.size () - pos);
+			std::copy_n (results.begin (), len, &data[pos]);
+		}
+		catch (...) {
+			if (!error)
+				error = std::current_exception ();
+		}
+		reads.pop_front ();
 	}
+	if (error)
+		std::rethrow_exception (error);
 }
 
-void IMemory::writeMem (Address address, const std::vector<uint8_t> &data)
+void IMemory::writeMem (Address address, const std::vector<uint8_t> &data,
+			unsigned int window)
 {
+	Dispatcher::PriorityScope bulk (Dispatcher::Priority::Bulk);
 	static constexpr std::size_t HeaderLength = 9;
 	static constexpr std::size_t FirstPacketDataLength =
 			LongParamLength - HeaderLength;
 
+	/*
+	 * Split data in packets
+	 */
+	std::vector<Device::DataPacket> packets;
+	std::size_t sent = 0;
+	if (!data.empty ()) {
+		std::vector<uint8_t> params (LongParamLength);
+		/* First packet header */
+		params[0] = 0x01; // Unknown meaning
+		params[1] = address.page;
+		params[2] = address.offset;
+		writeBE<uint16_t> (params, 5, data.size ());
+		/* Start of data */
+		std::size_t len = std::min (FirstPacketDataLength, data.size ());
+		std::copy_n (data.begin (), len, params.begin () + HeaderLength);
+		sent += len;
+		packets.push_back ({ SendDataBeginAck, std::move (params) });
+	}
+	while (sent < data.size ()) {
+		auto it = data.begin () + sent;
+		std::size_t len = std::min (LongParamLength, data.size () - sent);
+		packets.push_back ({ SendDataContinueAck, { it, it + len } });
+		sent += len;
+	}
+
 	/*
 	 * Init sequence number
 	 */
@@ -70,53 +130,27 @@ void IMemory::writeMem (Address address, const std::vector<uint8_t> &data)
 	/*
 	 * Start sending packets
 	 */
-	bool first = true;
-	std::size_t sent = 0;
+	if (window > 1) {
+		_dev->sendDataPackets (packets, 0, window);
+		return;
+	}
 	uint8_t seq_num = 0;
-	while (sent < data.size ()) {
-		if (first) {
-			std::vector<uint8_t> params (LongParamLength);
-			/* First packet header */
-			params[0] = 0x01; // Unknown meaning
-			params[1] = address.page;
-			params[2] = address.offset;
-			writeBE<uint16_t> (params, 5, data.size ());
-			/* Start of data */
-			if (data.size () < FirstPacketDataLength) {
-				std::copy (data.begin (), data.end (),
-					   params.begin () + HeaderLength);
-				sent = data.size ();
-			}
-			else {
-				std::size_t len = std::min (FirstPacketDataLength, data.size ());
-				std::copy_n (data.begin (), len,
-					     params.begin () + HeaderLength);
-				sent += len;
-			}
-			_dev->sendDataPacket (SendDataBeginAck, seq_num,
-					      params.begin (), params.end (),
-					      true);
-			first = false;
-		}
-		else {
-			auto it = data.begin () + sent;
-			std::size_t len = std::min (LongParamLength, data.size () - sent);
-			_dev->sendDataPacket (SendDataContinueAck, seq_num,
-					      it, it + len,
-					      true);
-			sent += len;
-		}
+	for (const auto &packet: packets) {
+		_dev->sendDataPacket (packet.sub_id, seq_num,
+				      packet.params.begin (), packet.params.end (),
+				      true);
 		seq_num++;
 	}
 }
 
-void IMemory::writePage (uint8_t page, const std::vector<uint8_t> &data)
+void IMemory::writePage (uint8_t page, const std::vector<uint8_t> &data,
+			 unsigned int window)
 {
 	if (data.size () > 512)
 		throw std::logic_error ("page too big");
 
 	fillPage (page);
-	writeMem ({0, page, 0}, data);
+	writeMem ({0, page, 0}, data, window);
 }
 
 void IMemory::resetSequenceNumber ()
@@ -39,12 +39,37 @@ public:
 
 	IMemory (Device *dev);
 
+	/**
+	 * Memory reads kept in flight by \ref readMem.
+	 */
+	static constexpr unsigned int ReadWindow = 8;
+
 	int readSome (HIDPP::Address address, uint8_t *buffer, std::size_t maxlen);
+	/**
+	 * Read \p data size bytes from \p address.
+	 *
+	 * Up to \ref ReadWindow MemoryRead requests are sent before
+	 * waiting for the answers, the device answers them in order.
+	 */
 	void readMem (HIDPP::Address address, std::vector<uint8_t> &data);
 
+	/**
+	 * Suggested window for \ref writeMem on devices accepting
+	 * streamed data packets.
+	 */
+	static constexpr unsigned int WriteWindow = 8;
 
-	void writeMem (HIDPP::Address address, const std::vector<uint8_t> &data);
-	void writePage (uint8_t page, const std::vector<uint8_t> &data);
+	/**
+	 * Write \p data at \p address.
+	 *
+	 * With a \p window of one, each data packet waits for its
+	 * acknowledgement before the next is sent. A larger \p window
+	 * streams the packets with Device::sendDataPackets.
+	 */
+	void writeMem (HIDPP::Address address, const std::vector<uint8_t> &data,
+		       unsigned int window = 1);
+	void writePage (uint8_t page, const std::vector<uint8_t> &data,
+			unsigned int window = 1);
 
 	void resetSequenceNumber ();
 	void fillPage (uint8_t page);
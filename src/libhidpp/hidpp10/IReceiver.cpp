@@ -104,3 +104,12 @@ std::string IReceiver::getDeviceName (unsigned int device)
 	std::size_t length = results[1];
 	return std::string (reinterpret_cast<char *> (&results[2]), std::min (length, std::size_t {14}));
 }
+
+void IReceiver::notifyConnectedDevices ()
+{
+	std::vector<uint8_t> params (HIDPP::ShortParamLength);
+
+	params[0] = 0x02; // fake device arrival
+
+	_dev->setRegister (ConnectionState, params, nullptr);
+}
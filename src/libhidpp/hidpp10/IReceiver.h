@@ -74,6 +74,12 @@ public:
 					   PowerSwitchLocation *ps_loc);
 	std::string getDeviceName (unsigned int device);
 
+	/**
+	 * Ask the receiver to send a \ref DeviceConnection notification for
+	 * every paired device, with its current link state.
+	 */
+	void notifyConnectedDevices ();
+
 private:
 	Device *_dev;
 };
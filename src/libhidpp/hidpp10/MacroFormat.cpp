@@ -24,7 +24,7 @@
 using namespace HIDPP;
 using namespace HIDPP10;
 
-static const std::map<Macro::Item::Instruction, uint8_t> OpCodes = {
+static constexpr MacroOpCodeTable::Entry OpCodeEntries[] = {
 	{ Macro::Item::NoOp, 0x00 },
 	{ Macro::Item::WaitRelease, 0x01 },
 	{ Macro::Item::RepeatUntilRelease, 0x02 },
@@ -45,6 +45,8 @@ static const std::map<Macro::Item::Instruction, uint8_t> OpCodes = {
 	{ Macro::Item::End, 0xff},
 };
 
+static constexpr MacroOpCodeTable OpCodes (OpCodeEntries);
+
 static std::size_t getOpLength (uint8_t op_code)
 {
 	switch (op_code & 0xE0) {
@@ -106,10 +108,10 @@ std::size_t MacroFormat::getLength (const Macro::Item &item) const
 	if (instr == Macro::Item::ShortDelay)
 		return 1;
 
-	auto it = OpCodes.find (instr);
-	if (it == OpCodes.end ())
+	int op_code = OpCodes.code (instr);
+	if (op_code == -1)
 		throw AbstractMacroFormat::UnsupportedInstruction (instr);
-	return getOpLength (it->second);
+	return getOpLength (op_code);
 }
 
 void MacroFormat::writeAddress (std::vector<uint8_t>::iterator it, const Address &addr) const
@@ -162,10 +164,10 @@ MacroFormat::writeItem (std::vector<uint8_t>::iterator it,
 		return it;
 	}
 
-	auto op = OpCodes.find (instr);
-	if (op == OpCodes.end ())
+	int op_code = OpCodes.code (instr);
+	if (op_code == -1)
 		throw AbstractMacroFormat::UnsupportedInstruction (instr);
-	*(it++) = op->second;
+	*(it++) = op_code;
 	switch (instr) {
 	case Macro::Item::KeyPress:
 	case Macro::Item::KeyRelease:
@@ -206,17 +208,11 @@ MacroFormat::writeItem (std::vector<uint8_t>::iterator it,
 
 Macro::Item MacroFormat::parseItem (std::vector<uint8_t>::const_iterator &it, Address &jump_addr) const
 {
-	static std::map<uint8_t, Macro::Item::Instruction> instr_map; // reversed OpCodes
-	if (instr_map.empty ()) {
-		for (const auto &p: OpCodes)
-			instr_map.emplace (p.second, p.first);
-	}
-
 	uint8_t op_code = *(it++);
-	auto instr = instr_map.find (op_code);
-	if (instr != instr_map.end ()) {
-		Macro::Item item (instr->second);
-		switch (instr->second) {
+	int instr = OpCodes.instruction (op_code);
+	if (instr != -1) {
+		Macro::Item item (static_cast<Macro::Item::Instruction> (instr));
+		switch (instr) {
 		case Macro::Item::KeyPress:
 		case Macro::Item::KeyRelease:
 			item.setKeyCode (*(it++));
@@ -275,6 +271,8 @@ Macro::Item MacroFormat::parseItem (std::vector<uint8_t>::const_iterator &it, Ad
 	throw std::runtime_error ("Invalid op-code in HID++1.0 macro");
 }
 
+template class HIDPP::MacroFormatKernel<HIDPP10::MacroFormat>;
+
 std::unique_ptr<AbstractMacroFormat> HIDPP10::getMacroFormat (Device *device)
 {
 	return std::unique_ptr<AbstractMacroFormat> (new MacroFormat ());
@@ -19,14 +19,14 @@
 #ifndef LIBHIDPP_HIDPP10_MACRO_FORMAT_H
 #define LIBHIDPP_HIDPP10_MACRO_FORMAT_H
 
-#include <hidpp/AbstractMacroFormat.h>
+#include <hidpp/MacroFormatKernel.h>
 
 #include <memory>
 
 namespace HIDPP10
 {
 
-class MacroFormat: public HIDPP::AbstractMacroFormat
+class MacroFormat final: public HIDPP::MacroFormatKernel<MacroFormat>
 {
 public:
 	virtual std::size_t getLength (const HIDPP::Macro::Item &item) const;
@@ -55,4 +55,6 @@ std::unique_ptr<HIDPP::AbstractMacroFormat> getMacroFormat (Device *device);
 
 }
 
+extern template class HIDPP::MacroFormatKernel<HIDPP10::MacroFormat>;
+
 #endif
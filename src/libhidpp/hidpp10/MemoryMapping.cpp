@@ -19,7 +19,9 @@
 #include "MemoryMapping.h"
 
 #include <hidpp10/defs.h>
+#include <hidpp/Report.h>
 #include <misc/Log.h>
+#include <misc/Trace.h>
 
 using namespace HIDPP;
 using namespace HIDPP10;
@@ -43,6 +45,12 @@ std::vector<uint8_t>::iterator MemoryMapping::getWritableIterator (const Address
 	return page.begin () + address.offset*2;
 }
 
+std::vector<uint8_t>::const_iterator MemoryMapping::getReadOnlyRange (const Address &address, std::size_t length)
+{
+	auto &page = getReadOnlyPageRange (address, address.offset*2, address.offset*2 + length);
+	return page.begin () + address.offset*2;
+}
+
 bool MemoryMapping::computeOffset (std::vector<uint8_t>::const_iterator it, Address &address)
 {
 	auto &page = getReadOnlyPage (address);
@@ -55,11 +63,47 @@ bool MemoryMapping::computeOffset (std::vector<uint8_t>::const_iterator it, Addr
 
 void MemoryMapping::readPage (const Address &address, std::vector<uint8_t> &data)
 {
+	Trace::Scope trace ("memory", "readPage", { { "page", address.page } });
 	data.resize (PageSize);
 	_imem.readMem (address, data);
 }
 
+std::size_t MemoryMapping::lineSize () const
+{
+	return LongParamLength;
+}
+
+std::size_t MemoryMapping::pageSize (const Address &) const
+{
+	return PageSize;
+}
+
+void MemoryMapping::readLines (const Address &address, const std::vector<std::size_t> &offsets, std::vector<uint8_t> &data)
+{
+	std::size_t i = 0;
+	while (i < offsets.size ()) {
+		std::size_t begin = offsets[i], end = begin + LongParamLength;
+		while (++i < offsets.size () && offsets[i] == end)
+			end += LongParamLength;
+		std::vector<uint8_t> lines (end - begin);
+		Address lines_address = address;
+		lines_address.offset = begin/2;
+		_imem.readMem (lines_address, lines);
+		std::copy (lines.begin (), lines.end (), &data[begin]);
+	}
+}
+
 void MemoryMapping::writePage (const Address &address, const std::vector<uint8_t> &data)
 {
+	Trace::Scope trace ("memory", "writePage", { { "page", address.page } });
 	_imem.writePage (address.page, data);
 }
+
+bool MemoryMapping::readPageEnd (const Address &address, std::vector<uint8_t> &data)
+{
+	data.resize (LongParamLength);
+	Address end = address;
+	end.offset = (PageSize - data.size ())/2;
+	_imem.readSome (end, data.data (), data.size ());
+	return true;
+}
@@ -32,12 +32,20 @@ public:
 	MemoryMapping (Device *dev, bool write_crc = true);
 
 	virtual std::vector<uint8_t>::const_iterator getReadOnlyIterator (const HIDPP::Address &address);
+	virtual std::vector<uint8_t>::const_iterator getReadOnlyRange (const HIDPP::Address &address, std::size_t length);
 	virtual std::vector<uint8_t>::iterator getWritableIterator (const HIDPP::Address &address);
 	virtual bool computeOffset (std::vector<uint8_t>::const_iterator it, HIDPP::Address &address);
 
 protected:
 	virtual void readPage (const HIDPP::Address &address, std::vector<uint8_t> &data);
+	virtual std::size_t lineSize () const;
+	virtual std::size_t pageSize (const HIDPP::Address &address) const;
+	/**
+	 * Consecutive lines are read together with IMemory::readMem.
+	 */
+	virtual void readLines (const HIDPP::Address &address, const std::vector<std::size_t> &offsets, std::vector<uint8_t> &data);
 	virtual void writePage (const HIDPP::Address &address, const std::vector<uint8_t> &data);
+	virtual bool readPageEnd (const HIDPP::Address &address, std::vector<uint8_t> &data);
 
 private:
 	IMemory _imem;
@@ -30,20 +30,21 @@ namespace Fields
 static constexpr std::size_t ModeSize = 6;
 
 static constexpr auto ProfileColor =	Field<Color> (0);
-static constexpr auto Angle =		Field<uint8_t> (3);
-static constexpr auto Modes =		StructArrayField<ModeSize, 5> (4);
-static constexpr auto AngleSnapping =	Field<uint8_t> (34);
-static constexpr auto DefaultDPI =	Field<uint8_t> (35);
-static constexpr auto LiftThreshold =	Field<uint8_t> (36);
-static constexpr auto Unknown =		Field<uint8_t> (37);
-static constexpr auto ReportRate =	Field<uint8_t> (38);
-static constexpr auto Buttons =		StructArrayField<ButtonSize, 13> (39);
+static constexpr auto Angle =		Field<uint8_t> (after (ProfileColor));
+static constexpr auto Modes =		StructArrayField<ModeSize, 5> (after (Angle));
+static constexpr auto AngleSnapping =	Field<uint8_t> (after (Modes));
+static constexpr auto DefaultDPI =	Field<uint8_t> (after (AngleSnapping));
+static constexpr auto LiftThreshold =	Field<uint8_t> (after (DefaultDPI));
+static constexpr auto Unknown =		Field<uint8_t> (after (LiftThreshold));
+static constexpr auto ReportRate =	Field<uint8_t> (after (Unknown));
+static constexpr auto Buttons =		StructArrayField<ButtonSize, 13> (after (ReportRate));
 
 namespace Mode
 {
 static constexpr auto DPIX =	Field<uint16_t, BigEndian> (0);
-static constexpr auto DPIY =	Field<uint16_t, BigEndian> (2);
-static constexpr auto LEDs =	Field<uint16_t, LittleEndian> (4);
+static constexpr auto DPIY =	Field<uint16_t, BigEndian> (after (DPIX));
+static constexpr auto LEDs =	Field<uint16_t, LittleEndian> (after (DPIY));
+static_assert (after (LEDs) == ModeSize);
 }
 }
 
@@ -57,7 +58,7 @@ const std::map<std::string, SettingDesc> ProfileFormatG500::GeneralSettings = {
 	{ "report_rate", SettingDesc (1, 8, 4) },
 };
 
-const EnumDesc ProfileFormatG500::SpecialActions = {
+static constexpr EnumTable SpecialActionTable ({
 	{ "WheelLeft", WheelLeft },
 	{ "WheelRight", WheelRight },
 	{ "ResolutionNext", ResolutionNext },
@@ -69,7 +70,9 @@ const EnumDesc ProfileFormatG500::SpecialActions = {
 	{ "ProfileSwitch2", ProfileSwitch + (2<<8) },
 	{ "ProfileSwitch3", ProfileSwitch + (3<<8) },
 	{ "ProfileSwitch4", ProfileSwitch + (4<<8) },
-};
+});
+
+const EnumDesc ProfileFormatG500::SpecialActions (SpecialActionTable);
 
 ProfileFormatG500::ProfileFormatG500 (const Sensor &sensor):
 	AbstractProfileFormat (ProfileSize, MaxButtonCount, MaxModeCount),
@@ -82,6 +85,7 @@ ProfileFormatG500::ProfileFormatG500 (const Sensor &sensor):
 		{ "leds", SettingDesc (LEDVector (LEDCount, false)) },
 	}
 {
+	static_assert (after (Fields::Buttons) == ProfileSize);
 }
 
 const std::map<std::string, SettingDesc> &ProfileFormatG500::generalSettings () const
@@ -180,7 +184,7 @@ void ProfileFormatG500::write (const Profile &profile, std::vector<uint8_t>::ite
 		Profile::Button button;
 		if (i < profile.buttons.size ())
 			button = profile.buttons[i];
-		writeButton (Buttons.begin (begin, i), button);
+		HIDPP10::writeButton (Buttons.begin (begin, i), button);
 	}
 }
 
@@ -30,28 +30,29 @@ namespace Fields
 static constexpr std::size_t ModeSize = 4;
 
 static constexpr auto Modes =		StructArrayField<ModeSize, 5> (0);
-static constexpr auto DefaultDPI =	Field<uint8_t> (20);
-static constexpr auto Angle =		Field<uint8_t> (21);
-static constexpr auto AngleSnapping =	Field<uint8_t> (22);
-static constexpr auto Unknown0 =	Field<uint8_t> (23);
-static constexpr auto ReportRate =	Field<uint8_t> (24);
-static constexpr auto Unknown1 =	Field<uint8_t> (25);
-static constexpr auto Unknown2 =	Field<uint8_t> (26);
-static constexpr auto Unknown3 =	Field<uint8_t> (27);
-static constexpr auto Unknown4 =	Field<uint8_t> (28);
-static constexpr auto PowerMode =	Field<uint8_t> (29);
-static constexpr auto Unknown5 =	Field<uint8_t> (30);
-static constexpr auto Unknown6 =	Field<uint8_t> (31);
-static constexpr auto Unknown7 =	Field<uint8_t> (32);
-static constexpr auto Unknown8 =	Field<uint8_t> (33);
-static constexpr auto Unknown9 =	Field<uint8_t> (34);
-static constexpr auto Buttons =		StructArrayField<ButtonSize, 13> (35);
+static constexpr auto DefaultDPI =	Field<uint8_t> (after (Modes));
+static constexpr auto Angle =		Field<uint8_t> (after (DefaultDPI));
+static constexpr auto AngleSnapping =	Field<uint8_t> (after (Angle));
+static constexpr auto Unknown0 =	Field<uint8_t> (after (AngleSnapping));
+static constexpr auto ReportRate =	Field<uint8_t> (after (Unknown0));
+static constexpr auto Unknown1 =	Field<uint8_t> (after (ReportRate));
+static constexpr auto Unknown2 =	Field<uint8_t> (after (Unknown1));
+static constexpr auto Unknown3 =	Field<uint8_t> (after (Unknown2));
+static constexpr auto Unknown4 =	Field<uint8_t> (after (Unknown3));
+static constexpr auto PowerMode =	Field<uint8_t> (after (Unknown4));
+static constexpr auto Unknown5 =	Field<uint8_t> (after (PowerMode));
+static constexpr auto Unknown6 =	Field<uint8_t> (after (Unknown5));
+static constexpr auto Unknown7 =	Field<uint8_t> (after (Unknown6));
+static constexpr auto Unknown8 =	Field<uint8_t> (after (Unknown7));
+static constexpr auto Unknown9 =	Field<uint8_t> (after (Unknown8));
+static constexpr auto Buttons =		StructArrayField<ButtonSize, 13> (after (Unknown9));
 
 namespace Mode
 {
 static constexpr auto DPIX =	Field<uint8_t> (0);
-static constexpr auto DPIY =	Field<uint8_t> (1);
-static constexpr auto LEDs =	Field<uint16_t, LittleEndian> (2);
+static constexpr auto DPIY =	Field<uint8_t> (after (DPIX));
+static constexpr auto LEDs =	Field<uint16_t, LittleEndian> (after (DPIY));
+static_assert (after (LEDs) == ModeSize);
 }
 }
 
@@ -73,7 +74,7 @@ const std::map<std::string, SettingDesc> ProfileFormatG700::GeneralSettings = {
 	{ "unknown9", SettingDesc (0x00, 0xff, 0x31) },
 };
 
-const EnumDesc ProfileFormatG700::SpecialActions = {
+static constexpr EnumTable SpecialActionTable ({
 	{ "WheelLeft", WheelLeft },
 	{ "WheelRight", WheelRight },
 	{ "BatteryLevel", BatteryLevel },
@@ -90,7 +91,9 @@ const EnumDesc ProfileFormatG700::SpecialActions = {
 	{ "ProfileSwitch2", ProfileSwitch + (2<<8) },
 	{ "ProfileSwitch3", ProfileSwitch + (3<<8) },
 	{ "ProfileSwitch4", ProfileSwitch + (4<<8) },
-};
+});
+
+const EnumDesc ProfileFormatG700::SpecialActions (SpecialActionTable);
 
 ProfileFormatG700::ProfileFormatG700 (const Sensor &sensor):
 	AbstractProfileFormat (ProfileSize, MaxButtonCount, MaxModeCount),
@@ -103,6 +106,7 @@ ProfileFormatG700::ProfileFormatG700 (const Sensor &sensor):
 		{ "leds", SettingDesc (LEDVector (LEDCount, false)) },
 	}
 {
+	static_assert (after (Fields::Buttons) == ProfileSize);
 }
 
 const std::map<std::string, SettingDesc> &ProfileFormatG700::generalSettings () const
@@ -222,7 +226,7 @@ void ProfileFormatG700::write (const Profile &profile, std::vector<uint8_t>::ite
 		Profile::Button button;
 		if (i < profile.buttons.size ())
 			button = profile.buttons[i];
-		writeButton (Buttons.begin (begin, i), button);
+		HIDPP10::writeButton (Buttons.begin (begin, i), button);
 	}
 }
 
@@ -33,18 +33,19 @@ static constexpr auto ProfileColor =	Field<Color> (0);
 static constexpr auto Unknown0 =	Field<uint8_t> (1);
 static constexpr auto Modes =		StructArrayField<ModeSize, 5> (2);
 static constexpr auto DefaultDPI =	Field<uint8_t> (19);
-static constexpr auto Unknown1 =	Field<uint8_t> (20);
-static constexpr auto Unknown2 =	Field<uint8_t> (21);
-static constexpr auto ReportRate =	Field<uint8_t> (22);
-static constexpr auto Buttons =		StructArrayField<ButtonSize, 10> (23);
-static constexpr auto Unknown3 =	Field<uint8_t> (53);
-static constexpr auto Unknown4 =	Field<uint8_t> (54);
-static constexpr auto Unknown5 =	Field<uint8_t> (55);
+static constexpr auto Unknown1 =	Field<uint8_t> (after (DefaultDPI));
+static constexpr auto Unknown2 =	Field<uint8_t> (after (Unknown1));
+static constexpr auto ReportRate =	Field<uint8_t> (after (Unknown2));
+static constexpr auto Buttons =		StructArrayField<ButtonSize, 10> (after (ReportRate));
+static constexpr auto Unknown3 =	Field<uint8_t> (after (Buttons));
+static constexpr auto Unknown4 =	Field<uint8_t> (after (Unknown3));
+static constexpr auto Unknown5 =	Field<uint8_t> (after (Unknown4));
 
 namespace Mode
 {
 static constexpr auto DPI =	Field<uint8_t> (0);
-static constexpr auto LEDs =	Field<uint16_t, LittleEndian> (1);
+static constexpr auto LEDs =	Field<uint16_t, LittleEndian> (after (DPI));
+static_assert (after (LEDs) == ModeSize);
 }
 }
 
@@ -61,7 +62,7 @@ const std::map<std::string, SettingDesc> ProfileFormatG9::GeneralSettings = {
 	{ "unknown5", SettingDesc (0x00, 0xff, 0x00) },
 };
 
-const EnumDesc ProfileFormatG9::SpecialActions = {
+static constexpr EnumTable SpecialActionTable ({
 	// TODO: find special actions supported by G9.
 	// Using the same as the G500 in the mean time.
 	{ "WheelLeft", WheelLeft },
@@ -75,7 +76,9 @@ const EnumDesc ProfileFormatG9::SpecialActions = {
 	{ "ProfileSwitch2", ProfileSwitch + (2<<8) },
 	{ "ProfileSwitch3", ProfileSwitch + (3<<8) },
 	{ "ProfileSwitch4", ProfileSwitch + (4<<8) },
-};
+});
+
+const EnumDesc ProfileFormatG9::SpecialActions (SpecialActionTable);
 
 ProfileFormatG9::ProfileFormatG9 (const Sensor &sensor):
 	AbstractProfileFormat (ProfileSize, MaxButtonCount, MaxModeCount),
@@ -87,6 +90,7 @@ ProfileFormatG9::ProfileFormatG9 (const Sensor &sensor):
 		{ "leds", SettingDesc (LEDVector (LEDCount, false)) },
 	}
 {
+	static_assert (after (Fields::Unknown5) == ProfileSize);
 }
 
 const std::map<std::string, SettingDesc> &ProfileFormatG9::generalSettings () const
@@ -193,7 +197,7 @@ void ProfileFormatG9::write (const Profile &profile, std::vector<uint8_t>::itera
 		Profile::Button button;
 		if (i < profile.buttons.size ())
 			button = profile.buttons[i];
-		writeButton (Buttons.begin (begin, i), button);
+		HIDPP10::writeButton (Buttons.begin (begin, i), button);
 	}
 
 	Unknown3.write (begin, general.get<int> ("unknown3"));
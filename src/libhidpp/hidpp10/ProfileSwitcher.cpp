@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileSwitcher.h"
+
+#include <hidpp10/defs.h>
+
+#include <stdexcept>
+
+using namespace HIDPP10;
+
+ProfileSwitcher::ProfileSwitcher (Device *dev, unsigned int write_window):
+	_iprofile (dev),
+	_ram (dev, write_window)
+{
+}
+
+void ProfileSwitcher::addIndex (const std::string &name, unsigned int index)
+{
+	add (name, { Path::Index, index, {}, true });
+}
+
+void ProfileSwitcher::addAddress (const std::string &name, const HIDPP::Address &address)
+{
+	add (name, { Path::Address, 0, { address, {} }, true });
+}
+
+void ProfileSwitcher::addImage (const std::string &name, RAMMapping::PreparedUpload image)
+{
+	// Same checks as RAMMapping::upload
+	if (image.address.page != 0)
+		throw std::out_of_range ("RAM address page");
+	if (image.address.offset*2 + image.data.size () > RAMSize)
+		throw std::out_of_range ("RAM upload length");
+	add (name, { Path::Upload, 0, std::move (image), false });
+}
+
+void ProfileSwitcher::remove (const std::string &name)
+{
+	_profiles.erase (name);
+	if (_active == name)
+		_active.reset ();
+}
+
+ProfileSwitcher::Path ProfileSwitcher::switchTo (const std::string &name)
+{
+	auto &entry = _profiles.at (name);
+	Path path = entry.path;
+	switch (entry.path) {
+	case Path::Index:
+		_iprofile.loadProfileFromIndex (entry.index);
+		break;
+	case Path::Address:
+		_iprofile.loadProfileFromAddress (entry.image.address);
+		break;
+	case Path::Upload:
+		if (entry.resident)
+			path = Path::Address;
+		else {
+			std::size_t begin = entry.image.address.offset*2;
+			std::size_t end = begin + entry.image.data.size ();
+			// Overwritten images are not resident anymore, even if
+			// the upload fails halfway.
+			for (auto &[other_name, other]: _profiles) {
+				if (other.path != Path::Upload || !other.resident)
+					continue;
+				std::size_t other_begin = other.image.address.offset*2;
+				std::size_t other_end = other_begin + other.image.data.size ();
+				if (other_begin < end && begin < other_end)
+					other.resident = false;
+			}
+			_ram.upload (entry.image);
+			entry.resident = true;
+		}
+		_iprofile.loadProfileFromAddress (entry.image.address);
+		break;
+	}
+	_active = name;
+	return path;
+}
+
+ProfileSwitcher::Path ProfileSwitcher::path (const std::string &name) const
+{
+	const auto &entry = _profiles.at (name);
+	if (entry.path == Path::Upload && entry.resident)
+		return Path::Address;
+	return entry.path;
+}
+
+void ProfileSwitcher::invalidateRAM ()
+{
+	for (auto &[name, entry]: _profiles)
+		if (entry.path == Path::Upload)
+			entry.resident = false;
+}
+
+std::optional<std::string> ProfileSwitcher::active () const
+{
+	return _active;
+}
+
+void ProfileSwitcher::add (const std::string &name, Entry entry)
+{
+	_profiles.insert_or_assign (name, std::move (entry));
+	if (_active == name)
+		_active.reset ();
+}
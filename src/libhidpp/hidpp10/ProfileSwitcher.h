@@ -0,0 +1,131 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP10_PROFILE_SWITCHER_H
+#define LIBHIDPP_HIDPP10_PROFILE_SWITCHER_H
+
+#include <hidpp10/IMemory.h>
+#include <hidpp10/IProfile.h>
+#include <hidpp10/RAMMapping.h>
+
+#include <map>
+#include <optional>
+#include <string>
+
+namespace HIDPP10
+{
+
+class Device;
+
+/**
+ * Switch between named profiles with as few round trips as possible.
+ *
+ * A profile is either:
+ *  - in the flash profile directory, loaded by index,
+ *  - elsewhere in flash, loaded by address,
+ *  - a RAM image already encoded (see RAMMapping::prepareUpload),
+ *    uploaded then loaded by address.
+ *
+ * The switcher remembers which RAM images are still resident, i.e.
+ * no overlapping image was uploaded since. Switching to a resident
+ * image is a single address switch, like flash profiles. Images are
+ * checked against the RAM size when added, so a switch never fails
+ * halfway because of an invalid image.
+ *
+ * The device may lose its RAM content (e.g. when it is turned off),
+ * call \ref invalidateRAM when it reconnects.
+ */
+class ProfileSwitcher
+{
+public:
+	enum class Path
+	{
+		Index,		///< IProfile::loadProfileFromIndex
+		Address,	///< IProfile::loadProfileFromAddress
+		Upload,		///< RAM upload, then address switch
+	};
+
+	/**
+	 * \param write_window	Data packets in flight when uploading
+	 *			images (see IMemory::writeMem).
+	 */
+	ProfileSwitcher (Device *dev, unsigned int write_window = IMemory::WriteWindow);
+
+	/**
+	 * Add profile \p index of the flash profile directory.
+	 */
+	void addIndex (const std::string &name, unsigned int index);
+	/**
+	 * Add a profile stored in flash at \p address.
+	 */
+	void addAddress (const std::string &name, const HIDPP::Address &address);
+	/**
+	 * Add a RAM image, starting with the profile.
+	 *
+	 * \throws std::out_of_range if the image does not fit in RAM.
+	 */
+	void addImage (const std::string &name, RAMMapping::PreparedUpload image);
+	void remove (const std::string &name);
+
+	/**
+	 * Load profile \p name, uploading it first if it is a RAM image
+	 * that is not resident.
+	 *
+	 * \returns the path used.
+	 *
+	 * \throws std::out_of_range if there is no profile \p name.
+	 */
+	Path switchTo (const std::string &name);
+
+	/**
+	 * The path \ref switchTo would use for \p name.
+	 *
+	 * \throws std::out_of_range if there is no profile \p name.
+	 */
+	Path path (const std::string &name) const;
+
+	/**
+	 * Forget which RAM images are resident.
+	 */
+	void invalidateRAM ();
+
+	/**
+	 * Profile of the last successful switch.
+	 */
+	std::optional<std::string> active () const;
+
+private:
+	struct Entry
+	{
+		Path path; // Upload for RAM images, even resident ones
+		unsigned int index;
+		RAMMapping::PreparedUpload image; // its address for flash profiles
+		bool resident;
+	};
+
+	void add (const std::string &name, Entry entry);
+
+	IProfile _iprofile;
+	RAMMapping _ram;
+	std::map<std::string, Entry> _profiles;
+	std::optional<std::string> _active;
+};
+
+}
+
+#endif
@@ -19,15 +19,35 @@
 #include "RAMMapping.h"
 
 #include <hidpp10/defs.h>
+#include <hidpp/Report.h>
 #include <misc/Log.h>
 
+#include <algorithm>
+#include <stdexcept>
+
 using namespace HIDPP;
 using namespace HIDPP10;
 
-RAMMapping::RAMMapping (Device *dev):
+RAMMapping::RAMMapping (Device *dev, unsigned int write_window):
 	AbstractMemoryMapping (false),
-	_imem (dev)
+	_imem (dev),
+	_write_window (write_window)
+{
+}
+
+RAMMapping::PreparedUpload RAMMapping::prepareUpload (const Address &address, std::size_t length)
+{
+	auto it = getReadOnlyIterator (address);
+	return { address, { it, it + length } };
+}
+
+void RAMMapping::upload (const PreparedUpload &upload)
 {
+	if (upload.address.page != 0)
+		throw std::out_of_range ("RAM address page");
+	if (upload.address.offset*2 + upload.data.size () > RAMSize)
+		throw std::out_of_range ("RAM upload length");
+	_imem.writeMem (upload.address, upload.data, _write_window);
 }
 
 std::vector<uint8_t>::const_iterator RAMMapping::getReadOnlyIterator (const Address &address)
@@ -64,5 +84,26 @@ void RAMMapping::writePage (const Address &address, const std::vector<uint8_t> &
 {
 	if (address.page != 0)
 		throw std::out_of_range ("RAM address page");
-	_imem.writeMem (address, data);
+	_imem.writeMem (address, data, _write_window);
+}
+
+bool RAMMapping::writeRanges (const Address &address, const std::vector<uint8_t> &data, const std::vector<Range> &ranges)
+{
+	if (address.page != 0)
+		throw std::out_of_range ("RAM address page");
+	std::vector<Range> words;
+	for (auto [begin, end]: ranges) {
+		begin &= ~std::size_t (1);
+		end = std::min (data.size (), (end + 1) & ~std::size_t (1));
+		if (!words.empty () && begin < words.back ().second + LongParamLength)
+			words.back ().second = end;
+		else
+			words.emplace_back (begin, end);
+	}
+	for (auto [begin, end]: words) {
+		Address range_address = address;
+		range_address.offset = begin/2;
+		_imem.writeMem (range_address, { data.begin () + begin, data.begin () + end }, _write_window);
+	}
+	return true;
 }
@@ -29,7 +29,31 @@ namespace HIDPP10
 class RAMMapping: public HIDPP::AbstractMemoryMapping
 {
 public:
-	RAMMapping (Device *dev);
+	/**
+	 * RAM is written with IMemory::writeMem using \p write_window
+	 * (e.g. IMemory::WriteWindow for streaming data packets).
+	 */
+	RAMMapping (Device *dev, unsigned int write_window = 1);
+
+	/**
+	 * RAM content already encoded with the profile and macro formats,
+	 * that can be uploaded again without encoding it or reading RAM.
+	 */
+	struct PreparedUpload
+	{
+		HIDPP::Address address;
+		std::vector<uint8_t> data;
+	};
+	/**
+	 * Copy \p length bytes of RAM content from \p address (as modified
+	 * through getWritableIterator, sync is not needed).
+	 */
+	PreparedUpload prepareUpload (const HIDPP::Address &address, std::size_t length);
+	/**
+	 * Write \p upload directly to RAM. Pages already read by this
+	 * mapping are not updated.
+	 */
+	void upload (const PreparedUpload &upload);
 
 	virtual std::vector<uint8_t>::const_iterator getReadOnlyIterator (const HIDPP::Address &address);
 	virtual std::vector<uint8_t>::iterator getWritableIterator (const HIDPP::Address &address);
@@ -38,9 +62,15 @@ public:
 protected:
 	virtual void readPage (const HIDPP::Address &address, std::vector<uint8_t> &data);
 	virtual void writePage (const HIDPP::Address &address, const std::vector<uint8_t> &data);
+	/**
+	 * RAM can be written at any word offset. Ranges are aligned to words
+	 * and merged when they are closer than a data packet.
+	 */
+	virtual bool writeRanges (const HIDPP::Address &address, const std::vector<uint8_t> &data, const std::vector<Range> &ranges);
 
 private:
 	IMemory _imem;
+	unsigned int _write_window;
 };
 
 }
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <hidpp10/ReceiverState.h>
+
+#include <hidpp10/defs.h>
+#include <hidpp10/Device.h>
+#include <hidpp10/Error.h>
+#include <hidpp10/IReceiver.h>
+#include <misc/Endian.h>
+#include <misc/Log.h>
+
+using namespace HIDPP10;
+
+static constexpr HIDPP::DeviceIndex WirelessDevices[] = {
+	HIDPP::WirelessDevice1, HIDPP::WirelessDevice2, HIDPP::WirelessDevice3,
+	HIDPP::WirelessDevice4, HIDPP::WirelessDevice5, HIDPP::WirelessDevice6,
+};
+
+static uint8_t slotBit (HIDPP::DeviceIndex index)
+{
+	if (index < HIDPP::WirelessDevice1 || index > HIDPP::WirelessDevice6)
+		return 0;
+	return 1 << (index - HIDPP::WirelessDevice1);
+}
+
+ReceiverState::ReceiverState (HIDPP::Dispatcher *dispatcher):
+	_dispatcher (dispatcher), _paired (0), _connected (0), _known (0)
+{
+	// Listen first so that no change is missed while reading.
+	for (auto index: WirelessDevices) {
+		_listeners.push_back (_dispatcher->registerEventHandler (
+				index, DeviceConnection,
+				[this] (const HIDPP::Report &report) {
+					return connectionEvent (report);
+				}));
+		_listeners.push_back (_dispatcher->registerEventHandler (
+				index, DeviceDisconnection,
+				[this] (const HIDPP::Report &report) {
+					return disconnectionEvent (report);
+				}));
+	}
+	try {
+		Device receiver (_dispatcher, HIDPP::DefaultDevice);
+		IReceiver ireceiver (&receiver);
+		for (auto index: WirelessDevices) {
+			PairingInfo info;
+			try {
+				ireceiver.getDeviceInformation (index - 1, nullptr, nullptr,
+								&info.wpid, nullptr);
+				info.name = ireceiver.getDeviceName (index - 1);
+			}
+			catch (Error &e) {
+				if (e.errorCode () != Error::InvalidValue)
+					throw;
+				continue; // empty slot
+			}
+			{
+				std::unique_lock<std::mutex> lock (_mutex);
+				_info.emplace (index, std::move (info));
+			}
+			_paired |= slotBit (index);
+		}
+		try {
+			ireceiver.notifyConnectedDevices ();
+		}
+		catch (Error &e) {
+			Log::debug () << "Receiver cannot notify connected devices: " << e.what () << std::endl;
+		}
+	}
+	catch (...) {
+		unregisterHandlers ();
+		throw;
+	}
+}
+
+ReceiverState::~ReceiverState ()
+{
+	unregisterHandlers ();
+}
+
+HIDPP::Dispatcher *ReceiverState::dispatcher () const
+{
+	return _dispatcher;
+}
+
+uint8_t ReceiverState::pairedSlots () const
+{
+	return _paired;
+}
+
+uint8_t ReceiverState::connectedSlots () const
+{
+	return _paired & (_connected | ~_known);
+}
+
+bool ReceiverState::isPaired (HIDPP::DeviceIndex index) const
+{
+	return pairedSlots () & slotBit (index);
+}
+
+bool ReceiverState::isConnected (HIDPP::DeviceIndex index) const
+{
+	return connectedSlots () & slotBit (index);
+}
+
+void ReceiverState::checkConnected (HIDPP::DeviceIndex index) const
+{
+	if (!isPaired (index))
+		throw Error (Error::UnknownDevice);
+	if (!isConnected (index))
+		throw Error (Error::ResourceError);
+}
+
+bool ReceiverState::pairingInfo (HIDPP::DeviceIndex index, uint16_t *wpid, std::string *name) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _info.find (index);
+	if (it == _info.end ())
+		return false;
+	if (wpid)
+		*wpid = it->second.wpid;
+	if (name)
+		*name = it->second.name;
+	return true;
+}
+
+bool ReceiverState::connectionEvent (const HIDPP::Report &report)
+{
+	auto params = report.parameterBegin ();
+	uint8_t bit = slotBit (report.deviceIndex ());
+	uint16_t wpid = readLE<uint16_t> (params+1);
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		auto it = _info.find (report.deviceIndex ());
+		if (it != _info.end () && it->second.wpid != wpid)
+			_info.erase (it); // another device was paired in this slot
+	}
+	_paired |= bit;
+	if (params[0] & 0x40) // link not established
+		_connected &= static_cast<uint8_t> (~bit);
+	else
+		_connected |= bit;
+	_known |= bit;
+	return true;
+}
+
+bool ReceiverState::disconnectionEvent (const HIDPP::Report &report)
+{
+	if (report.address () != 0x02) // only unpairing is notified this way
+		return true;
+	uint8_t bit = slotBit (report.deviceIndex ());
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_info.erase (report.deviceIndex ());
+	}
+	_paired &= static_cast<uint8_t> (~bit);
+	_connected &= static_cast<uint8_t> (~bit);
+	_known |= bit;
+	return true;
+}
+
+void ReceiverState::unregisterHandlers ()
+{
+	for (auto &it: _listeners)
+		_dispatcher->unregisterEventHandler (it);
+	_listeners.clear ();
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LIBHIDPP_HIDPP10_RECEIVER_STATE_H
+#define LIBHIDPP_HIDPP10_RECEIVER_STATE_H
+
+#include <hidpp/defs.h>
+#include <hidpp/Dispatcher.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace HIDPP10
+{
+
+/**
+ * Live view of the devices paired to a HID++ 1.0 receiver.
+ *
+ * The pairing information of every slot is read once by the constructor,
+ * then the receiver connection and disconnection notifications keep track
+ * of which devices are paired and which have their link established. Use
+ * it to avoid waiting for timeouts when talking to absent devices (e.g.
+ * by passing it to the HIDPP::Device constructor).
+ *
+ * Slot bitmaps use bit n for the wireless device index n+1.
+ *
+ * Notifications are only sent by receivers with wireless notifications
+ * enabled (as done by the kernel driver). State methods can be called
+ * from any thread.
+ */
+class ReceiverState
+{
+public:
+	/**
+	 * Read pairing information from the receiver on \p dispatcher and
+	 * start listening to its notifications.
+	 *
+	 * Paired devices are assumed connected until the receiver tells
+	 * otherwise.
+	 *
+	 * \throws HIDPP10::Error or any exception from the dispatcher.
+	 */
+	ReceiverState (HIDPP::Dispatcher *dispatcher);
+	~ReceiverState ();
+
+	ReceiverState (const ReceiverState &) = delete;
+	ReceiverState &operator= (const ReceiverState &) = delete;
+
+	HIDPP::Dispatcher *dispatcher () const;
+
+	uint8_t pairedSlots () const;
+	uint8_t connectedSlots () const;
+
+	bool isPaired (HIDPP::DeviceIndex index) const;
+	bool isConnected (HIDPP::DeviceIndex index) const;
+
+	/**
+	 * Throw the error a command to \p index would end with instead of
+	 * sending it.
+	 *
+	 * \throws HIDPP10::Error with \ref Error::UnknownDevice if the slot is
+	 * not paired, or \ref Error::ResourceError if the device is
+	 * disconnected.
+	 */
+	void checkConnected (HIDPP::DeviceIndex index) const;
+
+	/**
+	 * Get the wireless PID and name read from the receiver.
+	 *
+	 * \returns false if they were not read, e.g. for devices paired
+	 * after the constructor.
+	 */
+	bool pairingInfo (HIDPP::DeviceIndex index, uint16_t *wpid, std::string *name) const;
+
+private:
+	bool connectionEvent (const HIDPP::Report &report);
+	bool disconnectionEvent (const HIDPP::Report &report);
+	void unregisterHandlers ();
+
+	HIDPP::Dispatcher *_dispatcher;
+	std::vector<HIDPP::Dispatcher::listener_iterator> _listeners;
+	std::atomic<uint8_t> _paired;
+	std::atomic<uint8_t> _connected;
+	std::atomic<uint8_t> _known; // link state was notified
+	struct PairingInfo
+	{
+		uint16_t wpid;
+		std::string name;
+	};
+	mutable std::mutex _mutex;
+	std::map<HIDPP::DeviceIndex, PairingInfo> _info;
+};
+
+}
+
+#endif
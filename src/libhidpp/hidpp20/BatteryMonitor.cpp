@@ -0,0 +1,278 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "BatteryMonitor.h"
+
+#include <hidpp10/defs.h>
+#include <misc/Log.h>
+
+#include <stdexcept>
+
+using namespace HIDPP20;
+
+BatteryMonitor::BatteryMonitor (clock::duration staleness,
+				clock::duration spacing,
+				clock::duration jitter,
+				int timeout):
+	_staleness (staleness),
+	_spacing (spacing),
+	_jitter (jitter),
+	_timeout (timeout),
+	_next_id (0),
+	_in_flight (0),
+	_stopped (false),
+	_random (std::random_device () ())
+{
+}
+
+BatteryMonitor::~BatteryMonitor ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto devices = std::move (_devices);
+	_devices.clear ();
+	lock.unlock ();
+	for (auto &[dev, entry]: devices)
+		unregister (dev, entry.listeners);
+	lock.lock ();
+	_cond.wait (lock, [this] () { return _in_flight == 0; });
+}
+
+void BatteryMonitor::setLevelHandler (level_handler handler)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_handler = std::move (handler);
+}
+
+void BatteryMonitor::addDevice (Device *dev)
+{
+	IBatteryLevelStatus battery (dev);
+	uint64_t id;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_devices.find (dev) != _devices.end ())
+			throw std::invalid_argument ("Device is already monitored");
+		id = _next_id++;
+	}
+	// Events arriving before the entry is added are ignored, the first
+	// poll will get the level.
+	std::vector<HIDPP::Dispatcher::listener_iterator> listeners;
+	auto dispatcher = dev->dispatcher ();
+	auto index = dev->deviceIndex ();
+	auto handler = [this, dev, id] (const HIDPP::Report &report) {
+		return event (dev, id, report);
+	};
+	listeners.push_back (dispatcher->registerEventHandler (index, battery.index (), handler));
+	if (index >= HIDPP::WirelessDevice1 && index <= HIDPP::WirelessDevice6)
+		listeners.push_back (dispatcher->registerEventHandler (
+				index, HIDPP10::DeviceConnection, handler));
+
+	std::unique_lock<std::mutex> lock (_mutex);
+	Entry entry = { id, battery, std::move (listeners), std::nullopt,
+			clock::now () + jitter (), false };
+	_devices.emplace (dev, std::move (entry));
+	++_receivers[dispatcher].devices;
+	_cond.notify_all ();
+}
+
+void BatteryMonitor::removeDevice (const Device *dev)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _devices.find (dev);
+	if (it == _devices.end ())
+		return;
+	auto listeners = std::move (it->second.listeners);
+	_devices.erase (it);
+	auto rit = _receivers.find (dev->dispatcher ());
+	if (--rit->second.devices == 0 && !rit->second.polling)
+		_receivers.erase (rit);
+	lock.unlock ();
+	unregister (dev, listeners);
+}
+
+std::optional<BatteryMonitor::Level> BatteryMonitor::level (const Device *dev) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _devices.find (dev);
+	if (it == _devices.end ())
+		return std::nullopt;
+	return it->second.level;
+}
+
+std::map<const Device *, BatteryMonitor::Level> BatteryMonitor::levels () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::map<const Device *, Level> levels;
+	for (const auto &[dev, entry]: _devices)
+		if (entry.level)
+			levels.emplace (dev, *entry.level);
+	return levels;
+}
+
+void BatteryMonitor::run ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	while (!_stopped) {
+		auto now = clock::now ();
+		std::optional<clock::time_point> wake;
+		std::vector<const Device *> due;
+		for (auto &[dev, entry]: _devices) {
+			if (entry.polling)
+				continue;
+			auto &receiver = _receivers[dev->dispatcher ()];
+			if (receiver.polling)
+				continue; // woken when the poll finishes
+			auto time = std::max (entry.next_poll, receiver.next_allowed);
+			if (time <= now) {
+				entry.polling = true;
+				receiver.polling = true;
+				due.push_back (dev);
+			}
+			else if (!wake || time < *wake)
+				wake = time;
+		}
+		if (!due.empty ()) {
+			for (auto dev: due)
+				poll (dev, lock);
+			continue;
+		}
+		if (wake)
+			_cond.wait_until (lock, *wake);
+		else
+			_cond.wait (lock);
+	}
+	_stopped = false;
+}
+
+void BatteryMonitor::stop ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_stopped = true;
+	_cond.notify_all ();
+}
+
+BatteryMonitor::clock::duration BatteryMonitor::jitter ()
+{
+	if (_jitter.count () <= 0)
+		return clock::duration::zero ();
+	std::uniform_int_distribution<clock::rep> dist (0, _jitter.count ());
+	return clock::duration (dist (_random));
+}
+
+void BatteryMonitor::poll (const Device *dev, std::unique_lock<std::mutex> &lock)
+{
+	auto dispatcher = dev->dispatcher ();
+	auto it = _devices.find (dev);
+	if (it == _devices.end ()) {
+		// removed while polling another device
+		auto rit = _receivers.find (dispatcher);
+		rit->second.polling = false;
+		if (rit->second.devices == 0)
+			_receivers.erase (rit);
+		return;
+	}
+	auto id = it->second.id;
+	auto battery = it->second.battery;
+	++_in_flight;
+	lock.unlock ();
+	try {
+		battery.getLevelStatusAsync ([this, dev, id, dispatcher] (const IBatteryLevelStatus::LevelStatus *status, std::exception_ptr error) {
+			if (error) {
+				try {
+					std::rethrow_exception (error);
+				}
+				catch (std::exception &e) {
+					Log::debug () << "Battery level poll failed: " << e.what () << std::endl;
+				}
+			}
+			polled (dev, id, dispatcher, status);
+		}, _timeout);
+	}
+	catch (std::exception &e) {
+		Log::debug () << "Battery level poll failed: " << e.what () << std::endl;
+		polled (dev, id, dispatcher, nullptr);
+	}
+	lock.lock ();
+}
+
+void BatteryMonitor::polled (const Device *dev, uint64_t id, HIDPP::Dispatcher *dispatcher,
+			     const IBatteryLevelStatus::LevelStatus *status)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto now = clock::now ();
+	auto rit = _receivers.find (dispatcher);
+	if (rit != _receivers.end ()) {
+		rit->second.polling = false;
+		rit->second.next_allowed = now + _spacing;
+		if (rit->second.devices == 0)
+			_receivers.erase (rit);
+	}
+	level_handler handler;
+	Level level;
+	auto it = _devices.find (dev);
+	if (it != _devices.end () && it->second.id == id) {
+		auto &entry = it->second;
+		entry.polling = false;
+		// On failure, wait for a reconnection or the next staleness period
+		entry.next_poll = now + _staleness + jitter ();
+		if (status) {
+			level = { *status, now };
+			entry.level = level;
+			handler = _handler;
+		}
+	}
+	--_in_flight;
+	_cond.notify_all ();
+	lock.unlock ();
+	if (handler)
+		handler (dev, level);
+}
+
+bool BatteryMonitor::event (const Device *dev, uint64_t id, const HIDPP::Report &report)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _devices.find (dev);
+	if (it == _devices.end () || it->second.id != id)
+		return true;
+	auto &entry = it->second;
+	auto now = clock::now ();
+	if (report.subID () == HIDPP10::DeviceConnection) {
+		if (!(report.parameterBegin ()[0] & 0x40)) { // link established
+			// The level may have changed while disconnected
+			entry.next_poll = now + jitter ();
+			_cond.notify_all ();
+		}
+		return true;
+	}
+	if (report.function () != IBatteryLevelStatus::BatteryLevelEvent)
+		return true;
+	Level level = { IBatteryLevelStatus::batteryLevelEvent (report), now };
+	entry.level = level;
+	entry.next_poll = now + _staleness + jitter ();
+	auto handler = _handler;
+	lock.unlock ();
+	if (handler)
+		handler (dev, level);
+	return true;
+}
+
+void BatteryMonitor::unregister (const Device *dev, std::vector<HIDPP::Dispatcher::listener_iterator> &listeners)
+{
+	for (auto &it: listeners)
+		dev->dispatcher ()->unregisterEventHandler (it);
+	listeners.clear ();
+}
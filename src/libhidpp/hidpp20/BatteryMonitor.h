@@ -0,0 +1,153 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_BATTERY_MONITOR_H
+#define LIBHIDPP_HIDPP20_BATTERY_MONITOR_H
+
+#include <hidpp20/IBatteryLevelStatus.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <vector>
+
+namespace HIDPP20
+{
+
+/**
+ * Battery levels of many devices, with as few queries as possible.
+ *
+ * Levels come from IBatteryLevelStatus::BatteryLevelEvent first. A
+ * device is only polled when no level was received for the staleness
+ * budget, or soon after a wireless device reconnects. Polls are delayed
+ * by a random jitter so that devices added together are not polled
+ * together, and each dispatcher (i.e. receiver) has at most one poll
+ * in flight, with a minimum spacing between its polls. A failed poll
+ * (e.g. the device is asleep or out of range) is not retried before
+ * the next staleness period.
+ *
+ * Polls are sent from the thread calling \ref run, use concurrent
+ * dispatchers (e.g. HIDPP::DispatcherThread) so that a slow device does
+ * not delay the others.
+ */
+class BatteryMonitor
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct Level
+	{
+		IBatteryLevelStatus::LevelStatus status;
+		clock::time_point time; ///< when the level was received
+	};
+
+	/**
+	 * Called from a dispatcher or the \ref run thread when a level is
+	 * received. It must not call the monitor.
+	 */
+	typedef std::function<void (const Device *dev, const Level &level)> level_handler;
+
+	/**
+	 * \param staleness	Poll a device when its level is older.
+	 * \param spacing	Minimum time between polls on the same dispatcher.
+	 * \param jitter	Maximum random delay added to each poll.
+	 * \param timeout	Timeout of each poll in milliseconds.
+	 */
+	BatteryMonitor (clock::duration staleness = std::chrono::minutes (10),
+			clock::duration spacing = std::chrono::milliseconds (500),
+			clock::duration jitter = std::chrono::seconds (30),
+			int timeout = 2000);
+	/**
+	 * Stop monitoring every device and wait for the polls in flight.
+	 */
+	~BatteryMonitor ();
+
+	BatteryMonitor (const BatteryMonitor &) = delete;
+	BatteryMonitor &operator= (const BatteryMonitor &) = delete;
+
+	void setLevelHandler (level_handler handler);
+
+	/**
+	 * Start monitoring \p dev, it must outlive its monitoring.
+	 *
+	 * \throws UnsupportedFeature if the device has no battery level
+	 * feature.
+	 */
+	void addDevice (Device *dev);
+	void removeDevice (const Device *dev);
+
+	/**
+	 * Last level received from \p dev, without querying it.
+	 */
+	std::optional<Level> level (const Device *dev) const;
+	/**
+	 * Last levels of every monitored device that sent one, without
+	 * querying them.
+	 */
+	std::map<const Device *, Level> levels () const;
+
+	/**
+	 * Schedule polls until \ref stop is called.
+	 */
+	void run ();
+	void stop ();
+
+private:
+	struct Entry
+	{
+		uint64_t id; // tells apart successive entries of the same device
+		IBatteryLevelStatus battery;
+		std::vector<HIDPP::Dispatcher::listener_iterator> listeners;
+		std::optional<Level> level;
+		clock::time_point next_poll;
+		bool polling;
+	};
+	struct Receiver
+	{
+		unsigned int devices = 0;
+		bool polling = false;
+		clock::time_point next_allowed;
+	};
+
+	clock::duration jitter (); // _mutex must be held
+	void poll (const Device *dev, std::unique_lock<std::mutex> &lock);
+	void polled (const Device *dev, uint64_t id, HIDPP::Dispatcher *dispatcher,
+		     const IBatteryLevelStatus::LevelStatus *status);
+	bool event (const Device *dev, uint64_t id, const HIDPP::Report &report);
+	void unregister (const Device *dev, std::vector<HIDPP::Dispatcher::listener_iterator> &listeners);
+
+	const clock::duration _staleness, _spacing, _jitter;
+	const int _timeout;
+	mutable std::mutex _mutex;
+	std::condition_variable _cond;
+	std::map<const Device *, Entry> _devices;
+	std::map<HIDPP::Dispatcher *, Receiver> _receivers;
+	uint64_t _next_id;
+	unsigned int _in_flight;
+	bool _stopped;
+	std::mt19937 _random;
+	level_handler _handler;
+};
+
+}
+
+#endif
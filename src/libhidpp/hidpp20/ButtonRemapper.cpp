@@ -0,0 +1,298 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ButtonRemapper.h"
+
+#include <misc/Log.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace HIDPP20;
+
+constexpr std::chrono::microseconds ButtonRemapper::Budget;
+
+ButtonRemapper::ButtonRemapper (Device *dev, Output &output,
+				const std::map<uint16_t, Action> &actions,
+				std::vector<std::vector<MacroStep>> macros,
+				Source source):
+	_dev (dev),
+	_output (output),
+	_source (source),
+	_base_dpi (0),
+	_buttons {},
+	_mapped_buttons (0),
+	_pressed {},
+	_button_mask (0),
+	_events (0),
+	_over_budget (0),
+	_max_processing (0),
+	_total_latency (0),
+	_max_latency (0)
+{
+	if (_source == Source::DivertedControls)
+		_reprog.emplace (dev);
+	else
+		_spy.emplace (dev);
+	for (const auto &macro: macros) {
+		_macros.emplace_back (_macro_steps.size (), macro.size ());
+		_macro_steps.insert (_macro_steps.end (), macro.begin (), macro.end ());
+	}
+	// std::map is already sorted by control ID
+	for (const auto &[control_id, action]: actions) {
+		if (action.type == Action::None)
+			continue;
+		if (action.type == Action::Macro && action.code >= _macros.size ())
+			throw std::invalid_argument ("Invalid macro index");
+		if (action.type == Action::DPIShift && !_dpi)
+			_dpi.emplace (dev);
+		if (_source == Source::MouseButtonSpy) {
+			if (control_id >= ButtonCount)
+				throw std::invalid_argument ("Invalid button");
+			_buttons[control_id] = action;
+			_mapped_buttons |= 1 << control_id;
+		}
+		else
+			_table.push_back ({ control_id, action });
+	}
+	if (_dpi)
+		_queue.emplace (dev);
+}
+
+ButtonRemapper::~ButtonRemapper ()
+{
+	stop ();
+}
+
+void ButtonRemapper::start ()
+{
+	if (!_listeners.empty ())
+		return;
+	if (_dpi)
+		_base_dpi = std::get<0> (_dpi->getSensorDPI (0));
+	_pressed.count = 0;
+	_button_mask = 0;
+	auto dispatcher = _dev->dispatcher ();
+	uint8_t feature = _reprog ? _reprog->index () : _spy->index ();
+	_listeners.push_back (dispatcher->registerEventHandler (
+			_dev->deviceIndex (), feature,
+			[this] (const HIDPP::Report &report) {
+				return event (report);
+			}));
+	if (_spy)
+		_spy->startMouseButtonSpy ();
+	if (_reprog)
+		_reprog->setControlReporting (reportings (true));
+}
+
+void ButtonRemapper::stop ()
+{
+	if (_listeners.empty ())
+		return;
+	for (auto it: _listeners)
+		_dev->dispatcher ()->unregisterEventHandler (it);
+	_listeners.clear ();
+	releaseAll ();
+	try {
+		if (_spy)
+			_spy->stopMouseButtonSpy ();
+	}
+	catch (std::exception &e) {
+		Log::debug () << "Could not stop the button spy: " << e.what () << std::endl;
+	}
+	try {
+		if (_reprog)
+			_reprog->setControlReporting (reportings (false));
+	}
+	catch (std::exception &e) {
+		Log::debug () << "Could not restore control reporting: " << e.what () << std::endl;
+	}
+	if (_queue)
+		_queue->wait ();
+}
+
+ButtonRemapper::Statistics ButtonRemapper::statistics () const
+{
+	return {
+		_events.load (),
+		_over_budget.load (),
+		std::chrono::nanoseconds (_max_processing.load ()),
+		std::chrono::nanoseconds (_total_latency.load ()),
+		std::chrono::nanoseconds (_max_latency.load ()),
+	};
+}
+
+std::vector<IReprogControlsV4::ControlReporting> ButtonRemapper::reportings (bool divert) const
+{
+	std::vector<IReprogControlsV4::ControlReporting> reportings;
+	for (const auto &entry: _table)
+		reportings.push_back ({ entry.control_id,
+				static_cast<uint8_t> (IReprogControlsV4::ChangeTemporaryDivert |
+						      (divert ? IReprogControlsV4::TemporaryDiverted : 0)),
+				0 });
+	return reportings;
+}
+
+const ButtonRemapper::Action *ButtonRemapper::find (uint16_t control_id) const
+{
+	auto it = std::lower_bound (_table.begin (), _table.end (), control_id,
+			[] (const Entry &entry, uint16_t id) {
+				return entry.control_id < id;
+			});
+	if (it == _table.end () || it->control_id != control_id)
+		return nullptr;
+	return &it->action;
+}
+
+void ButtonRemapper::apply (const Action &action, bool pressed)
+{
+	switch (action.type) {
+	case Action::None:
+		break;
+	case Action::Key:
+		_output.key (action.code, pressed);
+		break;
+	case Action::ConsumerControl:
+		_output.consumerControl (action.code, pressed);
+		break;
+	case Action::Macro:
+		if (pressed) {
+			auto [first, count] = _macros[action.code];
+			for (std::size_t i = first; i < first+count; ++i)
+				_output.key (_macro_steps[i].key, _macro_steps[i].pressed);
+		}
+		break;
+	case Action::DPIShift:
+		_dpi->setSensorDPI (*_queue, 0, pressed ? action.code : _base_dpi);
+		break;
+	}
+}
+
+// Index of the lowest set bit of a non-zero mask
+static inline unsigned int lowestBit (uint16_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctz (mask);
+#else
+	unsigned int i = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++i;
+	}
+	return i;
+#endif
+}
+
+void ButtonRemapper::releaseAll ()
+{
+	unsigned int applied = 0;
+	for (unsigned int i = 0; i < _pressed.count; ++i)
+		if (auto action = find (_pressed.controls[i])) {
+			apply (*action, false);
+			++applied;
+		}
+	for (uint16_t mask = _button_mask & _mapped_buttons; mask != 0; mask &= mask-1) {
+		apply (_buttons[lowestBit (mask)], false);
+		++applied;
+	}
+	if (applied > 0)
+		_output.sync ();
+	_pressed.count = 0;
+	_button_mask = 0;
+}
+
+static bool contains (const IReprogControlsV4::DivertedButtons &buttons, uint16_t control_id)
+{
+	for (unsigned int i = 0; i < buttons.count; ++i)
+		if (buttons.controls[i] == control_id)
+			return true;
+	return false;
+}
+
+unsigned int ButtonRemapper::controlEvent (const HIDPP::Report &report)
+{
+	IReprogControlsV4::DivertedButtons buttons;
+	if (!IReprogControlsV4::divertedButtonEvent (HIDPP::ReportView (report), buttons))
+		return 0;
+	// Releases first, so that a control replaced by another in the
+	// same report does not overlap it.
+	unsigned int applied = 0;
+	for (unsigned int i = 0; i < _pressed.count; ++i)
+		if (!contains (buttons, _pressed.controls[i]))
+			if (auto action = find (_pressed.controls[i])) {
+				apply (*action, false);
+				++applied;
+			}
+	for (unsigned int i = 0; i < buttons.count; ++i)
+		if (!contains (_pressed, buttons.controls[i]))
+			if (auto action = find (buttons.controls[i])) {
+				apply (*action, true);
+				++applied;
+			}
+	_pressed = buttons;
+	return applied;
+}
+
+unsigned int ButtonRemapper::buttonEvent (const HIDPP::Report &report)
+{
+	if (report.function () != IMouseButtonSpy::MouseButtonEvent)
+		return 0;
+	uint16_t mask = IMouseButtonSpy::mouseButtonEvent (report);
+	uint16_t changed = (mask ^ _button_mask) & _mapped_buttons;
+	// Only the buttons with an action are walked, releases first
+	uint16_t released = changed & _button_mask;
+	uint16_t pressed = changed & mask;
+	unsigned int applied = 0;
+	for (; released != 0; released &= released-1, ++applied)
+		apply (_buttons[lowestBit (released)], false);
+	for (; pressed != 0; pressed &= pressed-1, ++applied)
+		apply (_buttons[lowestBit (pressed)], true);
+	_button_mask = mask;
+	return applied;
+}
+
+bool ButtonRemapper::event (const HIDPP::Report &report)
+{
+	auto start = std::chrono::steady_clock::now ();
+	try {
+		unsigned int applied = _source == Source::MouseButtonSpy ?
+			buttonEvent (report) :
+			controlEvent (report);
+		if (applied == 0)
+			return true;
+		_output.sync ();
+	}
+	catch (std::exception &e) {
+		Log::error () << "Failed to apply remapped action: " << e.what () << std::endl;
+	}
+
+	auto end = std::chrono::steady_clock::now ();
+	auto processing = std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count ();
+	++_events;
+	if (processing > std::chrono::nanoseconds (Budget).count ())
+		++_over_budget;
+	auto max = _max_processing.load ();
+	while (processing > max && !_max_processing.compare_exchange_weak (max, processing));
+	if (report.receiveTime () != std::chrono::steady_clock::time_point ()) {
+		auto latency = std::chrono::duration_cast<std::chrono::nanoseconds> (end - report.receiveTime ()).count ();
+		_total_latency += latency;
+		max = _max_latency.load ();
+		while (latency > max && !_max_latency.compare_exchange_weak (max, latency));
+	}
+	return true;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_BUTTON_REMAPPER_H
+#define LIBHIDPP_HIDPP20_BUTTON_REMAPPER_H
+
+#include <hidpp20/IAdjustableDPI.h>
+#include <hidpp20/IMouseButtonSpy.h>
+#include <hidpp20/IReprogControlsV4.h>
+#include <hidpp20/SetterQueue.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace HIDPP20
+{
+
+/**
+ * Remap controls or mouse buttons to actions in userspace.
+ *
+ * With Source::DivertedControls, the controls with an action are
+ * temporarily diverted with IReprogControlsV4 (all of them in one
+ * pipelined burst, when starting and stopping), their
+ * DivertedButtonEvent are then translated on the dispatcher thread:
+ * presses and releases are found by comparing with the previous event
+ * and each control is looked up in a table sorted when the remapper is
+ * created.
+ *
+ * With Source::MouseButtonSpy, the buttons are spied with
+ * IMouseButtonSpy: the changed bits of successive button masks are
+ * walked with bit operations and each button indexes a fixed table.
+ *
+ * Processing an event does not allocate nor wait for the device, the
+ * events of one report are sent to the output followed by a single
+ * Output::sync.
+ *
+ * Use a concurrent dispatcher (e.g. HIDPP::DispatcherThread): DPI
+ * shifts are sent through a SetterQueue from the event handler.
+ */
+class ButtonRemapper
+{
+public:
+	struct Action
+	{
+		enum Type: uint8_t {
+			None,
+			Key,		///< \p code is held while the control is pressed
+			ConsumerControl,	///< \p code is a HID consumer usage held while the control is pressed
+			Macro,		///< \p code is the index of a macro, played when the control is pressed
+			DPIShift,	///< \p code is the DPI of the first sensor while the control is pressed
+		};
+		Type type = None;
+		uint16_t code = 0;
+	};
+
+	/**
+	 * A macro step is a key press or release.
+	 */
+	struct MacroStep
+	{
+		uint16_t key;
+		bool pressed;
+	};
+
+	/**
+	 * Receives the translated events, from the dispatcher thread.
+	 */
+	class Output
+	{
+	public:
+		virtual ~Output () = default;
+		virtual void key (uint16_t code, bool pressed) = 0;
+		virtual void consumerControl (uint16_t usage, bool pressed) = 0;
+		/**
+		 * End of the events translated from one report.
+		 */
+		virtual void sync () = 0;
+	};
+
+	/**
+	 * Events processed slower than this are counted in
+	 * Statistics::over_budget.
+	 */
+	static constexpr std::chrono::microseconds Budget = std::chrono::microseconds (1000);
+
+	struct Statistics
+	{
+		uint64_t events;
+		uint64_t over_budget;
+		std::chrono::nanoseconds max_processing;
+		/**
+		 * From reading the report to the end of Output::sync, for
+		 * reports with a receive time.
+		 */
+		std::chrono::nanoseconds total_latency, max_latency;
+	};
+
+	enum class Source {
+		DivertedControls,	///< actions are indexed by control ID
+		MouseButtonSpy,		///< actions are indexed by button number (0 to 15)
+	};
+
+	/**
+	 * \param actions	Action of each control ID or button.
+	 * \param macros	Steps of the macros used by Action::Macro.
+	 *
+	 * \throws UnsupportedFeature if the device has no IReprogControlsV4
+	 * or IMouseButtonSpy (or IAdjustableDPI when a DPI shift is used).
+	 * \throws std::invalid_argument if an action uses a missing macro
+	 * or an invalid button.
+	 */
+	ButtonRemapper (Device *dev, Output &output,
+			const std::map<uint16_t, Action> &actions,
+			std::vector<std::vector<MacroStep>> macros = {},
+			Source source = Source::DivertedControls);
+	/**
+	 * Calls \ref stop.
+	 */
+	~ButtonRemapper ();
+
+	ButtonRemapper (const ButtonRemapper &) = delete;
+	ButtonRemapper &operator= (const ButtonRemapper &) = delete;
+
+	/**
+	 * Divert the remapped controls (or start spying the buttons) and
+	 * start translating their events.
+	 */
+	void start ();
+	/**
+	 * Release the held actions and restore the reporting of the
+	 * controls (or stop spying).
+	 */
+	void stop ();
+
+	Statistics statistics () const;
+
+private:
+	struct Entry
+	{
+		uint16_t control_id;
+		Action action;
+	};
+
+	static constexpr unsigned int ButtonCount = 16;
+
+	// Diversion of every control of the table, applied in one burst
+	std::vector<IReprogControlsV4::ControlReporting> reportings (bool divert) const;
+	const Action *find (uint16_t control_id) const;
+	void apply (const Action &action, bool pressed);
+	void releaseAll ();
+	unsigned int controlEvent (const HIDPP::Report &report);
+	unsigned int buttonEvent (const HIDPP::Report &report);
+	bool event (const HIDPP::Report &report);
+
+	Device *_dev;
+	Output &_output;
+	const Source _source;
+	std::optional<IReprogControlsV4> _reprog;
+	std::optional<IMouseButtonSpy> _spy;
+	std::optional<IAdjustableDPI> _dpi;
+	std::optional<SetterQueue> _queue;
+	unsigned int _base_dpi;
+	std::vector<Entry> _table; // sorted by control ID
+	std::array<Action, ButtonCount> _buttons;
+	uint16_t _mapped_buttons;
+	std::vector<MacroStep> _macro_steps;
+	std::vector<std::pair<std::size_t, std::size_t>> _macros; // ranges of _macro_steps
+	std::vector<HIDPP::Dispatcher::listener_iterator> _listeners;
+	// Only used from the dispatcher thread while started
+	IReprogControlsV4::DivertedButtons _pressed;
+	uint16_t _button_mask;
+	std::atomic<uint64_t> _events, _over_budget;
+	std::atomic<int64_t> _max_processing, _total_latency, _max_latency;
+};
+
+}
+
+#endif
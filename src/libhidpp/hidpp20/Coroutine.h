@@ -0,0 +1,117 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_COROUTINE_H
+#define LIBHIDPP_HIDPP20_COROUTINE_H
+
+/**
+ * \file
+ * C++20 awaitables for HID++ 2.0 function calls.
+ *
+ * \see hidpp/Coroutine.h
+ */
+
+#include <hidpp/Coroutine.h>
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+
+#include <hidpp20/FeatureInterface.h>
+
+namespace HIDPP20
+{
+
+/**
+ * Awaitable calling a feature function and resuming with its results.
+ *
+ * \see callFunction, call
+ */
+class CallAwaiter
+{
+public:
+	CallAwaiter (Device *device, uint8_t feature_index, unsigned int function, std::vector<uint8_t> &&params):
+		_device (device),
+		_feature_index (feature_index),
+		_function (function),
+		_params (std::move (params))
+	{
+	}
+
+	bool await_ready () const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend (std::coroutine_handle<> coroutine)
+	{
+		// The coroutine may be resumed (and this awaiter destroyed)
+		// before callFunctionAsync returns, do not use members after.
+		_device->callFunctionAsync (_feature_index, _function, _params, [this, coroutine] (const std::vector<uint8_t> *results, std::exception_ptr error) {
+			if (results)
+				_results = *results;
+			else
+				_error = error;
+			coroutine.resume ();
+		});
+	}
+
+	std::vector<uint8_t> await_resume ()
+	{
+		if (_error)
+			std::rethrow_exception (_error);
+		return std::move (_results);
+	}
+
+private:
+	Device *_device;
+	uint8_t _feature_index;
+	unsigned int _function;
+	std::vector<uint8_t> _params;
+	std::vector<uint8_t> _results;
+	std::exception_ptr _error;
+};
+
+/**
+ * Coroutine version of Device::callFunction.
+ *
+ * \throws HIDPP20::Error from the co_await expression.
+ */
+inline CallAwaiter callFunction (Device &device,
+				 uint8_t feature_index,
+				 unsigned int function,
+				 std::vector<uint8_t> params = {})
+{
+	return CallAwaiter (&device, feature_index, function, std::move (params));
+}
+
+/**
+ * Coroutine version of FeatureInterface::call.
+ *
+ * \throws HIDPP20::Error from the co_await expression.
+ */
+inline CallAwaiter call (FeatureInterface &feature,
+			 unsigned int function,
+			 std::vector<uint8_t> params = {})
+{
+	return CallAwaiter (feature.device (), feature.index (), function, std::move (params));
+}
+
+}
+
+#endif
+
+#endif
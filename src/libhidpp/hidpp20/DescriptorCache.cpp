@@ -0,0 +1,222 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DescriptorCache.h"
+
+#include <misc/Log.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+using namespace HIDPP20;
+
+static constexpr char Header[] = "# libhidpp descriptor cache 1";
+
+static std::string toHex (const std::vector<uint8_t> &bytes)
+{
+	if (bytes.empty ())
+		return "-";
+	std::ostringstream ss;
+	ss << std::hex << std::setfill ('0');
+	for (auto byte: bytes)
+		ss << std::setw (2) << static_cast<unsigned int> (byte);
+	return ss.str ();
+}
+
+static std::vector<uint8_t> fromHex (const std::string &str)
+{
+	std::vector<uint8_t> bytes;
+	if (str == "-")
+		return bytes;
+	if (str.size () % 2 != 0)
+		throw std::runtime_error ("Invalid hexadecimal string");
+	for (std::size_t i = 0; i < str.size (); i += 2)
+		bytes.push_back (std::stoul (str.substr (i, 2), nullptr, 16));
+	return bytes;
+}
+
+DescriptorCache::DescriptorCache (const std::string &path):
+	_path (path),
+	_modified (false)
+{
+	try {
+		load ();
+	}
+	catch (std::exception &e) {
+		Log::warning () << "Ignoring invalid descriptor cache " << path
+				<< ": " << e.what () << std::endl;
+		_entries.clear ();
+	}
+}
+
+DescriptorCache::~DescriptorCache ()
+{
+	try {
+		if (_modified)
+			save ();
+	}
+	catch (std::exception &e) {
+		Log::error () << "Failed to save descriptor cache " << _path
+			      << ": " << e.what () << std::endl;
+	}
+}
+
+void DescriptorCache::load ()
+{
+	std::ifstream in (_path);
+	if (!in)
+		return; // no cache yet
+	std::string line;
+	if (!std::getline (in, line) || line != Header)
+		throw std::runtime_error ("unknown format");
+	Entry *entry = nullptr;
+	unsigned int line_number = 1;
+	while (std::getline (in, line)) {
+		++line_number;
+		std::istringstream ss (line);
+		std::string type;
+		if (!(ss >> type))
+			continue;
+		if (type == "device") {
+			std::string fingerprint;
+			if (!(ss >> fingerprint))
+				throw std::runtime_error ("missing fingerprint at line " + std::to_string (line_number));
+			entry = &_entries[fingerprint];
+			continue;
+		}
+		if (!entry)
+			throw std::runtime_error ("record before device at line " + std::to_string (line_number));
+		if (type == "feature") {
+			unsigned int id, index;
+			if (!(ss >> std::hex >> id >> index))
+				throw std::runtime_error ("invalid feature at line " + std::to_string (line_number));
+			entry->features[id] = index;
+		}
+		else if (type == "complete")
+			entry->complete = true;
+		else if (type == "call") {
+			unsigned int feature_id, function;
+			std::string params, results;
+			if (!(ss >> std::hex >> feature_id >> function >> params >> results))
+				throw std::runtime_error ("invalid call at line " + std::to_string (line_number));
+			entry->calls[std::make_tuple (feature_id, function, fromHex (params))] = fromHex (results);
+		}
+		else
+			throw std::runtime_error ("unknown record at line " + std::to_string (line_number));
+	}
+}
+
+void DescriptorCache::save ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::string tmp_path = _path + ".tmp";
+	{
+		std::ofstream out (tmp_path, std::ios::trunc);
+		if (!out)
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+		out << Header << std::endl << std::hex << std::setfill ('0');
+		for (const auto &[fingerprint, entry]: _entries) {
+			out << "device " << fingerprint << std::endl;
+			for (const auto &[id, index]: entry.features)
+				out << "feature " << std::setw (4) << id
+				    << " " << std::setw (2) << static_cast<unsigned int> (index) << std::endl;
+			if (entry.complete)
+				out << "complete" << std::endl;
+			for (const auto &[key, results]: entry.calls) {
+				const auto &[feature_id, function, params] = key;
+				out << "call " << std::setw (4) << feature_id
+				    << " " << function
+				    << " " << toHex (params)
+				    << " " << toHex (results) << std::endl;
+			}
+		}
+		if (!out.flush ())
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+	}
+	if (0 != std::rename (tmp_path.c_str (), _path.c_str ()))
+		throw std::system_error (errno, std::generic_category (), "rename");
+	_modified = false;
+}
+
+std::tuple<std::map<uint16_t, uint8_t>, bool> DescriptorCache::features (const std::string &fingerprint) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _entries.find (fingerprint);
+	_counter.count (it != _entries.end () && !it->second.features.empty ());
+	if (it == _entries.end ())
+		return {};
+	return { it->second.features, it->second.complete };
+}
+
+void DescriptorCache::storeFeature (const std::string &fingerprint, uint16_t feature_id, uint8_t index)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto &features = _entries[fingerprint].features;
+	auto [it, inserted] = features.emplace (feature_id, index);
+	if (inserted || it->second != index) {
+		it->second = index;
+		_modified = true;
+	}
+}
+
+void DescriptorCache::storeFeatureTable (const std::string &fingerprint, const std::map<uint16_t, uint8_t> &indices)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto &entry = _entries[fingerprint];
+	entry.features = indices;
+	entry.complete = true;
+	_modified = true;
+}
+
+std::optional<std::vector<uint8_t>> DescriptorCache::findCall (const std::string &fingerprint,
+							       uint16_t feature_id,
+							       unsigned int function,
+							       const std::vector<uint8_t> &params) const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto entry = _entries.find (fingerprint);
+	if (entry == _entries.end ()) {
+		_counter.count (false);
+		return std::nullopt;
+	}
+	auto it = entry->second.calls.find (std::make_tuple (feature_id, function, params));
+	_counter.count (it != entry->second.calls.end ());
+	if (it == entry->second.calls.end ())
+		return std::nullopt;
+	return it->second;
+}
+
+void DescriptorCache::storeCall (const std::string &fingerprint,
+				 uint16_t feature_id,
+				 unsigned int function,
+				 const std::vector<uint8_t> &params,
+				 const std::vector<uint8_t> &results)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_entries[fingerprint].calls[std::make_tuple (feature_id, function, params)] = results;
+	_modified = true;
+}
+
+const CacheCounter &DescriptorCache::counter () const noexcept
+{
+	return _counter;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_DESCRIPTOR_CACHE_H
+#define LIBHIDPP_HIDPP20_DESCRIPTOR_CACHE_H
+
+#include <misc/CacheCounter.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace HIDPP20
+{
+
+/**
+ * On-disk cache of static device metadata: feature indices and the
+ * results of functions describing the device (see
+ * FeatureInterface::callStatic).
+ *
+ * Entries are keyed by a device fingerprint (see
+ * Device::setDescriptorCache) made of the model, protocol version,
+ * feature count and main firmware version, so a firmware update
+ * invalidates them.
+ *
+ * The cache is a text file with one record per line. It can be shared
+ * by several devices and threads.
+ */
+class DescriptorCache
+{
+public:
+	/**
+	 * Load the cache from \p path if it exists.
+	 *
+	 * Invalid files are ignored (with a warning) and overwritten when
+	 * saving.
+	 */
+	DescriptorCache (const std::string &path);
+	/**
+	 * Save the cache if it was modified, errors are only logged.
+	 */
+	~DescriptorCache ();
+
+	DescriptorCache (const DescriptorCache &) = delete;
+	DescriptorCache &operator= (const DescriptorCache &) = delete;
+
+	/**
+	 * Write the cache, replacing the file atomically.
+	 *
+	 * \throws std::system_error
+	 */
+	void save ();
+
+	/**
+	 * Cached feature table of the device: indices by feature ID and
+	 * whether every supported feature is included.
+	 */
+	std::tuple<std::map<uint16_t, uint8_t>, bool> features (const std::string &fingerprint) const;
+	void storeFeature (const std::string &fingerprint, uint16_t feature_id, uint8_t index);
+	void storeFeatureTable (const std::string &fingerprint, const std::map<uint16_t, uint8_t> &indices);
+
+	std::optional<std::vector<uint8_t>> findCall (const std::string &fingerprint,
+						      uint16_t feature_id,
+						      unsigned int function,
+						      const std::vector<uint8_t> &params) const;
+	void storeCall (const std::string &fingerprint,
+			uint16_t feature_id,
+			unsigned int function,
+			const std::vector<uint8_t> &params,
+			const std::vector<uint8_t> &results);
+
+	/**
+	 * Hits and misses of features (a fingerprint with any feature is a
+	 * hit) and findCall.
+	 */
+	const CacheCounter &counter () const noexcept;
+
+private:
+	void load ();
+
+	struct Entry
+	{
+		std::map<uint16_t, uint8_t> features;
+		bool complete = false;
+		std::map<std::tuple<uint16_t, unsigned int, std::vector<uint8_t>>, std::vector<uint8_t>> calls;
+	};
+
+	std::string _path;
+	mutable std::mutex _mutex;
+	std::map<std::string, Entry> _entries;
+	bool _modified;
+	mutable CacheCounter _counter;
+};
+
+}
+
+#endif
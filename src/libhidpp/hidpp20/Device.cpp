@@ -19,14 +19,27 @@
 #include "Device.h"
 
 #include <hidpp/Dispatcher.h>
+#include <hidpp10/defs.h>
+#include <hidpp20/DescriptorCache.h>
+#include <hidpp20/DeviceInfo.h>
+#include <hidpp20/IDeviceInformation.h>
+#include <hidpp20/IFeatureSet.h>
+#include <hidpp20/IRoot.h>
+#include <misc/Endian.h>
 #include <misc/Log.h>
 
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <sstream>
+
 using namespace HIDPP20;
 
-unsigned int Device::softwareID = 1;
+static Log::Handle CallLog (Log::Debug, "call");
 
 Device::Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index):
-	HIDPP::Device (dispatcher, device_index)
+	HIDPP::Device (dispatcher, device_index),
+	_features (makeFeatureCache (dispatcher, device_index))
 {
 	auto version = protocolVersion ();
 	if (std::get<0> (version) < 2)
@@ -34,31 +47,474 @@ Device::Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index):
 }
 
 Device::Device (HIDPP::Device &&device):
-	HIDPP::Device (std::move (device))
+	HIDPP::Device (std::move (device)),
+	_features (makeFeatureCache (dispatcher (), deviceIndex ()))
+{
+	auto version = protocolVersion ();
+	if (std::get<0> (version) < 2)
+		throw HIDPP::Device::InvalidProtocolVersion (version);
+}
+
+Device::Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index,
+		const Identity &identity):
+	HIDPP::Device (dispatcher, device_index, identity),
+	_features (makeFeatureCache (dispatcher, device_index))
 {
 	auto version = protocolVersion ();
 	if (std::get<0> (version) < 2)
 		throw HIDPP::Device::InvalidProtocolVersion (version);
 }
 
+Device::FeatureCache::~FeatureCache ()
+{
+	if (dispatcher)
+		dispatcher->unregisterEventHandler (reconnection_listener);
+}
+
+std::shared_ptr<Device::FeatureCache> Device::makeFeatureCache (HIDPP::Dispatcher *dispatcher,
+								HIDPP::DeviceIndex index)
+{
+	auto features = std::make_shared<FeatureCache> ();
+	if (index >= HIDPP::WirelessDevice1 && index <= HIDPP::WirelessDevice6) {
+		FeatureCache *f = features.get (); // the listener does not outlive it
+		features->reconnection_listener = dispatcher->registerEventHandler (
+				index, HIDPP10::DeviceConnection,
+				[f] (const HIDPP::Report &report) {
+					if (report.parameterBegin ()[0] & 0x40)
+						return true; // link not established
+					std::unique_lock<std::mutex> lock (f->mutex);
+					// Another device or firmware may use this index now
+					f->indices.clear ();
+					f->complete = false;
+					f->results.clear ();
+					f->reconnected = true;
+					++f->generation;
+					return true;
+				});
+		features->dispatcher = dispatcher;
+	}
+	return features;
+}
+
+Device::AsyncCall::AsyncCall (std::unique_ptr<HIDPP::Dispatcher::AsyncReport> &&report):
+	_report (std::move (report))
+{
+}
+
+static void logResults (const HIDPP::Report &response)
+{
+	// Checked first so that calls do not build log objects when debug
+	// messages are disabled.
+	if (Log::DebugLevel < LIBHIDPP_LOG_MIN_LEVEL || !CallLog.isEnabled ())
+		return;
+	auto debug = CallLog.log ();
+	debug.printf ("Results from feature 0x%02hhx/function %u (software ID %u)\n",
+			response.featureIndex (), response.function (), response.softwareID ());
+	debug.printBytes ("Results:", response.parameterBegin (), response.parameterEnd ());
+}
+
+static std::vector<uint8_t> getResults (const HIDPP::Report &response)
+{
+	logResults (response);
+	return std::vector<uint8_t> (response.parameterBegin (), response.parameterEnd ());
+}
+
+static const uint8_t *paramData (std::vector<uint8_t>::const_iterator begin,
+				 std::vector<uint8_t>::const_iterator end)
+{
+	return begin == end ? nullptr : &*begin;
+}
+
+std::vector<uint8_t> Device::AsyncCall::get ()
+{
+	return getResults (_report->get ());
+}
+
+std::vector<uint8_t> Device::AsyncCall::get (int timeout)
+{
+	return getResults (_report->get (timeout));
+}
+
+HIDPP::Report Device::makeRequest (uint8_t feature_index,
+				   unsigned int function,
+				   const uint8_t *params, std::size_t param_length)
+{
+	auto type = dispatcher ()->reportInfo ().findReport (param_length);
+	if (!type)
+		throw std::logic_error ("Parameters too long");
+	unsigned int sw_id = dispatcher ()->nextSoftwareID ();
+
+	if (Log::DebugLevel >= LIBHIDPP_LOG_MIN_LEVEL && CallLog.isEnabled ()) {
+		auto debug = CallLog.log ();
+		debug.printf ("Calling feature 0x%02hhx/function %u (software ID %u)\n", feature_index, function, sw_id);
+		debug.printBytes ("Parameters:", params, params + param_length);
+	}
+
+	HIDPP::Report request (*type, deviceIndex (), feature_index, function, sw_id);
+	std::copy_n (params, param_length, request.parameterBegin ());
+	return request;
+}
+
+Device::AsyncCall Device::callFunctionAsync (uint8_t feature_index,
+					     unsigned int function,
+					     std::vector<uint8_t>::const_iterator param_begin,
+					     std::vector<uint8_t>::const_iterator param_end)
+{
+	auto request = makeRequest (feature_index, function,
+				    paramData (param_begin, param_end),
+				    std::distance (param_begin, param_end));
+	return AsyncCall (dispatcher ()->sendCommand (std::move (request)));
+}
+
+void Device::callFunctionAsync (uint8_t feature_index,
+				unsigned int function,
+				const std::vector<uint8_t> &params,
+				call_handler &&handler,
+				int timeout)
+{
+	auto request = makeRequest (feature_index, function, params.data (), params.size ());
+	dispatcher ()->sendCommand (std::move (request), [handler = std::move (handler)] (const HIDPP::Report *response, std::exception_ptr error) {
+		if (response) {
+			auto results = getResults (*response);
+			handler (&results, nullptr);
+		}
+		else
+			handler (nullptr, error);
+	}, timeout);
+}
+
 std::vector<uint8_t> Device::callFunction (uint8_t feature_index,
 					   unsigned int function,
 					   std::vector<uint8_t>::const_iterator param_begin,
 					   std::vector<uint8_t>::const_iterator param_end)
 {
-	auto debug = Log::debug ("call");
-	debug.printf ("Calling feature 0x%02hhx/function %u\n", feature_index, function);
-	debug.printBytes ("Parameters:", param_begin, param_end);
-
-	std::size_t len = std::distance (param_begin, param_end);
-	auto type = dispatcher ()->reportInfo ().findReport (len);
-	if (!type)
-		throw std::logic_error ("Parameters too long");
-	HIDPP::Report request (*type, deviceIndex (), feature_index, function, softwareID);
-	std::copy (param_begin, param_end, request.parameterBegin ());
+	return callFunctionAsync (feature_index, function, param_begin, param_end).get ();
+}
 
+std::size_t Device::callFunctionInto (uint8_t feature_index,
+				      unsigned int function,
+				      const uint8_t *params, std::size_t param_length,
+				      uint8_t *results, std::size_t result_length)
+{
+	auto request = makeRequest (feature_index, function, params, param_length);
 	auto response = dispatcher ()->sendCommand (std::move (request))->get ();
+	logResults (response);
+	std::size_t length = std::min<std::size_t> (result_length,
+			std::distance (response.parameterBegin (), response.parameterEnd ()));
+	std::copy_n (response.parameterBegin (), length, results);
+	return length;
+}
 
-	debug.printBytes ("Results:", response.parameterBegin (), response.parameterEnd ());
-	return std::vector<uint8_t> (response.parameterBegin (), response.parameterEnd ());
+HIDPP::CommandResult Device::tryCallFunction (uint8_t feature_index,
+					      unsigned int function,
+					      const std::vector<uint8_t> &params,
+					      int timeout)
+{
+	auto request = makeRequest (feature_index, function, params.data (), params.size ());
+	auto result = dispatcher ()->trySendCommand (std::move (request), timeout);
+	if (result)
+		logResults (*result.report);
+	return result;
+}
+
+std::vector<std::vector<uint8_t>> Device::callFunctions (const std::vector<Call> &calls)
+{
+	std::vector<std::vector<uint8_t>> results (calls.size ());
+	std::deque<AsyncCall> in_flight; // calls from index i to sent
+	std::size_t sent = 0;
+	std::exception_ptr error;
+	for (std::size_t i = 0; i < calls.size (); ++i) {
+		// Stop sending after the first error, but still wait for the
+		// calls in flight so that their answers are not mistaken
+		// for later ones.
+		while (!error && sent < calls.size () &&
+				in_flight.size () < HIDPP::Dispatcher::MaxSoftwareID) {
+			const auto &call = calls[sent];
+			try {
+				in_flight.push_back (callFunctionAsync (call.feature_index,
+									call.function,
+									call.params));
+				++sent;
+			}
+			catch (...) {
+				error = std::current_exception ();
+			}
+		}
+		if (in_flight.empty ())
+			break;
+		try {
+			results[i] = in_flight.front ().get ();
+		}
+		catch (...) {
+			if (!error)
+				error = std::current_exception ();
+		}
+		in_flight.pop_front ();
+	}
+	if (error)
+		std::rethrow_exception (error);
+	return results;
+}
+
+uint8_t Device::getFeatureIndex (uint16_t id)
+{
+	if (id == IRoot::ID)
+		return IRoot::index;
+	unsigned int generation;
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		auto it = _features->indices.find (id);
+		_features->counter.count (it != _features->indices.end () || _features->complete);
+		if (it != _features->indices.end ())
+			return it->second;
+		if (_features->complete)
+			return 0;
+		generation = _features->generation;
+	}
+	uint8_t index = IRoot (this).getFeature (id);
+	std::unique_lock<std::mutex> lock (_features->mutex);
+	addFeature (generation, id, index);
+	return index;
+}
+
+std::optional<uint8_t> Device::tryGetFeatureIndex (uint16_t id, int timeout)
+{
+	if (id == IRoot::ID)
+		return IRoot::index;
+	unsigned int generation;
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		auto it = _features->indices.find (id);
+		_features->counter.count (it != _features->indices.end () || _features->complete);
+		if (it != _features->indices.end ())
+			return it->second;
+		if (_features->complete)
+			return 0;
+		generation = _features->generation;
+	}
+	std::vector<uint8_t> params (2);
+	writeBE<uint16_t> (params, 0, id);
+	auto result = tryCallFunction (IRoot::index, IRoot::GetFeature, params, timeout);
+	if (!result)
+		return std::nullopt;
+	uint8_t index = result.report->parameterBegin ()[0];
+	std::unique_lock<std::mutex> lock (_features->mutex);
+	addFeature (generation, id, index);
+	return index;
+}
+
+void Device::loadFeatureTable ()
+{
+	unsigned int generation;
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		generation = _features->generation;
+	}
+	if (getFeatureIndex (IFeatureSet::ID) == 0)
+		return;
+	auto ids = IFeatureSet (this).getAllFeatures ();
+	std::map<uint16_t, uint8_t> indices;
+	for (unsigned int i = 1; i < ids.size (); ++i)
+		indices.emplace (ids[i], i);
+	std::unique_lock<std::mutex> lock (_features->mutex);
+	if (_features->generation != generation)
+		return; // the table may be from the previous device
+	if (_features->cache && !_features->reconnected)
+		_features->cache->storeFeatureTable (_features->fingerprint, indices);
+	_features->indices = std::move (indices);
+	_features->complete = true;
+	dispatcher ()->setFeatureCount (deviceIndex (), ids.size ());
+}
+
+bool Device::loadKnownFeatures ()
+{
+	const ModelInfo *info = getModelInfo (productID ());
+	if (!info)
+		return false;
+	std::vector<uint16_t> ids;
+	std::vector<Call> calls;
+	unsigned int generation;
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		if (_features->complete)
+			return true;
+		generation = _features->generation;
+		for (std::size_t i = 0; i < info->feature_count; ++i) {
+			uint16_t id = info->features[i];
+			if (_features->indices.find (id) != _features->indices.end ())
+				continue;
+			std::vector<uint8_t> params (2);
+			writeBE<uint16_t> (params, 0, id);
+			ids.push_back (id);
+			calls.push_back ({ IRoot::index, IRoot::GetFeature, std::move (params) });
+		}
+	}
+	auto results = callFunctions (calls);
+	std::unique_lock<std::mutex> lock (_features->mutex);
+	for (std::size_t i = 0; i < ids.size (); ++i)
+		addFeature (generation, ids[i], results[i][0]);
+	return true;
+}
+
+void Device::clearFeatureCache ()
+{
+	std::unique_lock<std::mutex> lock (_features->mutex);
+	_features->indices.clear ();
+	_features->complete = false;
+	_features->results.clear ();
+}
+
+std::shared_ptr<const CacheCounter> Device::featureCacheCounter () const
+{
+	return std::shared_ptr<const CacheCounter> (_features, &_features->counter);
+}
+
+std::string Device::computeFingerprint ()
+{
+	std::ostringstream ss;
+	auto [major, minor] = protocolVersion ();
+	ss << std::hex << std::setfill ('0')
+	   << std::setw (4) << dispatcher ()->vendorID ()
+	   << ":" << std::setw (4) << productID ()
+	   << ":" << major << "." << minor;
+	uint8_t feature_set = getFeatureIndex (IFeatureSet::ID);
+	unsigned int count = feature_set ? callFunction (feature_set, IFeatureSet::GetCount)[0] : 0;
+	ss << ":" << std::setw (2) << count << ":";
+	if (getFeatureIndex (IDeviceInformation::ID)) {
+		// Firmware type, name, version and build of the main entity
+		for (auto byte: IDeviceInformation (this).getRawFirmwareInfo (0))
+			ss << std::setw (2) << static_cast<unsigned int> (byte);
+	}
+	else
+		ss << "-";
+	return ss.str ();
+}
+
+std::string Device::fingerprint ()
+{
+	return computeFingerprint ();
+}
+
+void Device::setDescriptorCache (std::shared_ptr<DescriptorCache> cache)
+{
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		_features->cache.reset ();
+	}
+	if (!cache)
+		return;
+	unsigned int generation;
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		generation = _features->generation;
+	}
+	auto fingerprint = computeFingerprint ();
+	auto [indices, complete] = cache->features (fingerprint);
+	std::unique_lock<std::mutex> lock (_features->mutex);
+	if (_features->generation != generation) {
+		// Reconnected while computing: the fingerprint may be from the
+		// previous device, computed again by the next static call.
+		_features->cache = std::move (cache);
+		return;
+	}
+	// Indices are cleared on reconnection, the remaining ones were
+	// resolved on the device matching this fingerprint.
+	for (const auto &[id, index]: _features->indices)
+		cache->storeFeature (fingerprint, id, index);
+	_features->indices.merge (indices);
+	_features->complete = _features->complete || complete;
+	_features->cache = std::move (cache);
+	_features->fingerprint = std::move (fingerprint);
+	_features->reconnected = false;
+	routeFeatures ();
+}
+
+void Device::addFeature (unsigned int generation, uint16_t id, uint8_t index)
+{
+	if (_features->generation != generation)
+		return; // resolved on the previous device
+	_features->indices.emplace (id, index);
+	if (_features->cache && !_features->reconnected)
+		_features->cache->storeFeature (_features->fingerprint, id, index);
+	if (index != 0)
+		dispatcher ()->addFeatureIndex (deviceIndex (), index);
+}
+
+void Device::routeFeatures ()
+{
+	if (_features->complete) {
+		unsigned int count = 1;
+		for (const auto &[id, index]: _features->indices)
+			count = std::max<unsigned int> (count, index+1);
+		dispatcher ()->setFeatureCount (deviceIndex (), count);
+	}
+	else {
+		for (const auto &[id, index]: _features->indices)
+			if (index != 0)
+				dispatcher ()->addFeatureIndex (deviceIndex (), index);
+	}
+}
+
+std::vector<uint8_t> Device::callStaticFunction (uint16_t feature_id,
+						 uint8_t feature_index,
+						 unsigned int function,
+						 const std::vector<uint8_t> &params)
+{
+	return callStaticFunctions (feature_id, { { feature_index, function, params } })[0];
+}
+
+std::vector<std::vector<uint8_t>> Device::callStaticFunctions (uint16_t feature_id,
+							       const std::vector<Call> &calls)
+{
+	std::shared_ptr<DescriptorCache> cache;
+	bool reconnected;
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		cache = _features->cache;
+		reconnected = _features->reconnected;
+		_features->reconnected = false;
+	}
+	if (cache && reconnected)
+		setDescriptorCache (cache); // compute the fingerprint again
+	std::string fingerprint;
+	std::vector<std::vector<uint8_t>> results (calls.size ());
+	std::vector<std::size_t> missing, uncached_index;
+	std::vector<Call> uncached;
+	{
+		std::unique_lock<std::mutex> lock (_features->mutex);
+		fingerprint = _features->fingerprint;
+		for (std::size_t i = 0; i < calls.size (); ++i) {
+			auto it = _features->results.find (std::make_tuple (
+					feature_id, calls[i].function, calls[i].params));
+			_features->counter.count (it != _features->results.end ());
+			if (it != _features->results.end ())
+				results[i] = it->second;
+			else
+				missing.push_back (i);
+		}
+	}
+	for (auto i: missing) {
+		const auto &call = calls[i];
+		if (cache) {
+			if (auto cached = cache->findCall (fingerprint, feature_id,
+							   call.function, call.params)) {
+				results[i] = std::move (*cached);
+				continue;
+			}
+		}
+		uncached_index.push_back (i);
+		uncached.push_back (call);
+	}
+	auto called = callFunctions (uncached);
+	for (std::size_t j = 0; j < uncached.size (); ++j) {
+		const auto &call = uncached[j];
+		if (cache)
+			cache->storeCall (fingerprint, feature_id, call.function, call.params, called[j]);
+		results[uncached_index[j]] = std::move (called[j]);
+	}
+	std::unique_lock<std::mutex> lock (_features->mutex);
+	for (auto i: missing)
+		_features->results.emplace (std::make_tuple (feature_id, calls[i].function, calls[i].params),
+					    results[i]);
+	return results;
 }
@@ -20,17 +20,95 @@
 #define LIBHIDPP_HIDPP20_DEVICE_H
 
 #include <hidpp/Device.h>
+#include <hidpp/Dispatcher.h>
+#include <misc/CacheCounter.h>
 
-namespace HIDPP { class Dispatcher; }
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 
 namespace HIDPP20 {
 
+class DescriptorCache;
+
 class Device: public HIDPP::Device
 {
 public:
-	static unsigned int softwareID;
 	Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice);
 	Device (HIDPP::Device &&other);
+	/**
+	 * \see HIDPP::Device::Device(HIDPP::Dispatcher *, HIDPP::DeviceIndex, const Identity &)
+	 *
+	 * \throws HIDPP::Device::InvalidProtocolVersion if \p identity is
+	 * not a HID++ 2.0 or later device.
+	 */
+	Device (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex device_index, const Identity &identity);
+
+	/**
+	 * Function call whose results are retrieved later.
+	 *
+	 * \see callFunctionAsync
+	 */
+	class AsyncCall
+	{
+	public:
+		AsyncCall (std::unique_ptr<HIDPP::Dispatcher::AsyncReport> &&report);
+
+		/**
+		 * Wait for the function results.
+		 *
+		 * \throws HIDPP20::Error, HIDPP::Dispatcher::TimeoutError
+		 */
+		std::vector<uint8_t> get ();
+		/**
+		 * Wait for the function results with a timeout in milliseconds.
+		 *
+		 * \throws HIDPP20::Error, HIDPP::Dispatcher::TimeoutError
+		 */
+		std::vector<uint8_t> get (int timeout);
+
+	private:
+		std::unique_ptr<HIDPP::Dispatcher::AsyncReport> _report;
+	};
+
+	/**
+	 * Send a function call without waiting for its results.
+	 *
+	 * Every call is sent with its own software ID (see
+	 * HIDPP::Dispatcher::nextSoftwareID), so up to
+	 * HIDPP::Dispatcher::MaxSoftwareID calls can be kept in flight when
+	 * the dispatcher supports concurrent commands (HIDPP::DispatcherThread).
+	 */
+	AsyncCall callFunctionAsync (uint8_t feature_index,
+				     unsigned int function,
+				     std::vector<uint8_t>::const_iterator param_begin,
+				     std::vector<uint8_t>::const_iterator param_end);
+
+	inline AsyncCall callFunctionAsync (uint8_t feature_index,
+					    unsigned int function,
+					    const std::vector<uint8_t> &params = {})
+	{
+		return callFunctionAsync (feature_index, function, params.begin (), params.end ());
+	}
+
+	/**
+	 * Completion handler for function calls.
+	 *
+	 * \p results is null if the call failed with \p error.
+	 */
+	typedef std::function<void (const std::vector<uint8_t> *results, std::exception_ptr error)> call_handler;
+
+	/**
+	 * Send a function call and call \p handler with its results.
+	 *
+	 * \see HIDPP::Dispatcher::sendCommand(HIDPP::Report &&, completion_handler &&, int)
+	 */
+	void callFunctionAsync (uint8_t feature_index,
+				unsigned int function,
+				const std::vector<uint8_t> &params,
+				call_handler &&handler,
+				int timeout = -1);
 
 	std::vector<uint8_t> callFunction (uint8_t feature_index,
 					   unsigned int function,
@@ -39,10 +117,193 @@ public:
 
 	inline std::vector<uint8_t> callFunction (uint8_t feature_index,
 						  unsigned int function,
-						  const std::vector<uint8_t> params = {})
+						  const std::vector<uint8_t> &params = {})
 	{
 		return callFunction (feature_index, function, params.begin (), params.end ());
 	}
+
+	/**
+	 * Call a function without allocating parameter or result buffers,
+	 * for calls made often (e.g. setting changes).
+	 *
+	 * \p param_length bytes are sent from \p params and at most
+	 * \p result_length result bytes are copied to \p results (which
+	 * may be null).
+	 *
+	 * \returns the number of bytes copied to \p results.
+	 */
+	std::size_t callFunctionInto (uint8_t feature_index,
+				      unsigned int function,
+				      const uint8_t *params, std::size_t param_length,
+				      uint8_t *results = nullptr, std::size_t result_length = 0);
+
+	/**
+	 * Same as callFunction but errors are returned instead of thrown
+	 * (see HIDPP::Dispatcher::trySendCommand), for calls that often
+	 * fail. On success, the results are the parameters of the report.
+	 */
+	HIDPP::CommandResult tryCallFunction (uint8_t feature_index,
+					      unsigned int function,
+					      const std::vector<uint8_t> &params = {},
+					      int timeout = -1);
+
+	struct Call
+	{
+		uint8_t feature_index;
+		unsigned int function;
+		std::vector<uint8_t> params;
+	};
+
+	/**
+	 * Make independent function calls and return their results in the
+	 * same order.
+	 *
+	 * Up to HIDPP::Dispatcher::MaxSoftwareID calls are kept in flight
+	 * (see callFunctionAsync), the next one is sent as soon as the
+	 * oldest is answered. With a concurrent dispatcher, this takes about
+	 * one round trip per window instead of one per call.
+	 *
+	 * \throws the error of the first failed call, once the calls already
+	 * sent are finished.
+	 */
+	std::vector<std::vector<uint8_t>> callFunctions (const std::vector<Call> &calls);
+
+	/**
+	 * \name Feature indices
+	 *
+	 * Feature indices are cached by the device object (and its copies),
+	 * so that creating several interfaces for the same feature (see
+	 * FeatureInterface) costs a single IRoot query.
+	 *
+	 * \{
+	 */
+
+	/**
+	 * Get the index of feature \p id, or 0 if it is not supported.
+	 */
+	uint8_t getFeatureIndex (uint16_t id);
+	/**
+	 * Same as getFeatureIndex but without throwing: \c std::nullopt if
+	 * the query failed (e.g. the device is asleep).
+	 */
+	std::optional<uint8_t> tryGetFeatureIndex (uint16_t id, int timeout = -1);
+	/**
+	 * Read the whole feature table with IFeatureSet, so that no later
+	 * \ref getFeatureIndex call needs a round trip.
+	 *
+	 * The queries are sent concurrently, this is faster than looking
+	 * features up one by one when many of them are used. Does nothing
+	 * if the device does not support IFeatureSet.
+	 */
+	void loadFeatureTable ();
+	/**
+	 * Look up the features a known model is expected to have (see
+	 * getModelInfo) with pipelined IRoot queries (see callFunctions),
+	 * instead of one round trip per feature on first use.
+	 *
+	 * \returns false if the model is unknown.
+	 */
+	bool loadKnownFeatures ();
+	/**
+	 * Forget cached feature indices and static function results (e.g.
+	 * after a firmware update).
+	 */
+	void clearFeatureCache ();
+	/**
+	 * Hits and misses of the in-memory feature indices and static
+	 * function results, shared by the copies of this device. The
+	 * counter stays valid while the pointer is kept.
+	 */
+	std::shared_ptr<const CacheCounter> featureCacheCounter () const;
+
+	/**\}*/
+
+	/**
+	 * \name Descriptor cache
+	 *
+	 * \{
+	 */
+
+	/**
+	 * Use \p cache for the feature table and static function results
+	 * of this device (and its copies), or stop using a cache if
+	 * \p cache is null.
+	 *
+	 * This computes the fingerprint of the device: a few round trips
+	 * reading the feature count and the version of the main firmware
+	 * entity (if the device has IDeviceInformation).
+	 */
+	void setDescriptorCache (std::shared_ptr<DescriptorCache> cache);
+	/**
+	 * Fingerprint identifying the model and firmware of the device, the
+	 * key of descriptor cache entries.
+	 *
+	 * This makes the same round trips as \ref setDescriptorCache.
+	 */
+	std::string fingerprint ();
+	/**
+	 * Call a function whose results only depend on the device model and
+	 * firmware.
+	 *
+	 * Results are kept in memory by the device object (and its copies)
+	 * and, with a descriptor cache, stored on disk. Later calls with the
+	 * same parameters reuse them without any round trip. Wireless devices
+	 * forget the in-memory results when they reconnect (another device
+	 * or firmware may be behind the same index), and the fingerprint is
+	 * computed again before the next static call.
+	 */
+	std::vector<uint8_t> callStaticFunction (uint16_t feature_id,
+						 uint8_t feature_index,
+						 unsigned int function,
+						 const std::vector<uint8_t> &params = {});
+	/**
+	 * Make several static calls on feature \p feature_id, the calls
+	 * missing from the descriptor cache are made with \ref callFunctions.
+	 */
+	std::vector<std::vector<uint8_t>> callStaticFunctions (uint16_t feature_id,
+							       const std::vector<Call> &calls);
+
+	/**\}*/
+
+private:
+	struct FeatureCache
+	{
+		std::mutex mutex;
+		std::map<uint16_t, uint8_t> indices; // 0 for unsupported features
+		bool complete = false; // every supported feature is in indices
+		std::shared_ptr<DescriptorCache> cache;
+		std::string fingerprint;
+		// static function results, by feature ID, function and parameters
+		std::map<std::tuple<uint16_t, unsigned int, std::vector<uint8_t>>,
+			 std::vector<uint8_t>> results;
+		bool reconnected = false; // the fingerprint may be outdated
+		// Incremented on reconnection, indices resolved during an
+		// older generation may belong to another device.
+		unsigned int generation = 0;
+		HIDPP::Dispatcher *dispatcher = nullptr;
+		HIDPP::Dispatcher::listener_iterator reconnection_listener;
+		CacheCounter counter;
+
+		~FeatureCache ();
+	};
+	static std::shared_ptr<FeatureCache> makeFeatureCache (HIDPP::Dispatcher *dispatcher,
+							       HIDPP::DeviceIndex index);
+	std::string computeFingerprint ();
+	/**
+	 * Tell the dispatcher which feature indices are known (see
+	 * HIDPP::Dispatcher::ReportRoute), \c _features->mutex must be held.
+	 */
+	void routeFeatures ();
+	/**
+	 * Record a feature index resolved during \p generation, ignored if the
+	 * device reconnected since. \c _features->mutex must be held.
+	 */
+	void addFeature (unsigned int generation, uint16_t id, uint8_t index);
+	std::shared_ptr<FeatureCache> _features;
+
+	HIDPP::Report makeRequest (uint8_t feature_index,
+				   unsigned int function,
+				   const uint8_t *params, std::size_t param_length);
 };
 
 }
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_DEVICE_INFO_H
+#define LIBHIDPP_HIDPP20_DEVICE_INFO_H
+
+#include <hidpp/DeviceInfo.h>
+
+#include <cstddef>
+
+namespace HIDPP20
+{
+	/**
+	 * Hints about a known HID++ 2.0 model.
+	 *
+	 * They only tell which queries are worth batching (see
+	 * Device::loadKnownFeatures), the answers still come from the
+	 * device since they may change with the firmware.
+	 */
+	struct ModelInfo: HIDPP::DeviceInfo
+	{
+		const uint16_t *features; ///< feature IDs the model is expected to have
+		std::size_t feature_count;
+
+		template<std::size_t N>
+		ModelInfo (const uint16_t (&features)[N]):
+			HIDPP::DeviceInfo (HIDPP::DeviceInfo::Device),
+			features (features),
+			feature_count (N)
+		{
+		}
+	};
+
+	inline const ModelInfo *getModelInfo (uint16_t product_id)
+	{
+		return dynamic_cast<const ModelInfo *> (HIDPP::getDeviceInfo (product_id));
+	}
+}
+
+#endif
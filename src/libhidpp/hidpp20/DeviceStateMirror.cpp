@@ -0,0 +1,249 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "DeviceStateMirror.h"
+
+#include <hidpp10/defs.h>
+#include <hidpp20/UnsupportedFeature.h>
+
+using namespace HIDPP20;
+
+DeviceStateMirror::DeviceStateMirror (Device *dev):
+	_dev (dev), _changes {}, _known {}
+{
+	try {
+		_onboard_profiles.emplace (dev);
+	}
+	catch (UnsupportedFeature &) {
+	}
+	try {
+		_battery.emplace (dev);
+	}
+	catch (UnsupportedFeature &) {
+	}
+	auto dispatcher = _dev->dispatcher ();
+	auto index = _dev->deviceIndex ();
+	auto handler = [this] (const HIDPP::Report &report) {
+		return event (report);
+	};
+	if (_onboard_profiles)
+		_listeners.push_back (dispatcher->registerEventHandler (
+				index, _onboard_profiles->index (), handler));
+	if (_battery)
+		_listeners.push_back (dispatcher->registerEventHandler (
+				index, _battery->index (), handler));
+	if (index >= HIDPP::WirelessDevice1 && index <= HIDPP::WirelessDevice6)
+		_listeners.push_back (dispatcher->registerEventHandler (
+				index, HIDPP10::DeviceConnection, handler));
+}
+
+DeviceStateMirror::~DeviceStateMirror ()
+{
+	for (auto &it: _listeners)
+		_dev->dispatcher ()->unregisterEventHandler (it);
+}
+
+bool DeviceStateMirror::hasOnboardProfiles () const
+{
+	return _onboard_profiles.has_value ();
+}
+
+bool DeviceStateMirror::hasBatteryLevelStatus () const
+{
+	return _battery.has_value ();
+}
+
+IOnboardProfiles::Mode DeviceStateMirror::mode ()
+{
+	update (ModeValue);
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _mode;
+}
+
+void DeviceStateMirror::setMode (IOnboardProfiles::Mode mode)
+{
+	auto &onboard_profiles = onboardProfiles ();
+	if (mode == IOnboardProfiles::Mode::NoChange)
+		return;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_known[ModeValue] && _mode == mode)
+			return;
+	}
+	onboard_profiles.setMode (mode);
+	std::unique_lock<std::mutex> lock (_mutex);
+	_mode = mode;
+	changed (ModeValue);
+	changed (ProfileValue, false);
+	changed (DPIIndexValue, false);
+}
+
+std::tuple<IOnboardProfiles::MemoryType, unsigned int> DeviceStateMirror::currentProfile ()
+{
+	update (ProfileValue);
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _profile;
+}
+
+void DeviceStateMirror::setCurrentProfile (IOnboardProfiles::MemoryType mem_type, unsigned int index)
+{
+	auto &onboard_profiles = onboardProfiles ();
+	auto profile = std::make_tuple (mem_type, index);
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_known[ProfileValue] && _profile == profile)
+			return;
+	}
+	onboard_profiles.setCurrentProfile (mem_type, index);
+	std::unique_lock<std::mutex> lock (_mutex);
+	_profile = profile;
+	changed (ProfileValue);
+	changed (DPIIndexValue, false);
+}
+
+unsigned int DeviceStateMirror::currentDPIIndex ()
+{
+	update (DPIIndexValue);
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _dpi_index;
+}
+
+void DeviceStateMirror::setCurrentDPIIndex (unsigned int index)
+{
+	auto &onboard_profiles = onboardProfiles ();
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_known[DPIIndexValue] && _dpi_index == index)
+			return;
+	}
+	onboard_profiles.setCurrentDPIIndex (index);
+	std::unique_lock<std::mutex> lock (_mutex);
+	_dpi_index = index;
+	changed (DPIIndexValue);
+}
+
+IBatteryLevelStatus::LevelStatus DeviceStateMirror::batteryLevel ()
+{
+	update (BatteryValue);
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _battery_level;
+}
+
+void DeviceStateMirror::invalidate ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	for (unsigned int i = 0; i < ValueCount; ++i)
+		changed (static_cast<Value> (i), false);
+}
+
+IOnboardProfiles &DeviceStateMirror::onboardProfiles ()
+{
+	if (!_onboard_profiles)
+		throw UnsupportedFeature (IOnboardProfiles::ID, "OnboardProfiles");
+	return *_onboard_profiles;
+}
+
+IBatteryLevelStatus &DeviceStateMirror::batteryLevelStatus ()
+{
+	if (!_battery)
+		throw UnsupportedFeature (IBatteryLevelStatus::ID, "BatteryLevelStatus");
+	return *_battery;
+}
+
+void DeviceStateMirror::update (Value value)
+{
+	unsigned int changes;
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_known[value])
+			return;
+		changes = _changes[value];
+	}
+	// Query without the lock held, the value is only stored if no
+	// event changed it meanwhile.
+	switch (value) {
+	case ModeValue: {
+		auto mode = onboardProfiles ().getMode ();
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_changes[value] == changes)
+			_mode = mode;
+		break;
+	}
+	case ProfileValue: {
+		auto profile = onboardProfiles ().getCurrentProfile ();
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_changes[value] == changes)
+			_profile = profile;
+		break;
+	}
+	case DPIIndexValue: {
+		auto dpi_index = onboardProfiles ().getCurrentDPIIndex ();
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_changes[value] == changes)
+			_dpi_index = dpi_index;
+		break;
+	}
+	case BatteryValue: {
+		auto level = batteryLevelStatus ().getLevelStatus ();
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_changes[value] == changes)
+			_battery_level = level;
+		break;
+	}
+	default:
+		return;
+	}
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (_changes[value] == changes)
+		_known[value] = true;
+}
+
+void DeviceStateMirror::changed (Value value, bool known)
+{
+	++_changes[value];
+	_known[value] = known;
+}
+
+bool DeviceStateMirror::event (const HIDPP::Report &report)
+{
+	if (report.subID () == HIDPP10::DeviceConnection) {
+		if (!(report.parameterBegin ()[0] & 0x40)) // link established
+			invalidate ();
+		return true;
+	}
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (_onboard_profiles && report.featureIndex () == _onboard_profiles->index ()) {
+		switch (report.function ()) {
+		case IOnboardProfiles::CurrentProfileChanged:
+			_profile = IOnboardProfiles::currentProfileChanged (report);
+			changed (ProfileValue);
+			changed (DPIIndexValue, false);
+			break;
+		case IOnboardProfiles::CurrentDPIIndexChanged:
+			_dpi_index = IOnboardProfiles::currentDPIIndexChanged (report);
+			changed (DPIIndexValue);
+			break;
+		}
+	}
+	else if (_battery && report.featureIndex () == _battery->index ()) {
+		if (report.function () == IBatteryLevelStatus::BatteryLevelEvent) {
+			_battery_level = IBatteryLevelStatus::batteryLevelEvent (report);
+			changed (BatteryValue);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LIBHIDPP_HIDPP20_DEVICE_STATE_MIRROR_H
+#define LIBHIDPP_HIDPP20_DEVICE_STATE_MIRROR_H
+
+#include <hidpp20/IBatteryLevelStatus.h>
+#include <hidpp20/IOnboardProfiles.h>
+
+#include <array>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace HIDPP20
+{
+
+/**
+ * Local copy of the device state that changes at run time: on-board
+ * profile mode, current profile and DPI index, and battery level.
+ *
+ * Each value is read once, when first accessed, then kept current from
+ * the device events (IOnboardProfiles::CurrentProfileChanged,
+ * IOnboardProfiles::CurrentDPIIndexChanged and
+ * IBatteryLevelStatus::BatteryLevelEvent) so that later accesses need no
+ * round trip. Changes made through the mirror setters are applied to the
+ * copy as well, and the setters send nothing when the known value is
+ * already the one asked for. They do not read an unknown value to
+ * compare it: the write costs the same round trip.
+ *
+ * Values are read again after a wireless device reconnects, and the DPI
+ * index after the current profile changes.
+ *
+ * Accessors may be called from any thread except the dispatcher reading
+ * thread (they may need to query the device). They throw
+ * UnsupportedFeature if the device does not have the corresponding
+ * feature.
+ */
+class DeviceStateMirror
+{
+public:
+	/**
+	 * Start listening to the events of \p dev, it must outlive the
+	 * mirror.
+	 */
+	DeviceStateMirror (Device *dev);
+	~DeviceStateMirror ();
+
+	DeviceStateMirror (const DeviceStateMirror &) = delete;
+	DeviceStateMirror &operator= (const DeviceStateMirror &) = delete;
+
+	bool hasOnboardProfiles () const;
+	bool hasBatteryLevelStatus () const;
+
+	IOnboardProfiles::Mode mode ();
+	void setMode (IOnboardProfiles::Mode mode);
+
+	std::tuple<IOnboardProfiles::MemoryType, unsigned int> currentProfile ();
+	void setCurrentProfile (IOnboardProfiles::MemoryType mem_type, unsigned int index);
+
+	unsigned int currentDPIIndex ();
+	void setCurrentDPIIndex (unsigned int index);
+
+	IBatteryLevelStatus::LevelStatus batteryLevel ();
+
+	/**
+	 * Read every value again on next access.
+	 */
+	void invalidate ();
+
+private:
+	enum Value {
+		ModeValue,
+		ProfileValue,
+		DPIIndexValue,
+		BatteryValue,
+		ValueCount
+	};
+	IOnboardProfiles &onboardProfiles ();
+	IBatteryLevelStatus &batteryLevelStatus ();
+	// Read the value from the device if it is not known.
+	void update (Value value);
+	// Called with _mutex locked after the value changed.
+	void changed (Value value, bool known = true);
+	bool event (const HIDPP::Report &event);
+
+	Device *_dev;
+	std::optional<IOnboardProfiles> _onboard_profiles;
+	std::optional<IBatteryLevelStatus> _battery;
+	std::vector<HIDPP::Dispatcher::listener_iterator> _listeners;
+
+	std::mutex _mutex;
+	// Changes are counted so that reads racing with events cannot
+	// overwrite the newer value.
+	std::array<unsigned int, ValueCount> _changes;
+	std::array<bool, ValueCount> _known;
+	IOnboardProfiles::Mode _mode;
+	std::tuple<IOnboardProfiles::MemoryType, unsigned int> _profile;
+	unsigned int _dpi_index;
+	IBatteryLevelStatus::LevelStatus _battery_level;
+};
+
+}
+
+#endif
@@ -19,7 +19,6 @@
 #include "FeatureInterface.h"
 
 #include <hidpp20/Device.h>
-#include <hidpp20/IRoot.h>
 #include <hidpp20/UnsupportedFeature.h>
 #include <misc/Log.h>
 
@@ -27,7 +26,8 @@ using namespace HIDPP20;
 
 FeatureInterface::FeatureInterface (Device *dev, uint16_t id, const char *name):
 	_dev (dev),
-	_index (IRoot (dev).getFeature (id))
+	_id (id),
+	_index (dev->getFeatureIndex (id))
 {
 	if (_index == 0) {
 		Log::info ("feature").printf ("Feature [0x%04hx] %s is not supported\n", id, name);
@@ -46,3 +46,29 @@ uint8_t FeatureInterface::index () const
 	return _index;
 }
 
+
+uint16_t FeatureInterface::id () const
+{
+	return _id;
+}
+
+static std::vector<Device::Call> makeCalls (uint8_t index, unsigned int function,
+					    const std::vector<std::vector<uint8_t>> &params)
+{
+	std::vector<Device::Call> calls;
+	for (const auto &p: params)
+		calls.push_back ({ index, function, p });
+	return calls;
+}
+
+std::vector<std::vector<uint8_t>> FeatureInterface::callEach (unsigned int function,
+							      const std::vector<std::vector<uint8_t>> &params)
+{
+	return _dev->callFunctions (makeCalls (_index, function, params));
+}
+
+std::vector<std::vector<uint8_t>> FeatureInterface::callStaticEach (unsigned int function,
+								    const std::vector<std::vector<uint8_t>> &params)
+{
+	return _dev->callStaticFunctions (_id, makeCalls (_index, function, params));
+}
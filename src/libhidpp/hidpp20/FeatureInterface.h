@@ -35,15 +35,56 @@ public:
 	Device *device () const;
 
 	uint8_t index () const;
+	uint16_t id () const;
 
 	template<typename... Params>
-	std::vector<uint8_t> call (unsigned int function, Params... params)
+	std::vector<uint8_t> call (unsigned int function, const Params &... params)
 	{
 		return _dev->callFunction (_index, function, params...);
 	}
 
+	/**
+	 * Allocation-free call, see Device::callFunctionInto.
+	 */
+	std::size_t callInto (unsigned int function,
+			      const uint8_t *params, std::size_t param_length,
+			      uint8_t *results = nullptr, std::size_t result_length = 0)
+	{
+		return _dev->callFunctionInto (_index, function, params, param_length,
+					       results, result_length);
+	}
+
+	/**
+	 * Call a function whose results only depend on the device model and
+	 * firmware (e.g. description or capabilities), they may come from
+	 * the descriptor cache (see Device::setDescriptorCache).
+	 */
+	std::vector<uint8_t> callStatic (unsigned int function, const std::vector<uint8_t> &params = {})
+	{
+		return _dev->callStaticFunction (_id, _index, function, params);
+	}
+
+	/**
+	 * Call \p function once for each element of \p params, with the
+	 * calls pipelined (see Device::callFunctions).
+	 */
+	std::vector<std::vector<uint8_t>> callEach (unsigned int function,
+						    const std::vector<std::vector<uint8_t>> &params);
+	/**
+	 * Same as \ref callEach for static functions (see \ref callStatic).
+	 */
+	std::vector<std::vector<uint8_t>> callStaticEach (unsigned int function,
+							  const std::vector<std::vector<uint8_t>> &params);
+
+	template<typename... Params>
+	Device::AsyncCall callAsync (unsigned int function, const Params &... params)
+	{
+		return _dev->callFunctionAsync (_index, function, params...);
+	}
+
 private:
 	Device *_dev;
+	uint16_t _id;
 	uint8_t _index;
 };
 
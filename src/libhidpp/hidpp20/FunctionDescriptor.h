@@ -0,0 +1,247 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LIBHIDPP_HIDPP20_FUNCTION_DESCRIPTOR_H
+#define LIBHIDPP_HIDPP20_FUNCTION_DESCRIPTOR_H
+
+#include <hidpp/Field.h>
+#include <hidpp/Report.h>
+#include <hidpp20/FeatureInterface.h>
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace HIDPP20
+{
+
+/**
+ * Layout of function parameters and results, for FunctionDescriptor.
+ */
+namespace Layout
+{
+
+/**
+ * A single integer value in a parameter or result layout.
+ *
+ * Values larger than a byte need a byte order.
+ */
+template<typename T, HIDPP::ByteOrder BO = HIDPP::Undefined>
+struct Value
+{
+	static_assert (std::is_integral<T>::value, "Layout values must be integers");
+	static_assert (BO != HIDPP::Undefined || sizeof (T) == 1,
+		       "Multi-byte layout values need a byte order");
+
+	typedef T type;
+	static constexpr std::size_t size = sizeof (T);
+
+	static T read (const uint8_t *data)
+	{
+		if constexpr (BO == HIDPP::BigEndian)
+			return readBE<T> (data);
+		else if constexpr (BO == HIDPP::LittleEndian)
+			return readLE<T> (data);
+		else
+			return static_cast<T> (*data);
+	}
+
+	static void write (uint8_t *data, T value)
+	{
+		if constexpr (BO == HIDPP::BigEndian)
+			writeBE (data, value);
+		else if constexpr (BO == HIDPP::LittleEndian)
+			writeLE (data, value);
+		else
+			*data = static_cast<uint8_t> (value);
+	}
+};
+
+typedef Value<uint8_t> u8;
+typedef Value<uint16_t, HIDPP::BigEndian> u16be;
+typedef Value<uint16_t, HIDPP::LittleEndian> u16le;
+typedef Value<uint32_t, HIDPP::BigEndian> u32be;
+typedef Value<uint32_t, HIDPP::LittleEndian> u32le;
+
+/**
+ * Consecutive values starting at the first parameter byte.
+ */
+template<typename... Values>
+struct Fields
+{
+	static constexpr std::size_t count = sizeof... (Values);
+	static constexpr std::size_t size = (Values::size + ... + 0);
+
+	static constexpr std::size_t offset (std::size_t index)
+	{
+		constexpr std::size_t sizes[] = { Values::size..., 0 };
+		std::size_t offset = 0;
+		for (std::size_t i = 0; i < index; ++i)
+			offset += sizes[i];
+		return offset;
+	}
+
+	static void write (uint8_t *data, const typename Values::type &... values)
+	{
+		write (data, std::index_sequence_for<Values...> (), values...);
+	}
+
+	static std::tuple<typename Values::type...> read (const uint8_t *data)
+	{
+		return read (data, std::index_sequence_for<Values...> ());
+	}
+
+private:
+	template<std::size_t... I>
+	static void write (uint8_t *data, std::index_sequence<I...>,
+			   const typename Values::type &... values)
+	{
+		(Values::write (data + offset (I), values), ...);
+	}
+
+	template<std::size_t... I>
+	static std::tuple<typename Values::type...> read (const uint8_t *data, std::index_sequence<I...>)
+	{
+		return std::make_tuple (Values::read (data + offset (I))...);
+	}
+};
+
+/**
+ * Type returned for decoded values: nothing, the only value, or a tuple.
+ */
+template<typename... Values>
+struct Decoded
+{
+	typedef std::tuple<typename Values::type...> type;
+};
+
+template<typename V>
+struct Decoded<V>
+{
+	typedef typename V::type type;
+};
+
+template<>
+struct Decoded<>
+{
+	typedef void type;
+};
+
+}
+
+template<typename... Values>
+using Params = Layout::Fields<Values...>;
+template<typename... Values>
+using Result = Layout::Fields<Values...>;
+
+template<typename Feature, unsigned int Number, typename P = Params<>, typename R = Result<>>
+class FunctionDescriptor;
+
+/**
+ * Compile-time description of a feature function: its number and the
+ * layouts of its parameters and results.
+ *
+ * Calls encode and decode the values on stack buffers (see
+ * FeatureInterface::callInto), and the request report type is chosen at
+ * compile time. For example:
+ * \code
+ * typedef FunctionDescriptor<IAdjustableDPI, IAdjustableDPI::SetSensorDPI,
+ *                            Params<Layout::u8, Layout::u16be>> SetSensorDPI;
+ * SetSensorDPI::call (iadjustabledpi, sensor, dpi);
+ * \endcode
+ *
+ * \ref call returns nothing when there are no result values, the value
+ * itself for a single one and a tuple otherwise.
+ */
+template<typename Feature, unsigned int Number, typename... P, typename... R>
+class FunctionDescriptor<Feature, Number, Layout::Fields<P...>, Layout::Fields<R...>>
+{
+	typedef Layout::Fields<P...> ParamLayout;
+	typedef Layout::Fields<R...> ResultLayout;
+
+	static_assert (std::is_base_of<FeatureInterface, Feature>::value,
+		       "Functions belong to a FeatureInterface");
+	static_assert (Number < 16, "Function numbers are 4 bits long");
+	static_assert (ParamLayout::size <= HIDPP::VeryLongParamLength,
+		       "Parameters do not fit in a report");
+	static_assert (ResultLayout::size <= HIDPP::VeryLongParamLength,
+		       "Results do not fit in a report");
+
+public:
+	static constexpr unsigned int number = Number;
+	static constexpr std::size_t param_length = ParamLayout::size;
+	static constexpr std::size_t result_length = ResultLayout::size;
+	/**
+	 * Smallest request report holding the parameters, the device must
+	 * support it.
+	 */
+	static constexpr HIDPP::Report::Type request_type =
+		param_length <= HIDPP::ShortParamLength ? HIDPP::Report::Short :
+		param_length <= HIDPP::LongParamLength ? HIDPP::Report::Long :
+		HIDPP::Report::VeryLong;
+
+	typedef typename Layout::Decoded<R...>::type result_type;
+
+	/**
+	 * \throws std::runtime_error if the answer is shorter than the
+	 * result layout, or any error from FeatureInterface::callInto.
+	 */
+	static result_type call (Feature &feature, const typename P::type &... params)
+	{
+		std::array<uint8_t, param_length> param_data;
+		std::array<uint8_t, result_length> result_data;
+		ParamLayout::write (param_data.data (), params...);
+		std::size_t length = feature.callInto (Number,
+				param_data.data (), param_data.size (),
+				result_data.data (), result_data.size ());
+		return decode (result_data.data (), length);
+	}
+
+	/**
+	 * Call a function with static results (see
+	 * FeatureInterface::callStatic), later calls with the same
+	 * parameters are answered from the device caches.
+	 *
+	 * \throws same as \ref call
+	 */
+	static result_type callStatic (Feature &feature, const typename P::type &... params)
+	{
+		std::vector<uint8_t> param_data (param_length);
+		ParamLayout::write (param_data.data (), params...);
+		auto results = feature.callStatic (Number, param_data);
+		return decode (results.data (), results.size ());
+	}
+
+private:
+	static result_type decode (const uint8_t *data, std::size_t length)
+	{
+		if (length < result_length)
+			throw std::runtime_error ("Function results are too short");
+		if constexpr (sizeof... (R) == 1)
+			return std::get<0> (ResultLayout::read (data));
+		else if constexpr (sizeof... (R) > 1)
+			return ResultLayout::read (data);
+	}
+};
+
+}
+
+#endif
@@ -18,12 +18,26 @@
 
 #include <hidpp20/IAdjustableDPI.h>
 
+#include <hidpp/Dispatcher.h>
+#include <hidpp20/FunctionDescriptor.h>
+#include <hidpp20/SetterQueue.h>
 #include <misc/Endian.h>
 
 using namespace HIDPP20;
 
 constexpr uint16_t IAdjustableDPI::ID;
 
+namespace
+{
+using namespace Layout;
+typedef FunctionDescriptor<IAdjustableDPI, IAdjustableDPI::GetSensorCount,
+			   Params<>, Result<u8>> GetSensorCountFn;
+typedef FunctionDescriptor<IAdjustableDPI, IAdjustableDPI::GetSensorDPI,
+			   Params<u8>, Result<u8, u16be, u16be>> GetSensorDPIFn;
+typedef FunctionDescriptor<IAdjustableDPI, IAdjustableDPI::SetSensorDPI,
+			   Params<u8, u16be>> SetSensorDPIFn;
+}
+
 IAdjustableDPI::IAdjustableDPI (Device *dev):
 	FeatureInterface (dev, ID, "AdjustableDPI")
 {
@@ -31,9 +45,7 @@ IAdjustableDPI::IAdjustableDPI (Device *dev):
 
 unsigned int IAdjustableDPI::getSensorCount ()
 {
-	std::vector<uint8_t> results;
-	results = call (GetSensorCount);
-	return results[0];
+	return GetSensorCountFn::callStatic (*this);
 }
 
 bool IAdjustableDPI::getSensorDPIList (unsigned int index,
@@ -42,7 +54,7 @@ bool IAdjustableDPI::getSensorDPIList (unsigned int index,
 {
 	std::vector<uint8_t> params (1), results;
 	params[0] = index;
-	results = call (GetSensorDPIList, params);
+	results = callStatic (GetSensorDPIList, params);
 	dpi_list.clear ();
 	bool has_dpi_step = false;
 	uint16_t value;
@@ -62,19 +74,22 @@ bool IAdjustableDPI::getSensorDPIList (unsigned int index,
 
 std::tuple<unsigned int, unsigned int> IAdjustableDPI::getSensorDPI (unsigned int index)
 {
-	std::vector<uint8_t> params (1), results;
-	params[0] = index;
-	results = call (GetSensorDPI, params);
-	unsigned int current_dpi = readBE<uint16_t> (results, 1);
-	unsigned int default_dpi = readBE<uint16_t> (results, 3);
+	HIDPP::Dispatcher::ReadOnlyScope read;
+	auto [sensor, current_dpi, default_dpi] = GetSensorDPIFn::call (*this, index);
+	(void) sensor;
 	return std::make_tuple (current_dpi, default_dpi);
 }
 
 void IAdjustableDPI::setSensorDPI (unsigned int index, unsigned int dpi)
 {
-	std::vector<uint8_t> params (3);
+	SetSensorDPIFn::call (*this, index, dpi);
+}
+
+void IAdjustableDPI::setSensorDPI (SetterQueue &queue, unsigned int index, unsigned int dpi)
+{
+	std::array<uint8_t, SetSensorDPIFn::param_length> params;
 	params[0] = index;
-	writeBE<uint16_t> (params, 1, dpi);
-	call (SetSensorDPI, params);
+	writeBE<uint16_t> (&params[1], dpi);
+	queue.set (this->index (), SetSensorDPI, params.data (), params.size (), 1);
 }
 
@@ -26,6 +26,8 @@
 namespace HIDPP20
 {
 
+class SetterQueue;
+
 class IAdjustableDPI: public FeatureInterface
 {
 public:
@@ -75,6 +77,11 @@ public:
 	 * \param[in]	dpi	New DPI value
 	 */
 	void setSensorDPI (unsigned int index, unsigned int dpi);
+	/**
+	 * Same as setSensorDPI(unsigned int, unsigned int) through \p queue
+	 * (of the same device): only the latest DPI of each sensor is sent.
+	 */
+	void setSensorDPI (SetterQueue &queue, unsigned int index, unsigned int dpi);
 };
 
 }
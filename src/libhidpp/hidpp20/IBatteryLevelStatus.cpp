@@ -18,11 +18,21 @@
 
 #include "IBatteryLevelStatus.h"
 
+#include <hidpp/Dispatcher.h>
+#include <hidpp20/FunctionDescriptor.h>
 #include <misc/Endian.h>
 #include <cassert>
+#include <stdexcept>
 
 using namespace HIDPP20;
 
+namespace
+{
+using namespace Layout;
+typedef FunctionDescriptor<IBatteryLevelStatus, IBatteryLevelStatus::GetBatteryCapability,
+			   Params<>, Result<u8, u8, u16be, u8>> GetBatteryCapabilityFn;
+}
+
 IBatteryLevelStatus::IBatteryLevelStatus (Device *dev):
 	FeatureInterface (dev, ID, "BatteryLevelStatus")
 {
@@ -30,19 +40,34 @@ IBatteryLevelStatus::IBatteryLevelStatus (Device *dev):
 
 IBatteryLevelStatus::LevelStatus IBatteryLevelStatus::getLevelStatus ()
 {
+	HIDPP::Dispatcher::ReadOnlyScope read;
 	auto results = call (GetBatteryLevelStatus);
-	return parseLevelStatus (results.begin ());
+	return parseLevelStatus (results.data ());
+}
+
+void IBatteryLevelStatus::getLevelStatusAsync (level_status_handler &&handler, int timeout)
+{
+	HIDPP::Dispatcher::ReadOnlyScope read;
+	device ()->callFunctionAsync (index (), GetBatteryLevelStatus, {},
+		[handler = std::move (handler)] (const std::vector<uint8_t> *results, std::exception_ptr error) {
+			if (results) {
+				if (results->size () < 3) {
+					auto error = std::make_exception_ptr (std::runtime_error ("Function results are too short"));
+					handler (nullptr, error);
+					return;
+				}
+				auto level = parseLevelStatus (results->data ());
+				handler (&level, nullptr);
+			}
+			else
+				handler (nullptr, error);
+		}, timeout);
 }
 
 IBatteryLevelStatus::Capability IBatteryLevelStatus::getCapability ()
 {
-	auto results = call (GetBatteryCapability);
-	return Capability {
-		results[0], // number of levels
-		results[1], // flags
-		readBE<uint16_t>(results, 2), // battery life
-		results[4],
-	};
+	auto [levels, flags, nominal_battery_life, critical_level] = GetBatteryCapabilityFn::call (*this);
+	return Capability { levels, flags, nominal_battery_life, critical_level };
 }
 
 IBatteryLevelStatus::LevelStatus IBatteryLevelStatus::batteryLevelEvent (const HIDPP::Report &event)
@@ -51,7 +76,7 @@ IBatteryLevelStatus::LevelStatus IBatteryLevelStatus::batteryLevelEvent (const H
 	return parseLevelStatus (event.parameterBegin ());
 }
 
-IBatteryLevelStatus::LevelStatus IBatteryLevelStatus::parseLevelStatus (std::vector<uint8_t>::const_iterator params)
+IBatteryLevelStatus::LevelStatus IBatteryLevelStatus::parseLevelStatus (const uint8_t *params)
 {
 	return LevelStatus {
 		*(params + 0), // level
@@ -21,6 +21,9 @@
 
 #include <hidpp20/FeatureInterface.h>
 
+#include <exception>
+#include <functional>
+
 namespace HIDPP20
 {
 
@@ -84,10 +87,17 @@ public:
 	LevelStatus getLevelStatus ();
 	Capability getCapability ();
 
+	typedef std::function<void (const LevelStatus *level, std::exception_ptr error)> level_status_handler;
+	/**
+	 * Send a \ref GetBatteryLevelStatus call and call \p handler with
+	 * its result or error (see Device::callFunctionAsync).
+	 */
+	void getLevelStatusAsync (level_status_handler &&handler, int timeout = -1);
+
 	static LevelStatus batteryLevelEvent (const HIDPP::Report &event);
 
 private:
-	static LevelStatus parseLevelStatus (std::vector<uint8_t>::const_iterator params);
+	static LevelStatus parseLevelStatus (const uint8_t *params);
 };
 
 }
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <hidpp20/IDeviceInformation.h>
+
+#include <misc/Endian.h>
+
+#include <cstdio>
+
+using namespace HIDPP20;
+
+constexpr uint16_t IDeviceInformation::ID;
+constexpr std::size_t IDeviceInformation::FirmwareInfoLength;
+
+static IDeviceInformation::FirmwareInfo firmwareInfo (const std::vector<uint8_t> &results)
+{
+	return {
+		static_cast<IDeviceInformation::EntityType> (results[0]),
+		std::string (results.begin () + 1, results.begin () + 4),
+		results[4],
+		results[5],
+		readBE<uint16_t> (results, 6),
+		bool (results[8] & 0x01),
+		readBE<uint16_t> (results, 9),
+	};
+}
+
+IDeviceInformation::IDeviceInformation (Device *dev):
+	FeatureInterface (dev, ID, "DeviceInformation")
+{
+}
+
+IDeviceInformation::DeviceInfo IDeviceInformation::getDeviceInfo ()
+{
+	std::vector<uint8_t> results;
+	results = call (GetDeviceInfo);
+	DeviceInfo info;
+	info.entity_count = results[0];
+	std::copy_n (results.begin () + 1, info.unit_id.size (), info.unit_id.begin ());
+	info.transport = readBE<uint16_t> (results, 5);
+	std::copy_n (results.begin () + 7, info.model_id.size (), info.model_id.begin ());
+	info.extended_model_id = results[13];
+	info.capabilities = results[14];
+	return info;
+}
+
+IDeviceInformation::FirmwareInfo IDeviceInformation::getFirmwareInfo (unsigned int entity)
+{
+	std::vector<uint8_t> params (1), results;
+	params[0] = entity;
+	results = call (GetFwInfo, params);
+	return firmwareInfo (results);
+}
+
+std::vector<IDeviceInformation::FirmwareInfo> IDeviceInformation::getAllFirmwareInfo ()
+{
+	unsigned int count = getDeviceInfo ().entity_count;
+	std::vector<std::vector<uint8_t>> params;
+	for (unsigned int i = 0; i < count; ++i)
+		params.push_back ({ static_cast<uint8_t> (i) });
+	std::vector<FirmwareInfo> entities;
+	for (const auto &results: callEach (GetFwInfo, params))
+		entities.push_back (firmwareInfo (results));
+	return entities;
+}
+
+std::vector<uint8_t> IDeviceInformation::getRawFirmwareInfo (unsigned int entity)
+{
+	std::vector<uint8_t> params (1), results;
+	params[0] = entity;
+	results = call (GetFwInfo, params);
+	results.resize (FirmwareInfoLength);
+	return results;
+}
+
+std::string IDeviceInformation::FirmwareInfo::version () const
+{
+	char buffer[32];
+	snprintf (buffer, sizeof (buffer), "%s%02x.%02x_B%04x",
+		  name.c_str (), number, revision, build);
+	return buffer;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_IDEVICEINFORMATION_H
+#define LIBHIDPP_HIDPP20_IDEVICEINFORMATION_H
+
+#include <hidpp20/FeatureInterface.h>
+
+#include <array>
+#include <string>
+
+namespace HIDPP20
+{
+
+/**
+ * Device information (0x0003): firmware versions of the device entities
+ * (main application, bootloader, hardware, ...).
+ *
+ * \see Device::fingerprint
+ */
+class IDeviceInformation: public FeatureInterface
+{
+public:
+	static constexpr uint16_t ID = 0x0003;
+
+	enum Function {
+		GetDeviceInfo = 0,
+		GetFwInfo = 1,
+	};
+
+	IDeviceInformation (Device *dev);
+
+	struct DeviceInfo
+	{
+		unsigned int entity_count;
+		std::array<uint8_t, 4> unit_id;
+		uint16_t transport;
+		std::array<uint8_t, 6> model_id;
+		uint8_t extended_model_id;
+		uint8_t capabilities;
+	};
+	DeviceInfo getDeviceInfo ();
+
+	enum EntityType: uint8_t {
+		MainApplication = 0,
+		Bootloader = 1,
+		Hardware = 2,
+		Touchpad = 3,
+		OpticalSensor = 4,
+		Softdevice = 5,
+		RFCompanion = 6,
+		FactoryApplication = 7,
+	};
+
+	struct FirmwareInfo
+	{
+		EntityType type;
+		std::string name; ///< Three character prefix
+		uint8_t number; ///< BCD
+		uint8_t revision; ///< BCD
+		uint16_t build; ///< BCD
+		bool active;
+		uint16_t transport_pid;
+
+		/**
+		 * Version formatted as "NAMExx.yy_Bzzzz", as printed by the
+		 * Logitech tools.
+		 */
+		std::string version () const;
+	};
+	FirmwareInfo getFirmwareInfo (unsigned int entity);
+	/**
+	 * Get the firmware information of every entity: one GetDeviceInfo
+	 * round trip followed by pipelined GetFwInfo calls (see
+	 * Device::callFunctions).
+	 */
+	std::vector<FirmwareInfo> getAllFirmwareInfo ();
+
+	/**
+	 * Raw results of GetFwInfo without the transport and extra version
+	 * bytes: type, name, number, revision, build and active flag.
+	 */
+	static constexpr std::size_t FirmwareInfoLength = 9;
+	std::vector<uint8_t> getRawFirmwareInfo (unsigned int entity);
+};
+
+}
+
+#endif
@@ -18,12 +18,25 @@
 
 #include <hidpp20/IFeatureSet.h>
 
+#include <hidpp20/IRoot.h>
+
 #include <misc/Endian.h>
 
 using namespace HIDPP20;
 
 constexpr uint16_t IFeatureSet::ID;
 
+static IFeatureSet::FeatureInfo featureInfo (const std::vector<uint8_t> &results)
+{
+	return {
+		readBE<uint16_t> (results, 0),
+		bool (results[2] & (1<<7)),
+		bool (results[2] & (1<<6)),
+		bool (results[2] & (1<<5)),
+		results[3],
+	};
+}
+
 IFeatureSet::IFeatureSet (Device *dev):
 	FeatureInterface (dev, ID, "FeatureSet")
 {
@@ -32,7 +45,7 @@ IFeatureSet::IFeatureSet (Device *dev):
 unsigned int IFeatureSet::getCount ()
 {
 	std::vector<uint8_t> results;
-	results = call (GetCount);
+	results = callStatic (GetCount);
 	return results[0];
 }
 
@@ -44,15 +57,36 @@ uint16_t IFeatureSet::getFeatureID (uint8_t feature_index,
 {
 	std::vector<uint8_t> params (1), results;
 	params[0] = feature_index;
-	results = call (GetFeatureID, params);
+	results = callStatic (GetFeatureID, params);
+	auto info = featureInfo (results);
 	if (obsolete)
-		*obsolete = results[2] & (1<<7);
+		*obsolete = info.obsolete;
 	if (hidden)
-		*hidden = results[2] & (1<<6);
+		*hidden = info.hidden;
 	if (internal)
-		*internal = results[2] & (1<<5);
+		*internal = info.internal;
 	if (version)
-		*version = results[3];
-	return readBE<uint16_t> (results, 0);
+		*version = info.version;
+	return info.id;
+}
+
+
+std::vector<uint16_t> IFeatureSet::getAllFeatures ()
+{
+	std::vector<uint16_t> ids;
+	for (const auto &info: getAllFeatureInfo ())
+		ids.push_back (info.id);
+	return ids;
 }
 
+std::vector<IFeatureSet::FeatureInfo> IFeatureSet::getAllFeatureInfo ()
+{
+	unsigned int count = getCount ();
+	std::vector<std::vector<uint8_t>> params;
+	for (unsigned int i = 1; i <= count; ++i)
+		params.push_back ({ static_cast<uint8_t> (i) });
+	std::vector<FeatureInfo> features = { { IRoot::ID, false, false, false, 0 } };
+	for (const auto &results: callStaticEach (GetFeatureID, params))
+		features.push_back (featureInfo (results));
+	return features;
+}
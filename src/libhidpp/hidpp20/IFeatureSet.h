@@ -42,6 +42,25 @@ public:
 			       bool *hidden = nullptr,
 			       bool *internal = nullptr,
 			       uint8_t *version = nullptr);
+
+	/**
+	 * Get every feature ID, element \p i is the ID of the feature with
+	 * index \p i (element 0 is IRoot).
+	 *
+	 * The queries are pipelined (see Device::callFunctions).
+	 */
+	std::vector<uint16_t> getAllFeatures ();
+
+	struct FeatureInfo
+	{
+		uint16_t id;
+		bool obsolete, hidden, internal;
+		uint8_t version;
+	};
+	/**
+	 * Same as \ref getAllFeatures with the feature flags and versions.
+	 */
+	std::vector<FeatureInfo> getAllFeatureInfo ();
 };
 
 }
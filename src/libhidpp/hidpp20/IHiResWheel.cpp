@@ -0,0 +1,84 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <hidpp20/IHiResWheel.h>
+
+#include <hidpp/Dispatcher.h>
+#include <hidpp20/FunctionDescriptor.h>
+#include <misc/Endian.h>
+
+#include <cassert>
+
+using namespace HIDPP20;
+
+constexpr uint16_t IHiResWheel::ID;
+
+namespace
+{
+using namespace Layout;
+typedef FunctionDescriptor<IHiResWheel, IHiResWheel::GetWheelCapability,
+			   Params<>, Result<u8, u8>> GetWheelCapabilityFn;
+typedef FunctionDescriptor<IHiResWheel, IHiResWheel::GetWheelMode,
+			   Params<>, Result<u8>> GetWheelModeFn;
+typedef FunctionDescriptor<IHiResWheel, IHiResWheel::SetWheelMode,
+			   Params<u8>> SetWheelModeFn;
+typedef FunctionDescriptor<IHiResWheel, IHiResWheel::GetRatchetSwitchState,
+			   Params<>, Result<u8>> GetRatchetSwitchStateFn;
+}
+
+IHiResWheel::IHiResWheel (Device *dev):
+	FeatureInterface (dev, ID, "HiResWheel")
+{
+}
+
+IHiResWheel::Capability IHiResWheel::getWheelCapability ()
+{
+	auto [multiplier, flags] = GetWheelCapabilityFn::callStatic (*this);
+	return { multiplier, (flags & 0x04) != 0, (flags & 0x08) != 0 };
+}
+
+uint8_t IHiResWheel::getWheelMode ()
+{
+	HIDPP::Dispatcher::ReadOnlyScope read;
+	return GetWheelModeFn::call (*this);
+}
+
+void IHiResWheel::setWheelMode (uint8_t mode)
+{
+	SetWheelModeFn::call (*this, mode);
+}
+
+bool IHiResWheel::getRatchetSwitchState ()
+{
+	HIDPP::Dispatcher::ReadOnlyScope read;
+	return GetRatchetSwitchStateFn::call (*this) & 0x01;
+}
+
+IHiResWheel::Movement IHiResWheel::wheelMovementEvent (const HIDPP::Report &event)
+{
+	assert (event.function () == WheelMovement);
+	auto params = event.parameterBegin ();
+	return { (params[0] & 0x10) != 0, params[0] & 0x0Fu,
+		 readBE<int16_t> (params+1) };
+}
+
+bool IHiResWheel::ratchetSwitchEvent (const HIDPP::Report &event)
+{
+	assert (event.function () == RatchetSwitch);
+	return event.parameterBegin ()[0] & 0x01;
+}
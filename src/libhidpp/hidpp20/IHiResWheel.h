@@ -0,0 +1,103 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_IHIRESWHEEL_H
+#define LIBHIDPP_HIDPP20_IHIRESWHEEL_H
+
+#include <hidpp20/FeatureInterface.h>
+
+namespace HIDPP20
+{
+
+/**
+ * High resolution wheel
+ *
+ * In high resolution mode, the wheel reports \ref Capability::multiplier
+ * units per detent (ratchet) instead of one. When diverted, the wheel
+ * movements are sent as \ref WheelMovement events instead of HID mouse
+ * reports.
+ *
+ * The mode is reset with the device.
+ */
+class IHiResWheel: public FeatureInterface
+{
+public:
+	static constexpr uint16_t ID = 0x2121;
+
+	enum Function {
+		GetWheelCapability = 0,
+		GetWheelMode = 1,
+		SetWheelMode = 2,
+		GetRatchetSwitchState = 3,
+	};
+
+	enum Event {
+		WheelMovement = 0,
+		RatchetSwitch = 1,
+	};
+
+	IHiResWheel (Device *dev);
+
+	struct Capability
+	{
+		unsigned int multiplier; ///< High resolution units per detent
+		bool has_switch; ///< The ratchet can be switched (see getRatchetSwitchState)
+		bool has_invert; ///< The direction can be inverted
+	};
+	Capability getWheelCapability ();
+
+	enum ModeFlags: uint8_t {
+		Diverted = 1<<0, ///< Send HID++ events instead of HID reports
+		HighResolution = 1<<1,
+		Inverted = 1<<2,
+	};
+	/**
+	 * \returns the ModeFlags currently set.
+	 */
+	uint8_t getWheelMode ();
+	/**
+	 * Set the mode from ModeFlags.
+	 */
+	void setWheelMode (uint8_t mode);
+
+	/**
+	 * \returns true if the wheel is ratcheted, false if it spins freely.
+	 */
+	bool getRatchetSwitchState ();
+
+	struct Movement
+	{
+		bool high_resolution; ///< \ref delta is in high resolution units
+		unsigned int periods; ///< Sampling periods the movement was accumulated for
+		int delta; ///< Positive when scrolling up (or down if inverted)
+	};
+	/**
+	 * Parse a \ref WheelMovement event.
+	 */
+	static Movement wheelMovementEvent (const HIDPP::Report &event);
+	/**
+	 * Parse a \ref RatchetSwitch event.
+	 *
+	 * \returns the new state as getRatchetSwitchState.
+	 */
+	static bool ratchetSwitchEvent (const HIDPP::Report &event);
+};
+
+}
+
+#endif
@@ -18,8 +18,10 @@
 
 #include <hidpp20/ILEDControl.h>
 
+#include <hidpp20/SetterQueue.h>
 #include <misc/Endian.h>
 
+#include <array>
 #include <cassert>
 
 using namespace HIDPP20;
@@ -60,9 +62,9 @@ bool ILEDControl::getSWControl()
 
 void ILEDControl::setSWControl(bool software_controlled)
 {
-	std::vector<uint8_t> params (1);
+	std::array<uint8_t, 1> params;
 	params[0] = software_controlled ? 0x01 : 0x00;
-	call (SetSWControl, params);
+	callInto (SetSWControl, params.data (), params.size ());
 }
 
 ILEDControl::State ILEDControl::getState(unsigned int led_index)
@@ -94,9 +96,9 @@ ILEDControl::State ILEDControl::getState(unsigned int led_index)
 	return state;
 }
 
-void ILEDControl::setState(unsigned int led_index, const State &state)
+std::array<uint8_t, 9> ILEDControl::stateParams(unsigned int led_index, const State &state)
 {
-	std::vector<uint8_t> params (9);
+	std::array<uint8_t, 9> params = {};
 	params[0] = led_index;
 	writeLE<uint16_t> (params, 1, state.mode);
 	switch (state.mode) {
@@ -119,7 +121,29 @@ void ILEDControl::setState(unsigned int led_index, const State &state)
 	default:
 		break;
 	}
-	call (SetState, params);
+	return params;
+}
+
+void ILEDControl::setState(unsigned int led_index, const State &state)
+{
+	auto params = stateParams (led_index, state);
+	callInto (SetState, params.data (), params.size ());
+}
+
+void ILEDControl::setState(SetterQueue &queue, unsigned int led_index, const State &state)
+{
+	auto params = stateParams (led_index, state);
+	queue.set (index (), SetState, params.data (), params.size (), 1);
+}
+
+void ILEDControl::setStates(const std::vector<std::pair<unsigned int, State>> &states)
+{
+	std::vector<std::vector<uint8_t>> params;
+	for (const auto &[led_index, state]: states) {
+		auto p = stateParams (led_index, state);
+		params.emplace_back (p.begin (), p.end ());
+	}
+	callEach (SetState, params);
 }
 
 ILEDControl::Config ILEDControl::getConfig(unsigned int led_index)
@@ -132,9 +156,9 @@ ILEDControl::Config ILEDControl::getConfig(unsigned int led_index)
 
 void ILEDControl::setConfig(unsigned int led_index, Config config)
 {
-	std::vector<uint8_t> params (2);
+	std::array<uint8_t, 2> params;
 	params[0] = led_index;
 	params[1] = config;
-	call (SetConfig, params);
+	callInto (SetConfig, params.data (), params.size ());
 }
 
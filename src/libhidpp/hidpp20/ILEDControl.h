@@ -21,9 +21,15 @@
 
 #include <hidpp20/FeatureInterface.h>
 
+#include <array>
+#include <utility>
+#include <vector>
+
 namespace HIDPP20
 {
 
+class SetterQueue;
+
 /**
  * Control non-RGB LED features.
  */
@@ -137,6 +143,22 @@ public:
 	 * The device must be in sofware-control mode.
 	 */
 	void setState(unsigned int led_index, const State &state);
+	/**
+	 * Same as setState(unsigned int, const State &) through \p queue
+	 * (of the same device): only the latest state of each LED is sent.
+	 */
+	void setState(SetterQueue &queue, unsigned int led_index, const State &state);
+
+	/**
+	 * Change the states of several LEDs, with the calls pipelined (see
+	 * FeatureInterface::callEach).
+	 */
+	void setStates(const std::vector<std::pair<unsigned int, State>> &states);
+
+	/**
+	 * Parameters of the SetState call for \p led_index and \p state.
+	 */
+	static std::array<uint8_t, 9> stateParams(unsigned int led_index, const State &state);
 
 	/**
 	 * Get the current non-volatile configuration for a LED.
@@ -32,7 +32,7 @@ IMouseButtonSpy::IMouseButtonSpy (Device *dev):
 
 unsigned int IMouseButtonSpy::getMouseButtonCount ()
 {
-	auto results = call (GetMouseButtonCount);
+	auto results = callStatic (GetMouseButtonCount);
 	return results[0];
 }
 
@@ -18,8 +18,11 @@
 
 #include <hidpp20/IOnboardProfiles.h>
 
+#include <hidpp/Dispatcher.h>
 #include <misc/Endian.h>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 
 using namespace HIDPP20;
@@ -34,7 +37,7 @@ IOnboardProfiles::IOnboardProfiles (Device *dev):
 IOnboardProfiles::Description IOnboardProfiles::getDescription ()
 {
 	std::vector<uint8_t> results;
-	results = call (GetDescription);
+	results = callStatic (GetDescription);
 	return Description {
 		results[0], // Memory model
 		results[1], // Profile format
@@ -55,13 +58,14 @@ IOnboardProfiles::Mode IOnboardProfiles::getMode ()
 
 void IOnboardProfiles::setMode (Mode mode)
 {
-	std::vector<uint8_t> params (1);
+	std::array<uint8_t, 1> params;
 	params[0] = static_cast<uint8_t> (mode);
-	call (SetMode, params);
+	callInto (SetMode, params.data (), params.size ());
 }
 
 std::tuple<IOnboardProfiles::MemoryType, unsigned int> IOnboardProfiles::getCurrentProfile ()
 {
+	HIDPP::Dispatcher::ReadOnlyScope read;
 	std::vector<uint8_t> results;
 	results = call (GetCurrentProfile);
 	return std::make_tuple (static_cast<MemoryType> (results[0]), results[1]);
@@ -69,10 +73,10 @@ std::tuple<IOnboardProfiles::MemoryType, unsigned int> IOnboardProfiles::getCurr
 
 void IOnboardProfiles::setCurrentProfile (MemoryType mem_type, unsigned int index)
 {
-	std::vector<uint8_t> params (2);
+	std::array<uint8_t, 2> params;
 	params[0] = mem_type;
 	params[1] = index;
-	call (SetCurrentProfile, params);
+	callInto (SetCurrentProfile, params.data (), params.size ());
 }
 
 std::vector<uint8_t> IOnboardProfiles::memoryRead (MemoryType mem_type, unsigned int page, unsigned int offset)
@@ -84,6 +88,28 @@ std::vector<uint8_t> IOnboardProfiles::memoryRead (MemoryType mem_type, unsigned
 	return call (MemoryRead, params);
 }
 
+std::vector<std::vector<uint8_t>> IOnboardProfiles::memoryRead (MemoryType mem_type, unsigned int page,
+								 const std::vector<unsigned int> &offsets)
+{
+	std::vector<HIDPP::Address> addresses;
+	for (auto offset: offsets)
+		addresses.push_back ({ mem_type, page, offset });
+	return memoryRead (addresses);
+}
+
+std::vector<std::vector<uint8_t>> IOnboardProfiles::memoryRead (const std::vector<HIDPP::Address> &addresses)
+{
+	std::vector<std::vector<uint8_t>> params;
+	for (const auto &address: addresses) {
+		std::vector<uint8_t> p (4);
+		p[0] = address.mem_type;
+		p[1] = address.page;
+		writeBE<uint16_t> (p, 2, address.offset);
+		params.push_back (std::move (p));
+	}
+	return callEach (MemoryRead, params);
+}
+
 void IOnboardProfiles::memoryAddrWrite (unsigned int page, unsigned int offset, unsigned int length)
 {
 	std::vector<uint8_t> params (6);
@@ -100,13 +126,48 @@ void IOnboardProfiles::memoryWrite (std::vector<uint8_t>::const_iterator begin,
 	call (MemoryWrite, begin, end);
 }
 
+void IOnboardProfiles::memoryWriteLines (std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end)
+{
+	std::vector<Device::Call> calls;
+	appendLines (calls, begin, end);
+	device ()->callFunctions (calls);
+}
+
 void IOnboardProfiles::memoryWriteEnd ()
 {
 	call (MemoryWriteEnd);
 }
 
+void IOnboardProfiles::memoryWrite (const std::vector<WriteSession> &sessions)
+{
+	std::vector<Device::Call> calls;
+	for (const auto &session: sessions) {
+		std::vector<uint8_t> params (6);
+		params[0] = MemoryType::Writeable;
+		params[1] = session.page;
+		writeBE<uint16_t> (params, 2, session.offset);
+		writeBE<uint16_t> (params, 4, std::distance (session.begin, session.end));
+		calls.push_back ({ index (), MemoryAddrWrite, std::move (params) });
+		appendLines (calls, session.begin, session.end);
+		calls.push_back ({ index (), MemoryWriteEnd, {} });
+	}
+	device ()->callFunctions (calls);
+}
+
+void IOnboardProfiles::appendLines (std::vector<Device::Call> &calls,
+				     std::vector<uint8_t>::const_iterator begin,
+				     std::vector<uint8_t>::const_iterator end)
+{
+	for (auto it = begin; it != end; ) {
+		auto len = std::min<std::ptrdiff_t> (LineSize, end - it);
+		calls.push_back ({ index (), MemoryWrite, { it, it + len } });
+		it += len;
+	}
+}
+
 unsigned int IOnboardProfiles::getCurrentDPIIndex ()
 {
+	HIDPP::Dispatcher::ReadOnlyScope read;
 	std::vector<uint8_t> results;
 	results = call (GetCurrentDPIIndex);
 	return results[0];
@@ -114,9 +175,9 @@ unsigned int IOnboardProfiles::getCurrentDPIIndex ()
 
 void IOnboardProfiles::setCurrentDPIIndex (unsigned int index)
 {
-	std::vector<uint8_t> params (1);
+	std::array<uint8_t, 1> params;
 	params[0] = index;
-	call (SetCurrentDPIIndex, params);
+	callInto (SetCurrentDPIIndex, params.data (), params.size ());
 }
 
 std::tuple<IOnboardProfiles::MemoryType, unsigned int> IOnboardProfiles::currentProfileChanged (const HIDPP::Report &event)
@@ -20,6 +20,7 @@
 #define LIBHIDPP_HIDPP20_IONBOARDPROFILES_H
 
 #include <hidpp20/FeatureInterface.h>
+#include <hidpp/Address.h>
 
 #include <vector>
 #include <array>
@@ -41,7 +42,9 @@ namespace HIDPP20
  * of the page.
  *
  * Memory reads and writes are done by lines of \ref LineSize bytes (16 bytes:
- * the size of a long HID++ payload).
+ * the size of a long HID++ payload). The line size is fixed by the feature,
+ * even on transports with very long reports, so bulk transfers save time
+ * by pipelining lines rather than by making them larger.
  *
  * Writing memory start with one call to \ref memoryAddrWrite specifying the
  * start address of the new data and its length. Then, \ref memoryWrite must
@@ -195,6 +198,22 @@ public:
 	 * Read \ref LineSize bytes from the given address.
 	 */
 	std::vector<uint8_t> memoryRead (MemoryType mem_type, unsigned int page, unsigned int offset);
+	/**
+	 * Read \ref LineSize bytes from each of the \p offsets in the given
+	 * page.
+	 *
+	 * The reads are pipelined (see Device::callFunctions), this is much
+	 * faster than sequential memoryRead() calls on wireless links.
+	 */
+	std::vector<std::vector<uint8_t>> memoryRead (MemoryType mem_type, unsigned int page,
+						      const std::vector<unsigned int> &offsets);
+	/**
+	 * Read \ref LineSize bytes from each of the \p addresses, possibly
+	 * in different pages and memory types.
+	 *
+	 * The reads are pipelined as with the single page version.
+	 */
+	std::vector<std::vector<uint8_t>> memoryRead (const std::vector<HIDPP::Address> &addresses);
 	/**
 	 * Initiate writing to the memory.
 	 *
@@ -217,6 +236,14 @@ public:
 	 * the extra data at the end of the last memoryWrite call is ignored.
 	 */
 	void memoryWrite (std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end);
+	/**
+	 * Append the data between \p begin and \p end, split in lines of
+	 * \ref LineSize bytes, with the requests pipelined (see
+	 * Device::callFunctions).
+	 *
+	 * \ref memoryAddrWrite must have been called before.
+	 */
+	void memoryWriteLines (std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end);
 	/**
 	 * End writing to the memory.
 	 *
@@ -226,6 +253,25 @@ public:
 	 */
 	void memoryWriteEnd ();
 
+	/**
+	 * Data written to Writeable memory by a single
+	 * memoryAddrWrite/memoryWrite/memoryWriteEnd session.
+	 */
+	struct WriteSession
+	{
+		unsigned int page;
+		unsigned int offset;
+		std::vector<uint8_t>::const_iterator begin, end;
+	};
+	/**
+	 * Run every session of \p sessions, with all their requests
+	 * pipelined (see Device::callFunctions).
+	 *
+	 * Requests are sent in order and the device handles them in the
+	 * same order, so a line is never written outside its session.
+	 */
+	void memoryWrite (const std::vector<WriteSession> &sessions);
+
 	/**
 	 * Get the current DPI index.
 	 *
@@ -255,6 +301,11 @@ public:
 	 * \see getCurrentDPIIndex
 	 */
 	static unsigned int currentDPIIndexChanged (const HIDPP::Report &event);
+
+private:
+	void appendLines (std::vector<Device::Call> &calls,
+			  std::vector<uint8_t>::const_iterator begin,
+			  std::vector<uint8_t>::const_iterator end);
 };
 
 }
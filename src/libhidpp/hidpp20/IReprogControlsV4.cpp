@@ -18,7 +18,9 @@
 
 #include "IReprogControlsV4.h"
 
+#include <hidpp20/SetterQueue.h>
 #include <misc/Endian.h>
+#include <array>
 #include <cassert>
 
 using namespace HIDPP20;
@@ -33,16 +35,13 @@ IReprogControlsV4::IReprogControlsV4 (Device *dev):
 unsigned int IReprogControlsV4::getControlCount ()
 {
 	std::vector<uint8_t> results;
-	results = call (GetControlCount);
+	results = callStatic (GetControlCount);
 	return results[0];
 }
 
-IReprogControlsV4::ControlInfo IReprogControlsV4::getControlInfo (unsigned int index)
+static IReprogControlsV4::ControlInfo parseControlInfo (const std::vector<uint8_t> &results)
 {
-	std::vector<uint8_t> params (1), results;
-	params[0] = index;
-	results = call (GetControlInfo, params);
-	ControlInfo ci;
+	IReprogControlsV4::ControlInfo ci;
 	ci.control_id = readBE<uint16_t> (results, 0);
 	ci.task_id = readBE<uint16_t> (results, 2);
 	ci.flags = results[4];
@@ -53,6 +52,26 @@ IReprogControlsV4::ControlInfo IReprogControlsV4::getControlInfo (unsigned int i
 	return ci;
 }
 
+IReprogControlsV4::ControlInfo IReprogControlsV4::getControlInfo (unsigned int index)
+{
+	std::vector<uint8_t> params (1), results;
+	params[0] = index;
+	results = callStatic (GetControlInfo, params);
+	return parseControlInfo (results);
+}
+
+std::vector<IReprogControlsV4::ControlInfo> IReprogControlsV4::getAllControlInfo ()
+{
+	unsigned int count = getControlCount ();
+	std::vector<std::vector<uint8_t>> params;
+	for (unsigned int i = 0; i < count; ++i)
+		params.push_back ({ static_cast<uint8_t> (i) });
+	std::vector<ControlInfo> controls;
+	for (const auto &results: callStaticEach (GetControlInfo, params))
+		controls.push_back (parseControlInfo (results));
+	return controls;
+}
+
 uint16_t IReprogControlsV4::getControlReporting (uint16_t control_id, uint8_t &flags)
 {
 	std::vector<uint8_t> params (2), results;
@@ -62,32 +81,144 @@ uint16_t IReprogControlsV4::getControlReporting (uint16_t control_id, uint8_t &f
 	return readBE<uint16_t> (results, 3);
 }
 
+std::vector<IReprogControlsV4::ControlReporting> IReprogControlsV4::getControlReporting (const std::vector<uint16_t> &control_ids)
+{
+	std::vector<std::vector<uint8_t>> params;
+	for (auto control_id: control_ids) {
+		params.emplace_back (2);
+		writeBE<uint16_t> (params.back (), 0, control_id);
+	}
+	std::vector<ControlReporting> reportings;
+	auto results = callEach (GetControlReporting, params);
+	for (unsigned int i = 0; i < results.size (); ++i)
+		reportings.push_back ({ control_ids[i], results[i][2], readBE<uint16_t> (results[i], 3) });
+	return reportings;
+}
+
+std::vector<IReprogControlsV4::ControlState> IReprogControlsV4::getAllControlState ()
+{
+	auto controls = getAllControlInfo ();
+	std::vector<uint16_t> control_ids;
+	for (const auto &info: controls)
+		control_ids.push_back (info.control_id);
+	auto reportings = getControlReporting (control_ids);
+	std::vector<ControlState> states;
+	for (unsigned int i = 0; i < controls.size (); ++i)
+		states.push_back ({ controls[i], reportings[i].flags, reportings[i].remap });
+	return states;
+}
+
 void IReprogControlsV4::setControlReporting (uint16_t control_id, uint8_t flags, uint16_t remap)
 {
-	std::vector<uint8_t> params (5), results;
+	std::array<uint8_t, 5> params;
+	writeBE<uint16_t> (params, 0, control_id);
+	params[2] = flags;
+	writeBE<uint16_t> (params, 3, remap);
+	callInto (SetControlReporting, params.data (), params.size ());
+}
+
+void IReprogControlsV4::setControlReporting (SetterQueue &queue, uint16_t control_id, uint8_t flags, uint16_t remap)
+{
+	std::array<uint8_t, 5> params;
 	writeBE<uint16_t> (params, 0, control_id);
 	params[2] = flags;
 	writeBE<uint16_t> (params, 3, remap);
-	call (SetControlReporting, params);
+	queue.set (index (), SetControlReporting, params.data (), params.size (), 2);
+}
+
+void IReprogControlsV4::setControlReporting (const std::vector<ControlReporting> &reportings)
+{
+	std::vector<std::vector<uint8_t>> params;
+	for (const auto &reporting: reportings) {
+		params.emplace_back (5);
+		writeBE<uint16_t> (params.back (), 0, reporting.control_id);
+		params.back ()[2] = reporting.flags;
+		writeBE<uint16_t> (params.back (), 3, reporting.remap);
+	}
+	callEach (SetControlReporting, params);
 }
 
 std::vector<uint16_t> IReprogControlsV4::divertedButtonEvent (const HIDPP::Report &event)
 {
 	assert (event.function () == DivertedButtonEvent);
-	std::vector<uint16_t> buttons;
-	auto params = event.parameterBegin ();
-	for (unsigned int i = 0; i < 4; ++i) {
-		uint16_t control_id = readBE<uint16_t> (params + 2*i);
-		if (control_id == 0)
-			break;
-		buttons.push_back (control_id);
+	DivertedButtons buttons;
+	bool ret = divertedButtonEvent (HIDPP::ReportView (event), buttons);
+	assert (ret);
+	(void) ret;
+	return std::vector<uint16_t> (buttons.controls, buttons.controls+buttons.count);
+}
+
+template<typename View>
+static bool decodeDivertedButtonEvent (const View &event, IReprogControlsV4::DivertedButtons &buttons)
+{
+	if constexpr (View::ParameterLength < 8)
+		return false;
+	else {
+		if (event.function () != IReprogControlsV4::DivertedButtonEvent)
+			return false;
+		auto params = event.parameters ();
+		buttons.count = 0;
+		for (unsigned int i = 0; i < 4; ++i) {
+			uint16_t control_id = readBE<uint16_t> (params + 2*i);
+			if (control_id == 0)
+				break;
+			buttons.controls[buttons.count++] = control_id;
+		}
+		return true;
 	}
-	return buttons;
+}
+
+bool IReprogControlsV4::divertedButtonEvent (const HIDPP::ReportView &event, DivertedButtons &buttons)
+{
+	return HIDPP::visitReport (event.data (), event.length (), [&buttons] (const auto &view) {
+		return decodeDivertedButtonEvent (view, buttons);
+	});
 }
 
 IReprogControlsV4::Move IReprogControlsV4::divertedRawXYEvent (const HIDPP::Report &event)
 {
 	assert (event.function () == DivertedRawXYEvent);
-	auto params = event.parameterBegin ();
-	return Move { readBE<int16_t> (params+0), readBE<int16_t> (params+2) };
+	Move move;
+	bool ret = divertedRawXYEvent (HIDPP::ReportView (event), move);
+	assert (ret);
+	(void) ret;
+	return move;
+}
+
+template<typename View>
+static bool decodeDivertedRawXYEvent (const View &event, IReprogControlsV4::Move &move)
+{
+	if constexpr (View::ParameterLength < 4)
+		return false;
+	else {
+		if (event.function () != IReprogControlsV4::DivertedRawXYEvent)
+			return false;
+		auto params = event.parameters ();
+		move.x = readBE<int16_t> (params+0);
+		move.y = readBE<int16_t> (params+2);
+		return true;
+	}
+}
+
+bool IReprogControlsV4::divertedRawXYEvent (const HIDPP::ReportView &event, Move &move)
+{
+	return HIDPP::visitReport (event.data (), event.length (), [&move] (const auto &view) {
+		return decodeDivertedRawXYEvent (view, move);
+	});
+}
+
+std::size_t IReprogControlsV4::divertedRawXYEvents (uint8_t feature_index,
+						    const uint8_t *reports, std::size_t report_size,
+						    const int *lengths, std::size_t count,
+						    Move *moves)
+{
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < count; ++i) {
+		if (HIDPP::visitReport (reports + i*report_size, lengths[i], [&] (const auto &view) {
+				return view.featureIndex () == feature_index &&
+					decodeDivertedRawXYEvent (view, moves[n]);
+			}))
+			++n;
+	}
+	return n;
 }
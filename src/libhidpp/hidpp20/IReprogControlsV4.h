@@ -26,6 +26,8 @@
 namespace HIDPP20
 {
 
+class SetterQueue;
+
 /**
  * Interface for HW remapping controls or diverting the button or XY events for software handling.
  */
@@ -81,6 +83,11 @@ public:
 	 * Retrieve control \p index informations.
 	 */
 	ControlInfo getControlInfo (unsigned int index);
+	/**
+	 * Retrieve informations for every control, with the queries
+	 * pipelined (see Device::callFunctions).
+	 */
+	std::vector<ControlInfo> getAllControlInfo ();
 
 	enum ControlReportingFlags: uint8_t {
 		TemporaryDiverted = 1<<0,
@@ -104,6 +111,31 @@ public:
 	 */
 	uint16_t getControlReporting (uint16_t control_id, uint8_t &flags);
 
+	struct ControlReporting
+	{
+		uint16_t control_id;
+		uint8_t flags;	///< \see ControlReportingFlags
+		uint16_t remap;	///< Remapped control ID.
+	};
+	/**
+	 * Get the reporting settings of every control in \p control_ids,
+	 * with the queries pipelined (see Device::callFunctions).
+	 */
+	std::vector<ControlReporting> getControlReporting (const std::vector<uint16_t> &control_ids);
+
+	struct ControlState
+	{
+		ControlInfo info;
+		uint8_t flags;	///< \see ControlReportingFlags
+		uint16_t remap;
+	};
+	/**
+	 * Snapshot of the informations and reporting settings of every
+	 * control, in three pipelined bursts (the count, the informations
+	 * and the reporting settings) instead of two round trips per control.
+	 */
+	std::vector<ControlState> getAllControlState ();
+
 	/**
 	 * Set the current reporting settings for the control given by its control ID.
 	 *
@@ -116,14 +148,60 @@ public:
 	 * \see ControlReportingFlags.
 	 */
 	void setControlReporting (uint16_t control_id, uint8_t flags, uint16_t remap);
+	/**
+	 * Same as setControlReporting(uint16_t, uint8_t, uint16_t) through
+	 * \p queue (of the same device): only the latest reporting of each
+	 * control is sent.
+	 */
+	void setControlReporting (SetterQueue &queue, uint16_t control_id, uint8_t flags, uint16_t remap);
+	/**
+	 * Apply the reporting settings of several controls (e.g. a whole
+	 * diversion map) in one pipelined burst. The "Change" flags must be
+	 * set as for setControlReporting(uint16_t, uint8_t, uint16_t).
+	 *
+	 * \throws the error of the first failed call, the other settings may
+	 * have been applied.
+	 */
+	void setControlReporting (const std::vector<ControlReporting> &reportings);
 
 	static std::vector<uint16_t> divertedButtonEvent (const HIDPP::Report &event);
 
+	struct DivertedButtons
+	{
+		uint16_t controls[4];
+		unsigned int count;
+	};
+	/**
+	 * Decode \p event in \p buttons without allocating.
+	 *
+	 * \returns false if \p event is not a valid DivertedButtonEvent.
+	 */
+	static bool divertedButtonEvent (const HIDPP::ReportView &event, DivertedButtons &buttons);
+
 	struct Move
 	{
 		int16_t x, y;
 	};
 	static Move divertedRawXYEvent (const HIDPP::Report &event);
+	/**
+	 * Decode \p event in \p move.
+	 *
+	 * \returns false if \p event is not a valid DivertedRawXYEvent.
+	 */
+	static bool divertedRawXYEvent (const HIDPP::ReportView &event, Move &move);
+	/**
+	 * Decode the DivertedRawXYEvent reports from feature \p feature_index
+	 * among the \p count reports stored in slots of \p report_size bytes
+	 * (as read by HID::RawDevice::readReports).
+	 *
+	 * \p moves must have room for \p count events.
+	 *
+	 * \returns the number of decoded events.
+	 */
+	static std::size_t divertedRawXYEvents (uint8_t feature_index,
+						const uint8_t *reports, std::size_t report_size,
+						const int *lengths, std::size_t count,
+						Move *moves);
 };
 
 }
@@ -32,7 +32,7 @@ ITouchpadRawXY::ITouchpadRawXY (Device *dev):
 
 ITouchpadRawXY::TouchpadInfo ITouchpadRawXY::getTouchpadInfo ()
 {
-	auto results = call (GetTouchpadInfo);
+	auto results = callStatic (GetTouchpadInfo);
 	TouchpadInfo info;
 	info.x_max = readBE<uint16_t> (results, 0);
 	info.y_max = readBE<uint16_t> (results, 2);
@@ -50,16 +50,54 @@ ITouchpadRawXY::TouchpadRawData ITouchpadRawXY::touchpadRawEvent (const HIDPP::R
 {
 	assert (event.function () == TouchpadRawEvent);
 	TouchpadRawData data;
-	auto params = event.parameterBegin ();
-	data.seqnum = readBE<uint16_t> (params+0);
-	for (unsigned int i = 0; i < 2; ++i) {
-		auto pdata = params+2+7*i;
-		data.points[i].x = readBE<int16_t> (pdata+0);
-		data.points[i].y = readBE<int16_t> (pdata+2);
-		data.points[i].unknown0 = pdata[4];
-		data.points[i].unknown1 = pdata[5];
-		data.points[i].id = pdata[6] >> 4;
-		data.points[i].unknown2 = pdata[6] & 0x0f;
-	}
+	bool ret = touchpadRawEvent (HIDPP::ReportView (event), data);
+	assert (ret);
+	(void) ret;
 	return data;
 }
+
+template<typename View>
+static bool decodeTouchpadRawEvent (const View &event, ITouchpadRawXY::TouchpadRawData &data)
+{
+	if constexpr (View::ParameterLength < 16)
+		return false;
+	else {
+		if (event.function () != ITouchpadRawXY::TouchpadRawEvent)
+			return false;
+		auto params = event.parameters ();
+		data.seqnum = readBE<uint16_t> (params+0);
+		for (unsigned int i = 0; i < 2; ++i) {
+			auto pdata = params+2+7*i;
+			data.points[i].x = readBE<int16_t> (pdata+0);
+			data.points[i].y = readBE<int16_t> (pdata+2);
+			data.points[i].unknown0 = pdata[4];
+			data.points[i].unknown1 = pdata[5];
+			data.points[i].id = pdata[6] >> 4;
+			data.points[i].unknown2 = pdata[6] & 0x0f;
+		}
+		return true;
+	}
+}
+
+bool ITouchpadRawXY::touchpadRawEvent (const HIDPP::ReportView &event, TouchpadRawData &data)
+{
+	return HIDPP::visitReport (event.data (), event.length (), [&data] (const auto &view) {
+		return decodeTouchpadRawEvent (view, data);
+	});
+}
+
+std::size_t ITouchpadRawXY::touchpadRawEvents (uint8_t feature_index,
+					       const uint8_t *reports, std::size_t report_size,
+					       const int *lengths, std::size_t count,
+					       TouchpadRawData *data)
+{
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < count; ++i) {
+		if (HIDPP::visitReport (reports + i*report_size, lengths[i], [&] (const auto &view) {
+				return view.featureIndex () == feature_index &&
+					decodeTouchpadRawEvent (view, data[n]);
+			}))
+			++n;
+	}
+	return n;
+}
@@ -58,6 +58,25 @@ public:
 		} points[2];
 	};
 	static TouchpadRawData touchpadRawEvent (const HIDPP::Report &event);
+	/**
+	 * Decode \p event in \p data without allocating.
+	 *
+	 * \returns false if \p event is not a valid TouchpadRawEvent.
+	 */
+	static bool touchpadRawEvent (const HIDPP::ReportView &event, TouchpadRawData &data);
+	/**
+	 * Decode the TouchpadRawEvent reports from feature \p feature_index
+	 * among the \p count reports stored in slots of \p report_size bytes
+	 * (as read by HID::RawDevice::readReports).
+	 *
+	 * \p data must have room for \p count events.
+	 *
+	 * \returns the number of decoded events.
+	 */
+	static std::size_t touchpadRawEvents (uint8_t feature_index,
+					      const uint8_t *reports, std::size_t report_size,
+					      const int *lengths, std::size_t count,
+					      TouchpadRawData *data);
 };
 
 }
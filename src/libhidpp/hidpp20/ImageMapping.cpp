@@ -0,0 +1,139 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ImageMapping.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+}
+
+using namespace HIDPP;
+using namespace HIDPP20;
+
+ImageMapping::ImageMapping (const std::string &path,
+			    const IOnboardProfiles::Description &desc,
+			    bool write_crc,
+			    bool read_only):
+	AbstractMemoryMapping (write_crc),
+	_desc (desc),
+	_read_only (read_only),
+	_size (static_cast<std::size_t> (desc.sector_count) * desc.sector_size)
+{
+	_fd = ::open (path.c_str (), read_only ? O_RDONLY : O_RDWR);
+	if (_fd == -1)
+		throw std::system_error (errno, std::system_category (), path);
+	struct stat st;
+	if (-1 == fstat (_fd, &st)) {
+		int err = errno;
+		::close (_fd);
+		throw std::system_error (err, std::system_category (), path);
+	}
+	if (static_cast<std::size_t> (st.st_size) < _size) {
+		::close (_fd);
+		throw std::runtime_error ("image " + path + " is smaller than the device memory");
+	}
+	void *image = mmap (nullptr, _size, read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+			    MAP_SHARED, _fd, 0);
+	if (image == MAP_FAILED) {
+		int err = errno;
+		::close (_fd);
+		throw std::system_error (err, std::system_category (), "mmap " + path);
+	}
+	_image = static_cast<uint8_t *> (image);
+	setPageTable (1, _desc.sector_count, _desc.sector_size);
+}
+
+ImageMapping::~ImageMapping ()
+{
+	munmap (_image, _size);
+	::close (_fd);
+}
+
+void ImageMapping::create (const std::string &path, const IOnboardProfiles::Description &desc)
+{
+	int fd = ::open (path.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1)
+		throw std::system_error (errno, std::system_category (), path);
+	std::vector<uint8_t> sector (desc.sector_size, 0xff);
+	for (unsigned int i = 0; i < desc.sector_count; ++i) {
+		if (::write (fd, sector.data (), sector.size ()) != static_cast<ssize_t> (sector.size ())) {
+			int err = errno;
+			::close (fd);
+			throw std::system_error (err, std::system_category (), path);
+		}
+	}
+	if (-1 == ::close (fd))
+		throw std::system_error (errno, std::system_category (), path);
+}
+
+uint8_t *ImageMapping::mappedPage (const Address &address) const
+{
+	if (address.mem_type != IOnboardProfiles::Writeable || address.page >= _desc.sector_count)
+		throw std::out_of_range ("page is not in the memory image");
+	return _image + static_cast<std::size_t> (address.page) * _desc.sector_size;
+}
+
+const uint8_t *ImageMapping::sector (unsigned int page) const
+{
+	return mappedPage ({ IOnboardProfiles::Writeable, page, 0 });
+}
+
+void ImageMapping::flush ()
+{
+	if (!_read_only && -1 == msync (_image, _size, MS_SYNC))
+		throw std::system_error (errno, std::system_category (), "msync");
+}
+
+std::vector<uint8_t>::const_iterator ImageMapping::getReadOnlyIterator (const Address &address)
+{
+	auto &page = getReadOnlyPage (address);
+	return page.begin () + address.offset;
+}
+
+std::vector<uint8_t>::iterator ImageMapping::getWritableIterator (const Address &address)
+{
+	auto &page = getWritablePage (address);
+	return page.begin () + address.offset;
+}
+
+bool ImageMapping::computeOffset (std::vector<uint8_t>::const_iterator it, Address &address)
+{
+	auto &page = getReadOnlyPage (address);
+	address.offset = distance (page.begin (), it);
+	return true;
+}
+
+void ImageMapping::readPage (const Address &address, std::vector<uint8_t> &data)
+{
+	const uint8_t *page = mappedPage (address);
+	data.assign (page, page + _desc.sector_size);
+}
+
+void ImageMapping::writePage (const Address &address, const std::vector<uint8_t> &data)
+{
+	if (_read_only)
+		throw std::logic_error ("memory image is read-only");
+	std::memcpy (mappedPage (address), data.data (), _desc.sector_size);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_IMAGE_MAPPING_H
+#define LIBHIDPP_HIDPP20_IMAGE_MAPPING_H
+
+#include <hidpp/AbstractMemoryMapping.h>
+#include <hidpp20/IOnboardProfiles.h>
+
+#include <string>
+
+namespace HIDPP20
+{
+
+/**
+ * Onboard memory image in a host file, with the same addresses as
+ * MemoryMapping so that profile and macro formats can read and write it
+ * offline.
+ *
+ * The image is the writeable memory: \c sector_count sectors of
+ * \c sector_size bytes from the description, at offset
+ * page × \c sector_size. The file is mapped in memory, pages are copied
+ * from the mapping when first used and sync writes modified pages back
+ * in the mapping.
+ */
+class ImageMapping: public HIDPP::AbstractMemoryMapping
+{
+public:
+	/**
+	 * Map the image at \p path, it must be at least as large as the
+	 * memory described by \p desc.
+	 *
+	 * \throws std::system_error if the file cannot be mapped.
+	 * \throws std::runtime_error if the file is too small.
+	 */
+	ImageMapping (const std::string &path,
+		      const IOnboardProfiles::Description &desc,
+		      bool write_crc = true,
+		      bool read_only = false);
+	~ImageMapping ();
+
+	ImageMapping (const ImageMapping &) = delete;
+	ImageMapping &operator= (const ImageMapping &) = delete;
+
+	/**
+	 * Create (or truncate) an image file for \p desc filled with
+	 * erased bytes (0xff).
+	 *
+	 * \throws std::system_error
+	 */
+	static void create (const std::string &path, const IOnboardProfiles::Description &desc);
+
+	/**
+	 * Content of the image sector \p page, directly in the file mapping.
+	 *
+	 * \throws std::out_of_range if the page is not in the image.
+	 */
+	const uint8_t *sector (unsigned int page) const;
+
+	/**
+	 * Write the mapping back to the file (after sync).
+	 *
+	 * \throws std::system_error
+	 */
+	void flush ();
+
+	virtual std::vector<uint8_t>::const_iterator getReadOnlyIterator (const HIDPP::Address &address);
+	virtual std::vector<uint8_t>::iterator getWritableIterator (const HIDPP::Address &address);
+	virtual bool computeOffset (std::vector<uint8_t>::const_iterator it, HIDPP::Address &address);
+
+protected:
+	virtual void readPage (const HIDPP::Address &address, std::vector<uint8_t> &data);
+	virtual void writePage (const HIDPP::Address &address, const std::vector<uint8_t> &data);
+
+private:
+	uint8_t *mappedPage (const HIDPP::Address &address) const;
+
+	IOnboardProfiles::Description _desc;
+	bool _read_only;
+	int _fd;
+	std::size_t _size;
+	uint8_t *_image;
+};
+
+}
+
+#endif
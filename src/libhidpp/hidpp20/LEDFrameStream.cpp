@@ -0,0 +1,139 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "LEDFrameStream.h"
+
+#include <hidpp/Dispatcher.h>
+
+using namespace HIDPP20;
+
+LEDFrameStream::LEDFrameStream (Device *dev, int timeout):
+	_iled (dev),
+	_timeout (timeout),
+	_frame_active (false),
+	_advancing (false),
+	_in_flight (0)
+{
+}
+
+LEDFrameStream::~LEDFrameStream ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (_waiting) {
+		_waiting.reset ();
+		++_stats.dropped;
+	}
+	_idle.wait (lock, [this] () { return !_frame_active && !_advancing; });
+}
+
+void LEDFrameStream::submit (Frame frame)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	++_stats.submitted;
+	if (_waiting)
+		++_stats.dropped;
+	_waiting = std::move (frame);
+	advance (lock);
+}
+
+void LEDFrameStream::wait ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_idle.wait (lock, [this] () { return !_frame_active && !_waiting && !_advancing; });
+}
+
+LEDFrameStream::Statistics LEDFrameStream::statistics () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _stats;
+}
+
+std::exception_ptr LEDFrameStream::takeError ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return std::exchange (_error, nullptr);
+}
+
+void LEDFrameStream::advance (std::unique_lock<std::mutex> &lock)
+{
+	// Completions during a call (or from a synchronous dispatcher) are
+	// handled by the loop already running.
+	if (_advancing)
+		return;
+	_advancing = true;
+	while (true) {
+		if (!_calls.empty () && _in_flight < HIDPP::Dispatcher::MaxSoftwareID) {
+			auto params = _calls.front ();
+			_calls.pop_front ();
+			++_in_flight;
+			lock.unlock ();
+			try {
+				uint8_t led_index = params[0];
+				_iled.device ()->callFunctionAsync (_iled.index (), ILEDControl::SetState,
+					std::vector<uint8_t> (params.begin (), params.end ()),
+					[this, led_index] (const std::vector<uint8_t> *, std::exception_ptr error) {
+						callDone (led_index, error);
+					}, _timeout);
+				lock.lock ();
+			}
+			catch (...) {
+				lock.lock ();
+				--_in_flight;
+				++_stats.failed_calls;
+				_sent.erase (params[0]);
+				_error = std::current_exception ();
+			}
+			continue;
+		}
+		if (_frame_active && _calls.empty () && _in_flight == 0) {
+			_frame_active = false;
+			++_stats.applied;
+		}
+		if (!_frame_active && _waiting) {
+			for (const auto &[led_index, state]: *_waiting) {
+				auto params = ILEDControl::stateParams (led_index, state);
+				auto [it, inserted] = _sent.emplace (params[0], params);
+				if (!inserted) {
+					if (it->second == params)
+						continue;
+					it->second = params;
+				}
+				_calls.push_back (params);
+			}
+			_waiting.reset ();
+			_frame_active = true;
+			continue;
+		}
+		break;
+	}
+	_advancing = false;
+	if (!_frame_active)
+		_idle.notify_all ();
+}
+
+void LEDFrameStream::callDone (uint8_t led_index, std::exception_ptr error)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	--_in_flight;
+	if (error) {
+		++_stats.failed_calls;
+		_sent.erase (led_index); // the LED state is unknown
+		_error = error;
+	}
+	advance (lock);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_LED_FRAME_STREAM_H
+#define LIBHIDPP_HIDPP20_LED_FRAME_STREAM_H
+
+#include <hidpp20/ILEDControl.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+
+namespace HIDPP20
+{
+
+/**
+ * Stream of LED frames for software-driven lighting effects.
+ *
+ * A frame gives the state of several LEDs. Its SetState calls are sent
+ * pipelined (up to HIDPP::Dispatcher::MaxSoftwareID in flight), and
+ * LEDs whose state did not change since the previous frame are not
+ * sent again. The stream is paced by the device: a frame is started
+ * when the previous one is answered, and only the latest submitted
+ * frame waits meanwhile, older waiting frames are dropped instead of
+ * queued. Frames are never torn: a started frame is always finished.
+ *
+ * Use one stream per device, with a concurrent dispatcher (e.g.
+ * HIDPP::DispatcherThread) so that \ref submit does not block. The
+ * device must be in software control mode (see
+ * ILEDControl::setSWControl).
+ */
+class LEDFrameStream
+{
+public:
+	/**
+	 * LED states by LED index.
+	 */
+	typedef std::map<unsigned int, ILEDControl::State> Frame;
+
+	struct Statistics
+	{
+		uint64_t submitted = 0;
+		uint64_t applied = 0; ///< frames whose calls were all answered
+		uint64_t dropped = 0; ///< frames replaced before being started
+		uint64_t failed_calls = 0;
+	};
+
+	/**
+	 * \param timeout	Timeout of each SetState call in milliseconds.
+	 */
+	LEDFrameStream (Device *dev, int timeout = 1000);
+	/**
+	 * Drop the waiting frame and wait for the started one.
+	 */
+	~LEDFrameStream ();
+
+	/**
+	 * Submit \p frame, replacing the waiting frame if the device has
+	 * not finished the previous one.
+	 */
+	void submit (Frame frame);
+
+	/**
+	 * Wait until every submitted frame is applied or dropped.
+	 */
+	void wait ();
+
+	Statistics statistics () const;
+
+	/**
+	 * Take the error of the last failed call, null if no call failed
+	 * since the previous call.
+	 */
+	std::exception_ptr takeError ();
+
+private:
+	void advance (std::unique_lock<std::mutex> &lock);
+	void callDone (uint8_t led_index, std::exception_ptr error);
+
+	ILEDControl _iled;
+	int _timeout;
+	mutable std::mutex _mutex;
+	std::condition_variable _idle;
+	std::optional<Frame> _waiting;
+	bool _frame_active;
+	bool _advancing;
+	std::deque<std::array<uint8_t, 9>> _calls; // not sent yet, from the active frame
+	unsigned int _in_flight;
+	std::map<uint8_t, std::array<uint8_t, 9>> _sent; // last parameters sent for each LED
+	Statistics _stats;
+	std::exception_ptr _error;
+};
+
+}
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "LEDSyncScheduler.h"
+
+#include <hidpp20/IRoot.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace HIDPP20;
+
+namespace
+{
+
+// Answers of the calls of a release or calibration round, written
+// from the dispatcher threads.
+struct Pending
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	unsigned int count = 0;
+
+	void done ()
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		if (--count == 0)
+			cond.notify_all ();
+	}
+
+	void wait ()
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		cond.wait (lock, [this] () { return count == 0; });
+	}
+};
+
+}
+
+LEDSyncScheduler::LEDSyncScheduler (int timeout, clock::duration spin):
+	_timeout (timeout),
+	_spin (spin)
+{
+}
+
+void LEDSyncScheduler::addDevice (Device *dev)
+{
+	_devices.emplace (dev, Entry { ILEDControl (dev), std::nullopt, {}, {} });
+}
+
+void LEDSyncScheduler::removeDevice (const Device *dev)
+{
+	_devices.erase (dev);
+}
+
+unsigned int LEDSyncScheduler::calibrate (unsigned int count)
+{
+	struct Sample
+	{
+		clock::time_point sent;
+		std::optional<clock::duration> rtt;
+	};
+	unsigned int failed = 0;
+	for (unsigned int round = 0; round < count; ++round) {
+		auto pending = std::make_shared<Pending> ();
+		auto samples = std::make_shared<std::vector<Sample>> (_devices.size ());
+		unsigned int i = 0;
+		for (auto &[dev, entry]: _devices) {
+			auto &sample = (*samples)[i];
+			{
+				std::unique_lock<std::mutex> lock (pending->mutex);
+				++pending->count;
+			}
+			sample.sent = clock::now ();
+			try {
+				entry.iled.device ()->callFunctionAsync (IRoot::index, IRoot::Ping,
+					{ 0, 0, uint8_t (round) },
+					[pending, samples, i] (const std::vector<uint8_t> *results, std::exception_ptr) {
+						auto now = clock::now ();
+						if (results) {
+							auto &sample = (*samples)[i];
+							sample.rtt = now - sample.sent;
+						}
+						pending->done ();
+					}, _timeout);
+			}
+			catch (std::exception &e) {
+				pending->done ();
+			}
+			++i;
+		}
+		pending->wait ();
+		i = 0;
+		for (auto &[dev, entry]: _devices) {
+			if (auto rtt = (*samples)[i++].rtt)
+				addSample (entry, *rtt);
+			else
+				++failed;
+		}
+	}
+	return failed;
+}
+
+std::optional<LEDSyncScheduler::clock::duration> LEDSyncScheduler::rtt (const Device *dev) const
+{
+	auto it = _devices.find (dev);
+	if (it == _devices.end ())
+		return std::nullopt;
+	return it->second.rtt;
+}
+
+void LEDSyncScheduler::stage (const Device *dev, const Frame &frame)
+{
+	auto &entry = _devices.at (dev);
+	entry.staged.clear ();
+	for (const auto &[led_index, state]: frame) {
+		auto params = ILEDControl::stateParams (led_index, state);
+		auto it = entry.sent.find (params[0]);
+		if (it == entry.sent.end () || it->second != params)
+			entry.staged.push_back (params);
+	}
+}
+
+LEDSyncScheduler::Report LEDSyncScheduler::release (clock::time_point target)
+{
+	clock::duration default_rtt = clock::duration::zero ();
+	for (const auto &[dev, entry]: _devices)
+		if (entry.rtt)
+			default_rtt = std::max (default_rtt, *entry.rtt);
+
+	// Devices with the longest round trips are sent first
+	std::vector<std::pair<clock::time_point, Entry *>> plan;
+	for (auto &[dev, entry]: _devices)
+		if (!entry.staged.empty ())
+			plan.emplace_back (target - entry.rtt.value_or (default_rtt) / 2, &entry);
+	std::stable_sort (plan.begin (), plan.end (), [] (const auto &a, const auto &b) {
+		return a.first < b.first;
+	});
+
+	Report report;
+	report.devices.resize (plan.size ());
+	auto pending = std::make_shared<Pending> ();
+	// Answer time of the first call of each device, or failed call
+	// counts, written by the handlers.
+	struct Answers
+	{
+		std::vector<std::optional<clock::time_point>> first;
+		std::vector<unsigned int> failed;
+		std::vector<std::vector<uint8_t>> failed_leds;
+	};
+	auto answers = std::make_shared<Answers> ();
+	answers->first.resize (plan.size ());
+	answers->failed.resize (plan.size ());
+	answers->failed_leds.resize (plan.size ());
+	{
+		std::unique_lock<std::mutex> lock (pending->mutex);
+		for (const auto &[time, entry]: plan)
+			pending->count += entry->staged.size ();
+	}
+	for (std::size_t i = 0; i < plan.size (); ++i) {
+		auto &[time, entry] = plan[i];
+		auto &dev_report = report.devices[i];
+		dev_report.dev = entry->iled.device ();
+		dev_report.calls = entry->staged.size ();
+		waitUntil (time);
+		dev_report.sent = clock::now ();
+		for (std::size_t j = 0; j < entry->staged.size (); ++j) {
+			const auto &params = entry->staged[j];
+			entry->sent[params[0]] = params;
+			auto handler = [pending, answers, i, j, led = params[0]] (const std::vector<uint8_t> *results, std::exception_ptr) {
+				auto now = clock::now ();
+				{
+					std::unique_lock<std::mutex> lock (pending->mutex);
+					if (!results) {
+						++answers->failed[i];
+						answers->failed_leds[i].push_back (led);
+					}
+					else if (j == 0)
+						answers->first[i] = now;
+				}
+				pending->done ();
+			};
+			try {
+				entry->iled.device ()->callFunctionAsync (entry->iled.index (), ILEDControl::SetState,
+					std::vector<uint8_t> (params.begin (), params.end ()),
+					Device::call_handler (handler), _timeout);
+			}
+			catch (std::exception &e) {
+				handler (nullptr, std::current_exception ());
+			}
+		}
+		entry->staged.clear ();
+	}
+	pending->wait ();
+
+	std::optional<clock::time_point> earliest, latest;
+	for (std::size_t i = 0; i < plan.size (); ++i) {
+		auto &entry = *plan[i].second;
+		auto &dev_report = report.devices[i];
+		dev_report.failed_calls = answers->failed[i];
+		for (auto led: answers->failed_leds[i])
+			entry.sent.erase (led); // the LED state is unknown
+		if (!answers->first[i])
+			continue;
+		auto rtt = *answers->first[i] - dev_report.sent;
+		dev_report.rtt = rtt;
+		addSample (entry, rtt);
+		auto arrival = dev_report.sent + rtt / 2;
+		if (!earliest || arrival < *earliest)
+			earliest = arrival;
+		if (!latest || arrival > *latest)
+			latest = arrival;
+	}
+	report.skew = earliest ? *latest - *earliest : clock::duration::zero ();
+	return report;
+}
+
+void LEDSyncScheduler::waitUntil (clock::time_point time) const
+{
+	if (clock::now () + _spin < time)
+		std::this_thread::sleep_until (time - _spin);
+	while (clock::now () < time)
+		;
+}
+
+void LEDSyncScheduler::addSample (Entry &entry, clock::duration rtt)
+{
+	if (entry.rtt)
+		entry.rtt = (*entry.rtt * 3 + rtt) / 4;
+	else
+		entry.rtt = rtt;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_LED_SYNC_SCHEDULER_H
+#define LIBHIDPP_HIDPP20_LED_SYNC_SCHEDULER_H
+
+#include <hidpp20/ILEDControl.h>
+#include <hidpp20/LEDFrameStream.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace HIDPP20
+{
+
+/**
+ * Apply LED states on several devices at the same instant.
+ *
+ * Frames are staged per device first. As with LEDFrameStream, only the
+ * LEDs whose state changed since the previous release are kept, as
+ * ready SetState parameters. \ref release then sends the calls of each
+ * device early by half its estimated round trip time, so that they
+ * reach every device at the target time. Waiting for a send time
+ * sleeps until shortly before it, then spins.
+ *
+ * Round trip times are estimated per device with an exponential moving
+ * average. Samples come from \ref calibrate pings and from the first
+ * call of each device in every release.
+ *
+ * Use concurrent dispatchers so that sending does not block. For many
+ * devices, HIDPP::DispatcherReactor serves all of them from one thread.
+ * The devices must be in software control mode (see
+ * ILEDControl::setSWControl). The scheduler functions must be called
+ * from a single thread.
+ */
+class LEDSyncScheduler
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	typedef LEDFrameStream::Frame Frame;
+
+	struct DeviceReport
+	{
+		const Device *dev;
+		clock::time_point sent;	///< when its calls were sent
+		/**
+		 * Round trip of its first call, empty if the device had
+		 * no call or the first one failed.
+		 */
+		std::optional<clock::duration> rtt;
+		unsigned int calls;
+		unsigned int failed_calls;
+	};
+
+	struct Report
+	{
+		std::vector<DeviceReport> devices;
+		/**
+		 * Spread of the estimated arrival times (send time plus
+		 * half the measured round trip) of the first call of each
+		 * device.
+		 */
+		clock::duration skew;
+	};
+
+	/**
+	 * \param timeout	Timeout of each call in milliseconds.
+	 * \param spin		Busy-wait this long before each send time
+	 *			instead of sleeping.
+	 */
+	LEDSyncScheduler (int timeout = 1000,
+			  clock::duration spin = std::chrono::microseconds (500));
+
+	LEDSyncScheduler (const LEDSyncScheduler &) = delete;
+	LEDSyncScheduler &operator= (const LEDSyncScheduler &) = delete;
+
+	/**
+	 * Add \p dev, it must outlive the scheduler or be removed.
+	 *
+	 * \throws UnsupportedFeature if the device has no ILEDControl.
+	 */
+	void addDevice (Device *dev);
+	void removeDevice (const Device *dev);
+
+	/**
+	 * Estimate the round trip time of every device with \p count
+	 * IRoot pings each. Every round pings all the devices together.
+	 *
+	 * \returns the number of failed pings.
+	 */
+	unsigned int calibrate (unsigned int count = 4);
+
+	/**
+	 * Current round trip estimate of \p dev, if any.
+	 */
+	std::optional<clock::duration> rtt (const Device *dev) const;
+
+	/**
+	 * Stage \p frame for \p dev, replacing the frame staged since the
+	 * last release.
+	 *
+	 * \throws std::out_of_range if \p dev was not added.
+	 */
+	void stage (const Device *dev, const Frame &frame);
+
+	/**
+	 * Send the staged calls so that they reach their devices at
+	 * \p target, then wait for every answer.
+	 *
+	 * Devices without a round trip estimate use the longest known
+	 * one. Calls whose send time is already past are sent at once.
+	 */
+	Report release (clock::time_point target);
+
+private:
+	struct Entry
+	{
+		ILEDControl iled;
+		std::optional<clock::duration> rtt;
+		std::map<uint8_t, std::array<uint8_t, 9>> sent; // last parameters sent for each LED
+		std::vector<std::array<uint8_t, 9>> staged;
+	};
+
+	void waitUntil (clock::time_point time) const;
+	void addSample (Entry &entry, clock::duration rtt);
+
+	const int _timeout;
+	const clock::duration _spin;
+	std::map<const Device *, Entry> _devices;
+};
+
+}
+
+#endif
@@ -19,14 +19,14 @@
 #ifndef LIBHIDPP_HIDPP20_MACRO_FORMAT_H
 #define LIBHIDPP_HIDPP20_MACRO_FORMAT_H
 
-#include <hidpp/AbstractMacroFormat.h>
+#include <hidpp/MacroFormatKernel.h>
 
 #include <memory>
 
 namespace HIDPP20
 {
 
-class MacroFormat: public HIDPP::AbstractMacroFormat
+class MacroFormat final: public HIDPP::MacroFormatKernel<MacroFormat>
 {
 public:
 	virtual std::size_t getLength (const HIDPP::Macro::Item &item) const;
@@ -48,4 +48,6 @@ std::unique_ptr<HIDPP::AbstractMacroFormat> getMacroFormat (Device *device);
 
 }
 
+extern template class HIDPP::MacroFormatKernel<HIDPP20::MacroFormat>;
+
 #endif
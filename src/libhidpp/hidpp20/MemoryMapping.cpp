@@ -18,6 +18,12 @@
 
 #include "MemoryMapping.h"
 
+#include <hidpp/Dispatcher.h>
+#include <hidpp/PageCache.h>
+#include <hidpp/SyncJournal.h>
+#include <hidpp20/Device.h>
+#include <misc/Trace.h>
+
 #include <algorithm>
 #include <cassert>
 
@@ -29,6 +35,34 @@ MemoryMapping::MemoryMapping (Device *dev, bool write_crc):
 	_iop (dev),
 	_desc (_iop.getDescription ())
 {
+	// Writeable and ROM memory
+	setPageTable (2, _desc.sector_count, _desc.sector_size);
+}
+
+MemoryMapping::~MemoryMapping ()
+{
+	waitReadAhead ();
+}
+
+void MemoryMapping::setPageCache (std::shared_ptr<PageCache> cache)
+{
+	std::string fingerprint;
+	if (cache)
+		fingerprint = _iop.device ()->fingerprint ();
+	setPageCache (std::move (cache), fingerprint);
+}
+
+void MemoryMapping::setSyncJournal (std::shared_ptr<SyncJournal> journal)
+{
+	std::string fingerprint;
+	if (journal)
+		fingerprint = _iop.device ()->fingerprint ();
+	setSyncJournal (std::move (journal), fingerprint);
+}
+
+const IOnboardProfiles::Description &MemoryMapping::description () const
+{
+	return _desc;
 }
 
 std::vector<uint8_t>::const_iterator MemoryMapping::getReadOnlyIterator (const Address &address)
@@ -43,6 +77,12 @@ std::vector<uint8_t>::iterator MemoryMapping::getWritableIterator (const Address
 	return page.begin () + address.offset;
 }
 
+std::vector<uint8_t>::const_iterator MemoryMapping::getReadOnlyRange (const Address &address, std::size_t length)
+{
+	auto &page = getReadOnlyPageRange (address, address.offset, address.offset + length);
+	return page.begin () + address.offset;
+}
+
 bool MemoryMapping::computeOffset (std::vector<uint8_t>::const_iterator it, Address &address)
 {
 	auto &page = getReadOnlyPage (address);
@@ -53,21 +93,103 @@ bool MemoryMapping::computeOffset (std::vector<uint8_t>::const_iterator it, Addr
 
 void MemoryMapping::readPage (const Address &address, std::vector<uint8_t> &data)
 {
+	Trace::Scope trace ("memory", "readPage", {
+		{ "mem_type", static_cast<unsigned int> (address.mem_type) },
+		{ "page", address.page },
+	});
+	constexpr size_t LineSize = IOnboardProfiles::LineSize;
 	data.resize (_desc.sector_size);
-	for (unsigned int i = 0; i < _desc.sector_size; i += IOnboardProfiles::LineSize) {
-		auto vec = _iop.memoryRead (static_cast<IOnboardProfiles::MemoryType> (address.mem_type), address.page, i);
-		std::copy_n (vec.begin (), IOnboardProfiles::LineSize, &data[i]);
+	// The last line is read from the end of the sector not to overflow
+	// it when the sector size is not a multiple of the line size.
+	std::vector<std::size_t> offsets;
+	for (std::size_t i = 0; i < _desc.sector_size; i += LineSize)
+		offsets.push_back (std::min<std::size_t> (i, _desc.sector_size - LineSize));
+	readLines (address, offsets, data);
+}
+
+void MemoryMapping::readPages (const std::vector<Address> &addresses, std::vector<std::vector<uint8_t>> &data)
+{
+	Trace::Scope trace ("memory", "readPages", { { "count", static_cast<unsigned int> (addresses.size ()) } });
+	Dispatcher::PriorityScope bulk (Dispatcher::Priority::Bulk);
+	constexpr size_t LineSize = IOnboardProfiles::LineSize;
+	std::vector<Address> lines;
+	for (Address address: addresses) {
+		for (std::size_t i = 0; i < _desc.sector_size; i += LineSize) {
+			address.offset = std::min<std::size_t> (i, _desc.sector_size - LineSize);
+			lines.push_back (address);
+		}
 	}
+	auto results = _iop.memoryRead (lines);
+	std::size_t lines_per_page = lines.size () / addresses.size ();
+	data.assign (addresses.size (), std::vector<uint8_t> (_desc.sector_size));
+	for (std::size_t i = 0; i < lines.size (); ++i)
+		std::copy_n (results[i].begin (), LineSize,
+			     &data[i / lines_per_page][lines[i].offset]);
 }
 
-void MemoryMapping::writePage (const Address &address, const std::vector<uint8_t> &data)
+std::size_t MemoryMapping::lineSize () const
 {
-	assert (address.mem_type == IOnboardProfiles::Writeable);
-	_iop.memoryAddrWrite (address.page, address.offset, _desc.sector_size);
+	return IOnboardProfiles::LineSize;
+}
+
+std::size_t MemoryMapping::pageSize (const Address &) const
+{
+	return _desc.sector_size;
+}
+
+void MemoryMapping::readLines (const Address &address, const std::vector<std::size_t> &offsets, std::vector<uint8_t> &data)
+{
+	Dispatcher::PriorityScope bulk (Dispatcher::Priority::Bulk);
 	constexpr size_t LineSize = IOnboardProfiles::LineSize;
-	for (unsigned int i = 0; i < _desc.sector_size; i += LineSize) {
-		_iop.memoryWrite (data.begin () + i, data.begin () + i + LineSize);
+	auto lines = _iop.memoryRead (static_cast<IOnboardProfiles::MemoryType> (address.mem_type),
+				      address.page, { offsets.begin (), offsets.end () });
+	for (std::size_t i = 0; i < offsets.size (); ++i)
+		std::copy_n (lines[i].begin (), LineSize, &data[offsets[i]]);
+}
+
+void MemoryMapping::readPageLines (const std::vector<Address> &addresses, std::vector<std::vector<uint8_t>> &data)
+{
+	Trace::Scope trace ("memory", "readPageLines", { { "count", static_cast<unsigned int> (addresses.size ()) } });
+	Dispatcher::PriorityScope bulk (Dispatcher::Priority::Bulk);
+	data = _iop.memoryRead (addresses);
+	for (auto &line: data)
+		line.resize (IOnboardProfiles::LineSize);
+}
+
+void MemoryMapping::writePage (const Address &address, const std::vector<uint8_t> &data)
+{
+	Trace::Scope trace ("memory", "writePage", { { "page", address.page } });
+	writePages ({ address }, { &data });
+}
+
+void MemoryMapping::writePages (const std::vector<Address> &addresses, const std::vector<const std::vector<uint8_t> *> &data)
+{
+	Trace::Scope trace ("memory", "writePages", { { "count", static_cast<unsigned int> (addresses.size ()) } });
+	Dispatcher::PriorityScope bulk (Dispatcher::Priority::Bulk);
+	std::vector<IOnboardProfiles::WriteSession> sessions;
+	for (std::size_t i = 0; i < addresses.size (); ++i) {
+		assert (addresses[i].mem_type == IOnboardProfiles::Writeable);
+		sessions.push_back ({ addresses[i].page, addresses[i].offset,
+				      data[i]->begin (), data[i]->begin () + _desc.sector_size });
 	}
-	_iop.memoryWriteEnd ();
+	_iop.memoryWrite (sessions);
+}
+
+bool MemoryMapping::readPageEnd (const Address &address, std::vector<uint8_t> &data)
+{
+	constexpr size_t LineSize = IOnboardProfiles::LineSize;
+	data = _iop.memoryRead (static_cast<IOnboardProfiles::MemoryType> (address.mem_type),
+				address.page, _desc.sector_size - LineSize);
+	data.resize (LineSize);
+	return true;
+}
+
+bool MemoryMapping::isReadOnly (const Address &address) const
+{
+	return address.mem_type == IOnboardProfiles::ROM;
 }
 
+unsigned int MemoryMapping::pageCount (const Address &) const
+{
+	return _desc.sector_count;
+}
@@ -29,14 +29,58 @@ class MemoryMapping: public HIDPP::AbstractMemoryMapping
 {
 public:
 	MemoryMapping (Device *dev, bool write_crc = true);
+	~MemoryMapping ();
+
+	using HIDPP::AbstractMemoryMapping::setPageCache;
+	/**
+	 * Use \p cache with the fingerprint of the device (see
+	 * Device::fingerprint).
+	 */
+	void setPageCache (std::shared_ptr<HIDPP::PageCache> cache);
+	using HIDPP::AbstractMemoryMapping::setSyncJournal;
+	/**
+	 * Use \p journal with the fingerprint of the device (see
+	 * Device::fingerprint).
+	 */
+	void setSyncJournal (std::shared_ptr<HIDPP::SyncJournal> journal);
+
+	/**
+	 * Onboard memory description read when the mapping was created.
+	 */
+	const IOnboardProfiles::Description &description () const;
 
 	virtual std::vector<uint8_t>::const_iterator getReadOnlyIterator (const HIDPP::Address &address);
+	virtual std::vector<uint8_t>::const_iterator getReadOnlyRange (const HIDPP::Address &address, std::size_t length);
 	virtual std::vector<uint8_t>::iterator getWritableIterator (const HIDPP::Address &address);
 	virtual bool computeOffset (std::vector<uint8_t>::const_iterator it, HIDPP::Address &address);
 
 protected:
 	virtual void readPage (const HIDPP::Address &address, std::vector<uint8_t> &data);
+	/**
+	 * The lines of every page are read in one pipelined batch.
+	 */
+	virtual void readPages (const std::vector<HIDPP::Address> &addresses, std::vector<std::vector<uint8_t>> &data);
+	virtual std::size_t lineSize () const;
+	virtual std::size_t pageSize (const HIDPP::Address &address) const;
+	virtual void readLines (const HIDPP::Address &address, const std::vector<std::size_t> &offsets, std::vector<uint8_t> &data);
+	/**
+	 * The lines are read in one pipelined batch.
+	 */
+	virtual void readPageLines (const std::vector<HIDPP::Address> &addresses, std::vector<std::vector<uint8_t>> &data);
 	virtual void writePage (const HIDPP::Address &address, const std::vector<uint8_t> &data);
+	/**
+	 * The write sessions of every page are pipelined in one batch.
+	 */
+	virtual void writePages (const std::vector<HIDPP::Address> &addresses, const std::vector<const std::vector<uint8_t> *> &data);
+	virtual bool readPageEnd (const HIDPP::Address &address, std::vector<uint8_t> &data);
+	/**
+	 * ROM pages are read-only.
+	 */
+	virtual bool isReadOnly (const HIDPP::Address &address) const;
+	/**
+	 * Every memory type has the sector count of the description.
+	 */
+	virtual unsigned int pageCount (const HIDPP::Address &address) const;
 
 private:
 	IOnboardProfiles _iop;
@@ -36,17 +36,18 @@ static constexpr std::size_t ButtonSize = 4;
 static constexpr std::size_t RGBEffectSize = 11;
 
 static constexpr auto ReportRate =	Field<uint8_t> (0);
-static constexpr auto DefaultDPI =	Field<uint8_t> (1);
-static constexpr auto SwitchedDPI =	Field<uint8_t> (2);
-static constexpr auto Modes =		ArrayField<uint16_t, 5, LittleEndian> (3);
-static constexpr auto ProfileColor =	Field<Color> (13);
-static constexpr auto PowerMode =	Field<uint8_t> (16);
-static constexpr auto AngleSnapping =	Field<uint8_t> (17);
-static constexpr auto Revision =	Field<uint16_t, LittleEndian> (18);
+static constexpr auto DefaultDPI =	Field<uint8_t> (after (ReportRate));
+static constexpr auto SwitchedDPI =	Field<uint8_t> (after (DefaultDPI));
+static constexpr auto Modes =		ArrayField<uint16_t, 5, LittleEndian> (after (SwitchedDPI));
+static constexpr auto ProfileColor =	Field<Color> (after (Modes));
+static constexpr auto PowerMode =	Field<uint8_t> (after (ProfileColor));
+static constexpr auto AngleSnapping =	Field<uint8_t> (after (PowerMode));
+static constexpr auto Revision =	Field<uint16_t, LittleEndian> (after (AngleSnapping));
 static constexpr auto Buttons =		StructArrayField<ButtonSize, 32> (32);
-static constexpr auto Name =		ArrayField<char16_t, 24, LittleEndian> (160);
-static constexpr auto LogoEffect =	StructField<RGBEffectSize> (208);
-static constexpr auto SideEffect =	StructField<RGBEffectSize> (219);
+static constexpr auto Name =		ArrayField<char16_t, 24, LittleEndian> (after (Buttons));
+static constexpr auto LogoEffect =	StructField<RGBEffectSize> (after (Name));
+static constexpr auto SideEffect =	StructField<RGBEffectSize> (after (LogoEffect));
+static_assert (after (Name) == 208 && after (SideEffect) == 230); // see ProfileLength
 
 namespace Button
 {
@@ -282,7 +283,8 @@ Profile ProfileFormat::read (std::vector<uint8_t>::const_iterator begin) const
 	Profile profile;
 	profile.settings.emplace ("report_rate", static_cast<int> (ReportRate.read (begin)));
 	profile.settings.emplace ("default_dpi", static_cast<int> (DefaultDPI.read (begin)));
-	profile.settings.emplace ("switched_dpi", static_cast<int> (SwitchedDPI.read (begin)));
+	if (_has_dpi_shift)
+		profile.settings.emplace ("switched_dpi", static_cast<int> (SwitchedDPI.read (begin)));
 	for (unsigned int i = 0; i < MaxModeCount; ++i) {
 		uint16_t dpi = Modes.read (begin, i);
 		if (dpi == 0x0000 || dpi == 0xFFFF)
@@ -301,7 +303,7 @@ Profile ProfileFormat::read (std::vector<uint8_t>::const_iterator begin) const
 	for (unsigned int i = 0; i < (_has_g_shift ? 2 : 1); ++i) { // Normal/alternate buttons
 		for (unsigned int j = 0; j < _desc.button_count; ++j) {
 			auto button_data = Buttons.begin (begin, i*MaxButtonCount + j);
-			profile.buttons.emplace_back (readButton (button_data));
+			profile.buttons.emplace_back (::readButton (button_data));
 		}
 	}
 	{
@@ -334,7 +336,8 @@ void ProfileFormat::write (const Profile &profile, std::vector<uint8_t>::iterato
 	SettingLookup general (profile.settings, _general_settings);
 	ReportRate.write (begin, general.get<int> ("report_rate"));
 	DefaultDPI.write (begin, general.get<int> ("default_dpi"));
-	SwitchedDPI.write (begin, general.get<int> ("switched_dpi"));
+	if (_has_dpi_shift)
+		SwitchedDPI.write (begin, general.get<int> ("switched_dpi"));
 	for (unsigned int i = 0; i < MaxModeCount; ++i) {
 		if (i < profile.modes.size ()) {
 			SettingLookup mode (profile.modes[i], ModeSettings);
@@ -355,7 +358,7 @@ void ProfileFormat::write (const Profile &profile, std::vector<uint8_t>::iterato
 		for (unsigned int j = 0; j < _desc.button_count; ++j) {
 			auto button_data = Buttons.begin (begin, MaxButtonCount*i + j);
 			const auto &button = profile.buttons[i*_desc.button_count + j];
-			writeButton (button_data, button);
+			::writeButton (button_data, button);
 		}
 	}
 	std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> conv16;
@@ -371,6 +374,108 @@ void ProfileFormat::write (const Profile &profile, std::vector<uint8_t>::iterato
 	}
 }
 
+unsigned int ProfileFormat::readModeCount (std::vector<uint8_t>::const_iterator begin) const
+{
+	using namespace Fields;
+	unsigned int count = 0;
+	while (count < MaxModeCount) {
+		uint16_t dpi = Modes.read (begin, count);
+		if (dpi == 0x0000 || dpi == 0xFFFF)
+			break;
+		++count;
+	}
+	return count;
+}
+
+SettingMap ProfileFormat::readMode (std::vector<uint8_t>::const_iterator begin, unsigned int index) const
+{
+	using namespace Fields;
+	if (index >= readModeCount (begin))
+		throw std::out_of_range ("mode index");
+	return {
+		{ "dpi", static_cast<int> (Modes.read (begin, index)) },
+	};
+}
+
+unsigned int ProfileFormat::readButtonCount (std::vector<uint8_t>::const_iterator) const
+{
+	return (_has_g_shift ? 2 : 1) * _desc.button_count;
+}
+
+unsigned int ProfileFormat::buttonSlot (std::vector<uint8_t>::const_iterator begin, unsigned int index) const
+{
+	if (index >= readButtonCount (begin))
+		throw std::out_of_range ("button index");
+	// Normal/alternate buttons
+	return (index / _desc.button_count) * MaxButtonCount
+		+ index % _desc.button_count;
+}
+
+Profile::Button ProfileFormat::readButton (std::vector<uint8_t>::const_iterator begin, unsigned int index) const
+{
+	return ::readButton (Fields::Buttons.begin (begin, buttonSlot (begin, index)));
+}
+
+Setting ProfileFormat::readSetting (std::vector<uint8_t>::const_iterator begin, const std::string &name) const
+{
+	using namespace Fields;
+	if (name == "report_rate")
+		return static_cast<int> (ReportRate.read (begin));
+	if (name == "default_dpi")
+		return static_cast<int> (DefaultDPI.read (begin));
+	if (name == "switched_dpi" && _has_dpi_shift)
+		return static_cast<int> (SwitchedDPI.read (begin));
+	if (name == "color")
+		return ProfileColor.read (begin);
+	if (name == "power_mode" && _has_power_modes)
+		return EnumValue (PowerModes, PowerMode.read (begin));
+	if (name == "angle_snapping")
+		return AngleSnapping.read (begin) != 0;
+	if (name == "revision")
+		return static_cast<int> (Revision.read (begin));
+	return AbstractProfileFormat::readSetting (begin, name);
+}
+
+void ProfileFormat::writeMode (std::vector<uint8_t>::iterator begin, unsigned int index, const SettingMap &mode) const
+{
+	using namespace Fields;
+	if (index >= MaxModeCount || index > readModeCount (begin))
+		throw std::out_of_range ("mode index");
+	SettingLookup lookup (mode, ModeSettings);
+	Modes.write (begin, index, lookup.get<int> ("dpi"));
+}
+
+void ProfileFormat::writeButton (std::vector<uint8_t>::iterator begin, unsigned int index, const Profile::Button &button) const
+{
+	::writeButton (Fields::Buttons.begin (begin, buttonSlot (begin, index)), button);
+}
+
+void ProfileFormat::writeSetting (std::vector<uint8_t>::iterator begin, const std::string &name, const Setting &value) const
+{
+	using namespace Fields;
+	auto desc = _general_settings.find (name);
+	if (desc == _general_settings.end ())
+		throw std::out_of_range ("setting name");
+	if (!desc->second.check (value))
+		throw std::invalid_argument ("Invalid value for setting " + name);
+	if (name == "report_rate")
+		ReportRate.write (begin, value.get<int> ());
+	else if (name == "default_dpi")
+		DefaultDPI.write (begin, value.get<int> ());
+	else if (name == "switched_dpi")
+		SwitchedDPI.write (begin, value.get<int> ());
+	else if (name == "color")
+		ProfileColor.write (begin, value.get<Color> ());
+	else if (name == "power_mode")
+		PowerMode.write (begin, value.get<EnumValue> ().get ());
+	else if (name == "angle_snapping")
+		AngleSnapping.write (begin, value.get<bool> () ? 0x01 : 0x00);
+	else if (name == "revision")
+		Revision.write (begin, value.get<int> ());
+	else
+		AbstractProfileFormat::writeSetting (begin, name, value);
+}
+
 const std::map<uint8_t, size_t> ProfileFormat::ProfileLength = {
 	{ 1, 208 }, // actually 224, but ignoring data at the end right now
 	{ 2, 230 },
@@ -397,7 +502,7 @@ const std::map<std::string, SettingDesc> ProfileFormat::ModeSettings = {
 	{ "dpi", SettingDesc (0, 50000, 1200) }, // TODO: Get proper values from AdjustableDPI
 };
 
-const EnumDesc ProfileFormat::SpecialActions = {
+static constexpr EnumTable SpecialActionTable ({
 	{ "Deactivated", 0 },
 	{ "WheelLeft", 1 },
 	{ "WheelRight", 2 },
@@ -411,18 +516,24 @@ const EnumDesc ProfileFormat::SpecialActions = {
 	{ "ProfileCycle", 10 },
 	{ "GShift", 11 },
 	{ "BatteryLevel", 12 },
-};
+});
 
-const EnumDesc ProfileFormat::RGBEffects = {
+const EnumDesc ProfileFormat::SpecialActions (SpecialActionTable);
+
+static constexpr EnumTable RGBEffectTable ({
 	{ "Off", RGBEffectOff},
 	{ "Constant", RGBEffectConstant },
 	{ "Pulse", RGBEffectPulse },
 	{ "Cycle", RGBEffectCycle },
-};
+});
+
+const EnumDesc ProfileFormat::RGBEffects (RGBEffectTable);
 
-const EnumDesc ProfileFormat::PowerModes = {
+static constexpr EnumTable PowerModeTable ({
 	{ "NotApplicable", 0xff },
-};
+});
+
+const EnumDesc ProfileFormat::PowerModes (PowerModeTable);
 
 std::unique_ptr<AbstractProfileFormat> HIDPP20::getProfileFormat (HIDPP20::Device *device)
 {
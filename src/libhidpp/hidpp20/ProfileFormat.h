@@ -39,7 +39,28 @@ public:
 	virtual HIDPP::Profile read (std::vector<uint8_t>::const_iterator begin) const;
 	virtual void write (const HIDPP::Profile &profile, std::vector<uint8_t>::iterator begin) const;
 
+	virtual unsigned int readModeCount (std::vector<uint8_t>::const_iterator begin) const;
+	virtual HIDPP::SettingMap readMode (std::vector<uint8_t>::const_iterator begin, unsigned int index) const;
+	virtual unsigned int readButtonCount (std::vector<uint8_t>::const_iterator begin) const;
+	virtual HIDPP::Profile::Button readButton (std::vector<uint8_t>::const_iterator begin, unsigned int index) const;
+	/**
+	 * Settings other than the name and the LED effects are decoded
+	 * alone.
+	 */
+	virtual HIDPP::Setting readSetting (std::vector<uint8_t>::const_iterator begin, const std::string &name) const;
+	virtual void writeMode (std::vector<uint8_t>::iterator begin, unsigned int index, const HIDPP::SettingMap &mode) const;
+	virtual void writeButton (std::vector<uint8_t>::iterator begin, unsigned int index, const HIDPP::Profile::Button &button) const;
+	/**
+	 * Settings other than the name and the LED effects are encoded
+	 * alone.
+	 *
+	 * \throws std::invalid_argument if \p value is not valid.
+	 */
+	virtual void writeSetting (std::vector<uint8_t>::iterator begin, const std::string &name, const HIDPP::Setting &value) const;
+
 private:
+	unsigned int buttonSlot (std::vector<uint8_t>::const_iterator begin, unsigned int index) const;
+
 	IOnboardProfiles::Description _desc;
 	std::map<std::string, HIDPP::SettingDesc> _general_settings;
 	bool _has_g_shift;
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "SetterQueue.h"
+
+#include <stdexcept>
+#include <utility>
+
+using namespace HIDPP20;
+
+SetterQueue::SetterQueue (Device *dev, int timeout):
+	_dev (dev),
+	_timeout (timeout),
+	_in_flight (0)
+{
+}
+
+SetterQueue::~SetterQueue ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	for (auto &[key, target]: _targets) {
+		if (target.waiting) {
+			target.waiting.reset ();
+			++_stats.superseded;
+		}
+	}
+	_idle.wait (lock, [this] () { return _in_flight == 0; });
+}
+
+Device *SetterQueue::device () const
+{
+	return _dev;
+}
+
+void SetterQueue::set (uint8_t feature_index, unsigned int function,
+		       const uint8_t *params, std::size_t length,
+		       std::size_t target_length)
+{
+	if (target_length > length)
+		throw std::invalid_argument ("Target is longer than the parameters");
+	Key key (feature_index, function, std::vector<uint8_t> (params, params + target_length));
+	std::vector<uint8_t> value (params, params + length);
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		++_stats.submitted;
+		auto &target = _targets[key];
+		if (target.in_flight) {
+			if (target.waiting)
+				++_stats.superseded;
+			target.waiting = std::move (value);
+			return;
+		}
+		target.in_flight = true;
+		++_in_flight;
+	}
+	send (key, std::move (value));
+}
+
+void SetterQueue::wait ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_idle.wait (lock, [this] () { return _in_flight == 0; });
+}
+
+SetterQueue::Statistics SetterQueue::statistics () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _stats;
+}
+
+std::exception_ptr SetterQueue::takeError ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return std::exchange (_error, nullptr);
+}
+
+void SetterQueue::send (const Key &key, std::vector<uint8_t> params)
+{
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		++_stats.sent;
+	}
+	try {
+		_dev->callFunctionAsync (std::get<0> (key), std::get<1> (key), params,
+			[this, key] (const std::vector<uint8_t> *, std::exception_ptr error) {
+				callDone (key, error);
+			}, _timeout);
+	}
+	catch (...) {
+		callDone (key, std::current_exception ());
+	}
+}
+
+void SetterQueue::callDone (const Key &key, std::exception_ptr error)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	if (error) {
+		++_stats.failed_calls;
+		_error = error;
+	}
+	auto &target = _targets[key];
+	if (target.waiting) {
+		// Send the latest value, the target stays in flight.
+		auto params = std::move (*target.waiting);
+		target.waiting.reset ();
+		lock.unlock ();
+		send (key, std::move (params));
+		return;
+	}
+	target.in_flight = false;
+	if (--_in_flight == 0)
+		_idle.notify_all ();
+}
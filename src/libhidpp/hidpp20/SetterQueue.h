@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HIDPP20_SETTER_QUEUE_H
+#define LIBHIDPP_HIDPP20_SETTER_QUEUE_H
+
+#include <hidpp20/Device.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+namespace HIDPP20
+{
+
+/**
+ * Last-writer-wins queue of setter calls, for settings changed faster
+ * than the device answers (e.g. from UI sliders).
+ *
+ * A call is identified by its feature index, function and target: the
+ * first bytes of its parameters (e.g. a sensor, LED or control). Each
+ * target has at most one call in flight: values set meanwhile replace
+ * each other and only the latest one is sent when the previous call is
+ * answered. Calls to different targets are sent concurrently.
+ *
+ * Use one queue per device, with a concurrent dispatcher (e.g.
+ * HIDPP::DispatcherThread) so that \ref set does not block.
+ */
+class SetterQueue
+{
+public:
+	struct Statistics
+	{
+		uint64_t submitted = 0;
+		uint64_t sent = 0;
+		uint64_t superseded = 0; ///< values replaced before being sent
+		uint64_t failed_calls = 0;
+	};
+
+	/**
+	 * \param timeout	Timeout of each call in milliseconds.
+	 */
+	SetterQueue (Device *dev, int timeout = 1000);
+	/**
+	 * Drop the waiting values and wait for the calls in flight.
+	 */
+	~SetterQueue ();
+
+	SetterQueue (const SetterQueue &) = delete;
+	SetterQueue &operator= (const SetterQueue &) = delete;
+
+	Device *device () const;
+
+	/**
+	 * Call \p function of the feature at \p feature_index with
+	 * \p params, or replace the waiting value if a call to the same
+	 * target is in flight.
+	 *
+	 * \param target_length	Number of leading parameter bytes
+	 *			identifying the target.
+	 */
+	void set (uint8_t feature_index, unsigned int function,
+		  const uint8_t *params, std::size_t length,
+		  std::size_t target_length);
+
+	/**
+	 * Wait until every value is sent and answered.
+	 */
+	void wait ();
+
+	Statistics statistics () const;
+
+	/**
+	 * Take the error of the last failed call, null if no call failed
+	 * since the previous call.
+	 */
+	std::exception_ptr takeError ();
+
+private:
+	typedef std::tuple<uint8_t, unsigned int, std::vector<uint8_t>> Key;
+	struct Target
+	{
+		bool in_flight = false;
+		std::optional<std::vector<uint8_t>> waiting;
+	};
+
+	void send (const Key &key, std::vector<uint8_t> params);
+	void callDone (const Key &key, std::exception_ptr error);
+
+	Device *_dev;
+	int _timeout;
+	mutable std::mutex _mutex;
+	std::condition_variable _idle;
+	std::map<Key, Target> _targets;
+	unsigned int _in_flight;
+	Statistics _stats;
+	std::exception_ptr _error;
+};
+
+}
+
+#endif
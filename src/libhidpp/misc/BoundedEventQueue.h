@@ -0,0 +1,312 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_MISC_BOUNDED_EVENT_QUEUE_H
+#define LIBHIDPP_MISC_BOUNDED_EVENT_QUEUE_H
+
+#include <misc/MemoryAccounting.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/**
+ * Bounded multi-producer multi-consumer queue for transfering events
+ * across threads.
+ *
+ * Unlike EventQueue, the memory is allocated once: the capacity is
+ * rounded up to a power of two. Pushing and popping are lock-free (a
+ * ring of sequenced slots), the mutex and condition variables are only
+ * used by threads that must sleep, and a push only wakes them when
+ * there is a sleeper.
+ *
+ * When the queue is full, push blocks (backpressure) and try_push
+ * fails. pop_all takes every event available at once, so that a burst
+ * costs a single wakeup of the consumer.
+ */
+template<typename T>
+class BoundedEventQueue
+{
+public:
+	BoundedEventQueue (std::size_t capacity):
+		_slots (roundCapacity (capacity)),
+		_mask (_slots.size () - 1),
+		_head (0), _tail (0),
+		_interrupted (false),
+		_push_waiters (0), _pop_waiters (0),
+		_account (MemoryAccounting::Subsystem::EventQueues)
+	{
+		for (std::size_t i = 0; i < _slots.size (); ++i)
+			_slots[i].sequence.store (i, std::memory_order_relaxed);
+		_account.set (_slots.size () * sizeof (Slot));
+	}
+
+	BoundedEventQueue (const BoundedEventQueue &) = delete;
+	BoundedEventQueue &operator= (const BoundedEventQueue &) = delete;
+
+	std::size_t capacity () const noexcept
+	{
+		return _slots.size ();
+	}
+
+	/**
+	 * Push an event if there is room.
+	 *
+	 * \returns false if the queue is full or interrupted.
+	 */
+	bool try_push (T event)
+	{
+		if (_interrupted.load (std::memory_order_acquire) || !enqueue (event))
+			return false;
+		wake (_pop_waiters, _pop_cond);
+		return true;
+	}
+
+	/**
+	 * Push an event, blocking while the queue is full.
+	 *
+	 * \returns false if the queue was interrupted before the event could
+	 * be pushed.
+	 */
+	bool push (T event)
+	{
+		while (!_interrupted.load (std::memory_order_acquire)) {
+			if (enqueue (event)) {
+				wake (_pop_waiters, _pop_cond);
+				return true;
+			}
+			wait (_push_waiters, _push_cond, [this] () { return !full (); });
+		}
+		return false;
+	}
+
+	/**
+	 * Push the events from \p begin to \p end in order, blocking while
+	 * the queue is full. Consumers are woken once per batch of pushed
+	 * events instead of once per event.
+	 *
+	 * \returns the iterator after the last pushed event, it is \p end
+	 * unless the queue was interrupted.
+	 */
+	template<typename Iterator>
+	Iterator push_batch (Iterator begin, Iterator end)
+	{
+		while (begin != end && !_interrupted.load (std::memory_order_acquire)) {
+			bool pushed = false;
+			while (begin != end && enqueue (*begin)) {
+				++begin;
+				pushed = true;
+			}
+			if (pushed)
+				wake (_pop_waiters, _pop_cond);
+			if (begin != end)
+				wait (_push_waiters, _push_cond, [this] () { return !full (); });
+		}
+		return begin;
+	}
+
+	/**
+	 * Try to pop an event from the queue.
+	 *
+	 * If the queue is empty, an invalid value is returned.
+	 */
+	std::optional<T> try_pop ()
+	{
+		std::optional<T> ret = dequeue ();
+		if (ret)
+			wake (_push_waiters, _push_cond);
+		return ret;
+	}
+
+	/**
+	 * Append every available event to \p events without blocking.
+	 *
+	 * \returns the number of events appended.
+	 */
+	std::size_t try_pop_all (std::vector<T> &events)
+	{
+		std::size_t count = 0;
+		while (auto event = dequeue ()) {
+			events.push_back (std::move (*event));
+			++count;
+		}
+		if (count > 0)
+			wake (_push_waiters, _push_cond);
+		return count;
+	}
+
+	/**
+	 * Append every available event to \p events.
+	 *
+	 * This method will block until an event is available unless it is
+	 * interrupted.
+	 *
+	 * \returns the number of events appended, 0 only if interrupted.
+	 *
+	 * \see interrupt()
+	 */
+	std::size_t pop_all (std::vector<T> &events)
+	{
+		while (!_interrupted.load (std::memory_order_acquire)) {
+			if (std::size_t count = try_pop_all (events))
+				return count;
+			wait (_pop_waiters, _pop_cond, [this] () { return !empty (); });
+		}
+		return 0;
+	}
+
+	/**
+	 * Make the current and future calls to push() and pop_all() return
+	 * immediately without transfering events.
+	 *
+	 * \see resetInterruption()
+	 */
+	void interrupt ()
+	{
+		{
+			std::unique_lock<std::mutex> lock (_mutex);
+			_interrupted.store (true, std::memory_order_release);
+		}
+		_push_cond.notify_all ();
+		_pop_cond.notify_all ();
+	}
+
+	/**
+	 * Cancel the effect of interrupt().
+	 *
+	 * Future calls to push() and pop_all(), will block again.
+	 */
+	void resetInterruption ()
+	{
+		_interrupted.store (false, std::memory_order_release);
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<std::size_t> sequence;
+		std::optional<T> event;
+	};
+
+	static std::size_t roundCapacity (std::size_t capacity)
+	{
+		std::size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		return size;
+	}
+
+	/*
+	 * A slot can be written when its sequence is the position, and read
+	 * when it is the position + 1. Reading it sets the sequence for the
+	 * next round of the ring.
+	 */
+	bool enqueue (const T &event)
+	{
+		std::size_t pos = _tail.load (std::memory_order_relaxed);
+		while (true) {
+			Slot &slot = _slots[pos & _mask];
+			std::size_t seq = slot.sequence.load (std::memory_order_acquire);
+			if (seq == pos) {
+				if (_tail.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed)) {
+					slot.event = event;
+					slot.sequence.store (pos+1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (seq < pos)
+				return false; // full
+			else
+				pos = _tail.load (std::memory_order_relaxed);
+		}
+	}
+
+	std::optional<T> dequeue ()
+	{
+		std::size_t pos = _head.load (std::memory_order_relaxed);
+		while (true) {
+			Slot &slot = _slots[pos & _mask];
+			std::size_t seq = slot.sequence.load (std::memory_order_acquire);
+			if (seq == pos+1) {
+				if (_head.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed)) {
+					std::optional<T> event = std::move (slot.event);
+					slot.event.reset ();
+					slot.sequence.store (pos+_slots.size (), std::memory_order_release);
+					return event;
+				}
+			}
+			else if (seq < pos+1)
+				return std::nullopt; // empty
+			else
+				pos = _head.load (std::memory_order_relaxed);
+		}
+	}
+
+	bool empty () const
+	{
+		std::size_t pos = _head.load (std::memory_order_relaxed);
+		return _slots[pos & _mask].sequence.load (std::memory_order_acquire) != pos+1;
+	}
+
+	bool full () const
+	{
+		std::size_t pos = _tail.load (std::memory_order_relaxed);
+		return _slots[pos & _mask].sequence.load (std::memory_order_acquire) != pos;
+	}
+
+	/*
+	 * The waiter counter is incremented before checking the condition
+	 * and read after changing the ring, the fences make sure at least
+	 * one side sees the other.
+	 */
+	template<typename Ready>
+	void wait (std::atomic<unsigned int> &waiters, std::condition_variable &cond, Ready ready)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		waiters.fetch_add (1, std::memory_order_relaxed);
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		while (!ready () && !_interrupted.load (std::memory_order_acquire))
+			cond.wait (lock);
+		waiters.fetch_sub (1, std::memory_order_relaxed);
+	}
+
+	void wake (std::atomic<unsigned int> &waiters, std::condition_variable &cond)
+	{
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (waiters.load (std::memory_order_relaxed) == 0)
+			return;
+		// Locking waits for a waiter between its check and its wait
+		std::unique_lock<std::mutex> lock (_mutex);
+		lock.unlock ();
+		cond.notify_all ();
+	}
+
+	std::vector<Slot> _slots;
+	const std::size_t _mask;
+	std::atomic<std::size_t> _head, _tail;
+	std::atomic<bool> _interrupted;
+	std::atomic<unsigned int> _push_waiters, _pop_waiters;
+	std::mutex _mutex;
+	std::condition_variable _push_cond, _pop_cond;
+	MemoryAccounting::Account _account;
+};
+
+#endif
@@ -18,23 +18,73 @@
 
 #include <misc/CRC.h>
 
-uint16_t CRC::CCITT (std::vector<uint8_t>::const_iterator begin,
-		     std::vector<uint8_t>::const_iterator end,
+namespace
+{
+
+constexpr uint16_t Polynomial = 0x1021;
+
+// Table[k][b] is the CRC of byte b followed by k null bytes, with a null
+// start value.
+struct Tables
+{
+	uint16_t table[8][256];
+
+	constexpr Tables (): table {}
+	{
+		for (unsigned int b = 0; b < 256; ++b) {
+			uint16_t crc = b << 8;
+			for (int i = 0; i < 8; ++i)
+				crc = (crc & 0x8000) ? (crc << 1) ^ Polynomial : crc << 1;
+			table[0][b] = crc;
+		}
+		for (unsigned int k = 1; k < 8; ++k)
+			for (unsigned int b = 0; b < 256; ++b)
+				table[k][b] = (table[k-1][b] << 8) ^ table[0][table[k-1][b] >> 8];
+	}
+};
+
+constexpr Tables tables;
+
+}
+
+uint16_t CRC::CCITT (const uint8_t *data, std::size_t length,
 		     uint16_t start_value)
 {
+	const auto &t = tables.table;
 	uint16_t crc = start_value;
 
-	for (auto it = begin; it != end; ++it) {
-		uint16_t temp = (crc >> 8) ^ *it;
-		crc <<= 8;
-		uint16_t quick = temp ^ (temp >> 4);
-		crc ^= quick;
-		quick <<= 5;
-		crc ^= quick;
-		quick <<= 7;
-		crc ^= quick;
+	for (; length >= 8; data += 8, length -= 8) {
+		crc = t[7][data[0] ^ (crc >> 8)] ^ t[6][data[1] ^ (crc & 0xFF)] ^
+		      t[5][data[2]] ^ t[4][data[3]] ^
+		      t[3][data[4]] ^ t[2][data[5]] ^
+		      t[1][data[6]] ^ t[0][data[7]];
 	}
+	for (; length > 0; ++data, --length)
+		crc = (crc << 8) ^ t[0][(crc >> 8) ^ *data];
 
 	return crc;
 }
 
+uint16_t CRC::CCITT (std::vector<uint8_t>::const_iterator begin,
+		     std::vector<uint8_t>::const_iterator end,
+		     uint16_t start_value)
+{
+	if (begin == end)
+		return start_value;
+	return CCITT (&*begin, end - begin, start_value);
+}
+
+uint16_t CRC::CCITTShift (uint16_t crc, std::size_t length)
+{
+	const auto &t = tables.table;
+	for (; length >= 8; length -= 8)
+		crc = t[7][crc >> 8] ^ t[6][crc & 0xFF];
+	for (; length > 0; --length)
+		crc = (crc << 8) ^ t[0][crc >> 8];
+	return crc;
+}
+
+uint16_t CRC::CCITTCombine (uint16_t crc_a, uint16_t crc_b, std::size_t length_b)
+{
+	return CCITTShift (crc_a, length_b) ^ crc_b;
+}
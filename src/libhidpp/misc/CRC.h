@@ -19,16 +19,40 @@
 #ifndef LIBHIDPP_CRC_H
 #define LIBHIDPP_CRC_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 namespace CRC
 {
 
+/**
+ * CRC-16-CCITT (polynomial 0x1021, not reflected) of \p length bytes
+ * at \p data.
+ *
+ * Bytes are processed eight at a time with lookup tables.
+ */
+uint16_t CCITT (const uint8_t *data, std::size_t length,
+		uint16_t start_value = 0xFFFF);
+
 uint16_t CCITT (std::vector<uint8_t>::const_iterator begin,
 		std::vector<uint8_t>::const_iterator end,
 		uint16_t start_value = 0xFFFF);
 
+/**
+ * CRC-16-CCITT of \p crc followed by \p length null bytes, i.e. the CRC
+ * of a message after \p length null bytes are appended to it.
+ */
+uint16_t CCITTShift (uint16_t crc, std::size_t length);
+
+/**
+ * Combine the CRC \p crc_a of a message A with the CRC \p crc_b of a
+ * message B of \p length_b bytes, computed with a null start value.
+ *
+ * \returns the CRC of A followed by B.
+ */
+uint16_t CCITTCombine (uint16_t crc_a, uint16_t crc_b, std::size_t length_b);
+
 }
 
 #endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_MISC_CACHE_COUNTER_H
+#define LIBHIDPP_MISC_CACHE_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Hit and miss counts of a cache lookup.
+ *
+ * Counting is lock-free so that lookups on hot paths are not slowed
+ * down, and monitoring (e.g. HIDPP::MetricsExporter) can read the
+ * counts without locking the cache.
+ */
+class CacheCounter
+{
+public:
+	struct Snapshot
+	{
+		uint64_t hits = 0, misses = 0;
+
+		/**
+		 * Ratio of hits among lookups, 0 without any lookup.
+		 */
+		double hitRatio () const noexcept
+		{
+			auto total = hits + misses;
+			return total == 0 ? 0.0 : static_cast<double> (hits) / total;
+		}
+	};
+
+	void count (bool hit) noexcept
+	{
+		(hit ? _hits : _misses).fetch_add (1, std::memory_order_relaxed);
+	}
+
+	Snapshot snapshot () const noexcept
+	{
+		Snapshot s;
+		s.hits = _hits.load (std::memory_order_relaxed);
+		s.misses = _misses.load (std::memory_order_relaxed);
+		return s;
+	}
+
+private:
+	std::atomic<uint64_t> _hits {0}, _misses {0};
+};
+
+#endif
@@ -19,7 +19,150 @@
 #ifndef LIBHIDPP_ENDIAN_H
 #define LIBHIDPP_ENDIAN_H
 
+#include <cstdint>
+#include <cstring>
 #include <tuple>
+#include <type_traits>
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && defined(__ORDER_BIG_ENDIAN__)
+#  if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#    define LIBHIDPP_HOST_LITTLE_ENDIAN
+#  elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#    define LIBHIDPP_HOST_BIG_ENDIAN
+#  endif
+#elif defined(_MSC_VER)
+#  include <cstdlib>
+#  define LIBHIDPP_HOST_LITTLE_ENDIAN
+#endif
+
+namespace EndianDetail
+{
+
+template<typename U>
+inline U byteSwap (U value)
+{
+	static_assert (std::is_unsigned<U>::value, "byteSwap needs an unsigned type");
+#if defined(__GNUC__) || defined(__clang__)
+	if constexpr (sizeof (U) == 2)
+		return __builtin_bswap16 (value);
+	else if constexpr (sizeof (U) == 4)
+		return __builtin_bswap32 (value);
+	else if constexpr (sizeof (U) == 8)
+		return __builtin_bswap64 (value);
+#elif defined(_MSC_VER)
+	if constexpr (sizeof (U) == 2)
+		return _byteswap_ushort (value);
+	else if constexpr (sizeof (U) == 4)
+		return _byteswap_ulong (value);
+	else if constexpr (sizeof (U) == 8)
+		return _byteswap_uint64 (value);
+#endif
+	U swapped = 0;
+	for (int i = 0; i < (int) sizeof (U); ++i)
+		swapped |= ((value >> (i*8)) & 0xFF) << ((sizeof (U)-1-i)*8);
+	return swapped;
+}
+
+// Native (one unaligned load or store plus a byte swap) when the host
+// byte order is known, otherwise byte by byte.
+template<typename T, bool Little>
+inline T load (const uint8_t *data)
+{
+	if constexpr (sizeof (T) == 1)
+		return static_cast<T> (*data);
+	else {
+		typedef typename std::make_unsigned<T>::type U;
+#if defined(LIBHIDPP_HOST_LITTLE_ENDIAN) || defined(LIBHIDPP_HOST_BIG_ENDIAN)
+		U value;
+		std::memcpy (&value, data, sizeof (U));
+#  if defined(LIBHIDPP_HOST_LITTLE_ENDIAN)
+		if constexpr (!Little)
+#  else
+		if constexpr (Little)
+#  endif
+			value = byteSwap (value);
+#else
+		U value = 0;
+		for (int i = 0; i < (int) sizeof (U); ++i)
+			value |= U (data[i]) << ((Little ? i : sizeof (U)-1-i)*8);
+#endif
+		return static_cast<T> (value);
+	}
+}
+
+template<typename T, bool Little>
+inline void store (uint8_t *data, T v)
+{
+	if constexpr (sizeof (T) == 1)
+		*data = static_cast<uint8_t> (v);
+	else {
+		typedef typename std::make_unsigned<T>::type U;
+		U value = static_cast<U> (v);
+#if defined(LIBHIDPP_HOST_LITTLE_ENDIAN) || defined(LIBHIDPP_HOST_BIG_ENDIAN)
+#  if defined(LIBHIDPP_HOST_LITTLE_ENDIAN)
+		if constexpr (!Little)
+#  else
+		if constexpr (Little)
+#  endif
+			value = byteSwap (value);
+		std::memcpy (data, &value, sizeof (U));
+#else
+		for (int i = 0; i < (int) sizeof (U); ++i)
+			data[i] = (value >> ((Little ? i : sizeof (U)-1-i)*8)) & 0xFF;
+#endif
+	}
+}
+
+}
+
+/*
+ * Byte pointer overloads, they are preferred over the generic iterator
+ * versions and compile to a single load or store.
+ */
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, T>::type
+readLE (const uint8_t *data)
+{
+	return EndianDetail::load<T, true> (data);
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, T>::type
+readLE (uint8_t *data)
+{
+	return EndianDetail::load<T, true> (data);
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, T>::type
+readBE (const uint8_t *data)
+{
+	return EndianDetail::load<T, false> (data);
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, T>::type
+readBE (uint8_t *data)
+{
+	return EndianDetail::load<T, false> (data);
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, uint8_t *>::type
+writeLE (uint8_t *data, T value)
+{
+	EndianDetail::store<T, true> (data, value);
+	return data + sizeof (T);
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, uint8_t *>::type
+writeBE (uint8_t *data, T value)
+{
+	EndianDetail::store<T, false> (data, value);
+	return data + sizeof (T);
+}
 
 template<typename T, typename InputIt>
 typename std::enable_if<std::is_integral<T>::value, InputIt>::type
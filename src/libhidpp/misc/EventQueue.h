@@ -19,6 +19,8 @@
 #ifndef LIBHIDPP_HIDPP_EVENT_QUEUE_H
 #define LIBHIDPP_HIDPP_EVENT_QUEUE_H
 
+#include <misc/MemoryAccounting.h>
+
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -26,13 +28,16 @@
 
 /**
  * Queue for transfering events across different thread.
+ *
+ * \see BoundedEventQueue for a queue with bounded memory.
  */
 template<typename T>
 class EventQueue
 {
 public:
 	EventQueue ():
-		_interrupted (false)
+		_interrupted (false),
+		_account (MemoryAccounting::Subsystem::EventQueues)
 	{
 	}
 
@@ -47,6 +52,7 @@ public:
 	{
 		std::unique_lock<std::mutex> lock (_mutex);
 		_queue.push (event);
+		updateAccount ();
 		lock.unlock ();
 		_condvar.notify_one ();
 	}
@@ -68,6 +74,7 @@ public:
 		if (!_interrupted) {
 			ret = std::move (_queue.front ());
 			_queue.pop ();
+			updateAccount ();
 		}
 		return ret;
 	}
@@ -84,6 +91,7 @@ public:
 		if(!_queue.empty ()) {
 			ret = std::move (_queue.front ());
 			_queue.pop ();
+			updateAccount ();
 		}
 		return ret;
 	}
@@ -96,7 +104,9 @@ public:
 	 */
 	void interrupt ()
 	{
+		std::unique_lock<std::mutex> lock (_mutex);
 		_interrupted = true;
+		lock.unlock ();
 		_condvar.notify_all ();
 	}
 
@@ -107,14 +117,22 @@ public:
 	 */
 	void resetInterruption ()
 	{
+		std::unique_lock<std::mutex> lock (_mutex);
 		_interrupted = false;
 	}
 
 private:
+	void updateAccount () // _mutex must be held
+	{
+		if (MemoryAccounting::enabled ())
+			_account.set (_queue.size () * sizeof (T));
+	}
+
 	std::mutex _mutex;
 	std::condition_variable _condvar;
 	std::queue<T> _queue;
 	bool _interrupted;
+	MemoryAccounting::Account _account;
 };
 
 #endif
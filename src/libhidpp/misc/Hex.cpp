@@ -0,0 +1,125 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <misc/Hex.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+namespace
+{
+
+// Table.digits[b] is the two hexadecimal digits of byte b.
+struct Table
+{
+	char digits[256][2];
+
+	constexpr Table (): digits {}
+	{
+		constexpr char hex[] = "0123456789abcdef";
+		for (unsigned int b = 0; b < 256; ++b) {
+			digits[b][0] = hex[b >> 4];
+			digits[b][1] = hex[b & 0x0f];
+		}
+	}
+};
+
+constexpr Table table;
+
+#ifdef __SSSE3__
+// Shuffle masks spreading the 32 digits of 16 bytes (as two vectors of 16
+// digits) over the 48 characters of the separated output. Indices with the
+// high bit set give null bytes, where spaces are added.
+struct Masks
+{
+	int8_t low[3][16], high[3][16], spaces[3][16];
+
+	constexpr Masks (): low {}, high {}, spaces {}
+	{
+		for (unsigned int p = 0; p < 48; ++p) {
+			unsigned int chunk = p / 16, j = p % 16;
+			low[chunk][j] = high[chunk][j] = -128;
+			if (p % 3 == 0) {
+				spaces[chunk][j] = ' ';
+				continue;
+			}
+			unsigned int digit = 2*(p/3) + (p%3 - 1);
+			if (digit < 16)
+				low[chunk][j] = digit;
+			else
+				high[chunk][j] = digit - 16;
+		}
+	}
+};
+
+constexpr Masks masks;
+
+inline __m128i load (const int8_t *p)
+{
+	return _mm_loadu_si128 (reinterpret_cast<const __m128i *> (p));
+}
+
+// Digits of 16 bytes, bytes 0-7 in low and 8-15 in high.
+inline void digits (const uint8_t *data, __m128i &low, __m128i &high)
+{
+	const __m128i hex = _mm_setr_epi8 ('0', '1', '2', '3', '4', '5', '6', '7',
+					   '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m128i nibble = _mm_set1_epi8 (0x0f);
+	__m128i bytes = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (data));
+	__m128i hi = _mm_shuffle_epi8 (hex, _mm_and_si128 (_mm_srli_epi16 (bytes, 4), nibble));
+	__m128i lo = _mm_shuffle_epi8 (hex, _mm_and_si128 (bytes, nibble));
+	low = _mm_unpacklo_epi8 (hi, lo);
+	high = _mm_unpackhi_epi8 (hi, lo);
+}
+#endif
+
+}
+
+char *Hex::encode (const uint8_t *data, std::size_t length, char *out, bool separated)
+{
+	const uint8_t *end = data + length;
+#ifdef __SSSE3__
+	for (; end - data >= 16; data += 16) {
+		__m128i low, high;
+		digits (data, low, high);
+		if (separated) {
+			for (unsigned int i = 0; i < 3; ++i) {
+				__m128i chunk = _mm_or_si128 (
+					_mm_or_si128 (_mm_shuffle_epi8 (low, load (masks.low[i])),
+						      _mm_shuffle_epi8 (high, load (masks.high[i]))),
+					load (masks.spaces[i]));
+				_mm_storeu_si128 (reinterpret_cast<__m128i *> (out), chunk);
+				out += 16;
+			}
+		}
+		else {
+			_mm_storeu_si128 (reinterpret_cast<__m128i *> (out), low);
+			_mm_storeu_si128 (reinterpret_cast<__m128i *> (out+16), high);
+			out += 32;
+		}
+	}
+#endif
+	for (; data != end; ++data) {
+		if (separated)
+			*out++ = ' ';
+		*out++ = table.digits[*data][0];
+		*out++ = table.digits[*data][1];
+	}
+	return out;
+}
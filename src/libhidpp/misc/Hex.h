@@ -0,0 +1,50 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_HEX_H
+#define LIBHIDPP_HEX_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Hex
+{
+
+/**
+ * Size of the text written by encode for \p length bytes.
+ */
+constexpr std::size_t encodedLength (std::size_t length, bool separated = true)
+{
+	return length * (separated ? 3 : 2);
+}
+
+/**
+ * Write \p length bytes at \p data as lower case hexadecimal in \p out.
+ *
+ * If \p separated is true, every byte is preceded by a space (" 0a 1b").
+ * The output is not null-terminated.
+ *
+ * Uses SSSE3 shuffles when available, and a lookup table otherwise.
+ *
+ * \returns the end of the written text.
+ */
+char *encode (const uint8_t *data, std::size_t length, char *out, bool separated = true);
+
+}
+
+#endif
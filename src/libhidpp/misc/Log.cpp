@@ -22,6 +22,26 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Every handle, so that they can be updated when categories change.
+// Function-local so that handles can be constructed during static
+// initialization.
+static std::mutex &handlesMutex ()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+static std::vector<Log::Handle *> &handles ()
+{
+	static std::vector<Log::Handle *> handles;
+	return handles;
+}
 
 Log::Category::Category (const char *tag, bool enabled_by_default):
 	_enabled (enabled_by_default),
@@ -32,11 +52,13 @@ Log::Category::Category (const char *tag, bool enabled_by_default):
 void Log::Category::enable (bool enabled)
 {
 	_enabled = enabled;
+	Handle::invalidate (this);
 }
 
 void Log::Category::enable (const std::string &sub, bool enabled)
 {
 	_sub_categories[sub] = enabled;
+	Handle::invalidate (this);
 }
 
 bool Log::Category::isEnabled (const std::string &sub) const
@@ -56,6 +78,334 @@ std::string Log::Category::tag (const std::string &sub) const
 	return _tag;
 }
 
+Log::Handle::Handle (const Category &category, const char *sub):
+	_category (&category),
+	_sub (sub),
+	_state (Unknown)
+{
+	std::unique_lock<std::mutex> lock (handlesMutex ());
+	handles ().push_back (this);
+}
+
+Log::Handle::~Handle ()
+{
+	std::unique_lock<std::mutex> lock (handlesMutex ());
+	auto &list = handles ();
+	list.erase (std::remove (list.begin (), list.end (), this), list.end ());
+}
+
+Log Log::Handle::log () const
+{
+	Log log = Log::log (_category, _sub);
+	if (log) {
+		log._category = _category;
+		log._sub = _sub;
+	}
+	return log;
+}
+
+bool Log::Handle::update () const
+{
+	bool enabled = _sub ? _category->isEnabled (_sub) : _category->isEnabled ();
+	_state.store (enabled ? Enabled : Disabled, std::memory_order_relaxed);
+	return enabled;
+}
+
+void Log::Handle::invalidate (const Category *category)
+{
+	std::unique_lock<std::mutex> lock (handlesMutex ());
+	for (auto handle: handles ())
+		if (handle->_category == category)
+			handle->_state.store (Unknown, std::memory_order_relaxed);
+}
+
+namespace
+{
+
+/**
+ * Message copied in a thread ring.
+ *
+ * Text messages store the log prefix followed by the text, long texts are
+ * split in several records. Bytes messages store the printBytes prefix
+ * followed by the raw bytes, the tag is built from the category by the
+ * background thread.
+ */
+struct Record
+{
+	enum Kind: uint8_t {
+		Text,
+		Bytes,
+	};
+	static constexpr std::size_t DataSize = 224;
+
+	std::chrono::steady_clock::time_point time;
+	const Log::Category *category;
+	const char *sub;
+	Kind kind;
+	bool continued; // the next record of the ring continues this one
+	uint16_t prefix_length;
+	uint16_t length;
+	char data[DataSize];
+};
+
+/**
+ * Single producer single consumer ring owned by one logging thread.
+ */
+class Ring
+{
+public:
+	Ring (std::size_t size):
+		_records (size),
+		_head (0), _tail (0),
+		_dropped (0)
+	{
+	}
+
+	/**
+	 * Get the record \p index after the last committed one, returns
+	 * nullptr if the ring is full.
+	 */
+	Record *reserve (std::size_t index)
+	{
+		std::size_t tail = _tail.load (std::memory_order_relaxed);
+		if (tail + index - _head.load (std::memory_order_acquire) >= _records.size ())
+			return nullptr;
+		return &_records[(tail + index) % _records.size ()];
+	}
+
+	void commit (std::size_t count)
+	{
+		_tail.store (_tail.load (std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+	void drop ()
+	{
+		_dropped.fetch_add (1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Consumer side: pop every record committed until now.
+	 */
+	template <typename Function>
+	void drain (Function f)
+	{
+		std::size_t head = _head.load (std::memory_order_relaxed);
+		std::size_t tail = _tail.load (std::memory_order_acquire);
+		for (; head != tail; ++head)
+			f (_records[head % _records.size ()]);
+		_head.store (head, std::memory_order_release);
+	}
+
+	unsigned long takeDropped ()
+	{
+		return _dropped.exchange (0, std::memory_order_relaxed);
+	}
+
+	bool empty () const
+	{
+		return _head.load (std::memory_order_relaxed) == _tail.load (std::memory_order_acquire);
+	}
+
+private:
+	std::vector<Record> _records;
+	std::atomic<std::size_t> _head, _tail;
+	std::atomic<unsigned long> _dropped;
+};
+
+class AsyncBackend
+{
+public:
+	static AsyncBackend &instance ()
+	{
+		// Never destroyed, threads may still log during exit
+		static AsyncBackend *backend = new AsyncBackend;
+		return *backend;
+	}
+
+	bool running () const
+	{
+		return _running.load (std::memory_order_acquire);
+	}
+
+	void start (std::size_t ring_size)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (_running.load (std::memory_order_relaxed))
+			return;
+		_ring_size = ring_size;
+		_stopping = false;
+		_thread = std::thread (&AsyncBackend::run, this);
+		_running.store (true, std::memory_order_release);
+	}
+
+	void stop ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		if (!_running.load (std::memory_order_relaxed))
+			return;
+		_running.store (false, std::memory_order_release);
+		_stopping = true;
+		_cond.notify_one ();
+		lock.unlock ();
+		_thread.join ();
+	}
+
+	void writeText (const std::string &prefix, const std::string &text)
+	{
+		Ring &ring = threadRing ();
+		auto time = std::chrono::steady_clock::now ();
+		std::size_t count = (prefix.size () + text.size () + Record::DataSize - 1) / Record::DataSize;
+		if (text.empty ())
+			return;
+		if (!ring.reserve (count-1)) {
+			ring.drop ();
+			return;
+		}
+		std::size_t prefix_done = 0, text_done = 0;
+		for (std::size_t i = 0; i < count; ++i) {
+			Record *record = ring.reserve (i);
+			record->time = time;
+			record->category = nullptr;
+			record->sub = nullptr;
+			record->kind = Record::Text;
+			record->continued = i+1 < count;
+			std::size_t prefix_length = std::min (prefix.size () - prefix_done, Record::DataSize);
+			std::copy_n (prefix.data () + prefix_done, prefix_length, record->data);
+			prefix_done += prefix_length;
+			std::size_t text_length = std::min (text.size () - text_done, Record::DataSize - prefix_length);
+			std::copy_n (text.data () + text_done, text_length, record->data + prefix_length);
+			text_done += text_length;
+			record->prefix_length = prefix_length;
+			record->length = prefix_length + text_length;
+		}
+		ring.commit (count);
+	}
+
+	bool writeBytes (const Log::Category *category, const char *sub,
+			 const std::string &prefix, const uint8_t *bytes, std::size_t length)
+	{
+		if (prefix.size () + length > Record::DataSize)
+			return false;
+		Ring &ring = threadRing ();
+		Record *record = ring.reserve (0);
+		if (!record) {
+			ring.drop ();
+			return true;
+		}
+		record->time = std::chrono::steady_clock::now ();
+		record->category = category;
+		record->sub = sub;
+		record->kind = Record::Bytes;
+		record->continued = false;
+		record->prefix_length = prefix.size ();
+		record->length = prefix.size () + length;
+		std::copy (prefix.begin (), prefix.end (), record->data);
+		std::copy_n (bytes, length, record->data + prefix.size ());
+		ring.commit (1);
+		return true;
+	}
+
+private:
+	AsyncBackend ():
+		_running (false),
+		_ring_size (0),
+		_stopping (false)
+	{
+	}
+
+	Ring &threadRing ()
+	{
+		thread_local std::shared_ptr<Ring> ring;
+		if (!ring) {
+			std::unique_lock<std::mutex> lock (_mutex);
+			ring = std::make_shared<Ring> (_ring_size);
+			_rings.push_back (ring);
+		}
+		return *ring;
+	}
+
+	void run ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		bool stopping;
+		do {
+			// Polling keeps the logging threads free of any lock or
+			// system call.
+			_cond.wait_for (lock, std::chrono::milliseconds (10), [this] () { return _stopping; });
+			stopping = _stopping;
+			auto rings = _rings;
+			// Forget the rings of finished threads once they are empty
+			_rings.erase (std::remove_if (_rings.begin (), _rings.end (), [] (const auto &ring) {
+					return ring.use_count () == 2 && ring->empty ();
+				}), _rings.end ());
+			lock.unlock ();
+			write (rings);
+			lock.lock ();
+		} while (!stopping);
+	}
+
+	struct Message
+	{
+		std::chrono::steady_clock::time_point time;
+		std::string text;
+	};
+
+	void write (const std::vector<std::shared_ptr<Ring>> &rings)
+	{
+		std::vector<Message> messages;
+		unsigned long dropped = 0;
+		for (const auto &ring: rings) {
+			bool continuing = false;
+			ring->drain ([&] (const Record &record) {
+				if (!continuing)
+					messages.push_back ({ record.time, format (record) });
+				else
+					messages.back ().text.append (record.data, record.length);
+				continuing = record.continued;
+			});
+			dropped += ring->takeDropped ();
+		}
+		std::stable_sort (messages.begin (), messages.end (), [] (const auto &a, const auto &b) {
+			return a.time < b.time;
+		});
+		// Synchronous messages are not written while the backend runs
+		for (const auto &message: messages)
+			std::cerr << message.text;
+		if (dropped > 0)
+			std::cerr << "[log] " << dropped << " messages dropped" << std::endl;
+	}
+
+	static std::string format (const Record &record)
+	{
+		std::string text = "[";
+		if (record.kind == Record::Text) {
+			text.append (record.data, record.prefix_length);
+			text += "] ";
+			text.append (record.data + record.prefix_length, record.length - record.prefix_length);
+			return text;
+		}
+		text += record.sub ? record.category->tag (record.sub) : record.category->tag ();
+		text += "] ";
+		text.append (record.data, record.prefix_length);
+		char hex[Hex::encodedLength (Record::DataSize)];
+		auto end = Hex::encode (reinterpret_cast<const uint8_t *> (record.data + record.prefix_length),
+					record.length - record.prefix_length, hex);
+		text.append (hex, end);
+		text += '\n';
+		return text;
+	}
+
+	std::atomic<bool> _running;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::thread _thread;
+	std::vector<std::shared_ptr<Ring>> _rings;
+	std::size_t _ring_size;
+	bool _stopping;
+};
+
+}
+
 Log::Category Log::Error ("error", true);
 Log::Category Log::Warning ("warning");
 Log::Category Log::Info ("info");
@@ -65,18 +415,24 @@ std::mutex Log::_mutex;
 
 Log::Log ():
 	std::ostream (nullptr),
+	_category (nullptr),
+	_sub (nullptr),
 	_buf ("null")
 {
 }
 
 Log::Log (const std::string &prefix):
 	std::ostream (&_buf),
+	_category (nullptr),
+	_sub (nullptr),
 	_buf (prefix)
 {
 }
 
 Log::Log (Log &&log):
 	std::ostream (std::move (log)),
+	_category (log._category),
+	_sub (log._sub),
 	_buf (std::move (log._buf))
 {
 }
@@ -114,7 +470,13 @@ void Log::init (const char *setting_string)
 		}
 		std::string tag (current, sub);
 		auto it = categories_by_tag.find (tag);
-		if (it == categories_by_tag.end ())
+		if (tag == "async" && sub == next) {
+			if (enabling)
+				startAsync ();
+			else
+				stopAsync ();
+		}
+		else if (it == categories_by_tag.end ())
 			std::cerr << "Invalid log category tag: " << tag << std::endl;
 		else {
 			if (sub != next)
@@ -137,6 +499,26 @@ Log Log::log (const Category *category, const char *sub)
 	return Log ();
 }
 
+void Log::startAsync (std::size_t ring_size)
+{
+	static std::once_flag at_exit;
+	std::call_once (at_exit, [] () { atexit (&Log::stopAsync); });
+	AsyncBackend::instance ().start (ring_size);
+}
+
+void Log::stopAsync ()
+{
+	AsyncBackend::instance ().stop ();
+}
+
+bool Log::writeBytesAsync (const std::string &prefix, const uint8_t *bytes, std::size_t length)
+{
+	auto &backend = AsyncBackend::instance ();
+	if (!backend.running ())
+		return false;
+	return backend.writeBytes (_category, _sub, prefix, bytes, length);
+}
+
 void Log::printf (const char *format, ...)
 {
 	char *str, *current, *end;
@@ -168,6 +550,12 @@ Log::LogBuf::LogBuf (const std::string &prefix):
 
 int Log::LogBuf::sync ()
 {
+	auto &backend = AsyncBackend::instance ();
+	if (backend.running ()) {
+		backend.writeText (_prefix, str ());
+		str (std::string ());
+		return 0;
+	}
 	std::unique_lock<std::mutex> lock (_mutex);
 	std::cerr << "[" << _prefix << "] " << str ();
 	str (std::string ());
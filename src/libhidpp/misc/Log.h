@@ -24,8 +24,21 @@
 #include <iomanip>
 #include <map>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 
+#include <misc/Hex.h>
+
+/*
+ * Messages below this level are removed at compile time when logged through
+ * the LIBHIDPP_LOG_* macros: 0 keeps every message, 1 removes debug messages, 2 also
+ * removes info messages, 3 also removes warnings.
+ */
+#ifndef LIBHIDPP_LOG_MIN_LEVEL
+#define LIBHIDPP_LOG_MIN_LEVEL 0
+#endif
+
 class Log: public std::ostream
 {
 public:
@@ -68,6 +81,70 @@ public:
 	};
 	static Category Error, Warning, Info, Debug;
 
+	enum Level {
+		DebugLevel,
+		InfoLevel,
+		WarningLevel,
+		ErrorLevel,
+	};
+
+	/**
+	 * Precomputed state of a category (and optionally a subcategory) for
+	 * logging from hot paths.
+	 *
+	 * Checking the handle is a single relaxed atomic load, the category
+	 * map is only looked up again after the category settings changed.
+	 * Handles are meant to be static objects, they are usually used
+	 * through the LIBHIDPP_LOG_* macros:
+	 * \code
+	 * static Log::Handle ReportLog (Log::Debug, "report");
+	 * LIBHIDPP_LOG_DEBUG (ReportLog).printBytes ("Recv HID report:", begin, end);
+	 * \endcode
+	 */
+	class Handle
+	{
+	public:
+		/**
+		 * \param category	Category of the messages, it may not be
+		 *			constructed yet.
+		 * \param sub		Optional subcategory, it must outlive
+		 *			the handle.
+		 */
+		Handle (const Category &category, const char *sub = nullptr);
+		Handle (const Handle &) = delete;
+		~Handle ();
+
+		/**
+		 * Check if the category (and subcategory) is enabled.
+		 */
+		inline bool isEnabled () const {
+			int state = _state.load (std::memory_order_relaxed);
+			if (state != Unknown)
+				return state == Enabled;
+			return update ();
+		}
+
+		/**
+		 * Get a log object for this category (and subcategory).
+		 */
+		Log log () const;
+
+	private:
+		enum State: int {
+			Unknown = -1,
+			Disabled = 0,
+			Enabled = 1,
+		};
+		bool update () const;
+		static void invalidate (const Category *category);
+
+		const Category *_category;
+		const char *_sub;
+		mutable std::atomic<int> _state;
+
+		friend class Category;
+	};
+
 	/**
 	 * Initialize categories and subcategories states from parameter string
 	 * or environment variable.
@@ -89,8 +166,30 @@ public:
 	 *
 	 * Only the default categories "error", "warning", "info" and "debug"
 	 * are initialized.
+	 *
+	 * The special setting "async" starts the asynchronous backend (see
+	 * startAsync).
 	 */
 	static void init (const char *setting_string = nullptr);
+
+	/**
+	 * Start the asynchronous backend.
+	 *
+	 * Messages are then copied in per-thread lock-free rings and written
+	 * by a background thread, in timestamp order. Bytes printed with
+	 * printBytes from a Handle are only formatted by the background
+	 * thread. When a ring is full, messages are dropped and counted
+	 * instead of blocking the logging thread.
+	 *
+	 * The backend is stopped at exit.
+	 *
+	 * \param ring_size	Number of messages in each thread ring.
+	 */
+	static void startAsync (std::size_t ring_size = 1024);
+	/**
+	 * Write the pending messages and stop the asynchronous backend.
+	 */
+	static void stopAsync ();
 	/**
 	 * Get a log object for the corresponding category (and subcategory).
 	 */
@@ -112,14 +211,26 @@ public:
 			 InputIterator begin, InputIterator end) {
 		if (!*this)
 			return;
+		if (_category) {
+			// Let the asynchronous backend format the bytes
+			uint8_t bytes[AsyncBytesMax];
+			std::size_t length = 0;
+			auto it = begin;
+			for (; it != end && length < AsyncBytesMax; ++it)
+				bytes[length++] = *it;
+			if (it == end && writeBytesAsync (prefix, bytes, length))
+				return;
+		}
 		*this << prefix;
-		for (auto it = begin; it != end; ++it) {
-			uint8_t byte = *it;
-			*this << " "
-			      << std::hex
-			      << std::setw (2)
-			      << std::setfill ('0')
-			      << static_cast<unsigned int> (byte);
+		// Encode the bytes by chunks in a stack buffer
+		uint8_t bytes[AsyncBytesMax];
+		char text[Hex::encodedLength (AsyncBytesMax)];
+		auto it = begin;
+		while (it != end) {
+			std::size_t length = 0;
+			for (; it != end && length < AsyncBytesMax; ++it)
+				bytes[length++] = *it;
+			write (text, Hex::encode (bytes, length, text) - text);
 		}
 		*this << std::endl;
 	}
@@ -128,6 +239,13 @@ private:
 	Log ();
 	Log (const std::string &prefix);
 
+	static constexpr std::size_t AsyncBytesMax = 64;
+	bool writeBytesAsync (const std::string &prefix, const uint8_t *bytes, std::size_t length);
+
+	// Only set for logs from a Handle
+	const Category *_category;
+	const char *_sub;
+
 	class LogBuf: public std::stringbuf {
 	public:
 		LogBuf (const std::string &prefix);
@@ -140,4 +258,17 @@ private:
 	static std::mutex _mutex;
 };
 
+/*
+ * Log through a Log::Handle. The rest of the statement (including the
+ * evaluation of the arguments) is skipped when the handle is disabled or
+ * when the level is removed at compile time.
+ */
+#define LIBHIDPP_LOG(level, handle) \
+	if ((level) < LIBHIDPP_LOG_MIN_LEVEL || !(handle).isEnabled ()) {} \
+	else (handle).log ()
+#define LIBHIDPP_LOG_DEBUG(handle) LIBHIDPP_LOG (Log::DebugLevel, handle)
+#define LIBHIDPP_LOG_INFO(handle) LIBHIDPP_LOG (Log::InfoLevel, handle)
+#define LIBHIDPP_LOG_WARNING(handle) LIBHIDPP_LOG (Log::WarningLevel, handle)
+#define LIBHIDPP_LOG_ERROR(handle) LIBHIDPP_LOG (Log::ErrorLevel, handle)
+
 #endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MemoryAccounting.h"
+
+#include <cstdlib>
+
+using namespace MemoryAccounting;
+
+std::atomic<bool> MemoryAccounting::_enabled (false);
+
+namespace
+{
+
+struct Counters
+{
+	std::atomic<int64_t> bytes {0}, objects {0}, peak_bytes {0};
+};
+
+std::array<Counters, SubsystemCount> &counters ()
+{
+	// Constructed on first use: objects may be released after the
+	// other static objects are destroyed.
+	static auto *counters = new std::array<Counters, SubsystemCount> ();
+	return *counters;
+}
+
+}
+
+const char *MemoryAccounting::name (Subsystem subsystem)
+{
+	switch (subsystem) {
+	case Subsystem::MemoryMappings:
+		return "memory mappings";
+	case Subsystem::Listeners:
+		return "listeners";
+	case Subsystem::Commands:
+		return "commands";
+	case Subsystem::EventQueues:
+		return "event queues";
+	case Subsystem::Settings:
+		return "settings";
+	case Subsystem::ReportDescriptors:
+		return "report descriptors";
+	}
+	return "unknown";
+}
+
+int64_t Snapshot::totalBytes () const
+{
+	int64_t total = 0;
+	for (const auto &usage: subsystems)
+		total += usage.bytes;
+	return total;
+}
+
+void Snapshot::print (std::ostream &out) const
+{
+	for (std::size_t i = 0; i < SubsystemCount; ++i) {
+		const auto &usage = subsystems[i];
+		out << name (static_cast<Subsystem> (i)) << ": "
+		    << usage.bytes << " bytes in " << usage.objects << " objects"
+		    << " (peak " << usage.peak_bytes << " bytes)" << std::endl;
+	}
+	out << "total: " << totalBytes () << " bytes" << std::endl;
+}
+
+void MemoryAccounting::init ()
+{
+	if (const char *value = getenv ("HIDPP_MEMORY_ACCOUNTING"))
+		setEnabled (*value != '\0' && *value != '0');
+}
+
+void MemoryAccounting::setEnabled (bool enabled)
+{
+	_enabled.store (enabled, std::memory_order_relaxed);
+}
+
+Snapshot MemoryAccounting::snapshot ()
+{
+	Snapshot snapshot;
+	for (std::size_t i = 0; i < SubsystemCount; ++i) {
+		auto &c = counters ()[i];
+		snapshot.subsystems[i] = {
+			c.bytes.load (std::memory_order_relaxed),
+			c.objects.load (std::memory_order_relaxed),
+			c.peak_bytes.load (std::memory_order_relaxed),
+		};
+	}
+	return snapshot;
+}
+
+void MemoryAccounting::resetPeaks ()
+{
+	for (auto &c: counters ())
+		c.peak_bytes.store (c.bytes.load (std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void MemoryAccounting::charge (Subsystem subsystem, int64_t bytes, int64_t objects) noexcept
+{
+	auto &c = counters ()[static_cast<std::size_t> (subsystem)];
+	int64_t total = c.bytes.fetch_add (bytes, std::memory_order_relaxed) + bytes;
+	if (objects)
+		c.objects.fetch_add (objects, std::memory_order_relaxed);
+	int64_t peak = c.peak_bytes.load (std::memory_order_relaxed);
+	while (total > peak && !c.peak_bytes.compare_exchange_weak (peak, total, std::memory_order_relaxed))
+		;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_MEMORY_ACCOUNTING_H
+#define LIBHIDPP_MEMORY_ACCOUNTING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Optional accounting of the memory held by the main libhidpp
+ * containers, by subsystem.
+ *
+ * Holders compute their size (approximately, from container
+ * capacities) when it changes and charge it to their subsystem. This
+ * costs nothing but a flag check while accounting is disabled. Objects
+ * are charged when they change after accounting is enabled and release
+ * exactly what they were charged, so the totals stay consistent when
+ * enabling or disabling it at any time.
+ *
+ * Per-object sizes are also available without accounting, e.g.
+ * HIDPP::Dispatcher::Statistics::memory or
+ * HIDPP::AbstractMemoryMapping::memoryUsage.
+ */
+namespace MemoryAccounting
+{
+
+enum class Subsystem
+{
+	MemoryMappings,		///< HIDPP::AbstractMemoryMapping pages and snapshots
+	Listeners,		///< HIDPP::Dispatcher event listener tables
+	Commands,		///< HIDPP::DispatcherThread command slots and queues
+	EventQueues,		///< Reports waiting in EventQueue
+	Settings,		///< HIDPP::Setting heap values and HIDPP::SettingMap tables
+	ReportDescriptors,	///< Raw report descriptors interned by HID::ReportDescriptor
+};
+static constexpr std::size_t SubsystemCount = 6;
+
+const char *name (Subsystem subsystem);
+
+struct Usage
+{
+	int64_t bytes = 0;
+	int64_t objects = 0; ///< Charged holders (e.g. dispatchers for listeners)
+	int64_t peak_bytes = 0;
+};
+
+struct Snapshot
+{
+	std::array<Usage, SubsystemCount> subsystems;
+
+	const Usage &operator[] (Subsystem subsystem) const
+	{
+		return subsystems[static_cast<std::size_t> (subsystem)];
+	}
+	int64_t totalBytes () const;
+
+	/**
+	 * Write one line per subsystem.
+	 */
+	void print (std::ostream &out) const;
+};
+
+/**
+ * Approximate size of the header of std::map or std::list nodes, added
+ * to the value size of each element.
+ */
+static constexpr std::size_t NodeOverhead = 4 * sizeof (void *);
+
+extern std::atomic<bool> _enabled;
+
+inline bool enabled ()
+{
+	return _enabled.load (std::memory_order_relaxed);
+}
+
+/**
+ * Enable accounting if the HIDPP_MEMORY_ACCOUNTING environment variable
+ * is set.
+ */
+void init ();
+void setEnabled (bool enabled);
+
+/**
+ * Current usage of every subsystem.
+ */
+Snapshot snapshot ();
+/**
+ * Reset the peaks to the current usage.
+ */
+void resetPeaks ();
+
+/**
+ * Add to the counters of \p subsystem, negative values release memory.
+ */
+void charge (Subsystem subsystem, int64_t bytes, int64_t objects) noexcept;
+
+/**
+ * Memory charged by a holder object.
+ *
+ * Copies are charged like the original, moves are not handled: the
+ * owner must set the size of both objects again.
+ */
+class Account
+{
+public:
+	Account (Subsystem subsystem) noexcept:
+		_subsystem (subsystem),
+		_bytes (0),
+		_charged (false)
+	{
+	}
+
+	Account (const Account &other) noexcept:
+		Account (other._subsystem)
+	{
+		if (other._charged)
+			set (other._bytes);
+	}
+
+	Account &operator= (const Account &other) noexcept
+	{
+		if (this != &other && other._charged)
+			set (other._bytes);
+		return *this;
+	}
+
+	~Account ()
+	{
+		release ();
+	}
+
+	/**
+	 * Charge \p bytes instead of the current charge, if accounting is
+	 * enabled.
+	 */
+	void set (std::size_t bytes) noexcept
+	{
+		if (!enabled ())
+			return;
+		charge (_subsystem, int64_t (bytes) - int64_t (_bytes), _charged ? 0 : 1);
+		_bytes = bytes;
+		_charged = true;
+	}
+
+	/**
+	 * Release the charge, even if accounting is disabled.
+	 */
+	void release () noexcept
+	{
+		if (_charged) {
+			charge (_subsystem, -int64_t (_bytes), -1);
+			_bytes = 0;
+			_charged = false;
+		}
+	}
+
+private:
+	Subsystem _subsystem;
+	std::size_t _bytes;
+	bool _charged;
+};
+
+}
+
+#endif
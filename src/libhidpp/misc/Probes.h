@@ -0,0 +1,73 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_PROBES_H
+#define LIBHIDPP_PROBES_H
+
+/*
+ * Static tracepoints (USDT) of provider "libhidpp", for tracing with
+ * eBPF (bpftrace, bcc) or SystemTap without logging, e.g.:
+ *
+ *     bpftrace -e 'usdt:./libhidpp.so:libhidpp:command_matched { @[arg1] = count (); }'
+ *
+ * They are only built with the LIBHIDPP_USDT option (which needs
+ * <sys/sdt.h> from SystemTap), otherwise LIBHIDPP_PROBE expands to
+ * nothing and its arguments are not evaluated. An enabled probe is a
+ * single nop until a tracer attaches to it.
+ *
+ * Probes and their arguments:
+ *  - report_sent, report_received (report_id, device_index, sub_id,
+ *    address, length): HID reports written or read by HID::RawDevice.
+ *    The HID++ header bytes (sub_id is the feature index and address
+ *    holds the function for HID++ 2.0) are 0 for shorter reports.
+ *  - command_submitted (dispatcher, device_index, sub_id, address,
+ *    length): command added to a HIDPP::DispatcherThread, sent at once
+ *    or queued.
+ *  - command_matched (dispatcher, device_index, sub_id, address,
+ *    error): answer (or error message) matched with a command.
+ *  - command_timeout (dispatcher, device_index, sub_id, address).
+ *    The first four arguments of a command are the same in its
+ *    completion probe, for latency histograms.
+ *  - event_dispatched (dispatcher, device_index, sub_id, address,
+ *    listener_count): event passed to the listeners of
+ *    HIDPP::Dispatcher.
+ *  - page_read, page_written (mapping, mem_type, page, length): page
+ *    data read from or written to the device by
+ *    HIDPP::AbstractMemoryMapping. length is the byte count actually
+ *    transferred (lines or ranges for partial accesses).
+ *  - memory_synced (mapping, page_count, byte_count): end of a sync.
+ */
+
+#ifdef LIBHIDPP_USDT
+#include <sys/sdt.h>
+#define LIBHIDPP_PROBE(name, ...) STAP_PROBEV (libhidpp, name, __VA_ARGS__)
+#else
+#define LIBHIDPP_PROBE(name, ...) do {} while (false)
+#endif
+
+/**
+ * report_sent or report_received probe of a raw HID report.
+ */
+#define LIBHIDPP_PROBE_REPORT(name, report, length) \
+	LIBHIDPP_PROBE (name, (length) > 0 ? (report)[0] : 0, \
+			(length) > 1 ? (report)[1] : 0, \
+			(length) > 2 ? (report)[2] : 0, \
+			(length) > 3 ? (report)[3] : 0, \
+			(length))
+
+#endif
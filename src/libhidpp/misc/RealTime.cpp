@@ -0,0 +1,77 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "RealTime.h"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace RealTime;
+
+bool RealTime::parsePolicy (const char *str, Options &options)
+{
+	const char *colon = strchr (str, ':');
+	std::size_t name_length = colon ? colon - str : strlen (str);
+	if (name_length == 5 && strncmp (str, "other", 5) == 0) {
+		options.policy = Options::Policy::Default;
+		options.priority = 0;
+		return colon == nullptr;
+	}
+	if (name_length == 4 && strncmp (str, "fifo", 4) == 0)
+		options.policy = Options::Policy::FIFO;
+	else if (name_length == 2 && strncmp (str, "rr", 2) == 0)
+		options.policy = Options::Policy::RoundRobin;
+	else
+		return false;
+	if (!colon || colon[1] == '\0')
+		return false;
+	char *endptr;
+	long priority = strtol (colon+1, &endptr, 10);
+	if (*endptr != '\0' || priority < 1 || priority > 99)
+		return false;
+	options.priority = priority;
+	return true;
+}
+
+bool RealTime::parseCPUs (const char *str, Options &options)
+{
+	std::vector<unsigned int> cpus;
+	const char *p = str;
+	while (true) {
+		char *endptr;
+		unsigned long first = strtoul (p, &endptr, 10);
+		if (endptr == p)
+			return false;
+		unsigned long last = first;
+		if (*endptr == '-') {
+			p = endptr+1;
+			last = strtoul (p, &endptr, 10);
+			if (endptr == p || last < first)
+				return false;
+		}
+		for (unsigned long cpu = first; cpu <= last; ++cpu)
+			cpus.push_back (cpu);
+		if (*endptr == '\0')
+			break;
+		if (*endptr != ',')
+			return false;
+		p = endptr+1;
+	}
+	options.cpus = std::move (cpus);
+	return true;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_REALTIME_H
+#define LIBHIDPP_REALTIME_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Scheduling settings for latency-sensitive threads (e.g. the dispatcher
+ * thread of an input driver).
+ */
+namespace RealTime
+{
+
+struct Options
+{
+	enum class Policy
+	{
+		Default, ///< Leave the scheduling policy unchanged
+		FIFO,
+		RoundRobin,
+	} policy = Policy::Default;
+	int priority = 0; ///< Real-time priority, for FIFO and RoundRobin
+	std::vector<unsigned int> cpus; ///< CPUs the thread may run on, empty for any
+	/**
+	 * Lock current and future memory of the process, so that the thread
+	 * is never delayed by page faults.
+	 */
+	bool lock_memory = false;
+
+	bool empty () const
+	{
+		return policy == Policy::Default && cpus.empty () && !lock_memory;
+	}
+};
+
+/**
+ * Apply \p options to the calling thread.
+ *
+ * When locking memory, \p stack_size bytes of the calling thread stack
+ * are touched so that they are mapped before time-critical code runs.
+ *
+ * \throws std::system_error (e.g. without the privilege for real-time
+ * scheduling or locking memory)
+ */
+void applyToCurrentThread (const Options &options, std::size_t stack_size = 64*1024);
+
+/**
+ * Parse a scheduling setting: "fifo:priority", "rr:priority" or "other".
+ *
+ * \returns false if \p str is invalid.
+ */
+bool parsePolicy (const char *str, Options &options);
+/**
+ * Parse a comma-separated CPU list, with ranges (e.g. "0,2-3").
+ *
+ * \returns false if \p str is invalid.
+ */
+bool parseCPUs (const char *str, Options &options);
+
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "RealTime.h"
+
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+using namespace RealTime;
+
+static void prefaultStack (std::size_t size)
+{
+	volatile unsigned char *stack = static_cast<unsigned char *> (alloca (size));
+	for (std::size_t i = 0; i < size; i += 4096)
+		stack[i] = 0;
+}
+
+void RealTime::applyToCurrentThread (const Options &options, std::size_t stack_size)
+{
+	if (!options.cpus.empty ()) {
+		cpu_set_t set;
+		CPU_ZERO (&set);
+		for (auto cpu: options.cpus)
+			CPU_SET (cpu, &set);
+		int err = pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+		if (err)
+			throw std::system_error (err, std::system_category (), "pthread_setaffinity_np");
+	}
+	if (options.lock_memory) {
+		if (-1 == mlockall (MCL_CURRENT | MCL_FUTURE))
+			throw std::system_error (errno, std::system_category (), "mlockall");
+		prefaultStack (stack_size);
+	}
+	if (options.policy != Options::Policy::Default) {
+		struct sched_param param;
+		memset (&param, 0, sizeof (param));
+		param.sched_priority = options.priority;
+		int policy = options.policy == Options::Policy::FIFO ? SCHED_FIFO : SCHED_RR;
+		int err = pthread_setschedparam (pthread_self (), policy, &param);
+		if (err)
+			throw std::system_error (err, std::system_category (), "pthread_setschedparam");
+	}
+}
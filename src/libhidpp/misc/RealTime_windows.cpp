@@ -0,0 +1,51 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "RealTime.h"
+
+#include <malloc.h>
+#include <system_error>
+
+#include <windows.h>
+#include <hid/windows/error_category.h>
+
+using namespace RealTime;
+
+void RealTime::applyToCurrentThread (const Options &options, std::size_t stack_size)
+{
+	if (!options.cpus.empty ()) {
+		DWORD_PTR mask = 0;
+		for (auto cpu: options.cpus)
+			if (cpu < 8*sizeof (DWORD_PTR))
+				mask |= DWORD_PTR (1) << cpu;
+		if (!SetThreadAffinityMask (GetCurrentThread (), mask))
+			throw std::system_error (GetLastError (), windows_category (), "SetThreadAffinityMask");
+	}
+	if (options.lock_memory) {
+		// There is no equivalent of mlockall, only lock the stack.
+		void *stack = _alloca (stack_size);
+		if (!VirtualLock (stack, stack_size))
+			throw std::system_error (GetLastError (), windows_category (), "VirtualLock");
+	}
+	if (options.policy != Options::Policy::Default) {
+		// Windows has a single real-time class, the policies only
+		// differ on Linux.
+		if (!SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_TIME_CRITICAL))
+			throw std::system_error (GetLastError (), windows_category (), "SetThreadPriority");
+	}
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_MISC_TIMER_WHEEL_H
+#define LIBHIDPP_MISC_TIMER_WHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/**
+ * Hierarchical timer wheel with millisecond resolution.
+ *
+ * Adding a timer is constant time. Timers are not removed when they become
+ * useless: the owner must recognize stale values when they expire. Slots
+ * keep their allocated storage so the wheel stops allocating once it has
+ * grown to its working size.
+ *
+ * The wheel is not thread-safe.
+ */
+template<typename T>
+class TimerWheel
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	TimerWheel (clock::time_point start = clock::now ()):
+		_start (start), _current (0), _count (0)
+	{
+	}
+
+	bool empty () const noexcept
+	{
+		return _count == 0;
+	}
+
+	/**
+	 * Add \p value to be expired at \p deadline.
+	 */
+	void add (clock::time_point deadline, T value)
+	{
+		insert (Timer { std::max (ticks (deadline), _current + 1), std::move (value) });
+		++_count;
+	}
+
+	/**
+	 * Call \p expire with the value of every timer whose deadline is
+	 * before \p now, in deadline order.
+	 */
+	template<typename Function>
+	void advance (clock::time_point now, Function &&expire)
+	{
+		uint64_t target = ticks (now);
+		while (_current < target) {
+			// Skip the ticks where nothing happens.
+			uint64_t next = nextTick ();
+			if (next > target) {
+				_current = target;
+				break;
+			}
+			_current = next;
+			// Move timers from the upper levels when a lower level
+			// wraps around.
+			for (unsigned int level = Levels-1; level > 0; --level) {
+				if ((_current & ((uint64_t (1) << (level*SlotBits)) - 1)) == 0)
+					cascade (level, slotIndex (level, _current));
+			}
+			auto &slot = _slots[0][slotIndex (0, _current)];
+			if (slot.empty ())
+				continue;
+			std::vector<Timer> timers;
+			timers.swap (slot);
+			for (auto &timer: timers) {
+				if (timer.tick <= _current) {
+					--_count;
+					expire (timer.value);
+				}
+				else // further than the wheel range
+					insert (std::move (timer));
+			}
+			timers.clear ();
+			if (slot.empty ())
+				slot.swap (timers); // keep the storage
+		}
+	}
+
+	/**
+	 * Time when \ref advance should be called next.
+	 *
+	 * This may be earlier than the next deadline, but never later.
+	 */
+	std::optional<clock::time_point> nextDeadline () const
+	{
+		if (_count == 0)
+			return std::nullopt;
+		return _start + std::chrono::milliseconds (nextTick ());
+	}
+
+private:
+	static constexpr unsigned int SlotBits = 6;
+	static constexpr uint64_t SlotCount = 1 << SlotBits;
+	static constexpr uint64_t SlotMask = SlotCount - 1;
+	static constexpr unsigned int Levels = 4;
+
+	struct Timer
+	{
+		uint64_t tick;
+		T value;
+	};
+
+	uint64_t ticks (clock::time_point t) const
+	{
+		if (t <= _start)
+			return 0;
+		// round up so timers never expire early
+		auto ms = std::chrono::ceil<std::chrono::milliseconds> (t - _start);
+		return ms.count ();
+	}
+
+	/**
+	 * Next tick when a timer may expire or be cascaded.
+	 */
+	uint64_t nextTick () const
+	{
+		uint64_t next = UINT64_MAX;
+		if (_count == 0)
+			return next;
+		for (unsigned int level = 0; level < Levels; ++level) {
+			unsigned int shift = level*SlotBits;
+			uint64_t base = _current >> shift;
+			for (uint64_t i = 1; i <= SlotCount; ++i) {
+				if (!_slots[level][(base + i) & SlotMask].empty ()) {
+					next = std::min (next, (base + i) << shift);
+					break;
+				}
+			}
+		}
+		return next;
+	}
+
+	static unsigned int slotIndex (unsigned int level, uint64_t tick)
+	{
+		return (tick >> (level*SlotBits)) & SlotMask;
+	}
+
+	void insert (Timer &&timer)
+	{
+		uint64_t delta = timer.tick - _current;
+		unsigned int level = 0;
+		while (level < Levels-1 && delta >= (uint64_t (1) << ((level+1)*SlotBits)))
+			++level;
+		uint64_t tick = timer.tick;
+		uint64_t range = uint64_t (1) << (Levels*SlotBits);
+		if (delta >= range) // clamp, it will be inserted again when its slot expires
+			tick = _current + range - 1;
+		_slots[level][slotIndex (level, tick)].push_back (std::move (timer));
+	}
+
+	void cascade (unsigned int level, unsigned int index)
+	{
+		auto &slot = _slots[level][index];
+		if (slot.empty ())
+			return;
+		std::vector<Timer> timers;
+		timers.swap (slot);
+		for (auto &timer: timers)
+			insert (std::move (timer));
+		timers.clear ();
+		if (slot.empty ())
+			slot.swap (timers);
+	}
+
+	clock::time_point _start;
+	uint64_t _current;
+	std::size_t _count;
+	std::array<std::array<std::vector<Timer>, SlotCount>, Levels> _slots;
+};
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <misc/Trace.h>
+
+#include <misc/Log.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Trace::_enabled (false);
+
+namespace
+{
+
+struct Event
+{
+	char phase;
+	const char *category, *name;
+	uint64_t id;
+	unsigned int thread;
+	Trace::clock::time_point time;
+	Trace::clock::duration duration;
+	Trace::Arg args[Trace::MaxArgs];
+	std::size_t arg_count;
+};
+
+std::mutex mutex;
+std::vector<Event> events;
+std::string trace_path;
+Trace::clock::time_point trace_start;
+std::atomic<unsigned int> next_thread (1);
+std::atomic<uint64_t> next_id (1);
+
+unsigned int threadNumber ()
+{
+	thread_local unsigned int number = next_thread.fetch_add (1, std::memory_order_relaxed);
+	return number;
+}
+
+void add (char phase, const char *category, const char *name, uint64_t id,
+	  Trace::clock::time_point time, Trace::clock::duration duration,
+	  const Trace::Arg *args, std::size_t arg_count)
+{
+	Event event = { phase, category, name, id, threadNumber (), time, duration, {},
+			std::min (arg_count, Trace::MaxArgs) };
+	std::copy_n (args, event.arg_count, event.args);
+	std::unique_lock<std::mutex> lock (mutex);
+	if (Trace::enabled ())
+		events.push_back (event);
+}
+
+double microseconds (Trace::clock::duration duration)
+{
+	return std::chrono::duration<double, std::micro> (duration).count ();
+}
+
+}
+
+void Trace::init ()
+{
+	if (const char *path = getenv ("HIDPP_TRACE"))
+		start (path);
+}
+
+void Trace::start (const std::string &path)
+{
+	static std::once_flag at_exit;
+	std::call_once (at_exit, [] () { atexit (&Trace::stop); });
+	std::unique_lock<std::mutex> lock (mutex);
+	trace_path = path;
+	trace_start = clock::now ();
+	events.clear ();
+	_enabled.store (true, std::memory_order_relaxed);
+}
+
+void Trace::stop ()
+{
+	std::vector<Event> trace;
+	std::string path;
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		if (!_enabled.load (std::memory_order_relaxed))
+			return;
+		_enabled.store (false, std::memory_order_relaxed);
+		trace.swap (events);
+		path = trace_path;
+	}
+	FILE *file = fopen (path.c_str (), "w");
+	if (!file) {
+		Log::error () << "Failed to write trace file " << path << std::endl;
+		return;
+	}
+	fprintf (file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (std::size_t i = 0; i < trace.size (); ++i) {
+		const auto &event = trace[i];
+		fprintf (file, "%s\n{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+			 i == 0 ? "" : ",", event.phase, event.category, event.name,
+			 event.thread, microseconds (event.time - trace_start));
+		if (event.phase == 'X')
+			fprintf (file, ",\"dur\":%.3f", microseconds (event.duration));
+		else
+			fprintf (file, ",\"id\":\"0x%" PRIx64 "\"", event.id);
+		if (event.arg_count > 0) {
+			fprintf (file, ",\"args\":{");
+			for (std::size_t j = 0; j < event.arg_count; ++j)
+				fprintf (file, "%s\"%s\":%u", j == 0 ? "" : ",",
+					 event.args[j].name, event.args[j].value);
+			fprintf (file, "}");
+		}
+		fprintf (file, "}");
+	}
+	fprintf (file, "\n]}\n");
+	fclose (file);
+}
+
+void Trace::span (const char *category, const char *name,
+		  clock::time_point begin, clock::time_point end,
+		  std::initializer_list<Arg> args)
+{
+	if (!enabled ())
+		return;
+	add ('X', category, name, 0, begin, end - begin, args.begin (), args.size ());
+}
+
+void Trace::asyncSpan (const char *category, const char *name, uint64_t id,
+		       clock::time_point begin, clock::time_point end,
+		       std::initializer_list<Arg> args)
+{
+	if (!enabled ())
+		return;
+	add ('b', category, name, id, begin, {}, args.begin (), args.size ());
+	add ('e', category, name, id, end, {}, nullptr, 0);
+}
+
+uint64_t Trace::nextID ()
+{
+	return next_id.fetch_add (1, std::memory_order_relaxed);
+}
+
+Trace::Scope::Scope (const char *category, const char *name, std::initializer_list<Arg> args):
+	_category (category), _name (name),
+	_arg_count (std::min (args.size (), MaxArgs)),
+	_enabled (Trace::enabled ())
+{
+	if (!_enabled)
+		return;
+	std::copy_n (args.begin (), _arg_count, _args);
+	_begin = clock::now ();
+}
+
+Trace::Scope::~Scope ()
+{
+	if (!_enabled || !Trace::enabled ())
+		return;
+	add ('X', _category, _name, 0, _begin, clock::now () - _begin, _args, _arg_count);
+}
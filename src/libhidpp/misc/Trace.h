@@ -0,0 +1,108 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBHIDPP_TRACE_H
+#define LIBHIDPP_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+/**
+ * Optional span tracing written as Chrome trace JSON, which can be opened
+ * in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Spans are kept in memory while tracing and written when it stops.
+ * Category and span names must be static strings.
+ */
+namespace Trace
+{
+
+using clock = std::chrono::steady_clock;
+
+struct Arg
+{
+	const char *name;
+	unsigned int value;
+};
+static constexpr std::size_t MaxArgs = 4;
+
+extern std::atomic<bool> _enabled;
+
+inline bool enabled ()
+{
+	return _enabled.load (std::memory_order_relaxed);
+}
+
+/**
+ * Start tracing to the file in the HIDPP_TRACE environment variable, if
+ * it is set.
+ */
+void init ();
+/**
+ * Start recording spans, they are written to \p path when tracing stops
+ * or at exit.
+ */
+void start (const std::string &path);
+/**
+ * Stop tracing and write the trace file.
+ */
+void stop ();
+
+/**
+ * Record a span on the current thread track. Spans of a same thread
+ * must be nested.
+ */
+void span (const char *category, const char *name,
+	   clock::time_point begin, clock::time_point end,
+	   std::initializer_list<Arg> args = {});
+/**
+ * Record a span on the asynchronous track \p id. Spans with the same
+ * category and id are nested.
+ */
+void asyncSpan (const char *category, const char *name, uint64_t id,
+		clock::time_point begin, clock::time_point end,
+		std::initializer_list<Arg> args = {});
+/**
+ * Get a new identifier for asynchronous tracks.
+ */
+uint64_t nextID ();
+
+/**
+ * Record a span on the current thread from construction to destruction.
+ */
+class Scope
+{
+public:
+	Scope (const char *category, const char *name, std::initializer_list<Arg> args = {});
+	Scope (const Scope &) = delete;
+	~Scope ();
+
+private:
+	const char *_category, *_name;
+	clock::time_point _begin;
+	Arg _args[MaxArgs];
+	std::size_t _arg_count;
+	bool _enabled;
+};
+
+}
+
+#endif
@@ -1,6 +1,12 @@
 #include "CommonOptions.h"
 
+#include <hid/VirtualDevice.h>
+#ifdef __linux__
+#include <hidpp/DaemonClient.h>
+#endif
 #include <misc/Log.h>
+#include <misc/MemoryAccounting.h>
+#include <misc/Trace.h>
 
 #include "common.h"
 
@@ -51,6 +57,8 @@ Option DeviceIndexOption (HIDPP::DeviceIndex &device_index)
 Option VerboseOption ()
 {
 	Log::init ();
+	Trace::init ();
+	MemoryAccounting::init ();
 	return Option (
 		'v', "verbose",
 		Option::OptionalArgument, "list",
@@ -64,6 +72,89 @@ Option VerboseOption ()
 	);
 }
 
+Option DaemonOption ()
+{
+	return Option (
+		'S', "daemon",
+		Option::OptionalArgument, "socket",
+		"Access devices through hidppd, listening on socket (default: $HIDPPD_SOCKET or $XDG_RUNTIME_DIR/hidppd.sock).",
+		[] (const char *optarg) -> bool {
+#ifdef __linux__
+			HIDPP::DaemonClient::registerScheme (optarg ? optarg : "");
+			HID::VirtualDevice::setDefaultScheme ("hidppd");
+			return true;
+#else
+			fprintf (stderr, "hidppd is only supported on Linux.\n");
+			return false;
+#endif
+		}
+	);
+}
+
+Option SchedulingOption (RealTime::Options &options)
+{
+	return Option (
+		'R', "sched",
+		Option::RequiredArgument, "policy",
+		"Run the dispatcher thread with real-time scheduling: fifo:priority, rr:priority or other (priority from 1 to 99).",
+		[&options] (const char *optarg) -> bool {
+			if (!RealTime::parsePolicy (optarg, options)) {
+				fprintf (stderr, "Invalid scheduling policy: %s\n", optarg);
+				return false;
+			}
+			return true;
+		}
+	);
+}
+
+Option CPUAffinityOption (RealTime::Options &options)
+{
+	return Option (
+		'C', "cpus",
+		Option::RequiredArgument, "list",
+		"Run the dispatcher thread on the given CPUs (e.g. 0,2-3).",
+		[&options] (const char *optarg) -> bool {
+			if (!RealTime::parseCPUs (optarg, options)) {
+				fprintf (stderr, "Invalid CPU list: %s\n", optarg);
+				return false;
+			}
+			return true;
+		}
+	);
+}
+
+Option LockMemoryOption (RealTime::Options &options)
+{
+	return Option (
+		'M', "lock-memory",
+		Option::NoArgument, "",
+		"Lock the process memory so that the dispatcher thread is not delayed by page faults.",
+		[&options] (const char *) -> bool {
+			options.lock_memory = true;
+			return true;
+		}
+	);
+}
+
+Option BusyPollOption (std::chrono::microseconds &duration)
+{
+	return Option (
+		'B', "busy-poll",
+		Option::RequiredArgument, "us",
+		"Poll the device without sleeping for this many microseconds before waiting for each report (Linux only).",
+		[&duration] (const char *optarg) -> bool {
+			char *endptr;
+			long value = strtol (optarg, &endptr, 10);
+			if (*endptr != '\0' || value < 0) {
+				fprintf (stderr, "Invalid busy poll duration: %s\n", optarg);
+				return false;
+			}
+			duration = std::chrono::microseconds (value);
+			return true;
+		}
+	);
+}
+
 Option HelpOption (const char *program, const char *args,
 		   const std::vector<Option> *options)
 {
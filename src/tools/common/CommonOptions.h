@@ -3,9 +3,24 @@
 
 #include "Option.h"
 #include <hidpp/defs.h>
+#include <misc/RealTime.h>
+
+#include <chrono>
 
 Option DeviceIndexOption (HIDPP::DeviceIndex &device_index);
 Option VerboseOption ();
+Option DaemonOption ();
+/**
+ * Options for the scheduling of latency-sensitive threads (see
+ * HIDPP::DispatcherThread::setRealTimeOptions).
+ */
+Option SchedulingOption (RealTime::Options &options);
+Option CPUAffinityOption (RealTime::Options &options);
+Option LockMemoryOption (RealTime::Options &options);
+/**
+ * Option for HID::RawDevice::setBusyPoll.
+ */
+Option BusyPollOption (std::chrono::microseconds &duration);
 Option HelpOption (const char *program, const char *args, const std::vector<Option> *options);
 
 #endif
@@ -0,0 +1,368 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "DeviceSelector.h"
+
+#include <hid/DeviceMonitor.h>
+#include <hid/InterfaceRoleCache.h>
+#include <hidpp/Device.h>
+#include <hidpp/Probe.h>
+#include <hidpp/SimpleDispatcher.h>
+#include <hidpp10/Device.h>
+#include <hidpp10/Error.h>
+#include <hidpp10/IReceiver.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IDeviceInformation.h>
+#include <hidpp20/UnsupportedFeature.h>
+#include <misc/Log.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <system_error>
+
+static constexpr char Header[] = "# hidpp device selection cache 1";
+
+namespace
+{
+
+class DeviceCollector: public HID::DeviceMonitor
+{
+public:
+	std::vector<std::string> paths;
+
+protected:
+	void addDevice (const char *path)
+	{
+		paths.push_back (path);
+	}
+
+	void removeDevice (const char *) { }
+};
+
+struct CacheEntry
+{
+	std::string path;
+	HIDPP::DeviceIndex index;
+};
+
+}
+
+/*
+ * Selection cache file: a header line, then one "path index key" line
+ * per selection, the key taking the rest of the line.
+ */
+static std::map<std::string, CacheEntry> loadCache (const char *cache_path)
+{
+	std::map<std::string, CacheEntry> entries;
+	std::ifstream in (cache_path);
+	if (!in)
+		return entries; // no cache yet
+	std::string line;
+	if (!std::getline (in, line) || line != Header) {
+		Log::warning () << "Ignoring invalid selection cache " << cache_path << std::endl;
+		return entries;
+	}
+	while (std::getline (in, line)) {
+		std::istringstream ss (line);
+		std::string path, key;
+		unsigned int index;
+		if (!(ss >> path >> index) || index > 0xff || !std::getline (ss >> std::ws, key)) {
+			Log::warning () << "Ignoring invalid selection cache " << cache_path << std::endl;
+			return {};
+		}
+		entries[key] = { path, static_cast<HIDPP::DeviceIndex> (index) };
+	}
+	return entries;
+}
+
+static void saveCache (const char *cache_path, const std::map<std::string, CacheEntry> &entries)
+{
+	std::string tmp_path = std::string (cache_path) + ".tmp";
+	{
+		std::ofstream out (tmp_path, std::ios::trunc);
+		if (!out)
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+		out << Header << std::endl;
+		for (const auto &[key, entry]: entries)
+			out << entry.path << " " << static_cast<unsigned int> (entry.index)
+			    << " " << key << std::endl;
+		if (!out.flush ())
+			throw std::system_error (errno, std::generic_category (), tmp_path);
+	}
+	if (0 != std::rename (tmp_path.c_str (), cache_path))
+		throw std::system_error (errno, std::generic_category (), "rename");
+}
+
+/*
+ * Serial of the device as in HIDPP::DeviceRegistry keys, empty if it
+ * has none.
+ */
+static std::string deviceSerial (HIDPP::Dispatcher *dispatcher, HIDPP::DeviceIndex index,
+				 const HIDPP::Device::Identity &identity)
+{
+	char str[16];
+	if (std::get<0> (identity.version) >= 2) {
+		try {
+			HIDPP20::Device dev (dispatcher, index, identity);
+			auto info = HIDPP20::IDeviceInformation (&dev).getDeviceInfo ();
+			if (std::any_of (info.unit_id.begin (), info.unit_id.end (),
+					[] (uint8_t b) { return b != 0; })) {
+				std::string serial;
+				for (uint8_t b: info.unit_id) {
+					snprintf (str, sizeof (str), "%02x", b);
+					serial += str;
+				}
+				return serial;
+			}
+		}
+		catch (HIDPP20::UnsupportedFeature &e) {
+		}
+	}
+	if (index != HIDPP::DefaultDevice && index != HIDPP::CordedDevice) {
+		try {
+			HIDPP10::Device receiver (dispatcher, HIDPP::DefaultDevice);
+			uint32_t serial;
+			HIDPP10::IReceiver (&receiver).getDeviceExtendedInformation (index - 1, &serial, nullptr, nullptr);
+			snprintf (str, sizeof (str), "%08x", serial);
+			return str;
+		}
+		catch (HIDPP10::Error &e) {
+			// not every receiver has the extended pairing information
+		}
+		catch (HIDPP::Device::InvalidProtocolVersion &e) {
+		}
+	}
+	return {};
+}
+
+/*
+ * Everything but the serial, which needs more round trips.
+ */
+static bool matchIdentity (const DeviceSelector::Criteria &criteria, uint16_t vendor_id,
+			   const HIDPP::Device::Identity &identity)
+{
+	return (!criteria.vendor_id || *criteria.vendor_id == vendor_id) &&
+		(!criteria.product_id || *criteria.product_id == identity.product_id) &&
+		(!criteria.name || *criteria.name == identity.name);
+}
+
+static bool matchSerial (const DeviceSelector::Criteria &criteria, HIDPP::Dispatcher *dispatcher,
+			 HIDPP::DeviceIndex index, const HIDPP::Device::Identity &identity)
+{
+	return !criteria.serial || *criteria.serial == deviceSerial (dispatcher, index, identity);
+}
+
+std::string DeviceSelector::Criteria::key () const
+{
+	std::vector<std::string> fields;
+	if (vendor_id || product_id) {
+		char ids[16];
+		snprintf (ids, sizeof (ids), "%04hx:%04hx",
+			  vendor_id.value_or (0), product_id.value_or (0));
+		fields.push_back (std::string ("id=") + ids);
+	}
+	if (serial)
+		fields.push_back ("serial=" + *serial);
+	if (name)
+		fields.push_back ("name=" + *name);
+	std::string key;
+	for (const auto &field: fields)
+		key += (key.empty () ? "" : " ") + field;
+	return key;
+}
+
+DeviceSelector::DeviceSelector ():
+	_cache_path (nullptr)
+{
+}
+
+std::vector<Option> DeviceSelector::options ()
+{
+	return {
+		Option ('U', "serial",
+			Option::RequiredArgument, "serial",
+			"Select the device with this unit ID or receiver pairing serial (hexadecimal) instead of giving its path.",
+			[this] (const char *optarg) -> bool {
+				std::string serial = optarg;
+				if (serial.empty () || serial.size () > 8 ||
+						!std::all_of (serial.begin (), serial.end (), isxdigit)) {
+					fprintf (stderr, "Invalid serial: %s\n", optarg);
+					return false;
+				}
+				std::transform (serial.begin (), serial.end (), serial.begin (), tolower);
+				serial.insert (0, 8 - serial.size (), '0');
+				_criteria.serial = serial;
+				return true;
+			}),
+		Option ('N', "name",
+			Option::RequiredArgument, "name",
+			"Select the device with this name instead of giving its path.",
+			[this] (const char *optarg) -> bool {
+				if (*optarg == '\0' || strchr (optarg, '\n')) {
+					fprintf (stderr, "Invalid name: %s\n", optarg);
+					return false;
+				}
+				_criteria.name = optarg;
+				return true;
+			}),
+		Option ('I', "vid-pid",
+			Option::RequiredArgument, "vid:pid",
+			"Select the device with these IDs (hexadecimal, either may be empty) instead of giving its path.",
+			[this] (const char *optarg) -> bool {
+				const char *colon = strchr (optarg, ':');
+				if (!colon) {
+					fprintf (stderr, "Invalid IDs: %s\n", optarg);
+					return false;
+				}
+				auto parse = [optarg] (const std::string &str, std::optional<uint16_t> &id) {
+					if (str.empty ())
+						return true;
+					char *endptr;
+					unsigned long value = strtoul (str.c_str (), &endptr, 16);
+					if (*endptr != '\0' || value > 0xffff) {
+						fprintf (stderr, "Invalid IDs: %s\n", optarg);
+						return false;
+					}
+					id = value;
+					return true;
+				};
+				return parse (std::string (optarg, colon), _criteria.vendor_id) &&
+					parse (colon+1, _criteria.product_id);
+			}),
+		Option ('K', "select-cache",
+			Option::RequiredArgument, "file",
+			"Remember the selected device in file (and the HID++ interfaces in file.interfaces), so that it is found again without scanning.",
+			[this] (const char *optarg) -> bool {
+				_cache_path = optarg;
+				return true;
+			}),
+	};
+}
+
+bool DeviceSelector::active () const
+{
+	return _criteria.serial || _criteria.name || _criteria.vendor_id || _criteria.product_id;
+}
+
+bool DeviceSelector::select (std::string &path, HIDPP::DeviceIndex &index)
+{
+	if (_cache_path && checkCached (path, index))
+		return true;
+	if (!scan (path, index))
+		return false;
+	if (_cache_path) {
+		try {
+			store (path, index);
+		}
+		catch (std::exception &e) {
+			Log::error () << "Failed to save selection cache " << _cache_path
+				      << ": " << e.what () << std::endl;
+		}
+	}
+	return true;
+}
+
+bool DeviceSelector::checkCached (std::string &path, HIDPP::DeviceIndex &index)
+{
+	auto entries = loadCache (_cache_path);
+	auto it = entries.find (_criteria.key ());
+	if (it == entries.end ())
+		return false;
+	const auto &entry = it->second;
+	try {
+		HIDPP::SimpleDispatcher dispatcher (entry.path.c_str ());
+		HIDPP::Device dev (&dispatcher, entry.index);
+		auto identity = dev.identity ();
+		if (!matchIdentity (_criteria, dispatcher.vendorID (), identity) ||
+				!matchSerial (_criteria, &dispatcher, entry.index, identity)) {
+			Log::debug () << "Cached device " << entry.path << ":" << entry.index
+				      << " does not match any more" << std::endl;
+			return false;
+		}
+	}
+	catch (std::exception &e) {
+		Log::debug () << "Cached device " << entry.path << ":" << entry.index
+			      << " failed: " << e.what () << std::endl;
+		return false;
+	}
+	path = entry.path;
+	index = entry.index;
+	return true;
+}
+
+bool DeviceSelector::scan (std::string &path, HIDPP::DeviceIndex &index)
+{
+	std::shared_ptr<HID::InterfaceRoleCache> interface_cache;
+	if (_cache_path)
+		interface_cache = std::make_shared<HID::InterfaceRoleCache> (std::string (_cache_path) + ".interfaces");
+	DeviceCollector collector;
+	auto filter = HIDPP::deviceFilter (interface_cache);
+	if (_criteria.vendor_id)
+		filter.vendor_ids = { *_criteria.vendor_id };
+	collector.setFilter (filter);
+	collector.enumerate ();
+
+	std::vector<HIDPP::ProbeResult> candidates;
+	for (const auto &result: HIDPP::probeDevices (collector.paths))
+		if (!result.error && matchIdentity (_criteria, result.vendor_id, result.identity ()))
+			candidates.push_back (result);
+	if (_criteria.serial) {
+		auto it = std::remove_if (candidates.begin (), candidates.end (),
+				[this] (const HIDPP::ProbeResult &result) {
+			try {
+				HIDPP::SimpleDispatcher dispatcher (result.path.c_str ());
+				return !matchSerial (_criteria, &dispatcher, result.index, result.identity ());
+			}
+			catch (std::exception &e) {
+				Log::debug () << "Failed to read serial of " << result.path << ":"
+					      << result.index << ": " << e.what () << std::endl;
+				return true;
+			}
+		});
+		candidates.erase (it, candidates.end ());
+	}
+
+	if (candidates.empty ()) {
+		fprintf (stderr, "No device matches %s\n", _criteria.key ().c_str ());
+		return false;
+	}
+	if (candidates.size () > 1) {
+		fprintf (stderr, "Several devices match %s:\n", _criteria.key ().c_str ());
+		for (const auto &result: candidates)
+			fprintf (stderr, "  %s (device %d): %s (%04hx:%04hx)\n",
+				 result.path.c_str (), result.index, result.name.c_str (),
+				 result.vendor_id, result.product_id);
+		return false;
+	}
+	path = candidates.front ().path;
+	index = candidates.front ().index;
+	return true;
+}
+
+void DeviceSelector::store (const std::string &path, HIDPP::DeviceIndex index)
+{
+	auto entries = loadCache (_cache_path);
+	entries[_criteria.key ()] = { path, index };
+	saveCache (_cache_path, entries);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DEVICE_SELECTOR_H
+#define DEVICE_SELECTOR_H
+
+#include <hidpp/defs.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Option.h"
+
+/**
+ * Find the device to use from its serial, name or IDs instead of its
+ * node path and index.
+ *
+ * The serial is the unit ID of HID++ 2.0 devices
+ * (HIDPP20::IDeviceInformation) or the pairing serial of devices
+ * paired to a HID++ 1.0 receiver, as in HIDPP::DeviceRegistry keys.
+ * The name and IDs are the ones printed by hidpp-list-devices.
+ *
+ * With a selection cache, the node and index last found for the same
+ * criteria are checked first, costing only the few round trips needed
+ * to check the device still matches. Otherwise, or when the cached
+ * device does not match any more, the HID++ nodes are scanned (only
+ * nodes of the selected vendor, and without reading the descriptors
+ * of interfaces in the interface cache) and probed with
+ * HIDPP::probeDevices.
+ *
+ * With DaemonOption, nodes are opened through hidppd, which already
+ * has them open.
+ */
+class DeviceSelector
+{
+public:
+	DeviceSelector ();
+
+	/**
+	 * Options for the serial (-U), name (-N), IDs (-I) and cache
+	 * (-K) of the device to select.
+	 */
+	std::vector<Option> options ();
+
+	/**
+	 * Whether any criteria was given, in which case the tool does not
+	 * take a device path argument.
+	 */
+	bool active () const;
+
+	/**
+	 * Find the only device matching the criteria.
+	 *
+	 * Errors (no or several devices matching) are printed on stderr.
+	 *
+	 * \returns false if no single device was found.
+	 */
+	bool select (std::string &path, HIDPP::DeviceIndex &index);
+
+	struct Criteria
+	{
+		std::optional<std::string> serial; ///< lowercase hexadecimal
+		std::optional<std::string> name;
+		std::optional<uint16_t> vendor_id, product_id;
+
+		/**
+		 * Key of the criteria in the selection cache.
+		 */
+		std::string key () const;
+	};
+
+private:
+	bool checkCached (std::string &path, HIDPP::DeviceIndex &index);
+	bool scan (std::string &path, HIDPP::DeviceIndex &index);
+	void store (const std::string &path, HIDPP::DeviceIndex index);
+
+	Criteria _criteria;
+	const char *_cache_path;
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Executor.h"
+
+#include <algorithm>
+
+// Worker of the calling thread, or none
+static thread_local const Executor *current_executor = nullptr;
+static thread_local unsigned int current_worker = 0;
+
+Executor::Executor (unsigned int threads):
+	_workers (threads != 0 ? threads : std::max (1u, std::thread::hardware_concurrency ())),
+	_queued (0),
+	_stopping (false)
+{
+	for (unsigned int i = 0; i < _workers.size (); ++i)
+		_workers[i].thread = std::thread (&Executor::work, this, i);
+}
+
+Executor::~Executor ()
+{
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_stopping = true;
+	}
+	_cond.notify_all ();
+	for (auto &worker: _workers)
+		worker.thread.join ();
+}
+
+void Executor::run (Job &job)
+{
+	if (job.count == 0)
+		return;
+	unsigned int self = _workers.size ();
+	if (current_executor == this)
+		self = current_worker;
+	{
+		// Counted first so that it never goes below the actual count
+		std::unique_lock<std::mutex> lock (_mutex);
+		_queued += job.count;
+	}
+	if (self < _workers.size ()) {
+		// Nested job: keep it local, idle workers steal it
+		auto &worker = _workers[self];
+		std::unique_lock<std::mutex> lock (worker.mutex);
+		for (std::size_t i = job.count; i-- > 0;)
+			worker.tasks.push_back ({ &job, i });
+	}
+	else {
+		// Consecutive indices to each worker, taken in order
+		std::size_t worker_count = _workers.size ();
+		for (std::size_t w = 0; w < worker_count; ++w) {
+			auto &worker = _workers[w];
+			std::size_t first = w * job.count / worker_count;
+			std::size_t last = (w+1) * job.count / worker_count;
+			std::unique_lock<std::mutex> lock (worker.mutex);
+			for (std::size_t i = last; i-- > first;)
+				worker.tasks.push_back ({ &job, i });
+		}
+	}
+	_cond.notify_all ();
+
+	// Help until the job is done
+	while (job.remaining.load (std::memory_order_acquire) != 0) {
+		Task task;
+		if (take (self, task)) {
+			execute (task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock (_mutex);
+		_cond.wait (lock, [this, &job] () {
+			return job.remaining.load (std::memory_order_acquire) == 0 ||
+				_queued.load (std::memory_order_relaxed) != 0;
+		});
+	}
+	if (job.error)
+		std::rethrow_exception (job.error);
+}
+
+bool Executor::take (unsigned int self, Task &task)
+{
+	unsigned int worker_count = _workers.size ();
+	for (unsigned int i = 0; i < worker_count; ++i) {
+		unsigned int w = (self + i) % worker_count;
+		auto &worker = _workers[w];
+		std::unique_lock<std::mutex> lock (worker.mutex);
+		if (worker.tasks.empty ())
+			continue;
+		if (w == self) {
+			task = worker.tasks.back ();
+			worker.tasks.pop_back ();
+		}
+		else {
+			task = worker.tasks.front ();
+			worker.tasks.pop_front ();
+		}
+		_queued.fetch_sub (1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+void Executor::execute (const Task &task)
+{
+	Job &job = *task.job;
+	try {
+		job.call (job.data, task.index);
+	}
+	catch (...) {
+		std::unique_lock<std::mutex> lock (job.error_mutex);
+		if (task.index < job.error_index) {
+			job.error_index = task.index;
+			job.error = std::current_exception ();
+		}
+	}
+	if (job.remaining.fetch_sub (1, std::memory_order_acq_rel) == 1) {
+		// The job may be destroyed as soon as its caller sees it done
+		std::unique_lock<std::mutex> lock (_mutex);
+		_cond.notify_all ();
+	}
+}
+
+void Executor::work (unsigned int self)
+{
+	current_executor = this;
+	current_worker = self;
+	while (true) {
+		Task task;
+		if (take (self, task)) {
+			execute (task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock (_mutex);
+		_cond.wait (lock, [this] () {
+			return _stopping || _queued.load (std::memory_order_relaxed) != 0;
+		});
+		if (_stopping && _queued.load (std::memory_order_relaxed) == 0)
+			return;
+	}
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Work-stealing thread pool for the tools running many independent
+ * jobs (devices, nodes or files).
+ *
+ * Each worker has its own task deque: it takes its tasks from the back
+ * and steals from the front of the others when it runs out. A task is
+ * only a job pointer and an index, the function of a job is not copied
+ * and no memory is allocated per task.
+ *
+ * The thread calling \ref forEach helps running the tasks while it
+ * waits, so jobs can be nested (e.g. a node task running a job for each
+ * of its devices) without blocking workers.
+ */
+class Executor
+{
+public:
+	/**
+	 * \param threads	Number of workers, 0 for the hardware
+	 *			concurrency. Use more workers than the
+	 *			hardware concurrency for jobs waiting for
+	 *			devices.
+	 */
+	Executor (unsigned int threads = 0);
+	~Executor ();
+
+	Executor (const Executor &) = delete;
+	Executor &operator= (const Executor &) = delete;
+
+	unsigned int threadCount () const
+	{
+		return _workers.size ();
+	}
+
+	/**
+	 * Call \p function with every index from 0 to \p count - 1 and
+	 * wait for all the calls.
+	 *
+	 * If calls throw, the exception of the lowest index is rethrown
+	 * after every call finished.
+	 */
+	template<typename Function>
+	void forEach (std::size_t count, Function &&function)
+	{
+		typedef std::remove_reference_t<Function> F;
+		Job job (count, [] (void *data, std::size_t index) {
+			(*static_cast<F *> (data)) (index);
+		}, const_cast<void *> (static_cast<const void *> (&function)));
+		run (job);
+	}
+
+	/**
+	 * Call \p function with every index from 0 to \p count - 1.
+	 *
+	 * \returns the results in index order.
+	 */
+	template<typename Function>
+	auto map (std::size_t count, Function &&function)
+	{
+		std::vector<std::invoke_result_t<Function &, std::size_t>> results (count);
+		forEach (count, [&results, &function] (std::size_t index) {
+			results[index] = function (index);
+		});
+		return results;
+	}
+
+private:
+	struct Job
+	{
+		void (*call) (void *data, std::size_t index);
+		void *data;
+		std::size_t count;
+		std::atomic<std::size_t> remaining;
+		std::mutex error_mutex;
+		std::size_t error_index;
+		std::exception_ptr error;
+
+		Job (std::size_t count, void (*call) (void *, std::size_t), void *data):
+			call (call), data (data), count (count), remaining (count),
+			error_index (count)
+		{
+		}
+	};
+	struct Task
+	{
+		Job *job;
+		std::size_t index;
+	};
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	void run (Job &job);
+	bool take (unsigned int self, Task &task);
+	void execute (const Task &task);
+	void work (unsigned int self);
+
+	std::vector<Worker> _workers;
+	std::atomic<std::size_t> _queued; // tasks in the deques
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _stopping;
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "LatencyHistogram.h"
+
+#include <iomanip>
+
+static const char *StageNames[] = {
+	"receive to handler",
+	"handler to write",
+};
+
+LatencyHistogram::LatencyHistogram ()
+{
+	for (auto &stage: _stages) {
+		for (auto &bucket: stage.buckets)
+			bucket = 0;
+		stage.count = 0;
+		stage.total_us = 0;
+		stage.max_us = 0;
+	}
+}
+
+void LatencyHistogram::record (Stage stage, std::chrono::steady_clock::duration latency)
+{
+	auto &h = _stages[stage];
+	auto us = std::chrono::duration_cast<std::chrono::microseconds> (latency).count ();
+	uint64_t value = us < 0 ? 0 : us;
+	unsigned int bucket = 0;
+	while (bucket < BucketCount-1 && (value >> bucket) != 0)
+		++bucket;
+	h.buckets[bucket].fetch_add (1, std::memory_order_relaxed);
+	h.count.fetch_add (1, std::memory_order_relaxed);
+	h.total_us.fetch_add (value, std::memory_order_relaxed);
+	uint64_t max = h.max_us.load (std::memory_order_relaxed);
+	while (value > max && !h.max_us.compare_exchange_weak (max, value, std::memory_order_relaxed));
+}
+
+void LatencyHistogram::recordSince (Stage stage, std::chrono::steady_clock::time_point start)
+{
+	if (start == std::chrono::steady_clock::time_point ())
+		return;
+	record (stage, std::chrono::steady_clock::now () - start);
+}
+
+void LatencyHistogram::print (std::ostream &out) const
+{
+	for (unsigned int i = 0; i < StageCount; ++i) {
+		const auto &h = _stages[i];
+		uint64_t count = h.count.load ();
+		if (count == 0)
+			continue;
+		out << "Latency " << StageNames[i] << ": "
+		    << count << " samples, mean " << h.total_us.load ()/count
+		    << " us, max " << h.max_us.load () << " us" << std::endl;
+		for (unsigned int j = 0; j < BucketCount; ++j) {
+			uint64_t n = h.buckets[j].load ();
+			if (n == 0)
+				continue;
+			uint64_t low = j == 0 ? 0 : uint64_t (1) << (j-1);
+			out << "  " << std::setw (8) << low << " us - ";
+			if (j < BucketCount-1)
+				out << std::setw (8) << (uint64_t (1) << j) << " us";
+			else
+				out << std::setw (11) << "...";
+			out << ": " << n << std::endl;
+		}
+	}
+}
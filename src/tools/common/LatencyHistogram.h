@@ -0,0 +1,74 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * Histograms of event latencies with power of two microsecond buckets.
+ *
+ * Samples can be recorded from any thread without locking.
+ */
+class LatencyHistogram
+{
+public:
+	enum Stage {
+		/** From reading the report to calling the event handler */
+		ReceiveToHandler,
+		/** From calling the event handler to writing the uinput events */
+		HandlerToWrite,
+		StageCount,
+	};
+
+	LatencyHistogram ();
+
+	/**
+	 * Record a sample for \p stage.
+	 */
+	void record (Stage stage, std::chrono::steady_clock::duration latency);
+
+	/**
+	 * Record the time elapsed between \p start and now for \p stage.
+	 *
+	 * Default constructed (unknown) start times are ignored.
+	 */
+	void recordSince (Stage stage, std::chrono::steady_clock::time_point start);
+
+	/**
+	 * Print the stages that have samples.
+	 */
+	void print (std::ostream &out) const;
+
+private:
+	// Bucket i counts latencies in [2^(i-1), 2^i) µs, the last one is unbounded
+	static constexpr unsigned int BucketCount = 24;
+
+	struct Histogram {
+		std::array<std::atomic<uint64_t>, BucketCount> buckets;
+		std::atomic<uint64_t> count, total_us, max_us;
+	};
+	std::array<Histogram, StageCount> _stages;
+};
+
+#endif
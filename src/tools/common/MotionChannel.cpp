@@ -0,0 +1,148 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MotionChannel.h"
+
+#include <algorithm>
+
+using namespace HIDPP20;
+
+static unsigned int touchingSlots (const ITouchpadRawXY::TouchpadRawData &data)
+{
+	unsigned int slots = 0;
+	for (const auto &point: data.points)
+		if (point.id != 0)
+			slots |= 1u << point.id;
+	return slots;
+}
+
+// Merge next in last if they are both motion of the same kind
+static bool coalesce (MotionChannel::Event &last, const MotionChannel::Event &next)
+{
+	if (last.type != next.type)
+		return false;
+	switch (last.type) {
+	case MotionChannel::Event::Move:
+		last.dx += next.dx;
+		last.dy += next.dy;
+		return true;
+	case MotionChannel::Event::Scroll:
+		last.wheel += next.wheel;
+		return true;
+	case MotionChannel::Event::Touch:
+		if (touchingSlots (last.touch) != touchingSlots (next.touch))
+			return false;
+		last.touch = next.touch;
+		return true;
+	default:
+		return false;
+	}
+}
+
+MotionChannel::MotionChannel (std::size_t capacity):
+	_events (std::max<std::size_t> (capacity, 2)),
+	_head (0), _size (0),
+	_interrupted (false)
+{
+}
+
+void MotionChannel::pushButtons (const IReprogControlsV4::DivertedButtons &buttons,
+				 std::chrono::steady_clock::time_point time)
+{
+	Event event = {};
+	event.type = Event::Buttons;
+	event.time = time;
+	event.buttons = buttons;
+	push (event);
+}
+
+void MotionChannel::pushMove (const IReprogControlsV4::Move &move,
+			      std::chrono::steady_clock::time_point time)
+{
+	Event event = {};
+	event.type = Event::Move;
+	event.time = time;
+	event.dx = move.x;
+	event.dy = move.y;
+	push (event);
+}
+
+void MotionChannel::pushScroll (int delta, std::chrono::steady_clock::time_point time)
+{
+	Event event = {};
+	event.type = Event::Scroll;
+	event.time = time;
+	event.wheel = delta;
+	push (event);
+}
+
+void MotionChannel::pushTouch (const ITouchpadRawXY::TouchpadRawData &data,
+			       std::chrono::steady_clock::time_point time)
+{
+	Event event = {};
+	event.type = Event::Touch;
+	event.time = time;
+	event.touch = data;
+	push (event);
+}
+
+void MotionChannel::push (const Event &event)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	// Events that cannot be coalesced leave the last slot for moves and
+	// scrolls, so that motion following them never blocks.
+	bool motion = event.type == Event::Move || event.type == Event::Scroll;
+	std::size_t limit = motion ? _events.size () : _events.size ()-1;
+	while (true) {
+		if (_interrupted)
+			return;
+		if (_size > 0 && coalesce (_events[(_head+_size-1) % _events.size ()], event))
+			return;
+		if (_size < limit)
+			break;
+		_not_full.wait (lock);
+	}
+	_events[(_head+_size) % _events.size ()] = event;
+	++_size;
+	lock.unlock ();
+	_not_empty.notify_one ();
+}
+
+std::optional<MotionChannel::Event> MotionChannel::pop ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	while (_size == 0 && !_interrupted)
+		_not_empty.wait (lock);
+	if (_interrupted)
+		return std::nullopt;
+	Event event = _events[_head];
+	_head = (_head+1) % _events.size ();
+	--_size;
+	lock.unlock ();
+	_not_full.notify_all ();
+	return event;
+}
+
+void MotionChannel::interrupt ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_interrupted = true;
+	lock.unlock ();
+	_not_empty.notify_all ();
+	_not_full.notify_all ();
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MOTION_CHANNEL_H
+#define MOTION_CHANNEL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <hidpp20/IReprogControlsV4.h>
+#include <hidpp20/ITouchpadRawXY.h>
+
+/**
+ * Bounded channel for input events between a reading thread and a
+ * consumer thread.
+ *
+ * When the consumer falls behind, motion is coalesced instead of
+ * queued:
+ *  - relative moves are summed,
+ *  - wheel scrolls are summed,
+ *  - a touchpad frame replaces the previous one when the same slots
+ *    are touching.
+ *
+ * Transitions (button changes, touches starting or ending) are never
+ * dropped: pushing them blocks while the channel is full. The last slot
+ * is kept for relative moves and scrolls, so they only block if it is
+ * taken by the other kind.
+ */
+class MotionChannel
+{
+public:
+	struct Event
+	{
+		enum Type {
+			Buttons,
+			Move,
+			Scroll,
+			Touch,
+		} type;
+		/**
+		 * Time of the oldest input merged in this event.
+		 */
+		std::chrono::steady_clock::time_point time;
+		HIDPP20::IReprogControlsV4::DivertedButtons buttons; // Buttons
+		int dx, dy; // Move
+		int wheel; // Scroll
+		HIDPP20::ITouchpadRawXY::TouchpadRawData touch; // Touch
+	};
+
+	/**
+	 * \param capacity	Maximum number of events waiting in the channel
+	 *			(at least 2).
+	 */
+	MotionChannel (std::size_t capacity = 64);
+
+	/**
+	 * Push a diverted button event, blocking while the channel is full.
+	 */
+	void pushButtons (const HIDPP20::IReprogControlsV4::DivertedButtons &buttons,
+			  std::chrono::steady_clock::time_point time = {});
+	/**
+	 * Push a diverted raw XY move, it is added to the last event if it
+	 * is also a move.
+	 */
+	void pushMove (const HIDPP20::IReprogControlsV4::Move &move,
+		       std::chrono::steady_clock::time_point time = {});
+	/**
+	 * Push a wheel movement of \p delta (in the wheel units), it is
+	 * added to the last event if it is also a scroll.
+	 */
+	void pushScroll (int delta, std::chrono::steady_clock::time_point time = {});
+	/**
+	 * Push a touchpad frame, it replaces the last event if it is a
+	 * frame with the same touching slots.
+	 */
+	void pushTouch (const HIDPP20::ITouchpadRawXY::TouchpadRawData &data,
+			std::chrono::steady_clock::time_point time = {});
+
+	/**
+	 * Pop an event from the channel.
+	 *
+	 * This method will block until an event is available unless it is
+	 * interrupted.
+	 *
+	 * \see interrupt()
+	 */
+	std::optional<Event> pop ();
+
+	/**
+	 * Make the current and future calls to pop() return immediately
+	 * with an invalid value and unblock producers.
+	 */
+	void interrupt ();
+
+private:
+	void push (const Event &event);
+
+	std::mutex _mutex;
+	std::condition_variable _not_empty, _not_full;
+	std::vector<Event> _events; // ring of _capacity events
+	std::size_t _head, _size;
+	bool _interrupted;
+};
+
+#endif
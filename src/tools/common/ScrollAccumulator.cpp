@@ -0,0 +1,42 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ScrollAccumulator.h"
+
+#include <algorithm>
+
+ScrollAccumulator::ScrollAccumulator (unsigned int multiplier):
+	_multiplier (std::max (1u, multiplier)),
+	_rest (0),
+	_partial (0)
+{
+}
+
+void ScrollAccumulator::scroll (int delta, int &hi_res, int &detents)
+{
+	if ((delta > 0 && _partial < 0) || (delta < 0 && _partial > 0)) {
+		_rest = 0;
+		_partial = 0;
+	}
+	int total = delta * HiResPerDetent + _rest;
+	hi_res = total / _multiplier;
+	_rest = total % _multiplier;
+	_partial += hi_res;
+	detents = _partial / HiResPerDetent;
+	_partial %= HiResPerDetent;
+}
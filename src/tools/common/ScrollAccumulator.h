@@ -0,0 +1,55 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SCROLL_ACCUMULATOR_H
+#define SCROLL_ACCUMULATOR_H
+
+/**
+ * Convert high resolution wheel units to the Linux scroll units.
+ *
+ * REL_WHEEL_HI_RES counts 120 units per detent and REL_WHEEL whole
+ * detents. Remainders of both conversions are kept for the next
+ * movement, so slow scrolling is not lost. The partial detent is
+ * dropped when the direction changes.
+ */
+class ScrollAccumulator
+{
+public:
+	static constexpr int HiResPerDetent = 120;
+
+	/**
+	 * \param multiplier	Wheel units per detent (see
+	 *			HIDPP20::IHiResWheel::Capability).
+	 */
+	ScrollAccumulator (unsigned int multiplier);
+
+	/**
+	 * Add a wheel movement of \p delta units.
+	 *
+	 * \param[out]	hi_res	Value for REL_WHEEL_HI_RES.
+	 * \param[out]	detents	Value for REL_WHEEL.
+	 */
+	void scroll (int delta, int &hi_res, int &detents);
+
+private:
+	int _multiplier;
+	int _rest; // in 1/multiplier hi-res units
+	int _partial; // hi-res units not sent as detents
+};
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "TouchpadGestures.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <system_error>
+
+extern "C" {
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+}
+
+static constexpr auto TapTime = std::chrono::milliseconds (200);
+
+TouchpadGestures::TouchpadGestures (unsigned int x_max, unsigned int y_max):
+	_tap_distance (x_max/40),
+	_gesture_distance (x_max/30),
+	_scroll_step (y_max/40),
+	_pinch_step (x_max/15),
+	_swipe_distance (x_max/5),
+	_state (State::Idle),
+	_slots {},
+	_fingers (0),
+	_max_fingers (0),
+	_moved (false),
+	_swipe_dx (0)
+{
+}
+
+void TouchpadGestures::setupDevice (int uinput)
+{
+	static const struct { int request, code; } bits[] = {
+		{ UI_SET_EVBIT, EV_KEY },
+		{ UI_SET_KEYBIT, BTN_LEFT },
+		{ UI_SET_KEYBIT, BTN_RIGHT },
+		{ UI_SET_KEYBIT, KEY_ZOOMIN },
+		{ UI_SET_KEYBIT, KEY_ZOOMOUT },
+		{ UI_SET_KEYBIT, KEY_BACK },
+		{ UI_SET_KEYBIT, KEY_FORWARD },
+		{ UI_SET_EVBIT, EV_REL },
+		{ UI_SET_RELBIT, REL_WHEEL },
+	};
+	for (const auto &bit: bits)
+		if (-1 == ioctl (uinput, bit.request, bit.code))
+			throw std::system_error (errno, std::system_category (), "ioctl");
+}
+
+void TouchpadGestures::frame (const HIDPP20::ITouchpadRawXY::TouchpadRawData &data,
+			      std::chrono::steady_clock::time_point time,
+			      UInputEmitter &emitter)
+{
+	bool touching[SlotCount] = { false, false };
+	unsigned int count = 0;
+	for (const auto &point: data.points) {
+		// Contact IDs start at 1, slot i holds contact i+1
+		if (point.id <= 0 || point.id > static_cast<int> (SlotCount))
+			continue;
+		auto &slot = _slots[point.id-1];
+		touching[point.id-1] = true;
+		++count;
+		if (!slot.touching) {
+			slot.touching = true;
+			slot.start_x = point.x;
+			slot.start_y = point.y;
+		}
+		slot.x = point.x;
+		slot.y = point.y;
+		if (std::abs (slot.x-slot.start_x) > _tap_distance ||
+				std::abs (slot.y-slot.start_y) > _tap_distance)
+			_moved = true;
+	}
+	for (unsigned int i = 0; i < SlotCount; ++i)
+		if (!touching[i])
+			_slots[i].touching = false;
+	unsigned int previous_count = _fingers;
+	_fingers = count;
+
+	if (count == 0) {
+		// Every finger is lifted, finish the gesture
+		if (_state == State::Touching && !_moved && time - _start_time < TapTime)
+			click (_max_fingers == 1 ? BTN_LEFT : BTN_RIGHT, emitter);
+		else if (_state == State::Swiping) {
+			if (_swipe_dx > _swipe_distance)
+				click (KEY_BACK, emitter);
+			else if (_swipe_dx < -_swipe_distance)
+				click (KEY_FORWARD, emitter);
+		}
+		_state = State::Idle;
+		_max_fingers = 0;
+		_moved = false;
+		return;
+	}
+
+	if (_state == State::Idle) {
+		_state = State::Touching;
+		_start_time = time;
+	}
+	_max_fingers = std::max (_max_fingers, count);
+	if (count != SlotCount)
+		return;
+	if (previous_count != SlotCount)
+		startTwoFingers ();
+
+	switch (_state) {
+	case State::Touching: {
+		int dx = centroidX () - _start_cx;
+		int dy = centroidY () - _start_cy;
+		int ds = spread () - _start_spread;
+		int motion = std::max (std::abs (dx), std::abs (dy));
+		if (std::abs (ds) > _gesture_distance && std::abs (ds) > motion)
+			_state = State::Pinching;
+		else if (motion > _gesture_distance)
+			_state = std::abs (dy) >= std::abs (dx) ? State::Scrolling : State::Swiping;
+		break;
+	}
+	case State::Scrolling:
+		// Moving the fingers up scrolls up
+		while (centroidY () - _ref_cy <= -_scroll_step) {
+			emitter.push (EV_REL, REL_WHEEL, 1);
+			_ref_cy -= _scroll_step;
+		}
+		while (centroidY () - _ref_cy >= _scroll_step) {
+			emitter.push (EV_REL, REL_WHEEL, -1);
+			_ref_cy += _scroll_step;
+		}
+		break;
+	case State::Pinching:
+		while (spread () - _ref_spread >= _pinch_step) {
+			click (KEY_ZOOMIN, emitter);
+			_ref_spread += _pinch_step;
+		}
+		while (spread () - _ref_spread <= -_pinch_step) {
+			click (KEY_ZOOMOUT, emitter);
+			_ref_spread -= _pinch_step;
+		}
+		break;
+	case State::Swiping:
+		_swipe_dx = centroidX () - _start_cx;
+		break;
+	default:
+		break;
+	}
+}
+
+void TouchpadGestures::startTwoFingers ()
+{
+	_start_cx = centroidX ();
+	_start_cy = _ref_cy = centroidY ();
+	_start_spread = _ref_spread = spread ();
+	_swipe_dx = 0;
+}
+
+void TouchpadGestures::click (int code, UInputEmitter &emitter)
+{
+	// Press and release are sent in separate frames
+	emitter.push (EV_KEY, code, 1);
+	emitter.sync ();
+	emitter.push (EV_KEY, code, 0);
+}
+
+int TouchpadGestures::centroidX () const
+{
+	return (_slots[0].x + _slots[1].x) / 2;
+}
+
+int TouchpadGestures::centroidY () const
+{
+	return (_slots[0].y + _slots[1].y) / 2;
+}
+
+int TouchpadGestures::spread () const
+{
+	return std::hypot (_slots[0].x - _slots[1].x, _slots[0].y - _slots[1].y);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TOUCHPAD_GESTURES_H
+#define TOUCHPAD_GESTURES_H
+
+#include <chrono>
+
+#include <hidpp20/ITouchpadRawXY.h>
+
+#include "UInputEmitter.h"
+
+/**
+ * Recognize gestures from raw touchpad frames and emit them as input
+ * events:
+ *  - one finger tap: left click (BTN_LEFT),
+ *  - two finger tap: right click (BTN_RIGHT),
+ *  - two finger vertical scroll: wheel (REL_WHEEL),
+ *  - pinch: KEY_ZOOMIN / KEY_ZOOMOUT,
+ *  - two finger horizontal swipe: KEY_BACK / KEY_FORWARD.
+ *
+ * The state is fixed-size and processing a frame does not allocate.
+ */
+class TouchpadGestures
+{
+public:
+	/**
+	 * Thresholds are relative to the touchpad size.
+	 */
+	TouchpadGestures (unsigned int x_max, unsigned int y_max);
+
+	/**
+	 * Enable the event codes used for gestures on a uinput device
+	 * before it is created.
+	 *
+	 * \throws std::system_error
+	 */
+	static void setupDevice (int uinput);
+
+	/**
+	 * Process a frame (with the same coordinates as the ABS events)
+	 * and push the gesture events in \p emitter.
+	 */
+	void frame (const HIDPP20::ITouchpadRawXY::TouchpadRawData &data,
+		    std::chrono::steady_clock::time_point time,
+		    UInputEmitter &emitter);
+
+private:
+	static constexpr unsigned int SlotCount = 2;
+
+	enum class State {
+		Idle,
+		Touching, // gesture not recognized yet
+		Scrolling,
+		Pinching,
+		Swiping,
+	};
+
+	struct Slot {
+		bool touching;
+		int x, y;
+		int start_x, start_y;
+	};
+
+	void startTwoFingers ();
+	void click (int code, UInputEmitter &emitter);
+	int centroidX () const;
+	int centroidY () const;
+	int spread () const;
+
+	int _tap_distance;
+	int _gesture_distance;
+	int _scroll_step;
+	int _pinch_step;
+	int _swipe_distance;
+
+	State _state;
+	Slot _slots[SlotCount];
+	unsigned int _fingers, _max_fingers;
+	bool _moved;
+	std::chrono::steady_clock::time_point _start_time;
+	// Two finger reference positions, updated as steps are emitted
+	int _start_cx, _start_cy, _start_spread;
+	int _ref_cy, _ref_spread;
+	int _swipe_dx;
+};
+
+#endif
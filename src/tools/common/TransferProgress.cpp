@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "TransferProgress.h"
+
+#include <cstdlib>
+
+TransferProgress::TransferProgress (std::size_t total, FILE *out):
+	_total (total),
+	_out (out),
+	_done (0),
+	_start (clock::now ()),
+	_last_print (_start)
+{
+}
+
+void TransferProgress::advance (std::size_t bytes)
+{
+	_done += bytes;
+	auto now = clock::now ();
+	if (now - _last_print >= std::chrono::milliseconds (100)) {
+		_last_print = now;
+		print ();
+	}
+}
+
+void TransferProgress::finish ()
+{
+	print ();
+	if (_out)
+		fputc ('\n', _out);
+}
+
+void TransferProgress::print ()
+{
+	if (!_out)
+		return;
+	std::chrono::duration<double> elapsed = clock::now () - _start;
+	double rate = elapsed.count () > 0 ? _done / elapsed.count () : 0;
+	if (_total)
+		fprintf (_out, "\r%zu/%zu bytes (%u%%), %.0f B/s", _done, _total,
+			 static_cast<unsigned int> (100 * _done / _total), rate);
+	else
+		fprintf (_out, "\r%zu bytes, %.0f B/s", _done, rate);
+	fflush (_out);
+}
+
+bool parsePageRange (const char *arg, unsigned int &first, unsigned int &last)
+{
+	char *end;
+	first = strtoul (arg, &end, 0);
+	if (end == arg)
+		return false;
+	if (*end == '\0') {
+		last = first;
+		return true;
+	}
+	if (*end != '-')
+		return false;
+	const char *second = end + 1;
+	last = strtoul (second, &end, 0);
+	return end != second && *end == '\0' && first <= last;
+}
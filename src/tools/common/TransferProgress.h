@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TRANSFER_PROGRESS_H
+#define TRANSFER_PROGRESS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+/**
+ * Progress of a bulk transfer printed on a single line, with its
+ * throughput in bytes per second.
+ */
+class TransferProgress
+{
+public:
+	/**
+	 * \param total	Number of bytes to transfer, 0 if unknown.
+	 * \param out	Stream for the progress line, nothing is printed if null.
+	 */
+	TransferProgress (std::size_t total, FILE *out = stderr);
+
+	/**
+	 * Add \p bytes transferred, the line is refreshed at most ten times
+	 * per second.
+	 */
+	void advance (std::size_t bytes);
+	/**
+	 * Print the final line.
+	 */
+	void finish ();
+
+private:
+	void print ();
+
+	typedef std::chrono::steady_clock clock;
+	const std::size_t _total;
+	FILE *_out;
+	std::size_t _done;
+	clock::time_point _start, _last_print;
+};
+
+/**
+ * Parse a page number or an inclusive "first-last" range.
+ */
+bool parsePageRange (const char *arg, unsigned int &first, unsigned int &last);
+
+#endif
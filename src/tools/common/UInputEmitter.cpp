@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "UInputEmitter.h"
+
+#include <cerrno>
+#include <system_error>
+
+extern "C" {
+#include <unistd.h>
+}
+
+UInputEmitter::UInputEmitter (int fd):
+	_fd (fd),
+	_count (0)
+{
+}
+
+void UInputEmitter::push (int type, int code, int value)
+{
+	if (_count == MaxEvents)
+		flush ();
+	auto &ev = _events[_count++];
+	ev = {};
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+}
+
+void UInputEmitter::sync ()
+{
+	push (EV_SYN, SYN_REPORT, 0);
+	flush ();
+}
+
+void UInputEmitter::flush ()
+{
+	if (_count == 0)
+		return;
+	// uinput accepts any number of whole events in one write
+	ssize_t size = _count * sizeof (struct input_event);
+	_count = 0;
+	ssize_t ret;
+	do {
+		ret = write (_fd, _events.data (), size);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+		throw std::system_error (errno, std::system_category (), "write");
+}
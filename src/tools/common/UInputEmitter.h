@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef UINPUT_EMITTER_H
+#define UINPUT_EMITTER_H
+
+#include <array>
+
+extern "C" {
+#include <linux/input.h>
+}
+
+/**
+ * Collect the input events of a frame and send them to a uinput
+ * device with a single write.
+ *
+ * The emitter is meant to live on the stack for the duration of one
+ * frame:
+ *
+ *     UInputEmitter emitter (fd);
+ *     emitter.push (EV_ABS, ABS_X, x);
+ *     emitter.push (EV_ABS, ABS_Y, y);
+ *     emitter.sync ();
+ */
+class UInputEmitter
+{
+public:
+	static constexpr unsigned int MaxEvents = 64;
+
+	/**
+	 * Events that are not sent when the emitter is destroyed are
+	 * discarded.
+	 */
+	UInputEmitter (int fd);
+
+	/**
+	 * Add an event to the frame.
+	 *
+	 * The pending events are sent first if the buffer is full.
+	 *
+	 * \throws std::system_error if the write fails.
+	 */
+	void push (int type, int code, int value);
+
+	/**
+	 * Add a SYN_REPORT event and send the frame.
+	 *
+	 * \throws std::system_error if the write fails.
+	 */
+	void sync ();
+
+	/**
+	 * Send the pending events.
+	 *
+	 * \throws std::system_error if the write fails.
+	 */
+	void flush ();
+
+private:
+	int _fd;
+	unsigned int _count;
+	std::array<struct input_event, MaxEvents> _events;
+};
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <hidpp/DispatcherThread.h>
+#include <hidpp10/Error.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IRoot.h>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+
+using std::chrono::steady_clock;
+
+/**
+ * Outcome of a closed loop run against one device.
+ */
+struct Result
+{
+	std::string connection;
+	std::vector<double> rtt_us; // answered commands, including error replies
+	unsigned long timeouts = 0;
+	unsigned long errors = 0;
+	unsigned long mismatches = 0;
+	unsigned long failures = 0;
+	double duration = 0; // seconds
+
+	void merge (const Result &other)
+	{
+		rtt_us.insert (rtt_us.end (), other.rtt_us.begin (), other.rtt_us.end ());
+		timeouts += other.timeouts;
+		errors += other.errors;
+		mismatches += other.mismatches;
+		failures += other.failures;
+		duration += other.duration;
+	}
+};
+
+struct LoopSettings
+{
+	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	uint8_t feature_index = HIDPP20::IRoot::index;
+	unsigned int function = HIDPP20::IRoot::Ping;
+	unsigned int concurrency = 1;
+	unsigned long count = 1000;
+	int timeout = 1000;
+};
+
+static const char *connectionType (const HIDPP::DispatcherThread &dispatcher, HIDPP::DeviceIndex index)
+{
+	if (index >= HIDPP::WirelessDevice1 && index <= HIDPP::WirelessDevice6)
+		return "receiver";
+	switch (dispatcher.hidraw ().bus ()) {
+	case HID::RawDevice::Bus::USB:
+		return "corded";
+	case HID::RawDevice::Bus::Bluetooth:
+		return "bluetooth";
+	default:
+		return "unknown";
+	}
+}
+
+/**
+ * Keep \p settings.concurrency commands in flight until \p settings.count
+ * commands are completed.
+ *
+ * Each completion handler records the round-trip time and sends the
+ * next command from the dispatcher thread. Ping commands carry a
+ * sequence byte that the device echoes, so that answers matched with
+ * the wrong command (e.g. late answers to timed out commands reusing
+ * a software ID) are counted as mismatches.
+ */
+static Result runLoop (HIDPP::DispatcherThread &dispatcher, const LoopSettings &settings)
+{
+	Result result;
+	result.connection = connectionType (dispatcher, settings.device_index);
+	result.rtt_us.reserve (settings.count);
+	bool ping = settings.feature_index == HIDPP20::IRoot::index &&
+		    settings.function == HIDPP20::IRoot::Ping;
+	auto type = dispatcher.reportInfo ().findReport ();
+	if (!type)
+		throw std::runtime_error ("The device does not support HID++ reports");
+
+	std::mutex mutex;
+	std::condition_variable done_cond;
+	unsigned long sent = 0, completed = 0;
+	bool send_failed = false;
+	uint8_t sequence = 0;
+	std::function<void ()> send;
+	send = [&] () {
+		// called with mutex locked
+		HIDPP::Report request (*type, settings.device_index,
+				       settings.feature_index, settings.function,
+				       dispatcher.nextSoftwareID ());
+		uint8_t seq = sequence++;
+		if (ping)
+			request.parameterBegin ()[2] = seq;
+		++sent;
+		auto start = steady_clock::now ();
+		auto handler = [&, seq, start] (const HIDPP::Report *response, std::exception_ptr error) {
+			auto rtt = std::chrono::duration<double, std::micro> (steady_clock::now () - start).count ();
+			std::unique_lock<std::mutex> lock (mutex);
+			if (response) {
+				result.rtt_us.push_back (rtt);
+				if (ping && response->parameterBegin ()[2] != seq)
+					++result.mismatches;
+			}
+			else {
+				try {
+					std::rethrow_exception (error);
+				}
+				catch (HIDPP::Dispatcher::TimeoutError &) {
+					++result.timeouts;
+				}
+				catch (HIDPP10::Error &) {
+					// HID++1.0 receivers answer pings with an error, it is still a round trip
+					result.rtt_us.push_back (rtt);
+					++result.errors;
+				}
+				catch (HIDPP20::Error &) {
+					result.rtt_us.push_back (rtt);
+					++result.errors;
+				}
+				catch (std::exception &) {
+					++result.failures;
+				}
+			}
+			++completed;
+			if (sent < settings.count && !send_failed)
+				send ();
+			done_cond.notify_all ();
+		};
+		try {
+			dispatcher.sendCommand (std::move (request), std::move (handler), settings.timeout);
+		}
+		catch (std::exception &e) {
+			fprintf (stderr, "Failed to send command: %s\n", e.what ());
+			++result.failures;
+			++completed;
+			send_failed = true;
+		}
+	};
+
+	auto start = steady_clock::now ();
+	std::unique_lock<std::mutex> lock (mutex);
+	while (sent < std::min<unsigned long> (settings.concurrency, settings.count) && !send_failed)
+		send ();
+	done_cond.wait (lock, [&] () { return completed == sent && (sent == settings.count || send_failed); });
+	result.duration = std::chrono::duration<double> (steady_clock::now () - start).count ();
+	return result;
+}
+
+static double percentile (const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty ())
+		return 0;
+	std::size_t i = static_cast<std::size_t> (p * (sorted.size () - 1) + 0.5);
+	return sorted[std::min (i, sorted.size () - 1)];
+}
+
+static void printResult (const char *name, Result result)
+{
+	std::sort (result.rtt_us.begin (), result.rtt_us.end ());
+	printf ("%s (%s):\n", name, result.connection.c_str ());
+	printf ("  answered: %zu, timeouts: %lu, error replies: %lu, mismatched: %lu, failed: %lu\n",
+		result.rtt_us.size (), result.timeouts, result.errors,
+		result.mismatches, result.failures);
+	if (!result.rtt_us.empty ())
+		printf ("  rtt (us): p50 %.0f, p90 %.0f, p99 %.0f, max %.0f\n",
+			percentile (result.rtt_us, 0.50),
+			percentile (result.rtt_us, 0.90),
+			percentile (result.rtt_us, 0.99),
+			result.rtt_us.back ());
+	if (result.duration > 0)
+		printf ("  throughput: %.1f commands/s over %.3f s\n",
+			result.rtt_us.size () / result.duration, result.duration);
+}
+
+static bool parseUnsigned (const char *optarg, unsigned long min, unsigned long max, unsigned long &value)
+{
+	char *endptr;
+	value = strtoul (optarg, &endptr, 0);
+	return *endptr == '\0' && value >= min && value <= max;
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "/dev/hidrawX...";
+	LoopSettings settings;
+	std::chrono::microseconds busy_poll (0);
+
+	std::vector<Option> options = {
+		DeviceIndexOption (settings.device_index),
+		VerboseOption (),
+		DaemonOption (),
+		BusyPollOption (busy_poll),
+		Option ('c', "concurrency",
+			Option::RequiredArgument, "count",
+			"Number of commands kept in flight (default: 1, at most 15)",
+			[&settings] (const char *optarg) -> bool {
+				unsigned long value;
+				if (!parseUnsigned (optarg, 1, HIDPP::Dispatcher::MaxSoftwareID, value)) {
+					fprintf (stderr, "Invalid concurrency.\n");
+					return false;
+				}
+				settings.concurrency = value;
+				return true;
+			}),
+		Option ('n', "count",
+			Option::RequiredArgument, "count",
+			"Number of commands sent to each device (default: 1000)",
+			[&settings] (const char *optarg) -> bool {
+				if (!parseUnsigned (optarg, 1, ULONG_MAX, settings.count)) {
+					fprintf (stderr, "Invalid command count.\n");
+					return false;
+				}
+				return true;
+			}),
+		Option ('t', "timeout",
+			Option::RequiredArgument, "ms",
+			"Command timeout in milliseconds (default: 1000)",
+			[&settings] (const char *optarg) -> bool {
+				unsigned long value;
+				if (!parseUnsigned (optarg, 1, INT_MAX, value)) {
+					fprintf (stderr, "Invalid timeout.\n");
+					return false;
+				}
+				settings.timeout = value;
+				return true;
+			}),
+		Option ('f', "function",
+			Option::RequiredArgument, "feature_index:function",
+			"Send this function with null parameters instead of IRoot Ping (it must have no side effect)",
+			[&settings] (const char *optarg) -> bool {
+				unsigned int feature_index, function;
+				char end;
+				if (sscanf (optarg, "%i:%i%c", &feature_index, &function, &end) != 2 ||
+						feature_index > 0xff || function > 0x0f) {
+					fprintf (stderr, "Invalid function.\n");
+					return false;
+				}
+				settings.feature_index = feature_index;
+				settings.function = function;
+				return true;
+			}),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg < 1) {
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	int ret = EXIT_SUCCESS;
+	std::map<std::string, Result> by_connection;
+	for (int i = first_arg; i < argc; ++i) {
+		const char *path = argv[i];
+		try {
+			HIDPP::DispatcherThread dispatcher (path);
+			dispatcher.hidraw ().setBusyPoll (busy_poll);
+			std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+			Result result;
+			try {
+				result = runLoop (dispatcher, settings);
+			}
+			catch (std::exception &e) {
+				dispatcher.stop ();
+				thread.join ();
+				throw;
+			}
+			dispatcher.stop ();
+			thread.join ();
+			printResult (path, result);
+			by_connection[result.connection].merge (result);
+			by_connection[result.connection].connection = result.connection;
+		}
+		catch (std::exception &e) {
+			fprintf (stderr, "%s: %s\n", path, e.what ());
+			ret = EXIT_FAILURE;
+		}
+	}
+	if (argc-first_arg > 1)
+		for (const auto &[connection, result]: by_connection)
+			printResult ("all devices", result);
+	return ret;
+}
@@ -17,6 +17,20 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef __linux__
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <hidpp/SimpleDispatcher.h>
 #include <hidpp/Device.h>
@@ -27,14 +41,116 @@
 #include "common/Option.h"
 #include "common/CommonOptions.h"
 
+/**
+ * HID device of a hidraw node, read from sysfs without opening the node.
+ */
+struct SysfsInfo
+{
+	std::string devpath; ///< parent of the HID device, stable across replugs
+	uint16_t vendor_id, product_id;
+	std::vector<uint8_t> descriptor;
+};
+
+static std::optional<SysfsInfo> readSysfsInfo (const std::string &path)
+{
+#ifdef __linux__
+	std::string dir = "/sys/class/hidraw/" + path.substr (path.find_last_of ('/') + 1) + "/device";
+	SysfsInfo info;
+	char real[PATH_MAX];
+	if (!realpath (dir.c_str (), real))
+		return std::nullopt;
+	info.devpath = real;
+	info.devpath.erase (info.devpath.find_last_of ('/'));
+	std::ifstream uevent (dir + "/uevent");
+	std::string line;
+	bool has_id = false;
+	while (std::getline (uevent, line)) {
+		unsigned int bus, vid, pid;
+		if (sscanf (line.c_str (), "HID_ID=%x:%x:%x", &bus, &vid, &pid) == 3) {
+			info.vendor_id = vid;
+			info.product_id = pid;
+			has_id = true;
+		}
+	}
+	std::ifstream file (dir + "/report_descriptor", std::ios::binary);
+	info.descriptor.assign (std::istreambuf_iterator<char> (file), std::istreambuf_iterator<char> ());
+	if (!has_id || info.descriptor.empty ())
+		return std::nullopt;
+	return info;
+#else
+	return std::nullopt;
+#endif
+}
+
+/**
+ * Cache of devices known to support HID++: one line per device with its
+ * devpath, IDs, device index and protocol version. Lines are only
+ * appended, with a single write, so that concurrent runs (e.g. from udev)
+ * do not corrupt it.
+ */
+static std::string cacheKey (const SysfsInfo &info, HIDPP::DeviceIndex index)
+{
+	char ids[32];
+	snprintf (ids, sizeof (ids), " %04hx %04hx %d", info.vendor_id, info.product_id, index);
+	return info.devpath + ids;
+}
+
+static std::optional<std::tuple<unsigned int, unsigned int>> findCached (const char *cache_path, const std::string &key)
+{
+	std::ifstream file (cache_path);
+	std::string line;
+	std::optional<std::tuple<unsigned int, unsigned int>> version;
+	while (std::getline (file, line)) {
+		unsigned int major, minor;
+		if (line.size () > key.size () && line.compare (0, key.size (), key) == 0 &&
+				line[key.size ()] == ' ' &&
+				sscanf (line.c_str () + key.size (), "%u.%u", &major, &minor) == 2)
+			version = std::make_tuple (major, minor);
+	}
+	return version;
+}
+
+static void storeCached (const char *cache_path, const std::string &key, unsigned int major, unsigned int minor)
+{
+	std::ostringstream line;
+	line << key << " " << major << "." << minor << "\n";
+	std::string data = line.str ();
+#ifdef __linux__
+	int fd = open (cache_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1 || write (fd, data.data (), data.size ()) != static_cast<ssize_t> (data.size ()))
+		Log::warning () << "Failed to store the result in " << cache_path << std::endl;
+	if (fd != -1)
+		close (fd);
+#else
+	std::ofstream (cache_path, std::ios::app) << data;
+#endif
+}
+
 int main (int argc, char *argv[])
 {
 	static const char *args = "device_path";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	bool quick = false;
+	const char *cache_path = nullptr;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
+		Option ('q', "quick",
+			Option::NoArgument, "",
+			"Only check that the report descriptor, read from sysfs, has HID++ reports. The device is not opened and nothing is printed.",
+			[&quick] (const char *) -> bool {
+				quick = true;
+				return true;
+			}),
+		Option ('c', "cache",
+			Option::RequiredArgument, "file",
+			"Remember the devices supporting HID++ in file, by device path, IDs and index, and do not open them again.",
+			[&cache_path] (const char *optarg) -> bool {
+				cache_path = optarg;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -50,6 +166,30 @@ int main (int argc, char *argv[])
 
 	const char *path = argv[first_arg];
 
+	// Without sysfs, fall back to opening the device.
+	auto info = readSysfsInfo (path);
+	if (quick && info) {
+		try {
+			if (HIDPP::Dispatcher::reportFlags (info->descriptor.data (), info->descriptor.size ()) != 0)
+				return EXIT_SUCCESS;
+		}
+		catch (std::exception &e) {
+			Log::info () << "Invalid report descriptor: " << e.what () << std::endl;
+			return EXIT_FAILURE;
+		}
+		Log::info () << "Device is not a HID++ device" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::string key;
+	if (cache_path && info) {
+		key = cacheKey (*info, device_index);
+		if (auto version = findCached (cache_path, key)) {
+			auto [major, minor] = *version;
+			printf ("%d.%d\n", major, minor);
+			return EXIT_SUCCESS;
+		}
+	}
+
 	try {
 		unsigned int major, minor;
 		HIDPP::SimpleDispatcher dispatcher (path);
@@ -57,6 +197,8 @@ int main (int argc, char *argv[])
 			HIDPP::Device dev (&dispatcher, device_index);
 			std::tie (major, minor) = dev.protocolVersion ();
 			printf ("%d.%d\n", major, minor);
+			if (!key.empty ())
+				storeCached (cache_path, key, major, minor);
 			Log::info ().printf ("Device is %s (%04hx:%04hx)\n",
 					     dev.name ().c_str (),
 					     dispatcher.hidraw ().vendorID (), dev.productID ());
@@ -21,8 +21,9 @@
 
 #include <misc/Log.h>
 #include <hid/DeviceMonitor.h>
-#include <hidpp/SimpleDispatcher.h>
-#include <hidpp/Device.h>
+#include <hid/InterfaceRoleCache.h>
+#include <hidpp/Dispatcher.h>
+#include <hidpp/Probe.h>
 #include <hidpp10/Error.h>
 #include <hidpp20/Error.h>
 
@@ -30,72 +31,82 @@
 #include "common/Option.h"
 #include "common/CommonOptions.h"
 
-class DevicePrinter: public HID::DeviceMonitor
+class DeviceCollector: public HID::DeviceMonitor
 {
+public:
+	std::vector<std::string> paths;
+
 protected:
 	void addDevice (const char *path)
 	{
-		try {
-			HIDPP::SimpleDispatcher dispatcher (path);
-			bool has_receiver_index = false;
-			for (HIDPP::DeviceIndex index: {
-					HIDPP::DefaultDevice,
-					HIDPP::CordedDevice,
-					HIDPP::WirelessDevice1,
-					HIDPP::WirelessDevice2,
-					HIDPP::WirelessDevice3,
-					HIDPP::WirelessDevice4,
-					HIDPP::WirelessDevice5,
-					HIDPP::WirelessDevice6 }) {
-				// Skip wireless devices, if the default index (used by the receiver) already failed.
-				if (!has_receiver_index && index == HIDPP::WirelessDevice1)
-					break;
-				try {
-					HIDPP::Device dev (&dispatcher, index);
-					auto version = dev.protocolVersion ();
-					printf ("%s", path);
-					if (index != HIDPP::DefaultDevice)
-						printf (" (device %d)", index);
-					printf (": %s (%04hx:%04hx) HID++ %d.%d\n",
-							dev.name ().c_str (),
-							dispatcher.hidraw ().vendorID (), dev.productID (),
-							std::get<0> (version), std::get<1> (version));
-					if (index == HIDPP::DefaultDevice && version == std::make_tuple (1, 0))
-						has_receiver_index = true;
-				}
-				catch (HIDPP10::Error &e) {
-					if (e.errorCode () != HIDPP10::Error::UnknownDevice && e.errorCode () != HIDPP10::Error::InvalidSubID) {
-						Log::error ().printf ("Error while querying %s wireless device %d: %s\n",
-								      path, index, e.what ());
-					}
-				}
-				catch (HIDPP20::Error &e) {
-					if (e.errorCode () != HIDPP20::Error::UnknownDevice) {
-						Log::error ().printf ("Error while querying %s device %d: %s\n",
-								      path, index, e.what ());
-					}
-				}
-				catch (HIDPP::Dispatcher::TimeoutError &e) {
-					Log::warning ().printf ("Device %s (index %d) timed out\n",
-								path, index);
-				}
-			}
+		paths.push_back (path);
+	}
+
+	void removeDevice (const char *path) { }
+};
 
+static void printResult (const HIDPP::ProbeResult &result)
+{
+	const char *path = result.path.c_str ();
+	auto index = result.index;
+	if (!result.error) {
+		printf ("%s", path);
+		if (index != HIDPP::DefaultDevice)
+			printf (" (device %d)", index);
+		printf (": %s (%04hx:%04hx) HID++ %d.%d\n",
+				result.name.c_str (),
+				result.vendor_id, result.product_id,
+				std::get<0> (result.version), std::get<1> (result.version));
+		return;
+	}
+	try {
+		std::rethrow_exception (result.error);
+	}
+	catch (HIDPP10::Error &e) {
+		if (e.errorCode () == HIDPP10::Error::ResourceError) {
+			Log::warning ().printf ("Device %s (index %d) is not connected\n",
+						path, index);
 		}
-		catch (HIDPP::Dispatcher::NoHIDPPReportException &e) {
+		else if (e.errorCode () != HIDPP10::Error::UnknownDevice && e.errorCode () != HIDPP10::Error::InvalidSubID) {
+			Log::error ().printf ("Error while querying %s wireless device %d: %s\n",
+					      path, index, e.what ());
 		}
-		catch (std::system_error &e) {
-			Log::warning ().printf ("Failed to open %s: %s\n", path, e.what ());
+	}
+	catch (HIDPP20::Error &e) {
+		if (e.errorCode () != HIDPP20::Error::UnknownDevice) {
+			Log::error ().printf ("Error while querying %s device %d: %s\n",
+					      path, index, e.what ());
 		}
 	}
-
-	void removeDevice (const char *path) { }
-};
+	catch (HIDPP::Dispatcher::TimeoutError &e) {
+		Log::warning ().printf ("Device %s (index %d) timed out\n",
+					path, index);
+	}
+	catch (HIDPP::Dispatcher::NoHIDPPReportException &e) {
+	}
+	catch (std::system_error &e) {
+		Log::warning ().printf ("Failed to open %s: %s\n", path, e.what ());
+	}
+	catch (std::exception &e) {
+		Log::error ().printf ("Error while querying %s device %d: %s\n",
+				      path, index, e.what ());
+	}
+}
 
 int main (int argc, char *argv[])
 {
+	const char *interface_cache_path = nullptr;
+
 	std::vector<Option> options = {
 		VerboseOption (),
+		DaemonOption (),
+		Option ('i', "interface-cache",
+			Option::RequiredArgument, "file",
+			"Remember which interfaces of each model have HID++ reports in file.",
+			[&interface_cache_path] (const char *optarg) -> bool {
+				interface_cache_path = optarg;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], "", &options);
 	options.push_back (help);
@@ -109,7 +120,15 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	(DevicePrinter ()).enumerate ();
+	std::shared_ptr<HID::InterfaceRoleCache> interface_cache;
+	if (interface_cache_path)
+		interface_cache = std::make_shared<HID::InterfaceRoleCache> (interface_cache_path);
+
+	DeviceCollector collector;
+	collector.setFilter (HIDPP::deviceFilter (interface_cache));
+	collector.enumerate ();
+	for (const auto &result: HIDPP::probeDevices (collector.paths))
+		printResult (result);
 
 	return 0;
 }
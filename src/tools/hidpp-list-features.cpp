@@ -17,20 +17,31 @@
  */
 
 #include <cstdio>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <thread>
 
+#include <hid/DeviceMonitor.h>
 #include <hidpp/SimpleDispatcher.h>
+#include <hidpp/DispatcherThread.h>
 #include <hidpp/Device.h>
+#include <hidpp/Probe.h>
 #include <hidpp10/Device.h>
 #include <hidpp10/Error.h>
 #include <hidpp10/IIndividualFeatures.h>
+#include <hidpp20/DescriptorCache.h>
 #include <hidpp20/Device.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IDeviceInformation.h>
 #include <hidpp20/IFeatureSet.h>
 #include <misc/Log.h>
 
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
+#include "common/DeviceSelector.h"
+#include "common/Executor.h"
 
 static const std::map<uint16_t, const char *> HIDPP20Features = {
 	{ 0x0000, "Root" },
@@ -176,23 +187,235 @@ void testRegister (HIDPP10::Device *dev, std::size_t register_size, uint8_t addr
 	}
 }
 
+static void printFeatures (HIDPP20::Device &dev)
+{
+	HIDPP20::IFeatureSet ifeatureset (&dev);
+	auto features = ifeatureset.getAllFeatureInfo ();
+	for (unsigned int i = 1; i < features.size (); ++i) {
+		uint8_t feature_index = i;
+		const auto &feature = features[i];
+		auto str = HIDPP20Features.find (feature.id);
+		printf ("Feature 0x%02hhx: [0x%04hx] %s",
+			feature_index, feature.id,
+			(str == HIDPP20Features.end () ? "?" : str->second));
+		std::vector<const char *> flag_strings;
+		if (feature.obsolete)
+			flag_strings.push_back ("obsolete");
+		if (feature.hidden)
+			flag_strings.push_back ("hidden");
+		if (feature.internal)
+			flag_strings.push_back ("internal");
+		if (!flag_strings.empty ()) {
+			printf (" (");
+			bool first = true;
+			for (auto str: flag_strings) {
+				if (first)
+					first = false;
+				else
+					printf (", ");
+				printf ("%s", str);
+			}
+			printf (")");
+		}
+		printf ("\n");
+	}
+	if (dev.getFeatureIndex (HIDPP20::IDeviceInformation::ID)) {
+		static const char *entity_types[] = {
+			"main application", "bootloader", "hardware", "touchpad",
+			"optical sensor", "softdevice", "RF companion", "factory application",
+		};
+		auto entities = HIDPP20::IDeviceInformation (&dev).getAllFirmwareInfo ();
+		for (unsigned int i = 0; i < entities.size (); ++i) {
+			const auto &entity = entities[i];
+			printf ("Firmware entity %u: %s %s%s\n", i,
+				entity.type < std::size (entity_types) ? entity_types[entity.type] : "?",
+				entity.version ().c_str (),
+				entity.active ? " (active)" : "");
+		}
+	}
+}
+
+class DeviceCollector: public HID::DeviceMonitor
+{
+public:
+	std::vector<std::string> paths;
+
+protected:
+	void addDevice (const char *path)
+	{
+		paths.push_back (path);
+	}
+
+	void removeDevice (const char *) { }
+};
+
+static std::string quote (const std::string &str)
+{
+	std::string quoted = "\"";
+	for (char c: str) {
+		if (c == '"' || c == '\\')
+			quoted.push_back ('\\');
+		quoted.push_back (c);
+	}
+	quoted.push_back ('"');
+	return quoted;
+}
+
+/**
+ * Inventory record of a probed device, on a single line:
+ *
+ *     path=... index=... id=vvvv:pppp protocol=M.m name="..." features=...
+ *
+ * features lists index:id pairs in hexadecimal, followed by /flags
+ * (o: obsolete, h: hidden, i: internal) when any is set. HID++ 1.0
+ * devices have no features field. Devices whose feature table could
+ * not be read have an error="..." field instead.
+ */
+static std::string inventoryRecord (HIDPP::Dispatcher *dispatcher, const HIDPP::ProbeResult &probe,
+				    const std::shared_ptr<HIDPP20::DescriptorCache> &cache)
+{
+	char buffer[64];
+	std::string record = "path=" + probe.path;
+	record += " index=" + std::to_string (probe.index);
+	snprintf (buffer, sizeof (buffer), " id=%04hx:%04hx protocol=%u.%u",
+		  probe.vendor_id, probe.product_id,
+		  std::get<0> (probe.version), std::get<1> (probe.version));
+	record += buffer;
+	record += " name=" + quote (probe.name);
+	if (std::get<0> (probe.version) < 2)
+		return record;
+	try {
+		HIDPP20::Device dev (dispatcher, probe.index, probe.identity ());
+		if (cache)
+			dev.setDescriptorCache (cache);
+		HIDPP20::IFeatureSet ifeatureset (&dev);
+		std::string features;
+		auto infos = ifeatureset.getAllFeatureInfo ();
+		for (unsigned int i = 1; i < infos.size (); ++i) {
+			const auto &feature = infos[i];
+			snprintf (buffer, sizeof (buffer), "%s%02x:%04hx",
+				  features.empty () ? "" : ",", i, feature.id);
+			features += buffer;
+			if (feature.obsolete || feature.hidden || feature.internal) {
+				features.push_back ('/');
+				if (feature.obsolete)
+					features.push_back ('o');
+				if (feature.hidden)
+					features.push_back ('h');
+				if (feature.internal)
+					features.push_back ('i');
+			}
+		}
+		record += " features=" + features;
+	}
+	catch (std::exception &e) {
+		record += " error=" + quote (e.what ());
+	}
+	return record;
+}
+
+/**
+ * Probe every HID++ node and print one inventory record per device.
+ *
+ * Nodes are probed and inventoried concurrently (one DispatcherThread
+ * per node, devices run on an Executor with a worker per device), and the feature IDs of each
+ * device are read with pipelined calls. Records are printed in node
+ * and index order.
+ */
+static void inventoryAll (const std::shared_ptr<HIDPP20::DescriptorCache> &cache)
+{
+	DeviceCollector collector;
+	collector.setFilter (HIDPP::deviceFilter ());
+	collector.enumerate ();
+	std::map<std::string, std::vector<HIDPP::ProbeResult>> devices;
+	for (const auto &result: HIDPP::probeDevices (collector.paths)) {
+		if (!result.error) {
+			devices[result.path].push_back (result);
+			continue;
+		}
+		try {
+			std::rethrow_exception (result.error);
+		}
+		catch (HIDPP10::Error &e) {
+			// absent wireless device
+		}
+		catch (HIDPP20::Error &e) {
+		}
+		catch (HIDPP::Dispatcher::NoHIDPPReportException &e) {
+		}
+		catch (std::exception &e) {
+			Log::warning ().printf ("Failed to probe %s (device %d): %s\n",
+						result.path.c_str (), result.index, e.what ());
+		}
+	}
+
+	std::vector<const std::pair<const std::string, std::vector<HIDPP::ProbeResult>> *> nodes;
+	std::size_t device_count = 0;
+	for (const auto &node: devices) {
+		nodes.push_back (&node);
+		device_count += node.second.size ();
+	}
+	// Workers mostly wait for the devices
+	Executor executor (std::max<std::size_t> (1, device_count));
+	auto records = executor.map (nodes.size (), [&] (std::size_t i) {
+		const auto &[path, probes] = *nodes[i];
+		std::vector<std::string> records;
+		try {
+			HIDPP::DispatcherThread dispatcher (path.c_str ());
+			std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+			records = executor.map (probes.size (), [&] (std::size_t j) {
+				return inventoryRecord (&dispatcher, probes[j], cache);
+			});
+			dispatcher.stop ();
+			thread.join ();
+		}
+		catch (std::exception &e) {
+			records.push_back ("path=" + path + " error=" + quote (e.what ()));
+		}
+		return records;
+	});
+	for (const auto &node: records)
+		for (const auto &record: node)
+			printf ("%s\n", record.c_str ());
+}
+
 int main (int argc, char *argv[])
 {
-	static const char *args = "device_path";
+	static const char *args = "device_path|--all|selection";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
 	bool do_write_tests = false;
+	bool all = false;
+	const char *cache_path = nullptr;
+	DeviceSelector selector;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 		Option ('w', "write",
 			Option::NoArgument, "",
 			"Also do write tests with HID++ 1.0 devices.",
 			[&do_write_tests] (const char *optarg) -> bool {
 				do_write_tests = true;
 				return true;
-			})
+			}),
+		Option ('a', "all",
+			Option::NoArgument, "",
+			"Print one inventory record for every HID++ device instead of a single device.",
+			[&all] (const char *) -> bool {
+				all = true;
+				return true;
+			}),
+		Option ('c', "cache",
+			Option::RequiredArgument, "file",
+			"Read and store the feature tables in the descriptor cache file.",
+			[&cache_path] (const char *optarg) -> bool {
+				cache_path = optarg;
+				return true;
+			}),
 	};
+	auto selector_options = selector.options ();
+	options.insert (options.end (), selector_options.begin (), selector_options.end ());
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
 
@@ -200,12 +423,24 @@ int main (int argc, char *argv[])
 	if (!Option::processOptions (argc, argv, options, first_arg))
 		return EXIT_FAILURE;
 
-	if (argc-first_arg != 1) {
+	if (argc-first_arg != (all || selector.active () ? 0 : 1)) {
 		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
 		return EXIT_FAILURE;
 	}
 
-	const char *path = argv[first_arg];
+	std::shared_ptr<HIDPP20::DescriptorCache> cache;
+	if (cache_path)
+		cache = std::make_shared<HIDPP20::DescriptorCache> (cache_path);
+
+	if (all) {
+		inventoryAll (cache);
+		return EXIT_SUCCESS;
+	}
+
+	std::string selected_path;
+	if (selector.active () && !selector.select (selected_path, device_index))
+		return EXIT_FAILURE;
+	const char *path = selector.active () ? selected_path.c_str () : argv[first_arg];
 
 	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
 	try {
@@ -285,40 +520,9 @@ int main (int argc, char *argv[])
 	 */
 	else if (major >= 2) {
 		HIDPP20::Device dev (std::move (gdev));
-		HIDPP20::IFeatureSet ifeatureset (&dev);
-
-		unsigned int feature_count = ifeatureset.getCount ();
-		for (unsigned int i = 1; i <= feature_count; ++i) {
-			uint8_t feature_index = i;
-			uint16_t feature_id;
-			bool obsolete, hidden, internal;
-
-			feature_id = ifeatureset.getFeatureID (feature_index, &obsolete, &hidden, &internal);
-			auto str = HIDPP20Features.find (feature_id);
-			printf ("Feature 0x%02hhx: [0x%04hx] %s",
-				feature_index, feature_id,
-				(str == HIDPP20Features.end () ? "?" : str->second));
-			std::vector<const char *> flag_strings;
-			if (obsolete)
-				flag_strings.push_back ("obsolete");
-			if (hidden)
-				flag_strings.push_back ("hidden");
-			if (internal)
-				flag_strings.push_back ("internal");
-			if (!flag_strings.empty ()) {
-				printf (" (");
-				bool first = true;
-				for (auto str: flag_strings) {
-					if (first)
-						first = false;
-					else
-						printf (", ");
-					printf ("%s", str);
-				}
-				printf (")");
-			}
-			printf ("\n");
-		}
+		if (cache)
+			dev.setDescriptorCache (cache);
+		printFeatures (dev);
 	}
 	else {
 		fprintf (stderr, "Unsupported HID++ protocol version.\n");
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <hidpp/MacroSimulator.h>
+#include <hidpp10/MacroFormat.h>
+#include <hidpp10/defs.h>
+#include <hidpp20/MacroFormat.h>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+
+#include "profile/MacroText.h"
+
+static bool parseUnsigned (const char *optarg, unsigned long min, unsigned long max, unsigned long &value)
+{
+	char *endptr;
+	value = strtoul (optarg, &endptr, 0);
+	return *endptr == '\0' && value >= min && value <= max;
+}
+
+static const char *stopString (HIDPP::MacroSimulator::Stop stop)
+{
+	switch (stop) {
+	case HIDPP::MacroSimulator::Stop::End:
+		return "end";
+	case HIDPP::MacroSimulator::Stop::Repeat:
+		return "repeat";
+	case HIDPP::MacroSimulator::Stop::StepLimit:
+		return "step-limit";
+	}
+	return "?";
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "macro_file...";
+	unsigned long hold_time = 1000, step_limit = 100000, page_size = 256;
+
+	std::vector<Option> options = {
+		Option ('H', "hold",
+			Option::RequiredArgument, "ms",
+			"Time the button is held for in milliseconds (default: 1000)",
+			[&hold_time] (const char *optarg) -> bool {
+				if (!parseUnsigned (optarg, 0, UINT_MAX, hold_time)) {
+					fprintf (stderr, "Invalid hold time.\n");
+					return false;
+				}
+				return true;
+			}),
+		Option ('s', "steps",
+			Option::RequiredArgument, "count",
+			"Maximum number of executed items of a run (default: 100000)",
+			[&step_limit] (const char *optarg) -> bool {
+				if (!parseUnsigned (optarg, 1, UINT_MAX, step_limit)) {
+					fprintf (stderr, "Invalid step limit.\n");
+					return false;
+				}
+				return true;
+			}),
+		Option ('p', "page-size",
+			Option::RequiredArgument, "bytes",
+			"Page size of HID++ 2.0 onboard memory (default: 256)",
+			[&page_size] (const char *optarg) -> bool {
+				if (!parseUnsigned (optarg, 64, 65536, page_size)) {
+					fprintf (stderr, "Invalid page size.\n");
+					return false;
+				}
+				return true;
+			}),
+		VerboseOption (),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg < 1) {
+		fprintf (stderr, "Too few arguments.\n");
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	HIDPP::MacroSimulator simulator (hold_time, step_limit);
+	HIDPP10::MacroFormat format10;
+	HIDPP20::MacroFormat format20;
+	int ret = EXIT_SUCCESS;
+	// One line per macro, tab separated for batch processing
+	printf ("File\tTap ms\tHeld ms\tHeld instr\tHeld events\tHeld stop\t"
+		"Loop ms\tLoop events/s\t"
+		"HID++1.0 bytes\tHID++1.0 pages\tHID++2.0 bytes\tHID++2.0 pages\n");
+	for (int i = first_arg; i < argc; ++i) {
+		std::ifstream file (argv[i]);
+		if (!file) {
+			fprintf (stderr, "Failed to open %s.\n", argv[i]);
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		std::stringstream text;
+		text << file.rdbuf ();
+		HIDPP::Macro macro = textToMacro (text.str ());
+		if (macro.begin () == macro.end ()) {
+			fprintf (stderr, "Invalid macro in %s.\n", argv[i]);
+			ret = EXIT_FAILURE;
+			continue;
+		}
+		auto analysis = simulator.analyze (macro);
+		printf ("%s\t%u\t%u\t%u\t%u\t%s\t", argv[i],
+			analysis.tap.duration,
+			analysis.held.duration,
+			analysis.held.instructions,
+			analysis.held.events,
+			stopString (analysis.held.stop));
+		if (analysis.loop) {
+			printf ("%u\t", analysis.loop->iteration_duration);
+			if (std::isinf (analysis.loop->event_rate))
+				printf ("inf\t");
+			else
+				printf ("%.1f\t", analysis.loop->event_rate);
+		}
+		else
+			printf ("-\t-\t");
+		try {
+			auto size = HIDPP::MacroSimulator::size (macro, format10, HIDPP10::PageSize, 2);
+			printf ("%zu\t%zu\t", size.bytes, size.pages);
+		}
+		catch (HIDPP::AbstractMacroFormat::UnsupportedInstruction &e) {
+			printf ("-\t-\t");
+		}
+		try {
+			auto size = HIDPP::MacroSimulator::size (macro, format20, page_size);
+			printf ("%zu\t%zu\n", size.bytes, size.pages);
+		}
+		catch (HIDPP::AbstractMacroFormat::UnsupportedInstruction &e) {
+			printf ("-\t-\n");
+		}
+	}
+	return ret;
+}
@@ -18,13 +18,11 @@
 
 #include <hidpp/SimpleDispatcher.h>
 #include <hidpp/Device.h>
+#include <hidpp/DPIModel.h>
 #include <hidpp10/Device.h>
-#include <hidpp10/DeviceInfo.h>
-#include <hidpp10/Sensor.h>
-#include <hidpp10/IResolution.h>
 #include <hidpp20/Device.h>
-#include <hidpp20/IAdjustableDPI.h>
 #include <cstdio>
+#include <optional>
 
 #include "common/common.h"
 #include "common/Option.h"
@@ -49,138 +47,6 @@ void printDPIRange (unsigned int min, unsigned int max, unsigned int step)
 	printf ("min: %u, max: %u, step: %u\n", min, max, step);
 }
 
-class Operations
-{
-public:
-	const bool separated_axes;
-
-	Operations (bool separated_axes):
-		separated_axes (separated_axes)
-	{
-	}
-
-	virtual void set (unsigned int dpi_x, unsigned int dpi_y) = 0;
-	virtual void get (unsigned int &dpi_x, unsigned int &dpi_y) = 0;
-	virtual void info () = 0;
-};
-
-class Operations10: public Operations
-{
-protected:
-	HIDPP10::Device _dev;
-	const HIDPP10::Sensor *_sensor;
-
-	Operations10 (bool separated_axes, HIDPP10::Device &&dev, const HIDPP10::Sensor *sensor):
-		Operations (separated_axes),
-		_dev (std::move (dev)),
-		_sensor (sensor)
-	{
-	}
-
-public:
-	void info ()
-	{
-		const HIDPP10::ListSensor *list;
-		const HIDPP10::RangeSensor *range;
-		if ((list = dynamic_cast<const HIDPP10::ListSensor *> (_sensor)) != nullptr)
-			printDPIList (list->begin (), list->end ());
-		else if ((range = dynamic_cast<const HIDPP10::RangeSensor *> (_sensor)) != nullptr)
-			printDPIRange (range->minimumResolution (),
-				       range->maximumResolution (),
-				       range->resolutionStepHint ());
-		else
-			printf ("unsupported sensor\n");
-	}
-
-};
-
-class Operations10Type0: public Operations10
-{
-	HIDPP10::IResolution0 _iresolution;
-
-public:
-	Operations10Type0 (HIDPP10::Device &&dev, const HIDPP10::Sensor *sensor):
-		Operations10 (false, std::move (dev), sensor),
-		_iresolution (&_dev, sensor)
-	{
-	}
-
-	void set (unsigned int dpi_x, unsigned int dpi_y)
-	{
-		_iresolution.setCurrentResolution (dpi_x);
-	}
-
-	void get (unsigned int &dpi_x, unsigned int &dpi_y)
-	{
-		dpi_x = _iresolution.getCurrentResolution ();
-	}
-
-};
-
-class Operations10Type3: public Operations10
-{
-	HIDPP10::IResolution3 _iresolution;
-
-public:
-	Operations10Type3 (HIDPP10::Device &&dev, const HIDPP10::Sensor *sensor):
-		Operations10 (true, std::move (dev), sensor),
-		_iresolution (&_dev, sensor)
-	{
-	}
-
-	void set (unsigned int dpi_x, unsigned int dpi_y)
-	{
-		_iresolution.setCurrentResolution (dpi_x, dpi_y);
-	}
-
-	void get (unsigned int &dpi_x, unsigned int &dpi_y)
-	{
-		_iresolution.getCurrentResolution (dpi_x, dpi_y);
-	}
-
-};
-
-class Operations20: public Operations
-{
-	HIDPP20::Device _dev;
-	HIDPP20::IAdjustableDPI _iadjustabledpi;
-	unsigned int _sensor_index;
-
-public:
-	Operations20 (HIDPP20::Device &&dev, unsigned int sensor_index):
-		Operations (false),
-		_dev (std::move (dev)),
-		_iadjustabledpi (&_dev),
-		_sensor_index (sensor_index)
-	{
-	}
-
-	void set (unsigned int dpi_x, unsigned int dpi_y)
-	{
-		_iadjustabledpi.setSensorDPI (_sensor_index, dpi_x);
-	}
-
-	void get (unsigned int &dpi_x, unsigned int &dpi_y)
-	{
-		std::tie (dpi_x, std::ignore) = _iadjustabledpi.getSensorDPI (_sensor_index);
-	}
-
-	void info ()
-	{
-		unsigned int sensor_count = _iadjustabledpi.getSensorCount ();
-		printf ("Sensor count: %u\n", sensor_count);
-		for (unsigned int i = 0; i < sensor_count; ++i) {
-			printf ("%u: ", i);
-			std::vector<unsigned int> list;
-			unsigned int step;
-			if (_iadjustabledpi.getSensorDPIList (i, list, step))
-				printDPIRange (list[0], list[1], step);
-			else
-				printDPIList (list.begin (), list.end ());
-		}
-	}
-};
-
 int main (int argc, char *argv[])
 {
 	static const char *args = "device_path get|set dpi [y_dpi]";
@@ -190,6 +56,7 @@ int main (int argc, char *argv[])
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 		Option ('s', "sensor",
 			Option::RequiredArgument, "sensor_index",
 			"use the sensor sensor_index",
@@ -229,36 +96,34 @@ int main (int argc, char *argv[])
 	unsigned int major, minor;
 	std::tie (major, minor) = dev.protocolVersion ();
 
-	std::unique_ptr<Operations> ops;
-	if (major == 1) {
-		const HIDPP10::MouseInfo *info = HIDPP10::getMouseInfo (dev.productID ());
-		if (!info) {
-			fprintf (stderr, "Unsupported mice.\n");
-			return EXIT_FAILURE;
+	std::optional<HIDPP10::Device> dev10;
+	std::optional<HIDPP20::Device> dev20;
+	std::unique_ptr<HIDPP::DPIModel> model;
+	try {
+		if (major == 1) {
+			dev10.emplace (std::move (dev));
+			model = std::make_unique<HIDPP::DPIModel> (&*dev10);
 		}
-
-		switch (info->iresolution_type) {
-		case HIDPP10::IResolutionType0:
-			ops.reset (new Operations10Type0 (std::move (dev), info->sensor));
-			break;
-		case HIDPP10::IResolutionType3:
-			ops.reset (new Operations10Type3 (std::move (dev), info->sensor));
-			break;
-		default:
-			fprintf (stderr, "Unsupported resolution type.\n");
-			return EXIT_FAILURE;
+		else {
+			dev20.emplace (std::move (dev));
+			model = std::make_unique<HIDPP::DPIModel> (&*dev20);
 		}
 	}
-	else {
-		ops.reset (new Operations20 (HIDPP20::Device (std::move (dev)), sensor));
+	catch (std::exception &e) {
+		fprintf (stderr, "%s.\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	if (sensor < 0 || (unsigned int) sensor >= model->sensorCount ()) {
+		fprintf (stderr, "Invalid sensor index: %d\n", sensor);
+		return EXIT_FAILURE;
 	}
 
 	std::string op = argv[first_arg+1];
 	first_arg += 2;
 	if (op == "get") {
 		unsigned int dpi_x, dpi_y;
-		ops->get (dpi_x, dpi_y);
-		if (ops->separated_axes)
+		std::tie (dpi_x, dpi_y) = model->currentDPI (sensor);
+		if (model->separatedAxes ())
 			printf ("X: %u dpi, Y: %u dpi\n", dpi_x, dpi_y);
 		else
 			printf ("%u dpi\n", dpi_x);
@@ -275,7 +140,7 @@ int main (int argc, char *argv[])
 			fprintf (stderr, "Invalid dpi_x value.\n");
 			return EXIT_FAILURE;
 		}
-		if (ops->separated_axes) {
+		if (model->separatedAxes ()) {
 			if (argc - first_arg < 2) {
 				dpi_y = dpi_x;
 			}
@@ -287,10 +152,24 @@ int main (int argc, char *argv[])
 				}
 			}
 		}
-		ops->set (dpi_x, dpi_y);
+		else {
+			dpi_y = dpi_x;
+		}
+		model->setDPI (sensor, dpi_x, dpi_y);
 	}
 	else if (op == "info") {
-		ops->info ();
+		bool hidpp20 = major != 1; // HID++ 1.0 mice have a single sensor
+		if (hidpp20)
+			printf ("Sensor count: %u\n", model->sensorCount ());
+		for (unsigned int i = 0; i < model->sensorCount (); ++i) {
+			const auto &info = model->sensor (i);
+			if (hidpp20)
+				printf ("%u: ", i);
+			if (info.dpi_step != 0)
+				printDPIRange (info.dpi_list[0], info.dpi_list[1], info.dpi_step);
+			else
+				printDPIList (info.dpi_list.begin (), info.dpi_list.end ());
+		}
 	}
 	else {
 		fprintf (stderr, "Invalid operation: %s\n", op.c_str ());
@@ -21,36 +21,43 @@
 #include <fstream>
 
 #include <hidpp/SimpleDispatcher.h>
-#include <hidpp10/Device.h>
-#include <hidpp20/Device.h>
-#include <hidpp10/ProfileDirectoryFormat.h>
-#include <hidpp20/ProfileDirectoryFormat.h>
-#include <hidpp10/ProfileFormat.h>
-#include <hidpp20/ProfileFormat.h>
-#include <hidpp10/MemoryMapping.h>
-#include <hidpp20/MemoryMapping.h>
-#include <hidpp10/MacroFormat.h>
-#include <hidpp20/MacroFormat.h>
-#include <hidpp10/DeviceInfo.h>
+#include <hidpp/SyncJournal.h>
 #include <misc/Log.h>
 
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
 
+#include "profile/ProfileDevice.h"
 #include "profile/ProfileXML.h"
-
-using namespace HIDPP10;
-using namespace tinyxml2;
+#include "profile/ProfileXMLStream.h"
+#include "profile/ProfileBinary.h"
 
 int main (int argc, char *argv[])
 {
 	static const char *args = "device_path read|write [file]";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	bool binary = false;
+	const char *journal_path = nullptr;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
+		Option ('b', "binary",
+			Option::NoArgument, "",
+			"Read or write profiles in the binary format instead of XML",
+			[&binary] (const char *) -> bool {
+				binary = true;
+				return true;
+			}),
+		Option ('j', "journal",
+			Option::RequiredArgument, "file",
+			"Journal the page writes in file, so that a write interrupted by a disconnection or a timeout resumes from the first page not written when run again",
+			[&journal_path] (const char *optarg) -> bool {
+				journal_path = optarg;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -76,163 +83,89 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	unsigned int major, minor;
-	HIDPP::Device generic_device (dispatcher.get (), device_index);
-	std::tie (major, minor) = generic_device.protocolVersion () ;
-
-	std::unique_ptr<HIDPP::Device> device;
-	std::unique_ptr<HIDPP::AbstractProfileDirectoryFormat> profdir_format;
-	std::unique_ptr<HIDPP::AbstractProfileFormat> profile_format;
-	std::unique_ptr<HIDPP::AbstractMemoryMapping> memory;
-	std::unique_ptr<HIDPP::AbstractMacroFormat> macro_format;
-	HIDPP::Address dir_address, prof_address;
-
-	/*
-	 * HID++ 1.0
-	 */
-	if (major == 1 && minor == 0) {
-		auto dev = new HIDPP10::Device (std::move (generic_device));
-		const HIDPP10::MouseInfo *info = HIDPP10::getMouseInfo (dev->productID ());
-		device.reset (dev);
-		profdir_format = HIDPP10::getProfileDirectoryFormat (dev);
-		profile_format = HIDPP10::getProfileFormat (dev);
-		macro_format = HIDPP10::getMacroFormat (dev);
-		memory.reset (new HIDPP10::MemoryMapping (dev));
-		dir_address = HIDPP::Address { 0, 1, 0 };
-		prof_address = HIDPP::Address { 0, info->default_profile_page, 0 };
-	}
-	/*
-	 * HID++ 2.0 and later
-	 */
-	else if (major >= 2) {
-		auto dev = new HIDPP20::Device (std::move (generic_device));
-		device.reset (dev);
-		profdir_format = HIDPP20::getProfileDirectoryFormat (dev);
-		profile_format = HIDPP20::getProfileFormat (dev);
-		macro_format = HIDPP20::getMacroFormat (dev);
-		memory.reset (new HIDPP20::MemoryMapping (dev));
-		dir_address = HIDPP::Address { HIDPP20::IOnboardProfiles::Writeable, 0, 0 };
-		prof_address = HIDPP::Address { HIDPP20::IOnboardProfiles::Writeable, 1, 0 };
+	std::unique_ptr<ProfileDevice> profile_device;
+	try {
+		profile_device = std::make_unique<ProfileDevice> (HIDPP::Device (dispatcher.get (), device_index));
+		if (journal_path)
+			profile_device->setSyncJournal (std::make_shared<HIDPP::SyncJournal> (journal_path));
 	}
-	else {
-		fprintf (stderr, "Unsupported HID++ protocol version.\n");
+	catch (std::runtime_error &e) {
+		fprintf (stderr, "%s.\n", e.what ());
 		return EXIT_FAILURE;
 	}
+	auto &profdir_format = profile_device->profdir_format;
+	auto &profile_format = profile_device->profile_format;
 
 	ProfileXML profxml (profile_format.get (), profdir_format.get ());
+	ProfileBinary profbin (profile_format.get (), profdir_format.get ());
 
 	if (op == "write") {
-		// Read XML input
-		std::string xml;
+		// Read XML or binary input
 		std::ifstream file;
 		std::istream *input;
 		if (argc-first_arg == 3) {
-			file.open (argv[first_arg+2]);
+			file.open (argv[first_arg+2], std::ios::binary);
 			input = &file;
 		}
 		else {
 			input = &std::cin;
 		}
-		while (*input) {
-			char buffer[4096];
-			input->read (buffer, sizeof (buffer));
-			xml.append (buffer, input->gcount ());
-		}
-
-		// Parse XML
-		tinyxml2::XMLDocument doc;
-		doc.Parse (xml.c_str ());
-		if (doc.Error ()) {
-			fprintf (stderr, "Error parsing XML:\n%s\n", doc.ErrorStr ());
-			return EXIT_FAILURE;
-		}
-
-		HIDPP::ProfileDirectory profdir;
-		std::vector<HIDPP::Profile> profiles;
-		std::vector<std::vector<HIDPP::Macro>> macros;
-
-		const XMLElement *root = doc.RootElement ();
-		const XMLElement *element = root->FirstChildElement ("profile");
-		while (element) {
-			profiles.emplace_back ();
-			auto &profile = profiles.back ();
 
-			profdir.entries.push_back ({ prof_address });
-			auto &entry = profdir.entries.back ();
-
-			macros.emplace_back ();
-			auto &pmacros = macros.back ();
-
-			profxml.read (element, profile, entry, pmacros);
-
-			element = element->NextSiblingElement ("profile");
-			++prof_address.page;
-		}
-
-		// Macro are written from the next page after profiles
-		HIDPP::Address macro_address = prof_address;
-		for (unsigned int i = 0; i < profiles.size (); ++i) {
-			auto &entry = profdir.entries[i];
-			auto &profile = profiles[i];
-			for (unsigned int j = 0; j < profile.buttons.size (); ++j) {
-				auto &button = profile.buttons[j];
-				if (button.type () == HIDPP::Profile::Button::Type::Macro) {
-					auto &macro = macros[i][j];
-					auto next_address = macro.write (*macro_format, *memory, macro_address);
-					button.setMacro (macro_address);
-					macro_address = next_address;
+		try {
+			if (binary) {
+				std::vector<uint8_t> data;
+				while (*input) {
+					char buffer[4096];
+					input->read (buffer, sizeof (buffer));
+					data.insert (data.end (), buffer, buffer + input->gcount ());
 				}
+				HIDPP::ProfileDiff::ProfileSet profiles;
+				profbin.read (data, profiles.directory, profiles.profiles, profiles.macros);
+				profile_device->writeProfiles (profiles);
+			}
+			else {
+				// Profiles are parsed one at a time
+				profile_device->writeProfiles (*input);
 			}
-			auto it = memory->getWritableIterator (entry.profile_address);
-			profile_format->write (profile, it);
 		}
-		{
-			auto it = memory->getWritableIterator (dir_address);
-			profdir_format->write (profdir, it);
+		catch (std::runtime_error &e) {
+			fprintf (stderr, "%s\n", e.what ());
+			return EXIT_FAILURE;
 		}
-
-		memory->sync ();
 	}
 	else if (op == "read") {
-		XMLPrinter printer;
-		XMLDocument doc;
-		XMLElement *root = doc.NewElement ("profiles");
-
-		auto profdir_it = memory->getReadOnlyIterator (dir_address);
-		HIDPP::ProfileDirectory profdir = profdir_format->read (profdir_it);
-		for (const auto &entry: profdir.entries) {
-			auto it = memory->getReadOnlyIterator (entry.profile_address);
-			HIDPP::Profile profile = profile_format->read (it);
-
-			std::vector<HIDPP::Macro> macros;
-			for (const auto &button: profile.buttons) {
-				if (button.type () == HIDPP::Profile::Button::Type::Macro) {
-					macros.emplace_back (*macro_format, *memory, button.macro ());
-					macros.back ().simplify ();
-				}
-				else
-					macros.emplace_back ();
-			}
-
-			XMLElement *element = doc.NewElement ("profile");
-			profxml.write (profile, entry, macros, element);
-			root->InsertEndChild (element);
-		}
-		doc.InsertEndChild (root);
-		doc.Print (&printer);
-
-		// Read XML input
+		// Write XML output one profile at a time as they are read,
+		// binary output at once
 		std::ofstream file;
 		std::ostream *output;
 		if (argc-first_arg == 3) {
-			file.open (argv[first_arg+2]);
+			file.open (argv[first_arg+2], std::ios::binary);
 			output = &file;
 		}
 		else {
 			output = &std::cout;
 		}
-		*output << printer.CStr ();
-
+		if (binary) {
+			auto set = profile_device->readProfiles ();
+			for (auto &macros: set.macros)
+				for (auto &macro: macros)
+					macro.simplify ();
+			auto data = profbin.write (set.directory, set.profiles, set.macros);
+			output->write (reinterpret_cast<const char *> (data.data ()), data.size ());
+		}
+		else {
+			ProfileXMLWriter writer (profxml, *output);
+			profile_device->readProfiles ([&] (std::size_t index,
+							   const HIDPP::ProfileDirectory::Entry &entry,
+							   HIDPP::Profile &profile,
+							   std::vector<HIDPP::Macro> &macros) {
+				for (auto &macro: macros)
+					macro.simplify ();
+				writer.write (profile, entry, macros);
+				output->flush ();
+			});
+			writer.finish ();
+		}
 	}
 	else {
 		fprintf (stderr, "Invalid operation.\n");
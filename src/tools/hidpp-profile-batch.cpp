@@ -0,0 +1,167 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <list>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+
+#include "profile/ProfileBatch.h"
+
+static bool parseUnsigned (const char *str, unsigned long min, unsigned long max, unsigned long &value)
+{
+	char *endptr;
+	value = strtoul (str, &endptr, 0);
+	return endptr != str && *endptr == '\0' && value >= min && value <= max;
+}
+
+// format:buttons:sectors:sector_size[:layout:info:profiles]
+static bool parseDescription (const char *str, HIDPP20::IOnboardProfiles::Description &desc)
+{
+	static const unsigned long max[] = { 255, 255, 255, 65535, 255, 255, 255 };
+	unsigned long values[] = { 0, 0, 0, 0, 0, 0, 5 };
+	std::string arg (str);
+	std::size_t start = 0;
+	unsigned int count = 0;
+	while (true) {
+		std::size_t end = arg.find (':', start);
+		if (count == 7 || !parseUnsigned (arg.substr (start, end-start).c_str (), 0, max[count], values[count]))
+			return false;
+		++count;
+		if (end == std::string::npos)
+			break;
+		start = end+1;
+	}
+	if (count != 4 && count != 7)
+		return false;
+	desc.memory_model = 1;
+	desc.profile_format = values[0];
+	desc.macro_format = 1;
+	desc.button_count = values[1];
+	desc.sector_count = values[2];
+	desc.sector_size = values[3];
+	desc.mechanical_layout = values[4];
+	desc.various_info = values[5];
+	desc.profile_count = values[6];
+	desc.profile_count_oob = 0;
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "profile_file...";
+	std::list<ProfileTarget> targets;
+	unsigned long threads = 0;
+	const char *output = nullptr;
+
+	std::vector<Option> options = {
+		Option ('1', "hidpp10",
+			Option::RequiredArgument, "product_id",
+			"Check profiles for the HID++ 1.0 mouse with this product ID",
+			[&targets] (const char *optarg) -> bool {
+				unsigned long pid;
+				if (!parseUnsigned (optarg, 0, 0xffff, pid)) {
+					fprintf (stderr, "Invalid product ID.\n");
+					return false;
+				}
+				try {
+					targets.push_back (ProfileTarget::hidpp10 (pid));
+				}
+				catch (std::exception &e) {
+					fprintf (stderr, "Invalid product ID: %s.\n", e.what ());
+					return false;
+				}
+				return true;
+			}),
+		Option ('2', "hidpp20",
+			Option::RequiredArgument, "format:buttons:sectors:sector_size[:layout:info:profiles]",
+			"Check profiles for a HID++ 2.0 device with this onboard memory description",
+			[&targets] (const char *optarg) -> bool {
+				HIDPP20::IOnboardProfiles::Description desc;
+				if (!parseDescription (optarg, desc)) {
+					fprintf (stderr, "Invalid description.\n");
+					return false;
+				}
+				try {
+					targets.push_back (ProfileTarget::hidpp20 (desc));
+				}
+				catch (std::exception &e) {
+					fprintf (stderr, "Invalid description: %s.\n", e.what ());
+					return false;
+				}
+				return true;
+			}),
+		Option ('j', "threads",
+			Option::RequiredArgument, "count",
+			"Number of worker threads (default: hardware concurrency)",
+			[&threads] (const char *optarg) -> bool {
+				if (!parseUnsigned (optarg, 1, 1024, threads)) {
+					fprintf (stderr, "Invalid thread count.\n");
+					return false;
+				}
+				return true;
+			}),
+		Option ('o', "output",
+			Option::RequiredArgument, "directory",
+			"Write the memory images of HID++ 2.0 targets in this directory",
+			[&output] (const char *optarg) -> bool {
+				output = optarg;
+				return true;
+			}),
+		VerboseOption (),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg < 1) {
+		fprintf (stderr, "Too few arguments.\n");
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+	if (targets.empty ()) {
+		fprintf (stderr, "No target, use --hidpp10 or --hidpp20.\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<const ProfileTarget *> target_ptrs;
+	for (const auto &target: targets)
+		target_ptrs.push_back (&target);
+	ProfileBatch batch (std::move (target_ptrs), threads);
+	if (output)
+		batch.setOutputDirectory (output);
+
+	std::vector<std::string> paths (argv+first_arg, argv+argc);
+	unsigned int invalid = 0;
+	for (const auto &result: batch.run (paths)) {
+		if (result.errors.empty ())
+			continue;
+		++invalid;
+		for (const auto &error: result.errors)
+			fprintf (stderr, "%s: %s\n", result.path.c_str (), error.c_str ());
+	}
+	printf ("%zu files, %u invalid\n", paths.size (), invalid);
+	return invalid == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#include <hid/DeviceMonitor.h>
+#include <hidpp/DispatcherThread.h>
+#include <hidpp/Probe.h>
+#include <misc/Log.h>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+#include "common/Executor.h"
+
+#include "profile/ProfileDevice.h"
+
+class DeviceCollector: public HID::DeviceMonitor
+{
+public:
+	std::vector<std::string> paths;
+
+protected:
+	void addDevice (const char *path)
+	{
+		paths.push_back (path);
+	}
+
+	void removeDevice (const char *path) { }
+};
+
+// Glob with '*' and '?' wildcards
+static bool matchPath (const char *pattern, const char *path)
+{
+	if (*pattern == '\0')
+		return *path == '\0';
+	if (*pattern == '*')
+		return matchPath (pattern+1, path) || (*path != '\0' && matchPath (pattern, path+1));
+	if (*path != '\0' && (*pattern == '?' || *pattern == *path))
+		return matchPath (pattern+1, path+1);
+	return false;
+}
+
+struct ProvisionResult
+{
+	HIDPP::ProbeResult device;
+	std::string error; // empty on success
+	std::chrono::steady_clock::duration duration;
+};
+
+// Devices on the same node are provisioned one after the other, so every
+// receiver gets its own worker.
+static std::vector<ProvisionResult> provisionNode (const std::string &path,
+						  const std::vector<HIDPP::ProbeResult> &devices,
+						  const tinyxml2::XMLElement *root)
+{
+	std::vector<ProvisionResult> results;
+	std::unique_ptr<HIDPP::DispatcherThread> dispatcher;
+	try {
+		dispatcher = std::make_unique<HIDPP::DispatcherThread> (path.c_str ());
+	}
+	catch (std::exception &e) {
+		for (const auto &device: devices)
+			results.push_back ({ device, e.what (), {} });
+		return results;
+	}
+	std::thread thread ([&dispatcher] () { dispatcher->run (); });
+	for (const auto &device: devices) {
+		auto start = std::chrono::steady_clock::now ();
+		std::string error;
+		try {
+			ProfileDevice profile_device (HIDPP::Device (dispatcher.get (), device.index, device.identity ()));
+			profile_device.writeProfiles (root);
+		}
+		catch (std::exception &e) {
+			error = e.what ();
+		}
+		results.push_back ({ device, error, std::chrono::steady_clock::now () - start });
+	}
+	dispatcher->stop ();
+	thread.join ();
+	return results;
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "profiles_file [device_path...]";
+	const char *path_pattern = nullptr;
+	int vendor_id = -1, product_id = -1;
+
+	std::vector<Option> options = {
+		Option ('V', "vendor",
+			Option::RequiredArgument, "id",
+			"Only provision devices with this vendor ID",
+			[&vendor_id] (const char *optarg) -> bool {
+				char *endptr;
+				vendor_id = strtol (optarg, &endptr, 16);
+				if (*endptr != '\0') {
+					fprintf (stderr, "Invalid vendor ID.\n");
+					return false;
+				}
+				return true;
+			}),
+		Option ('P', "product",
+			Option::RequiredArgument, "id",
+			"Only provision devices with this product ID",
+			[&product_id] (const char *optarg) -> bool {
+				char *endptr;
+				product_id = strtol (optarg, &endptr, 16);
+				if (*endptr != '\0') {
+					fprintf (stderr, "Invalid product ID.\n");
+					return false;
+				}
+				return true;
+			}),
+		Option ('p', "path",
+			Option::RequiredArgument, "pattern",
+			"Only provision devices whose path matches the pattern (with * and ? wildcards)",
+			[&path_pattern] (const char *optarg) -> bool {
+				path_pattern = optarg;
+				return true;
+			}),
+		VerboseOption (),
+		DaemonOption (),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg < 1) {
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	// Read and parse the profiles once for every device
+	std::ifstream file (argv[first_arg]);
+	if (!file) {
+		fprintf (stderr, "Failed to open %s.\n", argv[first_arg]);
+		return EXIT_FAILURE;
+	}
+	std::string xml;
+	while (file) {
+		char buffer[4096];
+		file.read (buffer, sizeof (buffer));
+		xml.append (buffer, file.gcount ());
+	}
+	tinyxml2::XMLDocument doc;
+	doc.Parse (xml.c_str ());
+	if (doc.Error ()) {
+		fprintf (stderr, "Error parsing XML:\n%s\n", doc.ErrorStr ());
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::string> paths;
+	if (argc-first_arg > 1)
+		paths.assign (argv+first_arg+1, argv+argc);
+	else {
+		DeviceCollector collector;
+		collector.setFilter (HIDPP::deviceFilter ());
+		collector.enumerate ();
+		paths = std::move (collector.paths);
+	}
+	if (path_pattern) {
+		std::vector<std::string> matching;
+		for (const auto &path: paths)
+			if (matchPath (path_pattern, path.c_str ()))
+				matching.push_back (path);
+		paths = std::move (matching);
+	}
+
+	std::map<std::string, std::vector<HIDPP::ProbeResult>> nodes;
+	for (const auto &result: HIDPP::probeDevices (paths)) {
+		if (result.error)
+			continue;
+		if (vendor_id != -1 && result.vendor_id != vendor_id)
+			continue;
+		if (product_id != -1 && result.product_id != product_id)
+			continue;
+		nodes[result.path].push_back (result);
+	}
+	// The default index of a node with wireless devices is the receiver
+	for (auto &[path, devices]: nodes) {
+		bool receiver = std::any_of (devices.begin (), devices.end (),
+				[] (const HIDPP::ProbeResult &result) {
+					return result.index != HIDPP::DefaultDevice &&
+						result.index != HIDPP::CordedDevice;
+				});
+		if (receiver)
+			devices.erase (std::remove_if (devices.begin (), devices.end (),
+					[] (const HIDPP::ProbeResult &result) {
+						return result.index == HIDPP::DefaultDevice;
+					}),
+				devices.end ());
+	}
+
+	std::vector<const std::pair<const std::string, std::vector<HIDPP::ProbeResult>> *> node_list;
+	for (const auto &node: nodes)
+		node_list.push_back (&node);
+	Executor executor (std::max<std::size_t> (1, node_list.size ()));
+	auto results = executor.map (node_list.size (), [&] (std::size_t i) {
+		return provisionNode (node_list[i]->first, node_list[i]->second, doc.RootElement ());
+	});
+	int failures = 0;
+	for (const auto &node_results: results) {
+		for (const auto &result: node_results) {
+			printf ("%s", result.device.path.c_str ());
+			if (result.device.index != HIDPP::DefaultDevice)
+				printf (" (device %d)", result.device.index);
+			printf (": %s (%04hx:%04hx): ",
+				result.device.name.c_str (),
+				result.device.vendor_id, result.device.product_id);
+			if (result.error.empty ())
+				printf ("done in %ld ms\n", (long) std::chrono::duration_cast<std::chrono::milliseconds> (result.duration).count ());
+			else {
+				printf ("failed: %s\n", result.error.c_str ());
+				++failures;
+			}
+		}
+	}
+
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -36,6 +36,7 @@ int main (int argc, char *argv[])
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -16,25 +16,68 @@
  *
  */
 
+#include <algorithm>
 #include <cstdio>
+#include <fstream>
+#include <iostream>
 #include <memory>
 
 #include <hidpp/SimpleDispatcher.h>
 #include <hidpp10/Device.h>
 #include <hidpp10/IMemory.h>
+#include <misc/Hex.h>
 
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
+#include "common/TransferProgress.h"
+
+// Print \p data as lines of 16 bytes prefixed with their offset
+static void printHex (std::ostream &out, const uint8_t *data, std::size_t length)
+{
+	constexpr std::size_t LineLength = 16;
+	char line[6 + Hex::encodedLength (LineLength)];
+	for (std::size_t offset = 0; offset < length; offset += LineLength) {
+		std::size_t n = std::min (LineLength, length - offset);
+		int prefix = snprintf (line, sizeof (line), "%04zx:", offset);
+		char *end = Hex::encode (data + offset, n, line + prefix);
+		*(end++) = '\n';
+		out.write (line, end - line);
+	}
+}
 
 int main (int argc, char *argv[])
 {
-	static const char *args = "device_path page";
+	static const char *args = "device_path page|first-last";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	bool hex = false, progress = false;
+	const char *output_path = nullptr;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
+		Option ('x', "hex",
+			Option::NoArgument, "",
+			"Print the page as hexadecimal text instead of raw bytes",
+			[&hex] (const char *) -> bool {
+				hex = true;
+				return true;
+			}),
+		Option ('o', "output",
+			Option::RequiredArgument, "file",
+			"Write to file instead of the standard output",
+			[&output_path] (const char *optarg) -> bool {
+				output_path = optarg;
+				return true;
+			}),
+		Option ('p', "progress",
+			Option::NoArgument, "",
+			"Print the progress and throughput on the standard error",
+			[&progress] (const char *) -> bool {
+				progress = true;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -48,6 +91,12 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	unsigned int first, last;
+	if (!parsePageRange (argv[first_arg+1], first, last) || last > 0xff) {
+		fprintf (stderr, "Invalid page number.\n");
+		return EXIT_FAILURE;
+	}
+
 	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
 	try {
 		dispatcher = std::make_unique<HIDPP::SimpleDispatcher> (argv[first_arg]);
@@ -57,21 +106,46 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	char *endptr;
-	unsigned int page = strtol (argv[first_arg+1], &endptr, 0);
-	if (*endptr != '\0') {
-		fprintf (stderr, "Invalid page number.\n");
-		return EXIT_FAILURE;
+	std::ofstream file;
+	std::ostream *output = &std::cout;
+	if (output_path) {
+		file.open (output_path, std::ios::binary);
+		if (!file) {
+			fprintf (stderr, "Failed to open %s.\n", output_path);
+			return EXIT_FAILURE;
+		}
+		output = &file;
 	}
 
 	HIDPP10::Device dev (dispatcher.get (), device_index);
+	HIDPP10::IMemory imem (&dev);
 
 	static constexpr std::size_t PageSize = 512;
 	std::vector<uint8_t> data (PageSize);
-
-	HIDPP10::IMemory (&dev).readMem ({0, static_cast<uint8_t> (page), 0}, data);
-
-	fwrite (data.data (), sizeof (uint8_t), PageSize, stdout);
+	TransferProgress meter ((last - first + 1) * PageSize,
+				progress ? stderr : nullptr);
+	try {
+		for (unsigned int page = first; page <= last; ++page) {
+			imem.readMem ({0, static_cast<uint8_t> (page), 0}, data);
+			meter.advance (PageSize);
+			if (hex) {
+				if (first != last)
+					*output << "page " << page << ":\n";
+				printHex (*output, data.data (), PageSize);
+			}
+			else
+				output->write (reinterpret_cast<const char *> (data.data ()), PageSize);
+		}
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to read memory: %s.\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	meter.finish ();
+	if (!output->flush ()) {
+		fprintf (stderr, "Failed to write data.\n");
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -19,6 +19,7 @@
 #include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <iterator>
 
 #include <hidpp/SimpleDispatcher.h>
 #include <hidpp10/Device.h>
@@ -47,10 +48,39 @@ int main (int argc, char *argv[])
 {
 	static const char *args = "device_path [file]";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	unsigned int window = 1;
+	const char *prepared_path = nullptr, *save_path = nullptr;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
+		Option ('w', "window",
+			Option::RequiredArgument, "packets",
+			"stream up to packets data packets before waiting for their acknowledgements",
+			[&window] (const char *optarg) -> bool {
+				char *endptr;
+				window = strtol (optarg, &endptr, 10);
+				if (*endptr != '\0' || window == 0) {
+					fprintf (stderr, "Invalid window: %s\n", optarg);
+					return false;
+				}
+				return true;
+			}),
+		Option ('s', "save-prepared",
+			Option::RequiredArgument, "file",
+			"save the encoded profile for loading it later with --prepared",
+			[&save_path] (const char *optarg) -> bool {
+				save_path = optarg;
+				return true;
+			}),
+		Option ('p', "prepared",
+			Option::RequiredArgument, "file",
+			"load a profile saved with --save-prepared instead of an XML file",
+			[&prepared_path] (const char *optarg) -> bool {
+				prepared_path = optarg;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -75,10 +105,27 @@ int main (int argc, char *argv[])
 
 	HIDPP10::Device dev (dispatcher.get (), device_index);
 	IProfile iprofile (&dev);
+	RAMMapping memory (&dev, window);
+	Address profile_addr { 0, 0, 0 };
+
+	if (prepared_path) {
+		// Already encoded, skip the formats and upload directly.
+		std::ifstream prepared (prepared_path, std::ios::binary);
+		if (!prepared) {
+			fprintf (stderr, "Failed to open %s.\n", prepared_path);
+			return EXIT_FAILURE;
+		}
+		RAMMapping::PreparedUpload upload { profile_addr, {
+			std::istreambuf_iterator<char> (prepared),
+			std::istreambuf_iterator<char> () } };
+		memory.upload (upload);
+		iprofile.loadProfileFromAddress (profile_addr);
+		return EXIT_SUCCESS;
+	}
+
 	auto profile_format = getProfileFormat (&dev);
 	auto profdir_format = getProfileDirectoryFormat (&dev);
 	auto macro_format = getMacroFormat (&dev);
-	RAMMapping memory (&dev);
 
 	// Read XML input
 	std::string xml;
@@ -111,12 +158,13 @@ int main (int argc, char *argv[])
 	ProfileXML profxml (profile_format.get (), profdir_format.get ());
 	profxml.read (doc.RootElement (), profile, entry, macros);
 
+	HIDPP::Address macro_address { 0, 0, (profile_format->size ()+1)/2 };
 	try {
-		HIDPP::Address macro_address { 0, 0, (profile_format->size ()+1)/2 };
 		for (unsigned int i = 0; i < profile.buttons.size (); ++i) {
 			auto &button = profile.buttons[i];
 			if (button.type () == HIDPP::Profile::Button::Type::Macro) {
 				auto &macro = macros[i];
+				macro.optimize (*macro_format);
 				auto next_address = macro.write (*macro_format, memory, macro_address);
 				button.setMacro (macro_address);
 				macro_address = next_address;
@@ -127,9 +175,18 @@ int main (int argc, char *argv[])
 		fprintf (stderr, "Cannot write macros: too long for RAM.\n");
 		return EXIT_FAILURE;
 	}
-	Address profile_addr { 0, 0, 0 };
 	profile_format->write (profile, memory.getWritableIterator (profile_addr));
 
+	if (save_path) {
+		// The profile and its macros end at the last macro address
+		auto upload = memory.prepareUpload (profile_addr, macro_address.offset*2);
+		std::ofstream prepared (save_path, std::ios::binary);
+		if (!prepared.write (reinterpret_cast<const char *> (upload.data.data ()), upload.data.size ())) {
+			fprintf (stderr, "Failed to save %s.\n", save_path);
+			return EXIT_FAILURE;
+		}
+	}
+
 	memory.sync ();
 	iprofile.loadProfileFromAddress (profile_addr);
 
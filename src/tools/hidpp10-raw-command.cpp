@@ -17,23 +17,234 @@
  */
 
 #include <hidpp/SimpleDispatcher.h>
+#include <hidpp/DispatcherThread.h>
 #include <hidpp10/Device.h>
 #include <hidpp10/Error.h>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <memory>
+#include <string>
+#include <thread>
 
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
 
+struct RegisterCommand
+{
+	uint8_t address;
+	bool write;
+	std::size_t register_size;
+	std::vector<uint8_t> params; // padded to the request length
+};
+
+/**
+ * Parse "command read|write short|long [parameters...]" from \p args.
+ *
+ * \p where prefixes the error messages.
+ */
+static bool parseCommand (const std::vector<const char *> &args, const std::string &where,
+			  RegisterCommand &command)
+{
+	char *endptr;
+
+	int address = strtol (args[0], &endptr, 0);
+	if (*endptr != '\0' || address < 0 || address > 255) {
+		fprintf (stderr, "%sInvalid register address.\n", where.c_str ());
+		return false;
+	}
+	command.address = static_cast<uint8_t> (address);
+	std::string type = args[1];
+	if (type == "read")
+		command.write = false;
+	else if (type == "write")
+		command.write = true;
+	else {
+		fprintf (stderr, "%sInvalid access type (must be read or write).\n", where.c_str ());
+		return false;
+	}
+	std::string size_string = args[2];
+	if (size_string == "short")
+		command.register_size = HIDPP::ShortParamLength;
+	else if (size_string == "long")
+		command.register_size = HIDPP::LongParamLength;
+	else {
+		fprintf (stderr, "%sInvalid length option (must be short or long).\n", where.c_str ());
+		return false;
+	}
+
+	command.params.clear ();
+	for (std::size_t i = 3; i < args.size (); ++i) {
+		int value = strtol (args[i], &endptr, 16);
+		if (*endptr != '\0' || value < 0 || value > 255) {
+			fprintf (stderr, "%sInvalid parameter %zu value.\n", where.c_str (), i-3);
+			return false;
+		}
+		command.params.push_back (static_cast<uint8_t> (value));
+	}
+	std::size_t param_length = command.write ? command.register_size : HIDPP::ShortParamLength;
+	if (command.params.size () > param_length) {
+		fprintf (stderr, "%sToo many parameters.\n", where.c_str ());
+		return false;
+	}
+	command.params.resize (param_length, 0);
+	return true;
+}
+
+static void printBytes (const std::vector<uint8_t> &bytes, const char *separator)
+{
+	bool first = true;
+	for (uint8_t value: bytes) {
+		if (first)
+			first = false;
+		else
+			printf ("%s", separator);
+		printf ("%02hhx", value);
+	}
+}
+
+struct BatchCommand
+{
+	RegisterCommand command;
+	std::unique_ptr<HIDPP10::Device::AsyncRegister> read; // null for writes
+	std::vector<uint8_t> results;
+	std::exception_ptr error;
+};
+
+/**
+ * Print "address read|write ok results" or "address read|write error
+ * code message" for a completed command. code is "-" for errors that
+ * are not HID++ 1.0 error replies.
+ */
+static bool printBatchResult (BatchCommand &batch)
+{
+	const RegisterCommand &command = batch.command;
+	printf ("%02hhx %s ", command.address, command.write ? "write" : "read");
+	if (batch.read) {
+		try {
+			batch.results = batch.read->get ();
+		}
+		catch (...) {
+			batch.error = std::current_exception ();
+		}
+	}
+	bool ok = !batch.error;
+	if (ok) {
+		printf ("ok ");
+		printBytes (batch.results, "");
+	}
+	else try {
+		std::rethrow_exception (batch.error);
+	}
+	catch (HIDPP10::Error &e) {
+		printf ("error %02x %s", e.errorCode (), e.what ());
+	}
+	catch (std::exception &e) {
+		printf ("error - %s", e.what ());
+	}
+	printf ("\n");
+	fflush (stdout);
+	return ok;
+}
+
+/**
+ * Reads sent before waiting for the first answer in batch mode.
+ */
+static constexpr std::size_t BatchReadWindow = 8;
+
+/**
+ * Run the commands read from \p input, one per line.
+ *
+ * Consecutive reads are pipelined, up to \ref BatchReadWindow of them.
+ * Writes wait for all previous commands and are sent alone, so that
+ * reads always see the writes before them. Results are printed in the
+ * input order. Empty lines and lines starting with '#' are ignored.
+ * Reading stops at the first invalid line.
+ */
+static bool runBatch (HIDPP10::Device &dev, FILE *input)
+{
+	std::deque<BatchCommand> in_flight;
+	bool ok = true;
+	char *line = nullptr;
+	std::size_t size = 0;
+	unsigned int line_number = 0;
+	auto printNext = [&] () {
+		ok = printBatchResult (in_flight.front ()) && ok;
+		in_flight.pop_front ();
+	};
+	while (getline (&line, &size, input) != -1) {
+		++line_number;
+		std::vector<const char *> args;
+		char *saveptr;
+		for (char *token = strtok_r (line, " \t\r\n", &saveptr);
+				token;
+				token = strtok_r (nullptr, " \t\r\n", &saveptr))
+			args.push_back (token);
+		if (args.empty () || args[0][0] == '#')
+			continue;
+		std::string where = "Line " + std::to_string (line_number) + ": ";
+		BatchCommand batch;
+		if (args.size () < 3) {
+			fprintf (stderr, "%sToo few arguments.\n", where.c_str ());
+			ok = false;
+			break;
+		}
+		if (!parseCommand (args, where, batch.command)) {
+			ok = false;
+			break;
+		}
+		const RegisterCommand &command = batch.command;
+		if (command.write) {
+			while (!in_flight.empty ())
+				printNext ();
+			try {
+				dev.setRegister (command.address, command.params, &batch.results);
+			}
+			catch (...) {
+				batch.error = std::current_exception ();
+			}
+			ok = printBatchResult (batch) && ok;
+			continue;
+		}
+		if (in_flight.size () >= BatchReadWindow)
+			printNext ();
+		try {
+			batch.read = std::make_unique<HIDPP10::Device::AsyncRegister> (
+					dev.getRegisterAsync (command.address,
+							      &command.params,
+							      command.register_size));
+		}
+		catch (std::exception &e) {
+			fprintf (stderr, "%sFailed to send command: %s\n", where.c_str (), e.what ());
+			ok = false;
+			break;
+		}
+		in_flight.push_back (std::move (batch));
+	}
+	free (line);
+	while (!in_flight.empty ())
+		printNext ();
+	return ok;
+}
+
 int main (int argc, char *argv[])
 {
 	static const char *args = "device_path command read|write short|long [parameters...]";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	const char *batch_path = nullptr;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
+		Option ('b', "batch",
+			Option::RequiredArgument, "file",
+			"read commands from file (- for stdin) instead of the arguments, one \"command read|write short|long [parameters...]\" per line, and print one \"command read|write ok|error result\" line for each",
+			[&batch_path] (const char *optarg) -> bool {
+				batch_path = optarg;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -42,6 +253,47 @@ int main (int argc, char *argv[])
 	if (!Option::processOptions (argc, argv, options, first_arg))
 		return EXIT_FAILURE;
 
+	if (batch_path) {
+		if (argc-first_arg != 1) {
+			fprintf (stderr, "Batch mode only takes the device path.\n");
+			fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+			return EXIT_FAILURE;
+		}
+		FILE *input = stdin;
+		if (strcmp (batch_path, "-") != 0) {
+			input = fopen (batch_path, "r");
+			if (!input) {
+				perror ("Failed to open batch file");
+				return EXIT_FAILURE;
+			}
+		}
+		const char *path = argv[first_arg];
+		bool ok;
+		try {
+			// Reads are pipelined, which needs an asynchronous dispatcher
+			HIDPP::DispatcherThread dispatcher (path);
+			std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+			try {
+				HIDPP10::Device dev (&dispatcher, device_index);
+				ok = runBatch (dev, input);
+			}
+			catch (std::exception &e) {
+				dispatcher.stop ();
+				thread.join ();
+				throw;
+			}
+			dispatcher.stop ();
+			thread.join ();
+		}
+		catch (std::exception &e) {
+			fprintf (stderr, "%s: %s\n", path, e.what ());
+			ok = false;
+		}
+		if (input != stdin)
+			fclose (input);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	if (argc-first_arg < 4) {
 		fprintf (stderr, "Too few arguments.\n");
 		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
@@ -57,55 +309,18 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	char *endptr;
-
-	int address = strtol (argv[first_arg+1], &endptr, 0);
-	if (*endptr != '\0' || address < 0 || address > 255) {
-		fprintf (stderr, "Invalid register address.\n");
+	RegisterCommand command;
+	if (!parseCommand (std::vector<const char *> (&argv[first_arg+1], &argv[argc]), "", command))
 		return EXIT_FAILURE;
-	}
-	std::string type = argv[first_arg+2];
-	std::string size_string = argv[first_arg+3];
-	std::size_t register_size;
-	if (size_string == "short")
-		register_size = HIDPP::ShortParamLength;
-	else if (size_string == "long")
-		register_size = HIDPP::LongParamLength;
-	else {
-		fprintf (stderr, "Invalid length option (must be short or long).\n");
-		return EXIT_FAILURE;
-	}
 
 	HIDPP10::Device dev (dispatcher.get (), device_index);
-	std::vector<uint8_t> params, results;
-	for (int i = 0; first_arg+4+i < argc; ++i) {
-		int value = strtol (argv[first_arg+4+i], &endptr, 16);
-		if (*endptr != '\0' || value < 0 || value > 255) {
-			fprintf (stderr, "Invalid parameter %d value.\n", i);
-			return EXIT_FAILURE;
-		}
-		params.push_back (static_cast<uint8_t> (value));
-	}
-
+	std::vector<uint8_t> results;
 	try {
-		if (type == "read") {
-			if (params.size () > HIDPP::ShortParamLength) {
-				fprintf (stderr, "Too many parameters.\n");
-				return EXIT_FAILURE;
-			}
-			params.resize (HIDPP::ShortParamLength, 0);
-			results.resize (register_size);
-			dev.getRegister (static_cast<uint8_t> (address),
-					 &params, results);
-		}
-		else if (type == "write") {
-			if (params.size () > register_size) {
-				fprintf (stderr, "Too many parameters.\n");
-				return EXIT_FAILURE;
-			}
-			params.resize (register_size, 0);
-			dev.setRegister (static_cast<uint8_t> (address),
-					 params, &results);
+		if (command.write)
+			dev.setRegister (command.address, command.params, &results);
+		else {
+			results.resize (command.register_size);
+			dev.getRegister (command.address, &command.params, results);
 		}
 	}
 	catch (HIDPP10::Error &e) {
@@ -113,16 +328,8 @@ int main (int argc, char *argv[])
 		return e.errorCode ();
 	}
 
-	bool first = true;
-	for (uint8_t value: results) {
-		if (first)
-			first = false;
-		else 
-			printf (" ");
-		printf ("%02hhx", value);
-	}
+	printBytes (results, " ");
 	printf ("\n");
 
 	return EXIT_SUCCESS;
 }
-
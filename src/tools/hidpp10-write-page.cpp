@@ -31,10 +31,24 @@ int main (int argc, char *argv[])
 {
 	static const char *args = "device_path page";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	unsigned int window = 1;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
+		Option ('w', "window",
+			Option::RequiredArgument, "packets",
+			"stream up to packets data packets before waiting for their acknowledgements",
+			[&window] (const char *optarg) -> bool {
+				char *endptr;
+				window = strtol (optarg, &endptr, 10);
+				if (*endptr != '\0' || window == 0) {
+					fprintf (stderr, "Invalid window: %s\n", optarg);
+					return false;
+				}
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -68,7 +82,7 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	HIDPP10::IMemory (&dev).writePage (page, data);
+	HIDPP10::IMemory (&dev).writePage (page, data, window);
 
 	return EXIT_SUCCESS;
 }
@@ -17,24 +17,169 @@
  */
 
 #include <hidpp/SimpleDispatcher.h>
+#include <hidpp/DispatcherThread.h>
 #include <hidpp20/Device.h>
 #include <hidpp20/Error.h>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <memory>
+#include <string>
+#include <thread>
 
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
+#include "common/DeviceSelector.h"
+
+/**
+ * Parse "feature_index function [parameters...]" from \p args.
+ *
+ * \p where prefixes the error messages.
+ */
+static bool parseCall (const std::vector<const char *> &args, const std::string &where,
+		       HIDPP20::Device::Call &call)
+{
+	char *endptr;
+
+	int feature_index = strtol (args[0], &endptr, 0);
+	if (*endptr != '\0' || feature_index < 0 || feature_index > 255) {
+		fprintf (stderr, "%sInvalid feature index.\n", where.c_str ());
+		return false;
+	}
+	int function = strtol (args[1], &endptr, 0);
+	if (*endptr != '\0' || function < 0 || function > 15) {
+		fprintf (stderr, "%sInvalid function.\n", where.c_str ());
+		return false;
+	}
+	call.feature_index = static_cast<uint8_t> (feature_index);
+	call.function = static_cast<unsigned int> (function);
+
+	call.params.clear ();
+	for (std::size_t i = 2; i < args.size (); ++i) {
+		int value = strtol (args[i], &endptr, 16);
+		if (*endptr != '\0' || value < 0 || value > 255) {
+			fprintf (stderr, "%sInvalid parameter %zu value.\n", where.c_str (), i-2);
+			return false;
+		}
+		call.params.push_back (static_cast<uint8_t> (value));
+	}
+	return true;
+}
+
+static void printResults (const std::vector<uint8_t> &results)
+{
+	bool first = true;
+	for (uint8_t value: results) {
+		if (first)
+			first = false;
+		else
+			printf (" ");
+		printf ("%02hhx", value);
+	}
+	printf ("\n");
+}
+
+/**
+ * Print the results of the oldest call in flight.
+ *
+ * Errors are printed on stdout too, so that every input line has its
+ * output line.
+ */
+static bool printNext (std::deque<HIDPP20::Device::AsyncCall> &in_flight)
+{
+	bool ok = true;
+	try {
+		printResults (in_flight.front ().get ());
+	}
+	catch (HIDPP20::Error &e) {
+		printf ("Error code %d: %s\n", e.errorCode (), e.what ());
+		ok = false;
+	}
+	catch (std::exception &e) {
+		printf ("Error: %s\n", e.what ());
+		ok = false;
+	}
+	in_flight.pop_front ();
+	fflush (stdout);
+	return ok;
+}
+
+/**
+ * Run the calls read from \p input, one per line, keeping up to
+ * HIDPP::Dispatcher::MaxSoftwareID of them in flight.
+ *
+ * Empty lines and lines starting with '#' are ignored. Results are
+ * printed in the input order. Reading stops at the first invalid line.
+ */
+static bool runBatch (HIDPP20::Device &dev, FILE *input)
+{
+	std::deque<HIDPP20::Device::AsyncCall> in_flight;
+	bool ok = true;
+	char *line = nullptr;
+	std::size_t size = 0;
+	unsigned int line_number = 0;
+	while (getline (&line, &size, input) != -1) {
+		++line_number;
+		std::vector<const char *> args;
+		char *saveptr;
+		for (char *token = strtok_r (line, " \t\r\n", &saveptr);
+				token;
+				token = strtok_r (nullptr, " \t\r\n", &saveptr))
+			args.push_back (token);
+		if (args.empty () || args[0][0] == '#')
+			continue;
+		std::string where = "Line " + std::to_string (line_number) + ": ";
+		HIDPP20::Device::Call call;
+		if (args.size () < 2) {
+			fprintf (stderr, "%sToo few arguments.\n", where.c_str ());
+			ok = false;
+			break;
+		}
+		if (!parseCall (args, where, call)) {
+			ok = false;
+			break;
+		}
+		if (in_flight.size () >= HIDPP::Dispatcher::MaxSoftwareID)
+			ok = printNext (in_flight) && ok;
+		try {
+			in_flight.push_back (dev.callFunctionAsync (call.feature_index,
+								   call.function,
+								   call.params));
+		}
+		catch (std::exception &e) {
+			fprintf (stderr, "%sFailed to send call: %s\n", where.c_str (), e.what ());
+			ok = false;
+			break;
+		}
+	}
+	free (line);
+	while (!in_flight.empty ())
+		ok = printNext (in_flight) && ok;
+	return ok;
+}
 
 int main (int argc, char *argv[])
 {
 	static const char *args = "device_path feature_index function [parameters...]";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	const char *batch_path = nullptr;
+	DeviceSelector selector;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
+		Option ('b', "batch",
+			Option::RequiredArgument, "file",
+			"read calls from file (- for stdin) instead of the arguments, one \"feature_index function [parameters...]\" per line, and print their results in order",
+			[&batch_path] (const char *optarg) -> bool {
+				batch_path = optarg;
+				return true;
+			}),
 	};
+	auto selector_options = selector.options ();
+	options.insert (options.end (), selector_options.begin (), selector_options.end ());
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
 
@@ -42,35 +187,68 @@ int main (int argc, char *argv[])
 	if (!Option::processOptions (argc, argv, options, first_arg))
 		return EXIT_FAILURE;
 
+	// With a selection, the device path argument is omitted.
+	std::string selected_path;
+	if (selector.active ()) {
+		if (!selector.select (selected_path, device_index))
+			return EXIT_FAILURE;
+		--first_arg;
+	}
+	auto devicePath = [&] () {
+		return selector.active () ? selected_path.c_str () : argv[first_arg];
+	};
+
+	if (batch_path) {
+		if (argc-first_arg != 1) {
+			fprintf (stderr, "Batch mode only takes the device path.\n");
+			fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+			return EXIT_FAILURE;
+		}
+		FILE *input = stdin;
+		if (strcmp (batch_path, "-") != 0) {
+			input = fopen (batch_path, "r");
+			if (!input) {
+				perror ("Failed to open batch file");
+				return EXIT_FAILURE;
+			}
+		}
+		const char *path = devicePath ();
+		bool ok;
+		try {
+			// Calls are pipelined, which needs an asynchronous dispatcher
+			HIDPP::DispatcherThread dispatcher (path);
+			std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+			try {
+				HIDPP20::Device dev (&dispatcher, device_index);
+				ok = runBatch (dev, input);
+			}
+			catch (std::exception &e) {
+				dispatcher.stop ();
+				thread.join ();
+				throw;
+			}
+			dispatcher.stop ();
+			thread.join ();
+		}
+		catch (std::exception &e) {
+			fprintf (stderr, "%s: %s\n", path, e.what ());
+			ok = false;
+		}
+		if (input != stdin)
+			fclose (input);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	if (argc-first_arg < 3) {
 		fprintf (stderr, "Too few arguments.\n");
 		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
 		return EXIT_FAILURE;
 	}
 
-	char *endptr;
-
-	const char *path = argv[first_arg];
-	int feature_index = strtol (argv[first_arg+1], &endptr, 0);
-	if (*endptr != '\0' || feature_index < 0 || feature_index > 255) {
-		fprintf (stderr, "Invalid feature index.\n");
+	const char *path = devicePath ();
+	HIDPP20::Device::Call call;
+	if (!parseCall (std::vector<const char *> (&argv[first_arg+1], &argv[argc]), "", call))
 		return EXIT_FAILURE;
-	}
-	int function = strtol (argv[first_arg+2], &endptr, 0);
-	if (*endptr != '\0' || function < 0 || function > 15) {
-		fprintf (stderr, "Invalid function.\n");
-		return EXIT_FAILURE;
-	}
-
-	std::vector<uint8_t> params, results;
-	for (int i = 0; first_arg+3+i < argc; ++i) {
-		int value = strtol (argv[first_arg+3+i], &endptr, 16);
-		if (*endptr != '\0' || value < 0 || value > 255) {
-			fprintf (stderr, "Invalid parameter %d value.\n", i);
-			return EXIT_FAILURE;
-		}
-		params.push_back (static_cast<uint8_t> (value));
-	}
 
 	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
 	try {
@@ -81,26 +259,16 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 	HIDPP20::Device dev (dispatcher.get (), device_index);
+	std::vector<uint8_t> results;
 	try {
-		results = dev.callFunction (static_cast<uint8_t> (feature_index),
-					    static_cast<unsigned int> (function),
-					    params);
+		results = dev.callFunction (call.feature_index, call.function, call.params);
 	}
 	catch (HIDPP20::Error &e) {
 		fprintf (stderr, "Error code %d: %s\n", e.errorCode (), e.what ());
 		return e.errorCode ();
 	}
 
-	bool first = true;
-	for (uint8_t value: results) {
-		if (first)
-			first = false;
-		else
-			printf (" ");
-		printf ("%02hhx", value);
-	}
-	printf ("\n");
+	printResults (results);
 
 	return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <hidpp/DeviceRegistry.h>
+#include <hidpp/PageCache.h>
+#include <hidpp/SimpleDispatcher.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IOnboardProfiles.h>
+#include <hidpp20/MemoryMapping.h>
+#include <hidpp20/UnsupportedFeature.h>
+
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+
+/**
+ * Check every writeable page of the onboard memory of \p dev and
+ * summarize the results on a single line in \p summary.
+ *
+ * \returns false if any page is corrupted.
+ */
+static bool checkMemory (HIDPP20::Device &dev, const std::shared_ptr<HIDPP::PageCache> &cache,
+			 std::string &summary)
+{
+	HIDPP20::MemoryMapping memory (&dev);
+	if (cache)
+		memory.setPageCache (cache);
+	std::vector<HIDPP::Address> pages;
+	for (unsigned int i = 0; i < memory.description ().sector_count; ++i)
+		pages.push_back ({ HIDPP20::IOnboardProfiles::Writeable, i, 0 });
+	unsigned int valid = 0, erased = 0, full_reads = 0;
+	std::string corrupted;
+	typedef HIDPP::AbstractMemoryMapping::PageIntegrity PageIntegrity;
+	for (const auto &result: memory.checkIntegrity (pages)) {
+		if (result.full_read)
+			++full_reads;
+		switch (result.integrity) {
+		case PageIntegrity::Valid:
+			++valid;
+			break;
+		case PageIntegrity::Erased:
+			++erased;
+			break;
+		case PageIntegrity::Corrupted:
+			corrupted += " " + std::to_string (result.address.page);
+			break;
+		}
+	}
+	char counts[128];
+	snprintf (counts, sizeof (counts), "%zu pages, %u valid, %u erased, %u read whole",
+		  pages.size (), valid, erased, full_reads);
+	summary = counts;
+	if (corrupted.empty ())
+		return true;
+	summary += ", corrupted:" + corrupted;
+	return false;
+}
+
+static int checkAll (const std::shared_ptr<HIDPP::PageCache> &cache)
+{
+	HIDPP::DeviceRegistry registry;
+	registry.enumerate ();
+	// Every device is checked concurrently, the reads of each device
+	// are pipelined by its memory mapping.
+	std::mutex output_mutex;
+	bool ok = true;
+	std::vector<std::future<void>> checks;
+	for (const auto &entry: registry.devices ()) {
+		if (!entry.present () || std::get<0> (entry.identity.version) < 2)
+			continue;
+		checks.push_back (std::async (std::launch::async, [&, entry] () {
+			std::string line;
+			bool valid = false;
+			try {
+				std::shared_ptr<HIDPP::Dispatcher> dispatcher;
+				HIDPP20::Device dev (registry.open (entry.id, dispatcher));
+				valid = checkMemory (dev, cache, line);
+			}
+			catch (HIDPP20::UnsupportedFeature &e) {
+				return; // no onboard memory
+			}
+			catch (std::exception &e) {
+				line = std::string ("error: ") + e.what ();
+			}
+			std::unique_lock<std::mutex> lock (output_mutex);
+			printf ("%s (device %d) %s: %s\n", entry.path.c_str (), entry.index,
+				entry.identity.name.c_str (), line.c_str ());
+			if (!valid)
+				ok = false;
+		}));
+	}
+	for (auto &check: checks)
+		check.get ();
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "[device_path]";
+	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	const char *cache_path = nullptr;
+
+	std::vector<Option> options = {
+		DeviceIndexOption (device_index),
+		VerboseOption (),
+		DaemonOption (),
+		Option ('p', "page-cache",
+			Option::RequiredArgument, "file",
+			"Only read the end of the pages found in the page cache file, and store the pages read whole",
+			[&cache_path] (const char *optarg) -> bool {
+				cache_path = optarg;
+				return true;
+			}),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg > 1) {
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	std::shared_ptr<HIDPP::PageCache> cache;
+	if (cache_path)
+		cache = std::make_shared<HIDPP::PageCache> (cache_path);
+
+	// Without a path, check every device
+	if (argc-first_arg == 0)
+		return checkAll (cache);
+
+	const char *path = argv[first_arg];
+	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
+	try {
+		dispatcher = std::make_unique<HIDPP::SimpleDispatcher> (path);
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to open device: %s.\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	try {
+		HIDPP20::Device dev (dispatcher.get (), device_index);
+		std::string line;
+		bool valid = checkMemory (dev, cache, line);
+		printf ("%s\n", line.c_str ());
+		return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	catch (HIDPP20::Error &e) {
+		fprintf (stderr, "HID++2 error %d: %s\n", e.errorCode (), e.what ());
+		return e.errorCode ();
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "%s\n", e.what ());
+		return EXIT_FAILURE;
+	}
+}
@@ -16,27 +16,69 @@
  *
  */
 
+#include <algorithm>
 #include <cstdio>
+#include <fstream>
+#include <iostream>
 #include <memory>
+#include <optional>
+#include <vector>
 
+#include <hidpp/MemorySnapshot.h>
 #include <hidpp/SimpleDispatcher.h>
 #include <hidpp20/Device.h>
 #include <hidpp20/Error.h>
 #include <hidpp20/IOnboardProfiles.h>
+#include <misc/Endian.h>
+#include <misc/Hex.h>
 
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
+#include "common/TransferProgress.h"
+
+// Print \p data as lines of 16 bytes prefixed with their offset
+static void printHex (std::ostream &out, const uint8_t *data, std::size_t length)
+{
+	constexpr std::size_t LineLength = 16;
+	char line[6 + Hex::encodedLength (LineLength)];
+	for (std::size_t offset = 0; offset < length; offset += LineLength) {
+		std::size_t n = std::min (LineLength, length - offset);
+		int prefix = snprintf (line, sizeof (line), "%04zx:", offset);
+		char *end = Hex::encode (data + offset, n, line + prefix);
+		*(end++) = '\n';
+		out.write (line, end - line);
+	}
+}
+
+// Same layout as the GetDescription results
+static std::vector<uint8_t> descriptionBytes (const HIDPP20::IOnboardProfiles::Description &desc)
+{
+	std::vector<uint8_t> bytes = {
+		desc.memory_model,
+		desc.profile_format,
+		desc.macro_format,
+		desc.profile_count, desc.profile_count_oob,
+		desc.button_count,
+		desc.sector_count, 0, 0,
+		desc.mechanical_layout, desc.various_info,
+	};
+	writeBE<uint16_t> (bytes, 7, desc.sector_size);
+	return bytes;
+}
 
 int main (int argc, char *argv[])
 {
-	static const char *args = "device_path page";
+	static const char *args = "device_path page|first-last";
 	auto mem_type = HIDPP20::IOnboardProfiles::MemoryType::Writeable;
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	bool hex = false, all = false, snapshot = false, progress = false;
+	const char *output_path = nullptr;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 		Option ('r', "rom",
 			Option::NoArgument, "",
 			"Read data from ROM",
@@ -44,6 +86,41 @@ int main (int argc, char *argv[])
 				mem_type = HIDPP20::IOnboardProfiles::MemoryType::ROM;
 				return true;
 			}),
+		Option ('x', "hex",
+			Option::NoArgument, "",
+			"Print the page as hexadecimal text instead of raw bytes",
+			[&hex] (const char *) -> bool {
+				hex = true;
+				return true;
+			}),
+		Option ('a', "all",
+			Option::NoArgument, "",
+			"Dump every page of the memory (the page argument is omitted)",
+			[&all] (const char *) -> bool {
+				all = true;
+				return true;
+			}),
+		Option ('s', "snapshot",
+			Option::NoArgument, "",
+			"Write the pages in the snapshot format (see hidpp20-memory-snapshot)",
+			[&snapshot] (const char *) -> bool {
+				snapshot = true;
+				return true;
+			}),
+		Option ('o', "output",
+			Option::RequiredArgument, "file",
+			"Write to file instead of the standard output",
+			[&output_path] (const char *optarg) -> bool {
+				output_path = optarg;
+				return true;
+			}),
+		Option ('p', "progress",
+			Option::NoArgument, "",
+			"Print the progress and throughput on the standard error",
+			[&progress] (const char *) -> bool {
+				progress = true;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -52,15 +129,18 @@ int main (int argc, char *argv[])
 	if (!Option::processOptions (argc, argv, options, first_arg))
 		return EXIT_FAILURE;
 
-	if (argc-first_arg != 2) {
+	if (argc-first_arg != (all ? 1 : 2)) {
 		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
 		return EXIT_FAILURE;
 	}
+	if (hex && snapshot) {
+		fprintf (stderr, "Hexadecimal and snapshot outputs are exclusive.\n");
+		return EXIT_FAILURE;
+	}
 
 	const char *path = argv[first_arg];
-	char *endptr;
-	unsigned int page = strtol (argv[first_arg+1], &endptr, 0);
-	if (*endptr != '\0') {
+	unsigned int first = 0, last = 0;
+	if (!all && !parsePageRange (argv[first_arg+1], first, last)) {
 		fprintf (stderr, "Invalid page number.\n");
 		return EXIT_FAILURE;
 	}
@@ -77,17 +157,76 @@ int main (int argc, char *argv[])
 	try {
 		HIDPP20::IOnboardProfiles iop (&dev);
 		auto desc = iop.getDescription ();
-		unsigned int i = 0;
-		while (i < desc.sector_size) {
-			auto data = iop.memoryRead (mem_type, page, i);
-			fwrite (data.data (), sizeof (uint8_t), data.size (), stdout);
-			i += data.size ();
+		if (all) {
+			if (desc.sector_count == 0)
+				return EXIT_SUCCESS;
+			last = desc.sector_count - 1;
+		}
+		else if (last >= desc.sector_count) {
+			fprintf (stderr, "Page index too big: page count is %d.\n", desc.sector_count);
+			return EXIT_FAILURE;
+		}
+
+		std::ofstream file;
+		std::ostream *output = &std::cout;
+		if (output_path) {
+			file.open (output_path, std::ios::binary);
+			if (!file) {
+				fprintf (stderr, "Failed to open %s.\n", output_path);
+				return EXIT_FAILURE;
+			}
+			output = &file;
+		}
+		std::optional<HIDPP::SnapshotWriter> writer;
+		if (snapshot) {
+			HIDPP::SnapshotHeader header;
+			header.fingerprint = dev.fingerprint ();
+			header.description = descriptionBytes (desc);
+			writer.emplace (*output, header);
+		}
+
+		// Read every line of a page at once, the last one ends with the sector.
+		constexpr unsigned int LineSize = HIDPP20::IOnboardProfiles::LineSize;
+		std::vector<unsigned int> offsets;
+		for (unsigned int i = 0; i < desc.sector_size; i += LineSize)
+			offsets.push_back (std::min (i, desc.sector_size - LineSize));
+		TransferProgress meter ((last - first + 1) * desc.sector_size,
+					progress ? stderr : nullptr);
+		std::vector<uint8_t> data;
+		for (unsigned int page = first; page <= last; ++page) {
+			auto lines = iop.memoryRead (mem_type, page, offsets);
+			data.clear ();
+			for (std::size_t i = 0; i < lines.size (); ++i) {
+				unsigned int skip = i * LineSize - offsets[i];
+				data.insert (data.end (), lines[i].begin () + skip, lines[i].begin () + LineSize);
+			}
+			meter.advance (data.size ());
+			if (writer)
+				writer->writePage ({ mem_type, page, 0 }, data);
+			else if (hex) {
+				if (first != last)
+					*output << "page " << page << ":\n";
+				printHex (*output, data.data (), data.size ());
+			}
+			else
+				output->write (reinterpret_cast<const char *> (data.data ()), data.size ());
+		}
+		if (writer)
+			writer->finish ();
+		meter.finish ();
+		if (!output->flush ()) {
+			fprintf (stderr, "Failed to write data.\n");
+			return EXIT_FAILURE;
 		}
 	}
 	catch (HIDPP20::Error &e) {
 		fprintf (stderr, "HID++2 error %d: %s\n", e.errorCode (), e.what ());
 		return e.errorCode ();
 	}
+	catch (std::exception &e) {
+		fprintf (stderr, "%s\n", e.what ());
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <hidpp/SimpleDispatcher.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IOnboardProfiles.h>
+#include <hidpp20/ImageMapping.h>
+#include <hidpp20/MemoryMapping.h>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "device_path image";
+	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	bool dump = false, dry_run = false, overwrite = false;
+
+	std::vector<Option> options = {
+		DeviceIndexOption (device_index),
+		VerboseOption (),
+		DaemonOption (),
+		Option ('D', "dump",
+			Option::NoArgument, "",
+			"Write the device memory to the image instead of flashing it",
+			[&dump] (const char *) -> bool {
+				dump = true;
+				return true;
+			}),
+		Option ('n', "dry-run",
+			Option::NoArgument, "",
+			"Only list the pages differing from the image",
+			[&dry_run] (const char *) -> bool {
+				dry_run = true;
+				return true;
+			}),
+		Option ('o', "overwrite",
+			Option::NoArgument, "",
+			"Write every page without reading the device memory first (e.g. for a fresh flash)",
+			[&overwrite] (const char *) -> bool {
+				overwrite = true;
+				return true;
+			}),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg != 2) {
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[first_arg];
+	const char *image_path = argv[first_arg+1];
+
+	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
+	try {
+		dispatcher = std::make_unique<HIDPP::SimpleDispatcher> (path);
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to open device: %s.\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	HIDPP20::Device dev (dispatcher.get (), device_index);
+	try {
+		HIDPP20::IOnboardProfiles iop (&dev);
+		auto desc = iop.getDescription ();
+		// Keep the device content as is, CRCs come from the image.
+		HIDPP20::MemoryMapping memory (&dev, false);
+		std::vector<HIDPP::Address> pages;
+		for (unsigned int i = 0; i < desc.sector_count; ++i)
+			pages.push_back ({ HIDPP20::IOnboardProfiles::Writeable, i, 0 });
+
+		if (overwrite && !dump && !dry_run) {
+			HIDPP20::ImageMapping image (image_path, desc, false, true);
+			for (const auto &address: pages) {
+				auto &data = memory.getOverwritePage (address);
+				std::copy_n (image.sector (address.page), data.size (), data.begin ());
+			}
+			memory.sync ();
+			printf ("%zu page(s) written.\n", pages.size ());
+			return EXIT_SUCCESS;
+		}
+		memory.prefetch (pages);
+
+		if (dump) {
+			HIDPP20::ImageMapping::create (image_path, desc);
+			HIDPP20::ImageMapping image (image_path, desc, false);
+			for (const auto &address: pages)
+				image.getOverwritePage (address) = memory.getReadOnlyPage (address);
+			image.sync ();
+			image.flush ();
+			return EXIT_SUCCESS;
+		}
+
+		HIDPP20::ImageMapping image (image_path, desc, false, true);
+		unsigned int differing = 0;
+		for (const auto &address: pages) {
+			const uint8_t *sector = image.sector (address.page);
+			const auto &page = memory.getReadOnlyPage (address);
+			if (std::equal (page.begin (), page.end (), sector))
+				continue;
+			printf ("Page %u differs.\n", address.page);
+			++differing;
+			if (!dry_run) {
+				auto &data = memory.getWritablePage (address);
+				std::copy_n (sector, data.size (), data.begin ());
+			}
+		}
+		if (!dry_run)
+			memory.sync ();
+		printf ("%u page(s) %s.\n", differing, dry_run ? "differ" : "written");
+	}
+	catch (HIDPP20::Error &e) {
+		fprintf (stderr, "HID++2 error %d: %s\n", e.errorCode (), e.what ());
+		return e.errorCode ();
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "%s\n", e.what ());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -17,12 +17,17 @@
  */
 
 #include <hidpp/SimpleDispatcher.h>
+#include <hidpp/DispatcherThread.h>
 #include <hidpp20/Device.h>
 #include <hidpp20/Error.h>
 #include <hidpp20/ILEDControl.h>
+#include <hidpp20/LEDFrameStream.h>
+#include <chrono>
 #include <cstdio>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <thread>
 
 #include "common/common.h"
 #include "common/Option.h"
@@ -124,14 +129,93 @@ static void print_state(const ILEDControl::State &state)
 	std::cout << std::endl;
 }
 
+static ILEDControl::State simple_state (ILEDControl::Mode mode)
+{
+	ILEDControl::State state = {};
+	state.mode = mode;
+	return state;
+}
+
+// Frame number n of the effect on count LEDs
+static LEDFrameStream::Frame effect_frame (const std::string &effect, unsigned int count, unsigned int n)
+{
+	LEDFrameStream::Frame frame;
+	for (unsigned int i = 0; i < count; ++i) {
+		bool on;
+		if (effect == "chase")
+			on = i == n % count;
+		else if (effect == "flash")
+			on = n % 2 == 0;
+		else
+			throw std::invalid_argument ("unknown effect");
+		frame.emplace (i, simple_state (on ? ILEDControl::On : ILEDControl::Off));
+	}
+	return frame;
+}
+
+static int play (const char *path, HIDPP::DeviceIndex device_index,
+		 const std::string &effect, double fps, double seconds)
+{
+	using namespace std::chrono;
+	HIDPP::DispatcherThread dispatcher (path);
+	std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+	int ret = EXIT_SUCCESS;
+	try {
+		Device dev (&dispatcher, device_index);
+		ILEDControl iled (&dev);
+		unsigned int count = iled.getCount ();
+		if (count == 0)
+			throw std::runtime_error ("The device has no LED");
+		bool swcontrol = iled.getSWControl ();
+		iled.setSWControl (true);
+		LEDFrameStream::Statistics stats;
+		{
+			// Frames are submitted at the requested rate, the stream
+			// drops those the device is too slow to apply.
+			LEDFrameStream stream (&dev);
+			auto period = duration_cast<steady_clock::duration> (duration<double> (1.0/fps));
+			auto end = steady_clock::now () + duration_cast<steady_clock::duration> (duration<double> (seconds));
+			auto next = steady_clock::now ();
+			for (unsigned int n = 0; next < end; ++n) {
+				stream.submit (effect_frame (effect, count, n));
+				if (auto error = stream.takeError ())
+					std::rethrow_exception (error);
+				next += period;
+				std::this_thread::sleep_until (next);
+			}
+			stream.wait ();
+			if (auto error = stream.takeError ())
+				std::rethrow_exception (error);
+			stats = stream.statistics ();
+		}
+		iled.setSWControl (swcontrol);
+		printf ("%lu frames submitted, %lu applied, %lu dropped.\n",
+			(unsigned long) stats.submitted,
+			(unsigned long) stats.applied,
+			(unsigned long) stats.dropped);
+	}
+	catch (Error &e) {
+		fprintf (stderr, "Error code %d: %s\n", e.errorCode (), e.what ());
+		ret = e.errorCode ();
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Playing failed: %s\n", e.what ());
+		ret = EXIT_FAILURE;
+	}
+	dispatcher.stop ();
+	thread.join ();
+	return ret;
+}
+
 int main (int argc, char *argv[])
 {
-	static const char *args = "device_path info|control|state|config [params...]";
+	static const char *args = "device_path info|control|state|config|play [params...]";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -150,6 +234,42 @@ int main (int argc, char *argv[])
 	std::string op = argv[first_arg+1];
 	first_arg += 2;
 
+	if (op == "play") {
+		// play chase|flash [fps [duration]]
+		if (argc-first_arg < 1) {
+			std::cerr << "Missing effect (chase or flash)." << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::string effect = argv[first_arg];
+		if (effect != "chase" && effect != "flash") {
+			std::cerr << "Invalid effect: " << effect << "." << std::endl;
+			return EXIT_FAILURE;
+		}
+		char *endptr;
+		double fps = 30.0, duration = 10.0;
+		if (argc-first_arg >= 2) {
+			fps = strtod (argv[first_arg+1], &endptr);
+			if (*endptr != '\0' || fps <= 0.0) {
+				std::cerr << "Invalid frame rate." << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		if (argc-first_arg >= 3) {
+			duration = strtod (argv[first_arg+2], &endptr);
+			if (*endptr != '\0' || duration <= 0.0) {
+				std::cerr << "Invalid duration." << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		try {
+			return play (path, device_index, effect, fps, duration);
+		}
+		catch (std::exception &e) {
+			std::cerr << "Failed to open device: " << e.what () << "." << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
 	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
 	try {
 		dispatcher = std::make_unique<HIDPP::SimpleDispatcher> (path);
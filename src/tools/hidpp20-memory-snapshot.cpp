@@ -0,0 +1,200 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <hidpp/MemorySnapshot.h>
+#include <hidpp/SimpleDispatcher.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IOnboardProfiles.h>
+#include <hidpp20/MemoryMapping.h>
+#include <misc/CRC.h>
+#include <misc/Endian.h>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+
+// Same layout as the GetDescription results
+static std::vector<uint8_t> descriptionBytes (const HIDPP20::IOnboardProfiles::Description &desc)
+{
+	std::vector<uint8_t> bytes = {
+		desc.memory_model,
+		desc.profile_format,
+		desc.macro_format,
+		desc.profile_count, desc.profile_count_oob,
+		desc.button_count,
+		desc.sector_count, 0, 0,
+		desc.mechanical_layout, desc.various_info,
+	};
+	writeBE<uint16_t> (bytes, 7, desc.sector_size);
+	return bytes;
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "device_path backup|restore [file]";
+	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	bool compress = false, force = false, dry_run = false;
+
+	std::vector<Option> options = {
+		DeviceIndexOption (device_index),
+		VerboseOption (),
+		DaemonOption (),
+		Option ('c', "compress",
+			Option::NoArgument, "",
+			"Run-length encode the pages of the backup",
+			[&compress] (const char *) -> bool {
+				compress = true;
+				return true;
+			}),
+		Option ('f', "force",
+			Option::NoArgument, "",
+			"Restore a snapshot taken from another model or firmware",
+			[&force] (const char *) -> bool {
+				force = true;
+				return true;
+			}),
+		Option ('n', "dry-run",
+			Option::NoArgument, "",
+			"Only list the pages a restore would write",
+			[&dry_run] (const char *) -> bool {
+				dry_run = true;
+				return true;
+			}),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg < 2 || argc-first_arg > 3) {
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[first_arg];
+	std::string op = argv[first_arg+1];
+	if (op != "backup" && op != "restore") {
+		fprintf (stderr, "Invalid operation: %s.\n", op.c_str ());
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
+	try {
+		dispatcher = std::make_unique<HIDPP::SimpleDispatcher> (path);
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to open device: %s.\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	HIDPP20::Device dev (dispatcher.get (), device_index);
+	try {
+		HIDPP20::IOnboardProfiles iop (&dev);
+		auto desc = iop.getDescription ();
+		HIDPP::SnapshotHeader header;
+		header.fingerprint = dev.fingerprint ();
+		header.description = descriptionBytes (desc);
+		header.compressed = compress;
+		// Keep the device content as is, CRCs come from the snapshot.
+		HIDPP20::MemoryMapping memory (&dev, false);
+
+		if (op == "backup") {
+			std::vector<HIDPP::Address> pages;
+			for (unsigned int i = 0; i < desc.sector_count; ++i)
+				pages.push_back ({ HIDPP20::IOnboardProfiles::Writeable, i, 0 });
+			memory.prefetch (pages);
+			std::ofstream file;
+			std::ostream *output = &std::cout;
+			if (argc-first_arg == 3) {
+				file.open (argv[first_arg+2], std::ios::binary);
+				if (!file) {
+					fprintf (stderr, "Failed to open %s.\n", argv[first_arg+2]);
+					return EXIT_FAILURE;
+				}
+				output = &file;
+			}
+			HIDPP::SnapshotWriter writer (*output, header);
+			for (const auto &address: pages)
+				writer.writePage (address, memory.getReadOnlyPage (address));
+			writer.finish ();
+			return EXIT_SUCCESS;
+		}
+
+		std::ifstream file;
+		std::istream *input = &std::cin;
+		if (argc-first_arg == 3) {
+			file.open (argv[first_arg+2], std::ios::binary);
+			if (!file) {
+				fprintf (stderr, "Failed to open %s.\n", argv[first_arg+2]);
+				return EXIT_FAILURE;
+			}
+			input = &file;
+		}
+		HIDPP::SnapshotReader reader (*input);
+		if (reader.header ().description != header.description) {
+			fprintf (stderr, "The snapshot memory description does not match the device.\n");
+			return EXIT_FAILURE;
+		}
+		if (reader.header ().fingerprint != header.fingerprint && !force) {
+			fprintf (stderr, "The snapshot was taken from another model or firmware (use --force).\n");
+			return EXIT_FAILURE;
+		}
+		std::vector<HIDPP::SnapshotPage> pages;
+		HIDPP::SnapshotPage page;
+		while (reader.readPage (page)) {
+			if (page.address.mem_type != HIDPP20::IOnboardProfiles::Writeable)
+				continue;
+			pages.push_back (std::move (page));
+		}
+		std::vector<HIDPP::Address> addresses;
+		for (const auto &page: pages)
+			addresses.push_back (page.address);
+		memory.prefetch (addresses);
+		unsigned int differing = 0;
+		for (const auto &page: pages) {
+			const auto &data = memory.getReadOnlyPage (page.address);
+			if (CRC::CCITT (data.data (), data.size ()) == page.crc)
+				continue;
+			printf ("Page %u differs.\n", page.address.page);
+			++differing;
+			if (!dry_run)
+				memory.getWritablePage (page.address) = page.data;
+		}
+		if (!dry_run)
+			memory.sync ();
+		printf ("%u page(s) %s.\n", differing, dry_run ? "differ" : "written");
+	}
+	catch (HIDPP20::Error &e) {
+		fprintf (stderr, "HID++2 error %d: %s\n", e.errorCode (), e.what ());
+		return e.errorCode ();
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "%s\n", e.what ());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -18,18 +18,24 @@
 
 #include <hidpp/SimpleDispatcher.h>
 #include <hidpp/DispatcherThread.h>
+#include <hidpp/EventBus.h>
 #include <hidpp20/Device.h>
 #include <hidpp20/Error.h>
 #include <hidpp20/IMouseButtonSpy.h>
 #include <hidpp20/IOnboardProfiles.h>
+#include <hidpp20/ITouchpadRawXY.h>
 #include <hidpp20/UnsupportedFeature.h>
+#include <algorithm>
 #include <cstdio>
+#include <iostream>
+#include <map>
 #include <memory>
+#include <optional>
 
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
-#include "common/EventQueue.h"
+#include "common/LatencyHistogram.h"
 
 extern "C" {
 #include <unistd.h>
@@ -39,6 +45,97 @@ extern "C" {
 
 using namespace HIDPP20;
 
+// Latency histograms printed on exit (--latency)
+static std::unique_ptr<LatencyHistogram> latency;
+
+/**
+ * Rate and timing statistics of the events, per device and feature index.
+ *
+ * Events are recorded from the dispatcher thread.
+ */
+class EventStats
+{
+	struct Source
+	{
+		unsigned long count = 0;
+		std::chrono::steady_clock::time_point first, last;
+		std::vector<uint32_t> intervals; // µs between events
+		std::vector<uint32_t> dispatch; // µs from reading to the handler
+		std::optional<uint16_t> seqnum;
+		unsigned long seqnum_jumps = 0, seqnum_lost = 0;
+	};
+	std::map<std::pair<unsigned int, unsigned int>, Source> _sources;
+	std::optional<uint8_t> _touchpad_feature;
+
+	static uint32_t percentile (std::vector<uint32_t> &values, unsigned int p)
+	{
+		if (values.empty ())
+			return 0;
+		auto it = values.begin () + (values.size ()-1) * p / 100;
+		std::nth_element (values.begin (), it, values.end ());
+		return *it;
+	}
+
+public:
+	void setTouchpadFeature (uint8_t index)
+	{
+		_touchpad_feature = index;
+	}
+
+	void record (const HIDPP::Report &report)
+	{
+		auto now = std::chrono::steady_clock::now ();
+		auto time = report.receiveTime ();
+		if (time == std::chrono::steady_clock::time_point ())
+			time = now;
+		auto &source = _sources[{ report.deviceIndex (), report.featureIndex () }];
+		if (source.count > 0)
+			source.intervals.push_back (std::chrono::duration_cast<std::chrono::microseconds> (time - source.last).count ());
+		else
+			source.first = time;
+		source.last = time;
+		++source.count;
+		source.dispatch.push_back (std::chrono::duration_cast<std::chrono::microseconds> (now - time).count ());
+		HIDPP20::ITouchpadRawXY::TouchpadRawData data;
+		if (report.featureIndex () == _touchpad_feature &&
+				HIDPP20::ITouchpadRawXY::touchpadRawEvent (HIDPP::ReportView (report), data)) {
+			if (source.seqnum && data.seqnum != uint16_t (*source.seqnum+1)) {
+				++source.seqnum_jumps;
+				source.seqnum_lost += uint16_t (data.seqnum - *source.seqnum - 1);
+			}
+			source.seqnum = data.seqnum;
+		}
+	}
+
+	void print ()
+	{
+		for (auto &[key, source]: _sources) {
+			printf ("Device %u, feature index %u: %lu events", key.first, key.second, source.count);
+			double duration = std::chrono::duration<double> (source.last - source.first).count ();
+			if (duration > 0)
+				printf (", %.1f events/s", (source.count-1) / duration);
+			printf ("\n");
+			if (!source.intervals.empty ()) {
+				uint32_t p50 = percentile (source.intervals, 50);
+				uint32_t p99 = percentile (source.intervals, 99);
+				uint32_t max = *std::max_element (source.intervals.begin (), source.intervals.end ());
+				// Gaps are intervals much longer than the usual one
+				auto gaps = std::count_if (source.intervals.begin (), source.intervals.end (),
+						[p50] (uint32_t interval) { return interval > 4*std::max (p50, 1u); });
+				printf ("  interval: p50 %u us, p99 %u us, max %u us, %ld gaps\n",
+					p50, p99, max, (long) gaps);
+			}
+			printf ("  dispatch: p50 %u us, p99 %u us\n",
+				percentile (source.dispatch, 50), percentile (source.dispatch, 99));
+			if (source.seqnum)
+				printf ("  seqnum: %lu discontinuities, %lu reports lost\n",
+					source.seqnum_jumps, source.seqnum_lost);
+		}
+	}
+};
+// Statistics printed on exit instead of the events (--stats)
+static std::unique_ptr<EventStats> stats;
+
 class EventHandler
 {
 public:
@@ -87,6 +184,39 @@ public:
 	}
 };
 
+class TouchpadHandler: public EventHandler
+{
+	HIDPP20::ITouchpadRawXY _itrxy;
+public:
+	TouchpadHandler (HIDPP20::Device *dev):
+		_itrxy (dev)
+	{
+		_itrxy.setTouchpadRawMode (true);
+	}
+
+	~TouchpadHandler ()
+	{
+		_itrxy.setTouchpadRawMode (false);
+	}
+
+	const HIDPP20::FeatureInterface *feature () const
+	{
+		return &_itrxy;
+	}
+
+	void handleEvent (const HIDPP::Report &event)
+	{
+		HIDPP20::ITouchpadRawXY::TouchpadRawData data;
+		if (!ITouchpadRawXY::touchpadRawEvent (HIDPP::ReportView (event), data))
+			return;
+		printf ("Touchpad frame %u:", data.seqnum);
+		for (const auto &point: data.points)
+			if (point.id != 0)
+				printf (" %d: (%d, %d)", point.id, point.x, point.y);
+		printf ("\n");
+	}
+};
+
 class ProfileHandler: public EventHandler
 {
 	HIDPP20::IOnboardProfiles _iop;
@@ -147,9 +277,10 @@ public:
 		uint8_t feature = handler->feature ()->index ();
 		EventHandler *ptr = handler.get ();
 		handlers.emplace (feature, std::move (handler));
-		auto it = dispatcher->registerEventHandler (index, feature, [ptr] (const HIDPP::Report &report) {
-			ptr->handleEvent (report);
-			return true;
+		auto it = dispatcher->registerEventHandler (index, feature, [this, ptr] (const HIDPP::Report &report) {
+			if (stats)
+				stats->record (report);
+			return event (ptr, report);
 		});
 		iterators.emplace (feature, it);
 	}
@@ -166,41 +297,60 @@ public:
 	virtual void stop () = 0;
 
 protected:
+	EventHandler *handler (uint8_t feature) const
+	{
+		auto it = handlers.find (feature);
+		return it == handlers.end () ? nullptr : it->second.get ();
+	}
+
+	static void handleEvent (EventHandler *handler, const HIDPP::Report &report)
+	{
+		if (latency)
+			latency->recordSince (LatencyHistogram::ReceiveToHandler, report.receiveTime ());
+		if (!stats)
+			handler->handleEvent (report);
+	}
+
 	virtual bool event (EventHandler *handler, const HIDPP::Report &report) = 0;
 };
 
 class ThreadListener: public EventListener
 {
 	HIDPP::DispatcherThread *dispatcher;
-	EventQueue<std::pair<EventHandler *, HIDPP::Report>> queue;
+	HIDPP::EventBus bus;
+	HIDPP::EventBus::Cursor cursor;
 	std::thread thread;
 public:
 	ThreadListener (HIDPP::DispatcherThread *dispatcher, HIDPP::DeviceIndex index):
 		EventListener (dispatcher, index),
 		dispatcher (dispatcher),
+		bus (dispatcher),
+		cursor (bus.cursor ()),
 		thread (std::bind (&HIDPP::DispatcherThread::run, dispatcher))
 	{
 	}
 
 	virtual void start ()
 	{
-		while (auto event = queue.pop ()) {
-			auto pair = event.value ();
-			pair.first->handleEvent (pair.second);
+		while (auto report = cursor.next ()) {
+			if (auto h = handler (report->featureIndex ()))
+				handleEvent (h, *report);
 		}
+		if (cursor.lost () > 0)
+			printf ("%lu events were lost.\n", (unsigned long) cursor.lost ());
 		dispatcher->stop ();
 		thread.join ();
 	}
 
 	virtual void stop ()
 	{
-		queue.interrupt ();
+		bus.interrupt ();
 	}
 
 protected:
 	virtual bool event (EventHandler *handler, const HIDPP::Report &report)
 	{
-		queue.push (std::make_pair (handler, report));
+		bus.publish (report);
 		return true;
 	}
 };
@@ -228,7 +378,7 @@ public:
 protected:
 	virtual bool event (EventHandler *handler, const HIDPP::Report &report)
 	{
-		handler->handleEvent (report);
+		handleEvent (handler, report);
 		return true;
 	}
 };
@@ -254,8 +404,23 @@ int main (int argc, char *argv[])
 				thread = true;
 				return true;
 			}),
+		Option ('l', "latency",
+			Option::NoArgument, "",
+			"Print event latency histograms on exit",
+			[] (const char *) {
+				latency = std::make_unique<LatencyHistogram> ();
+				return true;
+			}),
+		Option ('s', "stats",
+			Option::NoArgument, "",
+			"Print event rate, jitter and loss statistics on exit instead of the events",
+			[] (const char *) {
+				stats = std::make_unique<EventStats> ();
+				return true;
+			}),
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -310,11 +475,25 @@ int main (int argc, char *argv[])
 	catch (HIDPP20::UnsupportedFeature &e) {
 		printf ("%s\n", e.what ());
 	}
+	try {
+		auto handler = std::make_unique<TouchpadHandler> (dev.get ());
+		if (stats)
+			stats->setTouchpadFeature (handler->feature ()->index ());
+		listener->addEventHandler (std::move (handler));
+	}
+	catch (HIDPP20::UnsupportedFeature &e) {
+		printf ("%s\n", e.what ());
+	}
 	listener->start();
 	listener->removeEventHandlers ();
 	sigaction (SIGINT, &oldsa, nullptr);
 	delete listener;
 
+	if (stats)
+		stats->print ();
+	if (latency)
+		latency->print (std::cout);
+
 	return EXIT_SUCCESS;
 }
 
@@ -17,14 +17,20 @@
  */
 
 #include <cstdio>
+#include <iostream>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <cassert>
 #include <thread>
 
 #include "common/common.h"
 #include "common/CommonOptions.h"
-#include "common/EventQueue.h"
+#include "common/MotionChannel.h"
+#include "common/UInputEmitter.h"
+#include "common/LatencyHistogram.h"
+#include "common/TouchpadGestures.h"
 
 extern "C" {
 #include <unistd.h>
@@ -34,6 +40,8 @@ extern "C" {
 #include <linux/uinput.h>
 }
 
+#include <misc/BoundedEventQueue.h>
+#include <misc/EventQueue.h>
 #include <misc/Log.h>
 #include <hid/DeviceMonitor.h>
 #include <hidpp/DispatcherThread.h>
@@ -43,7 +51,24 @@ extern "C" {
 #include <hidpp20/Device.h>
 #include <hidpp20/ITouchpadRawXY.h>
 
-EventQueue<std::function<void ()>> task_queue;
+class Driver;
+// Events queued for the main thread, the reports are shared with the
+// dispatcher pool instead of being copied in each task.
+struct QueuedEvent
+{
+	Driver *driver;
+	HIDPP::SharedReport report;
+};
+BoundedEventQueue<QueuedEvent> task_queue (256);
+// Emit touchpad events from a separate thread instead of the dispatcher thread
+static bool threaded = false;
+// Scheduling of the dispatcher threads
+static RealTime::Options realtime;
+static std::chrono::microseconds busy_poll (0);
+// Recognize gestures in the driver (--gestures)
+static bool gestures = false;
+// Latency histograms printed on exit (--latency)
+static std::unique_ptr<LatencyHistogram> latency;
 
 class Driver
 {
@@ -62,6 +87,14 @@ public:
 			_dispatcher->unregisterEventHandler (it);
 	}
 
+	/**
+	 * Handle an event queued by a handler registered without \p direct.
+	 */
+	void queuedEvent (const HIDPP::Report &report)
+	{
+		event (report);
+	}
+
 protected:
 	HIDPP::Dispatcher *dispatcher ()
 	{
@@ -77,7 +110,10 @@ protected:
 			}
 			:
 			(HIDPP::Dispatcher::event_handler) [this] (const HIDPP::Report &report) {
-				task_queue.push (std::bind (&Driver::event, this, report));
+				// Do not block the dispatcher thread when the queue
+				// is full: the main thread may be waiting for it.
+				if (!task_queue.try_push ({ this, _dispatcher->shareEvent (report) }))
+					Log::warning () << "Event queue is full, dropping event" << std::endl;
 				return true;
 			}
 		));
@@ -93,23 +129,17 @@ static void setBit (int fd, int request, int code)
 		throw std::system_error (errno, std::system_category (), "ioctl");
 }
 
-static void sendEvent (int fd, int type, int code, int value)
-{
-	struct input_event ev;
-	memset (&ev, 0, sizeof (struct input_event));
-	ev.type = type;
-	ev.code = code;
-	ev.value = value;
-	if (-1 == write (fd, &ev, sizeof (struct input_event)))
-		throw std::system_error (errno, std::system_category (), "write");
-}
-
 class TouchpadDriver: public Driver
 {
 	HIDPP20::Device _dev;
 	HIDPP20::ITouchpadRawXY _itrxy;
 	HIDPP20::ITouchpadRawXY::TouchpadInfo _info;
 	int _uinput;
+	bool _threaded;
+	// Decoded frames waiting for the emitter thread (threaded mode only)
+	MotionChannel _frames;
+	std::thread _emitter;
+	std::optional<TouchpadGestures> _gestures;
 	struct MTState {
 		int id[2];
 		uint16_t next_id;
@@ -122,7 +152,7 @@ class TouchpadDriver: public Driver
 		{
 		}
 
-		void event (int uinput, const HIDPP20::ITouchpadRawXY::TouchpadRawData::Point points[], unsigned int point_count)
+		void event (UInputEmitter &uinput, const HIDPP20::ITouchpadRawXY::TouchpadRawData::Point points[], unsigned int point_count)
 		{
 			assert (point_count == 2);
 			bool touching[2] = { false, false };
@@ -134,28 +164,28 @@ class TouchpadDriver: public Driver
 					new_count++;
 					if (id[point.id-1] == -1)
 						id[point.id-1] = next_id++;
-					sendEvent (uinput, EV_ABS, ABS_MT_SLOT, point.id-1);
-					sendEvent (uinput, EV_ABS, ABS_MT_TRACKING_ID, id[point.id-1]);
-					sendEvent (uinput, EV_ABS, ABS_MT_POSITION_X, point.x);
-					sendEvent (uinput, EV_ABS, ABS_MT_POSITION_Y, point.y);
+					uinput.push (EV_ABS, ABS_MT_SLOT, point.id-1);
+					uinput.push (EV_ABS, ABS_MT_TRACKING_ID, id[point.id-1]);
+					uinput.push (EV_ABS, ABS_MT_POSITION_X, point.x);
+					uinput.push (EV_ABS, ABS_MT_POSITION_Y, point.y);
 				}
 			}
 			for (unsigned int i = 0; i < 2; ++i) {
 				if (!touching[i] && id[i] != -1) {
-					sendEvent (uinput, EV_ABS, ABS_MT_SLOT, i);
-					sendEvent (uinput, EV_ABS, ABS_MT_TRACKING_ID, -1);
+					uinput.push (EV_ABS, ABS_MT_SLOT, i);
+					uinput.push (EV_ABS, ABS_MT_TRACKING_ID, -1);
 					id[i] = -1;
 				}
 			}
 			if (new_count != count) {
 				if (new_count == 1)
-					sendEvent (uinput, EV_KEY, BTN_TOOL_FINGER, 1);
+					uinput.push (EV_KEY, BTN_TOOL_FINGER, 1);
 				else if (new_count == 2)
-					sendEvent (uinput, EV_KEY, BTN_TOOL_DOUBLETAP, 1);
+					uinput.push (EV_KEY, BTN_TOOL_DOUBLETAP, 1);
 				if (count == 1)
-					sendEvent (uinput, EV_KEY, BTN_TOOL_FINGER, 0);
+					uinput.push (EV_KEY, BTN_TOOL_FINGER, 0);
 				else if (count == 2)
-					sendEvent (uinput, EV_KEY, BTN_TOOL_DOUBLETAP, 0);
+					uinput.push (EV_KEY, BTN_TOOL_DOUBLETAP, 0);
 				count = new_count;
 			}
 		}
@@ -166,16 +196,16 @@ class TouchpadDriver: public Driver
 			touching (false)
 		{
 		}
-		void event (int uinput, const HIDPP20::ITouchpadRawXY::TouchpadRawData::Point &point)
+		void event (UInputEmitter &uinput, const HIDPP20::ITouchpadRawXY::TouchpadRawData::Point &point)
 		{
 			if (point.id != 0) {
 				if (!touching)
-					sendEvent (uinput, EV_KEY, BTN_TOUCH, 1);
-				sendEvent (uinput, EV_ABS, ABS_X, point.x);
-				sendEvent (uinput, EV_ABS, ABS_Y, point.y);
+					uinput.push (EV_KEY, BTN_TOUCH, 1);
+				uinput.push (EV_ABS, ABS_X, point.x);
+				uinput.push (EV_ABS, ABS_Y, point.y);
 			}
 			else if (touching) {
-				sendEvent (uinput, EV_KEY, BTN_TOUCH, 0);
+				uinput.push (EV_KEY, BTN_TOUCH, 0);
 			}
 			touching = point.id != 0;
 		}
@@ -185,7 +215,8 @@ public:
 		Driver (dispatcher),
 		_dev (dispatcher, index),
 		_itrxy (&_dev),
-		_info (_itrxy.getTouchpadInfo ())
+		_info (_itrxy.getTouchpadInfo ()),
+		_threaded (threaded)
 	{
 		if (-1 == (_uinput = open ("/dev/uinput", O_RDWR)))
 			throw std::system_error (errno, std::system_category (), "open uinput");
@@ -220,6 +251,10 @@ public:
 			setBit (_uinput, UI_SET_KEYBIT, BTN_TOUCH);
 			setBit (_uinput, UI_SET_KEYBIT, BTN_TOOL_FINGER);
 			setBit (_uinput, UI_SET_KEYBIT, BTN_TOOL_DOUBLETAP);
+			if (gestures) {
+				_gestures.emplace (_info.x_max, _info.y_max);
+				TouchpadGestures::setupDevice (_uinput);
+			}
 			if (-1 == write (_uinput, &uidev, sizeof (struct uinput_user_dev)))
 				throw std::system_error (errno, std::system_category (), "write");
 			if (-1 == ioctl (_uinput, UI_DEV_CREATE))
@@ -234,6 +269,11 @@ public:
 		printf ("Added touchpad device: %s\n", _dev.name ().c_str ());
 		addEvent (index, _itrxy.index (), true);
 		_itrxy.setTouchpadRawMode (true);
+		if (_threaded)
+			_emitter = std::thread ([this] () {
+				while (auto frame = _frames.pop ())
+					emit (frame->touch, frame->time);
+			});
 	}
 
 	~TouchpadDriver ()
@@ -244,21 +284,49 @@ public:
 		catch (std::exception &e) {
 			Log::debug () << "Could not disable raw mode: " << e.what () << std::endl;
 		}
+		if (_emitter.joinable ()) {
+			_frames.interrupt ();
+			_emitter.join ();
+		}
 	}
 
 protected:
+	/*
+	 * Reports are decoded on the dispatcher thread, then the frame is
+	 * either emitted right away or handed to the emitter thread.
+	 */
 	void event (const HIDPP::Report &report)
 	{
-		if (report.function () != HIDPP20::ITouchpadRawXY::TouchpadRawEvent)
+		std::chrono::steady_clock::time_point handled;
+		if (latency)
+			handled = std::chrono::steady_clock::now ();
+		HIDPP20::ITouchpadRawXY::TouchpadRawData data;
+		if (!HIDPP20::ITouchpadRawXY::touchpadRawEvent (HIDPP::ReportView (report), data))
 			return;
-		auto data = HIDPP20::ITouchpadRawXY::touchpadRawEvent (report);
+		if (latency)
+			latency->recordSince (LatencyHistogram::ReceiveToHandler, report.receiveTime ());
 		for (unsigned int i = 0; i < 2; ++i)
 			if (data.points[i].id != 0)
 				data.points[i].y = 0x4000+_info.y_max-data.points[i].y;
+		if (_threaded)
+			_frames.pushTouch (data, handled);
+		else
+			emit (data, handled);
+	}
+
+private:
+	void emit (const HIDPP20::ITouchpadRawXY::TouchpadRawData &data,
+		   std::chrono::steady_clock::time_point handled)
+	{
 		try {
-			st_state.event (_uinput, data.points[0]);
-			mt_state.event (_uinput, data.points, 2);
-			sendEvent (_uinput, EV_SYN, SYN_REPORT, 0);
+			UInputEmitter emitter (_uinput);
+			st_state.event (emitter, data.points[0]);
+			mt_state.event (emitter, data.points, 2);
+			if (_gestures)
+				_gestures->frame (data, std::chrono::steady_clock::now (), emitter);
+			emitter.sync ();
+			if (latency)
+				latency->recordSince (LatencyHistogram::HandlerToWrite, handled);
 		}
 		catch (std::exception &e) {
 			Log::error () << "Failed to send uinput event: " << e.what () << std::endl;
@@ -326,9 +394,11 @@ class MyMonitor: public HID::DeviceMonitor
 		std::unique_ptr<Driver> driver;
 
 		node (const char *path):
-			dispatcher (path),
-			thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher))
+			dispatcher (path)
 		{
+			dispatcher.setRealTimeOptions (realtime);
+			dispatcher.hidraw ().setBusyPoll (busy_poll);
+			thread = std::thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
 		}
 
 		~node ()
@@ -338,41 +408,63 @@ class MyMonitor: public HID::DeviceMonitor
 			thread.join ();
 		}
 	};
-	std::map<std::string, node> _nodes;
+	std::mutex _nodes_mutex;
+	std::map<std::string, std::unique_ptr<node>> _nodes;
 public:
+	MyMonitor ()
+	{
+		// Probe nodes plugged together (e.g. a hub of receivers) concurrently
+		setWorkerCount (4);
+	}
+
+	~MyMonitor ()
+	{
+		setWorkerCount (0);
+	}
+
 	void addDevice (const char *path)
 	{
-		std::map<std::string, node>::iterator it;
+		std::unique_ptr<node> n;
 		try {
-			it = _nodes.emplace (path, path).first;
+			n = std::make_unique<node> (path);
 		}
 		catch (std::exception &e) {
 			Log::debug () << "Ignored device " << path << ": " << e.what () << std::endl;
 			return;
 		}
-		auto &node = it->second;
 		try {
-			node.driver = std::make_unique<ReceiverDriver> (&node.dispatcher);
-			return;
+			n->driver = std::make_unique<ReceiverDriver> (&n->dispatcher);
 		}
 		catch (std::exception &e) {
 			Log::debug () << "Device " << path << " is not a receiver: " << e.what () << std::endl;
 		}
 		for (HIDPP::DeviceIndex index: { HIDPP::DefaultDevice, HIDPP::CordedDevice }) {
+			if (n->driver)
+				break;
 			try {
-				node.driver = std::make_unique<TouchpadDriver> (&node.dispatcher, index);
-				return;
+				n->driver = std::make_unique<TouchpadDriver> (&n->dispatcher, index);
 			}
 			catch (std::exception &e) {
 				Log::debug () << "Device " << path << "/" << index << " is not a touchpad device: " << e.what () << std::endl;
 			}
 		}
-		_nodes.erase (it);
+		if (!n->driver)
+			return;
+		std::unique_lock<std::mutex> lock (_nodes_mutex);
+		_nodes[path] = std::move (n);
 	}
 
 	void removeDevice (const char *path)
 	{
-		_nodes.erase (path);
+		std::unique_ptr<node> n; // stopped outside the lock
+		{
+			std::unique_lock<std::mutex> lock (_nodes_mutex);
+			auto it = _nodes.find (path);
+			if (it == _nodes.end ())
+				return;
+			n = std::move (it->second);
+			_nodes.erase (it);
+		}
 	}
 };
 
@@ -385,6 +477,32 @@ int main (int argc, char *argv[])
 {
 	std::vector<Option> options = {
 		VerboseOption (),
+		DaemonOption (),
+		Option ('t', "threaded",
+			Option::NoArgument, "",
+			"Send touchpad events from a separate thread instead of the HID++ dispatcher thread",
+			[] (const char *) -> bool {
+				threaded = true;
+				return true;
+			}),
+		Option ('g', "gestures",
+			Option::NoArgument, "",
+			"Recognize taps, scrolling, pinches and swipes and send them as button, wheel and key events",
+			[] (const char *) -> bool {
+				gestures = true;
+				return true;
+			}),
+		Option ('l', "latency",
+			Option::NoArgument, "",
+			"Print event latency histograms on exit",
+			[] (const char *) -> bool {
+				latency = std::make_unique<LatencyHistogram> ();
+				return true;
+			}),
+		SchedulingOption (realtime),
+		CPUAffinityOption (realtime),
+		LockMemoryOption (realtime),
+		BusyPollOption (busy_poll),
 	};
 	Option help = HelpOption (argv[0], "", &options);
 	options.push_back (help);
@@ -401,13 +519,20 @@ int main (int argc, char *argv[])
 	sa.sa_handler = sigint;
 	sigaction (SIGINT, &sa, &oldsa);
 
-	while (auto task = task_queue.pop ())
-		task.value () ();
+	std::vector<QueuedEvent> tasks;
+	while (task_queue.pop_all (tasks)) {
+		for (const auto &task: tasks)
+			task.driver->queuedEvent (*task.report);
+		tasks.clear ();
+	}
 
 	sigaction (SIGINT, &oldsa, nullptr);
 
 	monitor.stop ();
 	monitor_thread.join ();
 
+	if (latency)
+		latency->print (std::cout);
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,275 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+
+#include <hid/ReportCapture.h>
+#include <hidpp/DispatcherThread.h>
+#include <hidpp/ReplayDevice.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/IMouseButtonSpy.h>
+#include <hidpp20/IReprogControlsV4.h>
+#include <hidpp20/ITouchpadRawXY.h>
+#include <hidpp20/UnsupportedFeature.h>
+#include <misc/EventQueue.h>
+#include <misc/Log.h>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+#include "common/LatencyHistogram.h"
+
+extern "C" {
+#include <signal.h>
+#include <string.h>
+}
+
+// Only used for waiting for SIGINT or the end of the replay
+static EventQueue<int> stop_queue;
+
+static void sigint (int)
+{
+	stop_queue.interrupt ();
+}
+
+static void waitForStop ()
+{
+	struct sigaction sa, oldsa;
+	memset (&sa, 0, sizeof (struct sigaction));
+	sa.sa_handler = sigint;
+	sigaction (SIGINT, &sa, &oldsa);
+	stop_queue.pop ();
+	sigaction (SIGINT, &oldsa, nullptr);
+}
+
+static int record (const char *path, HIDPP::DeviceIndex device_index,
+		   const char *capture_path, std::size_t capacity)
+{
+	HIDPP::DispatcherThread dispatcher (path);
+	std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+	auto capture = std::make_shared<HID::ReportCapture> (capacity);
+	std::vector<HIDPP::Dispatcher::listener_iterator> listeners;
+	int ret = EXIT_SUCCESS;
+	try {
+		HIDPP20::Device dev (&dispatcher, device_index);
+		auto listen = [&] (const HIDPP20::FeatureInterface &feature, const char *name) {
+			printf ("Recording %s events (feature index %u).\n", name, feature.index ());
+			listeners.push_back (dispatcher.registerEventHandler (device_index, feature.index (),
+				[capture] (const HIDPP::Report &report) {
+					capture->record (0, HID::ReportCapture::Input,
+							 report.rawData (), report.rawLength ());
+					return true;
+				}));
+		};
+		std::unique_ptr<HIDPP20::IMouseButtonSpy> imbs;
+		std::unique_ptr<HIDPP20::ITouchpadRawXY> itrxy;
+		std::unique_ptr<HIDPP20::IReprogControlsV4> irc;
+		try {
+			imbs = std::make_unique<HIDPP20::IMouseButtonSpy> (&dev);
+			listen (*imbs, "mouse button");
+			imbs->startMouseButtonSpy ();
+		}
+		catch (HIDPP20::UnsupportedFeature &e) {
+		}
+		try {
+			itrxy = std::make_unique<HIDPP20::ITouchpadRawXY> (&dev);
+			listen (*itrxy, "touchpad");
+			itrxy->setTouchpadRawMode (true);
+		}
+		catch (HIDPP20::UnsupportedFeature &e) {
+		}
+		try {
+			// Only the controls diverted with hidpp20-reprog-controls send events
+			irc = std::make_unique<HIDPP20::IReprogControlsV4> (&dev);
+			listen (*irc, "diverted control");
+		}
+		catch (HIDPP20::UnsupportedFeature &e) {
+		}
+		if (listeners.empty ())
+			throw std::runtime_error ("The device has no supported event feature");
+
+		printf ("Press Ctrl-C to stop recording.\n");
+		waitForStop ();
+
+		if (imbs)
+			imbs->stopMouseButtonSpy ();
+		if (itrxy)
+			itrxy->setTouchpadRawMode (false);
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Recording failed: %s\n", e.what ());
+		ret = EXIT_FAILURE;
+	}
+	for (const auto &it: listeners)
+		dispatcher.unregisterEventHandler (it);
+	dispatcher.stop ();
+	thread.join ();
+	if (ret != EXIT_SUCCESS)
+		return ret;
+
+	auto count = capture->recorded ();
+	if (count > capacity)
+		fprintf (stderr, "Only the last %zu of %lu events are kept.\n",
+			 capacity, (unsigned long) count);
+	try {
+		capture->save (capture_path);
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to save the events: %s\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	printf ("Recorded %lu events.\n", (unsigned long) std::min<uint64_t> (count, capacity));
+	return EXIT_SUCCESS;
+}
+
+static int replay (const char *capture_path, double speed)
+{
+	std::vector<HID::ReportCapture::Entry> entries;
+	try {
+		entries = HID::ReportCapture::load (capture_path);
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to load %s: %s\n", capture_path, e.what ());
+		return EXIT_FAILURE;
+	}
+	// Listen to every device and feature index found in the capture
+	std::set<std::pair<HIDPP::DeviceIndex, uint8_t>> sources;
+	for (const auto &entry: entries)
+		if (entry.direction == HID::ReportCapture::Input && entry.report.size () > 2)
+			sources.emplace (static_cast<HIDPP::DeviceIndex> (entry.report[1]),
+					 entry.report[2]);
+	std::size_t expected = 0;
+	for (const auto &entry: entries)
+		if (entry.direction == HID::ReportCapture::Input)
+			++expected;
+	if (expected == 0) {
+		fprintf (stderr, "There is no event in %s.\n", capture_path);
+		return EXIT_FAILURE;
+	}
+
+	// Make sure the scheme is registered when libhidpp is linked statically
+	HIDPP::ReplayDevice::registerScheme ();
+	std::string path = std::string ("replay:") + capture_path + ",speed=" + std::to_string (speed);
+	LatencyHistogram latency;
+	std::map<std::pair<HIDPP::DeviceIndex, uint8_t>, unsigned long> counts;
+	std::size_t received = 0;
+	auto start = std::chrono::steady_clock::now ();
+	try {
+		HIDPP::DispatcherThread dispatcher (path.c_str ());
+		std::vector<HIDPP::Dispatcher::listener_iterator> listeners;
+		for (const auto &source: sources)
+			listeners.push_back (dispatcher.registerEventHandler (source.first, source.second,
+				[&, source] (const HIDPP::Report &report) {
+					latency.recordSince (LatencyHistogram::ReceiveToHandler,
+							     report.receiveTime ());
+					++counts[source];
+					if (++received == expected)
+						stop_queue.interrupt ();
+					return true;
+				}));
+		std::thread thread (std::bind (&HIDPP::DispatcherThread::run, &dispatcher));
+		start = std::chrono::steady_clock::now ();
+		// Stop when every event was replayed, or on Ctrl-C
+		waitForStop ();
+		for (const auto &it: listeners)
+			dispatcher.unregisterEventHandler (it);
+		dispatcher.stop ();
+		thread.join ();
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Replay failed: %s\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	auto duration = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+	for (const auto &[source, count]: counts)
+		printf ("Device %u, feature index %u: %lu events\n",
+			source.first, source.second, count);
+	printf ("Replayed %zu events in %.3f s (%.0f events/s).\n",
+		received, duration, duration > 0 ? received/duration : 0.0);
+	latency.print (std::cout);
+	return EXIT_SUCCESS;
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "/dev/hidrawX capture_file | --replay capture_file";
+	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	bool replay_mode = false;
+	double speed = 1.0;
+	std::size_t capacity = 1 << 20;
+
+	std::vector<Option> options = {
+		DeviceIndexOption (device_index),
+		VerboseOption (),
+		DaemonOption (),
+		Option ('r', "replay",
+			Option::NoArgument, "",
+			"Replay a capture through a dispatcher instead of recording one",
+			[&replay_mode] (const char *) -> bool {
+				replay_mode = true;
+				return true;
+			}),
+		Option ('s', "speed",
+			Option::RequiredArgument, "factor",
+			"Replay speed factor (default: 1, 0 for as fast as possible)",
+			[&speed] (const char *optarg) -> bool {
+				char *endptr;
+				speed = strtod (optarg, &endptr);
+				if (*endptr != '\0' || speed < 0) {
+					fprintf (stderr, "Invalid speed factor.\n");
+					return false;
+				}
+				return true;
+			}),
+		Option ('n', "max-events",
+			Option::RequiredArgument, "count",
+			"Number of recorded events kept, older events are dropped (default: 1048576)",
+			[&capacity] (const char *optarg) -> bool {
+				char *endptr;
+				capacity = strtoul (optarg, &endptr, 0);
+				if (*endptr != '\0' || capacity == 0) {
+					fprintf (stderr, "Invalid event count.\n");
+					return false;
+				}
+				return true;
+			}),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg != (replay_mode ? 1 : 2)) {
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	if (replay_mode)
+		return replay (argv[first_arg], speed);
+	else
+		return record (argv[first_arg], device_index, argv[first_arg+1], capacity);
+}
@@ -0,0 +1,404 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <hidpp/DispatcherThread.h>
+#include <hidpp20/ButtonRemapper.h>
+#include <hidpp20/Device.h>
+#include <hidpp20/IHiResWheel.h>
+#include <misc/Log.h>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <set>
+#include <thread>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+#include "common/MotionChannel.h"
+#include "common/ScrollAccumulator.h"
+#include "common/UInputEmitter.h"
+
+extern "C" {
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <linux/uinput.h>
+}
+
+using namespace HIDPP20;
+
+// Linux keys for the consumer usages of common media keys
+static const std::map<uint16_t, uint16_t> ConsumerKeys = {
+	{ 0x00b5, KEY_NEXTSONG },
+	{ 0x00b6, KEY_PREVIOUSSONG },
+	{ 0x00b7, KEY_STOPCD },
+	{ 0x00cd, KEY_PLAYPAUSE },
+	{ 0x00e2, KEY_MUTE },
+	{ 0x00e9, KEY_VOLUMEUP },
+	{ 0x00ea, KEY_VOLUMEDOWN },
+	{ 0x0223, KEY_HOMEPAGE },
+	{ 0x0224, KEY_BACK },
+	{ 0x0225, KEY_FORWARD },
+};
+
+/**
+ * Send the remapped events to a uinput keyboard, one write per report.
+ */
+class UInputOutput: public ButtonRemapper::Output
+{
+	int _fd;
+	UInputEmitter _emitter;
+public:
+	UInputOutput (const char *name, const std::set<uint16_t> &keys):
+		_fd (open ("/dev/uinput", O_RDWR)),
+		_emitter (_fd)
+	{
+		if (_fd == -1)
+			throw std::system_error (errno, std::system_category (), "open uinput");
+		struct uinput_user_dev uidev;
+		memset (&uidev, 0, sizeof (struct uinput_user_dev));
+		strncpy (uidev.name, name, UINPUT_MAX_NAME_SIZE-1);
+		uidev.id.bustype = BUS_VIRTUAL;
+		try {
+			if (-1 == ioctl (_fd, UI_SET_EVBIT, EV_KEY))
+				throw std::system_error (errno, std::system_category (), "ioctl");
+			for (auto key: keys)
+				if (-1 == ioctl (_fd, UI_SET_KEYBIT, key))
+					throw std::system_error (errno, std::system_category (), "ioctl");
+			if (-1 == write (_fd, &uidev, sizeof (struct uinput_user_dev)))
+				throw std::system_error (errno, std::system_category (), "write");
+			if (-1 == ioctl (_fd, UI_DEV_CREATE))
+				throw std::system_error (errno, std::system_category (), "ioctl UI_DEV_CREATE");
+		}
+		catch (std::exception &e) {
+			close (_fd);
+			throw;
+		}
+	}
+
+	~UInputOutput ()
+	{
+		ioctl (_fd, UI_DEV_DESTROY);
+		close (_fd);
+	}
+
+	void key (uint16_t code, bool pressed) override
+	{
+		_emitter.push (EV_KEY, code, pressed);
+	}
+
+	void consumerControl (uint16_t usage, bool pressed) override
+	{
+		auto it = ConsumerKeys.find (usage);
+		if (it != ConsumerKeys.end ())
+			_emitter.push (EV_KEY, it->second, pressed);
+	}
+
+	void sync () override
+	{
+		_emitter.sync ();
+	}
+};
+
+/**
+ * Divert the wheel in high resolution mode and send its movements to a
+ * uinput device from a separate thread. Movements arriving while the
+ * thread is writing are summed (see MotionChannel).
+ */
+class WheelOutput
+{
+	IHiResWheel _wheel;
+	uint8_t _old_mode;
+	unsigned int _multiplier;
+	int _fd;
+	MotionChannel _channel;
+	HIDPP::Dispatcher::listener_iterator _listener;
+	std::thread _thread;
+public:
+	WheelOutput (Device *dev, const char *name):
+		_wheel (dev),
+		_old_mode (_wheel.getWheelMode ()),
+		_multiplier (_wheel.getWheelCapability ().multiplier),
+		_fd (open ("/dev/uinput", O_RDWR))
+	{
+		if (_fd == -1)
+			throw std::system_error (errno, std::system_category (), "open uinput");
+		struct uinput_user_dev uidev;
+		memset (&uidev, 0, sizeof (struct uinput_user_dev));
+		strncpy (uidev.name, name, UINPUT_MAX_NAME_SIZE-1);
+		uidev.id.bustype = BUS_VIRTUAL;
+		try {
+			if (-1 == ioctl (_fd, UI_SET_EVBIT, EV_REL) ||
+					-1 == ioctl (_fd, UI_SET_RELBIT, REL_WHEEL) ||
+					-1 == ioctl (_fd, UI_SET_RELBIT, REL_WHEEL_HI_RES))
+				throw std::system_error (errno, std::system_category (), "ioctl");
+			if (-1 == write (_fd, &uidev, sizeof (struct uinput_user_dev)))
+				throw std::system_error (errno, std::system_category (), "write");
+			if (-1 == ioctl (_fd, UI_DEV_CREATE))
+				throw std::system_error (errno, std::system_category (), "ioctl UI_DEV_CREATE");
+		}
+		catch (std::exception &e) {
+			close (_fd);
+			throw;
+		}
+		auto dispatcher = _wheel.device ()->dispatcher ();
+		_listener = dispatcher->registerEventHandler (_wheel.device ()->deviceIndex (), _wheel.index (),
+			[this] (const HIDPP::Report &report) {
+				if (report.function () != IHiResWheel::WheelMovement)
+					return true;
+				auto movement = IHiResWheel::wheelMovementEvent (report);
+				_channel.pushScroll (movement.high_resolution ?
+							movement.delta :
+							movement.delta * int (_multiplier),
+						     report.receiveTime ());
+				return true;
+			});
+		try {
+			_wheel.setWheelMode (IHiResWheel::Diverted | IHiResWheel::HighResolution |
+					     (_old_mode & IHiResWheel::Inverted));
+		}
+		catch (std::exception &e) {
+			dispatcher->unregisterEventHandler (_listener);
+			ioctl (_fd, UI_DEV_DESTROY);
+			close (_fd);
+			throw;
+		}
+		_thread = std::thread (&WheelOutput::run, this);
+	}
+
+	~WheelOutput ()
+	{
+		try {
+			_wheel.setWheelMode (_old_mode);
+		}
+		catch (std::exception &e) {
+			Log::debug () << "Could not restore the wheel mode: " << e.what () << std::endl;
+		}
+		_wheel.device ()->dispatcher ()->unregisterEventHandler (_listener);
+		_channel.interrupt ();
+		_thread.join ();
+		ioctl (_fd, UI_DEV_DESTROY);
+		close (_fd);
+	}
+
+private:
+	void run ()
+	{
+		ScrollAccumulator scroll (_multiplier);
+		while (auto event = _channel.pop ()) {
+			int hi_res, detents;
+			scroll.scroll (event->wheel, hi_res, detents);
+			if (hi_res == 0)
+				continue;
+			try {
+				UInputEmitter emitter (_fd);
+				emitter.push (EV_REL, REL_WHEEL_HI_RES, hi_res);
+				if (detents != 0)
+					emitter.push (EV_REL, REL_WHEEL, detents);
+				emitter.sync ();
+			}
+			catch (std::exception &e) {
+				Log::error () << "Failed to send uinput event: " << e.what () << std::endl;
+			}
+		}
+	}
+};
+
+/**
+ * Parse "control_id=type:value", the control ID and values accept the
+ * C prefixes (e.g. 0x for hexadecimal).
+ */
+static bool parseAction (const char *str, uint16_t &control_id,
+			 ButtonRemapper::Action &action,
+			 std::vector<std::vector<ButtonRemapper::MacroStep>> &macros)
+{
+	char *endptr;
+	control_id = strtol (str, &endptr, 0);
+	if (*endptr != '=')
+		return false;
+	std::string spec = endptr+1;
+	auto colon = spec.find (':');
+	if (colon == std::string::npos)
+		return false;
+	std::string type = spec.substr (0, colon);
+	const char *value = spec.c_str () + colon+1;
+	if (type == "macro") {
+		std::vector<uint16_t> keys;
+		do {
+			keys.push_back (strtol (value, &endptr, 0));
+			if (endptr == value)
+				return false;
+			value = endptr+1;
+		} while (*endptr == ',');
+		if (*endptr != '\0')
+			return false;
+		// Press the keys in order, then release them in reverse
+		std::vector<ButtonRemapper::MacroStep> steps;
+		for (auto key: keys)
+			steps.push_back ({ key, true });
+		for (auto it = keys.rbegin (); it != keys.rend (); ++it)
+			steps.push_back ({ *it, false });
+		action = { ButtonRemapper::Action::Macro, static_cast<uint16_t> (macros.size ()) };
+		macros.push_back (std::move (steps));
+		return true;
+	}
+	uint16_t code = strtol (value, &endptr, 0);
+	if (endptr == value || *endptr != '\0')
+		return false;
+	if (type == "key")
+		action = { ButtonRemapper::Action::Key, code };
+	else if (type == "consumer") {
+		if (ConsumerKeys.find (code) == ConsumerKeys.end ())
+			return false;
+		action = { ButtonRemapper::Action::ConsumerControl, code };
+	}
+	else if (type == "dpi")
+		action = { ButtonRemapper::Action::DPIShift, code };
+	else
+		return false;
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	static const char *args = "device_path control_id=key:code|consumer:usage|macro:code,...|dpi:value...";
+	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
+	RealTime::Options realtime;
+	bool stats = false;
+	bool divert_wheel = false;
+	auto source = ButtonRemapper::Source::DivertedControls;
+
+	std::vector<Option> options = {
+		Option ('b', "spy",
+			Option::NoArgument, "",
+			"Spy the mouse buttons instead of diverting controls, actions are given for button numbers",
+			[&source] (const char *) {
+				source = ButtonRemapper::Source::MouseButtonSpy;
+				return true;
+			}),
+		Option ('w', "wheel",
+			Option::NoArgument, "",
+			"Divert the wheel in high resolution mode and send its scrolling from a separate thread",
+			[&divert_wheel] (const char *) {
+				divert_wheel = true;
+				return true;
+			}),
+		Option ('s', "stats",
+			Option::NoArgument, "",
+			"Print the event processing times and the latency added to the native mapping on exit",
+			[&stats] (const char *) {
+				stats = true;
+				return true;
+			}),
+		DeviceIndexOption (device_index),
+		SchedulingOption (realtime),
+		CPUAffinityOption (realtime),
+		LockMemoryOption (realtime),
+		VerboseOption (),
+		DaemonOption (),
+	};
+	Option help = HelpOption (argv[0], args, &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg < (divert_wheel ? 1 : 2)) {
+		fprintf (stderr, "Too few arguments.\n");
+		fprintf (stderr, "%s", getUsage (argv[0], args, &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	const char *path = argv[first_arg];
+	std::map<uint16_t, ButtonRemapper::Action> actions;
+	std::vector<std::vector<ButtonRemapper::MacroStep>> macros;
+	std::set<uint16_t> keys;
+	for (int i = first_arg+1; i < argc; ++i) {
+		uint16_t control_id;
+		ButtonRemapper::Action action;
+		if (!parseAction (argv[i], control_id, action, macros)) {
+			fprintf (stderr, "Invalid action: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+		actions[control_id] = action;
+		if (action.type == ButtonRemapper::Action::Key)
+			keys.insert (action.code);
+		else if (action.type == ButtonRemapper::Action::ConsumerControl)
+			keys.insert (ConsumerKeys.at (action.code));
+	}
+	for (const auto &macro: macros)
+		for (const auto &step: macro)
+			keys.insert (step.key);
+
+	// Signals are waited for by the main thread only
+	sigset_t signals;
+	sigemptyset (&signals);
+	sigaddset (&signals, SIGINT);
+	sigaddset (&signals, SIGTERM);
+	pthread_sigmask (SIG_BLOCK, &signals, nullptr);
+
+	std::unique_ptr<HIDPP::DispatcherThread> dispatcher;
+	std::thread thread;
+	try {
+		dispatcher = std::make_unique<HIDPP::DispatcherThread> (path);
+		dispatcher->setRealTimeOptions (realtime);
+		thread = std::thread (std::bind (&HIDPP::DispatcherThread::run, dispatcher.get ()));
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Failed to open device: %s.\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	int ret = EXIT_SUCCESS;
+	try {
+		Device dev (dispatcher.get (), device_index);
+		UInputOutput output ((dev.name () + " remapped buttons").c_str (), keys);
+		std::optional<WheelOutput> wheel;
+		if (divert_wheel)
+			wheel.emplace (&dev, (dev.name () + " wheel").c_str ());
+		ButtonRemapper remapper (&dev, output, actions, std::move (macros), source);
+		remapper.start ();
+		int sig;
+		sigwait (&signals, &sig);
+		remapper.stop ();
+		if (stats) {
+			auto s = remapper.statistics ();
+			printf ("%lu events, %lu over the %ld us budget, max %.1f us\n",
+				(unsigned long) s.events, (unsigned long) s.over_budget,
+				(long) ButtonRemapper::Budget.count (),
+				s.max_processing.count () / 1000.0);
+			// The native mapping is applied by the device, reports are
+			// already remapped when they are read: the latency from
+			// reading to writing the uinput events is what remapping
+			// in userspace adds.
+			if (s.events > 0)
+				printf ("Added latency: mean %.1f us, max %.1f us\n",
+					s.total_latency.count () / 1000.0 / s.events,
+					s.max_latency.count () / 1000.0);
+		}
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "Error: %s\n", e.what ());
+		ret = EXIT_FAILURE;
+	}
+	dispatcher->stop ();
+	thread.join ();
+	return ret;
+}
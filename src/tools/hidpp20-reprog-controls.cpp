@@ -84,6 +84,7 @@ int main (int argc, char *argv[])
 			std::bind (setFlag, &raw_xy, std::placeholders::_1)),
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -114,10 +115,8 @@ int main (int argc, char *argv[])
 	try {
 		IReprogControlsV4 irc (&dev);
 		if (op == "info") {
-			unsigned int count = irc.getControlCount ();
 			printf ("Control\tTask\tInfo\tFn\tCapabilities\tGroup\tRemap to groups\n");
-			for (unsigned int i = 0; i < count; ++i) {
-				auto info = irc.getControlInfo (i);
+			for (const auto &info: irc.getAllControlInfo ()) {
 				printf ("0x%04hx\t0x%04hx", info.control_id, info.task_id);
 				if (info.flags & IReprogControlsV4::MouseButton)
 					printf ("\tmouse");
@@ -164,12 +163,25 @@ int main (int argc, char *argv[])
 			}
 		}
 		else if (op == "get") {
-			int cid;
-			char *endptr;
+			auto printReporting = [] (uint16_t remap, uint8_t flags) {
+				printf ("0x%04hx (flags: ", remap);
+				printFlags (flags, {
+					std::make_tuple (IReprogControlsV4::TemporaryDiverted, "divert"),
+					std::make_tuple (IReprogControlsV4::PersistentDiverted, "persist"),
+					std::make_tuple (IReprogControlsV4::RawXYDiverted, "rawxy"),
+				});
+				printf (")\n");
+			};
 			if (argc-first_arg < 1) {
-				fprintf (stderr, "Missing control id.\n");
-				return EXIT_FAILURE;
+				// Every control, with pipelined queries
+				for (const auto &state: irc.getAllControlState ()) {
+					printf ("0x%04hx: ", state.info.control_id);
+					printReporting (state.remap, state.flags);
+				}
+				return EXIT_SUCCESS;
 			}
+			int cid;
+			char *endptr;
 			cid = strtol (argv[first_arg], &endptr, 0);
 			if (*endptr != '\0' || cid < 0 || cid > 65535) {
 				fprintf (stderr, "Invalid control ID value.\n");
@@ -177,13 +189,7 @@ int main (int argc, char *argv[])
 			}
 			uint8_t flags;
 			uint16_t remap = irc.getControlReporting (cid, flags);
-			printf ("0x%04hx (flags: ", remap);
-			printFlags (flags, {
-				std::make_tuple (IReprogControlsV4::TemporaryDiverted, "divert"),
-				std::make_tuple (IReprogControlsV4::PersistentDiverted, "persist"),
-				std::make_tuple (IReprogControlsV4::RawXYDiverted, "rawxy"),
-			});
-			printf (")\n");
+			printReporting (remap, flags);
 
 		}
 		else if (op == "set") {
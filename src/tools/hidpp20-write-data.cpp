@@ -38,6 +38,7 @@ int main (int argc, char *argv[])
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -89,9 +90,7 @@ int main (int argc, char *argv[])
 		HIDPP20::IOnboardProfiles iop (&dev);
 		iop.memoryAddrWrite (page, offset, data.size ());
 
-		constexpr auto LineSize = HIDPP20::IOnboardProfiles::LineSize;
-		for (unsigned int i = 0; i < data.size (); i += LineSize)
-			iop.memoryWrite (data.begin () + i, data.begin () + i + LineSize);
+		iop.memoryWriteLines (data.begin (), data.end ());
 
 		iop.memoryWriteEnd ();
 	}
@@ -16,6 +16,7 @@
  *
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <memory>
 
@@ -29,23 +30,63 @@
 #include "common/common.h"
 #include "common/Option.h"
 #include "common/CommonOptions.h"
+#include "common/TransferProgress.h"
+
+// Read the next sector from \p file, missing bytes are left erased (0xff).
+// Returns the number of bytes read.
+static std::size_t readSector (FILE *file, std::vector<uint8_t> &data)
+{
+	std::fill (data.begin (), data.end (), 0xff);
+	return fread (data.data (), sizeof (uint8_t), data.size (), file);
+}
+
+// Replace the last two bytes of the page with the CRC of the others
+static void addCRC (std::vector<uint8_t> &data)
+{
+	size_t page_content_size = data.size () - 2;
+	uint16_t crc = CRC::CCITT (data.begin (), data.begin () + page_content_size);
+	writeBE (data, page_content_size, crc);
+}
 
 int main (int argc, char *argv[])
 {
-	static const char *args = "device_path page";
+	static const char *args = "device_path first_page";
 	HIDPP::DeviceIndex device_index = HIDPP::DefaultDevice;
-	bool add_crc = false;
+	bool add_crc = false, progress = false;
+	const char *input_path = nullptr, *baseline_path = nullptr;
 
 	std::vector<Option> options = {
 		DeviceIndexOption (device_index),
 		VerboseOption (),
+		DaemonOption (),
 		Option ('c', "crc",
 			Option::NoArgument, "",
-			"Add CRC add the end of the page",
+			"Add CRC add the end of each page",
 			[&add_crc] (const char *) -> bool {
 				add_crc = true;
 				return true;
 			}),
+		Option ('i', "input",
+			Option::RequiredArgument, "file",
+			"Read the pages from file instead of the standard input",
+			[&input_path] (const char *optarg) -> bool {
+				input_path = optarg;
+				return true;
+			}),
+		Option ('b', "baseline",
+			Option::RequiredArgument, "file",
+			"Skip the pages identical to the same pages of this image",
+			[&baseline_path] (const char *optarg) -> bool {
+				baseline_path = optarg;
+				return true;
+			}),
+		Option ('p', "progress",
+			Option::NoArgument, "",
+			"Print the progress and throughput on the standard error",
+			[&progress] (const char *) -> bool {
+				progress = true;
+				return true;
+			}),
 	};
 	Option help = HelpOption (argv[0], args, &options);
 	options.push_back (help);
@@ -61,16 +102,33 @@ int main (int argc, char *argv[])
 
 	const char *path = argv[first_arg];
 	char *end;
-	int page = strtol (argv[first_arg+1], &end, 0);
+	int first_page = strtol (argv[first_arg+1], &end, 0);
 	if (*end != '\0') {
 		fprintf (stderr, "Page index must be a number.\n");
 		return EXIT_FAILURE;
 	}
-	if (page < 0) {
+	if (first_page < 0) {
 		fprintf (stderr, "Page index must be positive.\n");
 		return EXIT_FAILURE;
 	}
 
+	std::unique_ptr<FILE, int (*) (FILE *)> input (stdin, [] (FILE *) { return 0; });
+	if (input_path) {
+		input = { fopen (input_path, "rb"), fclose };
+		if (!input) {
+			fprintf (stderr, "Failed to open %s.\n", input_path);
+			return EXIT_FAILURE;
+		}
+	}
+	std::unique_ptr<FILE, int (*) (FILE *)> baseline (nullptr, fclose);
+	if (baseline_path) {
+		baseline.reset (fopen (baseline_path, "rb"));
+		if (!baseline) {
+			fprintf (stderr, "Failed to open %s.\n", baseline_path);
+			return EXIT_FAILURE;
+		}
+	}
+
 	std::unique_ptr<HIDPP::Dispatcher> dispatcher;
 	try {
 		dispatcher = std::make_unique<HIDPP::SimpleDispatcher> (path);
@@ -83,38 +141,69 @@ int main (int argc, char *argv[])
 	HIDPP20::IOnboardProfiles iop (&dev);
 	auto desc = iop.getDescription ();
 
-	if (page >= desc.sector_count) {
+	if (static_cast<unsigned int> (first_page) >= desc.sector_count) {
 		fprintf (stderr, "Page index too big: page count is %d.\n", desc.sector_count);
 		return EXIT_FAILURE;
 	}
 
-	iop.memoryAddrWrite (page, 0, desc.sector_size);
-
-	std::vector<uint8_t> data (desc.sector_size, 0xff);
-	fread (data.data (), sizeof (uint8_t), desc.sector_size, stdin);
-	if (ferror (stdin)) {
-		fprintf (stderr, "Failed to read data.\n");
-		return EXIT_FAILURE;
-	}
-	if (add_crc) {
-		size_t page_content_size = desc.sector_size - 2;
-		uint16_t crc = CRC::CCITT (data.begin (), data.begin () + page_content_size);
-		writeBE (data, page_content_size, crc);
+	// The input is streamed sector by sector, only the total for the
+	// progress line needs its size.
+	std::size_t total = 0;
+	if (progress && input_path && fseek (input.get (), 0, SEEK_END) == 0) {
+		long size = ftell (input.get ());
+		rewind (input.get ());
+		if (size > 0)
+			total = size;
 	}
+	TransferProgress meter (total, progress ? stderr : nullptr);
 
-	constexpr size_t LineSize = HIDPP20::IOnboardProfiles::LineSize;
-	for (unsigned int i = 0; i < data.size (); i += LineSize)
-		iop.memoryWrite (data.begin () + i, data.begin () + i + LineSize);
+	std::vector<uint8_t> data (desc.sector_size), base (desc.sector_size);
+	unsigned int written = 0, skipped = 0;
+	for (unsigned int page = first_page; ; ++page) {
+		std::size_t length = readSector (input.get (), data);
+		if (ferror (input.get ())) {
+			fprintf (stderr, "Failed to read data.\n");
+			return EXIT_FAILURE;
+		}
+		// An empty input still writes a single (erased) page
+		if (length == 0 && page != static_cast<unsigned int> (first_page))
+			break;
+		if (page >= desc.sector_count) {
+			fprintf (stderr, "Input is too big: page count is %d.\n", desc.sector_count);
+			return EXIT_FAILURE;
+		}
+		if (add_crc)
+			addCRC (data);
+		if (baseline) {
+			readSector (baseline.get (), base);
+			if (add_crc)
+				addCRC (base);
+			if (base == data) {
+				++skipped;
+				meter.advance (length);
+				continue;
+			}
+		}
 
-	try {
-		iop.memoryWriteEnd ();
-	}
-	catch (HIDPP20::Error &e) {
-		if (e.errorCode () == HIDPP20::Error::HWError) {
-			fprintf (stderr, "memoryWriteEnd returned Hardware Error, maybe the CRC in wrong but the page is actually written.\n");
+		iop.memoryAddrWrite (page, 0, desc.sector_size);
+		iop.memoryWriteLines (data.begin (), data.end ());
+		try {
+			iop.memoryWriteEnd ();
+		}
+		catch (HIDPP20::Error &e) {
+			if (e.errorCode () == HIDPP20::Error::HWError) {
+				fprintf (stderr, "memoryWriteEnd returned Hardware Error for page %u, maybe the CRC in wrong but the page is actually written.\n", page);
+			}
+			else throw e;
 		}
-		else throw e;
+		++written;
+		meter.advance (length);
+		if (length < desc.sector_size)
+			break;
 	}
+	meter.finish ();
+	if (baseline)
+		fprintf (stderr, "%u page(s) written, %u identical page(s) skipped.\n", written, skipped);
 
 	return EXIT_SUCCESS;
 }
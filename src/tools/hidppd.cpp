@@ -0,0 +1,1290 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <hid/DeviceMonitor.h>
+#include <hidpp/DaemonProtocol.h>
+#include <hidpp/DispatcherThread.h>
+#include <hidpp/EventRing.h>
+#include <hidpp/Handoff.h>
+#include <hidpp/MetricsExporter.h>
+#include <hidpp10/Error.h>
+#include <hidpp10/defs.h>
+#include <hidpp20/Error.h>
+#include <hidpp20/IFeatureSet.h>
+#include <hidpp20/IRoot.h>
+#include <hidpp20/defs.h>
+#include <misc/CacheCounter.h>
+#include <misc/Endian.h>
+#include <misc/Log.h>
+#include <misc/MemoryAccounting.h>
+
+#include "common/common.h"
+#include "common/Option.h"
+#include "common/CommonOptions.h"
+
+extern "C" {
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+}
+
+using namespace HIDPP;
+
+// Long enough for slow wireless devices, the client dispatcher has its own timeout
+static constexpr int CommandTimeout = 10000;
+// Clients share each receiver: limit the commands written at once so that
+// it does not drop reports when several clients are busy
+static constexpr unsigned int InFlightWindow = 8;
+
+// Serialization of the state handed off to a replacing daemon
+static void pushBytes (std::vector<uint8_t> &out, const uint8_t *data, std::size_t length)
+{
+	pushLE<uint32_t> (out, length);
+	out.insert (out.end (), data, data + length);
+}
+
+static void pushString (std::vector<uint8_t> &out, const std::string &str)
+{
+	pushBytes (out, reinterpret_cast<const uint8_t *> (str.data ()), str.size ());
+}
+
+class StateReader
+{
+public:
+	StateReader (const std::vector<uint8_t> &data):
+		_it (data.begin ()), _end (data.end ())
+	{
+	}
+
+	template<typename T>
+	T read ()
+	{
+		check (sizeof (T));
+		T value = readLE<T> (_it);
+		_it += sizeof (T);
+		return value;
+	}
+
+	std::vector<uint8_t> bytes ()
+	{
+		auto length = read<uint32_t> ();
+		check (length);
+		std::vector<uint8_t> data (_it, _it + length);
+		_it += length;
+		return data;
+	}
+
+	std::string string ()
+	{
+		auto data = bytes ();
+		return std::string (data.begin (), data.end ());
+	}
+
+private:
+	void check (std::size_t length)
+	{
+		if (static_cast<std::size_t> (_end - _it) < length)
+			throw std::runtime_error ("truncated handoff state");
+	}
+
+	std::vector<uint8_t>::const_iterator _it, _end;
+};
+
+/**
+ * Answers of requests whose results only change when the device
+ * reconnects: IRoot, IFeatureSet and the receiver pairing information
+ * register.
+ */
+class AnswerCache
+{
+public:
+	/**
+	 * Find an answer for \p request, adapted to its software ID (and
+	 * ping data).
+	 */
+	std::optional<std::vector<uint8_t>> find (const Report &request)
+	{
+		auto k = key (request);
+		if (!k)
+			return std::nullopt;
+		std::unique_lock<std::mutex> lock (_mutex);
+		auto it = _answers.find (*k);
+		_counter.count (it != _answers.end ());
+		if (it == _answers.end ())
+			return std::nullopt;
+		auto answer = it->second;
+		const uint8_t *raw = request.rawData ();
+		if (answer[2] == HIDPP10::ErrorMessage || answer[2] == HIDPP20::ErrorMessage)
+			answer[4] = raw[3];
+		else {
+			answer[3] = raw[3];
+			if (isPing (request))
+				answer[6] = raw[6];
+		}
+		return answer;
+	}
+
+	void store (const Report &request, const std::vector<uint8_t> &answer)
+	{
+		auto k = key (request);
+		if (!k)
+			return;
+		std::unique_lock<std::mutex> lock (_mutex);
+		_answers[*k] = answer;
+		// Learn where IFeatureSet is
+		auto params = request.parameterBegin ();
+		if (request.subID () == HIDPP20::IRoot::index &&
+				request.function () == HIDPP20::IRoot::GetFeature &&
+				readBE<uint16_t> (params) == HIDPP20::IFeatureSet::ID &&
+				answer[2] == HIDPP20::IRoot::index && answer.size () > 4 && answer[4] != 0)
+			_feature_set_index[request.deviceIndex ()] = answer[4];
+	}
+
+	/**
+	 * Forget every answer.
+	 */
+	void clear ()
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		_answers.clear ();
+		_feature_set_index.clear ();
+	}
+
+	void save (std::vector<uint8_t> &out)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		pushLE<uint32_t> (out, _answers.size ());
+		for (const auto &[key, answer]: _answers) {
+			const auto &[index, sub_id, function, params] = key;
+			out.push_back (index);
+			out.push_back (sub_id);
+			out.push_back (function);
+			pushBytes (out, params.data (), params.size ());
+			pushBytes (out, answer.data (), answer.size ());
+		}
+		pushLE<uint32_t> (out, _feature_set_index.size ());
+		for (const auto &[index, feature_index]: _feature_set_index) {
+			out.push_back (index);
+			out.push_back (feature_index);
+		}
+	}
+
+	void load (StateReader &in)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (auto count = in.read<uint32_t> (); count > 0; --count) {
+			auto index = static_cast<DeviceIndex> (in.read<uint8_t> ());
+			auto sub_id = in.read<uint8_t> ();
+			auto function = in.read<uint8_t> ();
+			auto params = in.bytes ();
+			_answers[Key (index, sub_id, function, params)] = in.bytes ();
+		}
+		for (auto count = in.read<uint32_t> (); count > 0; --count) {
+			auto index = static_cast<DeviceIndex> (in.read<uint8_t> ());
+			_feature_set_index[index] = in.read<uint8_t> ();
+		}
+	}
+
+	/**
+	 * Forget the answers of \p index (and the receiver pairing
+	 * information about it).
+	 */
+	void forget (DeviceIndex index)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		for (auto it = _answers.begin (); it != _answers.end (); ) {
+			auto k_index = std::get<0> (it->first);
+			if (k_index == index || k_index == DefaultDevice)
+				it = _answers.erase (it);
+			else
+				++it;
+		}
+		_feature_set_index.erase (index);
+	}
+
+	/**
+	 * Hits and misses of cacheable requests.
+	 */
+	const CacheCounter &counter () const
+	{
+		return _counter;
+	}
+
+private:
+	typedef std::tuple<DeviceIndex, uint8_t, uint8_t, std::vector<uint8_t>> Key;
+
+	static bool isPing (const Report &request)
+	{
+		return request.subID () == HIDPP20::IRoot::index &&
+			request.function () == HIDPP20::IRoot::Ping;
+	}
+
+	// Key ignoring the software ID, or nullopt if the request is not cacheable
+	std::optional<Key> key (const Report &request)
+	{
+		DeviceIndex index = request.deviceIndex ();
+		uint8_t sub_id = request.subID ();
+		std::vector<uint8_t> params (request.parameterBegin (), request.parameterEnd ());
+		if (sub_id == HIDPP20::IRoot::index) {
+			if (request.function () == HIDPP20::IRoot::Ping)
+				params.resize (2); // the last byte is echoed
+			else if (request.function () != HIDPP20::IRoot::GetFeature)
+				return std::nullopt;
+			return Key (index, sub_id, request.function (), params);
+		}
+		if (index == DefaultDevice && sub_id == HIDPP10::GetRegisterLong &&
+				request.address () == HIDPP10::DevicePairingInfo)
+			return Key (index, sub_id, request.address (), params);
+		std::unique_lock<std::mutex> lock (_mutex);
+		auto it = _feature_set_index.find (index);
+		if (it != _feature_set_index.end () && sub_id == it->second &&
+				(request.function () == HIDPP20::IFeatureSet::GetCount ||
+				 request.function () == HIDPP20::IFeatureSet::GetFeatureID))
+			return Key (index, sub_id, request.function (), params);
+		return std::nullopt;
+	}
+
+	std::mutex _mutex;
+	std::map<Key, std::vector<uint8_t>> _answers;
+	std::map<DeviceIndex, uint8_t> _feature_set_index;
+	CacheCounter _counter;
+};
+
+struct Client;
+
+struct ServedDevice
+{
+	std::string path;
+	DispatcherThread dispatcher;
+	std::thread thread;
+	std::shared_ptr<AnswerCache> cache;
+	std::mutex clients_mutex;
+	std::vector<std::weak_ptr<Client>> clients;
+	std::vector<Dispatcher::listener_iterator> listeners;
+
+	ServedDevice (const std::string &path, const std::shared_ptr<AnswerCache> &cache);
+	~ServedDevice ();
+
+	/**
+	 * Stop reading the device, reports stay queued in its file.
+	 */
+	void stop ();
+
+	void forwardEvent (const Report &report);
+};
+
+struct Client
+{
+	int fd;
+	std::shared_ptr<ServedDevice> device;
+	// Shared memory events (DaemonProtocol::SharedEvents)
+	std::unique_ptr<EventRing> events;
+	int event_fd;
+
+	Client (int fd): fd (fd), event_fd (-1) { }
+	~Client ()
+	{
+		if (event_fd != -1)
+			close (event_fd);
+		close (fd);
+	}
+
+	/**
+	 * Attach the event ring and eventfd of a client handed off by
+	 * another daemon.
+	 */
+	void adoptEvents (int ring_fd, int fd)
+	{
+		event_fd = fd;
+		events = std::make_unique<EventRing> (EventRing::attach (ring_fd));
+	}
+
+	/**
+	 * Create the event ring and its eventfd.
+	 */
+	void shareEvents ()
+	{
+		events = std::make_unique<EventRing> (DaemonProtocol::EventRingSize);
+		event_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (event_fd == -1)
+			throw std::system_error (errno, std::system_category (), "eventfd");
+	}
+
+	void sendEvent (const Report &report)
+	{
+		if (!events) {
+			send (DaemonProtocol::Report, report.rawData (), report.rawLength ());
+			return;
+		}
+		events->push (report.rawData (), report.rawLength ());
+		uint64_t value = 1;
+		if (-1 == write (event_fd, &value, sizeof (value)))
+			Log::warning ().printf ("write eventfd: %s\n", strerror (errno));
+	}
+
+	/**
+	 * Send the event ring and its eventfd with \p message.
+	 */
+	void sendEventFDs (const std::vector<uint8_t> &message)
+	{
+		sendWithFDs (message, { events->fd (), event_fd });
+	}
+
+	void sendWithFDs (const std::vector<uint8_t> &message, const std::vector<int> &fds)
+	{
+		union {
+			cmsghdr header;
+			char buffer[CMSG_SPACE (2*sizeof (int))];
+		} control;
+		memset (&control, 0, sizeof (control));
+		iovec iov = { const_cast<uint8_t *> (message.data ()), message.size () };
+		msghdr msg;
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = CMSG_SPACE (fds.size ()*sizeof (int));
+		cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN (fds.size ()*sizeof (int));
+		memcpy (CMSG_DATA (cmsg), fds.data (), fds.size ()*sizeof (int));
+		if (-1 == sendmsg (fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT))
+			Log::warning ().printf ("Failed to send file descriptors to client %d: %s\n", fd, strerror (errno));
+	}
+
+	/**
+	 * Send a message without blocking, messages are dropped if the
+	 * client does not read them.
+	 */
+	void send (uint8_t type, const uint8_t *data, std::size_t length)
+	{
+		uint8_t message[DaemonProtocol::MaxMessageSize];
+		length = std::min (length, sizeof (message) - 1);
+		message[0] = type;
+		std::copy_n (data, length, &message[1]);
+		if (-1 == ::send (fd, message, length + 1, MSG_NOSIGNAL | MSG_DONTWAIT) && errno != EPIPE)
+			Log::warning ().printf ("Dropped message to client %d: %s\n", fd, strerror (errno));
+	}
+
+	void fail (int err, const std::string &what)
+	{
+		std::vector<uint8_t> message (4);
+		writeLE<int32_t> (message, 0, err);
+		message.insert (message.end (), what.begin (), what.end ());
+		send (DaemonProtocol::Failed, message.data (), message.size ());
+	}
+};
+
+ServedDevice::ServedDevice (const std::string &path, const std::shared_ptr<AnswerCache> &cache):
+	path (path),
+	dispatcher (path.c_str ()),
+	thread (std::bind (&DispatcherThread::run, &dispatcher)),
+	cache (cache)
+{
+	dispatcher.setInFlightWindow (InFlightWindow);
+	// Forward every event, the daemon cannot know what its clients listen to
+	for (auto index: { DefaultDevice, CordedDevice,
+			WirelessDevice1, WirelessDevice2, WirelessDevice3,
+			WirelessDevice4, WirelessDevice5, WirelessDevice6 })
+		for (unsigned int sub_id = 0; sub_id < 256; ++sub_id)
+			listeners.push_back (dispatcher.registerEventHandler (index, sub_id,
+				[this] (const Report &report) {
+					forwardEvent (report);
+					return true;
+				}));
+	for (auto index: { WirelessDevice1, WirelessDevice2, WirelessDevice3,
+			WirelessDevice4, WirelessDevice5, WirelessDevice6 })
+		listeners.push_back (dispatcher.registerEventHandler (index, HIDPP10::DeviceConnection,
+			[this] (const Report &report) {
+				this->cache->forget (report.deviceIndex ());
+				return true;
+			}));
+}
+
+ServedDevice::~ServedDevice ()
+{
+	for (const auto &it: listeners)
+		dispatcher.unregisterEventHandler (it);
+	stop ();
+}
+
+void ServedDevice::stop ()
+{
+	if (!thread.joinable ())
+		return;
+	dispatcher.stop ();
+	thread.join ();
+}
+
+void ServedDevice::forwardEvent (const Report &report)
+{
+	std::unique_lock<std::mutex> lock (clients_mutex);
+	for (const auto &weak: clients)
+		if (auto client = weak.lock ())
+			client->sendEvent (report);
+}
+
+// Rebuild the error report the device sent for request
+static std::vector<uint8_t> errorReport (const Report &request, std::exception_ptr error)
+{
+	std::vector<uint8_t> raw (request.rawData (), request.rawData () + request.rawLength ());
+	std::fill (raw.begin () + 2, raw.end (), 0);
+	raw[3] = request.subID ();
+	raw[4] = request.address ();
+	try {
+		std::rethrow_exception (error);
+	}
+	catch (HIDPP10::Error &e) {
+		raw.resize (Report::reportLength (Report::Short));
+		raw[0] = Report::Short;
+		raw[2] = HIDPP10::ErrorMessage;
+		raw[5] = e.errorCode ();
+	}
+	catch (HIDPP20::Error &e) {
+		raw[2] = HIDPP20::ErrorMessage;
+		raw[5] = e.errorCode ();
+		const auto &data = e.errorData ();
+		std::copy_n (data.begin (), std::min (data.size (), raw.size () - 6), raw.begin () + 6);
+	}
+	return raw;
+}
+
+class Daemon: public HID::DeviceMonitor
+{
+public:
+	/**
+	 * \param grace_time	How long the answers of a removed device are
+	 *			kept for its reconnection.
+	 * \param replace	Take over the socket, devices and clients of
+	 *			the daemon listening on \p socket_path.
+	 * \param metrics	Export the statistics of served devices.
+	 */
+	Daemon (const std::string &socket_path, std::chrono::milliseconds grace_time,
+		bool replace = false, MetricsExporter *metrics = nullptr);
+	~Daemon ();
+
+	/**
+	 * Serve clients until \p stop_fd is readable or another daemon
+	 * takes over.
+	 */
+	void serve (int stop_fd);
+
+protected:
+	void addDevice (const char *path);
+	void removeDevice (const char *path);
+
+private:
+	std::shared_ptr<ServedDevice> openDevice (const std::string &path);
+	void accept ();
+	bool processMessage (const std::shared_ptr<Client> &client);
+	void closeClient (const std::shared_ptr<Client> &client);
+	void takeOver ();
+	void handOff (const std::shared_ptr<Client> &client);
+	void exportDevice (const std::shared_ptr<ServedDevice> &device);
+	void unexportDevice (const std::shared_ptr<ServedDevice> &device);
+
+	std::string _socket_path;
+	int _listen_fd;
+	bool _handed_off;
+	std::map<std::string, std::shared_ptr<ServedDevice>> _devices;
+	std::vector<std::shared_ptr<Client>> _clients;
+	// Answers of removed devices, reused if the same device reconnects
+	struct WarmCache
+	{
+		uint16_t vendor_id, product_id;
+		std::string name;
+		std::shared_ptr<AnswerCache> cache;
+		std::chrono::steady_clock::time_point expiry;
+	};
+	std::chrono::milliseconds _grace_time;
+	std::map<std::string, WarmCache> _warm_caches;
+	MetricsExporter *_metrics;
+};
+
+Daemon::Daemon (const std::string &socket_path, std::chrono::milliseconds grace_time,
+		bool replace, MetricsExporter *metrics):
+	_socket_path (socket_path),
+	_handed_off (false),
+	_grace_time (grace_time),
+	_metrics (metrics)
+{
+	if (replace) {
+		takeOver ();
+		return;
+	}
+	sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size () >= sizeof (addr.sun_path))
+		throw std::system_error (ENAMETOOLONG, std::system_category (), "socket path");
+	strcpy (addr.sun_path, socket_path.c_str ());
+	_listen_fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (_listen_fd == -1)
+		throw std::system_error (errno, std::system_category (), "socket");
+	unlink (socket_path.c_str ()); // left by a previous daemon
+	if (-1 == bind (_listen_fd, reinterpret_cast<sockaddr *> (&addr), sizeof (addr)) ||
+			-1 == listen (_listen_fd, 16)) {
+		int err = errno;
+		close (_listen_fd);
+		throw std::system_error (err, std::system_category (), "bind");
+	}
+}
+
+Daemon::~Daemon ()
+{
+	for (const auto &[path, device]: _devices)
+		unexportDevice (device);
+	_clients.clear ();
+	_devices.clear ();
+	close (_listen_fd);
+	if (!_handed_off) // the socket is still used by the new daemon
+		unlink (_socket_path.c_str ());
+}
+
+void Daemon::takeOver ()
+{
+	sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (_socket_path.size () >= sizeof (addr.sun_path))
+		throw std::system_error (ENAMETOOLONG, std::system_category (), "socket path");
+	strcpy (addr.sun_path, _socket_path.c_str ());
+	int fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		throw std::system_error (errno, std::system_category (), "socket");
+	int stream = -1;
+	try {
+		if (-1 == connect (fd, reinterpret_cast<sockaddr *> (&addr), sizeof (addr)))
+			throw std::system_error (errno, std::system_category (), "connect");
+		uint8_t request[2] = { DaemonProtocol::Handoff, DaemonProtocol::Version };
+		if (-1 == ::send (fd, request, sizeof (request), MSG_NOSIGNAL))
+			throw std::system_error (errno, std::system_category (), "send");
+		uint8_t type;
+		iovec iov = { &type, sizeof (type) };
+		union {
+			cmsghdr header;
+			char buffer[CMSG_SPACE (sizeof (int))];
+		} control;
+		msghdr msg;
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buffer;
+		msg.msg_controllen = sizeof (control.buffer);
+		int ret = recvmsg (fd, &msg, MSG_CMSG_CLOEXEC);
+		if (ret == -1)
+			throw std::system_error (errno, std::system_category (), "recvmsg");
+		cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy (&stream, CMSG_DATA (cmsg), sizeof (int));
+		if (ret == 0 || type != DaemonProtocol::Handoff || stream == -1)
+			throw std::runtime_error ("the running daemon refused to hand off");
+	}
+	catch (...) {
+		if (stream != -1)
+			close (stream);
+		close (fd);
+		throw;
+	}
+	close (fd);
+
+	std::vector<Handoff::Item> items;
+	try {
+		items = Handoff::receive (stream);
+	}
+	catch (...) {
+		close (stream);
+		throw;
+	}
+	close (stream);
+
+	_listen_fd = -1;
+	auto now = std::chrono::steady_clock::now ();
+	for (auto &item: items) {
+		try {
+			StateReader in (item.data);
+			if (item.name == "listen" && item.fds.size () == 1) {
+				_listen_fd = item.fds[0];
+				item.fds.clear ();
+			}
+			else if (item.name == "device" && item.fds.size () <= 1) {
+				auto path = in.string ();
+				auto cache = std::make_shared<AnswerCache> ();
+				cache->load (in);
+				if (!item.fds.empty ())
+					HID::RawDevice::adoptFileDescriptor (path, item.fds[0]);
+				item.fds.clear ();
+				auto device = std::make_shared<ServedDevice> (path, cache);
+				_devices.emplace (path, device);
+				exportDevice (device);
+				Log::info ().printf ("Took over %s: %s\n", path.c_str (),
+						     device->dispatcher.name ().c_str ());
+			}
+			else if (item.name == "warm") {
+				auto path = in.string ();
+				WarmCache warm;
+				warm.vendor_id = in.read<uint16_t> ();
+				warm.product_id = in.read<uint16_t> ();
+				warm.name = in.string ();
+				warm.expiry = now + std::chrono::milliseconds (in.read<uint32_t> ());
+				warm.cache = std::make_shared<AnswerCache> ();
+				warm.cache->load (in);
+				_warm_caches.emplace (path, std::move (warm));
+			}
+			else if (item.name == "client" && (item.fds.size () == 1 || item.fds.size () == 3)) {
+				auto client = std::make_shared<Client> (item.fds[0]);
+				if (item.fds.size () == 3)
+					client->adoptEvents (item.fds[1], item.fds[2]);
+				item.fds.clear ();
+				auto path = in.string ();
+				if (!path.empty ()) {
+					auto it = _devices.find (path);
+					if (it == _devices.end ())
+						continue; // the client is closed
+					client->device = it->second;
+					std::unique_lock<std::mutex> lock (client->device->clients_mutex);
+					client->device->clients.push_back (client);
+				}
+				_clients.push_back (client);
+			}
+		}
+		catch (std::exception &e) {
+			Log::warning ().printf ("Failed to take over %s: %s\n", item.name.c_str (), e.what ());
+		}
+		for (int fd: item.fds)
+			close (fd);
+	}
+	if (_listen_fd == -1) {
+		for (const auto &[path, device]: _devices)
+			unexportDevice (device);
+		_clients.clear ();
+		_devices.clear ();
+		throw std::runtime_error ("the running daemon did not hand off its socket");
+	}
+}
+
+void Daemon::handOff (const std::shared_ptr<Client> &client)
+{
+	int fds[2];
+	if (-1 == socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)) {
+		Log::error ().printf ("socketpair: %s\n", strerror (errno));
+		return;
+	}
+	// Stop reading before the new daemon does
+	for (const auto &[path, device]: _devices)
+		device->stop ();
+
+	std::vector<Handoff::Item> items;
+	items.push_back ({ "listen", {}, { _listen_fd } });
+	for (const auto &[path, device]: _devices) {
+		Handoff::Item item = { "device", {}, {} };
+		int fd = device->dispatcher.hidraw ().fileDescriptor ();
+		if (fd != -1) // virtual devices are opened again
+			item.fds.push_back (fd);
+		pushString (item.data, path);
+		device->cache->save (item.data);
+		items.push_back (std::move (item));
+	}
+	auto now = std::chrono::steady_clock::now ();
+	for (const auto &[path, warm]: _warm_caches) {
+		if (warm.expiry <= now)
+			continue;
+		Handoff::Item item = { "warm", {}, {} };
+		pushString (item.data, path);
+		pushLE<uint16_t> (item.data, warm.vendor_id);
+		pushLE<uint16_t> (item.data, warm.product_id);
+		pushString (item.data, warm.name);
+		pushLE<uint32_t> (item.data, std::chrono::duration_cast<std::chrono::milliseconds> (warm.expiry - now).count ());
+		warm.cache->save (item.data);
+		items.push_back (std::move (item));
+	}
+	for (const auto &c: _clients) {
+		if (c == client)
+			continue;
+		Handoff::Item item = { "client", {}, { c->fd } };
+		if (c->events) {
+			item.fds.push_back (c->events->fd ());
+			item.fds.push_back (c->event_fd);
+		}
+		pushString (item.data, c->device ? c->device->path : std::string ());
+		items.push_back (std::move (item));
+	}
+
+	client->sendWithFDs ({ DaemonProtocol::Handoff }, { fds[1] });
+	close (fds[1]);
+	try {
+		Handoff::send (fds[0], items);
+		_handed_off = true;
+		Log::info ().printf ("Handed off %zu devices and %zu clients\n",
+				     _devices.size (), _clients.size () - 1);
+	}
+	catch (std::exception &e) {
+		Log::error ().printf ("Failed to hand off: %s\n", e.what ());
+	}
+	close (fds[0]);
+	if (_handed_off)
+		return;
+	// Keep serving, stopped dispatchers cannot restart so the devices are reopened
+	for (auto &[path, device]: _devices) {
+		auto old = device;
+		try {
+			device = std::make_shared<ServedDevice> (path, old->cache);
+		}
+		catch (std::exception &e) {
+			Log::error ().printf ("Failed to reopen %s: %s\n", path.c_str (), e.what ());
+			continue;
+		}
+		device->clients = old->clients;
+		for (const auto &c: _clients)
+			if (c->device == old)
+				c->device = device;
+		unexportDevice (old);
+		exportDevice (device);
+	}
+}
+
+void Daemon::exportDevice (const std::shared_ptr<ServedDevice> &device)
+{
+	if (!_metrics)
+		return;
+	_metrics->addDispatcher (device->path, &device->dispatcher);
+	_metrics->addCache ("answer", device->path,
+			    std::shared_ptr<const CacheCounter> (device->cache, &device->cache->counter ()));
+}
+
+void Daemon::unexportDevice (const std::shared_ptr<ServedDevice> &device)
+{
+	// Not in the device destructor: pending completion handlers may
+	// keep the device alive after it is removed.
+	if (!_metrics)
+		return;
+	_metrics->removeDispatcher (&device->dispatcher);
+	_metrics->removeCaches (device->path);
+}
+
+std::shared_ptr<ServedDevice> Daemon::openDevice (const std::string &path)
+{
+	auto it = _devices.find (path);
+	if (it != _devices.end ())
+		return it->second;
+	auto now = std::chrono::steady_clock::now ();
+	for (auto it = _warm_caches.begin (); it != _warm_caches.end (); ) {
+		if (it->second.expiry <= now)
+			it = _warm_caches.erase (it);
+		else
+			++it;
+	}
+	std::optional<WarmCache> warm;
+	auto warm_it = _warm_caches.find (path);
+	if (warm_it != _warm_caches.end ()) {
+		warm = std::move (warm_it->second);
+		_warm_caches.erase (warm_it);
+	}
+	auto device = std::make_shared<ServedDevice> (path,
+			warm ? warm->cache : std::make_shared<AnswerCache> ());
+	const auto &dispatcher = device->dispatcher;
+	if (warm) {
+		if (warm->vendor_id == dispatcher.vendorID () &&
+				warm->product_id == dispatcher.productID () &&
+				warm->name == dispatcher.name ())
+			Log::info ().printf ("Reusing cached answers for %s\n", path.c_str ());
+		else
+			warm->cache->clear (); // another device got the path
+	}
+	_devices.emplace (path, device);
+	exportDevice (device);
+	Log::info ().printf ("Opened %s: %s\n", path.c_str (),
+			     dispatcher.name ().c_str ());
+	return device;
+}
+
+void Daemon::addDevice (const char *path)
+{
+	try {
+		openDevice (path);
+	}
+	catch (Dispatcher::NoHIDPPReportException &e) {
+	}
+	catch (std::exception &e) {
+		Log::warning ().printf ("Failed to open %s: %s\n", path, e.what ());
+	}
+}
+
+void Daemon::removeDevice (const char *path)
+{
+	auto it = _devices.find (path);
+	if (it == _devices.end ())
+		return;
+	auto device = it->second;
+	_devices.erase (it);
+	unexportDevice (device);
+	if (_grace_time.count () > 0) {
+		const auto &dispatcher = device->dispatcher;
+		_warm_caches[path] = WarmCache {
+			dispatcher.vendorID (), dispatcher.productID (), dispatcher.name (),
+			device->cache, std::chrono::steady_clock::now () + _grace_time
+		};
+	}
+	auto clients = _clients;
+	for (const auto &client: clients)
+		if (client->device == device)
+			closeClient (client);
+	Log::info ().printf ("Closed %s\n", path);
+}
+
+void Daemon::accept ()
+{
+	int fd = ::accept4 (_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+	if (fd == -1) {
+		Log::warning ().printf ("accept: %s\n", strerror (errno));
+		return;
+	}
+	_clients.push_back (std::make_shared<Client> (fd));
+}
+
+bool Daemon::processMessage (const std::shared_ptr<Client> &client)
+{
+	uint8_t message[DaemonProtocol::MaxMessageSize];
+	int ret = recv (client->fd, message, sizeof (message), MSG_DONTWAIT);
+	if (ret == -1)
+		return errno == EAGAIN || errno == EINTR;
+	if (ret == 0)
+		return false;
+	switch (message[0]) {
+	case DaemonProtocol::Open: {
+		if (client->device || ret < 3)
+			return false;
+		if (message[1] != DaemonProtocol::Version) {
+			client->fail (EPROTO, "unsupported protocol version");
+			return false;
+		}
+		uint8_t flags = message[2];
+		std::string path (&message[3], &message[ret]);
+		try {
+			client->device = openDevice (path);
+			if (flags & DaemonProtocol::SharedEvents)
+				client->shareEvents ();
+		}
+		catch (std::system_error &e) {
+			// The client adds the error message again
+			std::string what = e.what ();
+			auto suffix = ": " + e.code ().message ();
+			if (what.size () > suffix.size () &&
+					what.compare (what.size () - suffix.size (), suffix.size (), suffix) == 0)
+				what.resize (what.size () - suffix.size ());
+			client->fail (e.code ().value (), what);
+			return false;
+		}
+		catch (std::exception &e) {
+			client->fail (ENODEV, e.what ());
+			return false;
+		}
+		auto &dispatcher = client->device->dispatcher;
+		std::vector<uint8_t> opened;
+		opened.push_back (DaemonProtocol::Opened);
+		pushLE<uint16_t> (opened, dispatcher.vendorID ());
+		pushLE<uint16_t> (opened, dispatcher.productID ());
+		opened.push_back (dispatcher.reportInfo ().flags);
+		auto name = dispatcher.name ();
+		opened.insert (opened.end (), name.begin (), name.end ());
+		if (client->events)
+			client->sendEventFDs (opened);
+		else
+			client->send (opened[0], &opened[1], opened.size () - 1);
+		std::unique_lock<std::mutex> lock (client->device->clients_mutex);
+		client->device->clients.push_back (client);
+		return true;
+	}
+	case DaemonProtocol::Report: {
+		if (!client->device)
+			return false;
+		auto device = client->device;
+		try {
+			Report request (&message[1], ret - 1);
+			if (auto answer = device->cache->find (request)) {
+				client->send (DaemonProtocol::Report, answer->data (), answer->size ());
+				return true;
+			}
+			Report copy = request;
+			device->dispatcher.sendCommand (std::move (copy),
+				[client, device, request] (const Report *response, std::exception_ptr error) {
+					std::vector<uint8_t> answer;
+					if (response)
+						answer.assign (response->rawData (), response->rawData () + response->rawLength ());
+					else {
+						try {
+							std::rethrow_exception (error);
+						}
+						catch (HIDPP10::Error &e) {
+						}
+						catch (HIDPP20::Error &e) {
+						}
+						catch (std::exception &e) {
+							return; // no answer from the device
+						}
+						answer = errorReport (request, error);
+					}
+					device->cache->store (request, answer);
+					client->send (DaemonProtocol::Report, answer.data (), answer.size ());
+				}, CommandTimeout);
+		}
+		catch (std::exception &e) {
+			Log::warning ().printf ("Invalid report from client %d: %s\n", client->fd, e.what ());
+		}
+		return true;
+	}
+	case DaemonProtocol::Handoff: {
+		ucred cred;
+		socklen_t len = sizeof (cred);
+		if (client->device || ret < 2 || message[1] != DaemonProtocol::Version)
+			return false;
+		if (-1 == getsockopt (client->fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+				cred.uid != geteuid ()) {
+			Log::warning ().printf ("Refused hand off to client %d\n", client->fd);
+			return false;
+		}
+		handOff (client);
+		return false;
+	}
+	default:
+		return false;
+	}
+}
+
+void Daemon::closeClient (const std::shared_ptr<Client> &client)
+{
+	// The fd is closed when pending completion handlers release the client
+	shutdown (client->fd, SHUT_RDWR);
+	if (client->device) {
+		std::unique_lock<std::mutex> lock (client->device->clients_mutex);
+		auto &clients = client->device->clients;
+		clients.erase (std::remove_if (clients.begin (), clients.end (),
+				[&client] (const std::weak_ptr<Client> &weak) {
+					return weak.lock () == client || weak.expired ();
+				}),
+			clients.end ());
+	}
+	_clients.erase (std::remove (_clients.begin (), _clients.end (), client), _clients.end ());
+}
+
+void Daemon::serve (int stop_fd)
+{
+	int monitor_fd = startMonitoring ();
+	while (true) {
+		std::vector<pollfd> fds = {
+			{ stop_fd, POLLIN, 0 },
+			{ monitor_fd, POLLIN, 0 },
+			{ _listen_fd, POLLIN, 0 },
+		};
+		for (const auto &client: _clients)
+			fds.push_back ({ client->fd, POLLIN, 0 });
+		// Held hot plug events are reported when the timeout expires
+		int timeout = settleTimeout ();
+		if (-1 == poll (fds.data (), fds.size (), timeout)) {
+			if (errno == EINTR)
+				continue;
+			throw std::system_error (errno, std::system_category (), "poll");
+		}
+		if (fds[0].revents)
+			break;
+		if (fds[1].revents || timeout >= 0)
+			processEvents ();
+		if (fds[2].revents)
+			accept ();
+		auto clients = _clients;
+		for (std::size_t i = 0; i+3 < fds.size () && !_handed_off; ++i)
+			if (fds[i+3].revents && !processMessage (clients[i]))
+				closeClient (clients[i]);
+		if (_handed_off)
+			break;
+	}
+	stopMonitoring ();
+}
+
+/**
+ * Minimal HTTP server for MetricsExporter snapshots, it also runs the
+ * exporter collection.
+ *
+ * Requests are answered from a dedicated thread, scrapes never wait for
+ * the daemon loop nor touch the devices.
+ */
+class MetricsServer
+{
+public:
+	/**
+	 * Listen on \p address ("[host:]port", localhost by default).
+	 */
+	MetricsServer (const std::string &address, MetricsExporter &exporter);
+	~MetricsServer ();
+
+private:
+	void serve ();
+	void answer (int fd);
+
+	MetricsExporter &_exporter;
+	int _listen_fd, _stop_fd;
+	std::thread _thread, _collector;
+};
+
+MetricsServer::MetricsServer (const std::string &address, MetricsExporter &exporter):
+	_exporter (exporter)
+{
+	std::string host = "localhost", port = address;
+	auto colon = address.rfind (':');
+	if (colon != std::string::npos) {
+		host = address.substr (0, colon);
+		port = address.substr (colon+1);
+	}
+	addrinfo hints, *result;
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int err = getaddrinfo (host.empty () ? nullptr : host.c_str (), port.c_str (), &hints, &result);
+	if (err)
+		throw std::runtime_error (address + ": " + gai_strerror (err));
+	_listen_fd = socket (result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (_listen_fd == -1) {
+		err = errno;
+		freeaddrinfo (result);
+		throw std::system_error (err, std::system_category (), "socket");
+	}
+	// A replacing daemon (--replace) binds while the old one still listens
+	int one = 1;
+	setsockopt (_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+	setsockopt (_listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one));
+	if (-1 == bind (_listen_fd, result->ai_addr, result->ai_addrlen) ||
+			-1 == listen (_listen_fd, 16)) {
+		err = errno;
+		freeaddrinfo (result);
+		close (_listen_fd);
+		throw std::system_error (err, std::system_category (), "bind " + address);
+	}
+	freeaddrinfo (result);
+	_stop_fd = eventfd (0, EFD_CLOEXEC);
+	if (_stop_fd == -1) {
+		err = errno;
+		close (_listen_fd);
+		throw std::system_error (err, std::system_category (), "eventfd");
+	}
+	_thread = std::thread (&MetricsServer::serve, this);
+	_collector = std::thread (&MetricsExporter::run, &_exporter);
+}
+
+MetricsServer::~MetricsServer ()
+{
+	_exporter.stop ();
+	_collector.join ();
+	uint64_t value = 1;
+	if (-1 == write (_stop_fd, &value, sizeof (value)))
+		abort ();
+	_thread.join ();
+	close (_stop_fd);
+	close (_listen_fd);
+}
+
+void MetricsServer::serve ()
+{
+	while (true) {
+		pollfd fds[] = {
+			{ _stop_fd, POLLIN, 0 },
+			{ _listen_fd, POLLIN, 0 },
+		};
+		if (-1 == poll (fds, 2, -1)) {
+			if (errno == EINTR)
+				continue;
+			Log::error ().printf ("metrics poll: %s\n", strerror (errno));
+			return;
+		}
+		if (fds[0].revents)
+			return;
+		int fd = ::accept4 (_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd == -1) {
+			Log::warning ().printf ("metrics accept: %s\n", strerror (errno));
+			continue;
+		}
+		answer (fd);
+		close (fd);
+	}
+}
+
+void MetricsServer::answer (int fd)
+{
+	// Slow clients cannot hold the server for long
+	timeval timeout = { 1, 0 };
+	setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+	std::string request;
+	char buffer[1024];
+	while (request.find ("\r\n\r\n") == std::string::npos && request.size () < 8192) {
+		int ret = recv (fd, buffer, sizeof (buffer), 0);
+		if (ret <= 0)
+			return;
+		request.append (buffer, ret);
+	}
+	std::string status, content_type, body;
+	auto line = request.substr (0, request.find ("\r\n"));
+	if (line.compare (0, 4, "GET ") != 0) {
+		status = "405 Method Not Allowed";
+		content_type = "text/plain";
+	}
+	else if (line.compare (4, 9, "/metrics ") != 0) {
+		status = "404 Not Found";
+		content_type = "text/plain";
+	}
+	else {
+		status = "200 OK";
+		content_type = MetricsExporter::ContentType;
+		body = *_exporter.text ();
+	}
+	auto response = "HTTP/1.1 " + status + "\r\n"
+		"Content-Type: " + content_type + "\r\n"
+		"Content-Length: " + std::to_string (body.size ()) + "\r\n"
+		"Connection: close\r\n\r\n" + body;
+	for (std::size_t sent = 0; sent < response.size (); ) {
+		int ret = ::send (fd, response.data () + sent, response.size () - sent, MSG_NOSIGNAL);
+		if (ret == -1)
+			return;
+		sent += ret;
+	}
+}
+
+static int stop_fd = -1;
+
+static void stop (int)
+{
+	uint64_t value = 1;
+	if (-1 == write (stop_fd, &value, sizeof (value)))
+		abort ();
+}
+
+int main (int argc, char *argv[])
+{
+	std::string socket_path = DaemonProtocol::defaultSocketPath ();
+	int settle_time = 500, grace_time = 10000;
+	bool replace = false;
+	std::string metrics_address;
+	int metrics_interval = 5000;
+
+	std::vector<Option> options = {
+		VerboseOption (),
+		Option ('s', "socket",
+			Option::RequiredArgument, "path",
+			"Listen on this socket (default: $HIDPPD_SOCKET or $XDG_RUNTIME_DIR/hidppd.sock)",
+			[&socket_path] (const char *optarg) -> bool {
+				socket_path = optarg;
+				return true;
+			}),
+		Option ('t', "settle",
+			Option::RequiredArgument, "ms",
+			"Wait for hot plug events to settle for this time (default: 500 ms)",
+			[&settle_time] (const char *optarg) -> bool {
+				char *endptr;
+				settle_time = strtol (optarg, &endptr, 10);
+				return *endptr == '\0' && settle_time >= 0;
+			}),
+		Option ('g', "grace",
+			Option::RequiredArgument, "ms",
+			"Keep the answers of removed devices for this time (default: 10000 ms)",
+			[&grace_time] (const char *optarg) -> bool {
+				char *endptr;
+				grace_time = strtol (optarg, &endptr, 10);
+				return *endptr == '\0' && grace_time >= 0;
+			}),
+		Option ('r', "replace",
+			Option::NoArgument, "",
+			"Take over the socket, devices and clients of the running daemon (for restarting without reopening devices)",
+			[&replace] (const char *) -> bool {
+				replace = true;
+				return true;
+			}),
+		Option ('m', "metrics",
+			Option::RequiredArgument, "[host:]port",
+			"Serve OpenMetrics telemetry at /metrics over HTTP (default host: localhost)",
+			[&metrics_address] (const char *optarg) -> bool {
+				metrics_address = optarg;
+				return !metrics_address.empty ();
+			}),
+		Option ('i', "metrics-interval",
+			Option::RequiredArgument, "ms",
+			"Collect metrics at this interval (default: 5000 ms)",
+			[&metrics_interval] (const char *optarg) -> bool {
+				char *endptr;
+				metrics_interval = strtol (optarg, &endptr, 10);
+				return *endptr == '\0' && metrics_interval > 0;
+			}),
+	};
+	Option help = HelpOption (argv[0], "", &options);
+	options.push_back (help);
+
+	int first_arg;
+	if (!Option::processOptions (argc, argv, options, first_arg))
+		return EXIT_FAILURE;
+
+	if (argc-first_arg != 0) {
+		fprintf (stderr, "%s", getUsage (argv[0], "", &options).c_str ());
+		return EXIT_FAILURE;
+	}
+
+	stop_fd = eventfd (0, EFD_CLOEXEC);
+	struct sigaction sa;
+	memset (&sa, 0, sizeof (struct sigaction));
+	sa.sa_handler = stop;
+	sigaction (SIGINT, &sa, nullptr);
+	sigaction (SIGTERM, &sa, nullptr);
+
+	try {
+		// The daemon is destroyed first, it unregisters its devices
+		std::unique_ptr<MetricsExporter> metrics;
+		std::unique_ptr<MetricsServer> metrics_server;
+		if (!metrics_address.empty ()) {
+			metrics = std::make_unique<MetricsExporter> (std::chrono::milliseconds (metrics_interval));
+			metrics_server = std::make_unique<MetricsServer> (metrics_address, *metrics);
+		}
+		Daemon daemon (socket_path, std::chrono::milliseconds (grace_time), replace, metrics.get ());
+		daemon.setSettleTime (std::chrono::milliseconds (settle_time));
+		daemon.serve (stop_fd);
+	}
+	catch (std::exception &e) {
+		fprintf (stderr, "hidppd: %s\n", e.what ());
+		return EXIT_FAILURE;
+	}
+	if (MemoryAccounting::enabled ()) {
+		// Everything was released with the daemon, what is left leaked.
+		auto log = Log::info ("memory");
+		MemoryAccounting::snapshot ().print (log);
+	}
+	return EXIT_SUCCESS;
+}
@@ -20,9 +20,9 @@
 
 #include <sstream>
 #include <map>
-#include <regex>
+#include <unordered_map>
 #include <algorithm>
-#include <cassert>
+#include <charconv>
 
 #include <misc/Log.h>
 #include <hid/UsageStrings.h>
@@ -48,7 +48,7 @@ std::string macroToText (Macro::const_iterator begin, Macro::const_iterator end)
 	for (auto it = begin; it != end; ++it) {
 		const Macro::Item &item = *it;
 		if (item.isJump ()) {
-			Macro::const_iterator dest = item.jumpDestination ();
+			Macro::const_iterator dest = it + item.jumpOffset ();
 			if (labels.find (&(*dest)) != labels.end ())
 				continue;
 			std::stringstream ss;
@@ -108,7 +108,7 @@ std::string macroToText (Macro::const_iterator begin, Macro::const_iterator end)
 
 		case Macro::Item::Jump:
 		case Macro::Item::JumpIfPressed:
-			ss << " " << labels[&(*item.jumpDestination ())];
+			ss << " " << labels[&*(it + item.jumpOffset ())];
 			break;
 
 		case Macro::Item::MousePointer:
@@ -117,7 +117,7 @@ std::string macroToText (Macro::const_iterator begin, Macro::const_iterator end)
 
 		case Macro::Item::JumpIfReleased:
 			ss << " " << item.delay ()
-			   << " " << labels[&(*item.jumpDestination ())];
+			   << " " << labels[&*(it + item.jumpOffset ())];
 			break;
 
 		default:
@@ -129,76 +129,238 @@ std::string macroToText (Macro::const_iterator begin, Macro::const_iterator end)
 	return ss.str ();
 }
 
-static inline
-std::string::const_iterator
-skipWhiteSpaces (std::string::const_iterator begin, std::string::const_iterator end)
+namespace
 {
-	static const std::regex WhiteSpaceRegex ("\\s*");
-	std::smatch results;
-	std::regex_search (begin, end,
-			   results, WhiteSpaceRegex,
-			   std::regex_constants::match_continuous);
-	assert (!results.empty());
-	return results[0].second;
-}
 
-Macro textToMacro (const std::string &text)
+/**
+ * Single pass lexer for macro text.
+ *
+ * Tokens are views in the text, the text must outlive them.
+ */
+class MacroLexer
 {
-	static const std::regex LabeledInstructionRegex ("(?:(\\w+):)?\\s*(\\w+)");
-	static const std::regex ParamRegex ("(;)|\"([^\"]*)\"|([^[:space:];]+)");
+public:
+	MacroLexer (std::string_view text):
+		_text (text),
+		_pos (0)
+	{
+		skipSpaces ();
+	}
 
-	std::map<std::string, Macro::iterator> labels;
-	std::vector<std::pair<Macro::Item *, std::string>> jumps;
+	bool atEnd () const
+	{
+		return _pos == _text.size ();
+	}
 
-	Macro macro;
+	std::size_t position () const
+	{
+		return _pos;
+	}
+
+	/**
+	 * Read a word made of letters, digits and underscores, followed
+	 * by spaces.
+	 *
+	 * \returns an empty view if there is no word.
+	 */
+	std::string_view word ()
+	{
+		std::size_t begin = _pos;
+		while (_pos < _text.size () && isWordChar (_text[_pos]))
+			++_pos;
+		auto token = _text.substr (begin, _pos - begin);
+		skipSpaces ();
+		return token;
+	}
+
+	/**
+	 * Read ':' if it is next, followed by spaces.
+	 */
+	bool colon ()
+	{
+		if (_pos == _text.size () || _text[_pos] != ':')
+			return false;
+		++_pos;
+		skipSpaces ();
+		return true;
+	}
+
+	/**
+	 * Read the next instruction parameter, a quoted string or
+	 * anything up to a space or semi-colon.
+	 *
+	 * \returns false at the end of the instruction (after its
+	 * semi-colon, if any).
+	 */
+	bool param (std::string_view &token)
+	{
+		if (_pos == _text.size ())
+			return false;
+		if (_text[_pos] == ';') {
+			++_pos;
+			skipSpaces ();
+			return false;
+		}
+		if (_text[_pos] == '"') {
+			std::size_t end = _text.find ('"', _pos+1);
+			if (end != std::string_view::npos) {
+				token = _text.substr (_pos+1, end - _pos - 1);
+				_pos = end+1;
+				skipSpaces ();
+				return true;
+			}
+			// Unterminated strings are read as plain parameters
+		}
+		std::size_t begin = _pos;
+		while (_pos < _text.size () && !isSpace (_text[_pos]) && _text[_pos] != ';')
+			++_pos;
+		token = _text.substr (begin, _pos - begin);
+		skipSpaces ();
+		return true;
+	}
+
+	/**
+	 * Describe \p pos as "line L, column C" for error messages.
+	 */
+	std::string where (std::size_t pos) const
+	{
+		std::size_t line = 1, line_begin = 0;
+		for (std::size_t i = 0; i < pos; ++i) {
+			if (_text[i] == '\n') {
+				++line;
+				line_begin = i+1;
+			}
+		}
+		return "line " + std::to_string (line) + ", column " + std::to_string (pos - line_begin + 1);
+	}
+
+private:
+	static bool isSpace (char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+	}
+
+	static bool isWordChar (char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			(c >= '0' && c <= '9') || c == '_';
+	}
+
+	void skipSpaces ()
+	{
+		while (_pos < _text.size () && isSpace (_text[_pos]))
+			++_pos;
+	}
+
+	std::string_view _text;
+	std::size_t _pos;
+};
+
+template<typename T>
+bool parseNumber (std::string_view str, T &value)
+{
+	auto result = std::from_chars (str.data (), str.data () + str.size (), value);
+	return result.ec == std::errc ();
+}
+
+}
+
+Macro textToMacro (std::string_view text)
+{
+	// Built once, the views refer to the static instruction strings
+	static const std::unordered_map<std::string_view, Macro::Item::Instruction> Instructions = [] () {
+		std::unordered_map<std::string_view, Macro::Item::Instruction> instructions;
+		for (const auto &[instr, str]: Macro::Item::InstructionStrings)
+			instructions.emplace (str, instr);
+		return instructions;
+	} ();
+
+	// Items are referenced by index, adding items moves them
+	std::unordered_map<std::string_view, int> labels;
+	struct Jump
+	{
+		int index;
+		std::string_view label;
+		std::size_t pos;
+	};
+	std::vector<Jump> jumps;
 
-	auto current = skipWhiteSpaces (text.begin (), text.end ());
-	std::smatch results;
-	while (current != text.end ()) {
-		if (!std::regex_search (current, text.end (),
-					results, LabeledInstructionRegex,
-					std::regex_constants::match_continuous)) {
-			std::string invalid_text (current, text.end ());
+	Macro macro;
+	// Every instruction but the last ends with a semi-colon
+	macro.reserve (std::count (text.begin (), text.end (), ';') + 1);
+
+	MacroLexer lexer (text);
+	std::vector<std::string_view> params;
+	while (!lexer.atEnd ()) {
+		std::size_t instr_pos = lexer.position ();
+		std::string_view label, instruction = lexer.word ();
+		if (!instruction.empty () && lexer.colon ()) {
+			label = instruction;
+			instruction = lexer.word ();
+		}
+		if (instruction.empty ()) {
 			static constexpr std::size_t MaxTextLength = 20;
-			if (invalid_text.size () > MaxTextLength)
-				invalid_text.resize (MaxTextLength);
-			Log::error () << "Syntax error when parsing macro instruction: \"" << invalid_text << "\"" << std::endl;
+			Log::error () << "Syntax error when parsing macro instruction at "
+				      << lexer.where (instr_pos) << ": \""
+				      << text.substr (instr_pos, MaxTextLength) << "\"" << std::endl;
 			return Macro ();
 		}
-		std::string label = results.str (1);
-		std::string instruction = results.str (2);
-		current = skipWhiteSpaces (results[0].second, text.end ());
-
-		std::vector<std::string> params;
-		while (current != text.end ()) {
-			std::regex_search (current, text.end (), results, ParamRegex, std::regex_constants::match_continuous);
-			assert (!results.empty());
-			current = skipWhiteSpaces (results[0].second, text.end ());
-			if (results[1].matched) // semi-colon
-				break;
-			for (unsigned int i = 2; i <= 3; ++i)
-				if (results[i].matched) {
-					params.push_back (results[i]);
-					break;
-				}
+
+		std::size_t params_pos = lexer.position ();
+		params.clear ();
+		std::string_view param;
+		while (lexer.param (param))
+			params.push_back (param);
+
+		auto instr = Instructions.find (instruction);
+		if (instr == Instructions.end ()) {
+			Log::error () << "Unknown instruction " << instruction
+				      << " at " << lexer.where (instr_pos) << std::endl;
+			return Macro ();
 		}
+		macro.emplace_back (instr->second);
+		Macro::Item *item = &macro.back ();
+		int index = std::distance (macro.begin (), macro.end ()) - 1;
 
-		Macro::Item *item = nullptr;
-		for (const auto &p: Macro::Item::InstructionStrings) {
-			if (instruction == p.second) {
-				macro.emplace_back (p.first);
-				item = &macro.back ();
-				break;
-			}
+		std::size_t param_count = 0;
+		switch (item->instruction ()) {
+		case Macro::Item::KeyPress:
+		case Macro::Item::KeyRelease:
+		case Macro::Item::ModifiersPress:
+		case Macro::Item::ModifiersRelease:
+		case Macro::Item::MouseWheel:
+		case Macro::Item::MouseHWheel:
+		case Macro::Item::MouseButtonPress:
+		case Macro::Item::MouseButtonRelease:
+		case Macro::Item::ConsumerControl:
+		case Macro::Item::ConsumerControlPress:
+		case Macro::Item::ConsumerControlRelease:
+		case Macro::Item::Delay:
+		case Macro::Item::ShortDelay:
+		case Macro::Item::Jump:
+		case Macro::Item::JumpIfPressed:
+			param_count = 1;
+			break;
+		case Macro::Item::ModifiersKeyPress:
+		case Macro::Item::ModifiersKeyRelease:
+		case Macro::Item::MousePointer:
+		case Macro::Item::JumpIfReleased:
+			param_count = 2;
+			break;
+		default:
+			break;
 		}
-		if (!item) {
-			Log::error () << "Unknown instruction " << instruction << std::endl;
+		if (params.size () < param_count) {
+			Log::error () << "Missing parameter for " << instruction
+				      << " at " << lexer.where (params_pos) << std::endl;
 			return Macro ();
 		}
+
+		bool valid = true;
 		switch (item->instruction ()) {
 		case Macro::Item::KeyPress:
 		case Macro::Item::KeyRelease: {
-			unsigned int code = keyUsageCode (params[0]);
+			unsigned int code = keyUsageCode (std::string (params[0]));
 			if (code > 255)
 				Log::warning () << "Key code " << code << " is too big." << std::endl;
 			item->setKeyCode (static_cast<uint8_t> (code));
@@ -206,15 +368,15 @@ Macro textToMacro (const std::string &text)
 		}
 		case Macro::Item::ModifiersPress:
 		case Macro::Item::ModifiersRelease: {
-			uint8_t mask = modifierMask (params[0]);
+			uint8_t mask = modifierMask (std::string (params[0]));
 			item->setModifiers (mask);
 			break;
 		}
 		case Macro::Item::ModifiersKeyPress:
 		case Macro::Item::ModifiersKeyRelease: {
-			uint8_t mask = modifierMask (params[0]);
+			uint8_t mask = modifierMask (std::string (params[0]));
 			item->setModifiers (mask);
-			unsigned int code = keyUsageCode (params[1]);
+			unsigned int code = keyUsageCode (std::string (params[1]));
 			if (code > 255)
 				Log::warning () << "Key code " << code << " is too big." << std::endl;
 			item->setKeyCode (static_cast<uint8_t> (code));
@@ -222,13 +384,14 @@ Macro textToMacro (const std::string &text)
 		}
 		case Macro::Item::MouseWheel:
 		case Macro::Item::MouseHWheel: {
-			int wheel = std::stoi (params[0]);
+			int wheel;
+			valid = parseNumber (params[0], wheel);
 			item->setWheel (wheel);
 			break;
 		}
 		case Macro::Item::MouseButtonPress:
 		case Macro::Item::MouseButtonRelease: {
-			unsigned int mask = buttonMask (params[0]);
+			unsigned int mask = buttonMask (std::string (params[0]));
 			if (mask > 65535)
 				Log::warning () << "Button number too big." << std::endl;
 			item->setButtons (mask);
@@ -237,51 +400,56 @@ Macro textToMacro (const std::string &text)
 		case Macro::Item::ConsumerControl:
 		case Macro::Item::ConsumerControlPress:
 		case Macro::Item::ConsumerControlRelease: {
-			unsigned int code = consumerControlCode (params[0]);
+			unsigned int code = consumerControlCode (std::string (params[0]));
 			item->setConsumerControl (code);
 			break;
 		}
 		case Macro::Item::Delay:
 		case Macro::Item::ShortDelay: {
-			unsigned int delay = std::stoul (params[0]);
+			unsigned int delay;
+			valid = parseNumber (params[0], delay);
 			item->setDelay (delay);
 			break;
 		}
 		case Macro::Item::Jump:
 		case Macro::Item::JumpIfPressed:
-			jumps.emplace_back (item, params[0]);
+			jumps.push_back ({ index, params[0], params_pos });
 			break;
 		case Macro::Item::MousePointer: {
-			int x = std::stoi (params[0]);
-			int y = std::stoi (params[1]);
+			int x, y;
+			valid = parseNumber (params[0], x) && parseNumber (params[1], y);
 			item->setMouseX (x);
 			item->setMouseY (y);
 			break;
 		}
 		case Macro::Item::JumpIfReleased: {
-			unsigned int delay = std::stoul (params[0]);
+			unsigned int delay;
+			valid = parseNumber (params[0], delay);
 			item->setDelay (delay);
-			jumps.emplace_back (item, params[1]);
+			jumps.push_back ({ index, params[1], params_pos });
 			break;
 		}
 		default:
 			break;
 		}
-
-		if (!label.empty ()) {
-			labels.emplace (label, std::prev (macro.end ()));
+		if (!valid) {
+			Log::error () << "Invalid number for " << instruction
+				      << " at " << lexer.where (params_pos) << std::endl;
+			return Macro ();
 		}
+
+		if (!label.empty ())
+			labels.emplace (label, index);
 	}
 
-	for (auto pair: jumps) {
-		Macro::Item *item = pair.first;
-		const std::string &label = pair.second;
-		auto it = labels.find (label);
+	for (const auto &jump: jumps) {
+		auto it = labels.find (jump.label);
 		if (it == labels.end ()) {
-			Log::error () << "Unknown label " << label << std::endl;
+			Log::error () << "Unknown label " << jump.label
+				      << " at " << lexer.where (jump.pos) << std::endl;
 			return Macro ();
 		}
-		item->setJumpDestination (it->second);
+		(macro.begin () + jump.index)->setJumpOffset (it->second - jump.index);
 	}
 
 	return macro;
@@ -21,10 +21,15 @@
 
 #include <hidpp/Macro.h>
 #include <string>
+#include <string_view>
 
 std::string macroToText (HIDPP::Macro::const_iterator begin,
 			 HIDPP::Macro::const_iterator end);
 
-HIDPP::Macro textToMacro (const std::string &text);
+/**
+ * Parse macro text, errors are logged with their line and column and
+ * an empty macro is returned.
+ */
+HIDPP::Macro textToMacro (std::string_view text);
 #endif
 
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileBatch.h"
+
+#include "ProfileXML.h"
+#include "ProfileXMLStream.h"
+
+#include "../common/Executor.h"
+
+#include <hidpp/MacroAllocator.h>
+#include <hidpp/ProfileDiff.h>
+#include <hidpp10/DeviceInfo.h>
+#include <hidpp10/MacroFormat.h>
+#include <hidpp10/ProfileDirectoryFormat.h>
+#include <hidpp10/ProfileFormatG500.h>
+#include <hidpp10/ProfileFormatG700.h>
+#include <hidpp10/ProfileFormatG9.h>
+#include <hidpp10/defs.h>
+#include <hidpp20/MacroFormat.h>
+#include <hidpp20/ProfileDirectoryFormat.h>
+#include <hidpp20/ProfileFormat.h>
+#ifdef __linux__
+#include <hidpp20/ImageMapping.h>
+#endif
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace HIDPP;
+
+ProfileTarget ProfileTarget::hidpp10 (uint16_t product_id)
+{
+	const HIDPP10::MouseInfo *info = HIDPP10::getMouseInfo (product_id);
+	if (!info)
+		throw std::runtime_error ("Unknown HID++ 1.0 device");
+	ProfileTarget target;
+	std::stringstream name;
+	name << "hidpp10-" << std::hex << product_id;
+	target.name = name.str ();
+	switch (info->profile_type) {
+	case HIDPP10::G9ProfileType:
+		target.profile_format = std::make_unique<HIDPP10::ProfileFormatG9> (*info->sensor);
+		break;
+	case HIDPP10::G500ProfileType:
+		target.profile_format = std::make_unique<HIDPP10::ProfileFormatG500> (*info->sensor);
+		break;
+	case HIDPP10::G700ProfileType:
+		target.profile_format = std::make_unique<HIDPP10::ProfileFormatG700> (*info->sensor);
+		break;
+	default:
+		throw std::runtime_error ("Unsupported device");
+	}
+	// Same as HIDPP10::getProfileDirectoryFormat and getMacroFormat
+	target.profdir_format = std::make_unique<HIDPP10::ProfileDirectoryFormat> (4);
+	target.macro_format = std::make_unique<HIDPP10::MacroFormat> ();
+	target.dir_address = Address { 0, 1, 0 };
+	target.prof_address = Address { 0, info->default_profile_page, 0 };
+	target.page_size = HIDPP10::PageSize;
+	target.offset_unit = 2;
+	target.page_count = 256;
+	target.max_profiles = target.page_count - info->default_profile_page;
+	target.button_count = target.profile_format->maxButtonCount ();
+	return target;
+}
+
+ProfileTarget ProfileTarget::hidpp20 (const HIDPP20::IOnboardProfiles::Description &desc)
+{
+	ProfileTarget target;
+	target.name = "hidpp20-" + std::to_string (desc.profile_format) +
+		"-" + std::to_string (desc.button_count);
+	target.profdir_format = std::make_unique<HIDPP20::ProfileDirectoryFormat> ();
+	target.profile_format = std::make_unique<HIDPP20::ProfileFormat> (desc);
+	target.macro_format = std::make_unique<HIDPP20::MacroFormat> ();
+	target.dir_address = Address { HIDPP20::IOnboardProfiles::Writeable, 0, 0 };
+	target.prof_address = Address { HIDPP20::IOnboardProfiles::Writeable, 1, 0 };
+	target.page_size = desc.sector_size;
+	target.offset_unit = 1;
+	target.page_count = desc.sector_count;
+	target.max_profiles = desc.profile_count;
+	// Buttons are doubled with G-shift
+	target.button_count = ((desc.mechanical_layout & 0x03) == 2 ? 2 : 1) * desc.button_count;
+	target.description = desc;
+	return target;
+}
+
+ProfileBatch::ProfileBatch (std::vector<const ProfileTarget *> targets, unsigned int threads):
+	_targets (std::move (targets)),
+	_threads (threads != 0 ? threads : std::max (1u, std::thread::hardware_concurrency ()))
+{
+}
+
+void ProfileBatch::setOutputDirectory (const std::string &output)
+{
+	_output = output;
+}
+
+std::vector<ProfileBatch::Result> ProfileBatch::run (const std::vector<std::string> &paths) const
+{
+	unsigned int worker_count = std::min<std::size_t> (_threads, paths.size ());
+	if (worker_count <= 1) {
+		std::vector<Result> results (paths.size ());
+		for (std::size_t i = 0; i < paths.size (); ++i)
+			results[i] = process (paths[i]);
+		return results;
+	}
+	Executor executor (worker_count);
+	return executor.map (paths.size (), [this, &paths] (std::size_t i) {
+		return process (paths[i]);
+	});
+}
+
+ProfileBatch::Result ProfileBatch::process (const std::string &path) const
+{
+	Result result;
+	result.path = path;
+	for (const ProfileTarget *target: _targets) {
+		try {
+			check (*target, path, result);
+		}
+		catch (std::exception &e) {
+			result.errors.push_back (target->name + ": " + e.what ());
+		}
+	}
+	return result;
+}
+
+static void checkSettings (const SettingMap &settings,
+			   const std::map<std::string, SettingDesc> &descs,
+			   const std::string &prefix,
+			   std::vector<std::string> &errors)
+{
+	std::vector<SettingDesc::Issue> issues;
+	validateSettings (settings, descs, issues);
+	for (const auto &issue: issues)
+		errors.push_back (prefix + issue.name + ": " + SettingDesc::errorString (issue.error));
+}
+
+void ProfileBatch::check (const ProfileTarget &target, const std::string &path,
+			  Result &result) const
+{
+	std::ifstream input (path);
+	if (!input)
+		throw std::runtime_error ("cannot open file");
+	ProfileXML profxml (target.profile_format.get (), target.profdir_format.get ());
+	ProfileXMLReader reader (profxml, input);
+	const auto &profile_format = *target.profile_format;
+	std::size_t error_count = result.errors.size ();
+
+	ProfileDiff::ProfileSet set;
+	Address address = target.prof_address;
+	while (true) {
+		Profile profile;
+		ProfileDirectory::Entry entry = { address };
+		std::vector<Macro> macros;
+		if (!reader.next (profile, entry, macros))
+			break;
+		unsigned int index = set.profiles.size ();
+		std::string prefix = target.name + ": profile " + std::to_string (index) + ": ";
+		if (index == target.max_profiles || address.page >= target.page_count) {
+			result.errors.push_back (prefix + "too many profiles");
+			break;
+		}
+		checkSettings (profile.settings, profile_format.generalSettings (), prefix, result.errors);
+		checkSettings (entry.settings, target.profdir_format->settings (), prefix, result.errors);
+		if (profile.modes.size () > profile_format.maxModeCount ())
+			result.errors.push_back (prefix + "too many modes");
+		for (const auto &mode: profile.modes)
+			checkSettings (mode, profile_format.modeSettings (), prefix + "mode: ", result.errors);
+		if (profile.buttons.size () != target.button_count)
+			result.errors.push_back (prefix + std::to_string (profile.buttons.size ()) +
+						 " buttons instead of " + std::to_string (target.button_count));
+		for (unsigned int i = 0; i < profile.buttons.size (); ++i)
+			if (profile.buttons[i].type () == Profile::Button::Type::Macro)
+				macros[i].optimize (*target.macro_format);
+		set.profiles.push_back (std::move (profile));
+		set.directory.entries.push_back (std::move (entry));
+		set.macros.push_back (std::move (macros));
+		++address.page;
+	}
+	if (set.profiles.size () > result.profile_count)
+		result.profile_count = set.profiles.size ();
+
+	// Macros are written in the pages after profiles
+	auto addPages = [&target, &address] (MacroAllocator &allocator) {
+		for (Address page = address; page.page < target.page_count; ++page.page)
+			allocator.addPage (page);
+	};
+	MacroAllocator allocator (*target.macro_format, target.page_size, target.offset_unit);
+	addPages (allocator);
+	std::vector<const Macro *> macros;
+	for (unsigned int i = 0; i < set.profiles.size (); ++i)
+		for (unsigned int j = 0; j < set.profiles[i].buttons.size (); ++j)
+			if (set.profiles[i].buttons[j].type () == Profile::Button::Type::Macro)
+				macros.push_back (&set.macros[i][j]);
+	try {
+		allocator.allocate (macros);
+	}
+	catch (std::out_of_range &e) {
+		result.errors.push_back (target.name + ": not enough room for macros");
+	}
+	catch (AbstractMacroFormat::UnsupportedInstruction &e) {
+		result.errors.push_back (target.name + ": " + e.what ());
+	}
+
+	if (_output.empty () || !target.description || result.errors.size () != error_count)
+		return;
+#ifdef __linux__
+	std::string name = path.substr (path.find_last_of ('/') + 1);
+	std::string image_path = _output + "/" + name + "." + target.name + ".img";
+	HIDPP20::ImageMapping::create (image_path, *target.description);
+	// The image is only mapped by this worker, no lock is needed.
+	HIDPP20::ImageMapping image (image_path, *target.description);
+	MacroAllocator image_allocator (*target.macro_format, target.page_size, target.offset_unit);
+	addPages (image_allocator);
+	ProfileDiff diff (profile_format, *target.profdir_format, *target.macro_format);
+	diff.apply (image, target.dir_address, ProfileDiff::ProfileSet (), set, image_allocator);
+	image.sync ();
+	image.flush ();
+#else
+	throw std::runtime_error ("images are not supported on this platform");
+#endif
+}
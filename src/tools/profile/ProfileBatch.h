@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROFILE_BATCH_H
+#define PROFILE_BATCH_H
+
+#include <hidpp/AbstractMacroFormat.h>
+#include <hidpp/AbstractProfileDirectoryFormat.h>
+#include <hidpp/AbstractProfileFormat.h>
+#include <hidpp/Address.h>
+#include <hidpp20/IOnboardProfiles.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Formats of a device model, for converting profiles without the
+ * device.
+ */
+struct ProfileTarget
+{
+	std::string name;
+	std::unique_ptr<HIDPP::AbstractProfileDirectoryFormat> profdir_format;
+	std::unique_ptr<HIDPP::AbstractProfileFormat> profile_format;
+	std::unique_ptr<HIDPP::AbstractMacroFormat> macro_format;
+	HIDPP::Address dir_address, prof_address;
+	std::size_t page_size;		///< Size in bytes of memory pages.
+	std::size_t offset_unit;	///< Size in bytes of an address offset unit.
+	unsigned int page_count;	///< Number of pages in memory.
+	unsigned int max_profiles;
+	unsigned int button_count;	///< Buttons of each profile, with the shifted ones.
+	/**
+	 * Description of the memory for HID++ 2.0 targets, images are
+	 * only written for them (see HIDPP20::ImageMapping).
+	 */
+	std::optional<HIDPP20::IOnboardProfiles::Description> description;
+
+	/**
+	 * Target of a HID++ 1.0 mouse model.
+	 *
+	 * \throws std::runtime_error if the model has no known profile format.
+	 */
+	static ProfileTarget hidpp10 (uint16_t product_id);
+	/**
+	 * Target of a HID++ 2.0 device with the onboard memory \p desc.
+	 */
+	static ProfileTarget hidpp20 (const HIDPP20::IOnboardProfiles::Description &desc);
+};
+
+/**
+ * Validate and convert many profile XML files in parallel.
+ *
+ * Each file is read one profile at a time (see ProfileXMLReader), the
+ * settings are checked against the setting descriptions of every
+ * target, as well as the profile, mode and button counts and the room
+ * left for macros. When an output directory is set, the onboard memory
+ * image of each valid file is written for each HID++ 2.0 target.
+ *
+ * Files are spread on worker threads that steal files from each other
+ * when they run out of their own. A worker only holds the profiles of
+ * the file it is converting, results only keep the errors.
+ */
+class ProfileBatch
+{
+public:
+	struct Result
+	{
+		std::string path;
+		unsigned int profile_count = 0;
+		/**
+		 * Errors prefixed by the target name and profile index,
+		 * empty if the file is valid for every target.
+		 */
+		std::vector<std::string> errors;
+	};
+
+	/**
+	 * \p targets must outlive the batch.
+	 *
+	 * \param threads	Number of workers, 0 for the hardware
+	 *			concurrency.
+	 */
+	ProfileBatch (std::vector<const ProfileTarget *> targets, unsigned int threads = 0);
+
+	/**
+	 * Write the images as "<output>/<file name>.<target name>.img".
+	 */
+	void setOutputDirectory (const std::string &output);
+
+	/**
+	 * Process every file in \p paths.
+	 *
+	 * \returns the results in the same order as \p paths.
+	 */
+	std::vector<Result> run (const std::vector<std::string> &paths) const;
+
+	/**
+	 * Process the file at \p path on the calling thread.
+	 */
+	Result process (const std::string &path) const;
+
+private:
+	void check (const ProfileTarget &target, const std::string &path,
+		    Result &result) const;
+
+	std::vector<const ProfileTarget *> _targets;
+	unsigned int _threads;
+	std::string _output;
+};
+
+#endif
@@ -0,0 +1,509 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileBinary.h"
+
+#include <misc/Endian.h>
+
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+using namespace HIDPP;
+
+static const char Magic[4] = { 'H', 'P', 'P', 'B' };
+
+namespace
+{
+
+class Encoder
+{
+public:
+	std::vector<uint8_t> data;
+
+	template<typename T>
+	void put (T value)
+	{
+		pushLE (data, value);
+	}
+
+	void putString (const std::string &str)
+	{
+		put<uint32_t> (str.size ());
+		data.insert (data.end (), str.begin (), str.end ());
+	}
+
+	void putKey (const std::string &name)
+	{
+		auto it = keys.emplace (name, names.size ()).first;
+		if (it->second == names.size ()) {
+			if (names.size () > 0xffff)
+				throw std::runtime_error ("Too many setting names");
+			names.push_back (&it->first);
+		}
+		put<uint16_t> (it->second);
+	}
+
+	template<typename Map>
+	void putSettings (const Map &settings)
+	{
+		put<uint32_t> (settings.size ());
+		for (const auto &[name, value]: settings) {
+			putKey (name);
+			putSetting (value);
+		}
+	}
+
+	void putSetting (const Setting &setting)
+	{
+		put<uint8_t> (static_cast<uint8_t> (setting.type ()));
+		switch (setting.type ()) {
+		case Setting::Type::String:
+			putString (setting.get<std::string> ());
+			break;
+		case Setting::Type::Boolean:
+			put<uint8_t> (setting.get<bool> ());
+			break;
+		case Setting::Type::Integer:
+			put<int32_t> (setting.get<int> ());
+			break;
+		case Setting::Type::LEDVector: {
+			const auto &leds = setting.get<LEDVector> ();
+			put<uint32_t> (leds.size ());
+			for (bool led: leds)
+				put<uint8_t> (led);
+			break;
+		}
+		case Setting::Type::Color: {
+			const auto &color = setting.get<Color> ();
+			put<uint8_t> (color.r);
+			put<uint8_t> (color.g);
+			put<uint8_t> (color.b);
+			break;
+		}
+		case Setting::Type::ComposedSetting:
+			putSettings (setting.get<ComposedSetting> ());
+			break;
+		case Setting::Type::Enum:
+			put<int32_t> (setting.get<EnumValue> ().get ());
+			break;
+		}
+	}
+
+	void putAddress (const Address &address)
+	{
+		put<int32_t> (address.mem_type);
+		put<uint32_t> (address.page);
+		put<uint32_t> (address.offset);
+	}
+
+	void putButton (const Profile::Button &button)
+	{
+		uint32_t a = 0, b = 0;
+		Address address = { 0, 0, 0 };
+		switch (button.type ()) {
+		case Profile::Button::Type::Disabled:
+			break;
+		case Profile::Button::Type::MouseButtons:
+			a = button.mouseButtons ();
+			break;
+		case Profile::Button::Type::Key:
+			a = button.modifierKeys ();
+			b = button.key ();
+			break;
+		case Profile::Button::Type::ConsumerControl:
+			a = button.consumerControl ();
+			break;
+		case Profile::Button::Type::Special:
+			a = button.special ();
+			break;
+		case Profile::Button::Type::Macro:
+			address = button.macro ();
+			break;
+		}
+		put<uint8_t> (static_cast<uint8_t> (button.type ()));
+		put<uint32_t> (a);
+		put<uint32_t> (b);
+		putAddress (address);
+	}
+
+	void putMacro (const Macro &macro)
+	{
+		std::size_t count_pos = data.size ();
+		put<uint32_t> (0);
+		uint32_t count = 0;
+		for (const auto &item: macro) {
+			int32_t a = 0, b = 0;
+			switch (item.instruction ()) {
+			case Macro::Item::KeyPress:
+			case Macro::Item::KeyRelease:
+			case Macro::Item::ModifiersPress:
+			case Macro::Item::ModifiersRelease:
+			case Macro::Item::ModifiersKeyPress:
+			case Macro::Item::ModifiersKeyRelease:
+				a = item.keyCode ();
+				b = item.modifiers ();
+				break;
+			case Macro::Item::MouseWheel:
+			case Macro::Item::MouseHWheel:
+				a = item.wheel ();
+				break;
+			case Macro::Item::MouseButtonPress:
+			case Macro::Item::MouseButtonRelease:
+				a = item.buttons ();
+				break;
+			case Macro::Item::ConsumerControl:
+			case Macro::Item::ConsumerControlPress:
+			case Macro::Item::ConsumerControlRelease:
+				a = item.consumerControl ();
+				break;
+			case Macro::Item::Delay:
+			case Macro::Item::ShortDelay:
+			case Macro::Item::JumpIfReleased:
+				a = item.delay ();
+				break;
+			case Macro::Item::MousePointer:
+				a = item.mouseX ();
+				b = item.mouseY ();
+				break;
+			default:
+				break;
+			}
+			put<uint8_t> (item.instruction ());
+			put<int32_t> (a);
+			put<int32_t> (b);
+			put<int32_t> (item.jumpOffset ());
+			++count;
+		}
+		writeLE<uint32_t> (data.begin () + count_pos, count);
+	}
+
+	/**
+	 * Names in the order of their index.
+	 */
+	std::vector<const std::string *> names;
+
+private:
+	std::map<std::string, std::size_t> keys;
+};
+
+class Decoder
+{
+public:
+	Decoder (std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end,
+		 const std::vector<std::string> &names):
+		_it (begin), _end (end), _names (names)
+	{
+	}
+
+	std::size_t remaining () const
+	{
+		return _end - _it;
+	}
+
+	std::vector<uint8_t>::const_iterator take (std::size_t length)
+	{
+		if (remaining () < length)
+			throw std::runtime_error ("Truncated profile data");
+		auto it = _it;
+		_it += length;
+		return it;
+	}
+
+	template<typename T>
+	T get ()
+	{
+		return readLE<T> (take (sizeof (T)));
+	}
+
+	std::string getString ()
+	{
+		uint32_t length = get<uint32_t> ();
+		auto it = take (length);
+		return std::string (it, it + length);
+	}
+
+	const std::string &getKey ()
+	{
+		uint16_t index = get<uint16_t> ();
+		if (index >= _names.size ())
+			throw std::runtime_error ("Invalid setting name index");
+		return _names[index];
+	}
+
+	template<typename Map>
+	void getSettings (Map &settings, const std::map<std::string, SettingDesc> *descs)
+	{
+		uint32_t count = get<uint32_t> ();
+		for (uint32_t i = 0; i < count; ++i) {
+			const std::string &name = getKey ();
+			const SettingDesc *desc = nullptr;
+			if (descs) {
+				auto it = descs->find (name);
+				if (it != descs->end ())
+					desc = &it->second;
+			}
+			settings.emplace (name, getSetting (name, desc));
+		}
+	}
+
+	Setting getSetting (const std::string &name, const SettingDesc *desc)
+	{
+		switch (static_cast<Setting::Type> (get<uint8_t> ())) {
+		case Setting::Type::String:
+			return getString ();
+		case Setting::Type::Boolean:
+			return get<uint8_t> () != 0;
+		case Setting::Type::Integer:
+			return static_cast<int> (get<int32_t> ());
+		case Setting::Type::LEDVector: {
+			LEDVector leds (get<uint32_t> ());
+			auto it = take (leds.size ());
+			for (std::size_t i = 0; i < leds.size (); ++i)
+				leds[i] = it[i] != 0;
+			return leds;
+		}
+		case Setting::Type::Color: {
+			auto it = take (3);
+			return Color { it[0], it[1], it[2] };
+		}
+		case Setting::Type::ComposedSetting: {
+			if (!desc || !desc->isComposed ())
+				throw std::runtime_error ("Unknown composed setting: " + name);
+			std::map<std::string, SettingDesc> sub_descs (desc->begin (), desc->end ());
+			ComposedSetting composed;
+			getSettings (composed, &sub_descs);
+			return composed;
+		}
+		case Setting::Type::Enum: {
+			if (!desc || desc->type () != Setting::Type::Enum)
+				throw std::runtime_error ("Unknown enum setting: " + name);
+			return EnumValue (desc->enumDesc (), get<int32_t> ());
+		}
+		default:
+			throw std::runtime_error ("Invalid setting type");
+		}
+	}
+
+	Address getAddress ()
+	{
+		Address address;
+		address.mem_type = get<int32_t> ();
+		address.page = get<uint32_t> ();
+		address.offset = get<uint32_t> ();
+		return address;
+	}
+
+	Profile::Button getButton ()
+	{
+		auto type = static_cast<Profile::Button::Type> (get<uint8_t> ());
+		uint32_t a = get<uint32_t> ();
+		uint32_t b = get<uint32_t> ();
+		Address address = getAddress ();
+		switch (type) {
+		case Profile::Button::Type::Disabled:
+			return Profile::Button ();
+		case Profile::Button::Type::MouseButtons:
+			return Profile::Button (Profile::Button::MouseButtonsType (), a);
+		case Profile::Button::Type::Key:
+			return Profile::Button (static_cast<uint8_t> (a), static_cast<uint8_t> (b));
+		case Profile::Button::Type::ConsumerControl:
+			return Profile::Button (Profile::Button::ConsumerControlType (), a);
+		case Profile::Button::Type::Special:
+			return Profile::Button (Profile::Button::SpecialType (), a);
+		case Profile::Button::Type::Macro:
+			return Profile::Button (address);
+		default:
+			throw std::runtime_error ("Invalid button type");
+		}
+	}
+
+	Macro getMacro ()
+	{
+		Macro macro;
+		uint32_t count = get<uint32_t> ();
+		for (uint32_t i = 0; i < count; ++i) {
+			auto instr = static_cast<Macro::Item::Instruction> (get<uint8_t> ());
+			if (instr > Macro::Item::End)
+				throw std::runtime_error ("Invalid macro instruction");
+			int32_t a = get<int32_t> ();
+			int32_t b = get<int32_t> ();
+			int32_t jump = get<int32_t> ();
+			macro.emplace_back (instr);
+			auto &item = macro.back ();
+			switch (instr) {
+			case Macro::Item::KeyPress:
+			case Macro::Item::KeyRelease:
+				item.setKeyCode (a);
+				break;
+			case Macro::Item::ModifiersPress:
+			case Macro::Item::ModifiersRelease:
+				item.setModifiers (b);
+				break;
+			case Macro::Item::ModifiersKeyPress:
+			case Macro::Item::ModifiersKeyRelease:
+				item.setKeyCode (a);
+				item.setModifiers (b);
+				break;
+			case Macro::Item::MouseWheel:
+			case Macro::Item::MouseHWheel:
+				item.setWheel (a);
+				break;
+			case Macro::Item::MouseButtonPress:
+			case Macro::Item::MouseButtonRelease:
+				item.setButtons (a);
+				break;
+			case Macro::Item::ConsumerControl:
+			case Macro::Item::ConsumerControlPress:
+			case Macro::Item::ConsumerControlRelease:
+				item.setConsumerControl (a);
+				break;
+			case Macro::Item::Delay:
+			case Macro::Item::ShortDelay:
+			case Macro::Item::JumpIfReleased:
+				item.setDelay (a);
+				break;
+			case Macro::Item::MousePointer:
+				item.setMouseX (a);
+				item.setMouseY (b);
+				break;
+			default:
+				break;
+			}
+			if (item.isJump ()) {
+				if (jump < -static_cast<int64_t> (i) || jump >= static_cast<int64_t> (count - i))
+					throw std::runtime_error ("Invalid macro jump");
+				item.setJumpOffset (jump);
+			}
+		}
+		return macro;
+	}
+
+private:
+	std::vector<uint8_t>::const_iterator _it, _end;
+	const std::vector<std::string> &_names;
+};
+
+}
+
+ProfileBinary::ProfileBinary (const AbstractProfileFormat *profile_format,
+			      const AbstractProfileDirectoryFormat *profdir_format):
+	_profile_settings (profile_format->generalSettings ()),
+	_mode_settings (profile_format->modeSettings ()),
+	_entry_settings (profdir_format->settings ())
+{
+}
+
+std::vector<uint8_t> ProfileBinary::write (const ProfileDirectory &profdir,
+					   const std::vector<Profile> &profiles,
+					   const std::vector<std::vector<Macro>> &macros) const
+{
+	// Profiles are encoded first for collecting the setting names
+	Encoder body;
+	body.put<uint32_t> (profiles.size ());
+	for (std::size_t i = 0; i < profiles.size (); ++i) {
+		const auto &entry = profdir.entries.at (i);
+		const auto &profile = profiles[i];
+		std::size_t length_pos = body.data.size ();
+		body.put<uint32_t> (0);
+		body.putAddress (entry.profile_address);
+		body.putSettings (entry.settings);
+		body.putSettings (profile.settings);
+		body.put<uint32_t> (profile.modes.size ());
+		for (const auto &mode: profile.modes)
+			body.putSettings (mode);
+		body.put<uint32_t> (profile.buttons.size ());
+		for (std::size_t j = 0; j < profile.buttons.size (); ++j) {
+			const auto &button = profile.buttons[j];
+			body.putButton (button);
+			if (button.type () == Profile::Button::Type::Macro)
+				body.putMacro (macros.at (i).at (j));
+		}
+		writeLE<uint32_t> (body.data.begin () + length_pos,
+				   body.data.size () - length_pos - sizeof (uint32_t));
+	}
+
+	Encoder header;
+	header.data.assign (Magic, Magic + sizeof (Magic));
+	header.put<uint16_t> (Version);
+	header.put<uint16_t> (body.names.size ());
+	for (const std::string *name: body.names) {
+		header.put<uint16_t> (name->size ());
+		header.data.insert (header.data.end (), name->begin (), name->end ());
+	}
+	header.data.insert (header.data.end (), body.data.begin (), body.data.end ());
+	return std::move (header.data);
+}
+
+void ProfileBinary::read (const std::vector<uint8_t> &data,
+			  ProfileDirectory &profdir,
+			  std::vector<Profile> &profiles,
+			  std::vector<std::vector<Macro>> &macros) const
+{
+	std::vector<std::string> names;
+	Decoder decoder (data.begin (), data.end (), names);
+	auto magic = decoder.take (sizeof (Magic));
+	if (!std::equal (magic, magic + sizeof (Magic), Magic))
+		throw std::runtime_error ("Not binary profile data");
+	if (decoder.get<uint16_t> () != Version)
+		throw std::runtime_error ("Unsupported binary profile version");
+	uint16_t name_count = decoder.get<uint16_t> ();
+	for (unsigned int i = 0; i < name_count; ++i) {
+		uint16_t length = decoder.get<uint16_t> ();
+		auto it = decoder.take (length);
+		names.emplace_back (it, it + length);
+	}
+
+	profdir.entries.clear ();
+	profiles.clear ();
+	macros.clear ();
+	uint32_t count = decoder.get<uint32_t> ();
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t length = decoder.get<uint32_t> ();
+		auto begin = decoder.take (length);
+		Decoder record (begin, begin + length, names);
+
+		ProfileDirectory::Entry entry;
+		entry.profile_address = record.getAddress ();
+		record.getSettings (entry.settings, &_entry_settings);
+		Profile profile;
+		record.getSettings (profile.settings, &_profile_settings);
+		uint32_t mode_count = record.get<uint32_t> ();
+		for (uint32_t j = 0; j < mode_count; ++j) {
+			profile.modes.emplace_back ();
+			record.getSettings (profile.modes.back (), &_mode_settings);
+		}
+		std::vector<Macro> pmacros;
+		uint32_t button_count = record.get<uint32_t> ();
+		for (uint32_t j = 0; j < button_count; ++j) {
+			profile.buttons.push_back (record.getButton ());
+			if (profile.buttons.back ().type () == Profile::Button::Type::Macro)
+				pmacros.push_back (record.getMacro ());
+			else
+				pmacros.emplace_back ();
+		}
+		if (record.remaining () != 0)
+			throw std::runtime_error ("Invalid profile length");
+
+		profdir.entries.push_back (std::move (entry));
+		profiles.push_back (std::move (profile));
+		macros.push_back (std::move (pmacros));
+	}
+	if (decoder.remaining () != 0)
+		throw std::runtime_error ("Trailing data after profiles");
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROFILE_BINARY_H
+#define PROFILE_BINARY_H
+
+#include <hidpp/Profile.h>
+#include <hidpp/ProfileDirectory.h>
+#include <hidpp/Macro.h>
+#include <hidpp/AbstractProfileFormat.h>
+#include <hidpp/AbstractProfileDirectoryFormat.h>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Binary serialization of profiles, holding the same data as ProfileXML.
+ *
+ * Data starts with a magic, the format version and the table of the
+ * setting names used, settings refer to names by their index. Each
+ * profile follows, prefixed with its length in bytes: directory entry
+ * (address and settings), profile settings, modes, then buttons each
+ * followed by its macro for macro buttons. Integers are little endian
+ * and fixed size, strings are prefixed with their length.
+ *
+ * As with ProfileXML, setting descriptions of the formats are used for
+ * decoding enum values.
+ */
+class ProfileBinary
+{
+public:
+	static constexpr uint16_t Version = 1;
+
+	ProfileBinary (const HIDPP::AbstractProfileFormat *profile_format,
+		       const HIDPP::AbstractProfileDirectoryFormat *profdir_format);
+
+	/**
+	 * Encode the profiles with their entries in \p profdir and their
+	 * macros (one per button, see ProfileXML::write).
+	 */
+	std::vector<uint8_t> write (const HIDPP::ProfileDirectory &profdir,
+				    const std::vector<HIDPP::Profile> &profiles,
+				    const std::vector<std::vector<HIDPP::Macro>> &macros) const;
+	/**
+	 * Decode data written by write, replacing the content of
+	 * \p profdir, \p profiles and \p macros.
+	 *
+	 * \throws std::runtime_error if \p data is invalid or of another
+	 * version.
+	 */
+	void read (const std::vector<uint8_t> &data,
+		   HIDPP::ProfileDirectory &profdir,
+		   std::vector<HIDPP::Profile> &profiles,
+		   std::vector<std::vector<HIDPP::Macro>> &macros) const;
+
+private:
+	const std::map<std::string, HIDPP::SettingDesc> &_profile_settings;
+	const std::map<std::string, HIDPP::SettingDesc> &_mode_settings;
+	const std::map<std::string, HIDPP::SettingDesc> &_entry_settings;
+};
+
+#endif
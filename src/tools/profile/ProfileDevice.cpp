@@ -0,0 +1,206 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileDevice.h"
+
+#include "ProfileXML.h"
+#include "ProfileXMLStream.h"
+
+#include <hidpp10/Device.h>
+#include <hidpp20/Device.h>
+#include <hidpp10/ProfileDirectoryFormat.h>
+#include <hidpp20/ProfileDirectoryFormat.h>
+#include <hidpp10/ProfileFormat.h>
+#include <hidpp20/ProfileFormat.h>
+#include <hidpp10/MemoryMapping.h>
+#include <hidpp20/MemoryMapping.h>
+#include <hidpp10/MacroFormat.h>
+#include <hidpp20/MacroFormat.h>
+#include <hidpp10/DeviceInfo.h>
+#include <hidpp10/defs.h>
+#include <hidpp/MacroAllocator.h>
+#include <hidpp/SyncJournal.h>
+#include <misc/Log.h>
+#include <stdexcept>
+
+using namespace tinyxml2;
+
+ProfileDevice::ProfileDevice (HIDPP::Device &&generic_device)
+{
+	unsigned int major, minor;
+	std::tie (major, minor) = generic_device.protocolVersion ();
+
+	/*
+	 * HID++ 1.0
+	 */
+	if (major == 1 && minor == 0) {
+		auto dev = new HIDPP10::Device (std::move (generic_device));
+		const HIDPP10::MouseInfo *info = HIDPP10::getMouseInfo (dev->productID ());
+		device.reset (dev);
+		profdir_format = HIDPP10::getProfileDirectoryFormat (dev);
+		profile_format = HIDPP10::getProfileFormat (dev);
+		macro_format = HIDPP10::getMacroFormat (dev);
+		memory.reset (new HIDPP10::MemoryMapping (dev));
+		dir_address = HIDPP::Address { 0, 1, 0 };
+		prof_address = HIDPP::Address { 0, info->default_profile_page, 0 };
+		memory->pinPage (prof_address);
+		page_size = HIDPP10::PageSize;
+		offset_unit = 2;
+		page_count = 256;
+	}
+	/*
+	 * HID++ 2.0 and later
+	 */
+	else if (major >= 2) {
+		auto dev = new HIDPP20::Device (std::move (generic_device));
+		device.reset (dev);
+		profdir_format = HIDPP20::getProfileDirectoryFormat (dev);
+		profile_format = HIDPP20::getProfileFormat (dev);
+		macro_format = HIDPP20::getMacroFormat (dev);
+		auto mapping = new HIDPP20::MemoryMapping (dev);
+		memory.reset (mapping);
+		// Profiles and macros are mostly read in page order
+		mapping->setReadAhead (4);
+		dir_address = HIDPP::Address { HIDPP20::IOnboardProfiles::Writeable, 0, 0 };
+		prof_address = HIDPP::Address { HIDPP20::IOnboardProfiles::Writeable, 1, 0 };
+		try {
+			auto [mem_type, page] = HIDPP20::IOnboardProfiles (dev).getCurrentProfile ();
+			mapping->pinPage (HIDPP::Address { mem_type, page, 0 });
+		}
+		catch (std::exception &e) {
+			Log::debug () << "Failed to get current profile: " << e.what () << std::endl;
+		}
+		page_size = mapping->description ().sector_size;
+		offset_unit = 1;
+		page_count = mapping->description ().sector_count;
+	}
+	else
+		throw std::runtime_error ("Unsupported HID++ protocol version");
+	// Kept resident if a page budget is set
+	memory->pinPage (dir_address);
+	macro_cache = std::make_unique<HIDPP::MacroCache> (*macro_format, *memory);
+}
+
+void ProfileDevice::setSyncJournal (std::shared_ptr<HIDPP::SyncJournal> journal)
+{
+	if (auto mapping = dynamic_cast<HIDPP20::MemoryMapping *> (memory.get ())) {
+		mapping->setSyncJournal (std::move (journal));
+		return;
+	}
+	// HID++ 1.0 devices have no fingerprint, their model is used instead
+	char fingerprint[16];
+	snprintf (fingerprint, sizeof (fingerprint), "hidpp10-%04hx", device->productID ());
+	memory->setSyncJournal (std::move (journal), fingerprint);
+}
+
+void ProfileDevice::writeProfiles (const XMLElement *root)
+{
+	ProfileXML profxml (profile_format.get (), profdir_format.get ());
+	HIDPP::ProfileDiff::ProfileSet set;
+
+	HIDPP::Address address = prof_address;
+	const XMLElement *element = root->FirstChildElement ("profile");
+	while (element) {
+		set.profiles.emplace_back ();
+		auto &profile = set.profiles.back ();
+
+		set.directory.entries.push_back ({ address });
+		auto &entry = set.directory.entries.back ();
+
+		set.macros.emplace_back ();
+		auto &pmacros = set.macros.back ();
+
+		profxml.read (element, profile, entry, pmacros);
+
+		element = element->NextSiblingElement ("profile");
+		++address.page;
+	}
+	writeProfiles (set);
+}
+
+void ProfileDevice::writeProfiles (std::istream &input)
+{
+	ProfileXML profxml (profile_format.get (), profdir_format.get ());
+	ProfileXMLReader reader (profxml, input);
+	HIDPP::ProfileDiff::ProfileSet set;
+
+	HIDPP::Address address = prof_address;
+	while (true) {
+		HIDPP::Profile profile;
+		HIDPP::ProfileDirectory::Entry entry = { address };
+		std::vector<HIDPP::Macro> pmacros;
+		if (!reader.next (profile, entry, pmacros))
+			break;
+		set.profiles.push_back (std::move (profile));
+		set.directory.entries.push_back (std::move (entry));
+		set.macros.push_back (std::move (pmacros));
+		++address.page;
+	}
+	writeProfiles (set);
+}
+
+HIDPP::ProfileDiff::ProfileSet ProfileDevice::readProfiles ()
+{
+	HIDPP::ProfileDecoder decoder (*profdir_format, *profile_format, *macro_format);
+	return decoder.decode (*memory, dir_address, macro_cache.get ());
+}
+
+HIDPP::ProfileDirectory ProfileDevice::readProfiles (const HIDPP::ProfileDecoder::profile_handler &handler)
+{
+	HIDPP::ProfileDecoder decoder (*profdir_format, *profile_format, *macro_format);
+	return decoder.decode (*memory, dir_address, handler, macro_cache.get ());
+}
+
+void ProfileDevice::writeProfiles (HIDPP::ProfileDiff::ProfileSet &profiles)
+{
+	HIDPP::Address address = prof_address;
+	for (auto &entry: profiles.directory.entries) {
+		entry.profile_address = address;
+		++address.page;
+	}
+	for (unsigned int i = 0; i < profiles.profiles.size (); ++i)
+		for (unsigned int j = 0; j < profiles.profiles[i].buttons.size (); ++j)
+			if (profiles.profiles[i].buttons[j].type () == HIDPP::Profile::Button::Type::Macro)
+				profiles.macros[i][j].optimize (*macro_format);
+
+	// Only what differs from the current profiles is written
+	HIDPP::ProfileDiff::ProfileSet current;
+	try {
+		current = readProfiles ();
+	}
+	catch (std::exception &e) {
+		Log::warning () << "Failed to read current profiles, all of them are written: "
+				<< e.what () << std::endl;
+		current = HIDPP::ProfileDiff::ProfileSet ();
+	}
+
+	// Macro are written in the pages after profiles
+	HIDPP::MacroAllocator allocator (*macro_format, page_size, offset_unit);
+	for (HIDPP::Address page = address; page.page < page_count; ++page.page)
+		allocator.addPage (page);
+
+	HIDPP::ProfileDiff diff (*profile_format, *profdir_format, *macro_format);
+	auto plan = diff.apply (*memory, dir_address, current, profiles, allocator);
+	std::size_t bytes = 0;
+	for (const auto &write: plan)
+		for (const auto &range: write.ranges)
+			bytes += range.second - range.first;
+	Log::info () << "Writing " << bytes << " bytes in " << plan.size () << " pages" << std::endl;
+
+	memory->sync ();
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROFILE_DEVICE_H
+#define PROFILE_DEVICE_H
+
+#include <hidpp/Device.h>
+#include <hidpp/Address.h>
+#include <hidpp/AbstractMemoryMapping.h>
+#include <hidpp/AbstractProfileFormat.h>
+#include <hidpp/AbstractProfileDirectoryFormat.h>
+#include <hidpp/AbstractMacroFormat.h>
+#include <hidpp/MacroCache.h>
+#include <hidpp/ProfileDecoder.h>
+#include <hidpp/ProfileDiff.h>
+#include <hidpp/ProfileDirectory.h>
+#include <hidpp/Profile.h>
+#include <hidpp/Macro.h>
+#include <tinyxml2.h>
+#include <istream>
+#include <memory>
+#include <vector>
+
+/**
+ * Onboard profile memory of a HID++ 1.0 or 2.0 device, with its formats.
+ */
+struct ProfileDevice
+{
+	std::unique_ptr<HIDPP::Device> device;
+	std::unique_ptr<HIDPP::AbstractProfileDirectoryFormat> profdir_format;
+	std::unique_ptr<HIDPP::AbstractProfileFormat> profile_format;
+	std::unique_ptr<HIDPP::AbstractMemoryMapping> memory;
+	std::unique_ptr<HIDPP::AbstractMacroFormat> macro_format;
+	std::unique_ptr<HIDPP::MacroCache> macro_cache; ///< Macros read from memory, shared by every operation.
+	HIDPP::Address dir_address, prof_address;
+	std::size_t page_size;		///< Size in bytes of memory pages.
+	std::size_t offset_unit;	///< Size in bytes of an address offset unit.
+	unsigned int page_count;	///< Number of pages in memory.
+
+	/**
+	 * \throws std::runtime_error if the protocol version is not supported.
+	 */
+	ProfileDevice (HIDPP::Device &&generic_device);
+
+	/**
+	 * Journal the memory syncs in \p journal, so that an interrupted
+	 * write resumes from the first page not written (see
+	 * HIDPP::AbstractMemoryMapping::setSyncJournal).
+	 */
+	void setSyncJournal (std::shared_ptr<HIDPP::SyncJournal> journal);
+
+	/**
+	 * Write the profiles (and their macros) of the XML \p root element
+	 * and sync the memory.
+	 *
+	 * The current profiles are read first so that only their changes
+	 * are written (see HIDPP::ProfileDiff). Changed macros are placed by
+	 * HIDPP::MacroAllocator in the pages after the profiles.
+	 */
+	void writeProfiles (const tinyxml2::XMLElement *root);
+	/**
+	 * Same as above, but the profiles are read one at a time from the
+	 * XML file \p input (see ProfileXMLReader).
+	 *
+	 * \throws std::runtime_error if the XML is invalid.
+	 */
+	void writeProfiles (std::istream &input);
+	/**
+	 * Write already converted profiles (e.g. by ProfileBinary).
+	 *
+	 * Profiles are placed in the pages from prof_address, the entries
+	 * and the macro buttons of \p profiles are updated with their new
+	 * addresses. Only what differs from the profiles currently in
+	 * memory is written (see HIDPP::ProfileDiff).
+	 */
+	void writeProfiles (HIDPP::ProfileDiff::ProfileSet &profiles);
+
+	/**
+	 * Read the profiles in memory with their macros (parsed by
+	 * macro_cache, not simplified), decoded on several threads (see
+	 * HIDPP::ProfileDecoder).
+	 */
+	HIDPP::ProfileDiff::ProfileSet readProfiles ();
+	/**
+	 * Read the profiles one at a time, each is passed to \p handler
+	 * with its macros as soon as they are decoded (see
+	 * HIDPP::ProfileDecoder).
+	 *
+	 * \returns the profile directory.
+	 */
+	HIDPP::ProfileDirectory readProfiles (const HIDPP::ProfileDecoder::profile_handler &handler);
+};
+
+#endif
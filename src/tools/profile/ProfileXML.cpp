@@ -296,7 +296,13 @@ Setting readSetting (const XMLElement *element, const SettingDesc &desc)
 	}
 	else {
 		const char * text = element->GetText ();
-		return desc.convertFromString (text ? text : std::string ());
+		SettingDesc::Error error;
+		auto value = desc.tryConvertFromString (text ? text : "", error);
+		if (!value)
+			throw std::runtime_error (std::string ("Invalid value for setting ") +
+						  element->Name () + ": " +
+						  SettingDesc::errorString (error));
+		return std::move (*value);
 	}
 }
 
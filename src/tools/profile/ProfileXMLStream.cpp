@@ -0,0 +1,209 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ProfileXMLStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace HIDPP;
+using namespace tinyxml2;
+
+static constexpr std::size_t ChunkSize = 64*1024;
+
+ProfileXMLReader::ProfileXMLReader (ProfileXML &profxml, std::istream &input):
+	_profxml (profxml),
+	_input (input),
+	_pos (0),
+	_depth (0)
+{
+}
+
+bool ProfileXMLReader::next (Profile &profile, ProfileDirectory::Entry &entry, std::vector<Macro> &macros)
+{
+	std::size_t profile_begin = std::string::npos;
+	while (true) {
+		if (profile_begin == std::string::npos) {
+			// Drop what was scanned outside of any profile
+			_buffer.erase (0, _pos);
+			_pos = 0;
+		}
+		std::size_t begin;
+		std::string name;
+		switch (nextMarkup (begin, name)) {
+		case Markup::End:
+			if (_depth != 0)
+				throw std::runtime_error ("Unexpected end of XML");
+			return false;
+		case Markup::StartTag:
+			if (_depth == 1 && name == "profile")
+				profile_begin = begin;
+			++_depth;
+			break;
+		case Markup::EndTag:
+			if (_depth == 0)
+				throw std::runtime_error ("Unexpected end tag: " + name);
+			--_depth;
+			if (_depth == 1 && profile_begin != std::string::npos) {
+				readProfile (profile_begin, profile, entry, macros);
+				return true;
+			}
+			break;
+		case Markup::EmptyTag:
+			if (_depth == 1 && name == "profile") {
+				readProfile (begin, profile, entry, macros);
+				return true;
+			}
+			break;
+		case Markup::Other:
+			break;
+		}
+	}
+}
+
+void ProfileXMLReader::readProfile (std::size_t begin, Profile &profile, ProfileDirectory::Entry &entry, std::vector<Macro> &macros)
+{
+	XMLDocument doc;
+	doc.Parse (_buffer.data () + begin, _pos - begin);
+	if (doc.Error ())
+		throw std::runtime_error (std::string ("Error parsing XML: ") + doc.ErrorStr ());
+	profile = Profile ();
+	entry.settings.clear ();
+	macros.clear ();
+	_profxml.read (doc.RootElement (), profile, entry, macros);
+}
+
+ProfileXMLReader::Markup ProfileXMLReader::nextMarkup (std::size_t &begin, std::string &name)
+{
+	std::size_t pos;
+	while ((pos = _buffer.find ('<', _pos)) == std::string::npos) {
+		_pos = _buffer.size ();
+		if (!fill ())
+			return Markup::End;
+	}
+	begin = pos;
+	if (startsWith (pos, "<!--")) {
+		_pos = find ("-->", pos+4) + 3;
+		return Markup::Other;
+	}
+	if (startsWith (pos, "<![CDATA[")) {
+		_pos = find ("]]>", pos+9) + 3;
+		return Markup::Other;
+	}
+	if (startsWith (pos, "<?")) {
+		_pos = find ("?>", pos+2) + 2;
+		return Markup::Other;
+	}
+	if (startsWith (pos, "<!")) {
+		_pos = find (">", pos+2) + 1;
+		return Markup::Other;
+	}
+	bool end_tag = at (pos+1) == '/';
+	std::size_t i = end_tag ? pos+2 : pos+1;
+	name.clear ();
+	for (char c = at (i); !std::strchr (" \t\r\n/>", c); c = at (++i))
+		name.push_back (c);
+	// Skip attributes, '>' may appear in quoted values
+	char quote = 0;
+	for (char c = at (i); quote || c != '>'; c = at (++i)) {
+		if (quote) {
+			if (c == quote)
+				quote = 0;
+		}
+		else if (c == '"' || c == '\'')
+			quote = c;
+	}
+	_pos = i+1;
+	if (end_tag)
+		return Markup::EndTag;
+	return _buffer[i-1] == '/' ? Markup::EmptyTag : Markup::StartTag;
+}
+
+bool ProfileXMLReader::fill ()
+{
+	if (!_input)
+		return false;
+	std::size_t size = _buffer.size ();
+	_buffer.resize (size + ChunkSize);
+	_input.read (&_buffer[size], ChunkSize);
+	_buffer.resize (size + _input.gcount ());
+	return _input.gcount () > 0;
+}
+
+char ProfileXMLReader::at (std::size_t pos)
+{
+	while (pos >= _buffer.size ())
+		if (!fill ())
+			throw std::runtime_error ("Unexpected end of XML");
+	return _buffer[pos];
+}
+
+bool ProfileXMLReader::startsWith (std::size_t pos, const char *str)
+{
+	std::size_t length = std::strlen (str);
+	while (pos + length > _buffer.size ())
+		if (!fill ())
+			return false;
+	return _buffer.compare (pos, length, str) == 0;
+}
+
+std::size_t ProfileXMLReader::find (const char *str, std::size_t from)
+{
+	std::size_t length = std::strlen (str);
+	std::size_t pos;
+	while ((pos = _buffer.find (str, from)) == std::string::npos) {
+		if (_buffer.size () >= length)
+			from = std::max (from, _buffer.size () - length + 1);
+		if (!fill ())
+			throw std::runtime_error ("Unexpected end of XML");
+	}
+	return pos;
+}
+
+ProfileXMLWriter::ProfileXMLWriter (ProfileXML &profxml, std::ostream &output):
+	_profxml (profxml),
+	_output (output),
+	_finished (false)
+{
+	_output << "<profiles>\n";
+}
+
+ProfileXMLWriter::~ProfileXMLWriter ()
+{
+	if (!_finished)
+		finish ();
+}
+
+void ProfileXMLWriter::write (const Profile &profile, const ProfileDirectory::Entry &entry, const std::vector<Macro> &macros)
+{
+	XMLDocument doc;
+	XMLElement *element = doc.NewElement ("profile");
+	_profxml.write (profile, entry, macros, element);
+	doc.InsertEndChild (element);
+	// Indented as a child of the root element
+	XMLPrinter printer (nullptr, false, 1);
+	doc.Print (&printer);
+	_output << printer.CStr ();
+}
+
+void ProfileXMLWriter::finish ()
+{
+	_output << "</profiles>\n";
+	_finished = true;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2021 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROFILE_XML_STREAM_H
+#define PROFILE_XML_STREAM_H
+
+#include "ProfileXML.h"
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+/**
+ * Read the profile elements of a profile XML file one at a time.
+ *
+ * Only the markup is scanned until a profile element is complete, each
+ * profile is then parsed and converted with ProfileXML alone. Memory
+ * use is bounded by the size of a profile element, not of the file.
+ */
+class ProfileXMLReader
+{
+public:
+	/**
+	 * \p profxml and \p input must outlive the reader.
+	 */
+	ProfileXMLReader (ProfileXML &profxml, std::istream &input);
+
+	/**
+	 * Read the next profile element of the root element.
+	 *
+	 * \p profile, \p macros and the settings of \p entry are replaced,
+	 * the profile address is left unchanged.
+	 *
+	 * \returns false if there are no more profiles.
+	 *
+	 * \throws std::runtime_error if the XML is invalid.
+	 */
+	bool next (HIDPP::Profile &profile,
+		   HIDPP::ProfileDirectory::Entry &entry,
+		   std::vector<HIDPP::Macro> &macros);
+
+private:
+	enum class Markup
+	{
+		End,		///< End of input
+		StartTag,
+		EndTag,
+		EmptyTag,
+		Other,		///< Comment, CDATA, declaration, ...
+	};
+	/**
+	 * Skip to the end of the next markup, \p begin is set to its
+	 * start and \p name to its element name.
+	 */
+	Markup nextMarkup (std::size_t &begin, std::string &name);
+	/**
+	 * Convert the profile element from \p begin to the scanned position.
+	 */
+	void readProfile (std::size_t begin,
+			  HIDPP::Profile &profile,
+			  HIDPP::ProfileDirectory::Entry &entry,
+			  std::vector<HIDPP::Macro> &macros);
+	/**
+	 * Read more input in the buffer.
+	 *
+	 * \returns false at the end of the input.
+	 */
+	bool fill ();
+	/**
+	 * Character at \p pos in the buffer, reading it if needed.
+	 *
+	 * \throws std::runtime_error at the end of the input.
+	 */
+	char at (std::size_t pos);
+	bool startsWith (std::size_t pos, const char *str);
+	/**
+	 * Position of \p str in the buffer after \p from, reading until
+	 * it is found.
+	 *
+	 * \throws std::runtime_error at the end of the input.
+	 */
+	std::size_t find (const char *str, std::size_t from);
+
+	ProfileXML &_profxml;
+	std::istream &_input;
+	std::string _buffer;
+	std::size_t _pos;	///< Scanned part of the buffer
+	int _depth;		///< Element depth at _pos
+};
+
+/**
+ * Write profiles to a profile XML file one at a time.
+ *
+ * Every profile is converted and printed alone, nothing is kept after
+ * write returns.
+ */
+class ProfileXMLWriter
+{
+public:
+	/**
+	 * Write the start of the root element to \p output.
+	 *
+	 * \p profxml and \p output must outlive the writer.
+	 */
+	ProfileXMLWriter (ProfileXML &profxml, std::ostream &output);
+	/**
+	 * Calls finish if it was not called.
+	 */
+	~ProfileXMLWriter ();
+
+	void write (const HIDPP::Profile &profile,
+		    const HIDPP::ProfileDirectory::Entry &entry,
+		    const std::vector<HIDPP::Macro> &macros);
+
+	/**
+	 * Write the end of the root element.
+	 */
+	void finish ();
+
+private:
+	ProfileXML &_profxml;
+	std::ostream &_output;
+	bool _finished;
+};
+
+#endif